@@ -0,0 +1,543 @@
+/*
+ * Automatic engine selection for "--engine auto": a short trial of each
+ * way of moving the data that could apply to the input and output, after
+ * which the fastest is kept, and remembered for later inputs.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __APPLE__
+#include <sys/param.h>
+#include <sys/mount.h>
+#elif defined(__linux__)
+#include <sys/vfs.h>
+#endif
+
+/* How long each candidate engine is tried for, in nanoseconds. */
+#define PV_AUTOENGINE_PHASE_NSEC 100000000LL
+
+/* How much faster than the first candidate another has to be to win. */
+#define PV_AUTOENGINE_MARGIN 1.1L
+
+/* The most candidates there can be. */
+#define PV_AUTOENGINE_CANDIDATES 3
+
+/* The most winners remembered, in memory and in the cache file. */
+#define PV_AUTOENGINE_CACHE_ENTRIES 64
+
+/* Longest key describing an input and output pair. */
+#define PV_AUTOENGINE_KEY_SIZE 128
+
+/*
+ * The trial works by switching control.io_engine between "auto", which
+ * uses splice(), copy_file_range() or sendfile() wherever pv_transfer()
+ * can, "readwrite", and, for a regular input file, "mmap", for
+ * PV_AUTOENGINE_PHASE_NSEC each.  Each engine is rated by the bytes it
+ * wrote against the time spent inside its transfer calls, so that time
+ * spent waiting for the input or output to become ready, which the engine
+ * has no say in, doesn't count against it.  The fastest is then left in
+ * control.io_engine for the rest of that input.
+ *
+ * The winner is remembered against a key made from the type and
+ * filesystem of the input and of the output, so that the next input
+ * between the same kinds of file starts with the right engine straight
+ * away.  It is only kept in memory unless "--engine-cache" names a file
+ * to keep it in across runs.
+ */
+struct pvautoengine_entry_s {
+	char key[PV_AUTOENGINE_KEY_SIZE];	/* input and output description */
+	pvioengine_t engine;		 /* engine that won for this key */
+};
+
+struct pvautoengine_s {
+	struct pvautoengine_entry_s remembered[PV_AUTOENGINE_CACHE_ENTRIES];	/* winners so far, as a ring */
+	char key[PV_AUTOENGINE_KEY_SIZE];	/* input and output description */
+	pvioengine_t candidate[PV_AUTOENGINE_CANDIDATES];	/* engines to try */
+	long double rate[PV_AUTOENGINE_CANDIDATES];	/* bytes per second of each */
+	long long phase_start;		 /* coarse clock at start of phase */
+	long long phase_busy_nsec;	 /* time inside transfer calls this phase */
+	off_t phase_written;		 /* bytes written by those calls */
+	dev_t input_dev;		 /* device of the input the choice is for */
+	ino_t input_ino;		 /* inode of the input the choice is for */
+	unsigned int remembered_count;	 /* number of winners ever remembered */
+	unsigned int candidates;	 /* number of candidates */
+	unsigned int phase;		 /* index of the candidate being tried */
+	int input_file;			 /* index of the input the choice is for */
+	int fd;				 /* input fd the choice was made for */
+	bool trialling;			 /* set while the trial is running */
+};
+
+/* Names used in the cache file, which are the same as for "--engine". */
+/*@observer@ */
+static const char *pv__autoengine_name(pvioengine_t engine)
+{
+	switch (engine) {
+	case PV_IOENGINE_READWRITE:
+		return "readwrite";
+	case PV_IOENGINE_MMAP:
+		return "mmap";
+	case PV_IOENGINE_IO_URING:
+		return "io_uring";
+	case PV_IOENGINE_AUTO:
+	default:
+		break;
+	}
+	return "auto";
+}
+
+
+/*
+ * Describe the type and filesystem of "fd" into "buf".
+ */
+static void pv__autoengine_describe_fd(int fd, char *buf, size_t bufsize)
+{
+	struct stat sb;
+	const char *type;
+
+	memset(&sb, 0, sizeof(sb));
+	if (0 != fstat(fd, &sb)) {
+		(void) pv_snprintf(buf, bufsize, "%s", "unknown");
+		return;
+	}
+
+	if (S_ISREG(sb.st_mode)) {
+		type = "file";
+	} else if (S_ISFIFO(sb.st_mode)) {
+		type = "pipe";
+	} else if (S_ISSOCK(sb.st_mode)) {
+		type = "socket";
+	} else if (S_ISCHR(sb.st_mode)) {
+		type = "chr";
+	} else if (S_ISBLK(sb.st_mode)) {
+		type = "blk";
+	} else {
+		type = "other";
+	}
+
+	/* Pipes and sockets aren't on a filesystem that matters here. */
+	if (!(S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode))) {
+		(void) pv_snprintf(buf, bufsize, "%s", type);
+		return;
+	}
+#ifdef __APPLE__
+	{
+		struct statfs fs;
+		memset(&fs, 0, sizeof(fs));
+		if (0 == fstatfs(fd, &fs)) {
+			fs.f_fstypename[sizeof(fs.f_fstypename) - 1] = '\0';
+			(void) pv_snprintf(buf, bufsize, "%s:%s", type, fs.f_fstypename);
+			return;
+		}
+	}
+#elif defined(__linux__)
+	{
+		struct statfs fs;
+		memset(&fs, 0, sizeof(fs));
+		if (0 == fstatfs(fd, &fs)) {
+			(void) pv_snprintf(buf, bufsize, "%s:%lx", type, (unsigned long) (fs.f_type));
+			return;
+		}
+	}
+#endif
+	(void) pv_snprintf(buf, bufsize, "%s", type);
+}
+
+
+/*
+ * Look up "key" in the "--engine-cache" file, returning true and filling
+ * in *engine if it was found.
+ */
+static bool pv__autoengine_cache_lookup(const char *filename, const char *key, pvioengine_t *engine)
+{
+	char line[256];			 /* flawfinder: ignore */
+	FILE *fptr;
+	bool found;
+
+	/* flawfinder: buffers are bounded and always terminated. */
+
+	fptr = fopen(filename, "r");	    /* flawfinder: ignore */
+	/* flawfinder rationale: the file is only ever read as text. */
+	if (NULL == fptr)
+		return false;
+
+	found = false;
+	while (NULL != fgets(line, (int) sizeof(line), fptr)) {
+		char *separator;
+
+		line[sizeof(line) - 1] = '\0';
+		line[strcspn(line, "\r\n")] = '\0';
+		separator = strrchr(line, ' ');
+		if (NULL == separator)
+			continue;
+		*separator = '\0';
+		if (0 != strcmp(line, key))
+			continue;
+		separator++;
+		if (0 == strcmp(separator, "readwrite")) {
+			*engine = PV_IOENGINE_READWRITE;
+			found = true;
+		} else if (0 == strcmp(separator, "mmap")) {
+			*engine = PV_IOENGINE_MMAP;
+			found = true;
+		} else if (0 == strcmp(separator, "auto")) {
+			*engine = PV_IOENGINE_AUTO;
+			found = true;
+		}
+	}
+
+	(void) fclose(fptr);
+
+	return found;
+}
+
+
+/*
+ * Store "engine" against "key" in the "--engine-cache" file, replacing any
+ * earlier entry for it, and dropping the oldest entries if there are too
+ * many.  The file is rewritten through a temporary file so that other
+ * instances never see it half written.
+ */
+static void pv__autoengine_cache_store(const char *filename, const char *key, pvioengine_t engine)
+{
+	char temp_filename[4200];	 /* flawfinder: ignore */
+	char lines[PV_AUTOENGINE_CACHE_ENTRIES][256];	/* flawfinder: ignore */
+	unsigned int line_count, first_line, idx;
+	size_t key_length;
+	FILE *fptr;
+
+	/* flawfinder: buffers are bounded and always terminated. */
+
+	key_length = strlen(key);	    /* flawfinder: ignore */
+	line_count = 0;
+
+	fptr = fopen(filename, "r");	    /* flawfinder: ignore */
+	if (NULL != fptr) {
+		char line[256];		 /* flawfinder: ignore */
+		while (NULL != fgets(line, (int) sizeof(line), fptr)) {
+			line[sizeof(line) - 1] = '\0';
+			line[strcspn(line, "\r\n")] = '\0';
+			if ('\0' == line[0])
+				continue;
+			if ((0 == strncmp(line, key, key_length)) && (' ' == line[key_length]))
+				continue;
+			/* Keep the newest entries, as a ring. */
+			(void) pv_snprintf(lines[line_count % PV_AUTOENGINE_CACHE_ENTRIES], sizeof(lines[0]), "%s",
+					   line);
+			line_count++;
+		}
+		(void) fclose(fptr);
+	}
+
+	if (pv_snprintf(temp_filename, sizeof(temp_filename), "%s.%lu", filename, (unsigned long) getpid()) >=
+	    (int) sizeof(temp_filename)) {
+		pv_error("%s: %s", filename, strerror(ENAMETOOLONG));
+		return;
+	}
+	fptr = fopen(temp_filename, "w");   /* flawfinder: ignore */
+	/* flawfinder rationale: the temporary file is only renamed over the cache. */
+	if (NULL == fptr) {
+		pv_error("%s: %s", temp_filename, strerror(errno));
+		return;
+	}
+
+	first_line = 0;
+	if (line_count >= PV_AUTOENGINE_CACHE_ENTRIES) {
+		first_line = line_count - (PV_AUTOENGINE_CACHE_ENTRIES - 1);
+	}
+	for (idx = first_line; idx < line_count; idx++)
+		(void) fprintf(fptr, "%s\n", lines[idx % PV_AUTOENGINE_CACHE_ENTRIES]);
+	(void) fprintf(fptr, "%s %s\n", key, pv__autoengine_name(engine));
+
+	if (0 != fclose(fptr)) {
+		pv_error("%s: %s", temp_filename, strerror(errno));
+		(void) remove(temp_filename);
+		return;
+	}
+	if (0 != rename(temp_filename, filename)) {
+		pv_error("%s: %s", filename, strerror(errno));
+		(void) remove(temp_filename);
+	}
+}
+
+
+/*
+ * Look up "key" among the winners remembered so far, returning true and
+ * filling in *engine if it was found.
+ */
+static bool pv__autoengine_remembered(const struct pvautoengine_s *autoengine, const char *key,
+				      pvioengine_t *engine)
+{
+	unsigned int count, idx;
+
+	count = autoengine->remembered_count;
+	if (count > PV_AUTOENGINE_CACHE_ENTRIES)
+		count = PV_AUTOENGINE_CACHE_ENTRIES;
+
+	for (idx = 0; idx < count; idx++) {
+		if (0 != strcmp(autoengine->remembered[idx].key, key))
+			continue;
+		*engine = autoengine->remembered[idx].engine;
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * Remember "engine" as the winner for "key", replacing the oldest winner
+ * if there is no more room.
+ */
+static void pv__autoengine_remember(struct pvautoengine_s *autoengine, const char *key, pvioengine_t engine)
+{
+	struct pvautoengine_entry_s *entry;
+
+	entry = &(autoengine->remembered[autoengine->remembered_count % PV_AUTOENGINE_CACHE_ENTRIES]);
+	(void) pv_snprintf(entry->key, sizeof(entry->key), "%s", key);
+	entry->engine = engine;
+	autoengine->remembered_count++;
+}
+
+
+/*
+ * Switch control.io_engine to "engine", letting go of any memory mapping
+ * if the mmap engine is being left, since the input's file position moves
+ * on without it.
+ */
+static void pv__autoengine_apply(pvstate_t state, pvioengine_t engine)
+{
+#ifdef HAVE_MMAP
+	if ((PV_IOENGINE_MMAP != engine) && (NULL != state->transfer.mmapin))
+		pv_mmapin_stop(&(state->transfer));
+#endif
+	state->control.io_engine = engine;
+}
+
+
+/*
+ * Start choosing an engine for the new input "fd", whose details are in
+ * "sb": from an earlier winner for the same kinds of input and output if
+ * there is one, otherwise by starting a trial.
+ */
+static void pv__autoengine_new_input(pvstate_t state, struct pvautoengine_s *autoengine, int fd,
+				     const struct stat *sb)
+{
+	char input_desc[PV_AUTOENGINE_KEY_SIZE];	/* flawfinder: ignore */
+	char output_desc[PV_AUTOENGINE_KEY_SIZE];	/* flawfinder: ignore */
+	pvioengine_t cached;
+
+	/* flawfinder: buffers are bounded by pv_snprintf(). */
+
+	autoengine->input_file = state->status.current_input_file;
+	autoengine->input_dev = sb->st_dev;
+	autoengine->input_ino = sb->st_ino;
+	autoengine->fd = fd;
+	autoengine->trialling = false;
+	pv__autoengine_apply(state, PV_IOENGINE_AUTO);
+
+	/*
+	 * When the rate is limited, or the data has to pass through the
+	 * buffer anyway, there's nothing to choose between.
+	 */
+	if ((state->control.rate_limit > 0) || state->control.linemode || state->control.discard_input
+	    || (PV_CODEC_NONE != state->control.codec) || (state->control.pipeline_buffers > 0)
+	    || (NULL != state->control.rescue_map)
+	    || state->display.showing_last_written || state->display.showing_previous_line)
+		return;
+
+	pv__autoengine_describe_fd(fd, input_desc, sizeof(input_desc));
+	pv__autoengine_describe_fd(state->control.output_fd, output_desc, sizeof(output_desc));
+	(void) pv_snprintf(autoengine->key, sizeof(autoengine->key), "%s>%s", input_desc, output_desc);
+
+	cached = PV_IOENGINE_AUTO;
+	if (pv__autoengine_remembered(autoengine, autoengine->key, &cached)) {
+		debug("%s: %s: %s", autoengine->key, "engine from earlier trial", pv__autoengine_name(cached));
+		pv__autoengine_apply(state, cached);
+		return;
+	}
+	if ((NULL != state->control.engine_cache)
+	    && pv__autoengine_cache_lookup(state->control.engine_cache, autoengine->key, &cached)) {
+		debug("%s: %s: %s", autoengine->key, "engine from cache file", pv__autoengine_name(cached));
+		pv__autoengine_remember(autoengine, autoengine->key, cached);
+		pv__autoengine_apply(state, cached);
+		return;
+	}
+
+	autoengine->candidates = 0;
+	if (!state->control.no_splice)
+		autoengine->candidate[autoengine->candidates++] = PV_IOENGINE_AUTO;
+	autoengine->candidate[autoengine->candidates++] = PV_IOENGINE_READWRITE;
+#ifdef HAVE_MMAP
+	if ((0 == state->control.skip_errors) && S_ISREG(sb->st_mode))
+		autoengine->candidate[autoengine->candidates++] = PV_IOENGINE_MMAP;
+#endif
+
+	if (autoengine->candidates < 2)
+		return;
+
+	debug("%s: %s (%u)", autoengine->key, "starting engine trial", autoengine->candidates);
+
+	autoengine->trialling = true;
+	autoengine->phase = 0;
+	autoengine->phase_start = pv_elapsedtime_coarse_nsec();
+	autoengine->phase_busy_nsec = 0;
+	autoengine->phase_written = 0;
+	pv__autoengine_apply(state, autoengine->candidate[0]);
+}
+
+
+/*
+ * For "--engine auto", choose the engine pv_transfer() uses for "fd",
+ * moving the trial on to its next candidate, or to its conclusion, once
+ * the current one has run for long enough.  This is called before every
+ * transfer, and does nothing once the choice for this input has been
+ * made.
+ *
+ * Returns true while a trial is running, in which case the caller should
+ * time the transfer and pass the result to pv_autoengine_measured().
+ */
+bool pv_autoengine_select(pvstate_t state, int fd)
+{
+	struct pvautoengine_s *autoengine;
+	long long now;
+	unsigned int idx, best;
+
+	autoengine = state->transfer.autoengine;
+
+	if (NULL == autoengine) {
+		if (PV_IOENGINE_AUTO != state->control.io_engine)
+			return false;
+		autoengine = calloc(1, sizeof(*autoengine));
+		if (NULL == autoengine)
+			return false;
+		autoengine->input_file = -1;
+		autoengine->fd = -1;
+		state->transfer.autoengine = autoengine;
+	}
+
+	/*
+	 * The same file descriptor number is reused for one input after
+	 * another, so a new input is told apart by its index in the file
+	 * list, or, if the descriptor has changed under the same index, by
+	 * its device and inode.
+	 */
+	if ((state->status.current_input_file != autoengine->input_file) || (fd != autoengine->fd)) {
+		struct stat sb;
+
+		memset(&sb, 0, sizeof(sb));
+		(void) fstat(fd, &sb);
+		if ((state->status.current_input_file != autoengine->input_file) || (sb.st_dev != autoengine->input_dev)
+		    || (sb.st_ino != autoengine->input_ino)) {
+			pv__autoengine_new_input(state, autoengine, fd, &sb);
+			return autoengine->trialling;
+		}
+		autoengine->fd = fd;
+	}
+
+	if (!autoengine->trialling)
+		return false;
+
+	now = pv_elapsedtime_coarse_nsec();
+	if (now - autoengine->phase_start < PV_AUTOENGINE_PHASE_NSEC)
+		return true;
+
+	autoengine->rate[autoengine->phase] = 0.0L;
+	if (autoengine->phase_busy_nsec > 0) {
+		autoengine->rate[autoengine->phase] =
+		    ((long double) (autoengine->phase_written)) * 1000000000.0L /
+		    (long double) (autoengine->phase_busy_nsec);
+	}
+
+	debug("%s: %s: %.0Lf B/s", autoengine->key, pv__autoengine_name(autoengine->candidate[autoengine->phase]),
+	      autoengine->rate[autoengine->phase]);
+
+	autoengine->phase++;
+	autoengine->phase_start = now;
+	autoengine->phase_busy_nsec = 0;
+	autoengine->phase_written = 0;
+
+	if (autoengine->phase < autoengine->candidates) {
+		pv__autoengine_apply(state, autoengine->candidate[autoengine->phase]);
+		return true;
+	}
+
+	autoengine->trialling = false;
+
+	/*
+	 * If any candidate moved nothing in its turn - because the input or
+	 * output stalled - the trial says nothing about the engines, so the
+	 * first candidate is kept and nothing is remembered.
+	 */
+	for (idx = 0; idx < autoengine->candidates; idx++) {
+		if (autoengine->rate[idx] <= 0.0L) {
+			debug("%s: %s", autoengine->key, "engine trial inconclusive");
+			pv__autoengine_apply(state, autoengine->candidate[0]);
+			return false;
+		}
+	}
+
+	/*
+	 * The first candidate is what "auto" would have used anyway, so
+	 * another only wins by a clear margin, rather than by the noise of a
+	 * short trial.
+	 */
+	best = 0;
+	for (idx = 1; idx < autoengine->candidates; idx++) {
+		if (autoengine->rate[idx] > autoengine->rate[best] * PV_AUTOENGINE_MARGIN)
+			best = idx;
+	}
+
+	pv__autoengine_apply(state, autoengine->candidate[best]);
+
+	debug("%s: %s: %s", autoengine->key, "engine trial winner", pv__autoengine_name(autoengine->candidate[best]));
+
+	pv__autoengine_remember(autoengine, autoengine->key, autoengine->candidate[best]);
+	if (NULL != state->control.engine_cache)
+		pv__autoengine_cache_store(state->control.engine_cache, autoengine->key, autoengine->candidate[best]);
+
+	return false;
+}
+
+
+/*
+ * Add a transfer made during a trial, which took "nsec" nanoseconds and
+ * returned "written", to the measurements for the current candidate.
+ */
+void pv_autoengine_measured(pvstate_t state, long long nsec, ssize_t written)
+{
+	struct pvautoengine_s *autoengine;
+
+	autoengine = state->transfer.autoengine;
+	if ((NULL == autoengine) || (!autoengine->trialling))
+		return;
+
+	if (nsec > 0)
+		autoengine->phase_busy_nsec += nsec;
+	if (written > 0)
+		autoengine->phase_written += (off_t) written;
+}
+
+
+/*
+ * Free the automatic engine selection state.
+ */
+void pv_autoengine_free(pvtransferstate_t transfer)
+{
+	if (NULL == transfer->autoengine)
+		return;
+	free(transfer->autoengine);
+	transfer->autoengine = NULL;
+}
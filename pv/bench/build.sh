@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# Build pvbench from the same sources as pv, leaving out pv's own main().
+#
+jb="/var/jb"
+ARCH="arm64"
+
+cd "$(dirname "$0")" || exit 1
+
+if [ $(uname -n) = iPhone ]; then
+    cc -lc -lc++ \
+       $(ls ../*.c | grep -v '^\.\./main\.c$') \
+       ../format/*.c \
+       pvbench.c \
+       -I.. \
+       -I../format \
+       -I../../include \
+       -I"$jb/usr/include" \
+       -I"$theos_sdk/usr/include" \
+       -L"$jb/usr/lib" \
+       -L/usr/lib \
+       -I/$jb/usr/include/ncursesw \
+       -I../ncursesw \
+       -I../xun-kernel-include \
+       -Wl,-undefined,dynamic_lookup \
+       -o "pvbench" && ldid -M -Hsha256 -S../ens.plist pvbench
+else
+    echo "[Error]: this not iPhone"
+    exit 1
+fi
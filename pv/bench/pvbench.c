@@ -0,0 +1,849 @@
+/*
+ * Benchmark harness: run pv_main_loop() over a matrix of I/O engines,
+ * buffer sizes, modes, inputs and outputs, and report the results as one
+ * JSON object per line.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+ * Each case is run in a child process of its own, so that nothing - the
+ * signal handlers, the transfer state, the page cache hints - carries
+ * over from one case to the next.  A pipe input is fed by another child
+ * copying the input file into it, and a pipe output is drained by a third,
+ * so that the time measured covers the whole of the data getting through.
+ *
+ * The groups of cases are:
+ *
+ *   engine   every engine, with file and pipe inputs, /dev/null, file,
+ *            and pipe outputs, three buffer sizes, and byte and line mode
+ *   sparse   a file with holes copied to a file, with and without --sparse
+ *   rate     how close -L gets to its target, over /dev/null and a pipe
+ *   display  the cost of the progress display at different intervals
+ *   startup  how long a built pv binary takes to start up and copy a
+ *            tiny input, with and without a display, against cat(1)
+ *
+ * The results go to standard output, one line per case, with the median
+ * and best of the runs, so that they can be collected from several hosts
+ * and compared over time.
+ */
+#define PVBENCH_DEFAULT_SIZE	((off_t) 256 * 1024 * 1024)
+#define PVBENCH_DEFAULT_RUNS	3
+#define PVBENCH_MAX_RUNS	99
+#define PVBENCH_COPY_SIZE	(128 * 1024)	/* feeder and drainer chunk size */
+#define PVBENCH_LINE_LENGTH	64		/* average line length of the input */
+#define PVBENCH_HOLE_SPACING	(4 * 1024 * 1024)	/* data every 4MiB in the sparse input */
+#define PVBENCH_RATE_SECONDS	2		/* how long each rate case should take */
+#define PVBENCH_STARTUP_SIZE	1024		/* size of the startup cases' input */
+#define PVBENCH_STARTUP_EXECS	100		/* commands run per startup run */
+
+typedef enum {
+	PVBENCH_IO_FILE,
+	PVBENCH_IO_PIPE,
+	PVBENCH_IO_NULL
+} pvbench_io_t;
+
+struct pvbench_engine_s {
+	const char *name;
+	pvioengine_t engine;
+	bool no_splice;
+};
+
+struct pvbench_case_s {
+	const char *group;		 /* which group of cases this is in */
+	const struct pvbench_engine_s *engine; /* engine to transfer with */
+	/*@observer@ */ const char *input_file; /* file to read, or feed a pipe from */
+	off_t size;			 /* size of the input */
+	pvbench_io_t input;		 /* what to read from */
+	pvbench_io_t output;		 /* what to write to */
+	size_t buffer_size;		 /* -B size, or 0 for the default */
+	off_t rate_limit;		 /* -L rate, or 0 for none */
+	double interval;		 /* display interval, or 0 for no display */
+	bool linemode;			 /* line mode instead of byte mode */
+	bool sparse;			 /* --sparse */
+	bool stop_at_size;		 /* stop after "size" bytes of the input */
+};
+
+struct pvbench_result_s {
+	double seconds;			 /* wall clock time */
+	double user_seconds;		 /* user CPU time of the pv process */
+	double system_seconds;		 /* system CPU time of the pv process */
+	int status;			 /* exit status of the pv process */
+};
+
+static const struct pvbench_engine_s pvbench_engines[] = {
+	{ "readwrite", PV_IOENGINE_READWRITE, true },
+	{ "splice", PV_IOENGINE_AUTO, false },
+#ifdef HAVE_MMAP
+	{ "mmap", PV_IOENGINE_MMAP, false },
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+	{ "io_uring", PV_IOENGINE_IO_URING, false },
+#endif
+	{ NULL, PV_IOENGINE_AUTO, false }
+};
+
+static const size_t pvbench_buffer_sizes[] = { 0, 64 * 1024, 1024 * 1024 };
+
+static /*@observer@ */ const char *pvbench_output_dir = "/tmp";
+static /*@observer@ */ const char *pvbench_pv_binary = "pv";
+static unsigned int pvbench_runs = PVBENCH_DEFAULT_RUNS;
+
+
+/*
+ * Return the name of an input or output type.
+ */
+static const char *pvbench_io_name(pvbench_io_t io)
+{
+	switch (io) {
+	case PVBENCH_IO_FILE:
+		return "file";
+	case PVBENCH_IO_PIPE:
+		return "pipe";
+	case PVBENCH_IO_NULL:
+		return "null";
+	}
+	return "?";
+}
+
+
+/*
+ * Return the current monotonic time in seconds.
+ */
+static double pvbench_now(void)
+{
+	struct timespec now;
+
+	memset(&now, 0, sizeof(now));
+	(void) clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (double) (now.tv_sec) + ((double) (now.tv_nsec) / 1000000000.0);
+}
+
+
+/*
+ * Write "count" bytes from "buffer" to "fd", returning false on error.
+ */
+static bool pvbench_write_all(int fd, const char *buffer, size_t count)
+{
+	while (count > 0) {
+		ssize_t written = write(fd, buffer, count);
+		if ((written < 0) && (EINTR == errno))
+			continue;
+		if (written <= 0)
+			return false;
+		buffer += written;
+		count -= (size_t) written;
+	}
+	return true;
+}
+
+
+/*
+ * Create the input file "path" of "size" bytes.  If "sparse" is false it
+ * is filled with printable text in lines of varying length, which neither
+ * compresses to nothing nor counts as zeroes; otherwise it is a file with
+ * holes, with a block of text every PVBENCH_HOLE_SPACING bytes.  Returns
+ * false on error, after reporting it.
+ */
+static bool pvbench_make_input(const char *path, off_t size, bool sparse)
+{
+	char buffer[PVBENCH_COPY_SIZE];	/* flawfinder: ignore - always bounded */
+	unsigned long seed;
+	off_t offset;
+	size_t buffer_idx;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);	/* flawfinder: ignore */
+	/* flawfinder - the path is inside the directory we were given. */
+	if (fd < 0) {
+		fprintf(stderr, "pvbench: %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	seed = 12345;
+	for (buffer_idx = 0; buffer_idx < sizeof(buffer); buffer_idx++) {
+		seed = seed * 1103515245UL + 12345UL;
+		if (0 == ((seed >> 16) % PVBENCH_LINE_LENGTH)) {
+			buffer[buffer_idx] = '\n';
+		} else {
+			buffer[buffer_idx] = (char) (' ' + ((seed >> 16) % 95));
+		}
+	}
+
+	for (offset = 0; offset < size; offset += (off_t) sizeof(buffer)) {
+		size_t chunk = sizeof(buffer);
+
+		if (sparse) {
+			if (0 != (offset % PVBENCH_HOLE_SPACING))
+				continue;
+			if (lseek(fd, offset, SEEK_SET) < 0)
+				break;
+		}
+		if ((off_t) chunk > size - offset)
+			chunk = (size_t) (size - offset);
+		if (!pvbench_write_all(fd, buffer, chunk))
+			break;
+	}
+
+	if ((offset < size) || (0 != ftruncate(fd, size)) || (0 != close(fd))) {
+		fprintf(stderr, "pvbench: %s: %s\n", path, strerror(errno));
+		(void) close(fd);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Copy everything from "fd_in" to "fd_out" (or nowhere, if it is -1), and
+ * exit - used by the feeder and drainer processes.
+ */
+static void pvbench_copy_and_exit(int fd_in, int fd_out)
+{
+	static char buffer[PVBENCH_COPY_SIZE];	/* flawfinder: ignore - always bounded */
+	ssize_t nread;
+
+	while ((nread = read(fd_in, buffer, sizeof(buffer))) != 0) {	/* flawfinder: ignore */
+		/* flawfinder - bounded by the buffer size. */
+		if ((nread < 0) && (EINTR == errno))
+			continue;
+		if (nread < 0)
+			_exit(1);
+		if ((fd_out >= 0) && (!pvbench_write_all(fd_out, buffer, (size_t) nread)))
+			_exit(1);
+	}
+
+	_exit(0);
+}
+
+
+/*
+ * Run the transfer of one case in this process, reading from "input_fd"
+ * (or the case's input file, if it is -1) and writing to "output_fd", and
+ * exit with pv_main_loop()'s exit status.
+ */
+static void pvbench_transfer_and_exit(const struct pvbench_case_s *bench, int input_fd, int output_fd)
+{
+	const char *input_names[1];
+	pvstate_t state;
+	int null_fd, rc;
+
+	/* The display, if any, is drawn but not looked at. */
+	null_fd = open("/dev/null", O_WRONLY);	/* flawfinder: ignore */
+	/* flawfinder - constant path. */
+	if (null_fd >= 0) {
+		(void) dup2(null_fd, STDERR_FILENO);
+		(void) close(null_fd);
+	}
+
+	input_names[0] = bench->input_file;
+	if (input_fd >= 0) {
+		(void) dup2(input_fd, STDIN_FILENO);
+		(void) close(input_fd);
+		input_names[0] = "-";
+	}
+
+	pv_set_error_prefix("pvbench");
+
+	state = pv_state_alloc();
+	if (NULL == state)
+		_exit(PV_ERROREXIT_MEMORY);
+
+	pv_state_inputfiles(state, 1, input_names);
+	pv_state_sparse_output_set(state, bench->sparse);
+	pv_state_output_set(state, output_fd, pvbench_io_name(bench->output));
+	pv_state_interval_set(state, bench->interval > 0 ? bench->interval : 1.0);
+	pv_state_width_set(state, 80, true);
+	pv_state_height_set(state, 25, true);
+	pv_state_no_display_set(state, bench->interval <= 0);
+	pv_state_force_set(state, bench->interval > 0);
+	pv_state_linemode_set(state, bench->linemode);
+	pv_state_rate_limit_set(state, bench->rate_limit);
+	pv_state_target_buffer_size_set(state, bench->buffer_size);
+	pv_state_no_splice_set(state, bench->engine->no_splice);
+	pv_state_io_engine_set(state, bench->engine->engine);
+	pv_state_average_rate_window_set(state, 30);
+	pv_state_size_set(state, bench->linemode ? 0 : bench->size);
+	pv_state_stop_at_size_set(state, bench->stop_at_size);
+	pv_state_set_format(state, true, true, !bench->linemode, false, true, false, true, false, 0, NULL);
+
+	pv_sig_init(state);
+	rc = pv_main_loop(state);
+	pv_sig_fini(state);
+	pv_state_free(state);
+
+	_exit(rc);
+}
+
+
+/*
+ * Run one case once, filling in "result".  Returns false if the case
+ * could not be set up, after reporting why.
+ */
+static bool pvbench_run_once(const struct pvbench_case_s *bench, struct pvbench_result_s *result)
+{
+	char output_path[4096];		 /* flawfinder: ignore - bounded by pv_snprintf() */
+	int input_pipe[2] = { -1, -1 };
+	int output_pipe[2] = { -1, -1 };
+	pid_t feeder, drainer, transfer;
+	struct rusage usage;
+	double start_time;
+	int output_fd, status;
+
+	memset(result, 0, sizeof(*result));
+	output_path[0] = '\0';
+	feeder = -1;
+	drainer = -1;
+
+	switch (bench->output) {
+	case PVBENCH_IO_FILE:
+		(void) pv_snprintf(output_path, sizeof(output_path), "%s/pvbench-output.%d", pvbench_output_dir,
+				   (int) getpid());
+		output_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);	/* flawfinder: ignore */
+		/* flawfinder - the path is inside the directory we were given. */
+		break;
+	case PVBENCH_IO_PIPE:
+		output_fd = -1;
+		if (0 == pipe(output_pipe))
+			output_fd = output_pipe[1];
+		break;
+	case PVBENCH_IO_NULL:
+	default:
+		output_fd = open("/dev/null", O_WRONLY);	/* flawfinder: ignore */
+		/* flawfinder - constant path. */
+		break;
+	}
+	if (output_fd < 0) {
+		fprintf(stderr, "pvbench: %s: %s\n", pvbench_io_name(bench->output), strerror(errno));
+		return false;
+	}
+
+	if ((PVBENCH_IO_PIPE == bench->input) && (0 != pipe(input_pipe))) {
+		fprintf(stderr, "pvbench: %s: %s\n", "pipe", strerror(errno));
+		(void) close(output_fd);
+		return false;
+	}
+
+	start_time = pvbench_now();
+
+	if (PVBENCH_IO_PIPE == bench->input) {
+		feeder = fork();
+		if (0 == feeder) {
+			int fd = open(bench->input_file, O_RDONLY);	/* flawfinder: ignore */
+			/* flawfinder - the path is inside the directory we were given. */
+			(void) close(input_pipe[0]);
+			if (output_pipe[0] >= 0)
+				(void) close(output_pipe[0]);
+			(void) close(output_fd);
+			if (fd < 0)
+				_exit(1);
+			pvbench_copy_and_exit(fd, input_pipe[1]);
+		}
+		(void) close(input_pipe[1]);
+	}
+
+	if (PVBENCH_IO_PIPE == bench->output) {
+		drainer = fork();
+		if (0 == drainer) {
+			(void) close(output_fd);
+			if (input_pipe[0] >= 0)
+				(void) close(input_pipe[0]);
+			pvbench_copy_and_exit(output_pipe[0], -1);
+		}
+		(void) close(output_pipe[0]);
+	}
+
+	transfer = fork();
+	if (0 == transfer)
+		pvbench_transfer_and_exit(bench, input_pipe[0], output_fd);
+
+	if (input_pipe[0] >= 0)
+		(void) close(input_pipe[0]);
+	(void) close(output_fd);
+
+	memset(&usage, 0, sizeof(usage));
+	status = 0;
+	if ((transfer < 0) || (wait4(transfer, &status, 0, &usage) < 0)) {
+		fprintf(stderr, "pvbench: %s: %s\n", "fork", strerror(errno));
+		status = 0xff00;
+	}
+	if (feeder > 0)
+		(void) waitpid(feeder, NULL, 0);
+	if (drainer > 0)
+		(void) waitpid(drainer, NULL, 0);
+
+	result->seconds = pvbench_now() - start_time;
+	result->user_seconds = (double) (usage.ru_utime.tv_sec) + ((double) (usage.ru_utime.tv_usec) / 1000000.0);
+	result->system_seconds = (double) (usage.ru_stime.tv_sec) + ((double) (usage.ru_stime.tv_usec) / 1000000.0);
+	result->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+
+	if ('\0' != output_path[0])
+		(void) unlink(output_path);
+
+	return true;
+}
+
+
+/*
+ * Comparison function for sorting results by time taken.
+ */
+static int pvbench_compare_results(const void *first, const void *second)
+{
+	const struct pvbench_result_s *a = first;
+	const struct pvbench_result_s *b = second;
+
+	if (a->seconds < b->seconds)
+		return -1;
+	if (a->seconds > b->seconds)
+		return 1;
+	return 0;
+}
+
+
+/*
+ * Run one case pvbench_runs times, and write a line describing its results
+ * to standard output.
+ */
+static void pvbench_run(const struct pvbench_case_s *bench)
+{
+	struct pvbench_result_s results[PVBENCH_MAX_RUNS];
+	const struct pvbench_result_s *median;
+	unsigned int run_idx;
+	int worst_status;
+	double rate;
+
+	for (run_idx = 0; run_idx < pvbench_runs; run_idx++) {
+		if (!pvbench_run_once(bench, &(results[run_idx])))
+			return;
+	}
+
+	worst_status = 0;
+	for (run_idx = 0; run_idx < pvbench_runs; run_idx++) {
+		if (results[run_idx].status > worst_status)
+			worst_status = results[run_idx].status;
+	}
+
+	qsort(results, pvbench_runs, sizeof(results[0]), pvbench_compare_results);
+	median = &(results[pvbench_runs / 2]);
+
+	rate = median->seconds > 0 ? (double) (bench->size) / median->seconds : 0.0;
+
+	printf("{\"group\":\"%s\",\"engine\":\"%s\",\"input\":\"%s\",\"output\":\"%s\","
+	       "\"buffer_size\":%lu,\"mode\":\"%s\",\"sparse\":%s,\"rate_limit\":%lld,\"interval\":%.1f,"
+	       "\"bytes\":%lld,\"runs\":%u,\"seconds\":%.6f,\"seconds_min\":%.6f,"
+	       "\"user_seconds\":%.6f,\"system_seconds\":%.6f,\"bytes_per_second\":%.0f",
+	       bench->group, bench->engine->name, pvbench_io_name(bench->input), pvbench_io_name(bench->output),
+	       (unsigned long) (bench->buffer_size), bench->linemode ? "lines" : "bytes",
+	       bench->sparse ? "true" : "false", (long long) (bench->rate_limit), bench->interval,
+	       (long long) (bench->size), pvbench_runs, median->seconds, results[0].seconds,
+	       median->user_seconds, median->system_seconds, rate);
+	if (bench->rate_limit > 0) {
+		printf(",\"rate_error_percent\":%.2f",
+		       100.0 * (rate - (double) (bench->rate_limit)) / (double) (bench->rate_limit));
+	}
+	printf(",\"status\":%d}\n", worst_status);
+	(void) fflush(stdout);
+}
+
+
+/*
+ * Run every engine over every input, output, buffer size, and mode.
+ */
+static void pvbench_group_engine(const char *data_file, off_t size)
+{
+	static const pvbench_io_t inputs[] = { PVBENCH_IO_FILE, PVBENCH_IO_PIPE };
+	static const pvbench_io_t outputs[] = { PVBENCH_IO_NULL, PVBENCH_IO_FILE, PVBENCH_IO_PIPE };
+	struct pvbench_case_s bench;
+	unsigned int engine_idx, input_idx, output_idx, buffer_idx, mode_idx;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.group = "engine";
+	bench.input_file = data_file;
+	bench.size = size;
+
+	for (engine_idx = 0; NULL != pvbench_engines[engine_idx].name; engine_idx++) {
+		bench.engine = &(pvbench_engines[engine_idx]);
+		for (input_idx = 0; input_idx < sizeof(inputs) / sizeof(inputs[0]); input_idx++) {
+			bench.input = inputs[input_idx];
+			/* A pipe can't be mapped, so mmap would only fall back. */
+			if ((PVBENCH_IO_PIPE == bench.input) && (PV_IOENGINE_MMAP == bench.engine->engine))
+				continue;
+			for (output_idx = 0; output_idx < sizeof(outputs) / sizeof(outputs[0]); output_idx++) {
+				bench.output = outputs[output_idx];
+				for (buffer_idx = 0;
+				     buffer_idx < sizeof(pvbench_buffer_sizes) / sizeof(pvbench_buffer_sizes[0]);
+				     buffer_idx++) {
+					bench.buffer_size = pvbench_buffer_sizes[buffer_idx];
+					for (mode_idx = 0; mode_idx < 2; mode_idx++) {
+						bench.linemode = (1 == mode_idx);
+						pvbench_run(&bench);
+					}
+				}
+			}
+		}
+	}
+}
+
+
+/*
+ * Copy a file with holes to a file, with and without --sparse.
+ */
+static void pvbench_group_sparse(const char *sparse_file, off_t size)
+{
+	struct pvbench_case_s bench;
+	unsigned int engine_idx, sparse_idx;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.group = "sparse";
+	bench.input_file = sparse_file;
+	bench.size = size;
+	bench.input = PVBENCH_IO_FILE;
+	bench.output = PVBENCH_IO_FILE;
+
+	for (engine_idx = 0; NULL != pvbench_engines[engine_idx].name; engine_idx++) {
+		bench.engine = &(pvbench_engines[engine_idx]);
+		for (sparse_idx = 0; sparse_idx < 2; sparse_idx++) {
+			bench.sparse = (1 == sparse_idx);
+			pvbench_run(&bench);
+		}
+	}
+}
+
+
+/*
+ * See how close the rate limit gets to its target.  Each case takes
+ * about PVBENCH_RATE_SECONDS seconds, so it only uses the start of the
+ * input file.
+ */
+static void pvbench_group_rate(const char *data_file, off_t size)
+{
+	static const off_t rates[] = { 1024 * 1024, 10 * 1024 * 1024, 100 * 1024 * 1024 };
+	static const pvbench_io_t outputs[] = { PVBENCH_IO_NULL, PVBENCH_IO_PIPE };
+	struct pvbench_case_s bench;
+	unsigned int rate_idx, output_idx;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.group = "rate";
+	bench.engine = &(pvbench_engines[1]);
+	bench.input_file = data_file;
+	bench.input = PVBENCH_IO_FILE;
+	bench.stop_at_size = true;
+
+	for (rate_idx = 0; rate_idx < sizeof(rates) / sizeof(rates[0]); rate_idx++) {
+		bench.rate_limit = rates[rate_idx];
+		bench.size = rates[rate_idx] * PVBENCH_RATE_SECONDS;
+		if (bench.size > size)
+			continue;
+		for (output_idx = 0; output_idx < sizeof(outputs) / sizeof(outputs[0]); output_idx++) {
+			bench.output = outputs[output_idx];
+			pvbench_run(&bench);
+		}
+	}
+}
+
+
+/*
+ * Measure the cost of the display, by transferring to /dev/null with no
+ * display, and with the display updating at different intervals.
+ */
+static void pvbench_group_display(const char *data_file, off_t size)
+{
+	static const double intervals[] = { 0, 0.1, 1 };
+	struct pvbench_case_s bench;
+	unsigned int interval_idx, mode_idx;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.group = "display";
+	bench.engine = &(pvbench_engines[0]);
+	bench.input_file = data_file;
+	bench.size = size;
+	bench.input = PVBENCH_IO_PIPE;
+	bench.output = PVBENCH_IO_NULL;
+
+	for (interval_idx = 0; interval_idx < sizeof(intervals) / sizeof(intervals[0]); interval_idx++) {
+		bench.interval = intervals[interval_idx];
+		for (mode_idx = 0; mode_idx < 2; mode_idx++) {
+			bench.linemode = (1 == mode_idx);
+			pvbench_run(&bench);
+		}
+	}
+}
+
+
+/*
+ * Run "command" on "input_file" PVBENCH_STARTUP_EXECS times in a row, with
+ * its output and error output going to /dev/null, filling in "result" with
+ * the average time per command and the worst exit status.  Returns false
+ * if a process could not be started, after reporting why.
+ */
+static bool pvbench_exec_once(char *const *command, const char *input_file, struct pvbench_result_s *result)
+{
+	struct rusage usage;
+	double start_time;
+	unsigned int exec_idx;
+
+	memset(result, 0, sizeof(*result));
+	start_time = pvbench_now();
+
+	for (exec_idx = 0; exec_idx < PVBENCH_STARTUP_EXECS; exec_idx++) {
+		pid_t child;
+		int status;
+
+		child = fork();
+		if (0 == child) {
+			int input_fd, null_fd;
+			input_fd = open(input_file, O_RDONLY);	/* flawfinder: ignore */
+			null_fd = open("/dev/null", O_WRONLY);	/* flawfinder: ignore */
+			/* flawfinder - our own input file, and a constant path. */
+			if ((input_fd < 0) || (null_fd < 0))
+				_exit(126);
+			(void) dup2(input_fd, STDIN_FILENO);
+			(void) dup2(null_fd, STDOUT_FILENO);
+			(void) dup2(null_fd, STDERR_FILENO);
+			(void) close(input_fd);
+			(void) close(null_fd);
+			(void) execvp(command[0], command);	/* flawfinder: ignore */
+			/* flawfinder - the command is ours, or given on our command line. */
+			_exit(127);
+		}
+
+		status = 0;
+		if ((child < 0) || (waitpid(child, &status, 0) < 0)) {
+			fprintf(stderr, "pvbench: %s: %s\n", "fork", strerror(errno));
+			return false;
+		}
+		status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+		if (status > result->status)
+			result->status = status;
+	}
+
+	memset(&usage, 0, sizeof(usage));
+	(void) getrusage(RUSAGE_CHILDREN, &usage);
+
+	result->seconds = (pvbench_now() - start_time) / PVBENCH_STARTUP_EXECS;
+	/* The children's CPU time adds up over every run so far. */
+	result->user_seconds = (double) (usage.ru_utime.tv_sec) + ((double) (usage.ru_utime.tv_usec) / 1000000.0);
+	result->system_seconds = (double) (usage.ru_stime.tv_sec) + ((double) (usage.ru_stime.tv_usec) / 1000000.0);
+
+	return true;
+}
+
+
+/*
+ * Measure the cold start of a built pv binary, by running it on a tiny
+ * input over and over, quietly, with no terminal to draw on, and with the
+ * display forced on, and running cat(1) the same way to show the cost of
+ * just starting a process.
+ */
+static void pvbench_group_startup(const char *startup_file)
+{
+	static const struct {
+		const char *name;
+		bool is_pv;
+		const char *arguments[3];
+	} commands[] = {
+		{ "cat", false, { NULL, NULL, NULL } },
+		{ "pv -q", true, { "-q", NULL, NULL } },
+		{ "pv", true, { NULL, NULL, NULL } },
+		{ "pv -f", true, { "-f", NULL, NULL } },
+	};
+	struct pvbench_result_s results[PVBENCH_MAX_RUNS];
+	unsigned int command_idx;
+
+	for (command_idx = 0; command_idx < sizeof(commands) / sizeof(commands[0]); command_idx++) {
+		char *argv[4];
+		unsigned int run_idx, arg_idx, argc;
+		double user_before, system_before;
+		int worst_status;
+
+		argc = 0;
+		/*@-observertrans@ *//* execvp() does not modify its arguments */
+		argv[argc++] = (char *) (commands[command_idx].is_pv ? pvbench_pv_binary : "cat");
+		for (arg_idx = 0; (arg_idx < 2) && (NULL != commands[command_idx].arguments[arg_idx]); arg_idx++)
+			argv[argc++] = (char *) (commands[command_idx].arguments[arg_idx]);
+		/*@+observertrans@ */
+		argv[argc] = NULL;
+
+		user_before = 0;
+		system_before = 0;
+		worst_status = 0;
+		for (run_idx = 0; run_idx < pvbench_runs; run_idx++) {
+			double user_total, system_total;
+			if (!pvbench_exec_once(argv, startup_file, &(results[run_idx])))
+				return;
+			/* Turn the running totals into time per command. */
+			user_total = results[run_idx].user_seconds;
+			system_total = results[run_idx].system_seconds;
+			results[run_idx].user_seconds = (user_total - user_before) / PVBENCH_STARTUP_EXECS;
+			results[run_idx].system_seconds = (system_total - system_before) / PVBENCH_STARTUP_EXECS;
+			user_before = user_total;
+			system_before = system_total;
+			if (results[run_idx].status > worst_status)
+				worst_status = results[run_idx].status;
+		}
+
+		qsort(results, pvbench_runs, sizeof(results[0]), pvbench_compare_results);
+
+		printf("{\"group\":\"startup\",\"command\":\"%s\",\"bytes\":%d,\"runs\":%u,\"execs\":%d,"
+		       "\"seconds\":%.6f,\"seconds_min\":%.6f,\"user_seconds\":%.6f,\"system_seconds\":%.6f,"
+		       "\"status\":%d}\n", commands[command_idx].name, PVBENCH_STARTUP_SIZE, pvbench_runs,
+		       PVBENCH_STARTUP_EXECS, results[pvbench_runs / 2].seconds, results[0].seconds,
+		       results[pvbench_runs / 2].user_seconds, results[pvbench_runs / 2].system_seconds, worst_status);
+		(void) fflush(stdout);
+	}
+}
+
+
+/*
+ * Show how to use the program.
+ */
+static void pvbench_usage(const char *program_name)
+{
+	fprintf(stderr, "Usage: %s [-s SIZE] [-r RUNS] [-d DIR] [-p PV] [-g GROUP]...\n", program_name);
+	fprintf(stderr, "Run pv's transfer loop over a matrix of cases and write JSON lines to stdout.\n\n");
+	fprintf(stderr, "  -s SIZE   size of the test input (default 256M)\n");
+	fprintf(stderr, "  -r RUNS   runs of each case, of which the median is reported (default %d)\n",
+		PVBENCH_DEFAULT_RUNS);
+	fprintf(stderr, "  -d DIR    directory for the test files (default /tmp)\n");
+	fprintf(stderr, "  -p PV     pv binary to run in the startup group (default pv, from $PATH)\n");
+	fprintf(stderr, "  -g GROUP  only run GROUP: engine, sparse, rate, display, or startup (repeatable)\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	char data_file[4096];		 /* flawfinder: ignore - bounded by pv_snprintf() */
+	char sparse_file[4096];		 /* flawfinder: ignore - bounded by pv_snprintf() */
+	char startup_file[4096];	 /* flawfinder: ignore - bounded by pv_snprintf() */
+	bool run_engine, run_sparse, run_rate, run_display, run_startup, any_group;
+	off_t size;
+	int c;
+
+	size = PVBENCH_DEFAULT_SIZE;
+	run_engine = false;
+	run_sparse = false;
+	run_rate = false;
+	run_display = false;
+	run_startup = false;
+	any_group = false;
+
+	while ((c = getopt(argc, argv, "s:r:d:p:g:h")) != -1) {	/* flawfinder: ignore */
+		/* flawfinder - getopt() is bounded by argc. */
+		switch (c) {
+		case 's':
+			size = pv_getnum_size(optarg, false);
+			if (size < 1) {
+				fprintf(stderr, "%s: -s: %s: %s\n", argv[0], optarg, "size not understood");
+				return 1;
+			}
+			break;
+		case 'r':
+			pvbench_runs = pv_getnum_count(optarg, false);
+			if ((pvbench_runs < 1) || (pvbench_runs > PVBENCH_MAX_RUNS)) {
+				fprintf(stderr, "%s: -r: %s: %s\n", argv[0], optarg, "must be between 1 and 99");
+				return 1;
+			}
+			break;
+		case 'd':
+			pvbench_output_dir = optarg;
+			break;
+		case 'p':
+			pvbench_pv_binary = optarg;
+			break;
+		case 'g':
+			any_group = true;
+			if (0 == strcmp(optarg, "engine")) {
+				run_engine = true;
+			} else if (0 == strcmp(optarg, "sparse")) {
+				run_sparse = true;
+			} else if (0 == strcmp(optarg, "rate")) {
+				run_rate = true;
+			} else if (0 == strcmp(optarg, "display")) {
+				run_display = true;
+			} else if (0 == strcmp(optarg, "startup")) {
+				run_startup = true;
+			} else {
+				fprintf(stderr, "%s: -g: %s: %s\n", argv[0], optarg, "unknown group");
+				return 1;
+			}
+			break;
+		default:
+			pvbench_usage(argv[0]);
+			return 'h' == c ? 0 : 1;
+		}
+	}
+
+	if (!any_group) {
+		run_engine = true;
+		run_sparse = true;
+		run_rate = true;
+		run_display = true;
+		run_startup = true;
+	}
+
+	/* A pipe output whose reader has gone should fail, not kill us. */
+	(void) signal(SIGPIPE, SIG_IGN);
+
+	(void) pv_snprintf(data_file, sizeof(data_file), "%s/pvbench-data.%d", pvbench_output_dir, (int) getpid());
+	(void) pv_snprintf(sparse_file, sizeof(sparse_file), "%s/pvbench-sparse.%d", pvbench_output_dir,
+			   (int) getpid());
+	(void) pv_snprintf(startup_file, sizeof(startup_file), "%s/pvbench-startup.%d", pvbench_output_dir,
+			   (int) getpid());
+
+	if (!pvbench_make_input(data_file, size, false)) {
+		(void) unlink(data_file);
+		return 1;
+	}
+	if (run_sparse && (!pvbench_make_input(sparse_file, size, true))) {
+		(void) unlink(data_file);
+		(void) unlink(sparse_file);
+		return 1;
+	}
+	if (run_startup && (!pvbench_make_input(startup_file, PVBENCH_STARTUP_SIZE, false))) {
+		(void) unlink(data_file);
+		if (run_sparse)
+			(void) unlink(sparse_file);
+		(void) unlink(startup_file);
+		return 1;
+	}
+
+	if (run_engine)
+		pvbench_group_engine(data_file, size);
+	if (run_sparse)
+		pvbench_group_sparse(sparse_file, size);
+	if (run_rate)
+		pvbench_group_rate(data_file, size);
+	if (run_display)
+		pvbench_group_display(data_file, size);
+	if (run_startup)
+		pvbench_group_startup(startup_file);
+
+	(void) unlink(data_file);
+	if (run_sparse)
+		(void) unlink(sparse_file);
+	if (run_startup)
+		(void) unlink(startup_file);
+
+	return 0;
+}
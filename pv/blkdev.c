@@ -0,0 +1,241 @@
+/*
+ * Functions for asking disk devices for their size and sector sizes.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_SYS_DISK_H
+#include <sys/disk.h>
+#endif
+
+/*
+ * A disk device is asked directly for its geometry: on Linux with
+ * BLKGETSIZE64, BLKSSZGET, BLKPBSZGET and BLKIOOPT, and on Darwin with
+ * DKIOCGETBLOCKCOUNT, DKIOCGETBLOCKSIZE and DKIOCGETPHYSICALBLOCKSIZE.
+ * This works for devices that seeking to the end does not, such as the
+ * raw character disk devices on Darwin, and gives the sector sizes that
+ * direct I/O has to be aligned to and that transfers are best sized by.
+ *
+ * If a block device won't answer, its size is found the old way, by
+ * seeking to the end - and then back to where it was, so that this can be
+ * used on descriptors that are about to be transferred.  A character
+ * device that won't answer is not a disk, and is left alone.
+ *
+ * Sector sizes outside PV_BLKDEV_MIN_SECTOR to PV_BLKDEV_MAX_SECTOR, or
+ * that aren't powers of two, are not believed.
+ */
+#define PV_BLKDEV_MIN_SECTOR	512
+#define PV_BLKDEV_MAX_SECTOR	65536
+
+
+/*
+ * Return true if "size" is a believable sector size.
+ */
+static bool pv__blkdev_sector_valid(size_t size)
+{
+	if ((size < PV_BLKDEV_MIN_SECTOR) || (size > PV_BLKDEV_MAX_SECTOR))
+		return false;
+	return (0 == (size & (size - 1))) ? true : false;
+}
+
+
+/*
+ * Ask the device open on "fd" for its geometry, filling in whatever it
+ * answers in "geometry".  Returns true if the device answered at all.
+ */
+static bool pv__blkdev_ioctl(int fd, struct pvblkdev_s *geometry)
+{
+	bool answered = false;
+
+#if defined(HAVE_SYS_IOCTL_H) && defined(BLKGETSIZE64)
+	{
+		uint64_t bytes = 0;
+		if ((0 == ioctl(fd, BLKGETSIZE64, &bytes)) && (bytes > 0)) {
+			geometry->size = (off_t) bytes;
+			answered = true;
+		}
+	}
+#endif
+#if defined(HAVE_SYS_IOCTL_H) && defined(BLKSSZGET)
+	{
+		int sector_size = 0;
+		if ((0 == ioctl(fd, BLKSSZGET, &sector_size)) && (sector_size > 0)) {
+			geometry->logical_sector = (size_t) sector_size;
+			answered = true;
+		}
+	}
+#endif
+#if defined(HAVE_SYS_IOCTL_H) && defined(BLKPBSZGET)
+	{
+		unsigned int sector_size = 0;
+		if ((0 == ioctl(fd, BLKPBSZGET, &sector_size)) && (sector_size > 0))
+			geometry->physical_sector = (size_t) sector_size;
+	}
+#endif
+#if defined(HAVE_SYS_IOCTL_H) && defined(BLKIOOPT)
+	{
+		unsigned int optimal = 0;
+		if ((0 == ioctl(fd, BLKIOOPT, &optimal)) && (optimal > 0))
+			geometry->optimal_io = (size_t) optimal;
+	}
+#endif
+
+#if defined(HAVE_SYS_IOCTL_H) && defined(DKIOCGETBLOCKSIZE)
+	{
+		uint32_t sector_size = 0;
+		if ((0 == ioctl(fd, DKIOCGETBLOCKSIZE, &sector_size)) && (sector_size > 0)) {
+			geometry->logical_sector = (size_t) sector_size;
+			answered = true;
+#if defined(DKIOCGETBLOCKCOUNT)
+			{
+				uint64_t block_count = 0;
+				if ((0 == ioctl(fd, DKIOCGETBLOCKCOUNT, &block_count)) && (block_count > 0))
+					geometry->size = (off_t) (block_count * (uint64_t) sector_size);
+			}
+#endif
+		}
+	}
+#endif
+#if defined(HAVE_SYS_IOCTL_H) && defined(DKIOCGETPHYSICALBLOCKSIZE)
+	{
+		uint32_t sector_size = 0;
+		if ((0 == ioctl(fd, DKIOCGETPHYSICALBLOCKSIZE, &sector_size)) && (sector_size > 0))
+			geometry->physical_sector = (size_t) sector_size;
+	}
+#endif
+
+#if !defined(HAVE_SYS_IOCTL_H) || !(defined(BLKGETSIZE64) || defined(BLKSSZGET) || defined(BLKPBSZGET) \
+				      || defined(BLKIOOPT) || defined(DKIOCGETBLOCKSIZE) \
+				      || defined(DKIOCGETPHYSICALBLOCKSIZE))
+	/* No way to ask the device anything on this platform. */
+	(void) fd;
+	(void) geometry;
+#endif
+
+	return answered;
+}
+
+
+/*
+ * Fill in "geometry" for the disk device open on "fd", returning false if
+ * "fd" is not a disk device.  Anything that isn't known is left as -1 for
+ * the size, and 0 for the other fields; a physical sector size that isn't
+ * known, or makes no sense, is given as the logical one.  The file position
+ * of "fd" is left where it was.
+ */
+bool pv_blkdev_probe(int fd, struct pvblkdev_s *geometry)
+{
+	struct stat sb;
+	bool answered;
+
+	memset(geometry, 0, sizeof(*geometry));
+	geometry->size = -1;
+
+	memset(&sb, 0, sizeof(sb));
+	if ((fd < 0) || (0 != fstat(fd, &sb)))
+		return false;
+	if (!(S_ISBLK(sb.st_mode) || S_ISCHR(sb.st_mode)))
+		return false;
+
+	answered = pv__blkdev_ioctl(fd, geometry);
+
+	if ((!answered) && (!S_ISBLK(sb.st_mode)))
+		return false;
+
+	if (geometry->size < 0) {
+		off_t position, end_position;
+
+		position = lseek(fd, 0, SEEK_CUR);
+		end_position = lseek(fd, 0, SEEK_END);
+		if (end_position > 0)
+			geometry->size = end_position;
+		if ((position >= 0) && (lseek(fd, position, SEEK_SET) != position)) {
+			debug("%s: %d: %s", "failed to restore position", fd, strerror(errno));
+		}
+	}
+
+	if (!pv__blkdev_sector_valid(geometry->logical_sector))
+		geometry->logical_sector = 0;
+	if ((0 == geometry->logical_sector) || (!pv__blkdev_sector_valid(geometry->physical_sector))
+	    || (0 != (geometry->physical_sector % geometry->logical_sector)))
+		geometry->physical_sector = geometry->logical_sector;
+	if ((0 == geometry->physical_sector) || (0 != (geometry->optimal_io % geometry->physical_sector)))
+		geometry->optimal_io = 0;
+
+	debug("%s: %d: %s=%lld, %s=%lu, %s=%lu, %s=%lu", "disk device", fd, "size", (long long) (geometry->size),
+	      "logical", (unsigned long) (geometry->logical_sector), "physical",
+	      (unsigned long) (geometry->physical_sector), "optimal", (unsigned long) (geometry->optimal_io));
+
+	return true;
+}
+
+
+/*
+ * Return the size in bytes of the disk device open on "fd", or -1 if it
+ * isn't a disk device or its size can't be found.
+ */
+off_t pv_blkdev_size(int fd)
+{
+	struct pvblkdev_s geometry;
+
+	if (!pv_blkdev_probe(fd, &geometry))
+		return -1;
+
+	return geometry.size;
+}
+
+
+/*
+ * Return the buffer size to use instead of "size" when transferring to or
+ * from the disk device open on "fd", no larger than "max_size" if that can
+ * be helped.  The size is made a whole number of the device's optimal I/O
+ * size if it has one, or of its physical sectors otherwise, so that every
+ * full read or write covers whole sectors and nothing is split by the
+ * device.  If "fd" is not a disk device, "size" is returned unchanged.
+ */
+size_t pv_blkdev_buffer_size(int fd, size_t size, size_t max_size)
+{
+	struct pvblkdev_s geometry;
+	size_t unit;
+
+	if (!pv_blkdev_probe(fd, &geometry))
+		return size;
+
+	unit = geometry.optimal_io;
+	if ((0 == unit) || (unit > max_size))
+		unit = geometry.physical_sector;
+	if (0 == unit)
+		return size;
+
+	if (size < unit)
+		return unit;
+
+	if (size > max_size)
+		size = max_size;
+	size -= size % unit;
+	if (0 == size)
+		size = unit;
+
+	return size;
+}
@@ -0,0 +1,455 @@
+/*
+ * Functions for "--rate-budget", which shares one "-L" rate limit between
+ * several processes.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+/*
+ * The members of a budget share a small file, mapped into memory, in the
+ * same place as the --remote control files.  It holds the rate the whole
+ * group may use between them, and a table of members, in which each
+ * process claims a slot of its own.  Nobody takes a lock: each member only
+ * ever writes to its own slot, with atomic stores, and reads everyone
+ * else's.
+ *
+ * Every PV_BUDGET_PERIOD_NSEC, each member publishes what it used over the
+ * last period, and whether it was held back by its share, and then works
+ * out its share for the next period from the table:
+ *
+ *  - Members that were not held back - because their input or output is
+ *    slower than their share - are assumed to go on using what they used.
+ *
+ *  - What they leave is divided between the members that were held back,
+ *    in proportion to their weights.
+ *
+ *  - Nobody gets less than their weighted share of the whole rate, so a
+ *    member that picks up speed is never starved by the others.
+ *
+ * So a member that goes idle has its share taken up by the others within
+ * a period or two, and gets it back as soon as it needs it.  A member that
+ * has not published for PV_BUDGET_STALE_NSEC has gone, and its slot can be
+ * taken by a new one.
+ *
+ * Each member still paces its own writes with its own token bucket, at its
+ * share of the rate; only the shares are coordinated.  The group's rate is
+ * set by whichever member joined, or had its "-L" changed with "--remote",
+ * most recently, and the others follow it.
+ */
+#define PV_BUDGET_MAGIC		0x47425650	 /* "PVBG", little-endian */
+#define PV_BUDGET_VERSION	1
+#define PV_BUDGET_SLOTS		128		 /* most members of one budget */
+#define PV_BUDGET_PERIOD_NSEC	100000000LL	 /* how often shares are worked out */
+#define PV_BUDGET_STALE_NSEC	1000000000LL	 /* silence after which a member has gone */
+#define PV_BUDGET_HEADROOM	1.25L		 /* share kept above use when not held back */
+#define PV_BUDGET_MAX_NAME	64		 /* longest budget name */
+
+struct pvbudget_slot_s {
+	int64_t pid;			 /* process in this slot, or 0 if free */
+	int64_t heartbeat;		 /* coarse monotonic nsec of its last update */
+	int64_t used_rate;		 /* amount it used per second over its last period */
+	uint32_t weight;		 /* its weight */
+	uint32_t held_back;		 /* nonzero if its share held it back */
+};
+
+struct pvbudget_layout_s {
+	uint32_t magic;			 /* PV_BUDGET_MAGIC once initialised */
+	uint32_t version;		 /* PV_BUDGET_VERSION */
+	int64_t rate;			 /* rate the whole group shares, per second */
+	struct pvbudget_slot_s slot[PV_BUDGET_SLOTS];
+};
+
+struct pvbudget_s {
+	/*@null@ */ /*@dependent@ */ struct pvbudget_layout_s *page;	/* the mapped file */
+	unsigned int slot;		 /* our slot in the table */
+	long long last_update;		 /* coarse nsec of our last update */
+	off_t last_written;		 /* total_written at that time */
+	off_t published_rate;		 /* group rate as we last saw or set it */
+	long double share;		 /* our current share of the rate */
+	bool held_back;			 /* our share held us back this period */
+	bool failed;			 /* set if the budget could not be joined */
+};
+
+
+/*
+ * Return true if "name" can be used as the name of a rate budget.
+ */
+bool pv_budget_name_valid(const char *name)
+{
+	size_t length;
+
+	if ((NULL == name) || ('\0' == name[0]) || ('.' == name[0]))
+		return false;
+
+	for (length = 0; '\0' != name[length]; length++) {
+		char ch = name[length];
+		if (length >= PV_BUDGET_MAX_NAME)
+			return false;
+		if (('-' == ch) || ('_' == ch) || ('.' == ch))
+			continue;
+		if ((ch >= '0') && (ch <= '9'))
+			continue;
+		if ((ch >= 'a') && (ch <= 'z'))
+			continue;
+		if ((ch >= 'A') && (ch <= 'Z'))
+			continue;
+		return false;
+	}
+
+	return true;
+}
+
+
+#ifdef HAVE_MMAP
+
+/*
+ * Open, creating it if necessary, and map the file for the budget "name",
+ * returning NULL on failure.
+ */
+/*@null@ */ /*@dependent@ */ static struct pvbudget_layout_s *pv__budget_map(const char *name)
+{
+	char filename[PV_SIZEOF_STATSPAGE_FILENAME];	/* flawfinder: ignore - bounded by pv_snprintf() */
+	struct pvbudget_layout_s *page;
+	struct stat sb;
+	int open_flags, page_fd, attempt;
+	uint32_t magic;
+	void *mapping;
+
+	open_flags = O_RDWR | O_CREAT;
+#ifdef O_NOFOLLOW
+	open_flags |= O_NOFOLLOW;
+#endif
+
+	page_fd = -1;
+	for (attempt = 0; attempt < 2 && page_fd < 0; attempt++) {
+		char *home_dir;
+		if (0 == attempt) {
+			(void) pv_snprintf(filename, sizeof(filename), "/run/user/%lu/pv.budget.%s",
+					   (unsigned long) geteuid(), name);
+		} else {
+			home_dir = getenv("HOME");	/* flawfinder: ignore */
+			/* flawfinder rationale: as in pv_runtime_filename(). */
+			if ((NULL == home_dir) || ('\0' == home_dir[0]))
+				break;
+			(void) pv_snprintf(filename, sizeof(filename), "%s/.pv", home_dir);
+			if (0 == mkdir(filename, 0700))
+				(void) chmod(filename, 0700);	/* flawfinder: ignore */
+			(void) pv_snprintf(filename, sizeof(filename), "%s/.pv/budget.%s", home_dir, name);
+		}
+		page_fd = open(filename, open_flags, 0600);	/* flawfinder: ignore */
+	}
+
+	/*
+	 * flawfinder rationale: as with pv_open_controlfile(), the files
+	 * are in a directory whose parents cannot be manipulated, and the
+	 * final component is not allowed to be a symbolic link.
+	 */
+
+	if (page_fd < 0) {
+		debug("%s: %s", "rate budget", strerror(errno));
+		return NULL;
+	}
+
+	/* Every member makes sure the file is big enough; growing it is harmless. */
+	memset(&sb, 0, sizeof(sb));
+	if ((0 != fstat(page_fd, &sb))
+	    || ((sb.st_size < (off_t) sizeof(*page)) && (0 != ftruncate(page_fd, (off_t) sizeof(*page))))) {
+		debug("%s: %s: %s", filename, "ftruncate", strerror(errno));
+		(void) close(page_fd);
+		return NULL;
+	}
+
+	mapping = mmap(NULL, sizeof(*page), PROT_READ | PROT_WRITE, MAP_SHARED, page_fd, 0);
+	(void) close(page_fd);
+	if (MAP_FAILED == mapping) {
+		debug("%s: %s: %s", filename, "mmap", strerror(errno));
+		return NULL;
+	}
+	page = (struct pvbudget_layout_s *) mapping;
+
+	/* Whoever gets here first marks the file as initialised. */
+	magic = 0;
+	if (!__atomic_compare_exchange_n
+	    (&(page->magic), &magic, PV_BUDGET_MAGIC, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		if (PV_BUDGET_MAGIC != magic) {
+			debug("%s: %s", filename, "not a rate budget file");
+			(void) munmap(mapping, sizeof(*page));
+			return NULL;
+		}
+	} else {
+		__atomic_store_n(&(page->version), PV_BUDGET_VERSION, __ATOMIC_RELEASE);
+	}
+
+	debug("%s: %s", "rate budget", filename);
+
+	return page;
+}
+
+
+/*
+ * Claim a slot in the budget's table, returning false if they are all in
+ * use.
+ */
+static bool pv__budget_claim(struct pvbudget_s *budget, long long now, unsigned int weight)
+{
+	struct pvbudget_layout_s *page;
+	unsigned int idx;
+	int64_t pid;
+
+	page = budget->page;
+	if (NULL == page)
+		return false;
+	pid = (int64_t) getpid();
+
+	for (idx = 0; idx < PV_BUDGET_SLOTS; idx++) {
+		struct pvbudget_slot_s *slot = &(page->slot[idx]);
+		int64_t owner = __atomic_load_n(&(slot->pid), __ATOMIC_ACQUIRE);
+		int64_t heartbeat = __atomic_load_n(&(slot->heartbeat), __ATOMIC_ACQUIRE);
+
+		/* Only a free slot, or one whose owner has gone quiet, may be taken. */
+		if ((0 != owner) && (now - (long long) heartbeat < PV_BUDGET_STALE_NSEC))
+			continue;
+		if (!__atomic_compare_exchange_n(&(slot->pid), &owner, pid, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			continue;
+
+		__atomic_store_n(&(slot->weight), (uint32_t) weight, __ATOMIC_RELAXED);
+		__atomic_store_n(&(slot->used_rate), 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&(slot->held_back), 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&(slot->heartbeat), (int64_t) now, __ATOMIC_RELEASE);
+		budget->slot = idx;
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * Join the budget named in the state, returning NULL on failure.
+ */
+/*@null@ */ static struct pvbudget_s *pv__budget_join(pvstate_t state, long long now)
+{
+	struct pvbudget_s *budget;
+
+	budget = calloc(1, sizeof(*budget));
+	if (NULL == budget)
+		return NULL;
+	state->transfer.budget = budget;
+
+	budget->page = pv__budget_map(state->control.rate_budget);
+	if ((NULL == budget->page) || (!pv__budget_claim(budget, now, state->control.rate_weight))) {
+		pv_error("%s: %s", state->control.rate_budget, _("failed to join rate budget"));
+		if (NULL != budget->page)
+			(void) munmap((void *) (budget->page), sizeof(*(budget->page)));
+		budget->page = NULL;
+		budget->failed = true;
+		return budget;
+	}
+
+	/* Joining sets the group's rate to ours. */
+	__atomic_store_n(&(budget->page->rate), (int64_t) (state->control.rate_limit), __ATOMIC_RELEASE);
+	budget->published_rate = state->control.rate_limit;
+	budget->last_update = now;
+	budget->last_written = state->transfer.total_written;
+	budget->share = (long double) (state->control.rate_limit);
+
+	debug("%s: %s: %s=%u, %s=%u", "joined rate budget", state->control.rate_budget, "slot", budget->slot,
+	      "weight", state->control.rate_weight);
+
+	return budget;
+}
+
+
+/*
+ * Publish our usage for the period just gone, and work out our share for
+ * the next one.
+ */
+static void pv__budget_reshare(pvstate_t state, struct pvbudget_s *budget, long long now)
+{
+	struct pvbudget_layout_s *page;
+	struct pvbudget_slot_s *own;
+	long double seconds, used, fair, rate, total_weight, held_weight, others_used, share;
+	int64_t group_rate;
+	unsigned int idx;
+
+	page = budget->page;
+	if (NULL == page)
+		return;
+	own = &(page->slot[budget->slot]);
+
+	/* Follow a change to the group's rate, or make one. */
+	group_rate = __atomic_load_n(&(page->rate), __ATOMIC_ACQUIRE);
+	if (state->control.rate_limit != budget->published_rate) {
+		__atomic_store_n(&(page->rate), (int64_t) (state->control.rate_limit), __ATOMIC_RELEASE);
+		budget->published_rate = state->control.rate_limit;
+		debug("%s: %lld", "rate budget changed", (long long) (state->control.rate_limit));
+	} else if ((group_rate > 0) && ((off_t) group_rate != budget->published_rate)) {
+		state->control.rate_limit = (off_t) group_rate;
+		budget->published_rate = (off_t) group_rate;
+		debug("%s: %lld", "rate budget now", (long long) group_rate);
+	}
+	rate = (long double) (state->control.rate_limit);
+
+	seconds = (long double) (now - budget->last_update) / 1000000000.0L;
+	used = 0.0L;
+	if (seconds > 0.0L)
+		used = (long double) (state->transfer.total_written - budget->last_written) / seconds;
+	budget->last_update = now;
+	budget->last_written = state->transfer.total_written;
+
+	/* A slot taken over while we were stopped means we have to rejoin. */
+	if (__atomic_load_n(&(own->pid), __ATOMIC_ACQUIRE) != (int64_t) getpid()) {
+		if (!pv__budget_claim(budget, now, state->control.rate_weight)) {
+			budget->share = rate;
+			return;
+		}
+		own = &(page->slot[budget->slot]);
+	}
+
+	__atomic_store_n(&(own->weight), (uint32_t) (state->control.rate_weight), __ATOMIC_RELAXED);
+	__atomic_store_n(&(own->used_rate), (int64_t) used, __ATOMIC_RELAXED);
+	__atomic_store_n(&(own->held_back), budget->held_back ? 1 : 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&(own->heartbeat), (int64_t) now, __ATOMIC_RELEASE);
+
+	total_weight = 0.0L;
+	held_weight = 0.0L;
+	others_used = 0.0L;
+	for (idx = 0; idx < PV_BUDGET_SLOTS; idx++) {
+		struct pvbudget_slot_s *slot = &(page->slot[idx]);
+		int64_t heartbeat = __atomic_load_n(&(slot->heartbeat), __ATOMIC_ACQUIRE);
+		long double weight;
+
+		if (0 == __atomic_load_n(&(slot->pid), __ATOMIC_ACQUIRE))
+			continue;
+		if (now - (long long) heartbeat >= PV_BUDGET_STALE_NSEC)
+			continue;
+
+		weight = (long double) __atomic_load_n(&(slot->weight), __ATOMIC_RELAXED);
+		total_weight += weight;
+		if (0 != __atomic_load_n(&(slot->held_back), __ATOMIC_RELAXED)) {
+			held_weight += weight;
+		} else {
+			others_used += (long double) __atomic_load_n(&(slot->used_rate), __ATOMIC_RELAXED);
+		}
+	}
+
+	if (total_weight <= 0.0L)
+		total_weight = (long double) (state->control.rate_weight);
+	fair = rate * (long double) (state->control.rate_weight) / total_weight;
+
+	if (budget->held_back && (held_weight > 0.0L)) {
+		/* Take our part of what the members who aren't held back leave. */
+		share = (rate - others_used) * (long double) (state->control.rate_weight) / held_weight;
+	} else {
+		/* Keep some room to speed up, without holding on to what we don't use. */
+		share = budget->share;
+		if (share > used * PV_BUDGET_HEADROOM)
+			share = used * PV_BUDGET_HEADROOM;
+	}
+	if (share < fair)
+		share = fair;
+	if (share > rate)
+		share = rate;
+
+	budget->share = share;
+	budget->held_back = false;
+}
+
+#endif				/* HAVE_MMAP */
+
+
+/*
+ * Return the rate this process may use, joining the budget on the first
+ * call; "rate" is the rate limit it would have on its own, which is
+ * returned if there is no budget.  Called whenever the "-L" token bucket
+ * is topped up.
+ */
+long double pv_budget_rate(pvstate_t state, long double rate)
+{
+#ifdef HAVE_MMAP
+	struct pvbudget_s *budget;
+	long long now;
+
+	if (NULL == state->control.rate_budget)
+		return rate;
+
+	now = pv_elapsedtime_coarse_nsec();
+
+	budget = state->transfer.budget;
+	if (NULL == budget)
+		budget = pv__budget_join(state, now);
+	if ((NULL == budget) || budget->failed)
+		return rate;
+
+	if (now - budget->last_update >= PV_BUDGET_PERIOD_NSEC)
+		pv__budget_reshare(state, budget, now);
+
+	if (state->control.rate_limit <= 0)
+		return rate;
+	if (budget->share < 1.0L)
+		return 1.0L;
+
+	return budget->share;
+#else				/* !HAVE_MMAP */
+	(void) state;
+	return rate;
+#endif				/* HAVE_MMAP */
+}
+
+
+/*
+ * Note that the "-L" token bucket has run dry, so this process is being
+ * held back by its share of the budget.
+ */
+void pv_budget_held_back(pvstate_t state)
+{
+	if (NULL == state->transfer.budget)
+		return;
+	state->transfer.budget->held_back = true;
+}
+
+
+/*
+ * Leave the budget, if we joined one, and free the budget state.
+ */
+void pv_budget_free(pvtransferstate_t transfer)
+{
+	struct pvbudget_s *budget;
+
+	if ((NULL == transfer) || (NULL == transfer->budget))
+		return;
+
+	budget = transfer->budget;
+	transfer->budget = NULL;
+
+#ifdef HAVE_MMAP
+	if (NULL != budget->page) {
+		int64_t pid = (int64_t) getpid();
+		/* Only give the slot up if it is still ours. */
+		(void) __atomic_compare_exchange_n(&(budget->page->slot[budget->slot].pid), &pid, 0, false,
+						   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+		(void) munmap((void *) (budget->page), sizeof(*(budget->page)));
+	}
+#endif
+
+	free(budget);
+}
@@ -0,0 +1,263 @@
+/*
+ * Adaptive transfer buffer sizing, for "--buffer-size auto".
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+
+/*
+ * The controller works in epochs.  During each epoch it adds up how much
+ * data the read() and write() calls moved, how many calls there were, and
+ * how long they took.  At the end of an epoch, the throughput per second
+ * spent in those calls is compared with the previous epoch's, at the
+ * previous buffer size, and the buffer is doubled or halved accordingly -
+ * carrying on in the same direction while throughput improves, and turning
+ * round when it gets worse.
+ *
+ * Regardless of throughput, the buffer is shrunk if calls are taking so
+ * long that the display would lag, and it isn't grown if calls aren't
+ * filling the buffer they already have.
+ *
+ * Buffers that are swapped out are kept in a small pool, so that moving
+ * back to a size that was used before doesn't need a new allocation.  The
+ * buffer is only ever swapped while it is empty, so nothing is copied.
+ */
+struct pvbufferpool_s {
+	struct {
+		/*@only@ */ /*@null@ */ char *buffer;
+		size_t size;
+	} spare[PV_BUFFER_POOL_SLOTS];	 /* buffers not currently in use */
+	unsigned int next_evict;	 /* spare slot to reuse when all are full */
+	long long epoch_start;		 /* when this epoch started, coarse nsec */
+	long double epoch_io_seconds;	 /* time spent in read() and write() */
+	long double previous_rate;	 /* bytes per I/O second last epoch */
+	off_t epoch_bytes;		 /* bytes moved by read() and write() */
+	off_t epoch_requested;		 /* bytes asked for by those calls */
+	unsigned int epoch_calls;	 /* number of read() and write() calls */
+	int direction;			 /* 1 = growing, -1 = shrinking, 0 = not started */
+};
+
+
+/*
+ * Return the buffer pool, creating it if necessary, or NULL if it could
+ * not be allocated.
+ */
+/*@null@ */ /*@dependent@ */ static struct pvbufferpool_s *pv__buffer_pool(pvtransferstate_t transfer)
+{
+	if (NULL == transfer->buffer_pool) {
+		transfer->buffer_pool = calloc(1, sizeof(*(transfer->buffer_pool)));
+		if (NULL == transfer->buffer_pool)
+			return NULL;
+		transfer->buffer_pool->epoch_start = pv_elapsedtime_coarse_nsec();
+	}
+	return transfer->buffer_pool;
+}
+
+
+/*
+ * Record the result of a read() or write() call which was asked to move
+ * "requested" bytes, moved "done" bytes, and started at "start".
+ */
+void pv_buffer_adapt_record(pvtransferstate_t transfer, size_t requested, ssize_t done,
+			    const struct timespec *start)
+{
+	struct pvbufferpool_s *pool;
+	struct timespec now, elapsed;
+
+	if (done <= 0)
+		return;
+
+	pool = pv__buffer_pool(transfer);
+	if (NULL == pool)
+		return;
+
+	pv_elapsedtime_read(&now);
+	pv_elapsedtime_subtract(&elapsed, &now, start);
+
+	pool->epoch_io_seconds += pv_elapsedtime_seconds(&elapsed);
+	pool->epoch_bytes += (off_t) done;
+	pool->epoch_requested += (off_t) requested;
+	pool->epoch_calls++;
+}
+
+
+/*
+ * Take a buffer of "size" bytes from the pool, or allocate a new one,
+ * returning NULL on failure.
+ */
+/*@null@ */ /*@only@ */ static char *pv__buffer_take(struct pvbufferpool_s *pool, pvcontrol_t control, size_t size,
+						       int output_fd, int input_fd)
+{
+	unsigned int slot;
+
+	for (slot = 0; slot < PV_BUFFER_POOL_SLOTS; slot++) {
+		char *buffer = pool->spare[slot].buffer;
+		if ((NULL != buffer) && (size == pool->spare[slot].size)) {
+			pool->spare[slot].buffer = NULL;
+			pool->spare[slot].size = 0;
+			return buffer;
+		}
+	}
+
+	return pv_allocate_aligned_buffer(control, output_fd, input_fd, size + 32);
+}
+
+
+/*
+ * Put a buffer into the pool, freeing an older spare if the pool is full.
+ */
+static void pv__buffer_give(struct pvbufferpool_s *pool, /*@only@ */ char *buffer, size_t size)
+{
+	unsigned int slot;
+
+	for (slot = 0; slot < PV_BUFFER_POOL_SLOTS; slot++) {
+		if (NULL == pool->spare[slot].buffer)
+			break;
+	}
+
+	if (slot >= PV_BUFFER_POOL_SLOTS) {
+		slot = pool->next_evict;
+		pool->next_evict = (pool->next_evict + 1) % PV_BUFFER_POOL_SLOTS;
+		pv_free_aligned_buffer(pool->spare[slot].buffer, pool->spare[slot].size + 32);
+	}
+
+	pool->spare[slot].buffer = buffer;
+	pool->spare[slot].size = size;
+}
+
+
+/*
+ * Decide what size the buffer should be next, given the measurements from
+ * the epoch that has just finished, and start a new epoch.
+ */
+static size_t pv__buffer_next_size(struct pvbufferpool_s *pool, size_t current_size)
+{
+	long double rate, latency, fill;
+	size_t new_size;
+
+	rate = pool->epoch_bytes / (pool->epoch_io_seconds > 0.000001L ? pool->epoch_io_seconds : 0.000001L);
+	latency = pool->epoch_io_seconds / pool->epoch_calls;
+	fill = (long double) (pool->epoch_bytes) / (long double) (pool->epoch_requested);
+
+	if (latency > PV_BUFFER_ADAPT_MAX_LATENCY) {
+		/* Calls are too slow for the display to keep up - shrink. */
+		pool->direction = -1;
+	} else if (0 == pool->direction) {
+		/* First decision - try a bigger buffer. */
+		pool->direction = 1;
+	} else if (rate < pool->previous_rate * 0.95L) {
+		/* That step made things worse - go back the other way. */
+		pool->direction = -pool->direction;
+	} else if (rate < pool->previous_rate * 1.05L) {
+		/* No real difference - stay put, but keep the direction. */
+		new_size = current_size;
+		goto pv__buffer_next_size_done;
+	}
+
+	if ((pool->direction > 0) && (fill < 0.5L)) {
+		/*
+		 * The calls aren't filling the buffer we've got, so a
+		 * bigger one won't help.
+		 */
+		new_size = current_size;
+		goto pv__buffer_next_size_done;
+	}
+
+	new_size = pool->direction > 0 ? current_size * 2 : current_size / 2;
+	if (new_size < PV_BUFFER_ADAPT_MIN)
+		new_size = PV_BUFFER_ADAPT_MIN;
+	if (new_size > PV_BUFFER_ADAPT_MAX)
+		new_size = PV_BUFFER_ADAPT_MAX;
+
+      pv__buffer_next_size_done:
+	debug("%s: %s=%.0Lf, %s=%.6Lf, %s=%.2Lf, %s=%ld -> %ld", "buffer adapt", "rate", rate, "latency",
+	      latency, "fill", fill, "size", (long) current_size, (long) new_size);
+
+	pool->previous_rate = rate;
+	pool->epoch_io_seconds = 0.0L;
+	pool->epoch_bytes = 0;
+	pool->epoch_requested = 0;
+	pool->epoch_calls = 0;
+	pool->epoch_start = pv_elapsedtime_coarse_nsec();
+
+	return new_size;
+}
+
+
+/*
+ * With "--buffer-size auto", resize the transfer buffer if the current
+ * epoch has finished and the controller wants a different size.  This is
+ * only done while the buffer is empty, so the old buffer can go back into
+ * the pool without anything being copied out of it.
+ */
+void pv_buffer_adapt(pvstate_t state, int input_fd)
+{
+	struct pvbufferpool_s *pool;
+	size_t new_size;
+	char *new_buffer;
+
+	if ((!state->control.adaptive_buffer) || (NULL == state->transfer.transfer_buffer))
+		return;
+	if ((0 != state->transfer.read_position) || (0 != state->transfer.write_position))
+		return;
+
+	pool = pv__buffer_pool(&(state->transfer));
+	if (NULL == pool)
+		return;
+
+	if (pool->epoch_calls < PV_BUFFER_ADAPT_MIN_CALLS)
+		return;
+
+	/* The epoch length only needs to be roughly right. */
+	if (((long double) (pv_elapsedtime_coarse_nsec() - pool->epoch_start)) / 1000000000.0L
+	    < PV_BUFFER_ADAPT_EPOCH)
+		return;
+
+	new_size = pv__buffer_next_size(pool, state->transfer.buffer_size);
+	if (new_size == state->transfer.buffer_size)
+		return;
+
+	new_buffer = pv__buffer_take(pool, &(state->control), new_size, state->control.output_fd, input_fd);
+	if (NULL == new_buffer) {
+		debug("%s: %s", "buffer allocation failed", strerror(errno));
+		return;
+	}
+
+	pv__buffer_give(pool, state->transfer.transfer_buffer, state->transfer.buffer_size);
+	state->transfer.transfer_buffer = new_buffer;
+	state->transfer.buffer_size = new_size;
+	state->control.target_buffer_size = new_size;
+}
+
+
+/*
+ * Free the buffer pool and any spare buffers in it.
+ */
+void pv_buffer_adapt_free(pvtransferstate_t transfer)
+{
+	unsigned int slot;
+
+	if ((NULL == transfer) || (NULL == transfer->buffer_pool))
+		return;
+
+	for (slot = 0; slot < PV_BUFFER_POOL_SLOTS; slot++) {
+		if (NULL != transfer->buffer_pool->spare[slot].buffer)
+			pv_free_aligned_buffer(transfer->buffer_pool->spare[slot].buffer,
+					       transfer->buffer_pool->spare[slot].size + 32);
+	}
+
+	free(transfer->buffer_pool);
+	transfer->buffer_pool = NULL;
+}
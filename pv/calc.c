@@ -12,58 +12,323 @@
 
 
 /*
- * Update the current average rate, using a ring buffer of past transfer
- * positions - if this is the first entry, use the provided instantaneous
- * rate, otherwise calulate the average rate from the difference between the
- * current position + elapsed time pair, and the oldest pair in the buffer.
+ * Update the current average rate, using a fixed ring of past transfer
+ * positions spread across the average rate window - if this is the first
+ * point, use the provided instantaneous rate, otherwise calculate the
+ * average rate from the difference between the newest position + elapsed
+ * time pair, and the oldest pair in the window.
+ *
+ * The ring is the same size whatever the window length, and points are
+ * only added once per window step, so each call does a fixed amount of
+ * work; points which have fallen out of the window are dropped as well,
+ * so that with a display interval longer than the step, the window still
+ * covers the right length of time.
  */
-static void pv__update_average_rate_history(pvtransfercalc_t calc, readonly_pvtransferstate_t transfer,
-					    unsigned int history_interval, long double rate)
+static void pv__update_average_rate_window(pvtransfercalc_t calc, readonly_pvtransferstate_t transfer, long double rate)
 {
-	size_t first = calc->history_first;
-	size_t last = calc->history_last;
-	long double last_elapsed;
+	unsigned int first, last;
+	int64_t now_nsec, elapsed_nsec;
+	off_t bytes;
 
-	if (NULL == calc->history)
+	if (calc->window_nsec < 1)
 		return;
 
-	last_elapsed = calc->history[last].elapsed_sec;
+	now_nsec = (int64_t) (transfer->elapsed_seconds * 1000000000.0L);
 
 	/*
-	 * Do nothing if this is not the first call but not enough time has
-	 * elapsed since the previous call yet.
+	 * Do nothing if this is not the first point but not enough time has
+	 * elapsed since the previous one yet.
 	 */
-	if ((last_elapsed > 0.0)
-	    && (transfer->elapsed_seconds < (last_elapsed + history_interval)))
-		return;
+	if (calc->window_count > 0) {
+		last = (calc->window_first + calc->window_count - 1) % PV_CALC_WINDOW_POINTS;
+		if (now_nsec < calc->window[last].elapsed_nsec + calc->window_step_nsec)
+			return;
+	}
+
+	/* Add the new point, overwriting the oldest if the ring is full. */
+	if (calc->window_count < PV_CALC_WINDOW_POINTS) {
+		calc->window_count++;
+	} else {
+		calc->window_first = (calc->window_first + 1) % PV_CALC_WINDOW_POINTS;
+	}
+	last = (calc->window_first + calc->window_count - 1) % PV_CALC_WINDOW_POINTS;
+	calc->window[last].elapsed_nsec = now_nsec;
+	calc->window[last].transferred = transfer->transferred;
 
 	/*
-	 * If this is not the first call, add a new entry to the circular
-	 * buffer.
+	 * Drop the oldest point while the one after it is still at least a
+	 * whole window old.
 	 */
-	if (last_elapsed > 0.0) {
-		size_t len = calc->history_len;
-		last = (last + 1) % len;
-		calc->history_last = last;
-		if (last == first) {
-			first = (first + 1) % len;
-			calc->history_first = first;
-		}
+	while (calc->window_count > 2) {
+		unsigned int second = (calc->window_first + 1) % PV_CALC_WINDOW_POINTS;
+		if (calc->window[second].elapsed_nsec > now_nsec - calc->window_nsec)
+			break;
+		calc->window_first = second;
+		calc->window_count--;
 	}
 
-	calc->history[last].elapsed_sec = transfer->elapsed_seconds;
-	calc->history[last].transferred = transfer->transferred;
+	first = calc->window_first;
 
-	if (first == last) {
+	if (1 == calc->window_count) {
 		calc->current_avg_rate = rate;
-	} else {
-		off_t bytes = (calc->history[last].transferred - calc->history[first].transferred);
-		long double sec = (calc->history[last].elapsed_sec - calc->history[first].elapsed_sec);
-		/* Safety check to avoid division by zero. */
-		if (sec < 0.000001 && sec > -0.000001)
-			sec = 0.000001;
-		calc->current_avg_rate = (long double) bytes / sec;
+		return;
+	}
+
+	bytes = calc->window[last].transferred - calc->window[first].transferred;
+	elapsed_nsec = calc->window[last].elapsed_nsec - calc->window[first].elapsed_nsec;
+	/* Safety check to avoid division by zero. */
+	if (elapsed_nsec < 1000)
+		elapsed_nsec = 1000;
+	calc->current_avg_rate = (long double) bytes *1000000000.0L / (long double) elapsed_nsec;
+}
+
+
+/*
+ * Return the rate between two points in the average rate window, in units
+ * per second.
+ */
+static long double pv__window_rate(readonly_pvtransfercalc_t calc, unsigned int from, unsigned int to)
+{
+	int64_t elapsed_nsec;
+
+	elapsed_nsec = calc->window[to].elapsed_nsec - calc->window[from].elapsed_nsec;
+	if (elapsed_nsec < 1000)
+		elapsed_nsec = 1000;
+
+	return (long double) (calc->window[to].transferred -
+			      calc->window[from].transferred) * 1000000000.0L / (long double) elapsed_nsec;
+}
+
+
+/*
+ * Return the given fraction (0 to 1, such as 0.5 for the median) of the
+ * rates measured between each pair of neighbouring points in the average
+ * rate window, or 0 if the window has fewer than two points.
+ *
+ * The window is small and of fixed size, so the rates are simply sorted.
+ */
+long double pv_calc_rate_percentile(readonly_pvtransfercalc_t calc, long double fraction)
+{
+	long double rates[PV_CALC_WINDOW_POINTS];
+	unsigned int rate_count, point_idx, sort_idx, pick;
+
+	if ((NULL == calc) || (calc->window_count < 2))
+		return 0.0;
+
+	rate_count = 0;
+	for (point_idx = 1; point_idx < calc->window_count; point_idx++) {
+		long double rate;
+
+		rate =
+		    pv__window_rate(calc, (calc->window_first + point_idx - 1) % PV_CALC_WINDOW_POINTS,
+				    (calc->window_first + point_idx) % PV_CALC_WINDOW_POINTS);
+
+		/* Insertion sort as we go. */
+		for (sort_idx = rate_count; sort_idx > 0 && rates[sort_idx - 1] > rate; sort_idx--)
+			rates[sort_idx] = rates[sort_idx - 1];
+		rates[sort_idx] = rate;
+		rate_count++;
+	}
+
+	if (fraction < 0.0)
+		fraction = 0.0;
+	if (fraction > 1.0)
+		fraction = 1.0;
+
+	pick = (unsigned int) (fraction * (long double) (rate_count - 1) + 0.5);
+	if (pick >= rate_count)
+		pick = rate_count - 1;
+
+	return rates[pick];
+}
+
+
+/*
+ * Move every amount that the rate calculations remember up by "amount",
+ * for when "amount" has been added to the transferred count all at once
+ * without having been transferred since the last update - such as when
+ * another process joins the total of a multi-target query - so that it
+ * does not show up as a burst in the current or average rate.
+ */
+void pv_calc_shift_baseline(pvtransfercalc_t calc, off_t amount)
+{
+	unsigned int point_idx;
+
+	calc->prev_transferred += amount;
+	for (point_idx = 0; point_idx < calc->window_count; point_idx++)
+		calc->window[(calc->window_first + point_idx) % PV_CALC_WINDOW_POINTS].transferred += amount;
+}
+
+
+/*
+ * Return the slope of the least squares line through the points in the
+ * average rate window, so that a single slow or fast step moves the
+ * estimate less than it moves the plain average.
+ */
+static long double pv__eta_rate_linear(readonly_pvtransfercalc_t calc)
+{
+	long double sum_t, sum_x, sum_tt, sum_tx, count, denominator;
+	unsigned int point_idx;
+
+	sum_t = 0.0;
+	sum_x = 0.0;
+	sum_tt = 0.0;
+	sum_tx = 0.0;
+
+	for (point_idx = 0; point_idx < calc->window_count; point_idx++) {
+		unsigned int idx, first;
+		long double t, x;
+
+		first = calc->window_first;
+		idx = (first + point_idx) % PV_CALC_WINDOW_POINTS;
+		/* Relative to the first point, to keep the sums small. */
+		t = (long double) (calc->window[idx].elapsed_nsec - calc->window[first].elapsed_nsec) / 1000000000.0L;
+		x = (long double) (calc->window[idx].transferred - calc->window[first].transferred);
+		sum_t += t;
+		sum_x += x;
+		sum_tt += t * t;
+		sum_tx += t * x;
+	}
+
+	count = (long double) (calc->window_count);
+	denominator = count * sum_tt - sum_t * sum_t;
+	if (denominator < 0.000001)
+		return calc->current_avg_rate;
+
+	return (count * sum_tx - sum_t * sum_x) / denominator;
+}
+
+
+/*
+ * Return the average rate over the current phase of the transfer - the
+ * run of most recent steps in the window whose rates are within a factor
+ * of PV_ETA_PHASE_RATIO of the phase's rate so far - so that when a
+ * transfer moves from, say, data in the cache to data on disk, the ETA
+ * follows the new rate straight away rather than over a whole window.
+ *
+ * The first few steps are always taken as part of the phase, so that one
+ * unusual step doesn't start a phase of its own.
+ */
+#define PV_ETA_PHASE_RATIO	2.0
+#define PV_ETA_PHASE_MIN_STEPS	3
+
+static long double pv__eta_rate_phase(readonly_pvtransfercalc_t calc)
+{
+	unsigned int last, oldest, steps;
+	long double phase_rate;
+
+	last = (calc->window_first + calc->window_count - 1) % PV_CALC_WINDOW_POINTS;
+	oldest = last;
+	phase_rate = 0.0;
+
+	for (steps = 1; steps < calc->window_count; steps++) {
+		unsigned int from;
+		long double step_rate;
+
+		from = (oldest + PV_CALC_WINDOW_POINTS - 1) % PV_CALC_WINDOW_POINTS;
+		step_rate = pv__window_rate(calc, from, oldest);
+
+		if ((steps > PV_ETA_PHASE_MIN_STEPS)
+		    && ((step_rate > phase_rate * PV_ETA_PHASE_RATIO)
+			|| (step_rate * PV_ETA_PHASE_RATIO < phase_rate)))
+			break;
+
+		oldest = from;
+		phase_rate = pv__window_rate(calc, oldest, last);
 	}
+
+	return phase_rate;
+}
+
+
+/*
+ * Update calc->eta_rate, the rate the ETA is worked out from, according to
+ * the ETA model selected in control->eta_model.
+ */
+static void pv__update_eta_rate(pvtransfercalc_t calc, readonly_pvcontrol_t control)
+{
+	if (calc->window_count < 2) {
+		calc->eta_rate = calc->current_avg_rate;
+		return;
+	}
+
+	switch (control->eta_model) {
+	case PV_ETAMODEL_LINEAR:
+		calc->eta_rate = pv__eta_rate_linear(calc);
+		break;
+	case PV_ETAMODEL_EWMA:
+		calc->eta_rate = calc->ewma_rate;
+		break;
+	case PV_ETAMODEL_PHASE:
+		calc->eta_rate = pv__eta_rate_phase(calc);
+		break;
+	case PV_ETAMODEL_AVERAGE:
+	default:
+		calc->eta_rate = calc->current_avg_rate;
+		break;
+	}
+}
+
+
+/*
+ * Return the average rate that the "--history" ramp says to expect over the
+ * first "elapsed" seconds of the transfer - the remembered rate in each
+ * second up to then, with the overall rate for any seconds after the
+ * ramp, or that the ramp has no figure for.
+ */
+static long double pv__prior_average_rate(readonly_pvtransfercalc_t calc, long double elapsed)
+{
+	long double amount;
+	unsigned int second;
+
+	if (elapsed <= 0.0)
+		return calc->prior_ramp[0] > 0.0 ? calc->prior_ramp[0] : calc->prior_rate;
+
+	amount = 0.0;
+	for (second = 0; second < PV_HISTORY_RAMP_SECONDS && (long double) second < elapsed; second++) {
+		long double span = elapsed - (long double) second;
+		if (span > 1.0)
+			span = 1.0;
+		amount += span * (calc->prior_ramp[second] > 0.0 ? calc->prior_ramp[second] : calc->prior_rate);
+	}
+	if (elapsed > (long double) PV_HISTORY_RAMP_SECONDS)
+		amount += (elapsed - (long double) PV_HISTORY_RAMP_SECONDS) * calc->prior_rate;
+
+	return amount / elapsed;
+}
+
+
+/*
+ * Until the average rate window has filled, mix the rates remembered by
+ * "--history" into the current average rate and the ETA rate, with the
+ * live measurements counting for the share of the window they cover, so
+ * that both start out near where earlier transfers ended up instead of
+ * at whatever the first few measurements happen to say.  Once the window
+ * is full the remembered rates are forgotten.
+ */
+static void pv__blend_prior_rate(pvtransfercalc_t calc, readonly_pvtransferstate_t transfer)
+{
+	long double live_share;
+	int64_t span_nsec;
+
+	if ((calc->prior_rate <= 0.0) || (calc->window_nsec < 1))
+		return;
+
+	span_nsec = 0;
+	if (calc->window_count > 1) {
+		unsigned int last = (calc->window_first + calc->window_count - 1) % PV_CALC_WINDOW_POINTS;
+		span_nsec = calc->window[last].elapsed_nsec - calc->window[calc->window_first].elapsed_nsec;
+	}
+	if (span_nsec + calc->window_step_nsec >= calc->window_nsec) {
+		calc->prior_rate = 0.0;
+		return;
+	}
+
+	live_share = (long double) span_nsec / (long double) (calc->window_nsec);
+
+	calc->current_avg_rate = live_share * calc->current_avg_rate
+	    + (1.0 - live_share) * pv__prior_average_rate(calc, transfer->elapsed_seconds);
+	calc->eta_rate = live_share * calc->eta_rate + (1.0 - live_share) * calc->prior_rate;
 }
 
 
@@ -116,6 +381,19 @@ void pv_calculate_transfer_rate(pvtransfercalc_t calc, readonly_pvtransferstate_
 		transfer_rate = ((long double) bytes_since_last + calc->prev_trans) / time_since_last;
 		measured_rate = transfer_rate;
 
+		/*
+		 * Fold the measurement into the exponentially weighted
+		 * average, weighting it by how much of the average rate
+		 * window it covers.
+		 */
+		if ((calc->measurements_taken < 1) || (calc->window_nsec < 1)) {
+			calc->ewma_rate = transfer_rate;
+		} else {
+			long double weight =
+			    time_since_last / (time_since_last + ((long double) (calc->window_nsec) / 1000000000.0L));
+			calc->ewma_rate += weight * (transfer_rate - calc->ewma_rate);
+		}
+
 		calc->prev_elapsed_sec = transfer->elapsed_seconds;
 		calc->prev_trans = 0;
 
@@ -134,8 +412,10 @@ void pv_calculate_transfer_rate(pvtransfercalc_t calc, readonly_pvtransferstate_
 	}
 	calc->prev_rate = transfer_rate;
 
-	/* Update history and current average rate for ETA. */
-	pv__update_average_rate_history(calc, transfer, control->history_interval, transfer_rate);
+	/* Update the window and the current average rate for ETA. */
+	pv__update_average_rate_window(calc, transfer, transfer_rate);
+	pv__update_eta_rate(calc, control);
+	pv__blend_prior_rate(calc, transfer);
 	average_rate = calc->current_avg_rate;
 
 	/*
@@ -0,0 +1,183 @@
+/*
+ * Functions for capturing the most recently written output, for the
+ * last-written ("%A") and previous-line ("%L") displays.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <string.h>
+
+/*
+ * Written data is only copied into a ring buffer, with no searching and
+ * no shuffling of what is already there, so each write costs at most one
+ * ring's worth of copying however much is written.  The last bytes and
+ * the last complete line are picked out of the ring when the display is
+ * drawn, and only if more has been written since they were last picked
+ * out, so that the rest of the work is done once per display interval
+ * rather than once per write.
+ *
+ * A line too long to fit in the ring alongside the line after it is shown
+ * from the oldest part of it that is still there; and if no line at all
+ * ends in the ring, the last line that was picked out is shown again.
+ */
+
+
+/*
+ * Add the "count" bytes at "data", which have just been written, to the
+ * display's capture ring.
+ */
+void pv_capture_add(pvdisplay_t display, const char *data, size_t count)
+{
+	size_t position, first_part;
+
+	if (0 == count)
+		return;
+
+	/* Only the end of a large write can stay in the ring. */
+	if (count > PV_SIZEOF_CAPTURE_RING) {
+		display->capture_total += (uint64_t) (count - PV_SIZEOF_CAPTURE_RING);
+		data += count - PV_SIZEOF_CAPTURE_RING;
+		count = PV_SIZEOF_CAPTURE_RING;
+	}
+
+	position = (size_t) (display->capture_total % PV_SIZEOF_CAPTURE_RING);
+	first_part = PV_SIZEOF_CAPTURE_RING - position;
+	if (first_part > count)
+		first_part = count;
+
+	memcpy(display->capture_ring + position, data, first_part);	/* flawfinder: ignore */
+	if (count > first_part)
+		memcpy(display->capture_ring, data + first_part, count - first_part);	/* flawfinder: ignore */
+	/*
+	 * flawfinder rationale: "count" is at most the size of the ring,
+	 * and each part is bounded by the space from "position" to the end
+	 * of the ring, or from the start of the ring.
+	 */
+
+	display->capture_total += (uint64_t) count;
+}
+
+
+/*
+ * Copy "count" bytes from the capture ring, starting at stream position
+ * "from", into "buffer".  The caller makes sure they are all still in the
+ * ring.
+ */
+static void pv__capture_copy(pvdisplay_t display, char *buffer, uint64_t from, size_t count)
+{
+	size_t position, first_part;
+
+	position = (size_t) (from % PV_SIZEOF_CAPTURE_RING);
+	first_part = PV_SIZEOF_CAPTURE_RING - position;
+	if (first_part > count)
+		first_part = count;
+
+	memcpy(buffer, display->capture_ring + position, first_part);	/* flawfinder: ignore */
+	if (count > first_part)
+		memcpy(buffer + first_part, display->capture_ring, count - first_part);	/* flawfinder: ignore */
+	/* flawfinder rationale: as in pv_capture_add(). */
+}
+
+
+/*
+ * Return the stream position of the last "separator" before stream
+ * position "before", no earlier than "oldest", or -1 if there is none.
+ * The ring is searched backwards in at most two contiguous pieces.
+ */
+static int64_t pv__capture_rfind(pvdisplay_t display, uint64_t oldest, uint64_t before, char separator)
+{
+	while (before > oldest) {
+		size_t end, start, length;
+		char *found;
+
+		end = (size_t) (((before - 1) % PV_SIZEOF_CAPTURE_RING) + 1);
+		length = end;
+		if ((uint64_t) length > before - oldest)
+			length = (size_t) (before - oldest);
+		start = end - length;
+
+		found = pv_memrchr(display->capture_ring + start, (int) separator, length);
+		if (NULL != found)
+			return (int64_t) (before - (uint64_t) (display->capture_ring + end - found));
+
+		before -= (uint64_t) length;
+	}
+
+	return -1;
+}
+
+
+/*
+ * Bring the display's last-written buffer up to date from the capture
+ * ring, with the last "lastwritten_bytes" bytes written, oldest first, as
+ * pv_formatter_last_written() expects.
+ */
+void pv_capture_last_written(pvdisplay_t display)
+{
+	size_t wanted, available;
+
+	wanted = (size_t) (display->lastwritten_bytes);
+	if (wanted > PV_SIZEOF_LASTWRITTEN_BUFFER)
+		wanted = PV_SIZEOF_LASTWRITTEN_BUFFER;
+
+	if ((display->capture_total == display->capture_lastwritten_at)
+	    && (wanted == display->capture_lastwritten_bytes))
+		return;
+	display->capture_lastwritten_at = display->capture_total;
+	display->capture_lastwritten_bytes = wanted;
+
+	available = wanted;
+	if ((uint64_t) available > display->capture_total)
+		available = (size_t) (display->capture_total);
+
+	/* Before there is enough, right-align what there is. */
+	memset(display->lastwritten_buffer, 0, wanted - available);
+	pv__capture_copy(display, display->lastwritten_buffer + wanted - available,
+			 display->capture_total - (uint64_t) available, available);
+}
+
+
+/*
+ * Bring the display's previous-line buffer up to date from the capture
+ * ring, with the last line ended by "separator".
+ */
+void pv_capture_previous_line(pvdisplay_t display, char separator)
+{
+	uint64_t oldest;
+	int64_t line_end, line_start;
+	size_t length;
+
+	if (display->capture_total == display->capture_previous_line_at)
+		return;
+	display->capture_previous_line_at = display->capture_total;
+
+	oldest = 0;
+	if (display->capture_total > PV_SIZEOF_CAPTURE_RING)
+		oldest = display->capture_total - PV_SIZEOF_CAPTURE_RING;
+
+	line_end = pv__capture_rfind(display, oldest, display->capture_total, separator);
+	if (line_end < 0)
+		return;
+
+	line_start = pv__capture_rfind(display, oldest, (uint64_t) line_end, separator);
+	if (line_start < 0) {
+		line_start = (int64_t) oldest;
+	} else {
+		line_start++;
+	}
+
+	length = (size_t) (line_end - line_start);
+	if (length > PV_SIZEOF_PREVLINE_BUFFER - 1)
+		length = PV_SIZEOF_PREVLINE_BUFFER - 1;
+
+	memset(display->previous_line, 0, PV_SIZEOF_PREVLINE_BUFFER);
+	pv__capture_copy(display, display->previous_line, (uint64_t) line_start, length);
+
+	debug("%s: [%s]", "updated previous_line", display->previous_line);
+}
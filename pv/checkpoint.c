@@ -0,0 +1,479 @@
+/*
+ * Functions for recording the progress of a transfer in a "--checkpoint"
+ * file, so that it can be resumed after being interrupted.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * Every PV_CHECKPOINT_INTERVAL seconds while data is moving, the output is
+ * flushed to disk and the checkpoint file is replaced with one recording
+ * how far the transfer has got: which input file it is on, the offset in
+ * that file and in the output to carry on from, the byte and line counts,
+ * and the running --digest state.  The output is flushed first so that
+ * the checkpoint never claims more than has reached the disk.
+ *
+ * The offsets are worked out from the number of bytes written, not from
+ * the file positions, since a reader thread or mapping may have read
+ * ahead of what has been written.
+ *
+ * When pv starts and the checkpoint file exists, the input and output are
+ * moved to the recorded offsets, the output is truncated there, and the
+ * counters are set to carry on from where they were, with the resumed
+ * part left out of the average rate.  Once a transfer completes, the
+ * checkpoint file is removed.
+ *
+ * The file is made up of lines of "key value", starting with a line
+ * identifying it, in the order they are written by pv__checkpoint_write();
+ * "file" is the name of the input the offsets refer to, and is only used
+ * to check that the same inputs were given again.
+ */
+#define PV_CHECKPOINT_INTERVAL	10		 /* seconds between checkpoints */
+#define PV_CHECKPOINT_MAGIC	"pv-checkpoint 1"
+#define PV_CHECKPOINT_LINE_LENGTH	4096	 /* longest line we accept */
+
+struct pvcheckpoint_s {
+	/*@only@*/ char *temp_filename;	 /* file written before the rename */
+	time_t last_written;		 /* when the checkpoint was last written */
+	off_t output_base;		 /* output offset with no bytes written */
+	off_t input_start;		 /* offset the current input started from */
+	off_t input_bytes;		 /* bytes written from the current input */
+	off_t total_bytes;		 /* bytes written from all inputs */
+	unsigned int file_index;	 /* index of the current input */
+	bool warned_input;		 /* shown the unseekable input warning */
+	bool failed;			 /* set once writing the file has failed */
+};
+
+
+/*
+ * Return the name of input file "file_index", as given on the command
+ * line, with "-" for standard input.
+ */
+static const char *pv__checkpoint_input_name(pvstate_t state, unsigned int file_index)
+{
+	if ((NULL == state->files.filename) || (file_index >= state->files.file_count))
+		return "-";
+	if (NULL == state->files.filename[file_index])
+		return "-";
+	return state->files.filename[file_index];
+}
+
+
+/*
+ * Write the checkpoint file, after flushing the output to disk.
+ */
+static void pv__checkpoint_write(pvstate_t state, struct pvcheckpoint_s *checkpoint)
+{
+	char digest_state[1024];	 /* flawfinder: ignore - bounded by pv_digest_save() */
+	const char *input_name;
+	FILE *stream;
+	int fd;
+
+	checkpoint->last_written = time(NULL);
+
+	if (checkpoint->failed)
+		return;
+
+	if ((!state->control.discard_input) && (0 != fdatasync(state->control.output_fd))
+	    && (EINVAL != errno) && (EROFS != errno)) {
+		pv_error("%s: %s", _("failed to flush the output for the checkpoint"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		return;
+	}
+
+	fd = open(checkpoint->temp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);	/* flawfinder: ignore */
+	/* flawfinder - the checkpoint file name is given by the operator. */
+	stream = (fd < 0) ? NULL : fdopen(fd, "w");
+	if (NULL == stream) {
+		pv_error("%s: %s", checkpoint->temp_filename, strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		if (fd >= 0)
+			(void) close(fd);
+		checkpoint->failed = true;
+		return;
+	}
+
+	input_name = pv__checkpoint_input_name(state, checkpoint->file_index);
+
+	fprintf(stream, "%s\n", PV_CHECKPOINT_MAGIC);
+	fprintf(stream, "files %u\n", state->files.file_count);
+	fprintf(stream, "index %u\n", checkpoint->file_index);
+	if (NULL == strchr(input_name, '\n'))
+		fprintf(stream, "file %s\n", input_name);
+	fprintf(stream, "input %lld\n", (long long) (checkpoint->input_start + checkpoint->input_bytes));
+	fprintf(stream, "output %lld\n", (long long) (checkpoint->output_base + checkpoint->total_bytes));
+	fprintf(stream, "bytes %lld\n", (long long) (checkpoint->total_bytes));
+	fprintf(stream, "written %lld\n", (long long) (state->transfer.total_written));
+	if (pv_digest_save(state, digest_state, sizeof(digest_state)))
+		fprintf(stream, "digest %s %s\n", pv_digest_name(state->control.digest), digest_state);
+
+	if ((0 != fflush(stream)) || (0 != fsync(fd))) {
+		pv_error("%s: %s", checkpoint->temp_filename, strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		(void) fclose(stream);
+		(void) unlink(checkpoint->temp_filename);
+		checkpoint->failed = true;
+		return;
+	}
+	if (0 != fclose(stream)) {
+		pv_error("%s: %s", checkpoint->temp_filename, strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		(void) unlink(checkpoint->temp_filename);
+		checkpoint->failed = true;
+		return;
+	}
+
+	if (0 != rename(checkpoint->temp_filename, state->control.checkpoint_file)) {
+		pv_error("%s: %s", state->control.checkpoint_file, strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		(void) unlink(checkpoint->temp_filename);
+		checkpoint->failed = true;
+		return;
+	}
+
+	debug("%s: %s=%u, %s=%lld", "checkpoint written", "index", checkpoint->file_index, "bytes",
+	      (long long) (checkpoint->total_bytes));
+}
+
+
+/*
+ * Resume from the checkpoint file, if there is one, switching to the input
+ * it was on - closing "input_fd" if that's a different file - and moving
+ * the input and output to where it left off.  Returns the input file
+ * descriptor to carry on with, or -1 on error.
+ */
+static int pv__checkpoint_resume(pvstate_t state, struct pvcheckpoint_s *checkpoint, unsigned int *file_idx,
+				 int input_fd)
+{
+	char line[PV_CHECKPOINT_LINE_LENGTH];	/* flawfinder: ignore - bounded by fgets() */
+	char digest_state[1024];	 /* flawfinder: ignore - bounded by sscanf() */
+	char digest_name[32];		 /* flawfinder: ignore - bounded by sscanf() */
+	long long input_offset, output_offset, total_bytes, total_written;
+	unsigned int file_count, file_index;
+	bool have_magic, name_matches;
+	FILE *stream;
+
+	stream = fopen(state->control.checkpoint_file, "r");	/* flawfinder: ignore */
+	/* flawfinder - the checkpoint file name is given by the operator. */
+	if (NULL == stream) {
+		if (ENOENT == errno)
+			return input_fd;
+		pv_error("%s: %s", state->control.checkpoint_file, strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		(void) close(input_fd);
+		return -1;
+	}
+
+	input_offset = -1;
+	output_offset = -1;
+	total_bytes = -1;
+	total_written = -1;
+	file_count = 0;
+	file_index = 0;
+	have_magic = false;
+	name_matches = true;
+	digest_name[0] = '\0';
+	digest_state[0] = '\0';
+
+	/* An empty file is taken as a fresh start. */
+	if (NULL == fgets(line, sizeof(line), stream)) {
+		(void) fclose(stream);
+		return input_fd;
+	}
+	if (0 == strncmp(line, PV_CHECKPOINT_MAGIC "\n", sizeof(PV_CHECKPOINT_MAGIC)))
+		have_magic = true;
+
+	while (have_magic && (NULL != fgets(line, sizeof(line), stream))) {
+		size_t length = strlen(line);	/* flawfinder: ignore - fgets() always \0-terminates */
+		if ((length > 0) && ('\n' == line[length - 1]))
+			line[length - 1] = '\0';
+		if (0 == strncmp(line, "file ", 5)) {
+			if (0 != strcmp(line + 5, pv__checkpoint_input_name(state, file_index)))
+				name_matches = false;
+		} else if (0 == strncmp(line, "digest ", 7)) {
+			if (2 != sscanf(line + 7, "%31s %1023s", digest_name, digest_state))
+				digest_name[0] = '\0';
+		} else if (0 == strncmp(line, "files ", 6)) {
+			(void) sscanf(line + 6, "%u", &file_count);
+		} else if (0 == strncmp(line, "index ", 6)) {
+			(void) sscanf(line + 6, "%u", &file_index);
+		} else if (0 == strncmp(line, "input ", 6)) {
+			(void) sscanf(line + 6, "%lld", &input_offset);
+		} else if (0 == strncmp(line, "output ", 7)) {
+			(void) sscanf(line + 7, "%lld", &output_offset);
+		} else if (0 == strncmp(line, "bytes ", 6)) {
+			(void) sscanf(line + 6, "%lld", &total_bytes);
+		} else if (0 == strncmp(line, "written ", 8)) {
+			(void) sscanf(line + 8, "%lld", &total_written);
+		}
+	}
+	(void) fclose(stream);
+
+	if ((!have_magic) || (input_offset < 0) || (output_offset < 0) || (total_bytes < 0)
+	    || (total_written < 0) || (file_index >= state->files.file_count)) {
+		pv_error("%s: %s", state->control.checkpoint_file, _("not a valid checkpoint file"));
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		(void) close(input_fd);
+		return -1;
+	}
+
+	if ((file_count != state->files.file_count) || (!name_matches)) {
+		pv_error("%s: %s", state->control.checkpoint_file,
+			 _("checkpoint was made with different input files"));
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		(void) close(input_fd);
+		return -1;
+	}
+
+	if ((PV_DIGEST_NONE != state->control.digest)
+	    && ((0 != strcmp(digest_name, pv_digest_name(state->control.digest)))
+		|| (!pv_digest_restore(state, digest_state)))) {
+		pv_error("%s: %s", state->control.checkpoint_file,
+			 _("checkpoint has no saved state for this --digest"));
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		(void) close(input_fd);
+		return -1;
+	}
+
+	if (file_index != *file_idx) {
+		input_fd = pv_next_file(state, file_index, input_fd);
+		if (input_fd < 0)
+			return -1;
+		*file_idx = file_index;
+	}
+
+	if (lseek(input_fd, (off_t) input_offset, SEEK_SET) != (off_t) input_offset) {
+		pv_error("%s: %s: %s", pv__checkpoint_input_name(state, file_index),
+			 _("failed to seek input to the checkpoint"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		(void) close(input_fd);
+		return -1;
+	}
+
+	if (!state->control.discard_input) {
+		struct stat sb;
+		if (lseek(state->control.output_fd, (off_t) output_offset, SEEK_SET) != (off_t) output_offset) {
+			pv_error("%s: %s", _("failed to seek output to the checkpoint"), strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_ACCESS;
+			(void) close(input_fd);
+			return -1;
+		}
+		/* Anything written after the checkpoint is written again. */
+		memset(&sb, 0, sizeof(sb));
+		if ((0 == fstat(state->control.output_fd, &sb)) && S_ISREG(sb.st_mode)
+		    && (0 != ftruncate(state->control.output_fd, (off_t) output_offset)))
+			debug("%s: %s", "output ftruncate() failed", strerror(errno));
+	}
+
+	checkpoint->file_index = file_index;
+	checkpoint->input_start = (off_t) input_offset;
+	checkpoint->input_bytes = 0;
+	checkpoint->total_bytes = (off_t) total_bytes;
+	checkpoint->output_base = (off_t) (output_offset - total_bytes);
+
+	/* Carry the progress on, leaving the resumed part out of the rate. */
+	state->transfer.total_written = (off_t) total_written;
+	state->transfer.transferred = (off_t) total_written;
+	state->transfer.total_bytes_read = (off_t) total_bytes;
+	state->display.initial_offset = (off_t) total_written;
+	state->calc.prev_transferred = (off_t) total_written;
+
+	debug("%s: %s=%u, %s=%lld, %s=%lld, %s=%lld", "resuming from checkpoint", "index", file_index, "input",
+	      input_offset, "output", output_offset, "written", total_written);
+
+	return input_fd;
+}
+
+
+/*
+ * Start recording checkpoints, having opened "input_fd", the first input
+ * file, number *file_idx.  If the checkpoint file already exists, resume
+ * from it, which may switch to a later input file and update *file_idx.
+ * Returns the input file descriptor to carry on with, or -1 on error.
+ */
+int pv_checkpoint_start(pvstate_t state, unsigned int *file_idx, int input_fd)
+{
+	struct pvcheckpoint_s *checkpoint;
+	size_t name_length;
+	off_t output_base;
+
+	if (NULL == state->control.checkpoint_file)
+		return input_fd;
+
+	output_base = 0;
+	if (!state->control.discard_input) {
+		int flags = fcntl(state->control.output_fd, F_GETFL);
+		if ((flags >= 0) && (0 != (flags & O_APPEND))) {
+			output_base = lseek(state->control.output_fd, 0, SEEK_END);
+		} else {
+			output_base = lseek(state->control.output_fd, 0, SEEK_CUR);
+		}
+		if (output_base < 0) {
+			pv_error("%s: %s", _("output is not seekable - not writing checkpoints"), strerror(errno));
+			return input_fd;
+		}
+	}
+
+	checkpoint = calloc(1, sizeof(*checkpoint));
+	if (NULL == checkpoint) {
+		pv_error("%s: %s", _("checkpoint allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		return input_fd;
+	}
+
+	name_length = strlen(state->control.checkpoint_file) + 32;	/* flawfinder: ignore - always \0-terminated */
+	checkpoint->temp_filename = malloc(name_length);
+	if (NULL == checkpoint->temp_filename) {
+		pv_error("%s: %s", _("checkpoint allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		free(checkpoint);
+		return input_fd;
+	}
+	(void) pv_snprintf(checkpoint->temp_filename, name_length, "%s.tmp.%lu", state->control.checkpoint_file,
+			   (unsigned long) getpid());
+
+	checkpoint->output_base = output_base;
+	checkpoint->file_index = *file_idx;
+	checkpoint->input_start = lseek(input_fd, 0, SEEK_CUR);
+	if (checkpoint->input_start < 0)
+		checkpoint->input_start = 0;
+	checkpoint->last_written = time(NULL);
+
+	state->status.checkpoint = checkpoint;
+
+	input_fd = pv__checkpoint_resume(state, checkpoint, file_idx, input_fd);
+	if (input_fd < 0) {
+		/* Leave the checkpoint file as it was. */
+		checkpoint->failed = true;
+		return -1;
+	}
+
+	/* Starting afresh - lose anything beyond where we start writing. */
+	if ((0 == checkpoint->total_bytes) && (!state->control.discard_input)) {
+		struct stat sb;
+		memset(&sb, 0, sizeof(sb));
+		if ((0 == fstat(state->control.output_fd, &sb)) && S_ISREG(sb.st_mode)
+		    && (sb.st_size > output_base) && (0 != ftruncate(state->control.output_fd, output_base)))
+			debug("%s: %s", "output ftruncate() failed", strerror(errno));
+	}
+
+	if ((!checkpoint->warned_input) && (lseek(input_fd, 0, SEEK_CUR) < 0)) {
+		/*@-compdef@ */
+		pv_error("%s: %s", pv_current_file_name(state),
+			 _("input is not seekable - the transfer cannot be resumed from a checkpoint"));
+		/*@+compdef@ */
+		/* splint - see pv_current_file_name() calls in transfer.c. */
+		checkpoint->warned_input = true;
+	}
+
+	return input_fd;
+}
+
+
+/*
+ * Note that input file "file_index" has been opened as "fd", so that
+ * checkpoint offsets are taken from the start of it.
+ */
+void pv_checkpoint_input_opened(pvstate_t state, unsigned int file_index, int fd)
+{
+	struct pvcheckpoint_s *checkpoint;
+
+	checkpoint = state->status.checkpoint;
+	if (NULL == checkpoint)
+		return;
+
+	checkpoint->file_index = file_index;
+	checkpoint->input_bytes = 0;
+	checkpoint->input_start = lseek(fd, 0, SEEK_CUR);
+	if (checkpoint->input_start < 0) {
+		checkpoint->input_start = 0;
+		if (!checkpoint->warned_input) {
+			/*@-compdef@ */
+			pv_error("%s: %s", pv_current_file_name(state),
+				 _("input is not seekable - the transfer cannot be resumed from a checkpoint"));
+			/*@+compdef@ */
+			/* splint - see pv_current_file_name() calls in transfer.c. */
+			checkpoint->warned_input = true;
+		}
+	}
+}
+
+
+/*
+ * Count "written" more bytes as written to the output from the current
+ * input, and write a checkpoint if one is due.
+ */
+void pv_checkpoint_update(pvstate_t state, ssize_t written)
+{
+	struct pvcheckpoint_s *checkpoint;
+
+	checkpoint = state->status.checkpoint;
+	if ((NULL == checkpoint) || (written <= 0))
+		return;
+
+	checkpoint->input_bytes += (off_t) written;
+	checkpoint->total_bytes += (off_t) written;
+
+	if (time(NULL) - checkpoint->last_written >= PV_CHECKPOINT_INTERVAL)
+		pv__checkpoint_write(state, checkpoint);
+}
+
+
+/*
+ * At the end of the transfer, remove the checkpoint file if "complete" is
+ * true, or write a final checkpoint if not, and stop recording them.
+ */
+void pv_checkpoint_finish(pvstate_t state, bool complete)
+{
+	struct pvcheckpoint_s *checkpoint;
+
+	checkpoint = state->status.checkpoint;
+	if (NULL == checkpoint)
+		return;
+
+	if (checkpoint->failed) {
+		debug("%s", "checkpoint file left alone");
+	} else if (complete) {
+		if ((0 != unlink(state->control.checkpoint_file)) && (ENOENT != errno))
+			pv_error("%s: %s", state->control.checkpoint_file, strerror(errno));
+		debug("%s", "transfer complete - checkpoint file removed");
+	} else {
+		pv__checkpoint_write(state, checkpoint);
+	}
+
+	pv_checkpoint_free(state);
+}
+
+
+/*
+ * Free the checkpoint state, if there is any, without writing anything.
+ */
+void pv_checkpoint_free(pvstate_t state)
+{
+	struct pvcheckpoint_s *checkpoint;
+
+	if ((NULL == state) || (NULL == state->status.checkpoint))
+		return;
+
+	checkpoint = state->status.checkpoint;
+	state->status.checkpoint = NULL;
+
+	free(checkpoint->temp_filename);
+	free(checkpoint);
+}
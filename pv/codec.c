@@ -0,0 +1,700 @@
+/*
+ * Functions for compressing or decompressing the data on its way through,
+ * for "--compress" and "--decompress".
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4FRAME_H
+#include <lz4frame.h>
+#endif
+
+/*
+ * The codec sits in the read path: instead of read() filling the transfer
+ * buffer, pv_codec_read() reads the input into a buffer of its own, and
+ * what comes out of the compressor or decompressor goes into the transfer
+ * buffer.  Everything after that - line counting, --sparse, --digest,
+ * extra outputs, and the write itself - sees the transformed data, and the
+ * byte counts are of the data written.
+ *
+ * All of the input files are compressed as one stream, as if they were
+ * concatenated and piped into the compressor, and the stream is only ended
+ * after the last one.  When decompressing, each input file may hold any
+ * number of frames, but must not end part way through one.
+ *
+ * zstd compresses with one worker thread per processor, like "zstd -T0",
+ * so the main loop only has to hand it the input and collect the output;
+ * lz4 is fast enough not to need them.
+ *
+ * Since the size of the input is what is known up front, while the
+ * progress is counted in what is written, pv_codec_update() scales the
+ * size by the ratio seen so far, so that the percentage and ETA follow
+ * the input.  When decompressing files which record how big they will be
+ * once decompressed, as zstd frames usually do, the total of those sizes
+ * is used instead, with no scaling.
+ */
+#define PV_CODEC_INPUT_SIZE	(256 * 1024)	/* bytes of input read at once */
+#define PV_CODEC_LZ4_BLOCK	(64 * 1024)	/* input bytes per lz4 update */
+#define PV_CODEC_STALL_NSEC	1000000	/* wait when the codec is busy */
+
+struct pvcodec_s {
+	/*@only@ */ char *input;	 /* input read from the file */
+	size_t input_start;		 /* offset of the first unconsumed input byte */
+	size_t input_end;		 /* offset after the last input byte read */
+	/*@only@ */ /*@null@ */ char *pending; /* output not yet handed over */
+	size_t pending_size;		 /* size of the pending buffer */
+	size_t pending_start;		 /* offset of the first pending byte */
+	size_t pending_end;		 /* offset after the last pending byte */
+	off_t bytes_in;			 /* bytes read from the input */
+	off_t bytes_out;		 /* bytes handed over for writing */
+	off_t sample_in;		 /* bytes_in at the last rate sample */
+	off_t sample_out;		 /* bytes_out at the last rate sample */
+	long long sample_time;		 /* time of the last rate sample, coarse nsec */
+	long double rate_in;		 /* input bytes per second */
+	long double rate_out;		 /* output bytes per second */
+	off_t base_size;		 /* total size before scaling */
+	off_t scaled_size;		 /* total size as last scaled */
+	off_t hinted_size;		 /* decompressed size of all inputs, or -1 */
+	int input_file;			 /* index of the input file being read */
+	pvcodec_t codec;		 /* which codec */
+	bool compress;			 /* set if compressing, not decompressing */
+	bool input_eof;			 /* set at the end of the current input file */
+	bool in_frame;			 /* part way through a frame */
+	bool ended;			 /* compressing: the stream has been ended */
+	bool failed;			 /* an error has been reported */
+	bool sampled;			 /* set once sample_time has been set */
+	bool hint_checked;		 /* set once hinted_size has been looked for */
+	bool holding;			 /* output may come without more input */
+#ifdef HAVE_ZSTD_H
+	/*@null@ */ ZSTD_CCtx *zstd_compressor;
+	/*@null@ */ ZSTD_DCtx *zstd_decompressor;
+#endif
+#ifdef HAVE_LZ4FRAME_H
+	/*@null@ */ LZ4F_cctx *lz4_compressor;
+	/*@null@ */ LZ4F_dctx *lz4_decompressor;
+	LZ4F_preferences_t lz4_preferences;
+#endif
+};
+
+
+/*
+ * Return the name of a codec.
+ */
+const char *pv_codec_name(pvcodec_t codec)
+{
+	switch (codec) {
+	case PV_CODEC_ZSTD:
+		return "zstd";
+	case PV_CODEC_LZ4:
+		return "lz4";
+	case PV_CODEC_NONE:
+		break;
+	}
+	return "none";
+}
+
+
+/*
+ * Report a codec failure on the current input file, and stop producing
+ * output.
+ */
+static void pv__codec_fail(pvstate_t state, struct pvcodec_s *codec, const char *message)
+{
+	/*@-mustfreefresh@ *//* splint: see below about gettext _() calls. */
+	pv_error("%s: %s: %s", pv_current_file_name(state),
+		 codec->compress ? _("compression failed") : _("decompression failed"), message);
+	/*@+mustfreefresh@ */
+	state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+	codec->failed = true;
+}
+
+
+/*
+ * Allocate the codec state and set up the compressor or decompressor.
+ * Returns NULL on error, after reporting it.
+ */
+/*@null@ */
+static struct pvcodec_s *pv__codec_new(pvstate_t state)
+{
+	struct pvcodec_s *codec;
+
+	codec = calloc(1, sizeof(*codec));
+	if (NULL == codec) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		return NULL;
+	}
+
+	codec->codec = state->control.codec;
+	codec->compress = state->control.codec_compress;
+	codec->input_file = -2;
+	codec->input = malloc(PV_CODEC_INPUT_SIZE);
+	if (NULL == codec->input) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		free(codec);
+		return NULL;
+	}
+
+	switch (codec->codec) {
+#ifdef HAVE_ZSTD_H
+	case PV_CODEC_ZSTD:
+		if (codec->compress) {
+			codec->zstd_compressor = ZSTD_createCCtx();
+			if (NULL != codec->zstd_compressor) {
+				long processors = 1;
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+				processors = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+				(void) ZSTD_CCtx_setParameter(codec->zstd_compressor, ZSTD_c_compressionLevel,
+							      0 == state->control.codec_level ? ZSTD_CLEVEL_DEFAULT :
+							      state->control.codec_level);
+				/* Not all builds of libzstd have threads. */
+				if ((processors > 1)
+				    &&
+				    ZSTD_isError(ZSTD_CCtx_setParameter
+						 (codec->zstd_compressor, ZSTD_c_nbWorkers, (int) processors))) {
+					debug("%s", "zstd: worker threads not available");
+				}
+			}
+		} else {
+			codec->zstd_decompressor = ZSTD_createDCtx();
+		}
+		if ((NULL == codec->zstd_compressor) && (NULL == codec->zstd_decompressor)) {
+			pv_error("%s: %s", "zstd", _("failed to set up the codec"));
+			state->status.exit_status |= PV_ERROREXIT_MEMORY;
+			free(codec->input);
+			free(codec);
+			return NULL;
+		}
+		break;
+#endif				/* HAVE_ZSTD_H */
+#ifdef HAVE_LZ4FRAME_H
+	case PV_CODEC_LZ4:
+		memset(&(codec->lz4_preferences), 0, sizeof(codec->lz4_preferences));
+		codec->lz4_preferences.compressionLevel = state->control.codec_level;
+		if (codec->compress) {
+			codec->pending_size =
+			    LZ4F_compressBound(PV_CODEC_LZ4_BLOCK, &(codec->lz4_preferences)) + LZ4F_HEADER_SIZE_MAX;
+			codec->pending = malloc(codec->pending_size);
+			if (LZ4F_isError(LZ4F_createCompressionContext(&(codec->lz4_compressor), LZ4F_VERSION)))
+				codec->lz4_compressor = NULL;
+		} else if (LZ4F_isError(LZ4F_createDecompressionContext(&(codec->lz4_decompressor), LZ4F_VERSION))) {
+			codec->lz4_decompressor = NULL;
+		}
+		if (((NULL == codec->lz4_compressor) && (NULL == codec->lz4_decompressor))
+		    || (codec->compress && (NULL == codec->pending))) {
+			pv_error("%s: %s", "lz4", _("failed to set up the codec"));
+			state->status.exit_status |= PV_ERROREXIT_MEMORY;
+			if (NULL != codec->lz4_compressor)
+				(void) LZ4F_freeCompressionContext(codec->lz4_compressor);
+			if (NULL != codec->pending)
+				free(codec->pending);
+			free(codec->input);
+			free(codec);
+			return NULL;
+		}
+		break;
+#endif				/* HAVE_LZ4FRAME_H */
+	default:
+		pv_error("%s: %s", pv_codec_name(codec->codec), _("codec not supported in this build"));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		free(codec->input);
+		free(codec);
+		return NULL;
+	}
+
+	debug("%s: %s: %s", "codec started", pv_codec_name(codec->codec), codec->compress ? "compress" : "decompress");
+
+	return codec;
+}
+
+
+/*
+ * Return true if there is input waiting to be read from "fd" right now.
+ */
+static bool pv__codec_input_ready(int fd)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	return (poll(&pfd, 1, 0) > 0);
+}
+
+
+/*
+ * Run the codec once over the unconsumed input, putting up to "room"
+ * bytes of output at "dest", or into the pending buffer, and returning how
+ * many bytes went to "dest".  If "finishing", the stream is ended.
+ *
+ * Sets *idle if nothing more will come out without more input, and
+ * *stalled if the codec could not take any of the input just now.
+ */
+static size_t pv__codec_step(pvstate_t state, struct pvcodec_s *codec, char *dest, size_t room, bool finishing,
+			     bool *idle, bool *stalled)
+{
+	*idle = false;
+	*stalled = false;
+
+	switch (codec->codec) {
+#ifdef HAVE_ZSTD_H
+	case PV_CODEC_ZSTD:
+		{
+			size_t available = codec->input_end - codec->input_start;
+			ZSTD_inBuffer in = { codec->input + codec->input_start, available, 0 };
+			ZSTD_outBuffer out = { dest, room, 0 };
+			size_t ret;
+
+			if (codec->compress) {
+				if (codec->ended) {
+					*idle = true;
+					return 0;
+				}
+				ret =
+				    ZSTD_compressStream2(codec->zstd_compressor, &out, &in,
+							 finishing ? ZSTD_e_end : ZSTD_e_continue);
+			} else {
+				ret = ZSTD_decompressStream(codec->zstd_decompressor, &out, &in);
+			}
+			if (ZSTD_isError(ret)) {
+				pv__codec_fail(state, codec, ZSTD_getErrorName(ret));
+				*idle = true;
+				return 0;
+			}
+
+			codec->input_start += in.pos;
+
+			if (codec->compress) {
+				codec->in_frame = true;
+				if (finishing) {
+					*idle = (0 == ret);
+					codec->ended = *idle;
+				} else {
+					*idle = (in.pos == in.size) && (out.pos < out.size);
+				}
+			} else {
+				if ((in.pos > 0) || (out.pos > 0))
+					codec->in_frame = (0 != ret);
+				*idle = (in.pos == in.size) && (out.pos < out.size);
+			}
+			*stalled = (available > 0) && (0 == in.pos) && (0 == out.pos);
+
+			return out.pos;
+		}
+#endif				/* HAVE_ZSTD_H */
+#ifdef HAVE_LZ4FRAME_H
+	case PV_CODEC_LZ4:
+		if (codec->compress) {
+			size_t available = codec->input_end - codec->input_start;
+			size_t ret;
+
+			/*
+			 * lz4 writes whole blocks at once, so its output goes
+			 * into the pending buffer, which is always empty by
+			 * the time we get here.
+			 */
+			if (codec->ended) {
+				*idle = true;
+				return 0;
+			}
+			if (!codec->in_frame) {
+				ret =
+				    LZ4F_compressBegin(codec->lz4_compressor, codec->pending, codec->pending_size,
+						       &(codec->lz4_preferences));
+				codec->in_frame = true;
+			} else if (available > 0) {
+				size_t chunk = available > PV_CODEC_LZ4_BLOCK ? PV_CODEC_LZ4_BLOCK : available;
+				ret =
+				    LZ4F_compressUpdate(codec->lz4_compressor, codec->pending, codec->pending_size,
+							codec->input + codec->input_start, chunk, NULL);
+				if (!LZ4F_isError(ret))
+					codec->input_start += chunk;
+			} else if (finishing) {
+				ret = LZ4F_compressEnd(codec->lz4_compressor, codec->pending, codec->pending_size, NULL);
+				codec->ended = true;
+			} else {
+				*idle = true;
+				return 0;
+			}
+			if (LZ4F_isError(ret)) {
+				pv__codec_fail(state, codec, LZ4F_getErrorName(ret));
+				*idle = true;
+				return 0;
+			}
+			codec->pending_start = 0;
+			codec->pending_end = ret;
+			return 0;
+		} else {
+			size_t src_size = codec->input_end - codec->input_start;
+			size_t dst_size = room;
+			size_t ret;
+
+			ret =
+			    LZ4F_decompress(codec->lz4_decompressor, dest, &dst_size, codec->input + codec->input_start,
+					    &src_size, NULL);
+			if (LZ4F_isError(ret)) {
+				pv__codec_fail(state, codec, LZ4F_getErrorName(ret));
+				*idle = true;
+				return 0;
+			}
+			codec->input_start += src_size;
+			if ((src_size > 0) || (dst_size > 0))
+				codec->in_frame = (0 != ret);
+			*idle = (codec->input_start >= codec->input_end) && (dst_size < room);
+			return dst_size;
+		}
+#endif				/* HAVE_LZ4FRAME_H */
+	default:
+		break;
+	}
+
+#if !defined(HAVE_ZSTD_H) && !defined(HAVE_LZ4FRAME_H)
+	/* Without either library, there is nothing to run. */
+	(void) state;
+	(void) dest;
+	(void) room;
+	(void) finishing;
+#endif
+
+	*idle = true;
+	return 0;
+}
+
+
+/*
+ * Read from "fd" through the codec, putting up to "count" bytes of its
+ * output into "buffer", in place of read().
+ *
+ * Returns the number of bytes put into the buffer; 0 at the end of this
+ * input file, once everything from it has come out, or after a codec
+ * error, which is reported here; -1 on a read error, with errno set; or
+ * -2 if the input read so far has not produced any output yet.
+ */
+ssize_t pv_codec_read(pvstate_t state, int fd, char *buffer, size_t count)
+{
+	struct pvcodec_s *codec;
+	size_t produced;
+	bool last_file, did_read, idle;
+
+	if (0 == count)
+		return 0;
+
+	codec = state->transfer.codec;
+	if (NULL == codec) {
+		codec = pv__codec_new(state);
+		if (NULL == codec)
+			return 0;
+		state->transfer.codec = codec;
+	}
+
+	/* A new input file - a decompression failure only ends the one file. */
+	if (codec->input_file != state->status.current_input_file) {
+		codec->input_file = state->status.current_input_file;
+		codec->input_eof = false;
+		codec->input_start = 0;
+		codec->input_end = 0;
+		if (codec->failed && !codec->compress) {
+			codec->failed = false;
+			codec->in_frame = false;
+#ifdef HAVE_ZSTD_H
+			if (NULL != codec->zstd_decompressor)
+				(void) ZSTD_DCtx_reset(codec->zstd_decompressor, ZSTD_reset_session_only);
+#endif
+#ifdef HAVE_LZ4FRAME_H
+			if (NULL != codec->lz4_decompressor)
+				LZ4F_resetDecompressionContext(codec->lz4_decompressor);
+#endif
+		}
+	}
+
+	last_file = (state->status.current_input_file < 0)
+	    || ((unsigned int) (state->status.current_input_file + 1) >= state->files.file_count);
+
+	produced = 0;
+	did_read = false;
+	idle = false;
+
+	while ((produced < count) && (!codec->failed)) {
+		bool stalled;
+		ssize_t nread;
+
+		/* Hand over any output held back from before. */
+		if (codec->pending_start < codec->pending_end) {
+			size_t amount = codec->pending_end - codec->pending_start;
+			if (amount > count - produced)
+				amount = count - produced;
+			memcpy(buffer + produced, codec->pending + codec->pending_start, amount);	/* flawfinder: ignore */
+			/* flawfinder - bounded by both buffers' remaining space. */
+			codec->pending_start += amount;
+			produced += amount;
+			continue;
+		}
+
+		produced +=
+		    pv__codec_step(state, codec, buffer + produced, count - produced,
+				   codec->compress && codec->input_eof && last_file, &idle, &stalled);
+
+		if (codec->pending_start < codec->pending_end)
+			continue;
+
+		if (stalled) {
+			/* The worker threads are all busy - give them a moment. */
+			if (produced > 0)
+				break;
+			pv_nanosleep(PV_CODEC_STALL_NSEC);
+			continue;
+		}
+
+		if (!idle)
+			continue;
+
+		/* Nothing more will come out without more input. */
+		if (codec->input_eof || (produced > 0))
+			break;
+		if (codec->input_start < codec->input_end)
+			continue;
+		if (did_read && (!pv__codec_input_ready(fd)))
+			break;
+
+		nread = read(fd, codec->input, PV_CODEC_INPUT_SIZE);	/* flawfinder: ignore */
+		/* flawfinder - bounded by the size of the input buffer. */
+		did_read = true;
+		if (nread < 0)
+			return -1;
+		codec->input_start = 0;
+		codec->input_end = (size_t) nread;
+		codec->bytes_in += nread;
+		if (0 == nread)
+			codec->input_eof = true;
+	}
+
+	codec->bytes_out += (off_t) produced;
+
+	codec->holding = (!codec->failed)
+	    && ((!idle) || (codec->input_start < codec->input_end) || (codec->pending_start < codec->pending_end));
+
+	if (produced > 0)
+		return (ssize_t) produced;
+
+	if (codec->failed)
+		return 0;
+
+	if (codec->input_eof && idle) {
+		if ((!codec->compress) && codec->in_frame) {
+			pv__codec_fail(state, codec, _("the input ends part way through a frame"));
+			codec->in_frame = false;
+		}
+		return 0;
+	}
+
+	return -2;
+}
+
+
+/*
+ * Return true if the codec may have more output to give without any more
+ * input being read, so that the main loop shouldn't wait for the input.
+ */
+bool pv_codec_holding(readonly_pvtransferstate_t transfer)
+{
+	if (NULL == transfer->codec)
+		return false;
+	return transfer->codec->holding;
+}
+
+
+/*
+ * Return the total decompressed size of all of the input files, from the
+ * sizes they record, or -1 if that isn't known for all of them.
+ */
+static off_t pv__codec_size_hint(pvstate_t state)
+{
+	unsigned int file_idx;
+	off_t total;
+
+	if ((state->files.file_count < 1) || (NULL == state->files.filename))
+		return pv_sizehint_fd(STDIN_FILENO);
+
+	total = 0;
+	for (file_idx = 0; file_idx < state->files.file_count; file_idx++) {
+		const char *filename = state->files.filename[file_idx];
+		off_t size;
+
+		if (NULL == filename)
+			return -1;
+		if (0 == strcmp(filename, "-")) {
+			size = pv_sizehint_fd(STDIN_FILENO);
+		} else {
+			size = pv_sizehint_file(filename);
+		}
+		if (size < 0)
+			return -1;
+		total += size;
+	}
+
+	debug("%s: %lld", "decompressed size of inputs", (long long) total);
+
+	return total;
+}
+
+
+/*
+ * Sample the codec's rates, and scale the total size by the ratio so far,
+ * so that the percentage and ETA follow the input while the output is
+ * counted.  Called each time round the main loop.
+ */
+void pv_codec_update(pvstate_t state)
+{
+	struct pvcodec_s *codec;
+	long long now;
+	long double seconds;
+	off_t raw_progress, scaled;
+
+	codec = state->transfer.codec;
+	if (NULL == codec)
+		return;
+
+	/* The rates are sampled over whole intervals, so the coarse clock will do. */
+	now = pv_elapsedtime_coarse_nsec();
+	if (!codec->sampled) {
+		codec->sample_time = now;
+		codec->sampled = true;
+	}
+	seconds = ((long double) (now - codec->sample_time)) / 1000000000.0L;
+	if ((seconds > 0.0) && (seconds >= (long double) (state->control.interval))) {
+		codec->rate_in = (long double) (codec->bytes_in - codec->sample_in) / seconds;
+		codec->rate_out = (long double) (codec->bytes_out - codec->sample_out) / seconds;
+		codec->sample_time = now;
+		codec->sample_in = codec->bytes_in;
+		codec->sample_out = codec->bytes_out;
+	}
+
+	if (state->control.stop_at_size || state->control.linemode)
+		return;
+
+	if (!codec->hint_checked) {
+		codec->hint_checked = true;
+		codec->hinted_size = codec->compress ? -1 : pv__codec_size_hint(state);
+	}
+	if (codec->hinted_size > 0) {
+		state->control.size = codec->hinted_size;
+		return;
+	}
+
+	if (state->control.size <= 0)
+		return;
+	if ((codec->bytes_in <= 0) || (codec->bytes_out <= 0))
+		return;
+
+	/* Something else has changed the size, such as a background scan. */
+	if (state->control.size != codec->scaled_size)
+		codec->base_size = state->control.size;
+
+	raw_progress = codec->bytes_in;
+	if (raw_progress > codec->base_size)
+		raw_progress = codec->base_size;
+
+	scaled = (off_t) ((long double) (codec->base_size) * (long double) (codec->bytes_out) /
+			  (long double) (codec->bytes_in));
+
+	/* Once everything has been through, the size is exactly known. */
+	if (codec->ended || ((!codec->compress) && codec->input_eof && (raw_progress >= codec->base_size)))
+		scaled = codec->bytes_out;
+
+	if (scaled < state->transfer.total_written)
+		scaled = state->transfer.total_written;
+	if (scaled < 1)
+		scaled = 1;
+
+	codec->scaled_size = scaled;
+	state->control.size = scaled;
+}
+
+
+/*
+ * Put the rates of the uncompressed and compressed data, in bytes per
+ * second, and the ratio between the amounts of each so far, into the
+ * given variables.  Returns false if there is no codec in use.
+ */
+bool pv_codec_rates(readonly_pvtransferstate_t transfer, long double *raw_rate, long double *compressed_rate,
+		    long double *ratio)
+{
+	const struct pvcodec_s *codec;
+	off_t raw_bytes, compressed_bytes;
+
+	codec = transfer->codec;
+	if (NULL == codec)
+		return false;
+
+	if (codec->compress) {
+		*raw_rate = codec->rate_in;
+		*compressed_rate = codec->rate_out;
+		raw_bytes = codec->bytes_in;
+		compressed_bytes = codec->bytes_out;
+	} else {
+		*raw_rate = codec->rate_out;
+		*compressed_rate = codec->rate_in;
+		raw_bytes = codec->bytes_out;
+		compressed_bytes = codec->bytes_in;
+	}
+
+	*ratio = 0.0;
+	if (compressed_bytes > 0)
+		*ratio = (long double) raw_bytes / (long double) compressed_bytes;
+
+	return true;
+}
+
+
+/*
+ * Free the codec state.
+ */
+void pv_codec_free(pvtransferstate_t transfer)
+{
+	struct pvcodec_s *codec;
+
+	if ((NULL == transfer) || (NULL == transfer->codec))
+		return;
+
+	codec = transfer->codec;
+	transfer->codec = NULL;
+
+	debug("%s: %s=%lld, %s=%lld", "codec finished", "in", (long long) (codec->bytes_in), "out",
+	      (long long) (codec->bytes_out));
+
+#ifdef HAVE_ZSTD_H
+	if (NULL != codec->zstd_compressor)
+		(void) ZSTD_freeCCtx(codec->zstd_compressor);
+	if (NULL != codec->zstd_decompressor)
+		(void) ZSTD_freeDCtx(codec->zstd_decompressor);
+#endif
+#ifdef HAVE_LZ4FRAME_H
+	if (NULL != codec->lz4_compressor)
+		(void) LZ4F_freeCompressionContext(codec->lz4_compressor);
+	if (NULL != codec->lz4_decompressor)
+		(void) LZ4F_freeDecompressionContext(codec->lz4_decompressor);
+#endif
+	if (NULL != codec->pending)
+		free(codec->pending);
+	free(codec->input);
+	free(codec);
+}
@@ -0,0 +1,1023 @@
+/*
+ * Functions for the per-process control socket, which lets other programs
+ * read and change settings and subscribe to live counters, and which
+ * "--remote" and "--query" use in preference to signals.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * The socket is a Unix domain datagram socket at
+ * /run/user/<uid>/pv.control.<pid>, or $HOME/.pv/control.<pid>.  Each
+ * datagram is one request, a command followed by space-separated words,
+ * and is answered with one datagram sent back to the address it came
+ * from, so clients must bind their own socket first.  Replies start with
+ * "ok" or "error".  Values are written as NAME=VALUE, with any spaces,
+ * "%", "=", and control characters in VALUE encoded as "%XX".
+ *
+ *   get [NAME...]           reply "ok NAME=VALUE..." (all fields if none)
+ *   set NAME=VALUE...       change all of the settings together, or none
+ *   subscribe [SECONDS]     send "stats NAME=VALUE..." every SECONDS
+ *   unsubscribe             stop sending "stats" to this address
+ *
+ * Because a datagram socket is one descriptor however many clients there
+ * are, it only needs one slot in the main loop's poller, and replies are
+ * sent without blocking - a client that isn't keeping up just misses
+ * updates.  When the transfer ends, subscribers are sent the final totals
+ * as "end NAME=VALUE...".
+ */
+
+/* Field identifiers for get and set. */
+typedef enum {
+	PV_CTLSOCK_RATE_LIMIT,
+	PV_CTLSOCK_RATE_BURST,
+	PV_CTLSOCK_BUFFER_SIZE,
+	PV_CTLSOCK_SIZE,
+	PV_CTLSOCK_INTERVAL,
+	PV_CTLSOCK_WIDTH,
+	PV_CTLSOCK_HEIGHT,
+	PV_CTLSOCK_AVERAGE_RATE_WINDOW,
+	PV_CTLSOCK_NAME,
+	PV_CTLSOCK_FORMAT,
+	PV_CTLSOCK_EXTRA_DISPLAY,
+	PV_CTLSOCK_SHOW_PROGRESS,
+	PV_CTLSOCK_SHOW_TIMER,
+	PV_CTLSOCK_SHOW_ETA,
+	PV_CTLSOCK_SHOW_FINETA,
+	PV_CTLSOCK_SHOW_RATE,
+	PV_CTLSOCK_SHOW_AVERAGE_RATE,
+	PV_CTLSOCK_SHOW_BYTES,
+	PV_CTLSOCK_SHOW_BUFFER_PERCENT,
+	PV_CTLSOCK_LAST_WRITTEN,
+	PV_CTLSOCK_LINE_MODE,
+	PV_CTLSOCK_TRANSFERRED,
+	PV_CTLSOCK_WRITTEN,
+	PV_CTLSOCK_UNCONSUMED,
+	PV_CTLSOCK_ELAPSED,
+	PV_CTLSOCK_RATE,
+	PV_CTLSOCK_AVERAGE_RATE,
+	PV_CTLSOCK_PERCENTAGE,
+	PV_CTLSOCK_BLOCKED_INPUT,
+	PV_CTLSOCK_BLOCKED_OUTPUT,
+	PV_CTLSOCK_FIELD_COUNT
+} pvctlsock_field_t;
+
+/* How a field's value is checked when it is set. */
+typedef enum {
+	PV_CTLSOCK_READONLY,
+	PV_CTLSOCK_AMOUNT,		 /* size with optional suffix */
+	PV_CTLSOCK_SECONDS,		 /* plain decimal number */
+	PV_CTLSOCK_COUNT,		 /* bare integer */
+	PV_CTLSOCK_FLAG,		 /* 0 or 1 */
+	PV_CTLSOCK_TEXT			 /* any string, empty to unset */
+} pvctlsock_kind_t;
+
+struct pvctlsock_fielddef_s {
+	/*@observer@ */ const char *name;
+	pvctlsock_field_t field;
+	pvctlsock_kind_t kind;
+	bool display;			 /* changing it needs the display reparsed */
+	bool in_stats;			 /* included in subscription updates */
+};
+
+/*@observer@ */ static const struct pvctlsock_fielddef_s pv__ctlsock_fields[] = {
+	{ "rate-limit", PV_CTLSOCK_RATE_LIMIT, PV_CTLSOCK_AMOUNT, false, false },
+	{ "rate-burst", PV_CTLSOCK_RATE_BURST, PV_CTLSOCK_AMOUNT, false, false },
+	{ "buffer-size", PV_CTLSOCK_BUFFER_SIZE, PV_CTLSOCK_AMOUNT, false, false },
+	{ "size", PV_CTLSOCK_SIZE, PV_CTLSOCK_AMOUNT, true, true },
+	{ "interval", PV_CTLSOCK_INTERVAL, PV_CTLSOCK_SECONDS, false, false },
+	{ "width", PV_CTLSOCK_WIDTH, PV_CTLSOCK_COUNT, true, false },
+	{ "height", PV_CTLSOCK_HEIGHT, PV_CTLSOCK_COUNT, true, false },
+	{ "average-rate-window", PV_CTLSOCK_AVERAGE_RATE_WINDOW, PV_CTLSOCK_COUNT, false, false },
+	{ "name", PV_CTLSOCK_NAME, PV_CTLSOCK_TEXT, true, false },
+	{ "format", PV_CTLSOCK_FORMAT, PV_CTLSOCK_TEXT, true, false },
+	{ "extra-display", PV_CTLSOCK_EXTRA_DISPLAY, PV_CTLSOCK_TEXT, true, false },
+	{ "show-progress", PV_CTLSOCK_SHOW_PROGRESS, PV_CTLSOCK_FLAG, true, false },
+	{ "show-timer", PV_CTLSOCK_SHOW_TIMER, PV_CTLSOCK_FLAG, true, false },
+	{ "show-eta", PV_CTLSOCK_SHOW_ETA, PV_CTLSOCK_FLAG, true, false },
+	{ "show-fineta", PV_CTLSOCK_SHOW_FINETA, PV_CTLSOCK_FLAG, true, false },
+	{ "show-rate", PV_CTLSOCK_SHOW_RATE, PV_CTLSOCK_FLAG, true, false },
+	{ "show-average-rate", PV_CTLSOCK_SHOW_AVERAGE_RATE, PV_CTLSOCK_FLAG, true, false },
+	{ "show-bytes", PV_CTLSOCK_SHOW_BYTES, PV_CTLSOCK_FLAG, true, false },
+	{ "show-buffer-percent", PV_CTLSOCK_SHOW_BUFFER_PERCENT, PV_CTLSOCK_FLAG, true, false },
+	{ "last-written", PV_CTLSOCK_LAST_WRITTEN, PV_CTLSOCK_COUNT, true, false },
+	{ "line-mode", PV_CTLSOCK_LINE_MODE, PV_CTLSOCK_READONLY, false, false },
+	{ "transferred", PV_CTLSOCK_TRANSFERRED, PV_CTLSOCK_READONLY, false, true },
+	{ "written", PV_CTLSOCK_WRITTEN, PV_CTLSOCK_READONLY, false, true },
+	{ "unconsumed", PV_CTLSOCK_UNCONSUMED, PV_CTLSOCK_READONLY, false, true },
+	{ "elapsed", PV_CTLSOCK_ELAPSED, PV_CTLSOCK_READONLY, false, true },
+	{ "rate", PV_CTLSOCK_RATE, PV_CTLSOCK_READONLY, false, true },
+	{ "average-rate", PV_CTLSOCK_AVERAGE_RATE, PV_CTLSOCK_READONLY, false, true },
+	{ "percentage", PV_CTLSOCK_PERCENTAGE, PV_CTLSOCK_READONLY, false, true },
+	{ "blocked-input", PV_CTLSOCK_BLOCKED_INPUT, PV_CTLSOCK_READONLY, false, true },
+	{ "blocked-output", PV_CTLSOCK_BLOCKED_OUTPUT, PV_CTLSOCK_READONLY, false, true },
+	{ NULL, PV_CTLSOCK_FIELD_COUNT, PV_CTLSOCK_READONLY, false, false }
+};
+
+/*
+ * The server's state.
+ */
+struct pvctlsock_s {
+	struct sockaddr_un address;	 /* where the socket is bound */
+	struct {
+		struct sockaddr_un address;	/* where to send updates */
+		socklen_t address_length;	/* length of address */
+		struct timespec next_due;	/* when the next update is due */
+		long long interval_nsec;	/* nanoseconds between updates */
+		bool active;			/* set while this slot is in use */
+	} subscriber[PV_CTLSOCK_MAX_SUBSCRIBERS];
+	struct timespec next_due;	 /* earliest subscriber update */
+	unsigned int subscriber_count;	 /* active subscribers */
+	int fd;				 /* the socket, or -1 */
+	bool failed;			 /* set if the socket could not be created */
+};
+
+
+/*
+ * Append " NAME=VALUE" to the "length" bytes already in "buffer", encoding
+ * the value; if it won't fit, nothing is added and false is returned.
+ */
+bool pv_ctlsock_append(char *buffer, size_t bufsize, size_t *length, const char *name, const char *value)
+{
+	size_t offset, value_idx;
+
+	offset = *length;
+
+	if (offset + strlen(name) + 2 >= bufsize)	/* flawfinder: ignore */
+		return false;
+	/* flawfinder - both strings are always null-terminated. */
+
+	buffer[offset++] = ' ';
+	memcpy(buffer + offset, name, strlen(name));	/* flawfinder: ignore - as above */
+	offset += strlen(name);		    /* flawfinder: ignore - as above */
+	buffer[offset++] = '=';
+
+	for (value_idx = 0; '\0' != value[value_idx]; value_idx++) {
+		unsigned char value_char = (unsigned char) (value[value_idx]);
+		if ((value_char <= 32) || (127 == value_char) || ('%' == value_char) || ('=' == value_char)) {
+			if (offset + 4 >= bufsize) {
+				buffer[*length] = '\0';
+				return false;
+			}
+			(void) pv_snprintf(buffer + offset, 4, "%%%02X", (unsigned int) value_char);
+			offset += 3;
+		} else {
+			if (offset + 2 >= bufsize) {
+				buffer[*length] = '\0';
+				return false;
+			}
+			buffer[offset++] = (char) value_char;
+		}
+	}
+
+	buffer[offset] = '\0';
+	*length = offset;
+	return true;
+}
+
+
+/*
+ * Decode "%XX" sequences in "value", in place.
+ */
+static void pv__ctlsock_decode(char *value)
+{
+	size_t read_idx, write_idx;
+
+	for (read_idx = 0, write_idx = 0; '\0' != value[read_idx]; read_idx++, write_idx++) {
+		unsigned int decoded;
+		if (('%' == value[read_idx]) && ('\0' != value[read_idx + 1]) && ('\0' != value[read_idx + 2])
+		    && (1 == sscanf(value + read_idx + 1, "%2x", &decoded))) {
+			value[write_idx] = (char) decoded;
+			read_idx += 2;
+		} else {
+			value[write_idx] = value[read_idx];
+		}
+	}
+	value[write_idx] = '\0';
+}
+
+
+/*
+ * Write the current value of "field" into "buffer".
+ */
+static void pv__ctlsock_field_value(pvstate_t state, pvctlsock_field_t field, char *buffer, size_t bufsize)
+{
+	const char *text = NULL;
+	long double number = 0.0;
+	bool integer = true;
+
+	switch (field) {
+	case PV_CTLSOCK_RATE_LIMIT:
+		number = (long double) (state->control.rate_limit);
+		break;
+	case PV_CTLSOCK_RATE_BURST:
+		number = (long double) (state->control.rate_burst);
+		break;
+	case PV_CTLSOCK_BUFFER_SIZE:
+		if (state->control.adaptive_buffer)
+			text = "auto";
+		number = (long double) (state->control.target_buffer_size);
+		break;
+	case PV_CTLSOCK_SIZE:
+		number = (long double) (state->control.size);
+		break;
+	case PV_CTLSOCK_INTERVAL:
+		number = (long double) (state->control.interval);
+		integer = false;
+		break;
+	case PV_CTLSOCK_WIDTH:
+		number = (long double) (state->control.width);
+		break;
+	case PV_CTLSOCK_HEIGHT:
+		number = (long double) (state->control.height);
+		break;
+	case PV_CTLSOCK_AVERAGE_RATE_WINDOW:
+		number = (long double) (state->control.average_rate_window);
+		break;
+	case PV_CTLSOCK_NAME:
+		text = NULL == state->control.name ? "" : state->control.name;
+		break;
+	case PV_CTLSOCK_FORMAT:
+		text = NULL == state->control.format_string ? "" : state->control.format_string;
+		break;
+	case PV_CTLSOCK_EXTRA_DISPLAY:
+		text = NULL == state->control.extra_display_spec ? "" : state->control.extra_display_spec;
+		break;
+	case PV_CTLSOCK_SHOW_PROGRESS:
+		number = state->control.format_option.progress ? 1 : 0;
+		break;
+	case PV_CTLSOCK_SHOW_TIMER:
+		number = state->control.format_option.timer ? 1 : 0;
+		break;
+	case PV_CTLSOCK_SHOW_ETA:
+		number = state->control.format_option.eta ? 1 : 0;
+		break;
+	case PV_CTLSOCK_SHOW_FINETA:
+		number = state->control.format_option.fineta ? 1 : 0;
+		break;
+	case PV_CTLSOCK_SHOW_RATE:
+		number = state->control.format_option.rate ? 1 : 0;
+		break;
+	case PV_CTLSOCK_SHOW_AVERAGE_RATE:
+		number = state->control.format_option.average_rate ? 1 : 0;
+		break;
+	case PV_CTLSOCK_SHOW_BYTES:
+		number = state->control.format_option.bytes ? 1 : 0;
+		break;
+	case PV_CTLSOCK_SHOW_BUFFER_PERCENT:
+		number = state->control.format_option.bufpercent ? 1 : 0;
+		break;
+	case PV_CTLSOCK_LAST_WRITTEN:
+		number = (long double) (state->control.format_option.lastwritten);
+		break;
+	case PV_CTLSOCK_LINE_MODE:
+		number = state->control.linemode ? 1 : 0;
+		break;
+	case PV_CTLSOCK_TRANSFERRED:
+		number = (long double) (state->transfer.transferred);
+		break;
+	case PV_CTLSOCK_WRITTEN:
+		number = (long double) (state->transfer.total_written);
+		break;
+	case PV_CTLSOCK_UNCONSUMED:
+		number = (long double) (state->transfer.written_but_not_consumed);
+		break;
+	case PV_CTLSOCK_ELAPSED:
+		number = state->transfer.elapsed_seconds;
+		integer = false;
+		break;
+	case PV_CTLSOCK_RATE:
+		number = state->calc.transfer_rate;
+		integer = false;
+		break;
+	case PV_CTLSOCK_AVERAGE_RATE:
+		number = state->calc.average_rate;
+		integer = false;
+		break;
+	case PV_CTLSOCK_PERCENTAGE:
+		number = (long double) (state->calc.percentage);
+		integer = false;
+		break;
+	case PV_CTLSOCK_BLOCKED_INPUT:
+		number = pv_latency_total(&(state->transfer), PV_LATENCY_WAIT_INPUT);
+		integer = false;
+		break;
+	case PV_CTLSOCK_BLOCKED_OUTPUT:
+		number = pv_latency_total(&(state->transfer), PV_LATENCY_WAIT_OUTPUT);
+		integer = false;
+		break;
+	case PV_CTLSOCK_FIELD_COUNT:
+		break;
+	}
+
+	if (NULL != text) {
+		(void) pv_snprintf(buffer, bufsize, "%s", text);
+	} else if (integer) {
+		(void) pv_snprintf(buffer, bufsize, "%.0Lf", number);
+	} else {
+		(void) pv_snprintf(buffer, bufsize, "%.6Lf", number);
+	}
+}
+
+
+/*
+ * Append the named field, or all fields if "name" is NULL, or the ones in
+ * subscription updates if "stats_only" is true, to the reply.  Returns
+ * false if the name was not recognised or the reply is full.
+ */
+static bool pv__ctlsock_append_fields(pvstate_t state, char *reply, size_t bufsize, size_t *length,
+				      /*@null@ */ const char *name, bool stats_only)
+{
+	char value[PV_SIZEOF_CTLSOCK_MSG];  /* flawfinder: ignore - bounded by pv_snprintf() */
+	unsigned int field_idx;
+	bool found = false;
+
+	for (field_idx = 0; NULL != pv__ctlsock_fields[field_idx].name; field_idx++) {
+		if ((NULL != name) && (0 != strcmp(name, pv__ctlsock_fields[field_idx].name)))
+			continue;
+		if (stats_only && !pv__ctlsock_fields[field_idx].in_stats)
+			continue;
+		pv__ctlsock_field_value(state, pv__ctlsock_fields[field_idx].field, value, sizeof(value));
+		if (!pv_ctlsock_append(reply, bufsize, length, pv__ctlsock_fields[field_idx].name, value))
+			return false;
+		found = true;
+	}
+
+	return found;
+}
+
+
+/*
+ * Return the definition of the field called "name", or NULL.
+ */
+/*@null@ */ /*@observer@ */ static const struct pvctlsock_fielddef_s *pv__ctlsock_field(const char *name)
+{
+	unsigned int field_idx;
+
+	for (field_idx = 0; NULL != pv__ctlsock_fields[field_idx].name; field_idx++) {
+		if (0 == strcmp(name, pv__ctlsock_fields[field_idx].name))
+			return &(pv__ctlsock_fields[field_idx]);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Apply a "set" request whose NAME=VALUE words are in "words", writing the
+ * reply to "reply".  Everything is checked before anything is changed, so
+ * either all of the settings are applied or none of them are.
+ */
+static void pv__ctlsock_set(pvstate_t state, char **words, unsigned int word_count, char *reply, size_t bufsize)
+{
+	/*@null@ */ const char *value[PV_CTLSOCK_FIELD_COUNT];
+	bool format_options_changed, display_changed;
+	unsigned int word_idx, field_idx;
+
+	for (field_idx = 0; field_idx < PV_CTLSOCK_FIELD_COUNT; field_idx++)
+		value[field_idx] = NULL;
+
+	for (word_idx = 0; word_idx < word_count; word_idx++) {
+		const struct pvctlsock_fielddef_s *def;
+		char *equals;
+		bool valid;
+
+		equals = strchr(words[word_idx], '=');
+		if (NULL == equals) {
+			(void) pv_snprintf(reply, bufsize, "error %s: %s", words[word_idx], "expected NAME=VALUE");
+			return;
+		}
+		*equals = '\0';
+		pv__ctlsock_decode(equals + 1);
+
+		def = pv__ctlsock_field(words[word_idx]);
+		if (NULL == def) {
+			(void) pv_snprintf(reply, bufsize, "error %s: %s", words[word_idx], "unknown field");
+			return;
+		}
+
+		switch (def->kind) {
+		case PV_CTLSOCK_AMOUNT:
+			valid = pv_getnum_check(equals + 1, PV_NUMTYPE_ANY_WITH_SUFFIX);
+			if ((PV_CTLSOCK_BUFFER_SIZE == def->field) && (0 == strcmp(equals + 1, "auto")))
+				valid = true;
+			break;
+		case PV_CTLSOCK_SECONDS:
+			valid = pv_getnum_check(equals + 1, PV_NUMTYPE_BARE_DOUBLE);
+			break;
+		case PV_CTLSOCK_COUNT:
+			valid = pv_getnum_check(equals + 1, PV_NUMTYPE_BARE_INTEGER);
+			break;
+		case PV_CTLSOCK_FLAG:
+			valid = (0 == strcmp(equals + 1, "0")) || (0 == strcmp(equals + 1, "1"));
+			break;
+		case PV_CTLSOCK_TEXT:
+			valid = true;
+			break;
+		case PV_CTLSOCK_READONLY:
+		default:
+			(void) pv_snprintf(reply, bufsize, "error %s: %s", words[word_idx], "read-only field");
+			return;
+		}
+
+		if (!valid) {
+			(void) pv_snprintf(reply, bufsize, "error %s: %s", words[word_idx], "invalid value");
+			return;
+		}
+
+		value[def->field] = equals + 1;
+	}
+
+	/*
+	 * Apply the changes in the same order as a --remote message: the
+	 * old-style format options and name first, since they replace the
+	 * default format, then the numbers, then the format strings.
+	 */
+	format_options_changed = (NULL != value[PV_CTLSOCK_NAME]) || (NULL != value[PV_CTLSOCK_LAST_WRITTEN]);
+	for (field_idx = PV_CTLSOCK_SHOW_PROGRESS; field_idx <= PV_CTLSOCK_SHOW_BUFFER_PERCENT; field_idx++) {
+		if (NULL != value[field_idx])
+			format_options_changed = true;
+	}
+
+	if (format_options_changed) {
+		char *name = NULL;
+
+		/* pv_state_set_format() frees the old name before using this. */
+		if (NULL != value[PV_CTLSOCK_NAME]) {
+			if ('\0' != value[PV_CTLSOCK_NAME][0])
+				name = pv_strdup(value[PV_CTLSOCK_NAME]);
+		} else if (NULL != state->control.name) {
+			name = pv_strdup(state->control.name);
+		}
+
+#define PV_CTLSOCK_FLAGVALUE(id, current) (NULL == value[id] ? current : ('1' == value[id][0]))
+		pv_state_set_format(state,
+				    PV_CTLSOCK_FLAGVALUE(PV_CTLSOCK_SHOW_PROGRESS, state->control.format_option.progress),
+				    PV_CTLSOCK_FLAGVALUE(PV_CTLSOCK_SHOW_TIMER, state->control.format_option.timer),
+				    PV_CTLSOCK_FLAGVALUE(PV_CTLSOCK_SHOW_ETA, state->control.format_option.eta),
+				    PV_CTLSOCK_FLAGVALUE(PV_CTLSOCK_SHOW_FINETA, state->control.format_option.fineta),
+				    PV_CTLSOCK_FLAGVALUE(PV_CTLSOCK_SHOW_RATE, state->control.format_option.rate),
+				    PV_CTLSOCK_FLAGVALUE(PV_CTLSOCK_SHOW_AVERAGE_RATE,
+							 state->control.format_option.average_rate),
+				    PV_CTLSOCK_FLAGVALUE(PV_CTLSOCK_SHOW_BYTES, state->control.format_option.bytes),
+				    PV_CTLSOCK_FLAGVALUE(PV_CTLSOCK_SHOW_BUFFER_PERCENT,
+							 state->control.format_option.bufpercent),
+				    NULL == value[PV_CTLSOCK_LAST_WRITTEN] ? state->control.format_option.lastwritten :
+				    (size_t) pv_getnum_count(value[PV_CTLSOCK_LAST_WRITTEN], false), name);
+#undef PV_CTLSOCK_FLAGVALUE
+
+		if (NULL != name)
+			free(name);
+	}
+
+	if (NULL != value[PV_CTLSOCK_RATE_LIMIT])
+		pv_state_rate_limit_set(state, pv_getnum_size(value[PV_CTLSOCK_RATE_LIMIT], false));
+	if (NULL != value[PV_CTLSOCK_RATE_BURST])
+		pv_state_rate_burst_set(state, pv_getnum_size(value[PV_CTLSOCK_RATE_BURST], false));
+	if (NULL != value[PV_CTLSOCK_BUFFER_SIZE]) {
+		if (0 == strcmp(value[PV_CTLSOCK_BUFFER_SIZE], "auto")) {
+			pv_state_adaptive_buffer_set(state, true);
+		} else {
+			pv_state_adaptive_buffer_set(state, false);
+			pv_state_target_buffer_size_set(state,
+							(size_t) pv_getnum_size(value[PV_CTLSOCK_BUFFER_SIZE], false));
+		}
+	}
+	if (NULL != value[PV_CTLSOCK_SIZE])
+		pv_state_size_set(state, pv_getnum_size(value[PV_CTLSOCK_SIZE], false));
+	if (NULL != value[PV_CTLSOCK_INTERVAL]) {
+		double interval = pv_getnum_interval(value[PV_CTLSOCK_INTERVAL]);
+		if (interval < 0.1)
+			interval = 0.1;
+		if (interval > 600)
+			interval = 600;
+		pv_state_interval_set(state, interval);
+	}
+	if (NULL != value[PV_CTLSOCK_WIDTH]) {
+		unsigned int width = pv_getnum_count(value[PV_CTLSOCK_WIDTH], false);
+		if (width < 1)
+			width = 80;
+		if (width > 999999)
+			width = 999999;
+		pv_state_width_set(state, width, true);
+	}
+	if (NULL != value[PV_CTLSOCK_HEIGHT]) {
+		unsigned int height = pv_getnum_count(value[PV_CTLSOCK_HEIGHT], false);
+		if (height < 1)
+			height = 25;
+		if (height > 999999)
+			height = 999999;
+		pv_state_height_set(state, height, true);
+	}
+	if (NULL != value[PV_CTLSOCK_AVERAGE_RATE_WINDOW])
+		pv_state_average_rate_window_set(state,
+						 pv_getnum_count(value[PV_CTLSOCK_AVERAGE_RATE_WINDOW], false));
+	if (NULL != value[PV_CTLSOCK_FORMAT])
+		pv_state_format_string_set(state,
+					   '\0' == value[PV_CTLSOCK_FORMAT][0] ? NULL : value[PV_CTLSOCK_FORMAT]);
+	if (NULL != value[PV_CTLSOCK_EXTRA_DISPLAY])
+		pv_state_extra_display_set(state,
+					   '\0' ==
+					   value[PV_CTLSOCK_EXTRA_DISPLAY][0] ? NULL : value[PV_CTLSOCK_EXTRA_DISPLAY]);
+
+	display_changed = false;
+	for (field_idx = 0; NULL != pv__ctlsock_fields[field_idx].name; field_idx++) {
+		if (pv__ctlsock_fields[field_idx].display && (NULL != value[pv__ctlsock_fields[field_idx].field]))
+			display_changed = true;
+	}
+	if (display_changed)
+		state->flags.reparse_display = 1;
+
+	debug("%s: %u %s", "control socket", word_count, "settings changed");
+
+	(void) pv_snprintf(reply, bufsize, "%s", "ok");
+}
+
+
+/*
+ * Add or update a subscription for "address", or remove it if "interval" is
+ * negative, writing the reply to "reply".
+ */
+static void pv__ctlsock_subscribe(struct pvctlsock_s *ctl, const struct sockaddr_un *address,
+				  socklen_t address_length, double interval, const struct timespec *now,
+				  char *reply, size_t bufsize)
+{
+	unsigned int slot, free_slot;
+
+	free_slot = PV_CTLSOCK_MAX_SUBSCRIBERS;
+
+	for (slot = 0; slot < PV_CTLSOCK_MAX_SUBSCRIBERS; slot++) {
+		if (!ctl->subscriber[slot].active) {
+			if (free_slot >= PV_CTLSOCK_MAX_SUBSCRIBERS)
+				free_slot = slot;
+			continue;
+		}
+		if ((ctl->subscriber[slot].address_length == address_length)
+		    && (0 == memcmp(&(ctl->subscriber[slot].address), address, (size_t) address_length)))
+			break;
+	}
+
+	if (interval < 0) {
+		if (slot < PV_CTLSOCK_MAX_SUBSCRIBERS) {
+			ctl->subscriber[slot].active = false;
+			ctl->subscriber_count--;
+		}
+		(void) pv_snprintf(reply, bufsize, "%s", "ok");
+		return;
+	}
+
+	if (slot >= PV_CTLSOCK_MAX_SUBSCRIBERS) {
+		if (free_slot >= PV_CTLSOCK_MAX_SUBSCRIBERS) {
+			(void) pv_snprintf(reply, bufsize, "error %s", "too many subscribers");
+			return;
+		}
+		slot = free_slot;
+		memcpy(&(ctl->subscriber[slot].address), address, (size_t) address_length);
+		ctl->subscriber[slot].address_length = address_length;
+		ctl->subscriber[slot].active = true;
+		ctl->subscriber_count++;
+	}
+
+	ctl->subscriber[slot].interval_nsec = (long long) (interval * 1000000000.0);
+	pv_elapsedtime_copy(&(ctl->subscriber[slot].next_due), now);
+
+	/* The first update goes out straight away. */
+	pv_elapsedtime_copy(&(ctl->next_due), now);
+
+	(void) pv_snprintf(reply, bufsize, "%s", "ok");
+}
+
+
+/*
+ * Answer the request in "request", from "address", into "reply".
+ */
+static void pv__ctlsock_answer(pvstate_t state, struct pvctlsock_s *ctl, char *request,
+			       const struct sockaddr_un *address, socklen_t address_length,
+			       const struct timespec *now, char *reply, size_t bufsize)
+{
+	char *words[PV_CTLSOCK_MAX_WORDS];
+	unsigned int word_count;
+	char *position;
+
+	word_count = 0;
+	position = request;
+	while ('\0' != *position && word_count < PV_CTLSOCK_MAX_WORDS) {
+		while ((' ' == *position) || ('\t' == *position) || ('\n' == *position) || ('\r' == *position))
+			*(position++) = '\0';
+		if ('\0' == *position)
+			break;
+		words[word_count++] = position;
+		while (('\0' != *position) && (' ' != *position) && ('\t' != *position) && ('\n' != *position)
+		       && ('\r' != *position))
+			position++;
+	}
+
+	if (0 == word_count) {
+		(void) pv_snprintf(reply, bufsize, "error %s", "empty request");
+		return;
+	}
+
+	if (0 == strcmp(words[0], "get")) {
+		size_t length;
+		unsigned int word_idx;
+
+		(void) pv_snprintf(reply, bufsize, "%s", "ok");
+		length = 2;
+		if (1 == word_count) {
+			(void) pv__ctlsock_append_fields(state, reply, bufsize, &length, NULL, false);
+			return;
+		}
+		for (word_idx = 1; word_idx < word_count; word_idx++) {
+			if (!pv__ctlsock_append_fields(state, reply, bufsize, &length, words[word_idx], false)) {
+				(void) pv_snprintf(reply, bufsize, "error %s: %s", words[word_idx],
+						   NULL == pv__ctlsock_field(words[word_idx]) ? "unknown field" :
+						   "reply too long");
+				return;
+			}
+		}
+		return;
+	}
+
+	if (0 == strcmp(words[0], "set")) {
+		pv__ctlsock_set(state, words + 1, word_count - 1, reply, bufsize);
+		return;
+	}
+
+	if (0 == strcmp(words[0], "subscribe")) {
+		double interval = state->control.interval;
+		if (word_count > 1) {
+			if (!pv_getnum_check(words[1], PV_NUMTYPE_BARE_DOUBLE)) {
+				(void) pv_snprintf(reply, bufsize, "error %s: %s", words[1], "invalid interval");
+				return;
+			}
+			interval = pv_getnum_interval(words[1]);
+		}
+		if (interval < PV_CTLSOCK_MIN_INTERVAL)
+			interval = PV_CTLSOCK_MIN_INTERVAL;
+		pv__ctlsock_subscribe(ctl, address, address_length, interval, now, reply, bufsize);
+		return;
+	}
+
+	if (0 == strcmp(words[0], "unsubscribe")) {
+		pv__ctlsock_subscribe(ctl, address, address_length, -1.0, now, reply, bufsize);
+		return;
+	}
+
+	(void) pv_snprintf(reply, bufsize, "error %s: %s", words[0], "unknown command");
+}
+
+
+/*
+ * Send "message" to subscriber "slot", dropping the subscription if the
+ * subscriber has gone away.  A subscriber that is simply not reading fast
+ * enough misses this update.
+ */
+static void pv__ctlsock_send_subscriber(struct pvctlsock_s *ctl, unsigned int slot, const char *message)
+{
+	ssize_t sent;
+
+	sent = sendto(ctl->fd, message, strlen(message), MSG_DONTWAIT,	/* flawfinder: ignore */
+		      (const struct sockaddr *) &(ctl->subscriber[slot].address),
+		      ctl->subscriber[slot].address_length);
+	/* flawfinder - message is always null-terminated by pv_snprintf(). */
+
+	if ((sent < 0) && (EAGAIN != errno) && (EWOULDBLOCK != errno) && (ENOBUFS != errno)) {
+		debug("%s: %s: %s", "control socket", "dropping subscriber", strerror(errno));
+		ctl->subscriber[slot].active = false;
+		ctl->subscriber_count--;
+	}
+}
+
+
+/*
+ * Create the control socket, returning false on failure.
+ */
+static bool pv__ctlsock_create(pvstate_t state, struct pvctlsock_s *ctl)
+{
+	char filename[sizeof(ctl->address.sun_path)];	/* flawfinder: ignore - bounded by pv_snprintf() */
+	int attempt;
+
+	ctl->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (ctl->fd < 0) {
+		debug("%s: %s", "control socket", strerror(errno));
+		return false;
+	}
+
+	(void) fcntl(ctl->fd, F_SETFD, FD_CLOEXEC);
+	(void) fcntl(ctl->fd, F_SETFL, O_NONBLOCK | fcntl(ctl->fd, F_GETFL));
+
+	for (attempt = 0; attempt < 2; attempt++) {
+		memset(filename, 0, sizeof(filename));
+		if (!pv_runtime_filename(filename, sizeof(filename), "control", getpid(), 1 == attempt, true))
+			break;
+		/* The name may have been cut short to fit. */
+		if (strlen(filename) >= sizeof(filename) - 1)	/* flawfinder: ignore */
+			continue;
+		/* flawfinder - pv_snprintf() always null-terminates. */
+
+		memset(&(ctl->address), 0, sizeof(ctl->address));
+		ctl->address.sun_family = AF_UNIX;
+		memcpy(ctl->address.sun_path, filename, sizeof(filename));
+
+		/* Remove any socket left behind by an earlier process with our PID. */
+		(void) unlink(filename);
+
+		if (0 == bind(ctl->fd, (struct sockaddr *) &(ctl->address), (socklen_t) sizeof(ctl->address))) {
+			debug("%s: %s", "control socket", filename);
+			pv_poller_control_set(&(state->transfer), ctl->fd);
+			return true;
+		}
+		debug("%s: %s: %s", filename, "bind", strerror(errno));
+	}
+
+	(void) close(ctl->fd);
+	ctl->fd = -1;
+	ctl->address.sun_path[0] = '\0';
+	return false;
+}
+
+
+/*
+ * Service the control socket: answer any requests waiting on it, if the
+ * poller has seen that there are some or "check_anyway" is true, and send
+ * any subscription updates that are due by "now".  The socket is created
+ * the first time this is called.
+ *
+ * If "deadline" is not NULL, it is brought forward to the next time a
+ * subscription update will be due.
+ */
+void pv_ctlsock_service(pvstate_t state, const struct timespec *now, bool check_anyway,
+			/*@null@ */ struct timespec *deadline)
+{
+	struct pvctlsock_s *ctl;
+	unsigned int request_count, slot;
+
+	if (NULL == state->status.control_socket) {
+		state->status.control_socket = calloc(1, sizeof(*(state->status.control_socket)));
+		if (NULL == state->status.control_socket)
+			return;
+		if (!pv__ctlsock_create(state, state->status.control_socket))
+			state->status.control_socket->failed = true;
+		check_anyway = true;
+	}
+
+	ctl = state->status.control_socket;
+	if (ctl->failed)
+		return;
+
+	if (state->transfer.control_pending || check_anyway) {
+		state->transfer.control_pending = false;
+
+		for (request_count = 0; request_count < PV_CTLSOCK_MAX_BATCH; request_count++) {
+			char request[PV_SIZEOF_CTLSOCK_MSG + 1];	/* flawfinder: ignore */
+			char reply[PV_SIZEOF_CTLSOCK_MSG];	/* flawfinder: ignore */
+			struct sockaddr_un address;
+			socklen_t address_length;
+			ssize_t received;
+
+			/*
+			 * flawfinder rationale: the request is explicitly
+			 * terminated after recvfrom(), which is given one
+			 * byte less than its size, and the reply is only
+			 * written by pv_snprintf() and pv_ctlsock_append(),
+			 * which are both bounded.
+			 */
+
+			memset(&address, 0, sizeof(address));
+			address_length = (socklen_t) sizeof(address);
+			received =
+			    recvfrom(ctl->fd, request, PV_SIZEOF_CTLSOCK_MSG, MSG_DONTWAIT, (struct sockaddr *) &address,
+				     &address_length);
+			if (received < 0)
+				break;
+			request[received] = '\0';
+
+			reply[0] = '\0';
+			pv__ctlsock_answer(state, ctl, request, &address, address_length, now, reply, sizeof(reply));
+
+			/* Anonymous senders can't be answered. */
+			if (address_length <= (socklen_t) sizeof(sa_family_t))
+				continue;
+
+			if (sendto(ctl->fd, reply, strlen(reply), MSG_DONTWAIT,	/* flawfinder: ignore */
+				   (struct sockaddr *) &address, address_length) < 0) {
+				debug("%s: %s: %s", "control socket", "reply failed", strerror(errno));
+			}
+		}
+	}
+
+	if (0 == ctl->subscriber_count)
+		return;
+
+	if (pv_elapsedtime_compare(now, &(ctl->next_due)) >= 0) {
+		char message[PV_SIZEOF_CTLSOCK_MSG];	/* flawfinder: ignore - as above */
+		size_t length;
+		bool first;
+
+		(void) pv_snprintf(message, sizeof(message), "%s", "stats");
+		length = 5;
+		(void) pv__ctlsock_append_fields(state, message, sizeof(message), &length, NULL, true);
+
+		first = true;
+		for (slot = 0; slot < PV_CTLSOCK_MAX_SUBSCRIBERS; slot++) {
+			if (!ctl->subscriber[slot].active)
+				continue;
+			if (pv_elapsedtime_compare(now, &(ctl->subscriber[slot].next_due)) >= 0) {
+				pv__ctlsock_send_subscriber(ctl, slot, message);
+				pv_elapsedtime_add_nsec(&(ctl->subscriber[slot].next_due),
+							ctl->subscriber[slot].interval_nsec);
+				/* Don't try to catch up on missed updates. */
+				if (pv_elapsedtime_compare(&(ctl->subscriber[slot].next_due), now) < 0) {
+					pv_elapsedtime_copy(&(ctl->subscriber[slot].next_due), now);
+					pv_elapsedtime_add_nsec(&(ctl->subscriber[slot].next_due),
+								ctl->subscriber[slot].interval_nsec);
+				}
+			}
+			if (!ctl->subscriber[slot].active)
+				continue;
+			if (first || (pv_elapsedtime_compare(&(ctl->subscriber[slot].next_due), &(ctl->next_due)) < 0))
+				pv_elapsedtime_copy(&(ctl->next_due), &(ctl->subscriber[slot].next_due));
+			first = false;
+		}
+	}
+
+	if ((NULL != deadline) && (ctl->subscriber_count > 0)
+	    && (pv_elapsedtime_compare(&(ctl->next_due), deadline) < 0))
+		pv_elapsedtime_copy(deadline, &(ctl->next_due));
+}
+
+
+/*
+ * Send any subscribers the final totals in an "end" message, then close
+ * the control socket, remove it, and free it.
+ */
+void pv_ctlsock_free(pvstate_t state)
+{
+	struct pvctlsock_s *ctl;
+	unsigned int slot;
+
+	if ((NULL == state) || (NULL == state->status.control_socket))
+		return;
+
+	ctl = state->status.control_socket;
+
+	if (ctl->fd >= 0) {
+		char message[PV_SIZEOF_CTLSOCK_MSG];	/* flawfinder: ignore - bounded by pv_snprintf() */
+		size_t length;
+
+		(void) pv_snprintf(message, sizeof(message), "%s", "end");
+		length = 3;
+		(void) pv__ctlsock_append_fields(state, message, sizeof(message), &length, NULL, true);
+
+		for (slot = 0; slot < PV_CTLSOCK_MAX_SUBSCRIBERS; slot++) {
+			if (ctl->subscriber[slot].active)
+				pv__ctlsock_send_subscriber(ctl, slot, message);
+		}
+		if (NULL != state->transfer.poller)
+			pv_poller_control_set(&(state->transfer), -1);
+		(void) close(ctl->fd);
+		ctl->fd = -1;
+		if ('\0' != ctl->address.sun_path[0]) {
+			debug("%s: %s", "removing", ctl->address.sun_path);
+			(void) unlink(ctl->address.sun_path);
+		}
+	}
+
+	free(ctl);
+	state->status.control_socket = NULL;
+}
+
+
+/*
+ * Send "request" to the control socket of process "pid", and wait for a
+ * reply, which is written to "reply".
+ *
+ * Returns 0 on success, -1 if the process has no control socket (so the
+ * caller should fall back to signals), or 1 if no reply arrived.
+ */
+int pv_ctlsock_request(pid_t pid, const char *request, char *reply, size_t bufsize)
+{
+	struct sockaddr_un server, client;
+	int attempt, client_fd, result;
+	bool sent;
+
+	memset(&server, 0, sizeof(server));
+	memset(&client, 0, sizeof(client));
+
+	client_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (client_fd < 0)
+		return -1;
+	(void) fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+
+	/*
+	 * Find the server socket, and bind our own socket next to it so the
+	 * reply can find its way back.
+	 */
+	sent = false;
+	for (attempt = 0; attempt < 2 && !sent; attempt++) {
+		server.sun_family = AF_UNIX;
+		client.sun_family = AF_UNIX;
+		if (!pv_runtime_filename(server.sun_path, sizeof(server.sun_path), "control", pid, 1 == attempt, false))
+			break;
+		if (!pv_runtime_filename
+		    (client.sun_path, sizeof(client.sun_path), "client", getpid(), 1 == attempt, false))
+			break;
+
+		/* Only try to bind once, so an unbound socket is never left. */
+		(void) unlink(client.sun_path);
+		if (0 != bind(client_fd, (struct sockaddr *) &client, (socklen_t) sizeof(client)))
+			continue;
+
+		if (sendto(client_fd, request, strlen(request), 0,	/* flawfinder: ignore */
+			   (struct sockaddr *) &server, (socklen_t) sizeof(server)) >= 0) {
+			sent = true;
+			break;
+		}
+		debug("%s: %s: %s", server.sun_path, "sendto", strerror(errno));
+
+		/* Bound to the wrong directory - start again with a new socket. */
+		(void) close(client_fd);
+		(void) unlink(client.sun_path);
+		client_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+		if (client_fd < 0)
+			return -1;
+		(void) fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+	}
+	/* flawfinder - request is always null-terminated by the caller. */
+
+	if (!sent) {
+		(void) close(client_fd);
+		return -1;
+	}
+
+	result = 1;
+	{
+		struct pollfd pfd;
+		ssize_t received;
+
+		pfd.fd = client_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, PV_CTLSOCK_REPLY_TIMEOUT) > 0) {
+			received = recv(client_fd, reply, bufsize - 1, 0);
+			if (received >= 0) {
+				reply[received] = '\0';
+				result = 0;
+			}
+		}
+	}
+
+	(void) close(client_fd);
+	(void) unlink(client.sun_path);
+
+	return result;
+}
+
+
+/*
+ * Find "name" in a reply of NAME=VALUE words, and decode its value into
+ * "value", returning false if it isn't there.
+ */
+bool pv_ctlsock_reply_value(const char *reply, const char *name, char *value, size_t bufsize)
+{
+	size_t name_length;
+	const char *position;
+
+	name_length = strlen(name);	    /* flawfinder: ignore - always null-terminated */
+
+	for (position = strchr(reply, ' '); NULL != position; position = strchr(position, ' ')) {
+		size_t value_length;
+		position++;
+		if ((0 != strncmp(position, name, name_length)) || ('=' != position[name_length]))
+			continue;
+		position += name_length + 1;
+		value_length = strcspn(position, " ");
+		if (value_length >= bufsize)
+			value_length = bufsize - 1;
+		memcpy(value, position, value_length);
+		value[value_length] = '\0';
+		pv__ctlsock_decode(value);
+		return true;
+	}
+
+	return false;
+}
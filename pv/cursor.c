@@ -4,7 +4,14 @@
  * If IPC is available, then a shared memory segment is used to co-ordinate
  * cursor positioning across multiple instances of `pv'. The shared memory
  * segment contains an integer which is the original "y" co-ordinate of the
- * first `pv' process.
+ * first `pv' process, a row for each instance holding its latest update,
+ * drawn to the terminal by whichever instance is the current renderer, and
+ * a table of the time each instance spent blocked on its input and output,
+ * from which the bottleneck in the pipeline is reported with "--stats".
+ *
+ * The terminal is only locked when attaching, when the top line has to be
+ * found again, and when the renderer writes, so instances updating their
+ * rows never wait for each other.
  *
  * However, some OSes (FreeBSD and MacOS X so far) don't allow locking of a
  * terminal, so we try to use a lockfile if terminal locking doesn't work,
@@ -198,11 +205,372 @@ static void pv_crs_ipccount(pvcursorstate_t cursor)
 	if (cursor->pvcount > cursor->pvmax)
 		cursor->pvmax = cursor->pvcount;
 
+	if (NULL != cursor->shared) {
+		int rows = __atomic_load_n(&(cursor->shared->rows_claimed), __ATOMIC_ACQUIRE);
+		if ((rows <= PV_CRS_MAX_STAGES) && (rows > cursor->pvmax))
+			cursor->pvmax = rows;
+	}
+
 	debug("%s: %d", "pvcount", cursor->pvcount);
 }
 #endif				/* HAVE_IPC */
 
 
+#ifdef HAVE_IPC
+/*
+ * Claim the lowest free row in shared memory, with an atomic
+ * compare-and-swap on its owner so that no two instances can ever get the
+ * same one, and raise the shared count of rows claimed to include it.
+ * Unlike the attach count, which drops as instances exit, this means that
+ * an instance starting later never lands on the line of one still running.
+ */
+static void pv_crs_claim_row(pvcursorstate_t cursor)
+{
+	pid_t our_pid;
+	int row, claimed;
+
+	cursor->row = -1;
+	if (NULL == cursor->shared)
+		return;
+
+	our_pid = getpid();
+	for (row = 0; row < PV_CRS_MAX_STAGES; row++) {
+		pid_t expected = 0;
+		if (__atomic_compare_exchange_n
+		    (&(cursor->shared->row[row].pid), &expected, our_pid, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			break;
+	}
+	if (row >= PV_CRS_MAX_STAGES) {
+		debug("%s", "no free row");
+		return;
+	}
+
+	claimed = __atomic_load_n(&(cursor->shared->rows_claimed), __ATOMIC_ACQUIRE);
+	while ((claimed < row + 1)
+	       && (!__atomic_compare_exchange_n
+		   (&(cursor->shared->rows_claimed), &claimed, row + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))) {
+		/* "claimed" has been updated by the failed exchange. */
+	}
+
+	cursor->row = row;
+	memset(cursor->drawn, 0, sizeof(cursor->drawn));
+	debug("%s: %d", "claimed row", row);
+}
+
+
+/*
+ * Publish "length" bytes of "line" as the latest update of our row.
+ * Returns false if we have no row or the line doesn't fit, in which case
+ * the caller has to write it to the terminal itself.
+ */
+static bool pv_crs_publish_row(pvcursorstate_t cursor, const char *line, size_t length)
+{
+	struct pvipcrow_s *row;
+	unsigned int sequence;
+
+	if ((NULL == cursor->shared) || (cursor->row < 0) || (length > PV_SIZEOF_CRS_ROW))
+		return false;
+
+	row = &(cursor->shared->row[cursor->row]);
+	sequence = __atomic_load_n(&(row->sequence), __ATOMIC_RELAXED);
+
+	__atomic_store_n(&(row->sequence), sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(row->line, line, length);
+	__atomic_store_n(&(row->length), length, __ATOMIC_RELAXED);
+	__atomic_store_n(&(row->sequence), sequence + 2, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+
+/*
+ * Return true if we are, or have just become, the renderer.  We take over
+ * if there is no renderer, or if it has exited, or if it hasn't drawn
+ * anything for three of its update intervals plus a second, as happens
+ * when it is stopped or its output is blocked.  If "force" is true, we
+ * draw once regardless, without taking over from anyone.
+ */
+static bool pv_crs_elect_renderer(pvcursorstate_t cursor, readonly_pvcontrol_t control, bool force)
+{
+	pid_t our_pid, current;
+	long long now;
+
+	our_pid = getpid();
+	now = pv_elapsedtime_coarse_nsec();
+
+	current = __atomic_load_n(&(cursor->shared->renderer), __ATOMIC_ACQUIRE);
+	if (current != our_pid) {
+		if ((0 != current) && (!force)) {
+			long long seen, interval;
+			bool alive;
+
+			seen = __atomic_load_n(&(cursor->shared->renderer_seen), __ATOMIC_ACQUIRE);
+			interval = __atomic_load_n(&(cursor->shared->renderer_interval), __ATOMIC_RELAXED);
+			alive = ((0 == kill(current, 0)) || (EPERM == errno)) ? true : false;
+			if (alive && (now - seen < 3 * interval + 1000000000LL))
+				return false;
+		}
+		if ((!force)
+		    && (!__atomic_compare_exchange_n
+			(&(cursor->shared->renderer), &current, our_pid, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)))
+			return false;
+		if (!force)
+			debug("%s: %d", "became renderer, taking over from", (int) current);
+		/* Everything has to be drawn again, since we don't know what is shown. */
+		memset(cursor->drawn, 0, sizeof(cursor->drawn));
+		cursor->drawn_y_start = 0;
+		if (force)
+			return true;
+	}
+
+	__atomic_store_n(&(cursor->shared->renderer_interval),
+			 (long long) (control->interval * 1000000000.0L), __ATOMIC_RELAXED);
+	__atomic_store_n(&(cursor->shared->renderer_seen), now, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+
+/*
+ * Draw every row that has changed since we last drew it, or every row if
+ * the top line has moved, in a single terminal write, wrapped in the
+ * synchronised update sequences so that the whole set of bars appears at
+ * once.  A row being written to while we read it is left for next time.
+ */
+static void pv_crs_render_rows(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtransientflags_t flags)
+{
+	static const char sync_start[] = "\033[?2026h";
+	static const char sync_end[] = "\033[?2026l";
+	size_t batch_size, length;
+	bool redraw, drawn_any;
+	int rows, row;
+
+	if (NULL == cursor->batch) {
+		cursor->batch = malloc(PV_CRS_MAX_STAGES * (PV_SIZEOF_CRS_ROW + 32) + sizeof(sync_start) + sizeof(sync_end));
+		if (NULL == cursor->batch) {
+			debug("%s: %s", "batch buffer allocation failed", strerror(errno));
+			return;
+		}
+	}
+	batch_size = PV_CRS_MAX_STAGES * (PV_SIZEOF_CRS_ROW + 32) + sizeof(sync_start) + sizeof(sync_end);
+
+	rows = __atomic_load_n(&(cursor->shared->rows_claimed), __ATOMIC_ACQUIRE);
+	if (rows > PV_CRS_MAX_STAGES)
+		rows = PV_CRS_MAX_STAGES;
+
+	redraw = (cursor->drawn_y_start != cursor->y_start) ? true : false;
+	drawn_any = false;
+
+	memcpy(cursor->batch, sync_start, sizeof(sync_start) - 1);
+	length = sizeof(sync_start) - 1;
+
+	for (row = 0; row < rows; row++) {
+		struct pvipcrow_s *shared_row;
+		unsigned int sequence;
+		size_t row_length, start;
+		int y, cup_length;
+
+		shared_row = &(cursor->shared->row[row]);
+		sequence = __atomic_load_n(&(shared_row->sequence), __ATOMIC_ACQUIRE);
+		if ((0 == sequence) || (0 != (sequence & 1)))
+			continue;
+		if ((!redraw) && (sequence == cursor->drawn[row]))
+			continue;
+
+		y = cursor->y_start + row;
+		if ((y < 1) || (y > (int) (control->height)))
+			continue;
+
+		row_length = __atomic_load_n(&(shared_row->length), __ATOMIC_RELAXED);
+		if (row_length > PV_SIZEOF_CRS_ROW)
+			continue;
+
+		start = length;
+		cup_length = pv_snprintf(cursor->batch + length, 32, "\033[%d;1H", y);
+		if ((cup_length < 1) || (cup_length >= 32))
+			continue;
+		length += (size_t) cup_length;
+		memcpy(cursor->batch + length, shared_row->line, row_length);
+		length += row_length;
+
+		/* If the owner was writing while we copied, drop the row. */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&(shared_row->sequence), __ATOMIC_RELAXED) != sequence) {
+			length = start;
+			continue;
+		}
+
+		cursor->drawn[row] = sequence;
+		drawn_any = true;
+	}
+
+	cursor->drawn_y_start = cursor->y_start;
+
+	if ((!drawn_any) || (length + sizeof(sync_end) > batch_size))
+		return;
+
+	memcpy(cursor->batch + length, sync_end, sizeof(sync_end) - 1);
+	length += sizeof(sync_end) - 1;
+
+	pv_crs_lock(cursor, control, STDERR_FILENO);
+	pv_tty_write(flags, cursor->batch, length);
+	pv_crs_unlock(cursor, STDERR_FILENO);
+}
+#endif				/* HAVE_IPC */
+
+
+#ifdef HAVE_IPC
+/*
+ * Claim a stage slot in shared memory, preferring the one matching our Y
+ * offset so that stages are numbered in display order.  This should only
+ * be called while the terminal is locked.
+ */
+static void pv_crs_claim_stage(pvcursorstate_t cursor)
+{
+	int slot;
+
+	cursor->stage_slot = -1;
+	if (NULL == cursor->shared)
+		return;
+
+	slot = cursor->y_offset;
+	if ((slot >= PV_CRS_MAX_STAGES) || (0 != cursor->shared->stage[slot].pid)) {
+		for (slot = 0; slot < PV_CRS_MAX_STAGES; slot++) {
+			if (0 == cursor->shared->stage[slot].pid)
+				break;
+		}
+	}
+	if (slot >= PV_CRS_MAX_STAGES) {
+		debug("%s", "no free stage slot");
+		return;
+	}
+
+	memset(&(cursor->shared->stage[slot]), 0, sizeof(cursor->shared->stage[slot]));
+	cursor->shared->stage[slot].pid = getpid();
+	cursor->stage_slot = slot;
+	debug("%s: %d", "claimed stage slot", slot);
+}
+
+
+/*
+ * Publish how long this instance's transfer took and how much of that it
+ * spent blocked on its input and output, for the bottleneck summary.
+ */
+void pv_crs_publish(pvcursorstate_t cursor, readonly_pvcontrol_t control, readonly_pvtransferstate_t transfer)
+{
+	struct pvipcstage_s *stage;
+
+	if (cursor->noipc || (NULL == cursor->shared) || (cursor->stage_slot < 0))
+		return;
+
+	stage = &(cursor->shared->stage[cursor->stage_slot]);
+	if (stage->pid != getpid())
+		return;
+
+	stage->elapsed = (double) (transfer->elapsed_seconds);
+	stage->blocked_input = (double) pv_latency_total(transfer, PV_LATENCY_WAIT_INPUT);
+	stage->blocked_output = (double) pv_latency_total(transfer, PV_LATENCY_WAIT_OUTPUT);
+	if ((NULL != control->name) && ('\0' != control->name[0])) {
+		(void) pv_snprintf(stage->name, sizeof(stage->name), "%s", control->name);
+	} else {
+		(void) pv_snprintf(stage->name, sizeof(stage->name), "%s %ld", _("pid"), (long) getpid());
+	}
+	stage->published = true;
+}
+
+
+/*
+ * Write the bottleneck summary into cursor->bottleneck, from the stages
+ * published in shared memory: one line per stage with the fraction of its
+ * time spent blocked on input and on output, then a line naming where the
+ * bottleneck is.  This should only be called while the terminal is locked,
+ * by the last instance to finish.
+ *
+ * A stage that is mostly blocked on output is waiting for something after
+ * it, and one mostly blocked on input for something before it, so the
+ * bottleneck is put at the boundary between stages which best separates
+ * the output-bound stages before it from the input-bound ones after it.
+ */
+static void pv_crs_summarise(pvcursorstate_t cursor)
+{
+	double in_fraction[PV_CRS_MAX_STAGES];
+	double out_fraction[PV_CRS_MAX_STAGES];
+	int index[PV_CRS_MAX_STAGES];
+	double score, best_score;
+	int slot, count, boundary, best_boundary, stage_idx;
+	size_t length;
+
+	cursor->bottleneck[0] = '\0';
+	if (NULL == cursor->shared)
+		return;
+
+	for (slot = 0, count = 0; slot < PV_CRS_MAX_STAGES; slot++) {
+		const struct pvipcstage_s *stage = &(cursor->shared->stage[slot]);
+		if ((0 == stage->pid) || (!stage->published) || (stage->elapsed <= 0.0))
+			continue;
+		index[count] = slot;
+		in_fraction[count] = stage->blocked_input / stage->elapsed;
+		out_fraction[count] = stage->blocked_output / stage->elapsed;
+		count++;
+	}
+
+	if (count < 2)
+		return;
+
+	length = 0;
+	for (stage_idx = 0; stage_idx < count; stage_idx++) {
+		int added;
+		added = pv_snprintf(cursor->bottleneck + length, sizeof(cursor->bottleneck) - length,
+				    "%s %d (%s): %.0f%% %s, %.0f%% %s\n", _("stage"), stage_idx + 1,
+				    cursor->shared->stage[index[stage_idx]].name, 100.0 * in_fraction[stage_idx],
+				    _("blocked on input"), 100.0 * out_fraction[stage_idx], _("blocked on output"));
+		if ((added < 1) || ((size_t) added >= sizeof(cursor->bottleneck) - length)) {
+			cursor->bottleneck[length] = '\0';
+			return;
+		}
+		length += (size_t) added;
+	}
+
+	/*
+	 * Boundary N is just after stage N, so 0 is before the first stage
+	 * and "count" is after the last.
+	 */
+	best_boundary = 0;
+	best_score = 0.0;
+	for (boundary = 0; boundary <= count; boundary++) {
+		score = 0.0;
+		for (stage_idx = 0; stage_idx < count; stage_idx++) {
+			if (stage_idx < boundary) {
+				score += out_fraction[stage_idx] - in_fraction[stage_idx];
+			} else {
+				score += in_fraction[stage_idx] - out_fraction[stage_idx];
+			}
+		}
+		if ((0 == boundary) || (score > best_score)) {
+			best_score = score;
+			best_boundary = boundary;
+		}
+	}
+
+	if (0 == best_boundary) {
+		(void) pv_snprintf(cursor->bottleneck + length, sizeof(cursor->bottleneck) - length,
+				   "%s: %s %d (%s)\n", _("bottleneck"), _("before stage"), 1,
+				   cursor->shared->stage[index[0]].name);
+	} else if (count == best_boundary) {
+		(void) pv_snprintf(cursor->bottleneck + length, sizeof(cursor->bottleneck) - length,
+				   "%s: %s %d (%s)\n", _("bottleneck"), _("after stage"), count,
+				   cursor->shared->stage[index[count - 1]].name);
+	} else {
+		(void) pv_snprintf(cursor->bottleneck + length, sizeof(cursor->bottleneck) - length,
+				   "%s: %s %d (%s) %s %d (%s)\n", _("bottleneck"), _("between stage"), best_boundary,
+				   cursor->shared->stage[index[best_boundary - 1]].name, _("and stage"),
+				   best_boundary + 1, cursor->shared->stage[index[best_boundary]].name);
+	}
+}
+#endif				/* HAVE_IPC */
+
+
 /*
  * Get the current cursor Y co-ordinate by sending the ECMA-48 CPR code to
  * the terminal connected to the given file descriptor.
@@ -339,14 +707,30 @@ static int pv_crs_ipcinit(pvcursorstate_t cursor, readonly_pvcontrol_t control,
 		cursor->y_start = pv_crs_get_ypos(terminalfd);
 		cursor->shared->y_topmost = cursor->y_start;
 		cursor->shared->tty_tostop_added = false;
+		memset(cursor->shared->stage, 0, sizeof(cursor->shared->stage));
+		memset(cursor->shared->row, 0, sizeof(cursor->shared->row));
+		cursor->shared->rows_claimed = 0;
+		cursor->shared->renderer = 0;
 		cursor->y_lastread = cursor->y_start;
 		debug("%s", "we are the first to attach");
 	}
 
-	cursor->y_offset = cursor->pvcount - 1;
+	/*
+	 * Our row gives us our Y offset; only if all rows are taken do we
+	 * fall back to the attach count, and to writing to the terminal
+	 * ourselves.
+	 */
+	pv_crs_claim_row(cursor);
+	if (cursor->row >= 0) {
+		cursor->y_offset = cursor->row;
+	} else {
+		cursor->y_offset = cursor->pvcount - 1;
+	}
 	if (cursor->y_offset < 0)
 		cursor->y_offset = 0;
 
+	pv_crs_claim_stage(cursor);
+
 	/*
 	 * If anyone else had attached to the shared memory segment, we need
 	 * to read the top Y co-ordinate from it.
@@ -378,6 +762,16 @@ void pv_crs_init(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtransie
 	if ((!control->cursor) || (cursor->disable))
 		return;
 
+	/*
+	 * With nothing to display there is no point opening the terminal
+	 * or attaching to the shared memory segment.
+	 */
+	if (control->no_display) {
+		debug("%s", "no display - not initialising cursor positioning");
+		cursor->disable = true;
+		return;
+	}
+
 	debug("%s", "init");
 
 	ttyfile = ttyname(STDERR_FILENO);
@@ -502,17 +896,22 @@ static void pv_crs_reinit(pvcursorstate_t cursor, readonly_pvcontrol_t control,
 /*
  * Output a single-line update (\0-terminated), using the ECMA-48 CSI "CUP"
  * sequence to move the cursor to the correct position to do so.
+ *
+ * Returns true if the update was written to the same line as the previous
+ * one, so that an update containing only the changes since then will have
+ * been correct, or false if nothing was written or the line has moved.
  */
-void pv_crs_update(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtransientflags_t flags,
+bool pv_crs_update(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtransientflags_t flags,
 		   const char *output_line)
 {
 	char cup_cmd[32];		 /* flawfinder: ignore */
 	size_t cup_cmd_length, output_line_length;
+	bool same_line;
 	int y;
 
 	/* Early return if cursor positioning was disabled. */
 	if (cursor->disable)
-		return;
+		return false;
 
 	/*
 	 * flawfinder rationale: the "cup_cmd" buffer is always zeroed
@@ -537,8 +936,10 @@ void pv_crs_update(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtrans
 			}
 		}
 
-		if (cursor->needreinit > 0)
-			return;
+		if (cursor->needreinit > 0) {
+			cursor->y_lastwritten = 0;
+			return false;
+		}
 	}
 #endif				/* HAVE_IPC */
 
@@ -586,6 +987,20 @@ void pv_crs_update(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtrans
 
 	if (!cursor->noipc)
 		y = cursor->y_start + cursor->y_offset;
+
+	/*
+	 * With a row of our own, publish the update there, and only write
+	 * to the terminal if we are the renderer, drawing everyone's rows
+	 * at once.  The terminal is no longer locked on every update, and
+	 * since we can't tell whether our previous update has been drawn,
+	 * the next one has to be a whole line.
+	 */
+	if ((!cursor->noipc) && pv_crs_publish_row(cursor, output_line, output_line_length)) {
+		if (pv_crs_elect_renderer(cursor, control, false))
+			pv_crs_render_rows(cursor, control, flags);
+		cursor->y_lastwritten = 0;
+		return false;
+	}
 #endif				/* HAVE_IPC */
 
 	/*
@@ -612,6 +1027,11 @@ void pv_crs_update(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtrans
 	pv_tty_write(flags, output_line, output_line_length);
 
 	pv_crs_unlock(cursor, STDERR_FILENO);
+
+	same_line = (y == cursor->y_lastwritten);
+	cursor->y_lastwritten = y;
+
+	return same_line;
 }
 
 
@@ -627,6 +1047,25 @@ void pv_crs_fini(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtransie
 
 	debug("%s", "fini");
 
+#ifdef HAVE_IPC
+	/*
+	 * Draw any rows still waiting, so that our own final update is
+	 * shown even if the renderer has already gone, and then hand the
+	 * job of renderer over to whoever updates next.
+	 */
+	if ((!cursor->noipc) && (!cursor->disable) && (NULL != cursor->shared) && (cursor->row >= 0)) {
+		pid_t our_pid = getpid();
+		(void) pv_crs_elect_renderer(cursor, control, true);
+		pv_crs_render_rows(cursor, control, flags);
+		(void) __atomic_compare_exchange_n(&(cursor->shared->renderer), &our_pid, 0, false, __ATOMIC_ACQ_REL,
+						   __ATOMIC_ACQUIRE);
+	}
+	if (NULL != cursor->batch) {
+		free(cursor->batch);
+		cursor->batch = NULL;
+	}
+#endif				/* HAVE_IPC */
+
 	y = (unsigned int) (cursor->y_start);
 
 #ifdef HAVE_IPC
@@ -668,10 +1107,24 @@ void pv_crs_fini(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtransie
 	}
 
 	pv_crs_ipccount(cursor);
+
+	/*
+	 * If we are the last instance still attached, everyone else has
+	 * published their figures, so summarise them for "--stats".
+	 */
+	if ((cursor->pvcount < 2) && control->show_stats)
+		pv_crs_summarise(cursor);
+
+	/*
+	 * Our stage slot is left claimed, so that the figures in it are
+	 * still there for whichever instance finishes last.
+	 */
 	if (NULL != cursor->shared) {
 		(void) shmdt(cursor->shared);
 	}
 	cursor->shared = NULL;
+	cursor->stage_slot = -1;
+	cursor->row = -1;
 
 	/*
 	 * If we are the last instance detaching from the shared memory,
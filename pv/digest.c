@@ -0,0 +1,670 @@
+/*
+ * Functions for computing a digest of the output with "--digest", so that
+ * a checksum of the stream doesn't need a separate process reading a copy
+ * of it.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#ifdef HAVE_COMMONCRYPTO_COMMONDIGEST_H
+#include <CommonCrypto/CommonDigest.h>
+#endif
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+/*
+ * The digest is updated from pv__transfer_track_written(), with exactly
+ * the bytes that were committed to the output, in order.  Transfer paths
+ * which would move data without it passing through our buffer are not
+ * used while a digest is being computed, except for tee() and splice()
+ * between pipes, where the copy read from the side pipe is digested.
+ *
+ * CRC-32C uses the CPU's CRC32 instructions where the compiler says they
+ * are available (SSE 4.2, or the ARMv8 CRC extension), and a table
+ * otherwise.  SHA-256 uses CommonCrypto where it is available, which uses
+ * the hardware SHA instructions on Apple CPUs, and a portable version
+ * otherwise.  XXH64 is the 64-bit xxHash.
+ */
+
+struct pvdigest_s {
+	pvdigest_t type;		 /* which digest this is */
+	union {
+		uint32_t crc32c;	 /* CRC-32C, before final inversion */
+		struct {
+			uint64_t acc[4];	/* the four lane accumulators */
+			uint64_t total_len;	/* bytes digested so far */
+			unsigned char buffer[32];	/* partial stripe */
+			size_t buffered;	/* bytes in buffer */
+		} xxh64;
+#ifdef HAVE_COMMONCRYPTO_COMMONDIGEST_H
+		CC_SHA256_CTX commoncrypto;
+#endif
+		struct {
+			uint32_t h[8];		/* hash state */
+			uint64_t total_len;	/* bytes digested so far */
+			unsigned char buffer[64];	/* partial block */
+			size_t buffered;	/* bytes in buffer */
+		} sha256;
+	} ctx;
+};
+
+
+/*
+ * Names for each digest type, as accepted by --digest and shown by the
+ * stats.
+ */
+const char *pv_digest_name(pvdigest_t type)
+{
+	switch (type) {
+	case PV_DIGEST_CRC32C:
+		return "crc32c";
+	case PV_DIGEST_XXH64:
+		return "xxh64";
+	case PV_DIGEST_SHA256:
+		return "sha256";
+	case PV_DIGEST_NONE:
+	default:
+		break;
+	}
+	return "none";
+}
+
+
+/*
+ * CRC-32C (Castagnoli), reflected, polynomial 0x82F63B78.
+ */
+#if (!defined(__SSE4_2__)) && (!defined(__ARM_FEATURE_CRC32))
+static uint32_t pv__crc32c_table[8][256];
+static bool pv__crc32c_table_ready = false;
+
+static void pv__crc32c_init_table(void)
+{
+	unsigned int byte, bit, slice;
+
+	for (byte = 0; byte < 256; byte++) {
+		uint32_t crc = (uint32_t) byte;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+		pv__crc32c_table[0][byte] = crc;
+	}
+	for (byte = 0; byte < 256; byte++) {
+		for (slice = 1; slice < 8; slice++) {
+			uint32_t prev = pv__crc32c_table[slice - 1][byte];
+			pv__crc32c_table[slice][byte] = (prev >> 8) ^ pv__crc32c_table[0][prev & 0xFF];
+		}
+	}
+	pv__crc32c_table_ready = true;
+}
+#endif
+
+static uint32_t pv__crc32c_update(uint32_t crc, const unsigned char *data, size_t count)
+{
+#if defined(__SSE4_2__) || defined(__ARM_FEATURE_CRC32)
+	uint64_t crc64 = crc;
+
+	while (count >= 8) {
+		uint64_t word;
+		memcpy(&word, data, 8);
+#if defined(__SSE4_2__)
+		crc64 = _mm_crc32_u64(crc64, word);
+#else
+		crc64 = __crc32cd((uint32_t) crc64, word);
+#endif
+		data += 8;
+		count -= 8;
+	}
+	crc = (uint32_t) crc64;
+	while (count > 0) {
+#if defined(__SSE4_2__)
+		crc = _mm_crc32_u8(crc, *data);
+#else
+		crc = __crc32cb(crc, *data);
+#endif
+		data++;
+		count--;
+	}
+#else				/* no CRC32 instructions */
+	if (!pv__crc32c_table_ready)
+		pv__crc32c_init_table();
+
+	/* Slicing-by-8, which needs the bytes in little-endian order. */
+	while (count >= 8) {
+		uint32_t low, high;
+		low = crc ^ ((uint32_t) data[0] | ((uint32_t) data[1] << 8)
+			     | ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24));
+		high = (uint32_t) data[4] | ((uint32_t) data[5] << 8)
+		    | ((uint32_t) data[6] << 16) | ((uint32_t) data[7] << 24);
+		crc = pv__crc32c_table[7][low & 0xFF] ^ pv__crc32c_table[6][(low >> 8) & 0xFF]
+		    ^ pv__crc32c_table[5][(low >> 16) & 0xFF] ^ pv__crc32c_table[4][low >> 24]
+		    ^ pv__crc32c_table[3][high & 0xFF] ^ pv__crc32c_table[2][(high >> 8) & 0xFF]
+		    ^ pv__crc32c_table[1][(high >> 16) & 0xFF] ^ pv__crc32c_table[0][high >> 24];
+		data += 8;
+		count -= 8;
+	}
+	while (count > 0) {
+		crc = (crc >> 8) ^ pv__crc32c_table[0][(crc ^ *data) & 0xFF];
+		data++;
+		count--;
+	}
+#endif
+	return crc;
+}
+
+
+/*
+ * XXH64.
+ */
+#define PV_XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define PV_XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PV_XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define PV_XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PV_XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t pv__xxh64_rotl(uint64_t value, unsigned int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t pv__xxh64_read64(const unsigned char *data)
+{
+	return (uint64_t) data[0] | ((uint64_t) data[1] << 8) | ((uint64_t) data[2] << 16)
+	    | ((uint64_t) data[3] << 24) | ((uint64_t) data[4] << 32) | ((uint64_t) data[5] << 40)
+	    | ((uint64_t) data[6] << 48) | ((uint64_t) data[7] << 56);
+}
+
+static uint64_t pv__xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * PV_XXH_PRIME64_2;
+	acc = pv__xxh64_rotl(acc, 31);
+	return acc * PV_XXH_PRIME64_1;
+}
+
+static uint64_t pv__xxh64_merge(uint64_t hash, uint64_t acc)
+{
+	hash ^= pv__xxh64_round(0, acc);
+	return hash * PV_XXH_PRIME64_1 + PV_XXH_PRIME64_4;
+}
+
+static void pv__xxh64_stripes(uint64_t *acc, const unsigned char *data, size_t stripes)
+{
+	while (stripes > 0) {
+		acc[0] = pv__xxh64_round(acc[0], pv__xxh64_read64(data));
+		acc[1] = pv__xxh64_round(acc[1], pv__xxh64_read64(data + 8));
+		acc[2] = pv__xxh64_round(acc[2], pv__xxh64_read64(data + 16));
+		acc[3] = pv__xxh64_round(acc[3], pv__xxh64_read64(data + 24));
+		data += 32;
+		stripes--;
+	}
+}
+
+static uint64_t pv__xxh64_final(struct pvdigest_s *digest)
+{
+	const unsigned char *data = digest->ctx.xxh64.buffer;
+	size_t remaining = digest->ctx.xxh64.buffered;
+	uint64_t *acc = digest->ctx.xxh64.acc;
+	uint64_t hash;
+
+	if (digest->ctx.xxh64.total_len >= 32) {
+		hash = pv__xxh64_rotl(acc[0], 1) + pv__xxh64_rotl(acc[1], 7)
+		    + pv__xxh64_rotl(acc[2], 12) + pv__xxh64_rotl(acc[3], 18);
+		hash = pv__xxh64_merge(hash, acc[0]);
+		hash = pv__xxh64_merge(hash, acc[1]);
+		hash = pv__xxh64_merge(hash, acc[2]);
+		hash = pv__xxh64_merge(hash, acc[3]);
+	} else {
+		hash = acc[2] + PV_XXH_PRIME64_5;	/* acc[2] holds the seed, 0 */
+	}
+
+	hash += digest->ctx.xxh64.total_len;
+
+	while (remaining >= 8) {
+		hash ^= pv__xxh64_round(0, pv__xxh64_read64(data));
+		hash = pv__xxh64_rotl(hash, 27) * PV_XXH_PRIME64_1 + PV_XXH_PRIME64_4;
+		data += 8;
+		remaining -= 8;
+	}
+	if (remaining >= 4) {
+		uint64_t word = (uint64_t) data[0] | ((uint64_t) data[1] << 8)
+		    | ((uint64_t) data[2] << 16) | ((uint64_t) data[3] << 24);
+		hash ^= word * PV_XXH_PRIME64_1;
+		hash = pv__xxh64_rotl(hash, 23) * PV_XXH_PRIME64_2 + PV_XXH_PRIME64_3;
+		data += 4;
+		remaining -= 4;
+	}
+	while (remaining > 0) {
+		hash ^= (uint64_t) (*data) * PV_XXH_PRIME64_5;
+		hash = pv__xxh64_rotl(hash, 11) * PV_XXH_PRIME64_1;
+		data++;
+		remaining--;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PV_XXH_PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PV_XXH_PRIME64_3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+
+/*
+ * Portable SHA-256 (FIPS 180-4), for where CommonCrypto isn't available.
+ */
+#ifndef HAVE_COMMONCRYPTO_COMMONDIGEST_H
+static const uint32_t pv__sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define PV_SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void pv__sha256_blocks(uint32_t *h, const unsigned char *data, size_t blocks)
+{
+	while (blocks > 0) {
+		uint32_t w[64], a, b, c, d, e, f, g, hh;
+		unsigned int idx;
+
+		for (idx = 0; idx < 16; idx++) {
+			w[idx] = ((uint32_t) data[idx * 4] << 24) | ((uint32_t) data[idx * 4 + 1] << 16)
+			    | ((uint32_t) data[idx * 4 + 2] << 8) | (uint32_t) data[idx * 4 + 3];
+		}
+		for (idx = 16; idx < 64; idx++) {
+			uint32_t s0, s1;
+			s0 = PV_SHA256_ROTR(w[idx - 15], 7) ^ PV_SHA256_ROTR(w[idx - 15], 18) ^ (w[idx - 15] >> 3);
+			s1 = PV_SHA256_ROTR(w[idx - 2], 17) ^ PV_SHA256_ROTR(w[idx - 2], 19) ^ (w[idx - 2] >> 10);
+			w[idx] = w[idx - 16] + s0 + w[idx - 7] + s1;
+		}
+
+		a = h[0];
+		b = h[1];
+		c = h[2];
+		d = h[3];
+		e = h[4];
+		f = h[5];
+		g = h[6];
+		hh = h[7];
+
+		for (idx = 0; idx < 64; idx++) {
+			uint32_t s0, s1, choice, majority, temp1, temp2;
+			s1 = PV_SHA256_ROTR(e, 6) ^ PV_SHA256_ROTR(e, 11) ^ PV_SHA256_ROTR(e, 25);
+			choice = (e & f) ^ ((~e) & g);
+			temp1 = hh + s1 + choice + pv__sha256_k[idx] + w[idx];
+			s0 = PV_SHA256_ROTR(a, 2) ^ PV_SHA256_ROTR(a, 13) ^ PV_SHA256_ROTR(a, 22);
+			majority = (a & b) ^ (a & c) ^ (b & c);
+			temp2 = s0 + majority;
+			hh = g;
+			g = f;
+			f = e;
+			e = d + temp1;
+			d = c;
+			c = b;
+			b = a;
+			a = temp1 + temp2;
+		}
+
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+		h[5] += f;
+		h[6] += g;
+		h[7] += hh;
+
+		data += 64;
+		blocks--;
+	}
+}
+#endif				/* !HAVE_COMMONCRYPTO_COMMONDIGEST_H */
+
+
+/*
+ * Process "blocks" whole blocks at "data" for a buffered block digest.
+ */
+static void pv__digest_whole_blocks(struct pvdigest_s *digest, const unsigned char *data, size_t blocks)
+{
+	if (PV_DIGEST_XXH64 == digest->type) {
+		pv__xxh64_stripes(digest->ctx.xxh64.acc, data, blocks);
+		return;
+	}
+#ifndef HAVE_COMMONCRYPTO_COMMONDIGEST_H
+	pv__sha256_blocks(digest->ctx.sha256.h, data, blocks);
+#endif
+}
+
+
+/*
+ * Feed "count" bytes from "data" into a buffered block digest - XXH64 or
+ * the portable SHA-256 - whose blocks are "block_size" bytes and whose
+ * partial block is held in "buffer".
+ */
+static void pv__digest_blocks(struct pvdigest_s *digest, const unsigned char *data, size_t count,
+			      unsigned char *buffer, size_t *buffered, size_t block_size)
+{
+	while (count > 0) {
+		size_t whole, chunk;
+
+		/* Finish off any partial block first. */
+		if ((*buffered > 0) || (count < block_size)) {
+			chunk = block_size - *buffered;
+			if (chunk > count)
+				chunk = count;
+			memcpy(buffer + *buffered, data, chunk);	/* flawfinder: ignore */
+			/* flawfinder: chunk never exceeds the room left in the buffer. */
+			*buffered += chunk;
+			data += chunk;
+			count -= chunk;
+			if (*buffered < block_size)
+				return;
+			*buffered = 0;
+			pv__digest_whole_blocks(digest, buffer, 1);
+			continue;
+		}
+
+		/* Then whole blocks straight from the data. */
+		whole = count / block_size;
+		pv__digest_whole_blocks(digest, data, whole);
+		data += whole * block_size;
+		count -= whole * block_size;
+	}
+}
+
+
+/*
+ * Start a new digest of the given type, replacing any existing one.
+ * Returns false if the digest could not be allocated, or if "type" is
+ * PV_DIGEST_NONE.
+ */
+static bool pv__digest_start(pvstate_t state, pvdigest_t type)
+{
+	struct pvdigest_s *digest;
+
+	pv_digest_free(state);
+
+	if (PV_DIGEST_NONE == type)
+		return false;
+
+	digest = calloc(1, sizeof(*digest));
+	if (NULL == digest) {
+		pv_error("%s: %s", _("digest allocation failed"), strerror(errno));
+		return false;
+	}
+
+	digest->type = type;
+
+	switch (type) {
+	case PV_DIGEST_CRC32C:
+		digest->ctx.crc32c = 0xFFFFFFFF;
+		break;
+	case PV_DIGEST_XXH64:
+		/* Seed of 0. */
+		digest->ctx.xxh64.acc[0] = PV_XXH_PRIME64_1 + PV_XXH_PRIME64_2;
+		digest->ctx.xxh64.acc[1] = PV_XXH_PRIME64_2;
+		digest->ctx.xxh64.acc[2] = 0;
+		digest->ctx.xxh64.acc[3] = 0 - PV_XXH_PRIME64_1;
+		break;
+	case PV_DIGEST_SHA256:
+#ifdef HAVE_COMMONCRYPTO_COMMONDIGEST_H
+		(void) CC_SHA256_Init(&(digest->ctx.commoncrypto));
+#else
+		digest->ctx.sha256.h[0] = 0x6a09e667;
+		digest->ctx.sha256.h[1] = 0xbb67ae85;
+		digest->ctx.sha256.h[2] = 0x3c6ef372;
+		digest->ctx.sha256.h[3] = 0xa54ff53a;
+		digest->ctx.sha256.h[4] = 0x510e527f;
+		digest->ctx.sha256.h[5] = 0x9b05688c;
+		digest->ctx.sha256.h[6] = 0x1f83d9ab;
+		digest->ctx.sha256.h[7] = 0x5be0cd19;
+#endif
+		break;
+	case PV_DIGEST_NONE:
+	default:
+		break;
+	}
+
+	state->status.digest = digest;
+
+	return true;
+}
+
+
+/*
+ * Add "count" bytes at "data", which have just been written to the
+ * output, to the digest selected with --digest.  The digest is started
+ * the first time this is called after pv_digest_free().
+ */
+void pv_digest_update(pvstate_t state, const char *data, size_t count)
+{
+	struct pvdigest_s *digest;
+	const unsigned char *bytes = (const unsigned char *) data;
+
+	if ((PV_DIGEST_NONE == state->control.digest) || (0 == count))
+		return;
+
+	if ((NULL == state->status.digest) && (!pv__digest_start(state, state->control.digest)))
+		return;
+
+	digest = state->status.digest;
+
+	switch (digest->type) {
+	case PV_DIGEST_CRC32C:
+		digest->ctx.crc32c = pv__crc32c_update(digest->ctx.crc32c, bytes, count);
+		break;
+	case PV_DIGEST_XXH64:
+		digest->ctx.xxh64.total_len += count;
+		pv__digest_blocks(digest, bytes, count, digest->ctx.xxh64.buffer, &(digest->ctx.xxh64.buffered), 32);
+		break;
+	case PV_DIGEST_SHA256:
+#ifdef HAVE_COMMONCRYPTO_COMMONDIGEST_H
+		/* CC_SHA256_Update() takes a 32-bit length. */
+		while (count > 0) {
+			CC_LONG chunk = (count > 0x40000000) ? 0x40000000 : (CC_LONG) count;
+			(void) CC_SHA256_Update(&(digest->ctx.commoncrypto), bytes, chunk);
+			bytes += chunk;
+			count -= chunk;
+		}
+#else
+		digest->ctx.sha256.total_len += count;
+		pv__digest_blocks(digest, bytes, count, digest->ctx.sha256.buffer, &(digest->ctx.sha256.buffered), 64);
+#endif
+		break;
+	case PV_DIGEST_NONE:
+	default:
+		break;
+	}
+}
+
+
+/*
+ * Write the digest of everything passed to pv_digest_update() so far, as
+ * lower case hexadecimal, into "buffer", which is "bufsize" bytes long.
+ * The digest itself is left unchanged, so this can be called at any time.
+ * Returns false, leaving the buffer empty, if there is no digest or the
+ * buffer is too small.
+ */
+bool pv_digest_hex(pvstate_t state, char *buffer, size_t bufsize)
+{
+	unsigned char result[32];
+	size_t result_len, idx;
+	struct pvdigest_s copy;
+
+	if (bufsize > 0)
+		buffer[0] = '\0';
+
+	if (PV_DIGEST_NONE == state->control.digest)
+		return false;
+
+	/* Nothing written yet - give the digest of no data. */
+	if ((NULL == state->status.digest) && (!pv__digest_start(state, state->control.digest)))
+		return false;
+	if (NULL == state->status.digest)
+		return false;
+
+	/* Finish a copy, so that the running digest can carry on. */
+	copy = *(state->status.digest);
+	result_len = 0;
+
+	switch (copy.type) {
+	case PV_DIGEST_CRC32C:
+		{
+			uint32_t crc = copy.ctx.crc32c ^ 0xFFFFFFFF;
+			for (idx = 0; idx < 4; idx++)
+				result[idx] = (unsigned char) (crc >> (24 - 8 * idx));
+			result_len = 4;
+		}
+		break;
+	case PV_DIGEST_XXH64:
+		{
+			uint64_t hash = pv__xxh64_final(&copy);
+			for (idx = 0; idx < 8; idx++)
+				result[idx] = (unsigned char) (hash >> (56 - 8 * idx));
+			result_len = 8;
+		}
+		break;
+	case PV_DIGEST_SHA256:
+#ifdef HAVE_COMMONCRYPTO_COMMONDIGEST_H
+		(void) CC_SHA256_Final(result, &(copy.ctx.commoncrypto));
+#else
+		{
+			unsigned char padding[72];
+			uint64_t bit_len = copy.ctx.sha256.total_len * 8;
+			size_t pad_len;
+
+			memset(padding, 0, sizeof(padding));
+			padding[0] = 0x80;
+			pad_len = (copy.ctx.sha256.buffered < 56) ? 56 - copy.ctx.sha256.buffered
+			    : 120 - copy.ctx.sha256.buffered;
+			for (idx = 0; idx < 8; idx++)
+				padding[pad_len + idx] = (unsigned char) (bit_len >> (56 - 8 * idx));
+			pv__digest_blocks(&copy, padding, pad_len + 8, copy.ctx.sha256.buffer,
+					  &(copy.ctx.sha256.buffered), 64);
+			for (idx = 0; idx < 32; idx++)
+				result[idx] = (unsigned char) (copy.ctx.sha256.h[idx / 4] >> (24 - 8 * (idx % 4)));
+		}
+#endif
+		result_len = 32;
+		break;
+	case PV_DIGEST_NONE:
+	default:
+		break;
+	}
+
+	if ((0 == result_len) || (bufsize < 2 * result_len + 1))
+		return false;
+
+	for (idx = 0; idx < result_len; idx++)
+		(void) pv_snprintf(buffer + 2 * idx, 3, "%02x", (unsigned int) (result[idx]));
+
+	return true;
+}
+
+
+/*
+ * Write the running state of the digest into "buffer", which is "bufsize"
+ * bytes long, as hexadecimal, so that pv_digest_restore() can carry it on
+ * later - this is how a --checkpoint file keeps the digest going.  The
+ * state is in this build's own layout and byte order.  Returns false,
+ * leaving the buffer empty, if there is no digest or the buffer is too
+ * small.
+ */
+bool pv_digest_save(pvstate_t state, char *buffer, size_t bufsize)
+{
+	const unsigned char *bytes;
+	size_t idx;
+
+	if (bufsize > 0)
+		buffer[0] = '\0';
+
+	if (PV_DIGEST_NONE == state->control.digest)
+		return false;
+
+	if ((NULL == state->status.digest) && (!pv__digest_start(state, state->control.digest)))
+		return false;
+	if (NULL == state->status.digest)
+		return false;
+
+	if (bufsize < 2 * sizeof(struct pvdigest_s) + 1)
+		return false;
+
+	bytes = (const unsigned char *) (state->status.digest);
+	for (idx = 0; idx < sizeof(struct pvdigest_s); idx++)
+		(void) pv_snprintf(buffer + 2 * idx, 3, "%02x", (unsigned int) (bytes[idx]));
+
+	return true;
+}
+
+
+/*
+ * Replace the running digest with one saved by pv_digest_save().  Returns
+ * false, leaving the digest unchanged, if "hex" is not the saved state of
+ * a digest of the type selected with --digest.
+ */
+bool pv_digest_restore(pvstate_t state, const char *hex)
+{
+	struct pvdigest_s saved;
+	unsigned char *bytes;
+	size_t idx;
+
+	if (PV_DIGEST_NONE == state->control.digest)
+		return false;
+
+	if (strlen(hex) != 2 * sizeof(saved))	/* flawfinder: ignore */
+		return false;
+	/* flawfinder - "hex" is always \0-terminated by the caller. */
+
+	memset(&saved, 0, sizeof(saved));
+	bytes = (unsigned char *) (&saved);
+	for (idx = 0; idx < sizeof(saved); idx++) {
+		unsigned int value = 0;
+		if (1 != sscanf(hex + 2 * idx, "%2x", &value))
+			return false;
+		bytes[idx] = (unsigned char) value;
+	}
+
+	if (saved.type != state->control.digest)
+		return false;
+
+	if ((NULL == state->status.digest) && (!pv__digest_start(state, state->control.digest)))
+		return false;
+	if (NULL == state->status.digest)
+		return false;
+
+	*(state->status.digest) = saved;
+
+	return true;
+}
+
+
+/*
+ * Free the digest, if there is one, so that the next call to
+ * pv_digest_update() starts a new one.
+ */
+void pv_digest_free(pvstate_t state)
+{
+	if ((NULL == state) || (NULL == state->status.digest))
+		return;
+	free(state->status.digest);
+	state->status.digest = NULL;
+}
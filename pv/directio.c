@@ -0,0 +1,650 @@
+/*
+ * Functions for transferring data with "--direct-io", bypassing the page
+ * cache with aligned, double-buffered reads and writes.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#ifdef HAVE_PTHREAD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+
+/*
+ * Direct I/O - O_DIRECT, or F_NOCACHE on Darwin - needs every read and
+ * write to start at an offset, and a memory address, which is a multiple
+ * of the file's logical block size, and to be a whole number of blocks
+ * long.  The normal transfer buffer can't promise that, since reads and
+ * writes land wherever the last one left off, so direct I/O has its own
+ * path.
+ *
+ * A reader thread fills two page-aligned buffers in turn, each a whole
+ * number of blocks, while pv_transfer() writes out the other one, so the
+ * reads and writes overlap.  Each buffer is only handed over once it
+ * holds a whole number of output blocks, so that every write can be
+ * direct, except for the tail at the end of the input, which is written
+ * through the page cache after clearing the flag.
+ *
+ * Only regular files and disk devices are switched to direct I/O, and
+ * only if they are already positioned on a block boundary; a pipe, for
+ * instance, is read or written normally, while the other end of the
+ * transfer still bypasses the cache.
+ */
+#define PV_DIRECTIO_BUFFERS	2
+#define PV_DIRECTIO_MIN_BLOCK	512
+#define PV_DIRECTIO_MAX_BLOCK	65536
+
+struct pvdirectio_buffer_s {
+	/*@only@ */ /*@null@ */ char *data;	/* aligned data buffer */
+	size_t length;			 /* bytes of data in the buffer */
+	size_t taken;			 /* bytes already written out */
+	bool filled;			 /* set while the consumer owns it */
+	bool counted;			 /* set once added to total_bytes_read */
+};
+
+struct pvdirectio_s {
+	pthread_t thread;		 /* the reader thread */
+	pthread_mutex_t mutex;		 /* protects the state changes below */
+	pthread_cond_t changed;		 /* signalled on any buffer state change */
+	struct pvdirectio_buffer_s buffers[PV_DIRECTIO_BUFFERS];
+	unsigned int fill_index;	 /* next buffer for the reader to fill */
+	unsigned int take_index;	 /* next buffer for the consumer to take */
+	size_t buffer_size;		 /* capacity of each buffer */
+	size_t input_block;		 /* input block size, 1 if not direct */
+	size_t output_block;		 /* output block size, 1 if never direct */
+	off_t read_limit;		 /* bytes left to read, or -1 for no limit */
+	int input_fd;			 /* input file descriptor */
+	int output_fd;			 /* output file descriptor */
+	int read_errno;			 /* errno of the read error, if any */
+	bool input_direct;		 /* set while the input is direct */
+	bool output_direct;		 /* set while the output is direct */
+	bool thread_started;		 /* set once pthread_create() succeeded */
+	bool stop_requested;		 /* set by the consumer to end the thread */
+	bool finished;			 /* set by the reader at EOF or on error */
+};
+
+
+/*
+ * Turn direct I/O on or off for "fd".  Returns false if it could not be
+ * changed.
+ */
+static bool pv__directio_set(int fd, bool enable)
+{
+#if defined(O_DIRECT)
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0)
+		return false;
+	flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+	if (0 != fcntl(fd, F_SETFL, flags)) {
+		debug("%s: %d: %s", "fcntl", fd, strerror(errno));
+		return false;
+	}
+	return true;
+#elif defined(F_NOCACHE)
+	if (0 != fcntl(fd, F_NOCACHE, enable ? 1 : 0)) {
+		debug("%s: %d: %s", "fcntl", fd, strerror(errno));
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+/*
+ * Return the block size that direct I/O on "fd" has to be aligned to, or
+ * 0 if "fd" is not something that direct I/O should be used on.
+ */
+static size_t pv__directio_block_size(int fd)
+{
+	struct stat sb;
+	long block_size;
+	off_t position;
+	int flags;
+
+	memset(&sb, 0, sizeof(sb));
+	if (0 != fstat(fd, &sb))
+		return 0;
+
+	block_size = -1;
+
+	if (S_ISBLK(sb.st_mode) || S_ISCHR(sb.st_mode)) {
+		struct pvblkdev_s geometry;
+		/*
+		 * For a disk device, align to its physical sector size,
+		 * which is a multiple of the logical one that direct I/O
+		 * needs, and avoids the device having to read a sector
+		 * back in to write part of it; a character device which
+		 * isn't a disk won't answer, and is left alone.
+		 */
+		if (pv_blkdev_probe(fd, &geometry) && (geometry.physical_sector > 0))
+			block_size = (long) (geometry.physical_sector);
+		if (block_size < 0)
+			return 0;
+	} else if (S_ISREG(sb.st_mode)) {
+#if defined(HAVE_FPATHCONF) && defined(_PC_REC_XFER_ALIGN)
+		block_size = fpathconf(fd, _PC_REC_XFER_ALIGN);
+#endif
+		if ((block_size <= 0) && (sb.st_blksize > 0))
+			block_size = (long) (sb.st_blksize);
+	} else {
+		return 0;
+	}
+
+	if ((block_size < PV_DIRECTIO_MIN_BLOCK) || (block_size > PV_DIRECTIO_MAX_BLOCK)
+	    || (0 != (block_size & (block_size - 1)))) {
+		block_size = 4096;
+	}
+
+	/*
+	 * Direct I/O from the current position is only possible if that
+	 * position is on a block boundary - for an output in append mode,
+	 * that means the end of the file.
+	 */
+	flags = fcntl(fd, F_GETFL);
+	if ((flags >= 0) && (0 != (flags & O_APPEND))) {
+		position = sb.st_size;
+	} else {
+		position = lseek(fd, 0, SEEK_CUR);
+	}
+	if ((position > 0) && (0 != (position % (off_t) block_size))) {
+		debug("%s: %d: %ld", "not on a block boundary - not using direct I/O", fd, (long) position);
+		return 0;
+	}
+
+	return (size_t) block_size;
+}
+
+
+/*
+ * Wait for up to "usec" microseconds for "fd" to become readable, for use
+ * by the reader thread after a transient read error.
+ */
+static void pv__directio_wait_readable(int fd, long usec)
+{
+	struct timeval tv;
+	fd_set readfds;
+
+	memset(&tv, 0, sizeof(tv));
+	tv.tv_sec = usec / 1000000;
+	tv.tv_usec = usec % 1000000;
+
+#if SPLINT
+	memset(&readfds, 0, sizeof(readfds));
+#else
+	FD_ZERO(&readfds);
+	FD_SET(fd, &readfds);
+#endif
+
+	(void) select(fd + 1, &readfds, NULL, NULL, &tv);
+}
+
+
+/*
+ * Fill one buffer from the input, returning the number of bytes read, 0
+ * at end of file, or -1 on error with errno set.
+ *
+ * The buffer is only returned part full if that part is a whole number
+ * of output blocks, or the input has ended, so that the consumer never
+ * has to split an output block across two buffers.
+ */
+static ssize_t pv__directio_fill(struct pvdirectio_s *directio, struct pvdirectio_buffer_s *buffer)
+{
+	size_t capacity, length;
+
+	capacity = directio->buffer_size;
+	if ((directio->read_limit >= 0) && ((off_t) capacity > directio->read_limit))
+		capacity = (size_t) (directio->read_limit);
+
+	length = 0;
+
+	while ((length < capacity) && (!directio->stop_requested)) {
+		size_t asked;
+		ssize_t nread;
+		int old_cancel_state;
+
+		asked = capacity - length;
+		if (asked > MAX_READ_AT_ONCE)
+			asked = MAX_READ_AT_ONCE;
+
+		/*
+		 * A read to the --size limit may not be a whole number of
+		 * blocks, so that last one goes through the page cache.
+		 */
+		if (directio->input_direct && (0 != (asked % directio->input_block))) {
+			debug("%s", "partial block at read limit - clearing direct input");
+			(void) pv__directio_set(directio->input_fd, false);
+			directio->input_direct = false;
+		}
+
+		/* As in the --pipeline reader, only the read is cancellable. */
+		old_cancel_state = 0;
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancel_state);
+		nread = read(directio->input_fd, buffer->data + length, asked);	/* flawfinder: ignore */
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancel_state);
+
+		/*
+		 * flawfinder rationale: the read is bounded by "capacity",
+		 * which is no more than the size of the buffer.
+		 */
+
+		if (nread < 0) {
+			if ((EINVAL == errno) && directio->input_direct) {
+				debug("%s: %s", "direct read rejected - clearing direct input", strerror(errno));
+				(void) pv__directio_set(directio->input_fd, false);
+				directio->input_direct = false;
+				continue;
+			}
+			if ((EINTR == errno) || (EAGAIN == errno)) {
+				if ((length > 0) && (0 == (length % directio->output_block)))
+					break;
+				pv__directio_wait_readable(directio->input_fd, 90000);
+				continue;
+			}
+			if (length > 0)
+				break;
+			return -1;
+		}
+
+		if (0 == nread)
+			break;
+
+		length += (size_t) nread;
+
+		/*
+		 * A short read from something that isn't direct, such as a
+		 * pipe, hands over what we have, as long as it ends on an
+		 * output block boundary.
+		 */
+		if (((size_t) nread < asked) && (!directio->input_direct)
+		    && (0 == (length % directio->output_block))) {
+			break;
+		}
+	}
+
+	return (ssize_t) length;
+}
+
+
+/*
+ * Main function of the reader thread: keep filling free buffers until the
+ * end of the input, a read error, or the consumer asks us to stop.
+ */
+/*@null@ */
+static void *pv__directio_reader(void *arg)
+{
+	struct pvdirectio_s *directio;
+
+	directio = (struct pvdirectio_s *) arg;
+
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	while (true) {
+		struct pvdirectio_buffer_s *buffer;
+		ssize_t nread;
+		int read_errno;
+
+		(void) pthread_mutex_lock(&(directio->mutex));
+		while ((!directio->stop_requested) && (directio->buffers[directio->fill_index].filled)) {
+			(void) pthread_cond_wait(&(directio->changed), &(directio->mutex));
+		}
+		if (directio->stop_requested) {
+			(void) pthread_mutex_unlock(&(directio->mutex));
+			break;
+		}
+		buffer = &(directio->buffers[directio->fill_index]);
+		(void) pthread_mutex_unlock(&(directio->mutex));
+
+		/* The buffer isn't marked filled yet, so it's ours. */
+		nread = pv__directio_fill(directio, buffer);
+		read_errno = errno;
+
+		(void) pthread_mutex_lock(&(directio->mutex));
+		if (nread > 0) {
+			buffer->length = (size_t) nread;
+			buffer->taken = 0;
+			buffer->counted = false;
+			buffer->filled = true;
+			directio->fill_index = (directio->fill_index + 1) % PV_DIRECTIO_BUFFERS;
+			if (directio->read_limit >= 0)
+				directio->read_limit -= (off_t) nread;
+		}
+		if ((nread <= 0) || (0 == directio->read_limit)) {
+			directio->finished = true;
+			if (nread < 0)
+				directio->read_errno = read_errno;
+		}
+		(void) pthread_cond_broadcast(&(directio->changed));
+		if (directio->finished || directio->stop_requested) {
+			(void) pthread_mutex_unlock(&(directio->mutex));
+			break;
+		}
+		(void) pthread_mutex_unlock(&(directio->mutex));
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Free a direct I/O structure and its buffers - the reader thread must not
+ * be running.
+ */
+static void pv__directio_free( /*@only@ */ struct pvdirectio_s *directio)
+{
+	unsigned int buffer_idx;
+
+	for (buffer_idx = 0; buffer_idx < PV_DIRECTIO_BUFFERS; buffer_idx++) {
+		if (NULL != directio->buffers[buffer_idx].data)
+			pv_free_aligned_buffer(directio->buffers[buffer_idx].data, directio->buffer_size);
+	}
+	(void) pthread_cond_destroy(&(directio->changed));
+	(void) pthread_mutex_destroy(&(directio->mutex));
+	free(directio);
+}
+
+
+/*
+ * Start transferring from "fd" to the output with direct I/O, storing the
+ * state in state->transfer.directio.  Returns false if neither end can
+ * use direct I/O, or the reader thread could not be started, in which
+ * case the caller should transfer the data normally.
+ */
+bool pv_directio_start(pvstate_t state, int fd)
+{
+	struct pvdirectio_s *directio;
+	sigset_t all_signals, old_signals;
+	size_t input_block, output_block, alignment;
+	unsigned int buffer_idx;
+	int rc;
+
+	if (NULL != state->transfer.directio)
+		pv_directio_stop(&(state->transfer));
+
+	input_block = pv__directio_block_size(fd);
+	output_block = pv__directio_block_size(state->control.output_fd);
+
+	if ((0 == input_block) && (0 == output_block)) {
+		debug("%s", "neither input nor output can use direct I/O");
+		return false;
+	}
+
+	directio = calloc(1, sizeof(*directio));
+	if (NULL == directio) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		return false;
+	}
+
+	directio->input_fd = fd;
+	directio->output_fd = state->control.output_fd;
+	directio->read_limit = -1;
+	(void) pthread_mutex_init(&(directio->mutex), NULL);
+	(void) pthread_cond_init(&(directio->changed), NULL);
+
+	if ((input_block > 0) && pv__directio_set(fd, true)) {
+		directio->input_direct = true;
+		directio->input_block = input_block;
+	} else {
+		directio->input_block = 1;
+	}
+
+	if ((output_block > 0) && pv__directio_set(directio->output_fd, true)) {
+		directio->output_direct = true;
+		directio->output_block = output_block;
+	} else {
+		directio->output_block = 1;
+	}
+
+	/*
+	 * Each buffer is a whole number of pages, and so of blocks, since
+	 * the block sizes are powers of two no bigger than
+	 * PV_DIRECTIO_MAX_BLOCK.
+	 */
+	alignment = 4096;
+	if (directio->input_block > alignment)
+		alignment = directio->input_block;
+	if (directio->output_block > alignment)
+		alignment = directio->output_block;
+	directio->buffer_size = state->control.target_buffer_size;
+	if (directio->buffer_size < alignment)
+		directio->buffer_size = alignment;
+	directio->buffer_size = (directio->buffer_size + alignment - 1) & ~(alignment - 1);
+
+	for (buffer_idx = 0; buffer_idx < PV_DIRECTIO_BUFFERS; buffer_idx++) {
+		directio->buffers[buffer_idx].data =
+		    pv_allocate_aligned_buffer(&(state->control), directio->output_fd, fd, directio->buffer_size);
+		if (NULL == directio->buffers[buffer_idx].data) {
+			pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_MEMORY;
+			if (directio->input_direct)
+				(void) pv__directio_set(fd, false);
+			if (directio->output_direct)
+				(void) pv__directio_set(directio->output_fd, false);
+			pv__directio_free(directio);
+			return false;
+		}
+	}
+
+	/* As in pv__transfer_read(), don't read past --size (#166). */
+	if (state->control.stop_at_size) {
+		directio->read_limit = state->control.size - state->transfer.total_bytes_read;
+		if (directio->read_limit < 0)
+			directio->read_limit = 0;
+	}
+
+	/* As with the pipeline, leave all signals to the main thread. */
+	(void) sigfillset(&all_signals);
+	(void) sigemptyset(&old_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&(directio->thread), NULL, pv__directio_reader, directio);
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 != rc) {
+		pv_error("%s: %s", _("failed to start reader thread"), strerror(rc));
+		if (directio->input_direct)
+			(void) pv__directio_set(fd, false);
+		if (directio->output_direct)
+			(void) pv__directio_set(directio->output_fd, false);
+		pv__directio_free(directio);
+		return false;
+	}
+
+	directio->thread_started = true;
+	state->transfer.directio = directio;
+
+	debug("%s: fd=%d, %s=%ld, %s=%ld, %s=%ld", "direct I/O started", fd, "input block",
+	      directio->input_direct ? (long) (directio->input_block) : 0L, "output block",
+	      directio->output_direct ? (long) (directio->output_block) : 0L, "buffer size",
+	      (long) (directio->buffer_size));
+
+	return true;
+}
+
+
+/*
+ * Stop the direct I/O reader thread, if there is one, turn direct I/O off
+ * again on both descriptors, and free everything.  Any data which was read
+ * but not yet written is discarded.
+ */
+void pv_directio_stop(pvtransferstate_t transfer)
+{
+	struct pvdirectio_s *directio;
+
+	if (NULL == transfer || NULL == transfer->directio)
+		return;
+
+	directio = transfer->directio;
+	transfer->directio = NULL;
+
+	if (directio->thread_started) {
+		(void) pthread_mutex_lock(&(directio->mutex));
+		directio->stop_requested = true;
+		(void) pthread_cond_broadcast(&(directio->changed));
+		(void) pthread_mutex_unlock(&(directio->mutex));
+		/* As in pv_pipeline_stop(), the thread may be stuck in read(). */
+		(void) pthread_cancel(directio->thread);
+		(void) pthread_join(directio->thread, NULL);
+		debug("%s: fd=%d", "direct I/O stopped", directio->input_fd);
+	}
+
+	if (directio->input_direct)
+		(void) pv__directio_set(directio->input_fd, false);
+	if (directio->output_direct)
+		(void) pv__directio_set(directio->output_fd, false);
+
+	pv__directio_free(directio);
+}
+
+
+/*
+ * Return the input descriptor that direct I/O was started on, or -1 if it
+ * is not running.
+ */
+int pv_directio_input_fd(readonly_pvtransferstate_t transfer)
+{
+	if (NULL == transfer->directio)
+		return -1;
+	return transfer->directio->input_fd;
+}
+
+
+/*
+ * Point *data at the next data that the reader thread has produced,
+ * waiting up to "usec" microseconds for some to arrive if none is ready.
+ * The data stays in place until pv_directio_consume() is told how much of
+ * it was written.
+ *
+ * Returns the number of bytes at *data, or -1 if the reader has finished
+ * and there is nothing left, in which case *read_errno is set to the errno
+ * of the read failure, or 0 at end of file.
+ */
+ssize_t pv_directio_fetch(pvtransferstate_t transfer, long usec, char **data, int *read_errno)
+{
+	struct pvdirectio_s *directio;
+	struct pvdirectio_buffer_s *buffer;
+
+	*read_errno = 0;
+	*data = NULL;
+
+	directio = transfer->directio;
+	if (NULL == directio)
+		return 0;
+
+	(void) pthread_mutex_lock(&(directio->mutex));
+
+	buffer = &(directio->buffers[directio->take_index]);
+
+	if ((!buffer->filled) && (!directio->finished) && (usec > 0)) {
+		struct timespec deadline;
+
+		memset(&deadline, 0, sizeof(deadline));
+		(void) clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += usec / 1000000;
+		deadline.tv_nsec += (usec % 1000000) * 1000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		while ((!buffer->filled) && (!directio->finished)) {
+			if (ETIMEDOUT == pthread_cond_timedwait(&(directio->changed), &(directio->mutex), &deadline))
+				break;
+		}
+	}
+
+	if (!buffer->filled) {
+		bool finished = directio->finished;
+		*read_errno = directio->read_errno;
+		(void) pthread_mutex_unlock(&(directio->mutex));
+		return finished ? -1 : 0;
+	}
+
+	(void) pthread_mutex_unlock(&(directio->mutex));
+
+	if (!buffer->counted) {
+		transfer->total_bytes_read += (off_t) (buffer->length);
+		buffer->counted = true;
+	}
+
+	*data = buffer->data + buffer->taken;
+
+	return (ssize_t) (buffer->length - buffer->taken);
+}
+
+
+/*
+ * Mark "count" bytes of the data from pv_directio_fetch() as written,
+ * handing the buffer back to the reader thread once it is empty.
+ */
+void pv_directio_consume(pvtransferstate_t transfer, size_t count)
+{
+	struct pvdirectio_s *directio;
+	struct pvdirectio_buffer_s *buffer;
+
+	directio = transfer->directio;
+	if (NULL == directio)
+		return;
+
+	buffer = &(directio->buffers[directio->take_index]);
+	if (!buffer->filled)
+		return;
+
+	buffer->taken += count;
+	if (buffer->taken < buffer->length)
+		return;
+
+	(void) pthread_mutex_lock(&(directio->mutex));
+	buffer->filled = false;
+	buffer->length = 0;
+	buffer->taken = 0;
+	directio->take_index = (directio->take_index + 1) % PV_DIRECTIO_BUFFERS;
+	(void) pthread_cond_broadcast(&(directio->changed));
+	(void) pthread_mutex_unlock(&(directio->mutex));
+}
+
+
+/*
+ * Return the size that writes to the output have to be a multiple of -
+ * its block size while it is direct, or 1 if it isn't.
+ */
+size_t pv_directio_output_block(readonly_pvtransferstate_t transfer)
+{
+	if ((NULL == transfer->directio) || (!transfer->directio->output_direct))
+		return 1;
+	return transfer->directio->output_block;
+}
+
+
+/*
+ * Switch the output back to going through the page cache, for the tail at
+ * the end of the data, or after a write that direct I/O couldn't do.
+ */
+void pv_directio_output_buffered(pvtransferstate_t transfer)
+{
+	if ((NULL == transfer->directio) || (!transfer->directio->output_direct))
+		return;
+	debug("%s", "clearing direct output");
+	(void) pv__directio_set(transfer->directio->output_fd, false);
+	transfer->directio->output_direct = false;
+}
+
+#endif				/* HAVE_PTHREAD */
@@ -64,6 +64,28 @@ static bool pv__output_produced = false;
  * by checking pv__error_prefix_set.
  */
 
+/*
+ * Where the error messages of this thread go instead of standard error,
+ * if anywhere, set by a program that pv is embedded in.  Each thread has
+ * its own, so that transfers running in different threads of the same
+ * program keep their errors apart.
+ */
+static PV_THREAD_LOCAL /*@null@ */ pverrorfn_t pv__error_handler = NULL;
+static PV_THREAD_LOCAL /*@null@ */ void *pv__error_handler_data = NULL;
+
+/*
+ * While a frame is being composed by pv_tty_frame_begin(), terminal output
+ * is collected here instead of being written, along with the previous
+ * frame, so that an unchanged frame need not be written at all.
+ */
+static /*@null@ */ /*@only@ */ char *pv__tty_frame = NULL;
+static /*@null@ */ /*@only@ */ char *pv__tty_previous_frame = NULL;
+static size_t pv__tty_frame_length = 0;
+static size_t pv__tty_frame_size = 0;
+static size_t pv__tty_previous_frame_length = 0;
+static size_t pv__tty_previous_frame_size = 0;
+static bool pv__tty_frame_active = false;
+
 /*
  * Set the error message prefix.
  */
@@ -84,6 +106,16 @@ void pv_set_error_prefix( /*@unique@ */ const char *prefix)
 	 */
 }
 
+/*
+ * Send this thread's error messages to "handler", or to standard error if
+ * it is NULL.
+ */
+void pv_set_error_handler( /*@null@ */ pverrorfn_t handler, /*@null@ */ void *data)
+{
+	pv__error_handler = handler;
+	pv__error_handler_data = data;
+}
+
 /*
  * Output an error message.  If we've displayed anything to the terminal
  * already, then put a newline before our error so we don't write over what
@@ -92,6 +124,17 @@ void pv_set_error_prefix( /*@unique@ */ const char *prefix)
 void pv_error(char *format, ...)
 {
 	va_list ap;
+
+	if (NULL != pv__error_handler) {
+		char message[1024];	 /* flawfinder: ignore */
+		/* flawfinder: bounded by vsnprintf(), which terminates it. */
+		va_start(ap, format);
+		(void) vsnprintf(message, sizeof(message), format, ap);	/* flawfinder: ignore */
+		va_end(ap);
+		pv__error_handler(message, pv__error_handler_data);
+		return;
+	}
+
 	if (pv__output_produced)
 		fprintf(stderr, "\n");
 	if (pv__error_prefix_set)
@@ -178,6 +221,34 @@ void pv_write_retry(int fd, const char *buf, size_t count)
  */
 void pv_tty_write(readonly_pvtransientflags_t flags, const char *buf, size_t count)
 {
+	uint64_t profile_start;
+
+	if (pv__tty_frame_active && (0 == flags->suspend_stderr) && (count > 0)) {
+		if (pv__tty_frame_length + count > pv__tty_frame_size) {
+			size_t new_size;
+			char *new_frame;
+
+			new_size = 2 * (pv__tty_frame_length + count);
+			new_frame = realloc(pv__tty_frame, new_size);
+			if (NULL == new_frame) {
+				/* Out of memory - write directly instead. */
+				pv__tty_frame_active = false;
+				if (pv__tty_frame_length > 0)
+					pv_tty_write(flags, pv__tty_frame, pv__tty_frame_length);
+				pv__tty_frame_length = 0;
+				pv_tty_write(flags, buf, count);
+				return;
+			}
+			pv__tty_frame = new_frame;
+			pv__tty_frame_size = new_size;
+		}
+		memcpy(pv__tty_frame + pv__tty_frame_length, buf, count);
+		pv__tty_frame_length += count;
+		return;
+	}
+
+	profile_start = pv_profile_begin();
+
 	while (0 == flags->suspend_stderr && count > 0) {
 		ssize_t nwritten;
 
@@ -187,14 +258,105 @@ void pv_tty_write(readonly_pvtransientflags_t flags, const char *buf, size_t cou
 			if ((EINTR == errno) || (EAGAIN == errno)) {
 				continue;
 			}
-			return;
+			break;
 		}
 		if (nwritten < 1)
-			return;
+			break;
 
 		count -= nwritten;
 		buf += nwritten;
 	}
+
+	pv_profile_end(PV_PROFILE_TTY_WRITE, profile_start);
+}
+
+
+/*
+ * Start collecting terminal output into a frame, to be written all at once
+ * by pv_tty_frame_end().
+ */
+void pv_tty_frame_begin(void)
+{
+	pv__tty_frame_length = 0;
+	pv__tty_frame_active = true;
+}
+
+
+/*
+ * Write out the frame collected since pv_tty_frame_begin() in a single
+ * write().  If "synchronised" is true, the frame is a screen update: it is
+ * not written at all if it is exactly the same as the previous one, and
+ * otherwise, if standard error is a terminal, it is wrapped in the
+ * synchronised update mode sequences, so that terminals which support them
+ * show it all at once without flicker; others ignore them.
+ */
+void pv_tty_frame_end(readonly_pvtransientflags_t flags, bool synchronised)
+{
+	char *swap;
+	size_t swap_size;
+
+	if (!pv__tty_frame_active)
+		return;
+	pv__tty_frame_active = false;
+
+	if ((0 == pv__tty_frame_length) || (NULL == pv__tty_frame))
+		return;
+
+	if (synchronised && (pv__tty_frame_length == pv__tty_previous_frame_length)
+	    && (NULL != pv__tty_previous_frame)
+	    && (0 == memcmp(pv__tty_frame, pv__tty_previous_frame, pv__tty_frame_length))) {
+		debug("%s", "frame unchanged - not writing");
+		return;
+	}
+
+	if (synchronised && (0 != isatty(STDERR_FILENO))) {
+		static const char sync_start[] = "\033[?2026h";
+		static const char sync_end[] = "\033[?2026l";
+		char *new_frame;
+
+		new_frame = malloc(pv__tty_frame_length + sizeof(sync_start) + sizeof(sync_end));
+		if (NULL != new_frame) {
+			memcpy(new_frame, sync_start, sizeof(sync_start) - 1);
+			memcpy(new_frame + sizeof(sync_start) - 1, pv__tty_frame, pv__tty_frame_length);
+			memcpy(new_frame + sizeof(sync_start) - 1 + pv__tty_frame_length, sync_end,
+			       sizeof(sync_end) - 1);
+			pv_tty_write(flags, new_frame, pv__tty_frame_length + sizeof(sync_start) + sizeof(sync_end) - 2);
+			free(new_frame);
+		} else {
+			pv_tty_write(flags, pv__tty_frame, pv__tty_frame_length);
+		}
+	} else {
+		pv_tty_write(flags, pv__tty_frame, pv__tty_frame_length);
+	}
+
+	/* Keep this frame to compare the next one with. */
+	swap = pv__tty_previous_frame;
+	swap_size = pv__tty_previous_frame_size;
+	pv__tty_previous_frame = pv__tty_frame;
+	pv__tty_previous_frame_size = pv__tty_frame_size;
+	pv__tty_previous_frame_length = pv__tty_frame_length;
+	pv__tty_frame = swap;
+	pv__tty_frame_size = swap_size;
+	pv__tty_frame_length = 0;
+}
+
+
+/*
+ * Free the frame buffers used by pv_tty_frame_begin().
+ */
+void pv_tty_frame_free(void)
+{
+	pv__tty_frame_active = false;
+	if (NULL != pv__tty_frame)
+		free(pv__tty_frame);
+	pv__tty_frame = NULL;
+	pv__tty_frame_size = 0;
+	pv__tty_frame_length = 0;
+	if (NULL != pv__tty_previous_frame)
+		free(pv__tty_previous_frame);
+	pv__tty_previous_frame = NULL;
+	pv__tty_previous_frame_size = 0;
+	pv__tty_previous_frame_length = 0;
 }
 
 
@@ -247,27 +409,70 @@ long pv_seconds_remaining(const off_t so_far, const off_t total, const long doub
 }
 
 /*
- * Given a long double value, it is divided or multiplied by the ratio until
- * a value in the range 1.0 to 999.999... is found.  The string "prefix" to
- * is updated to the corresponding SI prefix.
- *
- * If the count type is PV_TRANSFERCOUNT_BYTES, then the second byte of
- * "prefix" is set to "i" to denote MiB etc (IEEE1541).  Thus "prefix"
- * should be at least 3 bytes long (to include the terminating null).
+ * Put "seconds" in "buffer" (max length "bufsize") as "H:MM:SS", or if
+ * "with_days" is true, as "D:HH:MM:SS", the same as "%ld:%02ld:%02ld"
+ * would, and return the number of bytes written.  Negative values are
+ * treated as zero.
  */
-void pv_si_prefix(long double *value, char *prefix, const long double ratio, pvtransfercount_t count_type)
+size_t pv_describe_duration(char *buffer, size_t bufsize, long seconds, bool with_days)
+{
+	char digits[32];		 /* flawfinder: ignore - bounded below */
+	char *start;
+	size_t length;
+	long leading;
+
+	if (bufsize < 1)
+		return 0;
+	if (seconds < 0)
+		seconds = 0;
+
+	start = digits + sizeof(digits);
+
+	/* Written backwards, starting with the seconds. */
+	*(--start) = (char) ('0' + (seconds % 10));
+	*(--start) = (char) ('0' + ((seconds / 10) % 6));
+	*(--start) = ':';
+	*(--start) = (char) ('0' + ((seconds / 60) % 10));
+	*(--start) = (char) ('0' + ((seconds / 600) % 6));
+	*(--start) = ':';
+
+	leading = seconds / 3600;
+	if (with_days) {
+		long hours = leading % 24;
+		*(--start) = (char) ('0' + (hours % 10));
+		*(--start) = (char) ('0' + (hours / 10));
+		*(--start) = ':';
+		leading = seconds / 86400;
+	}
+
+	do {
+		*(--start) = (char) ('0' + (leading % 10));
+		leading /= 10;
+	} while (leading > 0);
+
+	length = (size_t) (digits + sizeof(digits) - start);
+	if (length > bufsize - 1)
+		length = bufsize - 1;
+	memcpy(buffer, start, length);	    /* flawfinder: ignore - bounded by bufsize */
+	buffer[length] = '\0';
+
+	return length;
+}
+
+
+/*
+ * Return the list of prefix letters to use for "count_type", setting
+ * *middle to the space in the middle of it, or return NULL and set *middle
+ * to NULL if the list could not be looked up.
+ */
+/*@null@ */ static char *pv__si_prefix_list(pvtransfercount_t count_type, /*@out@ */ char const **middle)
 {
 	static char *pfx_000 = NULL;	 /* kilo, mega, etc */
 	static char *pfx_024 = NULL;	 /* kibi, mibi, etc */
 	static char const *pfx_middle_000 = NULL;
 	static char const *pfx_middle_024 = NULL;
-	char *pfx;
-	char const *pfx_middle;
-	char const *pfx_ptr;
-	long double cutoff;
 
-	prefix[0] = ' ';		    /* Make the prefix start blank. */
-	prefix[1] = '\0';
+	*middle = NULL;
 
 	/*
 	 * The prefix list strings have a space (no prefix) in the middle;
@@ -290,7 +495,7 @@ void pv_si_prefix(long double *value, char *prefix, const long double ratio, pvt
 		/*@+onlytrans@ */
 		if (NULL == pfx_000) {
 			debug("%s", "prefix list was NULL");
-			return;
+			return NULL;
 		}
 		pfx_middle_000 = strchr(pfx_000, ' ');
 	}
@@ -304,19 +509,45 @@ void pv_si_prefix(long double *value, char *prefix, const long double ratio, pvt
 		/*@+onlytrans@ *//* splint: see above. */
 		if (NULL == pfx_024) {
 			debug("%s", "prefix list was NULL");
-			return;
+			return NULL;
 		}
 		pfx_middle_024 = strchr(pfx_024, ' ');
 	}
 
-	pfx = pfx_000;
-	pfx_middle = pfx_middle_000;
 	if (count_type == PV_TRANSFERCOUNT_BYTES) {
 		/* bytes - multiples of 1024 */
-		pfx = pfx_024;
-		pfx_middle = pfx_middle_024;
+		*middle = pfx_middle_024;
+		return pfx_024;
 	}
 
+	*middle = pfx_middle_000;
+	return pfx_000;
+}
+
+
+/*
+ * Given a long double value, it is divided or multiplied by the ratio until
+ * a value in the range 1.0 to 999.999... is found.  The string "prefix" to
+ * is updated to the corresponding SI prefix.
+ *
+ * If the count type is PV_TRANSFERCOUNT_BYTES, then the second byte of
+ * "prefix" is set to "i" to denote MiB etc (IEEE1541).  Thus "prefix"
+ * should be at least 3 bytes long (to include the terminating null).
+ */
+void pv_si_prefix(long double *value, char *prefix, const long double ratio, pvtransfercount_t count_type)
+{
+	char *pfx;
+	char const *pfx_middle;
+	char const *pfx_ptr;
+	long double cutoff;
+
+	prefix[0] = ' ';		    /* Make the prefix start blank. */
+	prefix[1] = '\0';
+
+	pfx = pv__si_prefix_list(count_type, &pfx_middle);
+	if (NULL == pfx)
+		return;
+
 	pfx_ptr = pfx_middle;
 	if (NULL == pfx_ptr) {
 		debug("%s", "prefix middle was NULL");
@@ -402,6 +633,222 @@ void pv_si_prefix(long double *value, char *prefix, const long double ratio, pvt
 }
 
 
+/*
+ * Powers of 1000 and 1024, read by pv__describe_amount_fixed() in
+ * place of repeated floating-point division.
+ */
+#define PV_DESCRIBE_POWERS	6
+static const uint64_t pv__describe_power_000[PV_DESCRIBE_POWERS] = {
+	1ULL, 1000ULL, 1000000ULL, 1000000000ULL, 1000000000000ULL, 1000000000000000ULL
+};
+static const uint64_t pv__describe_power_024[PV_DESCRIBE_POWERS] = {
+	1ULL, 1ULL << 10, 1ULL << 20, 1ULL << 30, 1ULL << 40, 1ULL << 50
+};
+
+/*
+ * Amounts below this are described in fixed point with this many bits
+ * after the point, and amounts from there up to the limit as whole
+ * numbers.  Either way, the largest divisor needed is below 2^51, so 100
+ * times it, or 100 times a remainder of it, fits in 64 bits.
+ */
+#define PV_DESCRIBE_FRACTION_LIMIT	137438953472.0L	/* 2^37 */
+#define PV_DESCRIBE_FRACTION_BITS	20
+#define PV_DESCRIBE_LIMIT		144115188075855872.0L	/* 2^57 */
+
+
+/*
+ * Write the digits of "value" backwards, ending just before "end", and
+ * return a pointer to the first of them.
+ */
+static char *pv__describe_digits(char *end, unsigned long value)
+{
+	do {
+		*(--end) = (char) ('0' + (value % 10));
+		value /= 10;
+	} while (value > 0);
+	return end;
+}
+
+
+/*
+ * Write the number and prefix step for "fixed", a fixed-point amount with
+ * "shift" bits after the point, into "number" (at least 8 bytes), as
+ * pv_si_prefix() and pv_describe_amount() would, returning the prefix
+ * step - 0 for none, 1 for kilo, and so on - or -1 if it cannot be worked
+ * out the same way here.
+ *
+ * The prefix is chosen as pv_si_prefix() chooses it - moving up past 970
+ * for 1000, or 993.28 for 1024, then back one step if that leaves less
+ * than 1 - and the number is printed as "%4ld" truncates it above 99.9,
+ * or as "%#4.3Lg" rounds it below.  That rounds an exact half to even,
+ * which is only reproduced here when the divisor is a power of two; with
+ * a power of 1000, the floating-point quotient it would have rounded is
+ * not quite a half, so -1 is returned instead.
+ */
+static int pv__describe_fixed_number(char *number, uint64_t fixed, unsigned int shift, pvtransfercount_t count_type,
+				     char const *pfx_middle)
+{
+	const uint64_t *power;
+	char *number_end;
+	char *number_start;
+	uint64_t divisor, whole, remainder;
+	unsigned int step, cut_whole, cut_numerator, cut_denominator;
+
+	/* Cut-off for moving to the next prefix, as whole + numerator/denominator. */
+	if (count_type == PV_TRANSFERCOUNT_BYTES) {
+		power = pv__describe_power_024;
+		cut_whole = 993;
+		cut_numerator = 7;
+		cut_denominator = 25;
+	} else {
+		power = pv__describe_power_000;
+		cut_whole = 970;
+		cut_numerator = 0;
+		cut_denominator = 1;
+	}
+
+	step = 0;
+	divisor = power[0] << shift;
+	whole = fixed / divisor;
+	remainder = fixed % divisor;
+
+	while ((whole > cut_whole)
+	       || ((whole == cut_whole) && (remainder * cut_denominator > cut_numerator * divisor))) {
+		if ((step + 1 >= PV_DESCRIBE_POWERS) || ('\0' == pfx_middle[step + 1]))
+			break;
+		step++;
+		divisor = power[step] << shift;
+		whole = fixed / divisor;
+		remainder = fixed % divisor;
+	}
+
+	if ((step > 0) && (0 == whole)) {
+		step--;
+		divisor = power[step] << shift;
+		whole = fixed / divisor;
+		remainder = fixed % divisor;
+	}
+
+	number_end = number + 7;
+	*number_end = '\0';
+	number_start = number_end;
+
+	if ((whole > 99) || ((whole == 99) && (remainder * 10 > 9 * divisor))) {
+		/* Above 99.9 - the whole number, truncated. */
+		number_start = pv__describe_digits(number_start, (unsigned long) whole);
+	} else {
+		uint64_t scale, scaled, scaled_remainder;
+
+		/* Three significant figures, so two decimals below 10. */
+		scale = (whole < 10) ? 100 : 10;
+		scaled = whole * scale + (remainder * scale) / divisor;
+		scaled_remainder = (remainder * scale) % divisor;
+		if (scaled_remainder * 2 == divisor) {
+			if ((count_type != PV_TRANSFERCOUNT_BYTES) && (step > 0))
+				return -1;
+			if (1 == (scaled & 1))
+				scaled++;
+		} else if (scaled_remainder * 2 > divisor) {
+			scaled++;
+		}
+
+		/* 9.995 and up rounds to 10.0, not 10.00. */
+		if ((100 == scale) && (scaled >= 1000)) {
+			scale = 10;
+			scaled = scaled / 10;
+		}
+
+		*(--number_start) = (char) ('0' + (scaled % 10));
+		if (100 == scale) {
+			*(--number_start) = (char) ('0' + ((scaled / 10) % 10));
+			scaled /= 10;
+		}
+		*(--number_start) = '.';
+		number_start = pv__describe_digits(number_start, (unsigned long) (scaled / 10));
+	}
+
+	/* Pad to 4 characters, as "%4" would. */
+	while (number_end - number_start < 4)
+		*(--number_start) = ' ';
+
+	if (number_start != number)
+		memmove(number, number_start, (size_t) (number_end - number_start) + 1);
+
+	return (int) step;
+}
+
+
+/*
+ * Write the same text into "sizestr" (which must have room for at least
+ * 32 bytes) as pv_describe_amount() would, using only integer arithmetic,
+ * and return true; or return false, to leave it to pv_describe_amount(),
+ * if "amount" is negative, a fraction, or too large, or if the answer
+ * would not be the same.
+ *
+ * When converting "amount" to fixed point drops some of its fraction, the
+ * number is worked out for both ends of the range it could be in, and
+ * only used if they agree.
+ */
+static bool pv__describe_amount_fixed(char *sizestr, long double amount, const char *suffix,
+				      pvtransfercount_t count_type)
+{
+	char const *pfx_middle;
+	char number[8];			 /* flawfinder: ignore - see pv__describe_fixed_number() */
+	long double scaled_amount;
+	uint64_t fixed;
+	unsigned int shift;
+	int step;
+	size_t offset, suffix_length;
+
+	if ((amount != 0.0L) && ((!(amount >= 1.0L)) || (amount >= PV_DESCRIBE_LIMIT)))
+		return false;
+
+	if (NULL == pv__si_prefix_list(count_type, &pfx_middle))
+		return false;
+	if (NULL == pfx_middle)
+		return false;
+
+	shift = 0;
+	scaled_amount = amount;
+	if (amount < PV_DESCRIBE_FRACTION_LIMIT) {
+		shift = PV_DESCRIBE_FRACTION_BITS;
+		scaled_amount = amount * (long double) (1ULL << PV_DESCRIBE_FRACTION_BITS);
+	}
+	fixed = (uint64_t) scaled_amount;
+
+	step = pv__describe_fixed_number(number, fixed, shift, count_type, pfx_middle);
+	if (step < 0)
+		return false;
+
+	if ((long double) fixed != scaled_amount) {
+		char upper[8];		 /* flawfinder: ignore - as above */
+		if (pv__describe_fixed_number(upper, fixed + 1, shift, count_type, pfx_middle) != step)
+			return false;
+		if (0 != strcmp(number, upper))
+			return false;
+	}
+
+	offset = strlen(number);	    /* flawfinder: ignore - terminated by pv__describe_fixed_number() */
+	memcpy(sizestr, number, offset);	/* flawfinder: ignore - at most 7 of the 32 bytes */
+
+	/* The prefix - "Ki" and so on for bytes, or a single letter. */
+	if (count_type == PV_TRANSFERCOUNT_BYTES) {
+		sizestr[offset++] = (0 == step) ? ' ' : pfx_middle[step];
+		sizestr[offset++] = (0 == step) ? ' ' : 'i';
+	} else {
+		sizestr[offset++] = pfx_middle[step];
+	}
+
+	suffix_length = strlen(suffix);	    /* flawfinder: ignore - caller's string is terminated */
+	if (suffix_length > 16)
+		suffix_length = 16;
+	memcpy(sizestr + offset, suffix, suffix_length);	/* flawfinder: ignore - 7 + 2 + 16 < 32 */
+	sizestr[offset + suffix_length] = '\0';
+
+	return true;
+}
+
+
 /*
  * Put a string in "buffer" (max length "bufsize") containing "amount"
  * formatted such that it's 3 or 4 digits followed by an SI suffix and then
@@ -431,11 +878,6 @@ void pv_describe_amount(char *buffer, size_t bufsize, char *format,
 	 * needs 3 bytes.
 	 */
 
-	memset(sizestr_buffer, 0, sizeof(sizestr_buffer));
-	memset(si_prefix, 0, sizeof(si_prefix));
-
-	(void) pv_snprintf(si_prefix, sizeof(si_prefix), "%s", "  ");
-
 	if (count_type == PV_TRANSFERCOUNT_BYTES) {
 		suffix = suffix_bytes;
 		divider = 1024.0;
@@ -447,6 +889,37 @@ void pv_describe_amount(char *buffer, size_t bufsize, char *format,
 		divider = 1000.0;
 	}
 
+	/*
+	 * Most amounts are described without floating point or format
+	 * parsing, and put straight into the caller's format if it is plain
+	 * enough.
+	 */
+	if (pv__describe_amount_fixed(sizestr_buffer, amount, suffix, count_type)) {
+		const char *placeholder = strchr(format, '%');
+
+		if ((NULL != placeholder) && ('s' == placeholder[1]) && (NULL == strchr(placeholder + 2, '%'))) {
+			size_t before = (size_t) (placeholder - format);
+
+			if (bufsize < 1)
+				return;
+			buffer[0] = '\0';
+			if (before >= bufsize)
+				before = bufsize - 1;
+			memcpy(buffer, format, before);	/* flawfinder: ignore - bounded by bufsize */
+			buffer[before] = '\0';
+			(void) pv_strlcat(buffer, sizestr_buffer, bufsize);
+			(void) pv_strlcat(buffer, placeholder + 2, bufsize);
+		} else {
+			(void) pv_snprintf(buffer, bufsize, format, sizestr_buffer);
+		}
+		return;
+	}
+
+	memset(sizestr_buffer, 0, sizeof(sizestr_buffer));
+	memset(si_prefix, 0, sizeof(si_prefix));
+
+	(void) pv_snprintf(si_prefix, sizeof(si_prefix), "%s", "  ");
+
 	display_amount = amount;
 
 	pv_si_prefix(&display_amount, si_prefix, divider, count_type);
@@ -506,6 +979,78 @@ pvdisplay_bytecount_t pv_formatter_segmentcontent(char *content, pvformatter_arg
 }
 
 
+/*
+ * Store "bytes" bytes of "content" as the segment's fixed content, to be
+ * copied by pv_formatter_precomputed() on every update instead of being
+ * worked out each time, along with a formatter-specific "effect" value.
+ * This is for formatters whose output depends only on the format string,
+ * and is called when the format is parsed.
+ *
+ * Returns false if the content could not be stored, in which case the
+ * formatter must carry on working it out each time.
+ */
+bool pv_formatter_precompute(pvformatter_args_t formatter_info, const char *content, pvdisplay_bytecount_t bytes,
+			     int8_t effect)
+{
+	pvdisplay_t display = formatter_info->display;
+
+	if (display->precomputed_length + bytes > PVDISPLAY_BYTECOUNT_MAX)
+		return false;
+
+	if (display->precomputed_length + bytes > display->precomputed_size) {
+		size_t new_size;
+		char *new_buffer;
+
+		new_size = display->precomputed_size + bytes + 256;
+		new_buffer = realloc(display->precomputed, new_size);
+		if (NULL == new_buffer)
+			return false;
+		display->precomputed = new_buffer;
+		display->precomputed_size = new_size;
+	}
+
+	if (bytes > 0)
+		memcpy(display->precomputed + display->precomputed_length, content, bytes);
+
+	formatter_info->segment->precomputed_offset = (pvdisplay_bytecount_t) (display->precomputed_length);
+	formatter_info->segment->precomputed_bytes = bytes;
+	formatter_info->segment->precomputed_effect = effect;
+	formatter_info->segment->precomputed_valid = true;
+
+	display->precomputed_length += bytes;
+
+	return true;
+}
+
+
+/*
+ * Add the segment's fixed content, stored by pv_formatter_precompute(),
+ * to the buffer, in the same way as pv_formatter_segmentcontent().
+ */
+pvdisplay_bytecount_t pv_formatter_precomputed(pvformatter_args_t formatter_info)
+{
+	pvdisplay_bytecount_t bytes;
+
+	bytes = formatter_info->segment->precomputed_bytes;
+
+	if ((NULL == formatter_info->display->precomputed) || (formatter_info->offset >= formatter_info->buffer_size))
+		bytes = 0;
+	if ((formatter_info->offset + bytes) >= formatter_info->buffer_size)
+		bytes = 0;
+
+	formatter_info->segment->offset = formatter_info->offset;
+	formatter_info->segment->bytes = bytes;
+
+	if (0 == bytes)
+		return 0;
+
+	memcpy(formatter_info->buffer + formatter_info->offset,
+	       formatter_info->display->precomputed + formatter_info->segment->precomputed_offset, bytes);
+
+	return bytes;
+}
+
+
 /*
  * Format sequence lookup table.
  */
@@ -541,6 +1086,10 @@ pvdisplay_bytecount_t pv_formatter_segmentcontent(char *content, pvformatter_arg
 		{ "{previous-line}", &pv_formatter_previous_line, true },
 		{ "N", &pv_formatter_name, false },
 		{ "{name}", &pv_formatter_name, false },
+		{ "{outputs}", &pv_formatter_outputs, false },
+		{ "{raw-rate}", &pv_formatter_raw_rate, false },
+		{ "{compressed-rate}", &pv_formatter_compressed_rate, false },
+		{ "{ratio}", &pv_formatter_ratio, false },
 		{ "{sgr:colour,...}", &pv_formatter_sgr, false },
 		{ NULL, NULL, false }
 	};
@@ -588,47 +1137,51 @@ char *pv_format_sequences(void)
 
 
 /*
- * Initialise the output format structure, based on the current options.
+ * A format string compiled into the segments that pv__format_init() gives
+ * to a display: the component type and size prefix of each placeholder,
+ * and where each static string is in the format string along with its
+ * precomputed width.  String parameters are kept as offsets, so that a
+ * compiled format can be used with any copy of the same string.
  *
- * May update status->checked_colour_support and
- * status->terminal_supports_colour.
+ * Compiled formats are cached by content in the program status, so that
+ * re-initialising a display - after a terminal resize, a remote control
+ * update, or for each fd with --watchfd - only has to copy the segments
+ * across, and the main and extra displays share one compiled copy when
+ * their formats are the same.
  */
-static void pv__format_init(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_pvtransferstate_t transfer,
-			    readonly_pvtransfercalc_t calc,
-			    /*@null@ */ const char *format_supplied, pvdisplay_t display)
+struct pvformatprogram_s {
+	/*@only@ */ /*@null@ */ char *source;	/* format string that was compiled */
+	size_t segment_count;		 /* number of segments */
+	struct {
+		size_t parameter_offset;	/* start of string parameter, or 0 if none */
+		pvdisplay_bytecount_t parameter_bytes;	/* length of string parameter */
+		pvdisplay_bytecount_t offset;	/* start of static string in the format */
+		pvdisplay_bytecount_t bytes;	/* length of static string */
+		pvdisplay_width_t width;	/* displayed width of static string */
+		pvdisplay_width_t chosen_size;	/* "n" from %<n>A, or 0 */
+		pvdisplay_component_t type;	/* component type, -1 for static string */
+	} segment[PV_FORMAT_ARRAY_MAX];
+};
+
+struct pvformatcache_s {
+	struct pvformatprogram_s program[PV_FORMAT_CACHE_SLOTS];
+	unsigned int next_evict;	 /* slot to reuse when all are full */
+};
+
+
+/*
+ * Compile the format string "display_format" into "program", ignoring
+ * program->source.
+ */
+static void pv__format_compile(const char *display_format, struct pvformatprogram_s *program)
 {
 	struct pvdisplay_component_s *format_component_array;
-	const char *display_format;
 	size_t strpos;
 	size_t segment;
 
-	if (NULL == status)
-		return;
-	if (NULL == control)
-		return;
-	if (NULL == transfer)
-		return;
-	if (NULL == calc)
-		return;
-	if (NULL == display)
-		return;
-
 	format_component_array = pv__format_components();
 
-	display->format_segment_count = 0;
-	memset(display->format, 0, PV_FORMAT_ARRAY_MAX * sizeof(display->format[0]));
-
-	display->showing_timer = false;
-	display->showing_bytes = false;
-	display->showing_rate = false;
-	display->showing_last_written = false;
-	display->showing_previous_line = false;
-	display->format_uses_colour = false;
-
-	display_format = NULL == format_supplied ? control->default_format : format_supplied;
-
-	if (NULL == display_format)
-		return;
+	program->segment_count = 0;
 
 	/*
 	 * Split the format string into static strings and calculated
@@ -654,8 +1207,9 @@ static void pv__format_init(pvprogramstatus_t status, readonly_pvcontrol_t contr
 	for (strpos = 0; display_format[strpos] != '\0' && segment < PV_FORMAT_ARRAY_MAX; strpos++, segment++) {
 		pvdisplay_component_t component_type, component_idx;
 		size_t str_start, str_bytes, chosen_size;
-		const char *string_parameter = NULL;
+		size_t parameter_offset = 0;
 		size_t string_parameter_bytes = 0;
+		size_t slot;
 
 		str_start = strpos;
 		str_bytes = 0;
@@ -735,8 +1289,7 @@ static void pv__format_init(pvprogramstatus_t status, readonly_pvcontrol_t contr
 							&(display_format[sequence_start]), sequence_colon_offset))
 					    ) {
 						component_type = component_idx;
-						string_parameter =
-						    &(display_format[sequence_start + sequence_colon_offset]);
+						parameter_offset = sequence_start + sequence_colon_offset;
 						string_parameter_bytes = sequence_length - sequence_colon_offset;
 						if (string_parameter_bytes > 0)
 							string_parameter_bytes--;	/* the closing '}' */
@@ -789,66 +1342,207 @@ static void pv__format_init(pvprogramstatus_t status, readonly_pvcontrol_t contr
 		if (chosen_size > PVDISPLAY_WIDTH_MAX)
 			chosen_size = PVDISPLAY_WIDTH_MAX;
 
-		display->format[segment].type = component_type;
-		display->format[segment].chosen_size = chosen_size;
-		display->format[segment].string_parameter = string_parameter;
-		display->format[segment].string_parameter_bytes = string_parameter_bytes;
+		if ((-1 == component_type) && (0 == str_bytes))
+			continue;
 
-		if (-1 == component_type) {
-			if (0 == str_bytes)
-				continue;
+		slot = program->segment_count;
 
-			display->format[segment].offset = str_start;
-			display->format[segment].bytes = str_bytes;
-			display->format[segment].width = pv_strwidth(&(display_format[str_start]), str_bytes);
+		program->segment[slot].type = component_type;
+		program->segment[slot].chosen_size = chosen_size;
+		program->segment[slot].parameter_offset = parameter_offset;
+		program->segment[slot].parameter_bytes = string_parameter_bytes;
+		program->segment[slot].offset = 0;
+		program->segment[slot].bytes = 0;
+		program->segment[slot].width = 0;
 
-			debug("format[%d]:[%.*s], length=%d, width=%d", segment, str_bytes, display_format + str_start,
-			      str_bytes, display->format[segment].width);
+		if (-1 == component_type) {
+			program->segment[slot].offset = str_start;
+			program->segment[slot].bytes = str_bytes;
+			program->segment[slot].width = pv_strwidth(&(display_format[str_start]), str_bytes);
 
-		} else {
-			char dummy_buffer[4];	/* flawfinder: ignore - unused. */
-			struct pvformatter_args_s formatter_info;
+			debug("format[%d]:[%.*s], length=%d, width=%d", slot, str_bytes, display_format + str_start,
+			      str_bytes, program->segment[slot].width);
+		}
 
-			display->format[segment].offset = 0;
-			display->format[segment].bytes = 0;
+		program->segment_count++;
+	}
+}
 
-			/*
-			 * Run the formatter function with a zero-sized
-			 * buffer, to invoke its side effects such as
-			 * setting display->showing_timer.
-			 *
-			 * These side effects are required for other parts
-			 * of the program to understand what is required,
-			 * such as the transfer functions knowning to track
-			 * the previous line, or numeric mode knowing which
-			 * additional display options are enabled.
-			 */
-			memset(&formatter_info, 0, sizeof(formatter_info));
-			dummy_buffer[0] = '\0';
-
-			formatter_info.display = display;
-			formatter_info.segment = &(display->format[segment]);
-			formatter_info.status = status;
-			formatter_info.control = control;
-			formatter_info.transfer = transfer;
-			formatter_info.calc = calc;
-			formatter_info.buffer = dummy_buffer;
-			formatter_info.buffer_size = 0;
-			formatter_info.offset = 0;
-
-			/*@-compmempass@ */
-			(void) format_component_array[component_type].function(&formatter_info);
-			/*@+compmempass@ */
-			/*
-			 * splint - the buffer we point formatter_info to is
-			 * on the stack so doesn't match the "dependent"
-			 * annotation, but there's no other appropriate
-			 * annotation that doesn't make splint think there's
-			 * a leak here.
-			 */
+
+/*
+ * Return the compiled form of "display_format", from the cache if it has
+ * been compiled before.  If there is no cache and one can't be allocated,
+ * the format is compiled into "fallback" instead.
+ */
+/*@dependent@ */ static struct pvformatprogram_s *pv__format_program(pvprogramstatus_t status,
+									  const char *display_format,
+									  struct pvformatprogram_s *fallback)
+{
+	struct pvformatcache_s *cache;
+	struct pvformatprogram_s *program;
+	unsigned int slot;
+
+	if (NULL == status->format_cache) {
+		status->format_cache = calloc(1, sizeof(*(status->format_cache)));
+		if (NULL == status->format_cache) {
+			debug("%s: %s", "format cache allocation failed", strerror(errno));
+			pv__format_compile(display_format, fallback);
+			return fallback;
 		}
+	}
+	cache = status->format_cache;
+
+	for (slot = 0; slot < PV_FORMAT_CACHE_SLOTS; slot++) {
+		program = &(cache->program[slot]);
+		if ((NULL != program->source) && (0 == strcmp(program->source, display_format)))
+			return program;
+	}
+
+	for (slot = 0; slot < PV_FORMAT_CACHE_SLOTS; slot++) {
+		if (NULL == cache->program[slot].source)
+			break;
+	}
+	if (slot >= PV_FORMAT_CACHE_SLOTS) {
+		slot = cache->next_evict;
+		cache->next_evict = (cache->next_evict + 1) % PV_FORMAT_CACHE_SLOTS;
+		free(cache->program[slot].source);
+		cache->program[slot].source = NULL;
+	}
+
+	program = &(cache->program[slot]);
+	pv__format_compile(display_format, program);
+
+	/* If the copy fails, the program is still usable, but not cached. */
+	program->source = pv_strdup(display_format);
+
+	return program;
+}
+
+
+/*
+ * Free the cache of compiled format strings.
+ */
+void pv_format_cache_free(pvprogramstatus_t status)
+{
+	unsigned int slot;
+
+	if ((NULL == status) || (NULL == status->format_cache))
+		return;
+
+	for (slot = 0; slot < PV_FORMAT_CACHE_SLOTS; slot++) {
+		if (NULL != status->format_cache->program[slot].source)
+			free(status->format_cache->program[slot].source);
+	}
+
+	free(status->format_cache);
+	status->format_cache = NULL;
+}
+
+
+/*
+ * Initialise the output format structure, based on the current options.
+ *
+ * May update status->checked_colour_support and
+ * status->terminal_supports_colour.
+ */
+static void pv__format_init(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_pvtransferstate_t transfer,
+			    readonly_pvtransfercalc_t calc,
+			    /*@null@ */ const char *format_supplied, pvdisplay_t display)
+{
+	struct pvdisplay_component_s *format_component_array;
+	struct pvformatprogram_s fallback_program;
+	struct pvformatprogram_s *program;
+	const char *display_format;
+	size_t segment;
+
+	if (NULL == status)
+		return;
+	if (NULL == control)
+		return;
+	if (NULL == transfer)
+		return;
+	if (NULL == calc)
+		return;
+	if (NULL == display)
+		return;
+
+	format_component_array = pv__format_components();
+
+	display->format_segment_count = 0;
+	memset(display->format, 0, PV_FORMAT_ARRAY_MAX * sizeof(display->format[0]));
+	display->precomputed_length = 0;
+
+	display->showing_timer = false;
+	display->showing_bytes = false;
+	display->showing_rate = false;
+	display->showing_last_written = false;
+	display->showing_previous_line = false;
+	display->format_uses_colour = false;
+
+	display_format = NULL == format_supplied ? control->default_format : format_supplied;
+
+	if (NULL == display_format)
+		return;
+
+	fallback_program.source = NULL;
+	program = pv__format_program(status, display_format, &fallback_program);
+
+	for (segment = 0; segment < program->segment_count; segment++) {
+		char dummy_buffer[4];	/* flawfinder: ignore - unused. */
+		struct pvformatter_args_s formatter_info;
+		pvdisplay_segment_t display_segment;
+
+		display_segment = &(display->format[segment]);
+
+		display_segment->type = program->segment[segment].type;
+		display_segment->chosen_size = program->segment[segment].chosen_size;
+		display_segment->offset = program->segment[segment].offset;
+		display_segment->bytes = program->segment[segment].bytes;
+		display_segment->width = program->segment[segment].width;
+		display_segment->string_parameter = NULL;
+		display_segment->string_parameter_bytes = program->segment[segment].parameter_bytes;
+		if (0 != program->segment[segment].parameter_offset)
+			display_segment->string_parameter =
+			    &(display_format[program->segment[segment].parameter_offset]);
 
 		display->format_segment_count++;
+
+		if (-1 == display_segment->type)
+			continue;
+
+		/*
+		 * Run the formatter function with a zero-sized buffer, to
+		 * invoke its side effects such as setting
+		 * display->showing_timer.
+		 *
+		 * These side effects are required for other parts of the
+		 * program to understand what is required, such as the
+		 * transfer functions knowning to track the previous line,
+		 * or numeric mode knowing which additional display options
+		 * are enabled.
+		 */
+		memset(&formatter_info, 0, sizeof(formatter_info));
+		dummy_buffer[0] = '\0';
+
+		formatter_info.display = display;
+		formatter_info.segment = display_segment;
+		formatter_info.status = status;
+		formatter_info.control = control;
+		formatter_info.transfer = transfer;
+		formatter_info.calc = calc;
+		formatter_info.buffer = dummy_buffer;
+		formatter_info.buffer_size = 0;
+		formatter_info.offset = 0;
+
+		/*@-compmempass@ */
+		(void) format_component_array[display_segment->type].function(&formatter_info);
+		/*@+compmempass@ */
+		/*
+		 * splint - the buffer we point formatter_info to is on the
+		 * stack so doesn't match the "dependent" annotation, but
+		 * there's no other appropriate annotation that doesn't make
+		 * splint think there's a leak here.
+		 */
 	}
 
 	if (display->format_uses_colour && !status->checked_colour_support) {
@@ -948,6 +1642,35 @@ static void pv__format_init(pvprogramstatus_t status, readonly_pvcontrol_t contr
 }
 
 
+/*
+ * Return the display width of the "bytes" bytes of "content" just put in
+ * "segment" by its formatter.  The content a segment's width was last
+ * measured for is kept with it, so that a segment showing the same thing
+ * as last time - which most do, most of the time - is not measured again.
+ */
+static pvdisplay_width_t pv__segment_width(pvdisplay_segment_t segment, const char *content, size_t bytes)
+{
+	size_t width;
+
+	if ((bytes == (size_t) (segment->width_key_bytes))
+	    && (0 == memcmp(segment->width_key, content, bytes)))
+		return segment->width_key_width;
+
+	width = pv_strwidth(content, bytes);
+	if (width > PVDISPLAY_WIDTH_MAX)
+		width = PVDISPLAY_WIDTH_MAX;
+
+	segment->width_key_bytes = 0;
+	if (bytes <= PV_SIZEOF_WIDTH_KEY) {
+		memcpy(segment->width_key, content, bytes);	/* flawfinder: ignore - bounded by the check */
+		segment->width_key_bytes = (pvdisplay_bytecount_t) bytes;
+		segment->width_key_width = (pvdisplay_width_t) width;
+	}
+
+	return (pvdisplay_width_t) width;
+}
+
+
 /*
  * Update display->display_buffer with status information formatted
  * according to the state held within the given structures.
@@ -1011,9 +1734,14 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 	/* Populate the display's "final" flag, for formatters. */
 	display->final_update = final;
 
-	/* Reinitialise if we were asked to. */
-	if (reinitialise)
+	/*
+	 * Reinitialise if we were asked to.  The terminal may have been
+	 * resized or redrawn, so the next update has to be a full one.
+	 */
+	if (reinitialise) {
 		pv__format_init(status, control, transfer, calc, format_supplied, display);
+		display->rendered_valid = false;
+	}
 
 	/* The format string is needed for the static segments. */
 	display_format = NULL == format_supplied ? control->default_format : format_supplied;
@@ -1105,7 +1833,7 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 
 		segment->width = 0;
 		if (bytes_added > 0) {
-			segment->width = pv_strwidth(&(display_segments[formatter_info.offset]), bytes_added);
+			segment->width = pv__segment_width(segment, &(display_segments[formatter_info.offset]), bytes_added);
 		}
 
 		formatter_info.offset += bytes_added;
@@ -1176,6 +1904,9 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 		const char *content_buffer = display_format;
 
 		segment = &(display->format[segment_idx]);
+		segment->line_offset = (pvdisplay_bytecount_t) display_buffer_offset;
+		segment->line_bytes = 0;
+		segment->line_column = (pvdisplay_width_t) new_display_string_width;
 		if (0 == segment->bytes)
 			continue;
 		if (segment->bytes > display_buffer_remaining)
@@ -1191,6 +1922,7 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 			segment->bytes);
 		display_buffer_offset += segment->bytes;
 		display_buffer_remaining -= segment->bytes;
+		segment->line_bytes = segment->bytes;
 
 		new_display_string_bytes += segment->bytes;
 		new_display_string_width += segment->width;
@@ -1199,6 +1931,10 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 		      segment->bytes, display->display_buffer + display_buffer_offset - segment->bytes);
 	}
 
+	/* Anything after this point is trailing padding. */
+	display->padding_offset = (pvdisplay_bytecount_t) display_buffer_offset;
+	display->padding_column = (pvdisplay_width_t) new_display_string_width;
+
 	/* If the SGR active codes flag is set, we need to emit an SGR reset. */
 	if (display->sgr_code_active) {
 		debug("%s", "SGR codes still active - adding reset");
@@ -1243,6 +1979,195 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 }
 
 
+/*
+ * Return true if slot "idx" of the display has changed since the line in
+ * display->rendered_line was written, where the slots are the format
+ * segments followed by the trailing padding.
+ */
+static bool pv__display_slot_changed(readonly_pvdisplay_t display, size_t idx)
+{
+	const struct pvdisplay_rendered_segment_s *old_slot;
+	pvdisplay_bytecount_t offset, bytes;
+	pvdisplay_width_t column;
+
+	if (idx < display->format_segment_count) {
+		offset = display->format[idx].line_offset;
+		bytes = display->format[idx].line_bytes;
+		column = display->format[idx].line_column;
+	} else {
+		offset = display->padding_offset;
+		bytes = (pvdisplay_bytecount_t) (display->display_string_bytes - display->padding_offset);
+		column = display->padding_column;
+	}
+
+	old_slot = &(display->rendered_segment[idx]);
+	if ((column != old_slot->column) || (bytes != old_slot->bytes))
+		return true;
+	if (NULL == display->rendered_line || NULL == display->display_buffer)
+		return true;
+
+	return 0 != memcmp(display->display_buffer + offset, display->rendered_line + old_slot->offset, bytes);
+}
+
+
+/*
+ * Work out what has to be written to turn the line last written to the
+ * terminal into the one now in the display buffer, and remember the new
+ * line for next time.
+ *
+ * Only the segments whose content or position has changed are written,
+ * each run of them preceded by a carriage return and a cursor-forward
+ * sequence to reach its column; short unchanged gaps between runs are
+ * rewritten rather than skipped.  The result goes in display->render_buffer
+ * (\0-terminated, and possibly empty), with its length in
+ * display->render_bytes.
+ *
+ * Returns false if the whole line should be written instead - the first
+ * time, after the format or screen width changed, on the final update,
+ * every PV_DISPLAY_REDRAW_EVERY updates in case something else wrote to
+ * the terminal, when standard error is not a terminal (a log file or pipe
+ * reader has no cursor to move), when colour is in use (skipping an SGR segment would leave
+ * the wrong attributes active), or when the changes would be no shorter
+ * than the line.
+ */
+static bool pv__display_render_changes(pvdisplay_t display, bool final)
+{
+	size_t slot_count, idx, render_size;
+	bool partial;
+
+	if (NULL == display->display_buffer)
+		return false;
+
+	/* Room for every slot's bytes plus a cursor movement for each. */
+	render_size = (size_t) (display->display_buffer_size) + (12 * (PV_FORMAT_ARRAY_MAX + 1)) + 1;
+
+	if (display->rendered_buffer_size < display->display_buffer_size) {
+		char *new_line, *new_render;
+
+		new_line = realloc(display->rendered_line, display->display_buffer_size);
+		if (NULL != new_line)
+			display->rendered_line = new_line;
+		new_render = realloc(display->render_buffer, render_size);
+		if (NULL != new_render)
+			display->render_buffer = new_render;
+		if ((NULL == new_line) || (NULL == new_render)) {
+			display->rendered_buffer_size = 0;
+			display->rendered_valid = false;
+			return false;
+		}
+		display->rendered_buffer_size = display->display_buffer_size;
+		display->rendered_valid = false;
+		display->render_to_tty = (0 != isatty(STDERR_FILENO));
+	}
+
+	if ((NULL == display->rendered_line) || (NULL == display->render_buffer))
+		return false;
+
+	slot_count = display->format_segment_count + 1;
+
+	partial = display->rendered_valid && display->render_to_tty && (!final) && (!display->format_uses_colour)
+	    && (display->rendered_segment_count == display->format_segment_count)
+	    && (display->partial_updates < PV_DISPLAY_REDRAW_EVERY);
+
+	display->render_bytes = 0;
+	display->render_buffer[0] = '\0';
+
+	idx = 0;
+	while (partial && (idx < slot_count)) {
+		size_t run_end, look, gap, start_offset, end_offset;
+		pvdisplay_width_t column;
+		char move[16];		 /* flawfinder: ignore - bounded by pv_snprintf() */
+
+		if (!pv__display_slot_changed(display, idx)) {
+			idx++;
+			continue;
+		}
+
+		/*
+		 * Extend the run over following changed slots, and over
+		 * short unchanged gaps which are cheaper to rewrite than to
+		 * move the cursor past.
+		 */
+		run_end = idx + 1;
+		while (run_end < slot_count) {
+			if (pv__display_slot_changed(display, run_end)) {
+				run_end++;
+				continue;
+			}
+			gap = 0;
+			for (look = run_end; (look < slot_count) && (gap <= PV_DISPLAY_RENDER_GAP); look++) {
+				if (pv__display_slot_changed(display, look))
+					break;
+				gap += look < display->format_segment_count ? display->format[look].line_bytes : 0;
+			}
+			if ((look >= slot_count) || (gap > PV_DISPLAY_RENDER_GAP))
+				break;
+			run_end = look + 1;
+		}
+
+		if (idx < display->format_segment_count) {
+			start_offset = display->format[idx].line_offset;
+			column = display->format[idx].line_column;
+		} else {
+			start_offset = display->padding_offset;
+			column = display->padding_column;
+		}
+		if (run_end - 1 < display->format_segment_count) {
+			end_offset =
+			    (size_t) (display->format[run_end - 1].line_offset) + display->format[run_end - 1].line_bytes;
+		} else {
+			end_offset = display->display_string_bytes;
+		}
+
+		memset(move, 0, sizeof(move));
+		if (column > 0) {
+			(void) pv_snprintf(move, sizeof(move), "\r\033[%uC", (unsigned int) column);
+		} else {
+			move[0] = '\r';
+		}
+
+		(void) pv_strlcat(display->render_buffer, move, render_size);
+		display->render_bytes = strlen(display->render_buffer);	/* flawfinder: ignore */
+		/* flawfinder - render_buffer is always \0-terminated. */
+		if ((end_offset > start_offset) && (display->render_bytes + end_offset - start_offset < render_size)) {
+			memcpy(display->render_buffer + display->render_bytes, display->display_buffer + start_offset,
+			       end_offset - start_offset);
+			display->render_bytes += end_offset - start_offset;
+			display->render_buffer[display->render_bytes] = '\0';
+		}
+
+		idx = run_end;
+	}
+
+	if (partial && (display->render_bytes >= display->display_string_bytes))
+		partial = false;
+
+	if (partial) {
+		display->partial_updates++;
+	} else {
+		display->partial_updates = 0;
+		display->render_bytes = 0;
+		display->render_buffer[0] = '\0';
+	}
+
+	/* Remember what the terminal now shows. */
+	memcpy(display->rendered_line, display->display_buffer, display->display_string_bytes);
+	for (idx = 0; idx < display->format_segment_count; idx++) {
+		display->rendered_segment[idx].offset = display->format[idx].line_offset;
+		display->rendered_segment[idx].bytes = display->format[idx].line_bytes;
+		display->rendered_segment[idx].column = display->format[idx].line_column;
+	}
+	display->rendered_segment[idx].offset = display->padding_offset;
+	display->rendered_segment[idx].bytes =
+	    (pvdisplay_bytecount_t) (display->display_string_bytes - display->padding_offset);
+	display->rendered_segment[idx].column = display->padding_column;
+	display->rendered_segment_count = display->format_segment_count;
+	display->rendered_valid = true;
+
+	return partial;
+}
+
+
 /*
  * Output status information on standard error.
  *
@@ -1254,6 +2179,8 @@ void pv_display(pvprogramstatus_t status, readonly_pvcontrol_t control, pvtransi
 		/*@null@ */ pvdisplay_t extra_display, bool final)
 {
 	bool reinitialise = false;
+	bool formatted, shown;
+	uint64_t profile_start;
 
 	if (NULL == status)
 		return;
@@ -1274,6 +2201,18 @@ void pv_display(pvprogramstatus_t status, readonly_pvcontrol_t control, pvtransi
 
 	pv_calculate_transfer_rate(calc, transfer, control, display, final);
 
+	/*
+	 * If nothing would be written - we're not in the foreground, and not
+	 * forced to write anyway - and there's no process title to set,
+	 * don't format anything at all.  Any pending reparse is left for
+	 * when the display is next shown.
+	 */
+	shown = (control->force || pv_in_foreground()) ? true : false;
+	if ((!shown) && (!control->numeric) && (0 == (PV_DISPLAY_PROCESSTITLE & control->extra_displays))) {
+		display->rendered_valid = false;
+		return;
+	}
+
 	/*
 	 * Enable colour on the main display, and disable it on the extra
 	 * display (process title, window title).
@@ -1291,14 +2230,17 @@ void pv_display(pvprogramstatus_t status, readonly_pvcontrol_t control, pvtransi
 		flags->reparse_display = 0;
 	}
 
-	if (!pv_format(status, control, transfer, calc, control->format_string, display, reinitialise, final))
-		return;
-
-	if ((NULL != extra_display) && (0 != control->extra_displays)) {
-		if (!pv_format
-		    (status, control, transfer, calc, control->extra_format_string, extra_display, reinitialise, final))
-			return;
+	profile_start = pv_profile_begin();
+	formatted = pv_format(status, control, transfer, calc, control->format_string, display, reinitialise, final);
+	if (formatted && (NULL != extra_display) && (0 != control->extra_displays)) {
+		formatted =
+		    pv_format(status, control, transfer, calc, control->extra_format_string, extra_display,
+			      reinitialise, final);
 	}
+	pv_profile_end(PV_PROFILE_FORMAT, profile_start);
+
+	if (!formatted)
+		return;
 
 	if (NULL == display->display_buffer)
 		return;
@@ -1307,24 +2249,42 @@ void pv_display(pvprogramstatus_t status, readonly_pvcontrol_t control, pvtransi
 		pv_tty_write(flags, display->display_buffer, display->display_string_bytes);
 		pv_tty_write(flags, "\n", 1);
 	} else if (control->cursor) {
-		if (control->force || pv_in_foreground()) {
-			pv_crs_update(cursor, control, flags, display->display_buffer);
+		if (shown) {
+			if (pv__display_render_changes(display, final) && (NULL != display->render_buffer)) {
+				/* If our line has moved, the changes alone are not enough. */
+				if (!pv_crs_update(cursor, control, flags, display->render_buffer))
+					display->rendered_valid = pv_crs_update(cursor, control, flags,
+										display->display_buffer);
+			} else {
+				display->rendered_valid = pv_crs_update(cursor, control, flags, display->display_buffer);
+			}
 			display->output_produced = true;
 			pv__output_produced = true;
+		} else {
+			display->rendered_valid = false;
 		}
 	} else {
-		if (control->force || pv_in_foreground()) {
-			pv_tty_write(flags, display->display_buffer, display->display_string_bytes);
-			pv_tty_write(flags, "\r", 1);
+		if (shown) {
+			if (pv__display_render_changes(display, final) && (NULL != display->render_buffer)) {
+				if (display->render_bytes > 0) {
+					pv_tty_write(flags, display->render_buffer, display->render_bytes);
+					pv_tty_write(flags, "\r", 1);
+				}
+			} else {
+				pv_tty_write(flags, display->display_buffer, display->display_string_bytes);
+				pv_tty_write(flags, "\r", 1);
+			}
 			display->output_produced = true;
 			pv__output_produced = true;
+		} else {
+			display->rendered_valid = false;
 		}
 	}
 
 	debug("%s: [%s]", "display", display->display_buffer);
 
 	if ((0 != (PV_DISPLAY_WINDOWTITLE & control->extra_displays))
-	    && (control->force || pv_in_foreground())
+	    && shown
 	    && (NULL != extra_display)
 	    && (NULL != extra_display->display_buffer)
 	    ) {
@@ -0,0 +1,483 @@
+/*
+ * Functions for "--drop-behind", which releases the page cache used by a
+ * transfer as it goes, so that a large copy doesn't push everything else
+ * out of memory.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+/*
+ * The input and output are dealt with in chunks of PV_DROPBEHIND_CHUNK
+ * bytes.  The most recent PV_DROPBEHIND_KEEP chunks behind the read and
+ * write positions are left alone, and everything before them is dropped
+ * from the page cache with POSIX_FADV_DONTNEED.
+ *
+ * On the input, PV_DROPBEHIND_AHEAD chunks ahead of the read position are
+ * asked for with POSIX_FADV_WILLNEED, so that the kernel reads ahead by
+ * more than its default window.  Just before that, mincore() is used to
+ * note which pages of each chunk were already cached, and those pages are
+ * not dropped afterwards - so a file that was already in memory, because
+ * something else is using it, stays there.
+ *
+ * On the output, dirty pages can't be dropped until they have been
+ * written, so writeback of each chunk is started with sync_file_range()
+ * as soon as it is complete, and it is waited for only when the chunk
+ * falls out of the trailing window, by which point it is normally done.
+ *
+ * Without posix_fadvise(), as on Darwin, F_NOCACHE is set on the input
+ * and output instead, which stops their data being kept in the cache at
+ * all, and F_RDADVISE is used for the read-ahead.
+ *
+ * Only regular files and block devices are looked at; anything else, such
+ * as a pipe, has no page cache of its own to release.
+ */
+#define PV_DROPBEHIND_CHUNK	((off_t) 4194304)	/* bytes per step */
+#define PV_DROPBEHIND_KEEP	2	/* chunks kept behind the position */
+#define PV_DROPBEHIND_AHEAD	2	/* chunks read ahead of the input */
+#define PV_DROPBEHIND_RING	(PV_DROPBEHIND_KEEP + PV_DROPBEHIND_AHEAD + 2)
+
+struct pvdropbehind_s {
+	/* Input side. */
+	int input_fd;			 /* input the state below is for, or -1 */
+	bool input_usable;		 /* set if the input has a page cache */
+	off_t input_size;		 /* size of the input, if a regular file */
+	off_t input_dropped;		 /* input dropped from the cache up to here */
+	off_t input_ahead;		 /* input read ahead up to here */
+	/*@null@ */ unsigned char *resident[PV_DROPBEHIND_RING];	/* pages cached beforehand */
+	off_t resident_offset[PV_DROPBEHIND_RING];	/* chunk each entry is for */
+	/* Output side. */
+	bool output_checked;		 /* set once the output has been looked at */
+	bool output_usable;		 /* set if the output has a page cache */
+	off_t output_dropped;		 /* output dropped from the cache up to here */
+	off_t output_flushed;		 /* output writeback started up to here */
+	/* Both. */
+	off_t next_check;		 /* check again once this much is read */
+	size_t page_size;		 /* system page size */
+};
+
+
+/*
+ * Return true if "fd" is a regular file or a block device, putting its
+ * size in *size_ptr if it is a regular file, or -1 otherwise.
+ */
+static bool pv__dropbehind_cacheable(int fd, off_t *size_ptr)
+{
+	struct stat sb;
+
+	*size_ptr = -1;
+	memset(&sb, 0, sizeof(sb));
+	if (0 != fstat(fd, &sb))
+		return false;
+	if (S_ISREG(sb.st_mode)) {
+		*size_ptr = sb.st_size;
+		return true;
+	}
+	return S_ISBLK(sb.st_mode) ? true : false;
+}
+
+
+/*
+ * Return the ring slot for the chunk starting at "offset".
+ */
+static unsigned int pv__dropbehind_slot(off_t offset)
+{
+	return (unsigned int) ((offset / PV_DROPBEHIND_CHUNK) % PV_DROPBEHIND_RING);
+}
+
+
+/*
+ * Forget which pages of the input were cached beforehand.
+ */
+static void pv__dropbehind_forget_resident(struct pvdropbehind_s *dropbehind)
+{
+	unsigned int slot;
+
+	for (slot = 0; slot < PV_DROPBEHIND_RING; slot++) {
+		if (NULL != dropbehind->resident[slot])
+			free(dropbehind->resident[slot]);
+		dropbehind->resident[slot] = NULL;
+		dropbehind->resident_offset[slot] = -1;
+	}
+}
+
+
+/*
+ * Note which pages of the input chunk at "offset" are already cached, so
+ * that they can be left in the cache when the chunk is dropped.  If none
+ * are, or it can't be found out, nothing is kept.
+ */
+static void pv__dropbehind_note_resident(struct pvdropbehind_s *dropbehind, int fd, off_t offset, size_t length)
+{
+	unsigned int slot;
+
+	slot = pv__dropbehind_slot(offset);
+	if (NULL != dropbehind->resident[slot])
+		free(dropbehind->resident[slot]);
+	dropbehind->resident[slot] = NULL;
+	dropbehind->resident_offset[slot] = offset;
+
+#if defined(HAVE_MMAP) && HAVE_POSIX_FADVISE
+	{
+		void *mapping;
+		unsigned char *vector;
+		size_t pages, page_idx;
+		bool any_resident;
+
+		if (0 == length)
+			return;
+
+		pages = (length + dropbehind->page_size - 1) / dropbehind->page_size;
+		vector = calloc(pages, 1);
+		if (NULL == vector)
+			return;
+
+		mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, offset);
+		if (MAP_FAILED == mapping) {
+			debug("%s: %s", "mmap", strerror(errno));
+			free(vector);
+			return;
+		}
+
+		/* Linux takes an unsigned char vector, and Darwin a char one. */
+		if (0 != mincore(mapping, length, (void *) vector)) {
+			debug("%s: %s", "mincore", strerror(errno));
+			(void) munmap(mapping, length);
+			free(vector);
+			return;
+		}
+		(void) munmap(mapping, length);
+
+		any_resident = false;
+		for (page_idx = 0; page_idx < pages; page_idx++) {
+			vector[page_idx] &= 1;
+			if (0 != vector[page_idx])
+				any_resident = true;
+		}
+
+		if (!any_resident) {
+			free(vector);
+			return;
+		}
+
+		dropbehind->resident[slot] = vector;
+	}
+#else				/* ! (HAVE_MMAP && HAVE_POSIX_FADVISE) */
+	(void) fd;
+	(void) length;
+#endif				/* HAVE_MMAP && HAVE_POSIX_FADVISE */
+}
+
+
+/*
+ * Drop the input chunk at "offset" from the page cache, apart from any
+ * pages which were already cached before it was read.
+ */
+static void pv__dropbehind_drop_input(struct pvdropbehind_s *dropbehind, int fd, off_t offset)
+{
+#if HAVE_POSIX_FADVISE
+	unsigned int slot;
+	unsigned char *vector;
+	size_t pages, page_idx, run_start;
+
+	slot = pv__dropbehind_slot(offset);
+	vector = NULL;
+	if (offset == dropbehind->resident_offset[slot])
+		vector = dropbehind->resident[slot];
+
+	if (NULL == vector) {
+		(void) posix_fadvise(fd, offset, PV_DROPBEHIND_CHUNK, POSIX_FADV_DONTNEED);
+		return;
+	}
+
+	/* Drop each run of pages which weren't cached beforehand. */
+	pages = (size_t) (PV_DROPBEHIND_CHUNK) / dropbehind->page_size;
+	run_start = 0;
+	for (page_idx = 0; page_idx <= pages; page_idx++) {
+		if ((page_idx < pages) && (0 == vector[page_idx]))
+			continue;
+		if (page_idx > run_start) {
+			(void) posix_fadvise(fd, offset + (off_t) (run_start * dropbehind->page_size),
+					     (off_t) ((page_idx - run_start) * dropbehind->page_size),
+					     POSIX_FADV_DONTNEED);
+		}
+		run_start = page_idx + 1;
+	}
+
+	free(vector);
+	dropbehind->resident[slot] = NULL;
+	dropbehind->resident_offset[slot] = -1;
+#else				/* ! HAVE_POSIX_FADVISE */
+	(void) dropbehind;
+	(void) fd;
+	(void) offset;
+#endif				/* HAVE_POSIX_FADVISE */
+}
+
+
+/*
+ * Ask for the input chunk at "offset" to be read ahead.
+ */
+static void pv__dropbehind_read_ahead(int fd, off_t offset)
+{
+#if HAVE_POSIX_FADVISE
+	(void) posix_fadvise(fd, offset, PV_DROPBEHIND_CHUNK, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+	struct radvisory advice;
+	memset(&advice, 0, sizeof(advice));
+	advice.ra_offset = offset;
+	advice.ra_count = (int) PV_DROPBEHIND_CHUNK;
+	(void) fcntl(fd, F_RDADVISE, &advice);
+#else
+	(void) fd;
+	(void) offset;
+#endif
+}
+
+
+/*
+ * Drop the output chunk at "offset" from the page cache, first waiting
+ * for it to be written if "wait" is true.
+ */
+static void pv__dropbehind_drop_output(int fd, off_t offset, off_t length, bool wait)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+	if (wait) {
+		(void) sync_file_range(fd, offset, length,
+				       SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+				       SYNC_FILE_RANGE_WAIT_AFTER);
+	}
+#else				/* ! HAVE_SYNC_FILE_RANGE */
+	(void) wait;
+#endif				/* HAVE_SYNC_FILE_RANGE */
+#if HAVE_POSIX_FADVISE
+	(void) posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+#else
+	(void) fd;
+	(void) offset;
+	(void) length;
+#endif
+}
+
+
+/*
+ * Start writeback of the output chunk at "offset".
+ */
+static void pv__dropbehind_flush_output(int fd, off_t offset, off_t length)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+	(void) sync_file_range(fd, offset, length, SYNC_FILE_RANGE_WRITE);
+#else
+	(void) fd;
+	(void) offset;
+	(void) length;
+#endif
+}
+
+
+/*
+ * Set F_NOCACHE on "fd", where there is no posix_fadvise().
+ */
+static void pv__dropbehind_nocache(int fd)
+{
+#if !HAVE_POSIX_FADVISE && defined(F_NOCACHE)
+	if (0 != fcntl(fd, F_NOCACHE, 1))
+		debug("%s: %d: %s", "fcntl", fd, strerror(errno));
+#else
+	(void) fd;
+#endif
+}
+
+
+/*
+ * Start following input "fd", whose read position is "position".
+ */
+static void pv__dropbehind_input_start(struct pvdropbehind_s *dropbehind, int fd, off_t position)
+{
+	pv__dropbehind_forget_resident(dropbehind);
+
+	dropbehind->input_fd = fd;
+	dropbehind->input_usable = pv__dropbehind_cacheable(fd, &(dropbehind->input_size));
+	dropbehind->input_dropped = position - (position % PV_DROPBEHIND_CHUNK);
+	dropbehind->input_ahead = dropbehind->input_dropped;
+
+	if (dropbehind->input_usable)
+		pv__dropbehind_nocache(fd);
+
+	debug("%s: fd=%d, %s=%s", "drop-behind following input", fd, "usable",
+	      dropbehind->input_usable ? "true" : "false");
+}
+
+
+/*
+ * Release the page cache behind the current read and write positions, and
+ * read ahead of the read position, if the transfer has moved on far
+ * enough since the last time.  Called from the main loop after each
+ * transfer, when --drop-behind is in effect.
+ */
+void pv_dropbehind_update(pvstate_t state, int input_fd)
+{
+	struct pvdropbehind_s *dropbehind;
+	off_t position;
+
+	dropbehind = state->transfer.dropbehind;
+	if (NULL == dropbehind) {
+		dropbehind = calloc(1, sizeof(*dropbehind));
+		if (NULL == dropbehind)
+			return;
+		dropbehind->input_fd = -1;
+		pv__dropbehind_forget_resident(dropbehind);
+		dropbehind->page_size = 4096;
+#if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
+		if (sysconf(_SC_PAGESIZE) > 0)
+			dropbehind->page_size = (size_t) sysconf(_SC_PAGESIZE);
+#endif
+		state->transfer.dropbehind = dropbehind;
+	}
+
+	/*
+	 * Looking up the positions costs a system call each, so only do it
+	 * every quarter of a chunk.
+	 */
+	if ((input_fd == dropbehind->input_fd) && (state->transfer.total_bytes_read < dropbehind->next_check))
+		return;
+	dropbehind->next_check = state->transfer.total_bytes_read + PV_DROPBEHIND_CHUNK / 4;
+
+	if ((input_fd >= 0) && (input_fd != dropbehind->input_fd)) {
+		position = lseek(input_fd, 0, SEEK_CUR);
+		pv__dropbehind_input_start(dropbehind, input_fd, position < 0 ? 0 : position);
+	}
+
+	if ((input_fd >= 0) && dropbehind->input_usable) {
+		position = lseek(input_fd, 0, SEEK_CUR);
+		if (position >= 0) {
+			while ((dropbehind->input_ahead < position + PV_DROPBEHIND_AHEAD * PV_DROPBEHIND_CHUNK)
+			       && ((dropbehind->input_size < 0) || (dropbehind->input_ahead < dropbehind->input_size))) {
+				pv__dropbehind_note_resident(dropbehind, input_fd, dropbehind->input_ahead,
+							     (size_t) (PV_DROPBEHIND_CHUNK));
+				pv__dropbehind_read_ahead(input_fd, dropbehind->input_ahead);
+				dropbehind->input_ahead += PV_DROPBEHIND_CHUNK;
+			}
+			while (dropbehind->input_dropped + (PV_DROPBEHIND_KEEP + 1) * PV_DROPBEHIND_CHUNK <= position) {
+				pv__dropbehind_drop_input(dropbehind, input_fd, dropbehind->input_dropped);
+				dropbehind->input_dropped += PV_DROPBEHIND_CHUNK;
+			}
+		}
+	}
+
+	if (!dropbehind->output_checked) {
+		off_t output_size;
+		dropbehind->output_checked = true;
+		dropbehind->output_usable = pv__dropbehind_cacheable(state->control.output_fd, &output_size);
+		position = lseek(state->control.output_fd, 0, SEEK_CUR);
+		if (position < 0)
+			position = 0;
+		dropbehind->output_flushed = position - (position % PV_DROPBEHIND_CHUNK);
+		dropbehind->output_dropped = dropbehind->output_flushed;
+		if (dropbehind->output_usable)
+			pv__dropbehind_nocache(state->control.output_fd);
+	}
+
+	if (dropbehind->output_usable) {
+		position = lseek(state->control.output_fd, 0, SEEK_CUR);
+		if (position >= 0) {
+			while (dropbehind->output_flushed + PV_DROPBEHIND_CHUNK <= position) {
+				pv__dropbehind_flush_output(state->control.output_fd, dropbehind->output_flushed,
+							    PV_DROPBEHIND_CHUNK);
+				dropbehind->output_flushed += PV_DROPBEHIND_CHUNK;
+			}
+			while (dropbehind->output_dropped + PV_DROPBEHIND_KEEP * PV_DROPBEHIND_CHUNK <=
+			       dropbehind->output_flushed) {
+				pv__dropbehind_drop_output(state->control.output_fd, dropbehind->output_dropped,
+							   PV_DROPBEHIND_CHUNK, true);
+				dropbehind->output_dropped += PV_DROPBEHIND_CHUNK;
+			}
+		}
+	}
+}
+
+
+/*
+ * Release what is left of input "fd" in the page cache, just before it is
+ * closed, up to where it was read to.
+ */
+void pv_dropbehind_input_done(pvstate_t state, int fd)
+{
+	struct pvdropbehind_s *dropbehind;
+	off_t position;
+
+	dropbehind = state->transfer.dropbehind;
+	if ((NULL == dropbehind) || (fd < 0) || (fd != dropbehind->input_fd))
+		return;
+
+	if (dropbehind->input_usable) {
+		position = lseek(fd, 0, SEEK_CUR);
+		while ((position >= 0) && (dropbehind->input_dropped < position)) {
+			pv__dropbehind_drop_input(dropbehind, fd, dropbehind->input_dropped);
+			dropbehind->input_dropped += PV_DROPBEHIND_CHUNK;
+		}
+	}
+
+	pv__dropbehind_forget_resident(dropbehind);
+	dropbehind->input_fd = -1;
+	dropbehind->input_usable = false;
+}
+
+
+/*
+ * At the end of the transfer, release what is left of the input and the
+ * output in the page cache, waiting for the rest of the output to be
+ * written first, and free the drop-behind state.
+ */
+void pv_dropbehind_finish(pvstate_t state, int input_fd)
+{
+	struct pvdropbehind_s *dropbehind;
+	off_t position;
+
+	dropbehind = state->transfer.dropbehind;
+	if (NULL == dropbehind)
+		return;
+
+	pv_dropbehind_input_done(state, input_fd);
+
+	if (dropbehind->output_usable) {
+		position = lseek(state->control.output_fd, 0, SEEK_CUR);
+		if (position > dropbehind->output_dropped) {
+			pv__dropbehind_drop_output(state->control.output_fd, dropbehind->output_dropped,
+						   position - dropbehind->output_dropped, true);
+			dropbehind->output_dropped = position;
+		}
+	}
+
+	pv_dropbehind_free(&(state->transfer));
+}
+
+
+/*
+ * Free the drop-behind state, if there is any.
+ */
+void pv_dropbehind_free(pvtransferstate_t transfer)
+{
+	if ((NULL == transfer) || (NULL == transfer->dropbehind))
+		return;
+	pv__dropbehind_forget_resident(transfer->dropbehind);
+	free(transfer->dropbehind);
+	transfer->dropbehind = NULL;
+}
@@ -1,7 +1,7 @@
 /*
  * Functions relating to elapsed time.
  *
- * Copyright 2023-2025 Andrew Wood
+ * Copyright 2023-2026 Andrew Wood
  *
  * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
  */
@@ -13,6 +13,12 @@
 #include <string.h>
 #include <errno.h>
 
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#define PV_NSEC_PER_SEC 1000000000LL
+
 
 /*
  * Read the current elapsed time, relative to an unspecified point in the
@@ -36,6 +42,104 @@ void pv_elapsedtime_read(struct timespec *return_time)
 }
 
 
+/*
+ * Return the current elapsed time, as read by pv_elapsedtime_read(), as a
+ * whole number of nanoseconds.
+ */
+long long pv_elapsedtime_nsec(void)
+{
+	struct timespec now;
+
+	pv_elapsedtime_read(&now);
+
+	return pv_elapsedtime_to_nsec(&now);
+}
+
+
+/*
+ * Return a cheaper, lower resolution reading of the elapsed time, in
+ * nanoseconds, for timeouts and sampling periods where a few milliseconds
+ * either way don't matter.  On Linux this is CLOCK_MONOTONIC_COARSE, which
+ * only reads a value the kernel updates on each tick; on macOS and iOS it
+ * is mach_absolute_time(), which is read from user space without any
+ * system call at all.
+ *
+ * The coarse clock may not have the same starting point as the one read
+ * by pv_elapsedtime_read(), so its readings must only be compared with
+ * each other.
+ */
+long long pv_elapsedtime_coarse_nsec(void)
+{
+#if defined(__APPLE__)
+	static mach_timebase_info_data_t timebase;
+
+	if (0 == timebase.denom) {
+		if ((KERN_SUCCESS != mach_timebase_info(&timebase)) || (0 == timebase.denom)) {
+			timebase.numer = 0;
+			timebase.denom = 0;
+			return pv_elapsedtime_nsec();
+		}
+	}
+
+	return (long long) (mach_absolute_time() * timebase.numer / timebase.denom);
+#elif defined(CLOCK_MONOTONIC_COARSE)
+	struct timespec now;
+
+	/*@-unrecog@ *//* splint doesn't know clock_gettime */
+	if (0 != clock_gettime(CLOCK_MONOTONIC_COARSE, &now))
+		return pv_elapsedtime_nsec();
+	/*@+unrecog@ */
+
+	return pv_elapsedtime_to_nsec(&now);
+#else
+	return pv_elapsedtime_nsec();
+#endif
+}
+
+
+/*
+ * Return the time in the given timespec as a whole number of nanoseconds.
+ */
+long long pv_elapsedtime_to_nsec(const struct timespec *time_value)
+{
+	if (NULL == time_value)
+		return 0;
+	return ((long long) (time_value->tv_sec)) * PV_NSEC_PER_SEC + (long long) (time_value->tv_nsec);
+}
+
+
+/*
+ * Set the given timespec from a whole number of nanoseconds, which may be
+ * negative, in which case tv_sec is negative and tv_nsec is not.
+ */
+void pv_elapsedtime_from_nsec(struct timespec *return_time, long long nanoseconds)
+{
+	long long seconds;
+
+	if (NULL == return_time)
+		return;
+
+	seconds = nanoseconds / PV_NSEC_PER_SEC;
+	nanoseconds -= seconds * PV_NSEC_PER_SEC;
+	if (nanoseconds < 0) {
+		seconds--;
+		nanoseconds += PV_NSEC_PER_SEC;
+	}
+
+	/*@-type@ */
+	return_time->tv_sec = seconds;
+	return_time->tv_nsec = nanoseconds;
+	/*@+type@ */
+
+	/*
+	 * splint rationale: we know the types are different but should be
+	 * large enough and are relying on the compiler to do the casting
+	 * correctly, since the manual for timespec(3) states the types are
+	 * implementation-defined.
+	 */
+}
+
+
 /*
  * Set the time in the given timespec to zero.
  */
@@ -82,19 +186,11 @@ int pv_elapsedtime_compare(const struct timespec *first_time, const struct times
 	if (NULL == second_time)
 		return 0;
 
-	/* Check the seconds part, first */
-	if (first_time->tv_sec < second_time->tv_sec)
+	if (pv_elapsedtime_to_nsec(first_time) < pv_elapsedtime_to_nsec(second_time))
 		return -1;
-	if (first_time->tv_sec > second_time->tv_sec)
+	if (pv_elapsedtime_to_nsec(first_time) > pv_elapsedtime_to_nsec(second_time))
 		return 1;
 
-	/* Seconds are equal - compare nanoseconds. */
-	if (first_time->tv_nsec < second_time->tv_nsec)
-		return -1;
-	if (first_time->tv_nsec > second_time->tv_nsec)
-		return 1;
-
-	/* Nanoseconds are also equal - times are equal. */
 	return 0;
 }
 
@@ -105,38 +201,10 @@ int pv_elapsedtime_compare(const struct timespec *first_time, const struct times
 void pv_elapsedtime_add(struct timespec *return_time, const struct timespec *first_time,
 			const struct timespec *second_time)
 {
-	long long seconds, nanoseconds;
-
 	if (NULL == return_time)
 		return;
-
-	seconds = 0;
-	nanoseconds = 0;
-
-	if (NULL != first_time) {
-		seconds += first_time->tv_sec;
-		nanoseconds += first_time->tv_nsec;
-	}
-
-	if (NULL != second_time) {
-		seconds += second_time->tv_sec;
-		nanoseconds += second_time->tv_nsec;
-	}
-
-	seconds += nanoseconds / 1000000000;
-	nanoseconds = nanoseconds % 1000000000;
-
-	/*@-type@ */
-	return_time->tv_sec = seconds;
-	return_time->tv_nsec = nanoseconds;
-	/*@+type@ */
-
-	/*
-	 * splint rationale: we know the types are different but should be
-	 * large enough and are relying on the compiler to do the casting
-	 * correctly, since the manual for timespec(3) states the types are
-	 * implementation-defined.
-	 */
+	pv_elapsedtime_from_nsec(return_time,
+				 pv_elapsedtime_to_nsec(first_time) + pv_elapsedtime_to_nsec(second_time));
 }
 
 
@@ -145,21 +213,9 @@ void pv_elapsedtime_add(struct timespec *return_time, const struct timespec *fir
  */
 void pv_elapsedtime_add_nsec(struct timespec *return_time, long long add_nanoseconds)
 {
-	long long seconds, nanoseconds;
-
 	if (NULL == return_time)
 		return;
-
-	seconds = return_time->tv_sec;
-	nanoseconds = return_time->tv_nsec + add_nanoseconds;
-
-	seconds += nanoseconds / 1000000000;
-	nanoseconds = nanoseconds % 1000000000;
-
-	/*@-type@ *//* see above */
-	return_time->tv_sec = seconds;
-	return_time->tv_nsec = nanoseconds;
-	/*@+type@ */
+	pv_elapsedtime_from_nsec(return_time, pv_elapsedtime_to_nsec(return_time) + add_nanoseconds);
 }
 
 
@@ -169,36 +225,10 @@ void pv_elapsedtime_add_nsec(struct timespec *return_time, long long add_nanosec
 void pv_elapsedtime_subtract(struct timespec *return_time, const struct timespec *first_time,
 			     const struct timespec *second_time)
 {
-	long long seconds, nanoseconds;
-
 	if (NULL == return_time)
 		return;
-
-	seconds = 0;
-	nanoseconds = 0;
-
-	if (NULL != first_time) {
-		seconds += first_time->tv_sec;
-		nanoseconds += first_time->tv_nsec;
-	}
-
-	if (NULL != second_time) {
-		seconds -= second_time->tv_sec;
-		nanoseconds -= second_time->tv_nsec;
-	}
-
-	seconds += nanoseconds / 1000000000;
-	nanoseconds = nanoseconds % 1000000000;
-
-	if (nanoseconds < 0) {
-		seconds--;
-		nanoseconds = 1000000000 + nanoseconds;
-	}
-
-	/*@-type@ *//* see above */
-	return_time->tv_sec = seconds;
-	return_time->tv_nsec = nanoseconds;
-	/*@+type@ */
+	pv_elapsedtime_from_nsec(return_time,
+				 pv_elapsedtime_to_nsec(first_time) - pv_elapsedtime_to_nsec(second_time));
 }
 
 
@@ -0,0 +1,284 @@
+/*
+ * Functions for writing the output to more than one destination, when
+ * "-o" is given more than once.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+
+/*
+ * The first "-o" is the main output, handled as usual.  Each extra one is
+ * written here, from the transfer buffer, with whatever the main output
+ * has just accepted, so the data is read once and copied nowhere else.
+ *
+ * With the "wait" policy (the default), every output has to take the data
+ * before the transfer moves on, so the slowest one sets the pace.  With
+ * the "drop" policy, an output which holds up any one write for more than
+ * PV_FANOUT_DROP_TIMEOUT milliseconds is given up on, with a warning, and
+ * the others carry on without it; the exit status still shows that not
+ * every output got all of the data.
+ *
+ * The time spent waiting on each output is kept, so that the display can
+ * show which output is holding things up.
+ */
+#define PV_FANOUT_POLL_TIMEOUT	100		/* msec per wait for an output */
+#define PV_FANOUT_DROP_TIMEOUT	1000		/* msec before dropping a laggard */
+
+struct pvfanout_output_s {
+	/*@only@ */ char *name;		 /* name of the output, for messages */
+	int fd;				 /* descriptor to write to */
+	off_t written;			 /* amount written to it so far */
+	long double wait_seconds;	 /* time spent waiting for it */
+	bool dropped;			 /* set once it has been given up on */
+};
+
+struct pvfanout_s {
+	/*@only@ */ struct pvfanout_output_s *outputs;	/* the extra outputs */
+	unsigned int count;		 /* number of extra outputs */
+	bool held;			 /* set while writes are held back */
+};
+
+
+/*
+ * Add an extra output, already opened as "fd", under the given name.  The
+ * descriptor is closed by pv_fanout_free().  Returns false on error.
+ */
+bool pv_fanout_add(pvstate_t state, int fd, const char *name)
+{
+	struct pvfanout_s *fanout;
+	struct pvfanout_output_s *new_outputs;
+	struct pvfanout_output_s *output;
+	int flags;
+
+	fanout = state->status.fanout;
+	if (NULL == fanout) {
+		fanout = calloc(1, sizeof(*fanout));
+		if (NULL == fanout) {
+			pv_error("%s: %s", _("output list allocation failed"), strerror(errno));
+			return false;
+		}
+		state->status.fanout = fanout;
+	}
+
+	new_outputs = realloc(fanout->outputs, (fanout->count + 1) * sizeof(*new_outputs));
+	if (NULL == new_outputs) {
+		pv_error("%s: %s", _("output list allocation failed"), strerror(errno));
+		return false;
+	}
+	fanout->outputs = new_outputs;
+
+	output = &(fanout->outputs[fanout->count]);
+	memset(output, 0, sizeof(*output));
+	output->name = pv_strdup(name);
+	if (NULL == output->name) {
+		pv_error("%s: %s", _("output list allocation failed"), strerror(errno));
+		return false;
+	}
+	output->fd = fd;
+
+	/*
+	 * Writes are waited for with poll(), so that a slow output can be
+	 * timed, and given up on with the "drop" policy.  The descriptor
+	 * was opened by us, so nothing else shares its flags.
+	 */
+	flags = fcntl(fd, F_GETFL);
+	if (flags >= 0)
+		(void) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+	fanout->count++;
+
+	debug("%s: %s (%d)", "added extra output", name, fd);
+
+	return true;
+}
+
+
+/*
+ * Hold back writes to the extra outputs if "hold" is true, or let them
+ * through again if it is false - used while the store-and-forward receiver
+ * is writing to the spool rather than to the outputs.
+ */
+void pv_fanout_hold(pvstate_t state, bool hold)
+{
+	if (NULL == state->status.fanout)
+		return;
+	state->status.fanout->held = hold;
+}
+
+
+/*
+ * Write "count" bytes at "data", which the main output has just accepted,
+ * to every extra output which hasn't been dropped.
+ */
+void pv_fanout_write(pvstate_t state, const char *data, size_t count)
+{
+	struct pvfanout_s *fanout;
+	unsigned int output_idx;
+
+	fanout = state->status.fanout;
+	if ((NULL == fanout) || (fanout->held) || (0 == count))
+		return;
+
+	for (output_idx = 0; output_idx < fanout->count; output_idx++) {
+		struct pvfanout_output_s *output = &(fanout->outputs[output_idx]);
+		struct timespec start_time, end_time, wait_time;
+		unsigned int waited_msec;
+		bool waited;
+		size_t offset;
+
+		if (output->dropped)
+			continue;
+
+		waited = false;
+		waited_msec = 0;
+		pv_elapsedtime_zero(&start_time);
+
+		for (offset = 0; offset < count;) {
+			struct pollfd pfd;
+			ssize_t written;
+
+			written = write(output->fd, data + offset, count - offset);
+			if (written > 0) {
+				offset += (size_t) written;
+				continue;
+			}
+
+			if ((written < 0) && (EINTR == errno) && (0 == state->flags.trigger_exit))
+				continue;
+
+			if ((written < 0) && ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+			    && (0 == state->flags.trigger_exit)) {
+				if (!waited) {
+					pv_elapsedtime_read(&start_time);
+					waited = true;
+				}
+				if ((PV_FANOUT_DROP == state->control.fanout_policy)
+				    && (waited_msec >= PV_FANOUT_DROP_TIMEOUT)) {
+					pv_error("%s: %s", output->name, _("not keeping up - dropping this output"));
+					state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+					output->dropped = true;
+					break;
+				}
+				pfd.fd = output->fd;
+				pfd.events = POLLOUT;
+				pfd.revents = 0;
+				(void) poll(&pfd, 1, PV_FANOUT_POLL_TIMEOUT);
+				waited_msec += PV_FANOUT_POLL_TIMEOUT;
+				continue;
+			}
+
+			if (0 != state->flags.trigger_exit)
+				break;
+
+			pv_error("%s: %s: %s", output->name, _("write failed"),
+				 written < 0 ? strerror(errno) : _("no data written"));
+			state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+			output->dropped = true;
+			break;
+		}
+
+		output->written += (off_t) offset;
+
+		if (waited) {
+			pv_elapsedtime_read(&end_time);
+			pv_elapsedtime_subtract(&wait_time, &end_time, &start_time);
+			output->wait_seconds += pv_elapsedtime_seconds(&wait_time);
+		}
+	}
+}
+
+
+/*
+ * Describe each extra output into "buffer", for the "%{outputs}" format
+ * sequence: its name, how much has been written to it, and the percentage
+ * of the elapsed time spent waiting for it, or "dropped".  The buffer is
+ * left empty if there are no extra outputs.
+ */
+void pv_fanout_describe(pvformatter_args_t args, char *buffer, size_t bufsize)
+{
+	struct pvfanout_s *fanout;
+	unsigned int output_idx;
+	size_t offset;
+
+	if (bufsize < 1)
+		return;
+	buffer[0] = '\0';
+
+	fanout = args->status->fanout;
+	if (NULL == fanout)
+		return;
+
+	offset = 0;
+	for (output_idx = 0; output_idx < fanout->count && offset + 1 < bufsize; output_idx++) {
+		struct pvfanout_output_s *output = &(fanout->outputs[output_idx]);
+		char amount[64];	 /* flawfinder: ignore - always bounded */
+		int added;
+
+		/*@-mustfreefresh@ */
+		if (output->dropped) {
+			added = pv_snprintf(buffer + offset, bufsize - offset, "%s%.32s:%s", 0 == offset ? "" : " ",
+					    output->name, _("dropped"));
+		} else {
+			long double wait_percent = 0.0;
+
+			if (args->transfer->elapsed_seconds > 0.0)
+				wait_percent = 100.0 * output->wait_seconds / args->transfer->elapsed_seconds;
+			if (wait_percent > 100.0)
+				wait_percent = 100.0;
+
+			pv_describe_amount(amount, sizeof(amount), "%s", (long double) (output->written), "",
+					   _("B"), PV_TRANSFERCOUNT_BYTES);
+			added =
+			    pv_snprintf(buffer + offset, bufsize - offset, "%s%.32s:%s %.0Lf%%", 0 == offset ? "" : " ",
+					output->name, amount, wait_percent);
+		}
+		/*@+mustfreefresh@ *//* splint - false positive from gettext(). */
+
+		if (added < 0)
+			break;
+		offset += (size_t) added;
+	}
+
+	if (offset >= bufsize)
+		buffer[bufsize - 1] = '\0';
+}
+
+
+/*
+ * Close the extra outputs, if there are any, and free the list.
+ */
+void pv_fanout_free(pvstate_t state)
+{
+	struct pvfanout_s *fanout;
+	unsigned int output_idx;
+
+	if ((NULL == state) || (NULL == state->status.fanout))
+		return;
+
+	fanout = state->status.fanout;
+	state->status.fanout = NULL;
+
+	for (output_idx = 0; output_idx < fanout->count; output_idx++) {
+		if (fanout->outputs[output_idx].fd >= 0)
+			(void) close(fanout->outputs[output_idx].fd);
+		if (NULL != fanout->outputs[output_idx].name)
+			free(fanout->outputs[output_idx].name);
+	}
+
+	if (NULL != fanout->outputs)
+		free(fanout->outputs);
+	free(fanout);
+}
@@ -23,6 +23,89 @@
 /*@-type@*/
 /* splint has trouble with off_t and mode_t throughout this file. */
 
+/*
+ * Work out the size of one input file, "-" meaning standard input, putting
+ * it in *size_ptr.
+ *
+ * Returns 1 if the size is known, 0 if the file is of indeterminate size
+ * (such as a pipe), or -1 if the file cannot be stat()ed, or access() says
+ * we can't read it.
+ */
+int pv_calc_file_bytes(const char *filename, off_t *size_ptr)
+{
+	struct stat sb;
+	int rc;
+
+	*size_ptr = 0;
+	memset(&sb, 0, sizeof(sb));
+
+	/* The amount that will arrive over the network is unknown. */
+	if (pv_net_is_address(filename))
+		return 0;
+
+	if (0 == strcmp(filename, "-")) {
+		rc = fstat(STDIN_FILENO, &sb);
+	} else {
+		rc = stat(filename, &sb);
+		if (0 == rc) {
+			rc = access(filename, R_OK);	/* flawfinder: ignore */
+			/*
+			 * flawfinder rationale: we're not really using
+			 * access() to do permissions checks, but to zero
+			 * the total if we might be unable to read the file
+			 * later, so if an attacker redirected one of the
+			 * input files in between this part and the actual
+			 * reading, the outcome would be that the total
+			 * byte count would be wrong or missing, nothing
+			 * useful.
+			 */
+		}
+	}
+
+	if (rc != 0) {
+		debug("%s: %s", filename, strerror(errno));
+		return -1;
+	}
+
+	if (S_ISBLK(sb.st_mode)) {
+		off_t end_position;
+		int fd;
+
+		/*
+		 * Get the size of block devices by opening them and
+		 * asking the device, or failing that, seeking to the end.
+		 */
+		if (0 == strcmp(filename, "-")) {
+			fd = open("/dev/stdin", O_RDONLY);	/* flawfinder: ignore */
+			/*
+			 * flawfinder rationale: "/dev/stdin" may be a
+			 * symlink, so can't use O_NOFOLLOW, and so we have
+			 * to assume that it being under "/dev" means the
+			 * path is less likely to be under the control of
+			 * someone else.
+			 */
+		} else {
+			fd = open(filename, O_RDONLY);	/* flawfinder: ignore */
+			/* flawfinder - see the open() in pv_next_file(). */
+		}
+		if (fd < 0)
+			return -1;
+		end_position = pv_blkdev_size(fd);
+		if (end_position > 0)
+			*size_ptr = end_position;
+		(void) close(fd);
+		return 1;
+	}
+
+	if (S_ISREG(sb.st_mode)) {
+		*size_ptr = sb.st_size;
+		return 1;
+	}
+
+	return 0;
+}
+
+
 /*
  * Calculate the total number of bytes to be transferred by adding up the
  * sizes of all input files.  If any of the input files are of indeterminate
@@ -52,75 +135,19 @@ static off_t pv_calc_total_bytes(pvstate_t state)
 	}
 
 	for (file_idx = 0; file_idx < state->files.file_count; file_idx++) {
+		off_t file_size;
 		int rc;
 
 		/* Skip any NULL entries, though they should be impossible. */
 		if (NULL == state->files.filename[file_idx])
 			continue;
 
-		if (0 == strcmp(state->files.filename[file_idx], "-")) {
-			rc = fstat(STDIN_FILENO, &sb);
-			if (rc != 0) {
-				total = 0;
-				return total;
-			}
-		} else {
-			rc = stat(state->files.filename[file_idx], &sb);
-			if (0 == rc) {
-				rc = access(state->files.filename[file_idx], R_OK);	/* flawfinder: ignore */
-				/*
-				 * flawfinder rationale: we're not really
-				 * using access() to do permissions checks,
-				 * but to zero the total if we might be
-				 * unable to read the file later, so if an
-				 * attacker redirected one of the input
-				 * files in between this part and the actual
-				 * reading, the outcome would be that the
-				 * total byte count would be wrong or
-				 * missing, nothing useful.
-				 */
-			}
-		}
-
-		if (rc != 0) {
-			debug("%s: %s", state->files.filename[file_idx], strerror(errno));
+		rc = pv_calc_file_bytes(state->files.filename[file_idx], &file_size);
+		if (rc < 0) {
 			total = 0;
 			return total;
-		}
-
-		if (S_ISBLK(sb.st_mode)) {
-			int fd;
-
-			/*
-			 * Get the size of block devices by opening
-			 * them and seeking to the end.
-			 */
-			if (0 == strcmp(state->files.filename[file_idx], "-")) {
-				fd = open("/dev/stdin", O_RDONLY);	/* flawfinder: ignore */
-				/*
-				 * flawfinder rationale: "/dev/stdin" may be
-				 * a symlink, so can't use O_NOFOLLOW, and
-				 * so we have to assume that it being under
-				 * "/dev" means the path is less likely to
-				 * be under the control of someone else.
-				 */
-			} else {
-				fd = open(state->files.filename[file_idx], O_RDONLY);	/* flawfinder: ignore */
-				/* flawfinder - see last open() below. */
-			}
-			if (fd >= 0) {
-				off_t end_position;
-				end_position = lseek(fd, 0, SEEK_END);
-				if (end_position > 0) {
-					total += end_position;
-				}
-				(void) close(fd);
-			} else {
-				total = 0;
-				return total;
-			}
-		} else if (S_ISREG(sb.st_mode)) {
-			total += sb.st_size;
+		} else if (rc > 0) {
+			total += file_size;
 		} else {
 			total = 0;
 		}
@@ -142,7 +169,7 @@ static off_t pv_calc_total_bytes(pvstate_t state)
 		if ((0 == rc) && S_ISBLK(sb.st_mode)
 		    && (0 == (fcntl(state->control.output_fd, F_GETFL) & O_APPEND))) {
 			off_t end_position;
-			end_position = lseek(state->control.output_fd, 0, SEEK_END);
+			end_position = pv_blkdev_size(state->control.output_fd);
 			total = 0;
 			if (end_position > 0) {
 				total = end_position;
@@ -177,91 +204,14 @@ static off_t pv_calc_total_bytes(pvstate_t state)
  * Any files that cannot be stat()ed or that access() says we can't read
  * will be skipped, and the total size will be set to zero.
  *
+ * The counting itself is done by pv_prescan_count(), which maps large files
+ * into memory and counts separate parts of them in parallel.
+ *
  * Returns the total size, or 0 if it is unknown.
  */
 static off_t pv_calc_total_lines(pvstate_t state)
 {
-	off_t total;
-	struct stat sb;
-	unsigned int file_idx;
-
-	total = 0;
-
-	for (file_idx = 0; file_idx < state->files.file_count && NULL != state->files.filename; file_idx++) {
-		int fd = -1;
-		int rc = 0;
-
-		/* Skip any NULL entries, though they should be impossible. */
-		if (NULL == state->files.filename[file_idx])
-			continue;
-
-		if (0 == strcmp(state->files.filename[file_idx], "-")) {
-			rc = fstat(STDIN_FILENO, &sb);
-			if ((rc != 0) || (!S_ISREG(sb.st_mode))) {
-				total = 0;
-				return total;
-			}
-			fd = dup(STDIN_FILENO);
-		} else {
-			rc = stat(state->files.filename[file_idx], &sb);
-			if ((rc != 0) || (!S_ISREG(sb.st_mode))) {
-				total = 0;
-				return total;
-			}
-			fd = open(state->files.filename[file_idx], O_RDONLY);	/* flawfinder: ignore */
-			/* flawfinder - see last open() below. */
-		}
-
-		if (fd < 0) {
-			debug("%s: %s", state->files.filename[file_idx], strerror(errno));
-			total = 0;
-			return total;
-		}
-#if HAVE_POSIX_FADVISE
-		/* Advise the OS that we will only be reading sequentially. */
-		(void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
-#endif
-
-		while (true) {
-			char scanbuf[1024];	/* flawfinder: ignore */
-			ssize_t numread, buf_idx;
-
-			/* flawfinder - always bounded, below. */
-
-			numread = read(fd, scanbuf, sizeof(scanbuf));	/* flawfinder: ignore */
-			/*
-			 * flawfinder rationale: each time around the loop
-			 * we are always reading into the start of the
-			 * buffer, not moving along it, so the bounding is
-			 * OK.
-			 */
-			if (numread < 0) {
-				pv_error("%s: %s", state->files.filename[file_idx], strerror(errno));
-				state->status.exit_status |= PV_ERROREXIT_ACCESS;
-				break;
-			} else if (0 == numread) {
-				break;
-			}
-			for (buf_idx = 0; buf_idx < numread; buf_idx++) {
-				if (state->control.null_terminated_lines) {
-					if ('\0' == scanbuf[buf_idx])
-						total++;
-				} else {
-					if ('\n' == scanbuf[buf_idx])
-						total++;
-				}
-			}
-		}
-
-		if (0 != lseek(fd, 0, SEEK_SET)) {
-			pv_error("%s: %s", state->files.filename[file_idx], strerror(errno));
-			state->status.exit_status |= PV_ERROREXIT_ACCESS;
-		}
-
-		(void) close(fd);
-	}
-
-	return total;
+	return pv_prescan_count(state);
 }
 
 
@@ -270,10 +220,24 @@ static off_t pv_calc_total_lines(pvstate_t state)
  * files, using either pv_calc_total_bytes() or pv_calc_total_lines()
  * depending on whether state->control.linemode is true.
  *
+ * The lines of the input say nothing about the lines the codec will
+ * produce from it, so with --compress or --decompress in line mode, the
+ * size is left unknown.  With "--record", only fixed-size records can be
+ * counted without reading everything, so for any other framing the size
+ * is left unknown too.
+ *
  * Returns the total size, or 0 if it is unknown.
  */
 off_t pv_calc_total_size(pvstate_t state)
 {
+	if (state->control.linemode && (PV_CODEC_NONE != state->control.codec))
+		return 0;
+
+	if (PV_RECORD_FIXED == state->control.record.type)
+		return pv_calc_total_bytes(state) / (off_t) (state->control.record.size);
+	if (PV_RECORD_NONE != state->control.record.type)
+		return 0;
+
 	if (state->control.linemode) {
 		return pv_calc_total_lines(state);
 	} else {
@@ -282,6 +246,37 @@ off_t pv_calc_total_size(pvstate_t state)
 }
 
 
+/*
+ * Start working out the total size in the background, so that the transfer
+ * doesn't have to wait for it; the main loop will then update the size as
+ * the calculation progresses.  This is worth doing for the line count,
+ * since it means reading all of the input, and for the byte count when
+ * there are enough input files for stat()ing them all to take a while.
+ * With "--line-estimate", the line count is instead estimated from a
+ * sample of the input, which is quick enough to do here and now, and the
+ * main loop refines the estimate as the transfer goes on.
+ *
+ * Returns false if the size was not started in the background, in which
+ * case pv_calc_total_size() should be used instead.
+ */
+bool pv_calc_total_size_start(pvstate_t state)
+{
+	if (state->control.linemode && (PV_CODEC_NONE != state->control.codec))
+		return false;
+	if (PV_RECORD_NONE != state->control.record.type)
+		return false;
+	if (state->control.linemode && state->control.line_estimate && pv_linesample_start(state))
+		return true;
+#ifdef HAVE_PTHREAD
+	if (state->control.linemode)
+		return pv_prescan_start(state);
+	return pv_sizescan_start(state);
+#else
+	return false;
+#endif
+}
+
+
 /*
  * Close the given file descriptor and open the next one, whose number in
  * the list is "filenum", returning the new file descriptor (or negative on
@@ -299,6 +294,8 @@ int pv_next_file(pvstate_t state, unsigned int filenum, int oldfd)
 	char *next_filename;
 
 	if (oldfd >= 0) {
+		pv_poller_forget(&(state->transfer), oldfd);
+		pv_dropbehind_input_done(state, oldfd);
 		if (0 != close(oldfd)) {
 			pv_error("%s: %s", _("failed to close file"), strerror(errno));
 			state->status.exit_status |= PV_ERROREXIT_TRANSITION;
@@ -322,17 +319,41 @@ int pv_next_file(pvstate_t state, unsigned int filenum, int oldfd)
 		}
 	}
 
-	if ((NULL == next_filename) || (0 == strcmp(next_filename, "-"))) {
+	if (((NULL == next_filename) || (0 == strcmp(next_filename, "-"))) && (state->control.input_fd >= 0)) {
+		fd = state->control.input_fd;
+	} else if ((NULL == next_filename) || (0 == strcmp(next_filename, "-"))) {
 		fd = STDIN_FILENO;
+	} else if (pv_net_is_address(next_filename)) {
+		if (state->control.streams > 1) {
+			fd = pv_stripe_input_open(state, next_filename, state->control.streams,
+						  state->control.target_buffer_size);
+		} else {
+			fd = pv_net_open(next_filename, false, state->control.target_buffer_size);
+		}
+		if (fd < 0) {
+			state->status.exit_status |= PV_ERROREXIT_ACCESS;
+			return -1;
+		}
 	} else {
-		fd = open(next_filename, O_RDONLY);	/* flawfinder: ignore */
-		/*
-		 * flawfinder rationale: the input file list is under the
-		 * control of the operator by its nature, so we can't refuse
-		 * to open symlinks etc as that would be counterintuitive.
-		 */
+		int open_errno = 0;
+
+		fd = -1;
+#ifdef HAVE_PTHREAD
+		/* The file may already have been opened in the background. */
+		if (!pv_prefetch_take(state, filenum, &fd, &open_errno))
+#endif
+		{
+			fd = open(next_filename, O_RDONLY);	/* flawfinder: ignore */
+			/*
+			 * flawfinder rationale: the input file list is under
+			 * the control of the operator by its nature, so we
+			 * can't refuse to open symlinks etc as that would be
+			 * counterintuitive.
+			 */
+			open_errno = errno;
+		}
 		if (fd < 0) {
-			pv_error("%s: %s: %s", _("failed to read file"), next_filename, strerror(errno));
+			pv_error("%s: %s: %s", _("failed to read file"), next_filename, strerror(open_errno));
 			state->status.exit_status |= PV_ERROREXIT_ACCESS;
 			return -1;
 		}
@@ -376,25 +397,17 @@ int pv_next_file(pvstate_t state, unsigned int filenum, int oldfd)
 	}
 
 	state->status.current_input_file = filenum;
-#ifdef O_DIRECT
-	/*
-	 * Set or clear O_DIRECT on the file descriptor.
-	 */
-	if (0 != fcntl(fd, F_SETFL, (state->control.direct_io ? O_DIRECT : 0) | fcntl(fd, F_GETFL))) {
-		/*@-compdef@ */
-		/*
-		 * splint - passed or returned storage is undefined - but at
-		 * this point we know the input file list is been populated,
-		 * so that's OK.
-		 */
-		debug("%s: %s: %s", pv_current_file_name(state), "fcntl", strerror(errno));
-		/*@+compdef@ */
-	}
+
 	/*
-	 * We don't clear direct_io_changed here, to avoid race conditions
-	 * that could cause the input and output settings to differ.
+	 * The new file may well have the same descriptor number as the
+	 * last one, so forget what was found out about the old file's holes,
+	 * and whether it could be used with --direct-io or "--engine mmap".
 	 */
-#endif				/* O_DIRECT */
+	state->transfer.hole_checked_fd = -1;
+	state->transfer.direct_checked_fd = -1;
+	state->transfer.mmap_checked_fd = -1;
+
+	pv_checkpoint_input_opened(state, filenum, fd);
 
 	debug("%s: %d: %s: fd=%d", "next file opened", filenum, pv_current_file_name(state), fd);
 
@@ -466,6 +479,44 @@ int pv_next_file(pvstate_t state, unsigned int filenum, int oldfd)
 }
 
 
+/*
+ * Populate the filename buffer with the name of the per-process file
+ * "kind" for process "pid", in /run/user/<uid>, or under $HOME/.pv if
+ * "fallback" is true - the same places as the --remote control files.  If
+ * "create_dir" is true, the $HOME/.pv directory is created if it's
+ * missing.  Returns false if there is no usable name.
+ */
+bool pv_runtime_filename(char *filename, size_t bufsize, const char *kind, pid_t pid, bool fallback, bool create_dir)
+{
+	char *home_dir;
+
+	if (!fallback) {
+		(void) pv_snprintf(filename, bufsize, "/run/user/%lu/pv.%s.%lu", (unsigned long) geteuid(), kind,
+				   (unsigned long) pid);
+		return true;
+	}
+
+	home_dir = getenv("HOME");	    /* flawfinder: ignore */
+	if ((NULL == home_dir) || ('\0' == home_dir[0]))
+		return false;
+
+	/*
+	 * flawfinder rationale: null and zero-size values are rejected, and
+	 * the destination buffer is bounded.
+	 */
+
+	if (create_dir) {
+		(void) pv_snprintf(filename, bufsize, "%s/.pv", home_dir);
+		/* In case of weird umask, explicitly chmod a new dir. */
+		if (0 == mkdir(filename, 0700))
+			(void) chmod(filename, 0700);	/* flawfinder: ignore */
+	}
+
+	(void) pv_snprintf(filename, bufsize, "%s/.pv/%s.%lu", home_dir, kind, (unsigned long) pid);
+	return true;
+}
+
+
 /*
  * Return a stream pointer, and populate the filename buffer, for a control
  * file associated with a particular process ID, for the given signal
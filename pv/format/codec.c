@@ -0,0 +1,100 @@
+/*
+ * Formatter functions for the rates and ratio of "--compress" and
+ * "--decompress".
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+
+/*
+ * Show a codec rate, in the same way as the transfer rate.
+ */
+static pvdisplay_bytecount_t pv__formatter_codec_rate(pvformatter_args_t args, bool compressed)
+{
+	char content[128];		 /* flawfinder: ignore - always bounded */
+	long double raw_rate, compressed_rate, ratio, rate;
+	pvtransfercount_t count_type;
+
+	content[0] = '\0';
+
+	if (0 == args->buffer_size)
+		return 0;
+
+	raw_rate = 0.0;
+	compressed_rate = 0.0;
+	ratio = 0.0;
+	if (!pv_codec_rates(args->transfer, &raw_rate, &compressed_rate, &ratio))
+		return 0;
+
+	rate = compressed ? compressed_rate : raw_rate;
+
+	/* The codec counts bytes, even in line mode. */
+	count_type = args->display->count_type;
+	if (PV_TRANSFERCOUNT_LINES == count_type)
+		count_type = PV_TRANSFERCOUNT_BYTES;
+
+	/*@-mustfreefresh@ */
+	if (args->control->numeric) {
+		(void) pv_snprintf(content, sizeof(content), "%.4Lf", (args->control->bits ? 8.0 : 1.0) * rate);
+	} else if (args->control->bits) {
+		pv_describe_amount(content, sizeof(content), "[%s]", 8 * rate, "", _("b/s"), count_type);
+	} else {
+		pv_describe_amount(content, sizeof(content), "[%s]", rate, _("/s"), _("B/s"), count_type);
+	}
+	/*@+mustfreefresh@ *//* splint: see rate.c. */
+
+	return pv_formatter_segmentcontent(content, args);
+}
+
+
+/*
+ * Rate of the uncompressed data.
+ */
+pvdisplay_bytecount_t pv_formatter_raw_rate(pvformatter_args_t args)
+{
+	return pv__formatter_codec_rate(args, false);
+}
+
+
+/*
+ * Rate of the compressed data.
+ */
+pvdisplay_bytecount_t pv_formatter_compressed_rate(pvformatter_args_t args)
+{
+	return pv__formatter_codec_rate(args, true);
+}
+
+
+/*
+ * Compression ratio so far - uncompressed bytes per compressed byte.
+ */
+pvdisplay_bytecount_t pv_formatter_ratio(pvformatter_args_t args)
+{
+	char content[64];		 /* flawfinder: ignore - always bounded */
+	long double raw_rate, compressed_rate, ratio;
+
+	content[0] = '\0';
+
+	if (0 == args->buffer_size)
+		return 0;
+
+	raw_rate = 0.0;
+	compressed_rate = 0.0;
+	ratio = 0.0;
+	if (!pv_codec_rates(args->transfer, &raw_rate, &compressed_rate, &ratio))
+		return 0;
+
+	if (args->control->numeric) {
+		(void) pv_snprintf(content, sizeof(content), "%.4Lf", ratio);
+	} else {
+		(void) pv_snprintf(content, sizeof(content), "%.2Lf:1", ratio);
+	}
+
+	return pv_formatter_segmentcontent(content, args);
+}
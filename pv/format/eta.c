@@ -10,6 +10,8 @@
 #include "pv.h"
 #include "pv-internal.h"
 
+#include <string.h>
+
 
 /*
  * Estimated time until completion.
@@ -17,6 +19,7 @@
 pvdisplay_bytecount_t pv_formatter_eta(pvformatter_args_t args)
 {
 	char content[128];		 /* flawfinder: ignore - always bounded */
+	size_t content_bytes;
 	long eta;
 
 	content[0] = '\0';
@@ -32,7 +35,7 @@ pvdisplay_bytecount_t pv_formatter_eta(pvformatter_args_t args)
 
 	eta =
 	    pv_seconds_remaining((args->transfer->transferred - args->display->initial_offset),
-				 args->control->size - args->display->initial_offset, args->calc->current_avg_rate);
+				 args->control->size - args->display->initial_offset, args->calc->eta_rate);
 
 	/*
 	 * Bounds check, so we don't overrun the suffix buffer.  This means
@@ -42,20 +45,16 @@ pvdisplay_bytecount_t pv_formatter_eta(pvformatter_args_t args)
 
 	/*
 	 * If the ETA is more than a day, include a day count as well as
-	 * hours, minutes, and seconds.
+	 * hours, minutes, and seconds.  While the total size is still only
+	 * an estimate, mark the ETA with a "~".
 	 */
 	/*@-mustfreefresh@ */
-	if (eta > 86400L) {
-		(void) pv_snprintf(content,
-				   sizeof(content),
-				   "%.16s %ld:%02ld:%02ld:%02ld",
-				   _("ETA"), eta / 86400, (eta / 3600) % 24, (eta / 60) % 60, eta % 60);
-	} else {
-		(void) pv_snprintf(content,
-				   sizeof(content),
-				   "%.16s %ld:%02ld:%02ld", _("ETA"), eta / 3600, (eta / 60) % 60, eta % 60);
-	}
+	(void) pv_snprintf(content, sizeof(content), "%.16s %s", _("ETA"), args->control->size_provisional ? "~" : "");
 	/*@+mustfreefresh@ *//* splint: see above. */
+	content_bytes = strlen(content);    /* flawfinder: ignore */
+	/* flawfinder: always bounded with \0 by pv_snprintf(). */
+	(void) pv_describe_duration(content + content_bytes, sizeof(content) - content_bytes, eta,
+				    eta > 86400L ? true : false);
 
 	/*
 	 * If this is the final update, show a blank space where the ETA
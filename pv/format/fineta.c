@@ -48,7 +48,7 @@ pvdisplay_bytecount_t pv_formatter_fineta(pvformatter_args_t args)
 	 */
 
 	eta = pv_seconds_remaining(args->transfer->transferred - args->display->initial_offset,
-				   args->control->size - args->display->initial_offset, args->calc->current_avg_rate);
+				   args->control->size - args->display->initial_offset, args->calc->eta_rate);
 
 	/* Bounds check - see pv_formatter_eta(). */
 	eta = pv_bound_long(eta, 0, (long) 360000000L);
@@ -77,7 +77,8 @@ pvdisplay_bytecount_t pv_formatter_fineta(pvformatter_args_t args)
 		size_t content_bytes;
 
 		/*@-mustfreefresh@ */
-		(void) pv_snprintf(content, sizeof(content), "%.16s ", _("FIN"));
+		(void) pv_snprintf(content, sizeof(content), "%.16s %s", _("FIN"),
+				   args->control->size_provisional ? "~" : "");
 		/*@+mustfreefresh@ *//* splint: see above. */
 		content_bytes = strlen(content);	/* flawfinder: ignore */
 		/* flawfinder: always bounded with \0 by pv_snprintf(). */
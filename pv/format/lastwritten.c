@@ -40,6 +40,8 @@ pvdisplay_bytecount_t pv_formatter_last_written(pvformatter_args_t args)
 	if (args->offset + bytes_to_show >= args->buffer_size)
 		return 0;
 
+	pv_capture_last_written(args->display);
+
 	args->segment->offset = args->offset;
 	args->segment->bytes = bytes_to_show;
 
@@ -0,0 +1,27 @@
+/*
+ * Formatter function for the extra outputs given by repeating "-o".
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+
+/*
+ * How each extra output is keeping up.
+ */
+pvdisplay_bytecount_t pv_formatter_outputs(pvformatter_args_t args)
+{
+	char content[512];		 /* flawfinder: ignore - always bounded */
+
+	if (0 == args->buffer_size)
+		return 0;
+
+	pv_fanout_describe(args, content, sizeof(content));
+
+	return pv_formatter_segmentcontent(content, args);
+}
@@ -35,6 +35,8 @@ pvdisplay_bytecount_t pv_formatter_previous_line(pvformatter_args_t args)
 	if (args->offset + bytes_to_show >= args->buffer_size)
 		return 0;
 
+	pv_capture_previous_line(args->display, args->control->null_terminated_lines ? '\0' : '\n');
+
 	args->segment->offset = args->offset;
 	args->segment->bytes = bytes_to_show;
 
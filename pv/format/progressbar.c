@@ -10,6 +10,7 @@
 #include "pv.h"
 #include "pv-internal.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #if HAVE_MATH_H
@@ -29,6 +30,138 @@
  */
 
 
+/*
+ * Return the index into the display's bar styles (and bar templates) of
+ * the style used by this segment.
+ */
+static size_t pv__bar_style_index(pvformatter_args_t args)
+{
+	if (args->segment->parameter > 0 && args->segment->parameter <= PV_BARSTYLE_MAX)
+		return (size_t) (args->segment->parameter - 1);
+	return 0;
+}
+
+
+/*
+ * Make sure the template for the bar style at "style_index" holds at least
+ * "width" full cells and "width" empty cells, rendering it again if the
+ * style has changed or the bar has grown, such as when the terminal is
+ * resized.  It is rendered for the whole width of the segment, which no
+ * bar in it can exceed.  Returns false if no template could be made.
+ *
+ * Each filler counts as one cell, since they are only ever 0 or 1
+ * characters wide (see the description of struct pvbarstyle_s), which is
+ * how the bar-drawing loops counted them.
+ */
+static bool pv__bar_template(pvformatter_args_t args, size_t style_index, pvdisplay_width_t width)
+{
+	struct pvdisplay_bartemplate_s *template;
+	pvbarstyle_t style;
+	struct pvbarstring_spec_s *full_cell;
+	struct pvbarstring_spec_s *empty_cell;
+	size_t needed_size, offset;
+	pvdisplay_width_t cell_idx;
+
+	template = &(args->display->bartemplate[style_index]);
+	style = &(args->display->barstyle[style_index]);
+
+	if (template->style_id == style->style_id && template->width >= width && NULL != template->cells)
+		return true;
+
+	if (width < args->segment->width)
+		width = args->segment->width;
+	if (0 == width || style->filler_entries < 1)
+		return false;
+
+	full_cell = &(style->filler[style->filler_entries - 1]);
+	empty_cell = &(style->filler[0]);
+
+	needed_size = (size_t) width * ((size_t) (full_cell->bytes) + (size_t) (empty_cell->bytes));
+	if (0 == needed_size)
+		return false;
+
+	if (needed_size > template->size || NULL == template->cells) {
+		char *new_cells;
+		new_cells = realloc(template->cells, needed_size);
+		if (NULL == new_cells)
+			return false;
+		template->cells = new_cells;
+		template->size = needed_size;
+	}
+
+	offset = 0;
+	for (cell_idx = 0; cell_idx < width; cell_idx++) {
+		memcpy(template->cells + offset, full_cell->string, full_cell->bytes);	/* flawfinder: ignore */
+		offset += full_cell->bytes;
+	}
+	for (cell_idx = 0; cell_idx < width; cell_idx++) {
+		memcpy(template->cells + offset, empty_cell->string, empty_cell->bytes);	/* flawfinder: ignore */
+		offset += empty_cell->bytes;
+	}
+	/* flawfinder - the buffer was sized for exactly this many cells. */
+
+	template->width = width;
+	template->style_id = style->style_id;
+
+	debug("%s: %d: %d %s, %ld %s", "bar template rendered", (int) style_index, (int) width, "cells",
+	      (long) needed_size, "bytes");
+
+	return true;
+}
+
+
+/*
+ * Append "count" full cells (if "full" is true) or empty cells of the
+ * style at "style_index" to the buffer, as a slice of the style's
+ * template.  As with append_to_buffer(), only whole cells are added, and
+ * only while there is room.
+ */
+static void pv__bar_cells(pvformatter_args_t args, size_t style_index, bool full, pvdisplay_width_t count,
+			  char *buffer, pvdisplay_bytecount_t buffer_size, pvdisplay_bytecount_t *offset_ptr)
+{
+	struct pvdisplay_bartemplate_s *template;
+	pvbarstyle_t style;
+	struct pvbarstring_spec_s *cell;
+	pvdisplay_bytecount_t buffer_offset, fits;
+	const char *source;
+
+	if (0 == count)
+		return;
+
+	style = &(args->display->barstyle[style_index]);
+	cell = &(style->filler[full && style->filler_entries > 0 ? style->filler_entries - 1 : 0]);
+	buffer_offset = *offset_ptr;
+
+	if (!pv__bar_template(args, style_index, count)) {
+		/* No template - fall back to adding the cells one by one. */
+		for (; count > 0; count--) {
+			append_to_buffer((*cell));
+		}
+		*offset_ptr = buffer_offset;
+		return;
+	}
+
+	if (0 == cell->bytes || buffer_offset >= buffer_size)
+		return;
+
+	/* The number of cells that append_to_buffer() would have added. */
+	fits = (buffer_size - buffer_offset - 1) / cell->bytes;
+	if (fits > (pvdisplay_bytecount_t) count)
+		fits = (pvdisplay_bytecount_t) count;
+
+	/* The empty cells follow all of the full ones. */
+	template = &(args->display->bartemplate[style_index]);
+	source = template->cells;
+	if (!full)
+		source += (size_t) (template->width) * (size_t) (style->filler[style->filler_entries - 1].bytes);
+
+	memcpy(buffer + buffer_offset, source, (size_t) fits * cell->bytes);	/* flawfinder: ignore */
+	/* flawfinder - "fits" is bounded by the room left in the buffer. */
+
+	*offset_ptr = buffer_offset + fits * cell->bytes;
+}
+
+
 /*
  * Write a progress bar to a buffer, in known-size or rate-gauge mode - a
  * bar, and a percentage (size) or max rate (gauge).  The total width of the
@@ -55,16 +188,14 @@ static pvdisplay_bytecount_t pv_formatter_progress_knownsize(pvformatter_args_t
 	pvdisplay_width_t bar_area_width, filled_bar_width, pad_count;
 	double bar_percentage;
 	pvbarstyle_t style;
+	size_t style_index;
 	pvdisplay_bytecount_t full_cell_index;
 	bool has_tip = false;
 
 	buffer[0] = '\0';
 
-	if (args->segment->parameter > 0 && args->segment->parameter <= PV_BARSTYLE_MAX) {
-		style = &(args->display->barstyle[args->segment->parameter - 1]);
-	} else {
-		style = &(args->display->barstyle[0]);
-	}
+	style_index = pv__bar_style_index(args);
+	style = &(args->display->barstyle[style_index]);
 
 	full_cell_index = style->filler_entries;
 	if (full_cell_index > 0)
@@ -147,13 +278,8 @@ static pvdisplay_bytecount_t pv_formatter_progress_knownsize(pvformatter_args_t
 	}
 
 	/* The bar portion. */
-	pad_count = 0;
-	while (pad_count < filled_bar_width && pad_count < bar_area_width) {
-		append_to_buffer(style->filler[full_cell_index]);
-		pad_count += style->filler[full_cell_index].width;
-		if (0 == style->filler[full_cell_index].width)
-			pad_count++;
-	}
+	pad_count = filled_bar_width < bar_area_width ? filled_bar_width : bar_area_width;
+	pv__bar_cells(args, style_index, true, pad_count, buffer, buffer_size, &buffer_offset);
 
 	/* The tip of the bar, if not at 100%. */
 	if (has_tip && pad_count < bar_area_width) {
@@ -178,12 +304,8 @@ static pvdisplay_bytecount_t pv_formatter_progress_knownsize(pvformatter_args_t
 	}
 
 	/* The spaces after the bar. */
-	while (pad_count < bar_area_width) {
-		append_to_buffer(style->filler[0]);
-		pad_count += style->filler[0].width;
-		if (0 == style->filler[0].width)
-			pad_count++;
-	}
+	if (pad_count < bar_area_width)
+		pv__bar_cells(args, style_index, false, bar_area_width - pad_count, buffer, buffer_size, &buffer_offset);
 
 	if (bar_sides) {
 		/* The closure of the bar area. */
@@ -220,14 +342,12 @@ static pvdisplay_bytecount_t pv_formatter_progress_unknownsize(pvformatter_args_
 	pvdisplay_width_t bar_area_width, pad_count;
 	double indicator_position, padding_width;
 	pvbarstyle_t style;
+	size_t style_index;
 
 	buffer[0] = '\0';
 
-	if (args->segment->parameter > 0 && args->segment->parameter <= PV_BARSTYLE_MAX) {
-		style = &(args->display->barstyle[args->segment->parameter - 1]);
-	} else {
-		style = &(args->display->barstyle[0]);
-	}
+	style_index = pv__bar_style_index(args);
+	style = &(args->display->barstyle[style_index]);
 
 	if (bar_sides) {
 		if (args->segment->width < (style->indicator.width + 3))
@@ -268,14 +388,11 @@ static pvdisplay_bytecount_t pv_formatter_progress_unknownsize(pvformatter_args_
 	}
 
 	/* The spaces before the indicator. */
-	pad_count = 0;
 	padding_width = (((double) bar_area_width) * indicator_position) / 100.0;
-	while (pad_count < bar_area_width && pad_count < (pvdisplay_width_t) padding_width) {
-		append_to_buffer(style->filler[0]);
-		pad_count += style->filler[0].width;
-		if (0 == style->filler[0].width)
-			pad_count++;
-	}
+	pad_count = (pvdisplay_width_t) padding_width;
+	if (pad_count > bar_area_width)
+		pad_count = bar_area_width;
+	pv__bar_cells(args, style_index, false, pad_count, buffer, buffer_size, &buffer_offset);
 
 	/* The indicator. */
 	if (buffer_offset < buffer_size - style->indicator.bytes) {
@@ -283,12 +400,8 @@ static pvdisplay_bytecount_t pv_formatter_progress_unknownsize(pvformatter_args_
 	}
 
 	/* The spaces after the indicator. */
-	while (pad_count < bar_area_width) {
-		append_to_buffer(style->filler[0]);
-		pad_count += style->filler[0].width;
-		if (0 == style->filler[0].width)
-			pad_count++;
-	}
+	if (pad_count < bar_area_width)
+		pv__bar_cells(args, style_index, false, bar_area_width - pad_count, buffer, buffer_size, &buffer_offset);
 
 	if (bar_sides) {
 		/* The closure of the bar area. */
@@ -93,46 +93,34 @@ struct sgr_keyword_map_s {
 
 
 /*
- * Display SGR codes if colour output is supported.
+ * Write the SGR escape sequence for the comma or semicolon separated
+ * keywords and code numbers in "parameter" into "content", which must be
+ * "content_size" bytes, and set *most_recent_code to the last code in the
+ * sequence, or -1 if there were none.  Returns the length written.
  */
-pvdisplay_bytecount_t pv_formatter_sgr(pvformatter_args_t args)
+static pvdisplay_bytecount_t pv__sgr_compile(const char *parameter, pvdisplay_bytecount_t parameter_bytes,
+					     char *content, size_t content_size, int *most_recent_code)
 {
 	/*@keep@ */ static struct sgr_keyword_map_s *keywords;
-	char content[1024];		 /* flawfinder: ignore */
 	pvdisplay_bytecount_t write_position, read_position, keyword_start, keyword_length;
-	int numeric_value, code_count, most_recent_code;
-
-	/* flawfinder - null-terminated and bounded with pv_snprintf(). */
-
-	if (!args->display->colour_permitted)
-		return 0;
-
-	args->display->format_uses_colour = true;
-
-	if (!args->status->terminal_supports_colour)
-		return 0;
-	if (NULL == args->segment->string_parameter)
-		return 0;
-	if (0 == args->segment->string_parameter_bytes)
-		return 0;
+	int numeric_value, code_count;
 
 	keywords = sgr_keywords();
 
 	write_position = 0;
 	content[0] = '\0';
 
-	debug("%p+%d [%.*s]", args->segment->string_parameter, args->segment->string_parameter_bytes,
-	      args->segment->string_parameter_bytes, args->segment->string_parameter);
+	debug("%p+%d [%.*s]", parameter, parameter_bytes, parameter_bytes, parameter);
 
 	read_position = 0;
 	keyword_start = 0;
 	keyword_length = 0;
 	numeric_value = -1;
 	code_count = 0;
-	most_recent_code = -1;
+	*most_recent_code = -1;
 
-	while (read_position < args->segment->string_parameter_bytes) {
-		char read_char = args->segment->string_parameter[read_position++];
+	while (read_position < parameter_bytes) {
+		char read_char = parameter[read_position++];
 		if ((',' == read_char) || (';' == read_char)) {
 			keyword_length = read_position - keyword_start;
 			if (keyword_length > 0)
@@ -146,7 +134,7 @@ pvdisplay_bytecount_t pv_formatter_sgr(pvformatter_args_t args)
 			} else {
 				numeric_value = -1;
 			}
-			if (read_position >= args->segment->string_parameter_bytes) {
+			if (read_position >= parameter_bytes) {
 				keyword_length = read_position - keyword_start;
 			}
 		}
@@ -154,7 +142,7 @@ pvdisplay_bytecount_t pv_formatter_sgr(pvformatter_args_t args)
 			int code = -1;
 
 			debug("keyword@%d+%d: [%.*s]; numeric=%d", keyword_start, keyword_length, keyword_length,
-			      &(args->segment->string_parameter[keyword_start]), numeric_value);
+			      &(parameter[keyword_start]), numeric_value);
 
 			if (numeric_value >= 0 && numeric_value < 255) {
 				code = numeric_value;
@@ -166,7 +154,7 @@ pvdisplay_bytecount_t pv_formatter_sgr(pvformatter_args_t args)
 						continue;
 					if (0 !=
 					    strncmp(keywords[keyword_index].keyword,
-						    &(args->segment->string_parameter[keyword_start]), keyword_length))
+						    &(parameter[keyword_start]), keyword_length))
 						continue;
 					code = (int) (keywords[keyword_index].code);
 				}
@@ -177,23 +165,23 @@ pvdisplay_bytecount_t pv_formatter_sgr(pvformatter_args_t args)
 			if (code >= 0) {
 				if (code_count > 15) {
 					write_position +=
-					    pv_snprintf(content + write_position, sizeof(content) - write_position,
+					    pv_snprintf(content + write_position, content_size - write_position,
 							"%s", "m");
 					code_count = 0;
 				}
 				if (0 == code_count) {
 					write_position +=
-					    pv_snprintf(content + write_position, sizeof(content) - write_position,
+					    pv_snprintf(content + write_position, content_size - write_position,
 							"%s", "\033[");
 				} else {
 					write_position +=
-					    pv_snprintf(content + write_position, sizeof(content) - write_position,
+					    pv_snprintf(content + write_position, content_size - write_position,
 							"%s", ";");
 				}
 				write_position +=
-				    pv_snprintf(content + write_position, sizeof(content) - write_position, "%d", code);
+				    pv_snprintf(content + write_position, content_size - write_position, "%d", code);
 				code_count++;
-				most_recent_code = code;
+				*most_recent_code = code;
 			}
 
 			keyword_length = 0;
@@ -202,7 +190,58 @@ pvdisplay_bytecount_t pv_formatter_sgr(pvformatter_args_t args)
 	}
 
 	if (code_count > 0)
-		write_position += pv_snprintf(content + write_position, sizeof(content) - write_position, "%s", "m");
+		write_position += pv_snprintf(content + write_position, content_size - write_position, "%s", "m");
+
+	return write_position;
+}
+
+
+/*
+ * Display SGR codes if colour output is supported.
+ *
+ * The escape sequence depends only on the format string, so it is worked
+ * out once when the format is parsed, and then just copied on each update.
+ */
+pvdisplay_bytecount_t pv_formatter_sgr(pvformatter_args_t args)
+{
+	char content[1024];		 /* flawfinder: ignore */
+	int most_recent_code;
+
+	/* flawfinder - null-terminated and bounded with pv_snprintf(). */
+
+	if ((0 == args->buffer_size) && (NULL != args->segment->string_parameter)
+	    && (args->segment->string_parameter_bytes > 0)) {
+		pvdisplay_bytecount_t content_bytes;
+		content_bytes =
+		    pv__sgr_compile(args->segment->string_parameter, args->segment->string_parameter_bytes, content,
+				    sizeof(content), &most_recent_code);
+		(void) pv_formatter_precompute(args, content, content_bytes,
+					       (int8_t) (most_recent_code > 0 ? 1 : (0 == most_recent_code ? 0 : -1)));
+	}
+
+	if (!args->display->colour_permitted)
+		return 0;
+
+	args->display->format_uses_colour = true;
+
+	if (!args->status->terminal_supports_colour)
+		return 0;
+	if (NULL == args->segment->string_parameter)
+		return 0;
+	if (0 == args->segment->string_parameter_bytes)
+		return 0;
+
+	if (args->segment->precomputed_valid) {
+		if (args->segment->precomputed_effect > 0) {
+			args->display->sgr_code_active = true;
+		} else if (0 == args->segment->precomputed_effect) {
+			args->display->sgr_code_active = false;
+		}
+		return pv_formatter_precomputed(args);
+	}
+
+	(void) pv__sgr_compile(args->segment->string_parameter, args->segment->string_parameter_bytes, content,
+			       sizeof(content), &most_recent_code);
 
 	if (most_recent_code > 0) {
 		args->display->sgr_code_active = true;
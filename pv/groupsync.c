@@ -0,0 +1,236 @@
+/*
+ * Functions for "--sync-every" and "--sync-interval", which make the output
+ * durable in groups of writes rather than syncing after every one.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * The output is followed in windows of PV_GROUPSYNC_WINDOW bytes, or of
+ * "--sync-every" bytes if that is smaller.  When a window is complete,
+ * writeback of it is started with sync_file_range(), and the window
+ * before it is waited for, by which point its writeback has normally had
+ * a whole window's worth of writes to overlap with.
+ *
+ * That only pushes the data towards the disk.  The data is only made
+ * durable by a full fdatasync(): one is done once "--sync-every" bytes
+ * have been written since the last one, or "--sync-interval" seconds
+ * have passed since then, and one more at the end of the transfer.  So at
+ * most that much data is ever at risk, and each full sync mostly finds
+ * its data already written.
+ *
+ * Without sync_file_range(), only the full syncs are done.  Only regular
+ * files and block devices are windowed; anything else, such as a pipe,
+ * only gets the full syncs, which ignore everything but EIO as with
+ * "--sync" on its own.
+ */
+#define PV_GROUPSYNC_WINDOW	((off_t) 4194304)	/* bytes per writeback step */
+
+struct pvgroupsync_s {
+	struct timespec last_sync;	 /* when the last full sync was done */
+	off_t since_sync;		 /* bytes written since then */
+	off_t window_bytes;		 /* bytes written in the current window */
+	off_t window_size;		 /* bytes per window */
+	off_t window_start;		 /* output offset the current window started at */
+	off_t previous_start;		 /* output offset of the window being written back */
+	off_t previous_end;		 /* where that window ends (same as start if none) */
+	bool windowed;			 /* set if the output has a page cache to window */
+};
+
+
+/*
+ * Return the current output offset, or -1 if it isn't known.
+ */
+static off_t pv__groupsync_position(pvstate_t state)
+{
+	return lseek(state->control.output_fd, 0, SEEK_CUR);
+}
+
+
+/*
+ * Do a full sync of the output, reporting an I/O error and returning false
+ * if there is one.  Other errors, such as the output not being syncable,
+ * are ignored.
+ */
+static bool pv__groupsync_full(pvstate_t state, struct pvgroupsync_s *groupsync)
+{
+	int rc;
+
+	debug("%s: %lld %s", "full sync", (long long) (groupsync->since_sync), "bytes");
+
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+	rc = fdatasync(state->control.output_fd);
+#else
+	rc = fsync(state->control.output_fd);
+#endif
+
+	pv_elapsedtime_read(&(groupsync->last_sync));
+	groupsync->since_sync = 0;
+
+	/* Everything written so far is now on disk, so no window is pending. */
+	if (groupsync->windowed) {
+		off_t position = pv__groupsync_position(state);
+		if (position >= 0) {
+			groupsync->window_start = position;
+			groupsync->window_bytes = 0;
+		}
+		groupsync->previous_start = groupsync->window_start;
+		groupsync->previous_end = groupsync->window_start;
+	}
+
+	if ((rc < 0) && (EIO == errno)) {
+		/*@-compdef@ */
+		pv_error("%s: %s", pv_current_file_name(state), strerror(errno));
+		/*@+compdef@ */
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Start writeback of the window that has just been completed, and wait for
+ * the one before it.
+ */
+static void pv__groupsync_window(pvstate_t state, struct pvgroupsync_s *groupsync)
+{
+	off_t position;
+
+	position = pv__groupsync_position(state);
+	if (position < groupsync->window_start) {
+		groupsync->window_start = position < 0 ? 0 : position;
+		groupsync->window_bytes = 0;
+		return;
+	}
+
+#ifdef HAVE_SYNC_FILE_RANGE
+	(void) sync_file_range(state->control.output_fd, groupsync->window_start, position - groupsync->window_start,
+			       SYNC_FILE_RANGE_WRITE);
+	if (groupsync->previous_end > groupsync->previous_start) {
+		(void) sync_file_range(state->control.output_fd, groupsync->previous_start,
+				       groupsync->previous_end - groupsync->previous_start,
+				       SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+				       SYNC_FILE_RANGE_WAIT_AFTER);
+	}
+#endif				/* HAVE_SYNC_FILE_RANGE */
+
+	groupsync->previous_start = groupsync->window_start;
+	groupsync->previous_end = position;
+	groupsync->window_start = position;
+	groupsync->window_bytes = 0;
+}
+
+
+/*
+ * Account for "written" more bytes having been written to the output,
+ * moving writeback along and doing a full sync when one is due.  Called
+ * from the main loop after each transfer, when "--sync-every" or
+ * "--sync-interval" is in effect.  Returns false on an I/O error.
+ */
+bool pv_groupsync_update(pvstate_t state, ssize_t written)
+{
+	struct pvgroupsync_s *groupsync;
+
+	if (written <= 0)
+		return true;
+
+	groupsync = state->transfer.groupsync;
+	if (NULL == groupsync) {
+		struct stat sb;
+		off_t position;
+
+		groupsync = calloc(1, sizeof(*groupsync));
+		if (NULL == groupsync)
+			return true;
+		state->transfer.groupsync = groupsync;
+
+		pv_elapsedtime_read(&(groupsync->last_sync));
+
+		groupsync->window_size = PV_GROUPSYNC_WINDOW;
+		if ((state->control.sync_every > 0) && (state->control.sync_every < groupsync->window_size))
+			groupsync->window_size = state->control.sync_every;
+
+		memset(&sb, 0, sizeof(sb));
+		position = pv__groupsync_position(state);
+		if ((0 == fstat(state->control.output_fd, &sb)) && (S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode))
+		    && (position >= 0)) {
+			groupsync->windowed = true;
+			/* This transfer's first writes are already in. */
+			groupsync->window_start = position - (off_t) written;
+			if (groupsync->window_start < 0)
+				groupsync->window_start = 0;
+			groupsync->previous_start = groupsync->window_start;
+			groupsync->previous_end = groupsync->window_start;
+		}
+
+		debug("%s: %s=%lld, %s=%s", "group sync started", "window", (long long) (groupsync->window_size),
+		      "windowed", groupsync->windowed ? "true" : "false");
+	}
+
+	groupsync->since_sync += (off_t) written;
+	groupsync->window_bytes += (off_t) written;
+
+	if ((state->control.sync_every > 0) && (groupsync->since_sync >= state->control.sync_every))
+		return pv__groupsync_full(state, groupsync);
+
+	if (state->control.sync_interval > 0) {
+		struct timespec now, since;
+		pv_elapsedtime_read(&now);
+		pv_elapsedtime_subtract(&since, &now, &(groupsync->last_sync));
+		if (pv_elapsedtime_seconds(&since) >= (long double) (state->control.sync_interval))
+			return pv__groupsync_full(state, groupsync);
+	}
+
+	if (groupsync->windowed && (groupsync->window_bytes >= groupsync->window_size))
+		pv__groupsync_window(state, groupsync);
+
+	return true;
+}
+
+
+/*
+ * At the end of the transfer, do the last full sync if anything has been
+ * written since the last one, and free the group sync state.
+ */
+void pv_groupsync_finish(pvstate_t state)
+{
+	struct pvgroupsync_s *groupsync;
+
+	groupsync = state->transfer.groupsync;
+	if (NULL == groupsync)
+		return;
+
+	if (groupsync->since_sync > 0)
+		(void) pv__groupsync_full(state, groupsync);
+
+	pv_groupsync_free(&(state->transfer));
+}
+
+
+/*
+ * Free the group sync state, if there is any.
+ */
+void pv_groupsync_free(pvtransferstate_t transfer)
+{
+	if ((NULL == transfer) || (NULL == transfer->groupsync))
+		return;
+	free(transfer->groupsync);
+	transfer->groupsync = NULL;
+}
@@ -204,7 +204,9 @@ static void display_word_wrap(const char *string, size_t display_width, size_t l
  * translatable, as they must remain consistent across all locales.
  *
  * The list is terminated with a NULL opt_short value - to leave a gap, set
- * opt_short to an empty string instead.
+ * opt_short to an empty string instead, and leave opt_long NULL.  An
+ * option with no short equivalent has an empty opt_short and a non-NULL
+ * opt_long.
  */
 struct option_definition_s {
 	/*@null@ */ const char *opt_short;
@@ -284,6 +286,9 @@ void display_help(void)
 		{ "-s", "--size", N_("SIZE"),
 		 N_("set estimated data size to SIZE bytes"),
 		 { 0, 0, 0, 0} },
+		{ "", "--uncompressed-size", N_("FILE"),
+		 N_("set size to that of compressed FILE once decompressed"),
+		 { 0, 0, 0, 0} },
 		{ "-g", "--gauge", NULL,
 		 N_("if size unknown, show rate vs max rate"),
 		 { 0, 0, 0, 0} },
@@ -293,12 +298,27 @@ void display_help(void)
 		{ "-0", "--null", NULL,
 		 N_("lines are null-terminated"),
 		 { 0, 0, 0, 0} },
+		{ "", "--line-estimate", NULL,
+		 N_("estimate the line count by sampling the input"),
+		 { 0, 0, 0, 0} },
+		{ "", "--record", N_("SPEC"),
+		 N_("count records framed as SPEC instead of lines"),
+		 { 0, 0, 0, 0} },
 		{ "-i", "--interval", N_("SEC"),
 		 N_("update every SEC seconds"),
 		 { 0, 0, 0, 0} },
 		{ "-m", "--average-rate-window", N_("SEC"),
 		 N_("compute average rate over past SEC seconds (default 30s)"),
 		 { 0, 0, 0, 0} },
+		{ "", "--eta-model", N_("MODEL"),
+		 N_("estimate ETA by \"average\", \"linear\", \"ewma\", or \"phase\""),
+		 { 0, 0, 0, 0} },
+		{ "", "--history", N_("FILE"),
+		 N_("start rate and ETA from earlier transfers kept in FILE"),
+		 { 0, 0, 0, 0} },
+		{ "", "--digest", N_("TYPE"),
+		 N_("show a \"crc32c\", \"xxh64\", or \"sha256\" digest of the output"),
+		 { 0, 0, 0, 0} },
 		{ "-w", "--width", N_("WIDTH"),
 		 N_("assume terminal is WIDTH characters wide"),
 		 { 0, 0, 0, 0} },
@@ -317,6 +337,9 @@ void display_help(void)
 		{ "-v", "--stats", NULL,
 		 N_("output transfer statistics at the end"),
 		 { 0, 0, 0, 0} },
+		{ "", "--self-profile", NULL,
+		 N_("report the time pv itself spent in each phase at the end"),
+		 { 0, 0, 0, 0} },
 		{ "-f", "--force", NULL,
 		 N_("output even if standard error is not a terminal"),
 		 { 0, 0, 0, 0} },
@@ -325,32 +348,110 @@ void display_help(void)
 		 { 0, 0, 0, 0} },
 		{ "", NULL, NULL, NULL, { 0, 0, 0, 0} },
 		{ "-o", "--output", N_("FILE"),
-		 N_("write output to FILE instead of stdout"),
+		 N_("write output to FILE instead of stdout (repeat for more)"),
+		 { 0, 0, 0, 0} },
+		{ "", "--fanout-policy", N_("POLICY"),
+		 N_("\"wait\" for, or \"drop\", extra outputs that lag"),
+		 { 0, 0, 0, 0} },
+		{ "", "--streams", N_("NUM"),
+		 N_("split network transfers across NUM connections"),
+		 { 0, 0, 0, 0} },
+		{ "", "--manifest", N_("FILE"),
+		 N_("copy each SOURCE<tab>DEST pair listed in FILE"),
+		 { 0, 0, 0, 0} },
+		{ "", "--copy-into", N_("DIR"),
+		 N_("copy each FILE into DIR"),
+		 { 0, 0, 0, 0} },
+		{ "", "--jobs", N_("NUM"),
+		 N_("copy NUM files at a time (default 4)"),
+		 { 0, 0, 0, 0} },
+		{ "", "--compress", N_("CODEC[:LEVEL]"),
+		 N_("compress the data with \"zstd\" or \"lz4\""),
+		 { 0, 0, 0, 0} },
+		{ "", "--decompress", N_("CODEC"),
+		 N_("decompress the data with \"zstd\" or \"lz4\""),
 		 { 0, 0, 0, 0} },
 		{ "-L", "--rate-limit", N_("RATE"),
 		 N_("limit transfer to RATE bytes per second"),
 		 { 0, 0, 0, 0} },
+		{ "", "--rate-burst", N_("BYTES"),
+		 N_("let the rate limit catch up by up to BYTES"),
+		 { 0, 0, 0, 0} },
+		{ "", "--rate-budget", N_("NAME"),
+		 N_("share the rate limit with other pv processes using NAME"),
+		 { 0, 0, 0, 0} },
+		{ "", "--rate-weight", N_("NUM"),
+		 N_("take NUM shares of a --rate-budget (default 1)"),
+		 { 0, 0, 0, 0} },
+		{ "", "--latency-target", N_("SEC"),
+		 N_("slow down to keep write latency under SEC seconds"),
+		 { 0, 0, 0, 0} },
+		{ "", "--pressure-target", N_("PCT"),
+		 N_("slow down to keep system I/O stalls under PCT percent"),
+		 { 0, 0, 0, 0} },
+		{ "", "--coalesce", N_("SEC"),
+		 N_("hold small writes back for up to SEC seconds"),
+		 { 0, 0, 0, 0} },
+		{ "", "--coalesce-bytes", N_("BYTES"),
+		 N_("write held data once BYTES are waiting"),
+		 { 0, 0, 0, 0} },
 		{ "-B", "--buffer-size", N_("BYTES"),
-		 N_("use a buffer size of BYTES"),
+		 N_("use a buffer size of BYTES, or tune it with \"auto\""),
+		 { 0, 0, 0, 0} },
+		{ "", "--huge-pages", NULL,
+		 N_("back transfer buffers with huge pages (Linux only)"),
+		 { 0, 0, 0, 0} },
+		{ "", "--lock-buffers", NULL,
+		 N_("lock transfer buffers into memory"),
+		 { 0, 0, 0, 0} },
+		{ "", "--numa-node", N_("NODE"),
+		 N_("keep buffers and threads on NUMA node NODE, or \"auto\""),
+		 { 0, 0, 0, 0} },
+		{ "", "--cpu-affinity", N_("LIST"),
+		 N_("run only on the processors in LIST"),
 		 { 0, 0, 0, 0} },
 		{ "-C", "--no-splice", NULL,
 		 N_("never use splice(), always use read/write"),
 		 { 0, 0, 0, 0} },
+		{ "", "--pipe-size", N_("BYTES"),
+		 N_("set the capacity of pipes, or grow them with \"auto\""),
+		 { 0, 0, 0, 0} },
 		{ "-E", "--skip-errors", NULL,
 		 N_("skip read errors in input"),
 		 { 0, 0, 0, 0} },
 		{ "-Z", "--error-skip-block", N_("BYTES"),
 		 N_("skip errors in BYTES blocks at a time"),
 		 { 0, 0, 0, 0} },
+		{ "", "--rescue", N_("MAPFILE"),
+		 N_("rescue a failing input, keeping a map in MAPFILE"),
+		 { 0, 0, 0, 0} },
+		{ "", "--rescue-retries", N_("NUM"),
+		 N_("retry bad sectors NUM more times with --rescue"),
+		 { 0, 0, 0, 0} },
+		{ "", "--rescue-direct", NULL,
+		 N_("use direct I/O for --rescue retries"),
+		 { 0, 0, 0, 0} },
+		{ "", "--checkpoint", N_("FILE"),
+		 N_("record progress in FILE, and resume from it"),
+		 { 0, 0, 0, 0} },
 		{ "-S", "--stop-at-size", NULL,
 		 N_("stop after --size bytes have been transferred"),
 		 { 0, 0, 0, 0} },
 		{ "-Y", "--sync", NULL,
 		 N_("flush cache to disk after every write"),
 		 { 0, 0, 0, 0} },
+		{ "", "--sync-every", N_("BYTES"),
+		 N_("with --sync, flush only once per BYTES written"),
+		 { 0, 0, 0, 0} },
+		{ "", "--sync-interval", N_("SEC"),
+		 N_("with --sync, flush at least every SEC seconds"),
+		 { 0, 0, 0, 0} },
 		{ "-K", "--direct-io", NULL,
 		 N_("use direct I/O to bypass cache"),
 		 { 0, 0, 0, 0} },
+		{ "", "--drop-behind", NULL,
+		 N_("release cached input and output as the transfer goes"),
+		 { 0, 0, 0, 0} },
 		{ "-O", "--sparse", NULL,
 		 N_("try to seek instead of writing null bytes"),
 		 { 0, 0, 0, 0} },
@@ -360,22 +461,71 @@ void display_help(void)
 		{ "-U", "--store-and-forward", N_("FILE"),
 		 N_("write all input to FILE before writing to output"),
 		 { 0, 0, 0, 0} },
+		{ "", "--spool-memory", N_("SIZE"),
+		 N_("with \"-U -\", hold up to SIZE in memory"),
+		 { 0, 0, 0, 0} },
+#ifdef HAVE_PTHREAD
+		{ "", "--forward-after", N_("SIZE"),
+		 N_("with -U, start writing output once SIZE is stored"),
+		 { 0, 0, 0, 0} },
+#endif				/* HAVE_PTHREAD */
+#ifdef HAVE_PTHREAD
+		{ "", "--pipeline", N_("NUM"),
+		 N_("read input in a separate thread, NUM buffers ahead"),
+		 { 0, 0, 0, 0} },
+#endif				/* HAVE_PTHREAD */
+		{ "", "--engine", N_("NAME"),
+		 N_("transfer data using I/O engine NAME"),
+		 { 0, 0, 0, 0} },
+		{ "", "--engine-cache", N_("FILE"),
+		 N_("remember \"--engine auto\" choices in FILE"),
+		 { 0, 0, 0, 0} },
+		{ "", "--stats-page", NULL,
+		 N_("publish progress in a shared memory page"),
+		 { 0, 0, 0, 0} },
+		{ "", "--stats-fd", N_("FD"),
+		 N_("write a stats record to FD every update"),
+		 { 0, 0, 0, 0} },
+		{ "", "--stats-format", N_("TYPE"),
+		 N_("write records to --stats-fd as \"json\" or \"binary\""),
+		 { 0, 0, 0, 0} },
+		{ "", "--metrics-file", N_("FILE"),
+		 N_("keep Prometheus metrics up to date in FILE"),
+		 { 0, 0, 0, 0} },
+		{ "", "--stall-timeout", N_("SEC"),
+		 N_("report a stall after SEC seconds without progress"),
+		 { 0, 0, 0, 0} },
+		{ "", "--rate-drop", N_("PERCENT"),
+		 N_("report the rate falling below PERCENT of average"),
+		 { 0, 0, 0, 0} },
+		{ "", "--on-stall", N_("CMD"),
+		 N_("run CMD when a stall or rate drop starts or ends"),
+		 { 0, 0, 0, 0} },
 		{ "", NULL, NULL, NULL, { 0, 0, 0, 0} },
 		{ "-d", "--watchfd", N_("PID[:FD]|=NAME|@LISTFILE"),
 		 N_("watch file FD opened by process PID"),
 		 { 0, 0, 0, 0} },
+		{ "", "--tree", NULL,
+		 N_("with -d, also watch child processes"),
+		 { 0, 0, 0, 0} },
 #ifdef PV_REMOTE_CONTROL
 		{ "-R", "--remote", N_("PID"),
 		 N_("update settings of process PID"),
 		 { 0, 0, 0, 0} },
 		{ "-Q", "--query", N_("PID"),
-		 N_("show progress of process PID"),
+		 N_("show progress of process PID, a list of PIDs, or \"all\""),
 		 { 0, 0, 0, 0} },
 #endif				/* PV_REMOTE_CONTROL */
 		{ "", NULL, NULL, NULL, { 0, 0, 0, 0} },
 		{ "-P", "--pidfile", N_("FILE"),
 		 N_("save process ID in FILE"),
 		 { 0, 0, 0, 0} },
+		{ "", "--trace", N_("FILE"),
+		 N_("record transfer events to FILE for debugging"),
+		 { 0, 0, 0, 0} },
+		{ "", "--trace-decode", N_("FILE"),
+		 N_("write a --trace FILE as Chrome trace JSON"),
+		 { 0, 0, 0, 0} },
 		{ "-h", "--help", NULL,
 		 N_("show this help and exit"),
 		 { 0, 0, 0, 0} },
@@ -483,6 +633,8 @@ void display_help(void)
 		option_width += 2 + definition->width.opt_short;	/* "  short" */
 #ifdef HAVE_GETOPT_LONG
 		option_width += 2 + definition->width.opt_long;	/* ", <long>" */
+		if ((0 == definition->width.opt_short) && (definition->width.opt_long > 0))
+			option_width += 2;  /* long-only options line up with the others */
 #endif
 		option_width += 1 + definition->width.opt_argument;	/* " ARG" */
 		option_width += 2;	    /* final 2 spaces */
@@ -523,9 +675,19 @@ void display_help(void)
 		}
 #ifdef HAVE_GETOPT_LONG
 		if (definition->width.opt_long > 0 && NULL != definition->opt_long) {
-			printf(", %s", definition->opt_long);
-			option_width += 2 + definition->width.opt_long;
+			if (0 == definition->width.opt_short) {
+				/* No short option - pad to where it would be. */
+				printf("      %s", definition->opt_long);
+				option_width += 6 + definition->width.opt_long;
+			} else {
+				printf(", %s", definition->opt_long);
+				option_width += 2 + definition->width.opt_long;
+			}
 		}
+#else
+		/* Long-only options can't be used without getopt_long(). */
+		if ((0 == definition->width.opt_short) && (NULL != definition->opt_long))
+			continue;
 #endif
 		if (definition->width.opt_argument > 0 && NULL != definition->opt_argument) {
 			printf(" %s", definition->opt_argument);
@@ -539,11 +701,12 @@ void display_help(void)
 		}
 
 		/*
-		 * If the option is too wide, start a new line for the
+		 * If the option is too wide to leave a gap of 2 spaces
+		 * before the description, start a new line for the
 		 * description.  In both cases, pad with spaces up to the
 		 * description left margin.
 		 */
-		if (option_width > description_left_margin) {
+		if (option_width + 2 > description_left_margin) {
 			printf("\n%*s", (int) description_left_margin, "");
 		} else if (option_width < description_left_margin) {
 			printf("%*s", (int) (description_left_margin - option_width), "");
@@ -0,0 +1,524 @@
+/*
+ * Functions for "--history", which remembers how fast earlier transfers
+ * between the same places went, to start the rate and ETA from.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+/*
+ * Each transfer is identified by what it is measured in, and where it
+ * reads from and writes to: the filesystem device for a regular file, the
+ * device itself for a disk or other device, the peer's address and port
+ * for a network socket, or just "pipe" for a pipe.  Only the first input
+ * is looked at.
+ *
+ * The history file holds one line per transfer key, after a line
+ * identifying it:
+ *
+ *   UNIT SOURCE DESTINATION UPDATED RUNS AVERAGE MINIMUM MAXIMUM RAMP...
+ *
+ * where UPDATED is when the line was last changed, RUNS is how many
+ * transfers it has seen, the rates are per second, and the RAMP is the
+ * average rate in each of the first PV_HISTORY_RAMP_SECONDS seconds of the
+ * transfer, or 0 where a transfer hasn't lasted that long.
+ *
+ * When a transfer finishes, its figures are folded into its line, with
+ * the newest transfer counting for 1 in PV_HISTORY_BLEND_RUNS once there
+ * have been that many, so that the history follows a path that has got
+ * faster or slower without being thrown by one odd transfer.  Transfers
+ * that were rate limited, that failed, or that took less than
+ * PV_HISTORY_MIN_SECONDS, are not recorded, since they say little about
+ * the path.  The file is rewritten through a temporary file and a rename,
+ * so readers always see a whole file; if two transfers finish at once, one
+ * of their updates may be lost.  Only the PV_HISTORY_MAX_ENTRIES most
+ * recently updated lines are kept.
+ *
+ * When a transfer starts, the line for its key, if there is one, is given
+ * to the rate calculations (see calc.c), which mix it in with the live
+ * measurements until the average rate window has filled.
+ */
+#define PV_HISTORY_MAGIC	"pv-history 1"
+#define PV_HISTORY_LINE_LENGTH	1024		 /* longest line we accept */
+#define PV_HISTORY_KEY_LENGTH	256		 /* longest source or destination */
+#define PV_HISTORY_MAX_ENTRIES	1000		 /* lines kept in the file */
+#define PV_HISTORY_BLEND_RUNS	4		 /* newest run counts for 1 in this many */
+#define PV_HISTORY_MIN_SECONDS	1.0L		 /* shortest transfer worth recording */
+
+struct pvhistory_entry_s {
+	char unit[16];			 /* "bytes" or "lines" */
+	char source[PV_HISTORY_KEY_LENGTH];
+	char destination[PV_HISTORY_KEY_LENGTH];
+	long long updated;		 /* time(), when last updated */
+	unsigned long runs;		 /* transfers seen */
+	long double average;		 /* average rate */
+	long double minimum;		 /* lowest rate measured */
+	long double maximum;		 /* highest rate measured */
+	long double ramp[PV_HISTORY_RAMP_SECONDS]; /* rate in each second from the start */
+};
+
+struct pvhistory_s {
+	struct pvhistory_entry_s entry;	 /* this transfer's key, and its figures at the end */
+	long double ramp_elapsed;	 /* elapsed time at the last ramp sample */
+	off_t ramp_transferred;		 /* amount transferred at the last ramp sample */
+	unsigned int ramp_seconds;	 /* seconds of the ramp filled in so far */
+	bool unlimited;			 /* no rate limit was in force at the start */
+};
+
+
+/*
+ * Describe what the file descriptor "fd" is, for the history key, in
+ * "buf".
+ */
+static void pv__history_describe(int fd, char *buf, size_t bufsize)
+{
+	struct stat sb;
+
+	memset(&sb, 0, sizeof(sb));
+	if ((fd < 0) || (0 != fstat(fd, &sb))) {
+		(void) pv_snprintf(buf, bufsize, "%s", "unknown");
+		return;
+	}
+
+	if (S_ISREG(sb.st_mode) || S_ISDIR(sb.st_mode)) {
+		(void) pv_snprintf(buf, bufsize, "file:%llu", (unsigned long long) (sb.st_dev));
+	} else if (S_ISBLK(sb.st_mode)) {
+		(void) pv_snprintf(buf, bufsize, "disk:%llu", (unsigned long long) (sb.st_rdev));
+	} else if (S_ISCHR(sb.st_mode)) {
+		(void) pv_snprintf(buf, bufsize, "device:%llu", (unsigned long long) (sb.st_rdev));
+	} else if (S_ISFIFO(sb.st_mode)) {
+		(void) pv_snprintf(buf, bufsize, "%s", "pipe");
+	} else if (S_ISSOCK(sb.st_mode)) {
+		struct sockaddr_storage peer;
+		socklen_t peer_size;
+		char host[NI_MAXHOST];	 /* flawfinder: ignore - bounded by getnameinfo() */
+		char port[NI_MAXSERV];	 /* flawfinder: ignore - bounded by getnameinfo() */
+
+		memset(&peer, 0, sizeof(peer));
+		peer_size = (socklen_t) sizeof(peer);
+		host[0] = '\0';
+		port[0] = '\0';
+		if ((0 == getpeername(fd, (struct sockaddr *) &peer, &peer_size))
+		    && ((AF_INET == peer.ss_family) || (AF_INET6 == peer.ss_family))
+		    && (0 ==
+			getnameinfo((struct sockaddr *) &peer, peer_size, host, sizeof(host), port, sizeof(port),
+				    NI_NUMERICHOST | NI_NUMERICSERV))) {
+			(void) pv_snprintf(buf, bufsize, "net:%s:%s", host, port);
+		} else {
+			(void) pv_snprintf(buf, bufsize, "%s", "socket");
+		}
+	} else {
+		(void) pv_snprintf(buf, bufsize, "%s", "other");
+	}
+}
+
+
+/*
+ * Parse a line of the history file into "entry", returning false if it
+ * isn't valid.
+ */
+static bool pv__history_parse(const char *line, struct pvhistory_entry_s *entry)
+{
+	const char *ptr;
+	char *end;
+	int consumed;
+	unsigned int second;
+
+	memset(entry, 0, sizeof(*entry));
+	consumed = 0;
+	/* flawfinder: the widths below match the sizes of the fields. */
+	if (8 !=
+	    sscanf(line, "%15s %255s %255s %lld %lu %Lf %Lf %Lf%n", entry->unit, entry->source, entry->destination,
+		   &(entry->updated), &(entry->runs), &(entry->average), &(entry->minimum), &(entry->maximum),
+		   &consumed))
+		return false;
+	if ((consumed <= 0) || (entry->average <= 0.0L))
+		return false;
+
+	ptr = line + consumed;
+	for (second = 0; second < PV_HISTORY_RAMP_SECONDS; second++) {
+		entry->ramp[second] = strtold(ptr, &end);
+		if (end == ptr)
+			break;
+		if (entry->ramp[second] < 0.0L)
+			entry->ramp[second] = 0.0L;
+		ptr = end;
+	}
+
+	return true;
+}
+
+
+/*
+ * Return true if "a" and "b" are for the same transfer key.
+ */
+static bool pv__history_same_key(const struct pvhistory_entry_s *a, const struct pvhistory_entry_s *b)
+{
+	return ((0 == strcmp(a->unit, b->unit)) && (0 == strcmp(a->source, b->source))
+		&& (0 == strcmp(a->destination, b->destination))) ? true : false;
+}
+
+
+/*
+ * Read the history file, returning an array of its entries and setting
+ * "count" to how many there are, or returning NULL if there are none or
+ * it can't be read.  If "replaceable" is not NULL, it is set to false if
+ * the file exists but can't be read or isn't a history file, so that it
+ * isn't overwritten.
+ */
+/*@null@ */ static struct pvhistory_entry_s *pv__history_read(const char *filename, size_t *count,
+							      /*@null@ */ bool *replaceable)
+{
+	char line[PV_HISTORY_LINE_LENGTH];	/* flawfinder: ignore - bounded by fgets() */
+	struct pvhistory_entry_s *entries;
+	size_t allocated;
+	FILE *stream;
+
+	*count = 0;
+	if (NULL != replaceable)
+		*replaceable = true;
+
+	stream = fopen(filename, "r");	    /* flawfinder: ignore */
+	/* flawfinder - the history file name is given by the operator. */
+	if (NULL == stream) {
+		if (ENOENT != errno) {
+			debug("%s: %s", filename, strerror(errno));
+			if (NULL != replaceable)
+				*replaceable = false;
+		}
+		return NULL;
+	}
+
+	/* An empty file is taken as an empty history. */
+	memset(line, 0, sizeof(line));
+	if (NULL == fgets(line, (int) sizeof(line), stream)) {
+		(void) fclose(stream);
+		return NULL;
+	}
+	if (0 != strncmp(line, PV_HISTORY_MAGIC "\n", sizeof(PV_HISTORY_MAGIC))) {
+		debug("%s: %s", filename, "not a history file");
+		if (NULL != replaceable)
+			*replaceable = false;
+		(void) fclose(stream);
+		return NULL;
+	}
+
+	entries = NULL;
+	allocated = 0;
+
+	while (NULL != fgets(line, (int) sizeof(line), stream)) {
+		struct pvhistory_entry_s entry;
+
+		if (!pv__history_parse(line, &entry))
+			continue;
+
+		if (*count >= allocated) {
+			struct pvhistory_entry_s *new_entries;
+			size_t new_allocated = (0 == allocated) ? 16 : allocated * 2;
+			new_entries = realloc(entries, new_allocated * sizeof(*entries));
+			if (NULL == new_entries)
+				break;
+			entries = new_entries;
+			allocated = new_allocated;
+		}
+		entries[*count] = entry;
+		(*count)++;
+	}
+
+	(void) fclose(stream);
+
+	if ((NULL != entries) && (0 == *count)) {
+		free(entries);
+		entries = NULL;
+	}
+
+	return entries;
+}
+
+
+/*
+ * Start using "--history" for a transfer from "input_fd" to "output_fd",
+ * giving the rate calculations what was remembered about earlier
+ * transfers between the same places.
+ */
+void pv_history_start(pvstate_t state, int input_fd, int output_fd)
+{
+	struct pvhistory_entry_s *entries;
+	struct pvhistory_s *history;
+	size_t count, idx;
+
+	if (NULL == state->control.history_file)
+		return;
+
+	pv_history_free(&(state->transfer));
+
+	history = calloc(1, sizeof(*history));
+	if (NULL == history) {
+		debug("%s: %s", "history allocation failed", strerror(errno));
+		return;
+	}
+	state->transfer.history = history;
+
+	(void) pv_snprintf(history->entry.unit, sizeof(history->entry.unit), "%s",
+			   state->control.linemode ? "lines" : "bytes");
+	pv__history_describe(input_fd, history->entry.source, sizeof(history->entry.source));
+	pv__history_describe(output_fd, history->entry.destination, sizeof(history->entry.destination));
+	history->ramp_transferred = state->transfer.transferred;
+	history->unlimited = ((state->control.rate_limit <= 0) && (NULL == state->control.rate_budget)
+			      && (state->control.latency_target <= 0) && (0 == state->control.pressure_target))
+	    ? true : false;
+
+	debug("%s: %s %s %s", "history key", history->entry.unit, history->entry.source,
+	      history->entry.destination);
+
+	entries = pv__history_read(state->control.history_file, &count, NULL);
+	if (NULL == entries)
+		return;
+
+	for (idx = 0; idx < count; idx++) {
+		unsigned int second;
+
+		if (!pv__history_same_key(&(entries[idx]), &(history->entry)))
+			continue;
+
+		state->calc.prior_rate = entries[idx].average;
+		for (second = 0; second < PV_HISTORY_RAMP_SECONDS; second++)
+			state->calc.prior_ramp[second] = entries[idx].ramp[second];
+
+		debug("%s: %.0Lf, %s: %lu", "history rate", entries[idx].average, "runs", entries[idx].runs);
+		break;
+	}
+
+	free(entries);
+}
+
+
+/*
+ * Note how far the transfer has got, to build up the rate in each of its
+ * first few seconds.  Called after each rate calculation.
+ */
+void pv_history_sample(pvstate_t state)
+{
+	struct pvhistory_s *history;
+	long double elapsed, rate;
+
+	history = state->transfer.history;
+	if ((NULL == history) || (history->ramp_seconds >= PV_HISTORY_RAMP_SECONDS))
+		return;
+
+	elapsed = state->transfer.elapsed_seconds;
+	if (elapsed < (long double) (history->ramp_seconds + 1))
+		return;
+
+	/* Every second since the last sample gets the rate across all of them. */
+	rate = 0.0L;
+	if (elapsed > history->ramp_elapsed)
+		rate = (long double) (state->transfer.transferred - history->ramp_transferred)
+		    / (elapsed - history->ramp_elapsed);
+
+	while ((history->ramp_seconds < PV_HISTORY_RAMP_SECONDS)
+	       && (elapsed >= (long double) (history->ramp_seconds + 1))) {
+		history->entry.ramp[history->ramp_seconds] = rate;
+		history->ramp_seconds++;
+	}
+
+	history->ramp_elapsed = elapsed;
+	history->ramp_transferred = state->transfer.transferred;
+}
+
+
+/*
+ * Mix "observed" into "remembered", with the observed value counting for
+ * "weight".  Values that aren't known are left out.
+ */
+static long double pv__history_blend(long double remembered, long double observed, long double weight)
+{
+	if (remembered <= 0.0L)
+		return observed;
+	if (observed <= 0.0L)
+		return remembered;
+	return remembered + weight * (observed - remembered);
+}
+
+
+/*
+ * Write "entries" to the history file, through a temporary file.
+ */
+static void pv__history_write(pvstate_t state, const struct pvhistory_entry_s *entries, size_t count)
+{
+	char temp_filename[4096];	 /* flawfinder: ignore - bounded by pv_snprintf() */
+	FILE *stream;
+	size_t idx;
+	int fd;
+
+	if (pv_snprintf
+	    (temp_filename, sizeof(temp_filename), "%s.tmp.%lu", state->control.history_file,
+	     (unsigned long) getpid()) >= (int) sizeof(temp_filename)) {
+		pv_error("%s: %s", state->control.history_file, strerror(ENAMETOOLONG));
+		return;
+	}
+
+	fd = open(temp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);	/* flawfinder: ignore */
+	/* flawfinder - the history file name is given by the operator. */
+	stream = (fd < 0) ? NULL : fdopen(fd, "w");
+	if (NULL == stream) {
+		pv_error("%s: %s", temp_filename, strerror(errno));
+		if (fd >= 0)
+			(void) close(fd);
+		return;
+	}
+
+	fprintf(stream, "%s\n", PV_HISTORY_MAGIC);
+	for (idx = 0; idx < count; idx++) {
+		unsigned int second;
+		fprintf(stream, "%s %s %s %lld %lu %.3Lf %.3Lf %.3Lf", entries[idx].unit, entries[idx].source,
+			entries[idx].destination, entries[idx].updated, entries[idx].runs, entries[idx].average,
+			entries[idx].minimum, entries[idx].maximum);
+		for (second = 0; second < PV_HISTORY_RAMP_SECONDS; second++)
+			fprintf(stream, " %.3Lf", entries[idx].ramp[second]);
+		fprintf(stream, "\n");
+	}
+
+	if (0 != fclose(stream)) {
+		pv_error("%s: %s", temp_filename, strerror(errno));
+		(void) unlink(temp_filename);
+		return;
+	}
+
+	if (0 != rename(temp_filename, state->control.history_file)) {
+		pv_error("%s: %s", state->control.history_file, strerror(errno));
+		(void) unlink(temp_filename);
+	}
+}
+
+
+/*
+ * Record how this transfer went in the history file, if it ran to
+ * completion, without a rate limit, for long enough to say anything.
+ */
+void pv_history_finish(pvstate_t state, bool completed)
+{
+	struct pvhistory_entry_s *entries, *entry;
+	struct pvhistory_s *history;
+	long double elapsed, weight;
+	size_t count, idx;
+	unsigned int second;
+	bool replaceable;
+
+	history = state->transfer.history;
+	if (NULL == history)
+		return;
+
+	elapsed = state->transfer.elapsed_seconds;
+	if ((!completed) || (!history->unlimited) || (state->control.rate_limit > 0)
+	    || (elapsed < PV_HISTORY_MIN_SECONDS) || (state->transfer.transferred <= state->display.initial_offset)) {
+		debug("%s", "transfer not recorded in history");
+		pv_history_free(&(state->transfer));
+		return;
+	}
+
+	history->entry.updated = (long long) time(NULL);
+	history->entry.runs = 1;
+	history->entry.average = (long double) (state->transfer.transferred - state->display.initial_offset) / elapsed;
+	/* With no rate measured, the range is left unknown, for the blend. */
+	history->entry.minimum = 0.0L;
+	history->entry.maximum = 0.0L;
+	if (state->calc.measurements_taken > 0) {
+		history->entry.minimum = state->calc.rate_min;
+		history->entry.maximum = state->calc.rate_max;
+	}
+	if (state->control.bits) {
+		history->entry.minimum /= 8.0L;
+		history->entry.maximum /= 8.0L;
+	}
+
+	entries = pv__history_read(state->control.history_file, &count, &replaceable);
+	if (!replaceable) {
+		/*@-mustfreefresh@ *//* see options.c about gettext() */
+		pv_error("%s: %s", state->control.history_file, _("not a history file - not updating it"));
+		/*@+mustfreefresh@ */
+		pv_history_free(&(state->transfer));
+		return;
+	}
+
+	entry = NULL;
+	for (idx = 0; (NULL != entries) && (idx < count); idx++) {
+		if (pv__history_same_key(&(entries[idx]), &(history->entry))) {
+			entry = &(entries[idx]);
+			break;
+		}
+	}
+
+	if (NULL != entry) {
+		weight = 1.0L / (long double) (entry->runs + 1 < PV_HISTORY_BLEND_RUNS
+					       ? entry->runs + 1 : PV_HISTORY_BLEND_RUNS);
+		entry->updated = history->entry.updated;
+		entry->runs++;
+		entry->average = pv__history_blend(entry->average, history->entry.average, weight);
+		entry->minimum = pv__history_blend(entry->minimum, history->entry.minimum, weight);
+		entry->maximum = pv__history_blend(entry->maximum, history->entry.maximum, weight);
+		for (second = 0; second < PV_HISTORY_RAMP_SECONDS; second++)
+			entry->ramp[second] =
+			    pv__history_blend(entry->ramp[second], history->entry.ramp[second], weight);
+	} else {
+		struct pvhistory_entry_s *new_entries;
+
+		/* Make room by dropping the line that was updated longest ago. */
+		if ((NULL != entries) && (count >= PV_HISTORY_MAX_ENTRIES)) {
+			size_t oldest = 0;
+			for (idx = 1; idx < count; idx++) {
+				if (entries[idx].updated < entries[oldest].updated)
+					oldest = idx;
+			}
+			entries[oldest] = entries[count - 1];
+			count--;
+		}
+
+		new_entries = realloc(entries, (count + 1) * sizeof(*entries));
+		if (NULL == new_entries) {
+			if (NULL != entries)
+				free(entries);
+			pv_history_free(&(state->transfer));
+			return;
+		}
+		entries = new_entries;
+		entries[count] = history->entry;
+		count++;
+	}
+
+	debug("%s: %.0Lf", "history updated with rate", history->entry.average);
+
+	pv__history_write(state, entries, count);
+
+	free(entries);
+	pv_history_free(&(state->transfer));
+}
+
+
+/*
+ * Free the history state, if there is any.
+ */
+void pv_history_free(pvtransferstate_t transfer)
+{
+	if ((NULL == transfer) || (NULL == transfer->history))
+		return;
+	free(transfer->history);
+	transfer->history = NULL;
+}
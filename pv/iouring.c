@@ -0,0 +1,968 @@
+/*
+ * io_uring transfer engine, for Linux.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/*
+ * The ring is driven with the raw system calls rather than liburing, so
+ * that there is no extra library to depend on.
+ */
+
+/* Number of submission queue entries to ask for. */
+#define PV_URING_QUEUE_DEPTH	(2 * PV_URING_BUFFERS + 4)
+
+/* Operation types, kept in the top half of each request's user_data. */
+#define PV_URING_OP_READ	1
+#define PV_URING_OP_WRITE	2
+#define PV_URING_OP_TIMEOUT	3
+#define PV_URING_OP_CANCEL	4
+
+#define PV_URING_USER_DATA(op, index) ((((uint64_t) (op)) << 32) | ((uint64_t) (index)))
+
+/* Indexes of the input and output in the registered file table. */
+#define PV_URING_FILE_INPUT	0
+#define PV_URING_FILE_OUTPUT	1
+
+/*
+ * States that each buffer can be in.  Buffers are filled in strict
+ * rotation, and written out in the same rotation, so the output always
+ * receives the data in input order even when several reads complete out
+ * of order.
+ */
+typedef enum {
+	PV_URING_BUFFER_FREE,
+	PV_URING_BUFFER_READING,
+	PV_URING_BUFFER_FILLED,
+	PV_URING_BUFFER_WRITING
+} pvuring_buffer_state_t;
+
+struct pvuring_buffer_s {
+	/*@dependent@ */ char *data;	/* points into the registered block */
+	size_t length;			/* bytes of data in the buffer */
+	size_t written;			/* bytes of it written so far */
+	off_t input_offset;		/* where the data was read from (-1 if not seekable) */
+	off_t output_offset;		/* where the data is going (-1 if not seekable) */
+	size_t submitted;		/* bytes asked for by the request in flight */
+	pvuring_buffer_state_t state;	/* what the buffer is being used for */
+	bool holds_write_index;		/* write_index moves on only when this is written */
+};
+
+/*
+ * The ring itself, plus the buffers used with it.  The pointers into the
+ * mapped rings are named after the matching io_sqring_offsets and
+ * io_cqring_offsets members.
+ */
+struct pvuring_s {
+	int ring_fd;			/* from io_uring_setup() */
+	/*@null@ */ void *sq_ring;	/* mapped submission queue ring */
+	/*@null@ */ void *cq_ring;	/* mapped completion queue ring */
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	/*@null@ */ struct io_uring_sqe *sqes;	/* mapped submission queue entries */
+	size_t sqes_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_ring_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_ring_mask;
+	struct io_uring_cqe *cqes;
+	unsigned int sq_entries;	/* size of the submission queue */
+	unsigned int sqe_tail;		/* our copy of the tail, published on submit */
+	unsigned int to_submit;		/* entries queued but not yet submitted */
+
+	/*@only@ */ /*@null@ */ char *block;	/* memory for all buffers */
+	struct pvuring_buffer_s buffers[PV_URING_BUFFERS];
+	size_t buffer_size;		/* size of each buffer */
+	unsigned int read_index;	/* next buffer to read into */
+	unsigned int write_index;	/* next buffer to write out */
+	unsigned int reads_in_flight;
+	unsigned int writes_in_flight;
+	size_t write_bytes_in_flight;	/* bytes submitted but not yet written */
+
+	int input_fd;
+	int output_fd;
+	off_t next_input_offset;	/* offset of the next read, -1 if not seekable */
+	off_t next_output_offset;	/* offset of the next write, -1 if not seekable */
+	off_t input_position;		/* where the input is up to, for lseek() at the end */
+	off_t output_position;		/* where the output is up to, for lseek() at the end */
+	off_t read_limit;		/* bytes left to read, or -1 for no limit */
+	off_t eof_offset;		/* input offset at which EOF was seen, if seekable */
+
+	struct __kernel_timespec timeout;	/* progress tick interval */
+
+	bool fixed_buffers;		/* set if the buffers are registered */
+	bool fixed_files;		/* set if the file descriptors are registered */
+	bool timeout_pending;		/* set while a tick timeout is queued */
+	bool input_ended;		/* no more reads are to be submitted */
+	bool output_failed;		/* the output can take no more data */
+};
+
+
+/*
+ * Wrappers for the io_uring system calls.
+ */
+static int pv__uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int pv__uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+	return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int pv__uring_register(int ring_fd, unsigned int opcode, const void *arg, unsigned int nr_args)
+{
+	return (int) syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+
+/*
+ * Return a cleared submission queue entry to fill in, or NULL if the
+ * submission queue is full.
+ */
+/*@null@ */
+static struct io_uring_sqe *pv__uring_get_sqe(struct pvuring_s *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, index;
+
+	if (NULL == ring->sqes)
+		return NULL;
+
+	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (ring->sqe_tail - head >= ring->sq_entries)
+		return NULL;
+
+	index = ring->sqe_tail & *(ring->sq_ring_mask);
+	sqe = &(ring->sqes[index]);
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[index] = index;
+	ring->sqe_tail++;
+	ring->to_submit++;
+
+	return sqe;
+}
+
+
+/*
+ * Submit everything queued so far, waiting for at least "min_complete"
+ * completions if that is nonzero.  Returns 0, or -1 with errno set.
+ */
+static int pv__uring_submit(struct pvuring_s *ring, unsigned int min_complete)
+{
+	int submitted;
+
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+	if ((0 == ring->to_submit) && (0 == min_complete))
+		return 0;
+
+	submitted =
+	    pv__uring_enter(ring->ring_fd, ring->to_submit, min_complete,
+			    min_complete > 0 ? IORING_ENTER_GETEVENTS : 0);
+	if (submitted < 0)
+		return -1;
+
+	if ((unsigned int) submitted > ring->to_submit) {
+		ring->to_submit = 0;
+	} else {
+		ring->to_submit -= (unsigned int) submitted;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Fill in the file descriptor of a read or write request, using the
+ * registered file table if there is one.
+ */
+static void pv__uring_set_file(struct pvuring_s *ring, struct io_uring_sqe *sqe, bool output)
+{
+	if (ring->fixed_files) {
+		sqe->fd = output ? PV_URING_FILE_OUTPUT : PV_URING_FILE_INPUT;
+		sqe->flags |= IOSQE_FIXED_FILE;
+	} else {
+		sqe->fd = output ? ring->output_fd : ring->input_fd;
+	}
+}
+
+
+/*
+ * Queue a read into the buffer at "index", for up to "count" bytes.
+ * Returns false if the submission queue is full.
+ */
+static bool pv__uring_queue_read(struct pvuring_s *ring, unsigned int index, size_t count)
+{
+	struct pvuring_buffer_s *buffer;
+	struct io_uring_sqe *sqe;
+
+	sqe = pv__uring_get_sqe(ring);
+	if (NULL == sqe)
+		return false;
+
+	buffer = &(ring->buffers[index]);
+
+	if (ring->fixed_buffers) {
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->buf_index = (uint16_t) index;
+	} else {
+		sqe->opcode = IORING_OP_READ;
+	}
+	pv__uring_set_file(ring, sqe, false);
+	sqe->addr = (uint64_t) (uintptr_t) (buffer->data);
+	sqe->len = (uint32_t) count;
+	sqe->off = (uint64_t) (buffer->input_offset);
+	sqe->user_data = PV_URING_USER_DATA(PV_URING_OP_READ, index);
+
+	buffer->state = PV_URING_BUFFER_READING;
+	buffer->submitted = count;
+
+	return true;
+}
+
+
+/*
+ * Queue a write of up to "count" bytes of whatever is left to write in the
+ * buffer at "index".  Returns false if the submission queue is full.
+ */
+static bool pv__uring_queue_write(struct pvuring_s *ring, unsigned int index, size_t count)
+{
+	struct pvuring_buffer_s *buffer;
+	struct io_uring_sqe *sqe;
+
+	sqe = pv__uring_get_sqe(ring);
+	if (NULL == sqe)
+		return false;
+
+	buffer = &(ring->buffers[index]);
+
+	if (ring->fixed_buffers) {
+		sqe->opcode = IORING_OP_WRITE_FIXED;
+		sqe->buf_index = (uint16_t) index;
+	} else {
+		sqe->opcode = IORING_OP_WRITE;
+	}
+	pv__uring_set_file(ring, sqe, true);
+	sqe->addr = (uint64_t) (uintptr_t) (buffer->data + buffer->written);
+	sqe->len = (uint32_t) count;
+	if (buffer->output_offset < 0) {
+		sqe->off = (uint64_t) - 1;
+	} else {
+		sqe->off = (uint64_t) (buffer->output_offset + (off_t) (buffer->written));
+	}
+	sqe->user_data = PV_URING_USER_DATA(PV_URING_OP_WRITE, index);
+
+	buffer->state = PV_URING_BUFFER_WRITING;
+	buffer->submitted = count;
+
+	return true;
+}
+
+
+/*
+ * Queue a timeout which completes either after one other completion, or
+ * after the tick interval, whichever comes first, so that waiting for
+ * completions never holds up the progress display.
+ */
+static void pv__uring_queue_timeout(struct pvuring_s *ring)
+{
+	struct io_uring_sqe *sqe;
+
+	if (ring->timeout_pending)
+		return;
+
+	sqe = pv__uring_get_sqe(ring);
+	if (NULL == sqe)
+		return;
+
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t) (uintptr_t) (&(ring->timeout));
+	sqe->len = 1;
+	sqe->off = 1;
+	sqe->user_data = PV_URING_USER_DATA(PV_URING_OP_TIMEOUT, 0);
+
+	ring->timeout_pending = true;
+}
+
+
+/*
+ * Queue as many reads as there are free buffers for, and as many writes as
+ * there is filled data for, subject to "allowed" if rate limiting.
+ *
+ * Reads from a non-seekable input, and writes to a non-seekable output,
+ * are only ever issued one at a time, since there is no other way to keep
+ * them in order.  Writes are also issued one at a time when rate limiting,
+ * so that a buffer can be written out in several smaller pieces.
+ */
+static void pv__uring_queue_io(pvstate_t state, struct pvuring_s *ring, off_t allowed)
+{
+	bool limited;
+	off_t can_write;
+
+	while ((!ring->input_ended)
+	       && (PV_URING_BUFFER_FREE == ring->buffers[ring->read_index].state)) {
+		size_t count;
+
+		if ((ring->next_input_offset < 0) && (ring->reads_in_flight > 0))
+			break;
+
+		count = ring->buffer_size;
+		if (ring->read_limit >= 0) {
+			if (0 == ring->read_limit) {
+				ring->input_ended = true;
+				break;
+			}
+			if ((off_t) count > ring->read_limit)
+				count = (size_t) (ring->read_limit);
+		}
+
+		ring->buffers[ring->read_index].input_offset = ring->next_input_offset;
+		if (!pv__uring_queue_read(ring, ring->read_index, count))
+			break;
+
+		ring->reads_in_flight++;
+		if (ring->read_limit >= 0)
+			ring->read_limit -= (off_t) count;
+		if (ring->next_input_offset >= 0)
+			ring->next_input_offset += (off_t) count;
+		ring->read_index = (ring->read_index + 1) % PV_URING_BUFFERS;
+	}
+
+	if (ring->output_failed)
+		return;
+
+	/*
+	 * As with the read()/write() transfer, "allowed" is a ceiling if
+	 * rate limiting is active or it is positive.  Bytes already
+	 * submitted for writing count against it, since the main loop only
+	 * hears about them once they complete.
+	 */
+	limited = (state->control.rate_limit > 0) || (allowed > 0);
+	can_write = allowed - (off_t) (ring->write_bytes_in_flight);
+
+	while (PV_URING_BUFFER_FILLED == ring->buffers[ring->write_index].state) {
+		struct pvuring_buffer_s *buffer;
+		bool one_at_a_time;
+		size_t count;
+
+		one_at_a_time = limited || (ring->next_output_offset < 0);
+		if (one_at_a_time && (ring->writes_in_flight > 0))
+			break;
+
+		buffer = &(ring->buffers[ring->write_index]);
+		count = buffer->length - buffer->written;
+
+		if (limited) {
+			if (can_write <= 0)
+				break;
+			if ((off_t) count > can_write)
+				count = (size_t) can_write;
+		}
+
+		if ((0 == buffer->written) && (ring->next_output_offset >= 0)) {
+			buffer->output_offset = ring->next_output_offset;
+			ring->next_output_offset += (off_t) (buffer->length);
+		}
+
+		if (!pv__uring_queue_write(ring, ring->write_index, count))
+			break;
+
+		ring->writes_in_flight++;
+		ring->write_bytes_in_flight += count;
+		can_write -= (off_t) count;
+
+		buffer->holds_write_index = one_at_a_time;
+		if (one_at_a_time)
+			break;
+		ring->write_index = (ring->write_index + 1) % PV_URING_BUFFERS;
+	}
+}
+
+
+/*
+ * Mark the input as having ended at "offset", discarding any data that
+ * was read from beyond that point.  Only meaningful for seekable input.
+ */
+static void pv__uring_input_ends_at(struct pvuring_s *ring, off_t offset)
+{
+	unsigned int index;
+
+	ring->input_ended = true;
+	if ((ring->eof_offset >= 0) && (ring->eof_offset <= offset))
+		return;
+	ring->eof_offset = offset;
+
+	for (index = 0; index < PV_URING_BUFFERS; index++) {
+		struct pvuring_buffer_s *buffer = &(ring->buffers[index]);
+		if ((PV_URING_BUFFER_FILLED == buffer->state) && (0 == buffer->written)
+		    && (buffer->input_offset >= offset)) {
+			buffer->state = PV_URING_BUFFER_FREE;
+		}
+	}
+}
+
+
+/*
+ * Handle the completion of a read into the buffer at "index".
+ */
+static void pv__uring_read_done(/*@null@ */ pvstate_t state, struct pvuring_s *ring, unsigned int index, int result)
+{
+	struct pvuring_buffer_s *buffer;
+	bool seekable;
+
+	buffer = &(ring->buffers[index]);
+	seekable = buffer->input_offset >= 0;
+
+	if ((-EINTR == result) || (-EAGAIN == result)) {
+		if (pv__uring_queue_read(ring, index, buffer->submitted))
+			return;
+		result = -EAGAIN;
+	}
+
+	ring->reads_in_flight--;
+	buffer->state = PV_URING_BUFFER_FREE;
+
+	if (result < 0) {
+		if (-ECANCELED == result)
+			return;
+		if (NULL != state) {
+			/*@-compdef@ */
+			pv_error("%s: %s: %s", pv_current_file_name(state), _("read failed"), strerror(-result));
+			/*@+compdef@ */
+			/* splint - see pv_current_file_name() calls in transfer.c. */
+			state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		}
+		if (seekable) {
+			pv__uring_input_ends_at(ring, buffer->input_offset);
+		} else {
+			ring->input_ended = true;
+		}
+		return;
+	}
+
+	if (seekable) {
+		/* Anything read from past the end is discarded. */
+		if ((ring->eof_offset >= 0) && (buffer->input_offset >= ring->eof_offset))
+			return;
+		if ((size_t) result < buffer->submitted)
+			pv__uring_input_ends_at(ring, buffer->input_offset + result);
+		if (0 == result)
+			return;
+		if (buffer->input_offset + result > ring->input_position)
+			ring->input_position = buffer->input_offset + result;
+	} else if (0 == result) {
+		ring->input_ended = true;
+		return;
+	}
+
+	buffer->state = PV_URING_BUFFER_FILLED;
+	buffer->length = (size_t) result;
+	buffer->written = 0;
+	buffer->output_offset = -1;
+
+	if (NULL != state)
+		state->transfer.total_bytes_read += result;
+}
+
+
+/*
+ * Handle the completion of a write from the buffer at "index".  Returns
+ * the number of bytes written, or -1 on a write error (in which case
+ * state->status.exit_status is updated).
+ */
+static ssize_t pv__uring_write_done(/*@null@ */ pvstate_t state, struct pvuring_s *ring, unsigned int index,
+				    int result)
+{
+	struct pvuring_buffer_s *buffer;
+
+	buffer = &(ring->buffers[index]);
+
+	if ((-EINTR == result) || (-EAGAIN == result) || (0 == result)) {
+		if (pv__uring_queue_write(ring, index, buffer->submitted))
+			return 0;
+		result = -EAGAIN;
+	}
+
+	ring->writes_in_flight--;
+	if (ring->write_bytes_in_flight > buffer->submitted) {
+		ring->write_bytes_in_flight -= buffer->submitted;
+	} else {
+		ring->write_bytes_in_flight = 0;
+	}
+
+	if (result < 0) {
+		buffer->state = PV_URING_BUFFER_FREE;
+		ring->output_failed = true;
+		if ((-ECANCELED == result) || (NULL == state))
+			return 0;
+		/*
+		 * As in pv__transfer_write(), a closed pipe means we've
+		 * finished, and isn't really our error to report.
+		 */
+		if (-EPIPE == result) {
+			state->flags.pipe_closed = 1;
+			debug("%s", "EPIPE received - setting pipe_closed");
+			return 0;
+		}
+		pv_error("%s: %s", _("write failed"), strerror(-result));
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		return -1;
+	}
+
+	buffer->written += (size_t) result;
+	if ((buffer->output_offset >= 0)
+	    && (buffer->output_offset + (off_t) (buffer->written) > ring->output_position)) {
+		ring->output_position = buffer->output_offset + (off_t) (buffer->written);
+	}
+
+	if (buffer->written >= buffer->length) {
+		buffer->state = PV_URING_BUFFER_FREE;
+		if (buffer->holds_write_index)
+			ring->write_index = (ring->write_index + 1) % PV_URING_BUFFERS;
+	} else if (buffer->holds_write_index) {
+		/* Leave the rest for pv__uring_queue_io() to send. */
+		buffer->state = PV_URING_BUFFER_FILLED;
+	} else if (pv__uring_queue_write(ring, index, buffer->length - buffer->written)) {
+		/* Short write with others in flight - send the rest now. */
+		ring->writes_in_flight++;
+		ring->write_bytes_in_flight += buffer->submitted;
+	}
+
+	return (ssize_t) result;
+}
+
+
+/*
+ * Process every completion that is waiting, adding the number of bytes
+ * written to state->transfer.written.  Returns the number of completions
+ * processed, or -1 on a write error.
+ *
+ * If "state" is NULL, completions are processed but not reported, for use
+ * while shutting the ring down.
+ */
+static int pv__uring_reap(/*@null@ */ pvstate_t state, struct pvuring_s *ring)
+{
+	unsigned int head, tail;
+	int processed;
+	bool write_failed;
+
+	processed = 0;
+	write_failed = false;
+
+	head = *(ring->cq_head);
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		struct io_uring_cqe *cqe;
+		unsigned int op, index;
+		ssize_t nwritten;
+
+		cqe = &(ring->cqes[head & *(ring->cq_ring_mask)]);
+		op = (unsigned int) (cqe->user_data >> 32);
+		index = (unsigned int) (cqe->user_data & 0xffffffff);
+
+		if ((PV_URING_OP_READ == op) && (index < PV_URING_BUFFERS)) {
+			pv__uring_read_done(state, ring, index, cqe->res);
+		} else if ((PV_URING_OP_WRITE == op) && (index < PV_URING_BUFFERS)) {
+			nwritten = pv__uring_write_done(state, ring, index, cqe->res);
+			if (nwritten < 0) {
+				write_failed = true;
+			} else if (NULL != state) {
+				state->transfer.written += nwritten;
+			}
+		} else if (PV_URING_OP_TIMEOUT == op) {
+			ring->timeout_pending = false;
+		}
+
+		head++;
+		processed++;
+	}
+
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	return write_failed ? -1 : processed;
+}
+
+
+/*
+ * Release everything held by the ring.  If requests could not be cancelled
+ * the buffer memory is deliberately leaked, since the kernel may still
+ * write into it.
+ */
+static void pv__uring_free(/*@only@ */ struct pvuring_s *ring)
+{
+	bool busy;
+
+	busy = (ring->reads_in_flight > 0) || (ring->writes_in_flight > 0);
+
+	if (NULL != ring->sqes)
+		(void) munmap(ring->sqes, ring->sqes_size);
+	if ((NULL != ring->cq_ring) && (ring->cq_ring != ring->sq_ring))
+		(void) munmap(ring->cq_ring, ring->cq_ring_size);
+	if (NULL != ring->sq_ring)
+		(void) munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->ring_fd >= 0)
+		(void) close(ring->ring_fd);
+
+	if (NULL != ring->block) {
+		if (busy) {
+			debug("%s", "io_uring requests still in flight - not freeing buffers");
+		} else {
+			pv_free_aligned_buffer(ring->block, ring->buffer_size * PV_URING_BUFFERS);
+		}
+	}
+	ring->block = NULL;
+
+	free(ring);
+}
+
+
+/*
+ * Set up an io_uring for transferring from "fd" to the output, storing it
+ * in state->transfer.uring.  Returns false if io_uring could not be used,
+ * in which case the caller should fall back to read() and write().
+ */
+bool pv_uring_start(pvstate_t state, int fd)
+{
+	struct io_uring_params params;
+	struct pvuring_s *ring;
+	struct iovec iov[PV_URING_BUFFERS];
+	int files[2];
+	struct stat sb;
+	unsigned int index;
+	int output_flags;
+
+	ring = calloc(1, sizeof(*ring));
+	if (NULL == ring)
+		return false;
+
+	ring->ring_fd = -1;
+	ring->input_fd = fd;
+	ring->output_fd = state->control.output_fd;
+	ring->next_input_offset = -1;
+	ring->next_output_offset = -1;
+	ring->read_limit = -1;
+	ring->eof_offset = -1;
+	ring->timeout.tv_sec = 0;
+	ring->timeout.tv_nsec = 90000000;
+
+	memset(&params, 0, sizeof(params));
+	ring->ring_fd = pv__uring_setup(PV_URING_QUEUE_DEPTH, &params);
+	if (ring->ring_fd < 0) {
+		debug("%s: %s", "io_uring_setup", strerror(errno));
+		pv__uring_free(ring);
+		return false;
+	}
+
+	/* Reading at the current position (offset -1) needs this. */
+	if (0 == (params.features & IORING_FEAT_RW_CUR_POS)) {
+		debug("%s", "io_uring lacks IORING_FEAT_RW_CUR_POS");
+		pv__uring_free(ring);
+		return false;
+	}
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (0 != (params.features & IORING_FEAT_SINGLE_MMAP)) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring =
+	    mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+		 IORING_OFF_SQ_RING);
+	if (MAP_FAILED == ring->sq_ring) {
+		debug("%s: %s", "mmap", strerror(errno));
+		ring->sq_ring = NULL;
+		pv__uring_free(ring);
+		return false;
+	}
+
+	if (0 != (params.features & IORING_FEAT_SINGLE_MMAP)) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring =
+		    mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 ring->ring_fd, IORING_OFF_CQ_RING);
+		if (MAP_FAILED == ring->cq_ring) {
+			debug("%s: %s", "mmap", strerror(errno));
+			ring->cq_ring = NULL;
+			pv__uring_free(ring);
+			return false;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes =
+	    mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+		 IORING_OFF_SQES);
+	if (MAP_FAILED == ring->sqes) {
+		debug("%s: %s", "mmap", strerror(errno));
+		ring->sqes = NULL;
+		pv__uring_free(ring);
+		return false;
+	}
+
+	ring->sq_head = (unsigned int *) ((char *) (ring->sq_ring) + params.sq_off.head);
+	ring->sq_tail = (unsigned int *) ((char *) (ring->sq_ring) + params.sq_off.tail);
+	ring->sq_ring_mask = (unsigned int *) ((char *) (ring->sq_ring) + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *) ((char *) (ring->sq_ring) + params.sq_off.array);
+	ring->cq_head = (unsigned int *) ((char *) (ring->cq_ring) + params.cq_off.head);
+	ring->cq_tail = (unsigned int *) ((char *) (ring->cq_ring) + params.cq_off.tail);
+	ring->cq_ring_mask = (unsigned int *) ((char *) (ring->cq_ring) + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) (ring->cq_ring) + params.cq_off.cqes);
+	ring->sq_entries = params.sq_entries;
+	ring->sqe_tail = *(ring->sq_tail);
+
+	/*
+	 * Round each buffer up to a whole number of pages, so that every
+	 * buffer in the block stays aligned for O_DIRECT.
+	 */
+	ring->buffer_size = state->control.target_buffer_size;
+	if (0 == ring->buffer_size)
+		ring->buffer_size = BUFFER_SIZE;
+	ring->buffer_size = (ring->buffer_size + 4095) & ~((size_t) 4095);
+
+	ring->block =
+	    pv_allocate_aligned_buffer(&(state->control), ring->output_fd, fd, ring->buffer_size * PV_URING_BUFFERS);
+	if (NULL == ring->block) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		pv__uring_free(ring);
+		return false;
+	}
+
+	for (index = 0; index < PV_URING_BUFFERS; index++) {
+		ring->buffers[index].data = ring->block + index * ring->buffer_size;
+		ring->buffers[index].state = PV_URING_BUFFER_FREE;
+		ring->buffers[index].input_offset = -1;
+		ring->buffers[index].output_offset = -1;
+		iov[index].iov_base = ring->buffers[index].data;
+		iov[index].iov_len = ring->buffer_size;
+	}
+
+	/*
+	 * Registering the buffers and files saves the kernel mapping them
+	 * on every request, but is optional - it can fail if the locked
+	 * memory limit is low, for instance.
+	 */
+	if (0 == pv__uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iov, PV_URING_BUFFERS)) {
+		ring->fixed_buffers = true;
+	} else {
+		debug("%s: %s", "IORING_REGISTER_BUFFERS", strerror(errno));
+	}
+
+	files[PV_URING_FILE_INPUT] = fd;
+	files[PV_URING_FILE_OUTPUT] = ring->output_fd;
+	if (0 == pv__uring_register(ring->ring_fd, IORING_REGISTER_FILES, files, 2)) {
+		ring->fixed_files = true;
+	} else {
+		debug("%s: %s", "IORING_REGISTER_FILES", strerror(errno));
+	}
+
+	/*
+	 * Regular files and block devices are read with explicit offsets,
+	 * so that several reads can be in flight at once.  The same goes
+	 * for writing, unless the output is in append mode.
+	 */
+	memset(&sb, 0, sizeof(sb));
+	if ((0 == fstat(fd, &sb)) && (S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode))) {
+		ring->next_input_offset = lseek(fd, 0, SEEK_CUR);
+		ring->input_position = ring->next_input_offset;
+	}
+
+	memset(&sb, 0, sizeof(sb));
+	output_flags = fcntl(ring->output_fd, F_GETFL);
+	if ((0 == fstat(ring->output_fd, &sb)) && (S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode))
+	    && (output_flags >= 0) && (0 == (output_flags & O_APPEND))) {
+		ring->next_output_offset = lseek(ring->output_fd, 0, SEEK_CUR);
+		ring->output_position = ring->next_output_offset;
+	}
+
+	/* As in pv__transfer_read(), don't read past --size (#166). */
+	if (state->control.stop_at_size) {
+		ring->read_limit = state->control.size - state->transfer.total_bytes_read;
+		if (ring->read_limit < 0)
+			ring->read_limit = 0;
+	}
+
+	debug("%s: %s=%s, %s=%s, %s=%ld, %s=%ld", "io_uring started", "fixed_buffers",
+	      ring->fixed_buffers ? "true" : "false", "fixed_files", ring->fixed_files ? "true" : "false",
+	      "input_offset", (long) (ring->next_input_offset), "output_offset", (long) (ring->next_output_offset));
+
+	state->transfer.uring = ring;
+
+	return true;
+}
+
+
+/*
+ * Shut down the io_uring, if there is one, cancelling anything still in
+ * flight, and leave the input and output file positions where the data
+ * transferred so far has taken them.
+ */
+void pv_uring_stop(pvtransferstate_t transfer)
+{
+	struct pvuring_s *ring;
+	unsigned int index, attempts;
+
+	ring = transfer->uring;
+	if (NULL == ring)
+		return;
+	transfer->uring = NULL;
+
+	for (index = 0; index < PV_URING_BUFFERS; index++) {
+		struct io_uring_sqe *sqe;
+		unsigned int op;
+
+		if (PV_URING_BUFFER_READING == ring->buffers[index].state) {
+			op = PV_URING_OP_READ;
+		} else if (PV_URING_BUFFER_WRITING == ring->buffers[index].state) {
+			op = PV_URING_OP_WRITE;
+		} else {
+			continue;
+		}
+
+		sqe = pv__uring_get_sqe(ring);
+		if (NULL == sqe)
+			break;
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = PV_URING_USER_DATA(op, index);
+		sqe->user_data = PV_URING_USER_DATA(PV_URING_OP_CANCEL, index);
+	}
+
+	for (attempts = 0; attempts < 10; attempts++) {
+		if ((0 == ring->reads_in_flight) && (0 == ring->writes_in_flight))
+			break;
+		pv__uring_queue_timeout(ring);
+		if ((pv__uring_submit(ring, 1) < 0) && (EINTR != errno))
+			break;
+		(void) pv__uring_reap(NULL, ring);
+	}
+
+	if (ring->next_input_offset >= 0)
+		(void) lseek(ring->input_fd, ring->input_position, SEEK_SET);
+	if (ring->next_output_offset >= 0)
+		(void) lseek(ring->output_fd, ring->output_position, SEEK_SET);
+
+	pv__uring_free(ring);
+}
+
+
+/*
+ * Transfer some data from "fd" to the output using the io_uring set up by
+ * pv_uring_start(), keeping several reads and writes in flight.  Waits
+ * for at most one tick interval if nothing has completed yet.
+ *
+ * Returns the number of bytes written, or negative on error, and sets
+ * *eof_in and *eof_out in the same way as pv_transfer().  The ring is shut
+ * down once both are set.
+ */
+ssize_t pv_uring_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed)
+{
+	struct pvuring_s *ring;
+	unsigned int index;
+	int reaped;
+	bool idle;
+
+	/*
+	 * The ring is normally shut down at the end of each input file, but
+	 * make sure it's not left pointing at an old one.
+	 */
+	if ((NULL != state->transfer.uring) && (state->transfer.uring->input_fd != fd))
+		pv_uring_stop(&(state->transfer));
+	if ((NULL == state->transfer.uring) && (!pv_uring_start(state, fd)))
+		return 0;
+	ring = state->transfer.uring;
+	if (NULL == ring)
+		return 0;
+
+	state->transfer.written = 0;
+
+	reaped = pv__uring_reap(state, ring);
+	if (reaped >= 0) {
+		pv__uring_queue_io(state, ring, allowed);
+
+		/*
+		 * If nothing had completed, submit what we have queued and
+		 * wait for something to complete, or for the tick timeout
+		 * to expire, whichever is sooner.
+		 */
+		if (0 == reaped) {
+			pv__uring_queue_timeout(ring);
+			if (pv__uring_submit(ring, 1) < 0) {
+				if ((EINTR != errno) && (EAGAIN != errno) && (EBUSY != errno)) {
+					pv_error("%s: %s", "io_uring_enter", strerror(errno));
+					state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+					*eof_in = true;
+					*eof_out = true;
+					pv_uring_stop(&(state->transfer));
+					return -1;
+				}
+			}
+			reaped = pv__uring_reap(state, ring);
+			if (reaped >= 0)
+				pv__uring_queue_io(state, ring, allowed);
+		}
+	}
+
+	if (reaped < 0) {
+		*eof_out = true;
+		pv_uring_stop(&(state->transfer));
+		return -1;
+	}
+
+	(void) pv__uring_submit(ring, 0);
+
+	if (ring->output_failed) {
+		*eof_in = true;
+		*eof_out = true;
+	}
+
+	if (ring->input_ended && (0 == ring->reads_in_flight))
+		*eof_in = true;
+
+	idle = (0 == ring->writes_in_flight);
+	for (index = 0; idle && index < PV_URING_BUFFERS; index++) {
+		if (PV_URING_BUFFER_FREE != ring->buffers[index].state)
+			idle = false;
+	}
+	if (*eof_in && idle)
+		*eof_out = true;
+
+	if (*eof_in && *eof_out)
+		pv_uring_stop(&(state->transfer));
+
+	return state->transfer.written;
+}
+
+#endif				/* HAVE_LINUX_IO_URING_H */
@@ -0,0 +1,324 @@
+/*
+ * Latency histograms for the I/O calls and waits made while transferring.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+ * Each histogram counts durations in nanoseconds, in buckets whose width
+ * grows with the value, in the style of an HDR histogram: every power of
+ * two is split into 2^PV_LATENCY_SUB_BITS equal buckets, so any value is
+ * recorded to within 25% at the default setting, from nanoseconds up to
+ * tens of minutes, at a fixed cost in memory and time per value.
+ *
+ * Time spent waiting for only the input to become ready is time blocked
+ * on input, and likewise for the output; a wait for either end (when data
+ * is buffered and there's room for more) doesn't count towards either.
+ */
+#define PV_LATENCY_SUB_BUCKETS	(1 << PV_LATENCY_SUB_BITS)
+#define PV_LATENCY_BUCKETS	((PV_LATENCY_MAX_BITS - PV_LATENCY_SUB_BITS + 1) * PV_LATENCY_SUB_BUCKETS)
+
+struct pvlatency_histogram_s {
+	uint64_t buckets[PV_LATENCY_BUCKETS];	/* count of values per bucket */
+	uint64_t count;			 /* number of values recorded */
+	uint64_t max_nsec;		 /* largest value recorded */
+	long double total_seconds;	 /* sum of all values recorded */
+};
+
+struct pvlatency_s {
+	struct pvlatency_histogram_s histogram[PV_LATENCY_KINDS];
+	struct pvlatency_histogram_s marked[PV_LATENCY_KINDS];	/* as at the last pv_latency_recent() */
+};
+
+/* Labels for "--stats" and keys for "--stats-fd", in pvlatencykind_t order. */
+/*@observer@ */ static const char *const pv__latency_label[PV_LATENCY_KINDS] = {
+	N_("read latency"),
+	N_("write latency"),
+	N_("splice latency"),
+	N_("input wait"),
+	N_("output wait"),
+	N_("input/output wait")
+};
+
+/*@observer@ */ static const char *const pv__latency_key[PV_LATENCY_KINDS] = {
+	"read", "write", "splice", "wait_input", "wait_output", "wait_either"
+};
+
+
+/*
+ * Return the bucket index for a value of "nsec" nanoseconds.
+ */
+static unsigned int pv__latency_bucket(uint64_t nsec)
+{
+	unsigned int msb;
+	uint64_t value;
+
+	if (nsec < (uint64_t) PV_LATENCY_SUB_BUCKETS)
+		return (unsigned int) nsec;
+
+	for (msb = 0, value = nsec; value > 1; value >>= 1)
+		msb++;
+
+	if (msb >= PV_LATENCY_MAX_BITS)
+		return PV_LATENCY_BUCKETS - 1;
+
+	return (msb - PV_LATENCY_SUB_BITS + 1) * PV_LATENCY_SUB_BUCKETS
+	    + (unsigned int) ((nsec >> (msb - PV_LATENCY_SUB_BITS)) & (PV_LATENCY_SUB_BUCKETS - 1));
+}
+
+
+/*
+ * Return the highest value, in nanoseconds, which falls in bucket "index".
+ */
+static uint64_t pv__latency_bucket_top(unsigned int index)
+{
+	unsigned int group, sub;
+
+	if (index >= PV_LATENCY_BUCKETS - 1)
+		return UINT64_MAX;
+
+	index++;
+	if (index < PV_LATENCY_SUB_BUCKETS)
+		return (uint64_t) index - 1;
+
+	group = index / PV_LATENCY_SUB_BUCKETS;
+	sub = index % PV_LATENCY_SUB_BUCKETS;
+
+	return (((uint64_t) (PV_LATENCY_SUB_BUCKETS + sub)) << (group - 1)) - 1;
+}
+
+
+/*
+ * Return the value, in seconds, below which "fraction" of the values in
+ * the histogram fall, as the top of the bucket it is in, but no more than
+ * the largest value actually seen.
+ */
+static long double pv__latency_percentile(const struct pvlatency_histogram_s *histogram, long double fraction)
+{
+	uint64_t wanted, seen, nsec;
+	unsigned int index;
+
+	if (0 == histogram->count)
+		return 0.0;
+
+	wanted = (uint64_t) (fraction * (long double) (histogram->count));
+	if (wanted < 1)
+		wanted = 1;
+
+	nsec = histogram->max_nsec;
+	for (index = 0, seen = 0; index < PV_LATENCY_BUCKETS; index++) {
+		seen += histogram->buckets[index];
+		if (seen >= wanted) {
+			nsec = pv__latency_bucket_top(index);
+			break;
+		}
+	}
+
+	if (nsec > histogram->max_nsec)
+		nsec = histogram->max_nsec;
+
+	return ((long double) nsec) / 1000000000.0L;
+}
+
+
+/*
+ * Record that an operation of the given kind, which started at "start",
+ * has just finished.  The histograms are allocated the first time this is
+ * called; if that fails, nothing is recorded.
+ *
+ * The caller's errno is left untouched, since this comes between an I/O
+ * call and the check of its result.
+ */
+void pv_latency_record(pvtransferstate_t transfer, pvlatencykind_t kind, const struct timespec *start)
+{
+	struct pvlatency_histogram_s *histogram;
+	struct timespec now, elapsed;
+	long double seconds;
+	uint64_t nsec;
+	int saved_errno;
+
+	saved_errno = errno;
+
+	if (NULL == transfer->latency) {
+		transfer->latency = calloc(1, sizeof(*(transfer->latency)));
+		if (NULL == transfer->latency) {
+			errno = saved_errno;
+			return;
+		}
+	}
+
+	pv_elapsedtime_read(&now);
+	pv_elapsedtime_subtract(&elapsed, &now, start);
+	seconds = pv_elapsedtime_seconds(&elapsed);
+	errno = saved_errno;
+	if (seconds < 0.0)
+		return;
+
+	nsec = (uint64_t) (elapsed.tv_sec) * 1000000000 + (uint64_t) (elapsed.tv_nsec);
+
+	histogram = &(transfer->latency->histogram[kind]);
+	histogram->buckets[pv__latency_bucket(nsec)]++;
+	histogram->count++;
+	histogram->total_seconds += seconds;
+	if (nsec > histogram->max_nsec)
+		histogram->max_nsec = nsec;
+}
+
+
+/*
+ * Return the total time, in seconds, spent on operations of the given
+ * kind so far, or 0 if none have been recorded.
+ */
+long double pv_latency_total(readonly_pvtransferstate_t transfer, pvlatencykind_t kind)
+{
+	if (NULL == transfer->latency)
+		return 0.0;
+	return transfer->latency->histogram[kind].total_seconds;
+}
+
+
+/*
+ * Return the value, in seconds, below which "fraction" of the operations
+ * of the given kind recorded since the last call for that kind fall, and
+ * set "count" to how many there were.  This lets "--latency-target" follow
+ * the latency from moment to moment instead of over the whole transfer.
+ */
+long double pv_latency_recent(pvtransferstate_t transfer, pvlatencykind_t kind, long double fraction,
+			      uint64_t *count)
+{
+	struct pvlatency_histogram_s window;
+	struct pvlatency_histogram_s *current, *marked;
+	unsigned int index;
+
+	*count = 0;
+	if (NULL == transfer->latency)
+		return 0.0;
+
+	current = &(transfer->latency->histogram[kind]);
+	marked = &(transfer->latency->marked[kind]);
+
+	memset(&window, 0, sizeof(window));
+	for (index = 0; index < PV_LATENCY_BUCKETS; index++)
+		window.buckets[index] = current->buckets[index] - marked->buckets[index];
+	window.count = current->count - marked->count;
+	window.max_nsec = current->max_nsec;
+
+	memcpy(marked, current, sizeof(*marked));
+
+	*count = window.count;
+	return pv__latency_percentile(&window, fraction);
+}
+
+
+/*
+ * Write the latency histograms to the terminal, as part of "--stats",
+ * summarised as their count, median, 90th and 99th percentiles, and
+ * maximum, followed by the total time blocked on input and on output.
+ */
+void pv_latency_show(pvstate_t state)
+{
+	char stats_buf[256];		 /* flawfinder: ignore */
+	unsigned int kind;
+	int stats_size;
+
+	/* flawfinder: made safe by use of pv_snprintf() */
+
+	if (NULL == state->transfer.latency)
+		return;
+
+	for (kind = 0; kind < PV_LATENCY_KINDS; kind++) {
+		const struct pvlatency_histogram_s *histogram = &(state->transfer.latency->histogram[kind]);
+
+		if (0 == histogram->count)
+			continue;
+
+		memset(stats_buf, 0, sizeof(stats_buf));
+		stats_size =
+		    pv_snprintf(stats_buf, sizeof(stats_buf), "%s %s = %llu/%.3Lf/%.3Lf/%.3Lf/%.3Lf %s\n",
+				_(pv__latency_label[kind]), _("n/p50/p90/p99/max"),
+				(unsigned long long) (histogram->count),
+				1000.0L * pv__latency_percentile(histogram, 0.5L),
+				1000.0L * pv__latency_percentile(histogram, 0.9L),
+				1000.0L * pv__latency_percentile(histogram, 0.99L),
+				((long double) (histogram->max_nsec)) / 1000000.0L, _("ms"));
+
+		if (stats_size > 0 && stats_size < (int) (sizeof(stats_buf)))
+			pv_tty_write(&(state->flags), stats_buf, (size_t) stats_size);
+	}
+
+	memset(stats_buf, 0, sizeof(stats_buf));
+	stats_size =
+	    pv_snprintf(stats_buf, sizeof(stats_buf), "%s = %.3Lf/%.3Lf %s\n", _("blocked on input/output"),
+			pv_latency_total(&(state->transfer), PV_LATENCY_WAIT_INPUT),
+			pv_latency_total(&(state->transfer), PV_LATENCY_WAIT_OUTPUT), _("s"));
+
+	if (stats_size > 0 && stats_size < (int) (sizeof(stats_buf)))
+		pv_tty_write(&(state->flags), stats_buf, (size_t) stats_size);
+}
+
+
+/*
+ * Write the latency summary into "buffer" as JSON object members, each
+ * starting with a comma, for "--stats-fd" to add to its records.  Returns
+ * the length written, or 0 if there is nothing to add or it did not fit.
+ */
+size_t pv_latency_json(readonly_pvtransferstate_t transfer, char *buffer, size_t bufsize)
+{
+	size_t length;
+	unsigned int kind;
+	int added;
+
+	if ((NULL == transfer->latency) || (bufsize < 1))
+		return 0;
+
+	buffer[0] = '\0';
+	length = 0;
+
+	for (kind = 0; kind < PV_LATENCY_KINDS; kind++) {
+		const struct pvlatency_histogram_s *histogram = &(transfer->latency->histogram[kind]);
+
+		added = pv_snprintf(buffer + length, bufsize - length,
+				    "%s\"%s\":{\"count\":%llu,\"total\":%.6Lf,\"p50\":%.6Lf,\"p90\":%.6Lf"
+				    ",\"p99\":%.6Lf,\"max\":%.6Lf}", 0 == kind ? ",\"latency\":{" : ",",
+				    pv__latency_key[kind], (unsigned long long) (histogram->count),
+				    histogram->total_seconds, pv__latency_percentile(histogram, 0.5L),
+				    pv__latency_percentile(histogram, 0.9L), pv__latency_percentile(histogram, 0.99L),
+				    ((long double) (histogram->max_nsec)) / 1000000000.0L);
+		if ((added < 1) || ((size_t) added >= bufsize - length))
+			return 0;
+		length += (size_t) added;
+	}
+
+	added = pv_snprintf(buffer + length, bufsize - length, "},\"blocked_input\":%.6Lf,\"blocked_output\":%.6Lf",
+			    pv_latency_total(transfer, PV_LATENCY_WAIT_INPUT),
+			    pv_latency_total(transfer, PV_LATENCY_WAIT_OUTPUT));
+	if ((added < 1) || ((size_t) added >= bufsize - length))
+		return 0;
+
+	return length + (size_t) added;
+}
+
+
+/*
+ * Free the latency histograms.
+ */
+void pv_latency_free(pvtransferstate_t transfer)
+{
+	if (NULL == transfer->latency)
+		return;
+	free(transfer->latency);
+	transfer->latency = NULL;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Build libpv, the embeddable transfer library declared in libpv.h, from
+# the same sources as pv, leaving out pv's own main().
+#
+jb="/var/jb"
+ARCH="arm64"
+
+cd "$(dirname "$0")" || exit 1
+
+if [ $(uname -n) = iPhone ]; then
+    cc -dynamiclib -lc -lc++ \
+       $(ls ../*.c | grep -v '^\.\./main\.c$') \
+       ../format/*.c \
+       -I.. \
+       -I../format \
+       -I../../include \
+       -I"$jb/usr/include" \
+       -I"$theos_sdk/usr/include" \
+       -L"$jb/usr/lib" \
+       -L/usr/lib \
+       -I/$jb/usr/include/ncursesw \
+       -I../ncursesw \
+       -I../xun-kernel-include \
+       -Wl,-undefined,dynamic_lookup \
+       -install_name "$jb/usr/lib/libpv.dylib" \
+       -o "libpv.dylib" && ldid -S libpv.dylib && cp ../libpv.h .
+else
+    echo "[Error]: this not iPhone"
+    exit 1
+fi
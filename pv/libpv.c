@@ -0,0 +1,239 @@
+/*
+ * The embeddable transfer interface declared in libpv.h: a thin wrapper
+ * around a pvstate_t set up the way main.c would set it up, but marked as
+ * embedded, so that pv_main_loop() leaves signals, the terminal, and the
+ * caller's file descriptors alone.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+#include "libpv.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * One embedded transfer.  Nothing here or in the state it holds is shared
+ * with any other transfer.
+ */
+struct libpv_transfer_s {
+	/*@only@ */ pvstate_t state;
+	/*@null@ */ libpv_progress_fn progress_callback;
+	/*@null@ */ /*@dependent@ */ void *progress_data;
+	/*@null@ */ libpv_error_fn error_callback;
+	/*@null@ */ /*@dependent@ */ void *error_data;
+	bool started;
+};
+
+/*
+ * The I/O engines that can be chosen by name, as with "--engine".
+ */
+static struct {
+	const char *name;
+	pvioengine_t engine;
+} libpv__engines[] = {
+	{ "auto", PV_IOENGINE_AUTO },
+	{ "readwrite", PV_IOENGINE_READWRITE },
+#ifdef HAVE_LINUX_IO_URING_H
+	{ "io_uring", PV_IOENGINE_IO_URING },
+#endif				/* HAVE_LINUX_IO_URING_H */
+#ifdef HAVE_MMAP
+	{ "mmap", PV_IOENGINE_MMAP },
+#endif				/* HAVE_MMAP */
+	{ NULL, PV_IOENGINE_AUTO }
+};
+
+
+/*
+ * Create a new transfer.
+ */
+/*@null@ */ /*@only@ */ libpv_transfer_t libpv_transfer_new(void)
+{
+	static const char *standard_input = "-";
+	libpv_transfer_t transfer;
+
+	transfer = calloc(1, sizeof(*transfer));
+	if (NULL == transfer)
+		return NULL;
+
+	transfer->state = pv_state_alloc();
+	if (NULL == transfer->state) {
+		free(transfer);
+		return NULL;
+	}
+
+	pv_state_embedded_set(transfer->state, true);
+	pv_state_no_display_set(transfer->state, true);
+	pv_state_interval_set(transfer->state, 1.0);
+	pv_state_average_rate_window_set(transfer->state, 30);
+	pv_state_inputfiles(transfer->state, 1, &standard_input);
+	pv_state_output_set(transfer->state, STDOUT_FILENO, "(stdout)");
+
+	return transfer;
+}
+
+
+/*
+ * Attach the input and output file descriptors.
+ */
+int libpv_transfer_set_fds(libpv_transfer_t transfer, int input_fd, int output_fd)
+{
+	if ((input_fd < 0) || (output_fd < 0))
+		return -1;
+	pv_state_input_fd_set(transfer->state, input_fd);
+	pv_state_output_set(transfer->state, output_fd, "(output)");
+	return 0;
+}
+
+
+/*
+ * Choose the I/O engine by name.
+ */
+int libpv_transfer_set_engine(libpv_transfer_t transfer, const char *engine)
+{
+	unsigned int engine_idx;
+
+	for (engine_idx = 0; NULL != libpv__engines[engine_idx].name; engine_idx++) {
+		if (0 == strcmp(engine, libpv__engines[engine_idx].name)) {
+			pv_state_io_engine_set(transfer->state, libpv__engines[engine_idx].engine);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+void libpv_transfer_set_size(libpv_transfer_t transfer, off_t size)
+{
+	pv_state_size_set(transfer->state, size);
+}
+
+void libpv_transfer_set_rate_limit(libpv_transfer_t transfer, off_t rate)
+{
+	pv_state_rate_limit_set(transfer->state, rate);
+}
+
+void libpv_transfer_set_buffer_size(libpv_transfer_t transfer, size_t size)
+{
+	pv_state_target_buffer_size_set(transfer->state, size);
+}
+
+void libpv_transfer_set_interval(libpv_transfer_t transfer, double seconds)
+{
+	pv_state_interval_set(transfer->state, seconds);
+}
+
+void libpv_transfer_set_linemode(libpv_transfer_t transfer, int linemode)
+{
+	pv_state_linemode_set(transfer->state, 0 != linemode ? true : false);
+}
+
+void libpv_transfer_set_progress_callback(libpv_transfer_t transfer, libpv_progress_fn callback, void *data)
+{
+	transfer->progress_callback = callback;
+	transfer->progress_data = data;
+}
+
+void libpv_transfer_set_error_callback(libpv_transfer_t transfer, libpv_error_fn callback, void *data)
+{
+	transfer->error_callback = callback;
+	transfer->error_data = data;
+}
+
+
+/*
+ * Pass the progress of the transfer on to the caller's callback.
+ */
+static void libpv__progress(readonly_pvtransferstate_t state_transfer, readonly_pvtransfercalc_t calc,
+			    bool finished, /*@null@ */ void *data)
+{
+	libpv_transfer_t transfer = data;
+	struct libpv_progress_s progress;
+	off_t size;
+
+	if ((NULL == transfer) || (NULL == transfer->progress_callback))
+		return;
+
+	size = transfer->state->control.size;
+
+	memset(&progress, 0, sizeof(progress));
+	progress.transferred = (long long) (state_transfer->transferred);
+	progress.size = (long long) size;
+	progress.elapsed = (double) (state_transfer->elapsed_seconds);
+	progress.rate = (double) (calc->transfer_rate);
+	progress.average_rate = (double) (calc->average_rate);
+	progress.eta = -1;
+	if (size > 0)
+		progress.eta = pv_seconds_remaining(state_transfer->transferred, size, calc->eta_rate);
+	progress.finished = finished ? 1 : 0;
+
+	transfer->progress_callback(&progress, transfer->progress_data);
+}
+
+
+/*
+ * Pass an error message on to the caller's callback, or drop it.
+ */
+static void libpv__error(const char *message, /*@null@ */ void *data)
+{
+	libpv_transfer_t transfer = data;
+
+	if ((NULL == transfer) || (NULL == transfer->error_callback))
+		return;
+
+	transfer->error_callback(message, transfer->error_data);
+}
+
+
+/*
+ * Run the transfer in the calling thread.  The error handler is set for
+ * this thread only, and put back afterwards, so that other transfers
+ * running at the same time are unaffected.
+ */
+int libpv_transfer_run(libpv_transfer_t transfer)
+{
+	int exit_status;
+
+	if (transfer->started)
+		return PV_ERROREXIT_TRANSITION;
+	transfer->started = true;
+
+	if (NULL != transfer->progress_callback)
+		(void) pv_state_observer_add(transfer->state, libpv__progress, transfer);
+
+	pv_set_error_handler(libpv__error, transfer);
+	exit_status = pv_main_loop(transfer->state);
+	pv_set_error_handler(NULL, NULL);
+
+	return exit_status;
+}
+
+
+/*
+ * Ask the transfer to stop, the way a signal would.
+ */
+void libpv_transfer_cancel(libpv_transfer_t transfer)
+{
+	transfer->state->flags.trigger_exit = 1;
+}
+
+
+/*
+ * Free the transfer.  The caller's file descriptors are left open.
+ */
+void libpv_transfer_free( /*@only@ */ libpv_transfer_t transfer)
+{
+	if (NULL == transfer)
+		return;
+	pv_set_error_handler(libpv__error, transfer);
+	pv_state_free(transfer->state);
+	pv_set_error_handler(NULL, NULL);
+	free(transfer);
+}
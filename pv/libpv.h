@@ -0,0 +1,114 @@
+/*
+ * Public interface for embedding pv's transfer loop in another program:
+ * each transfer copies from one file descriptor to another, reporting its
+ * progress to a callback, without pv touching signal handlers, standard
+ * error, or the terminal.  Transfers are independent of each other, so a
+ * program can run several at once, each in a thread of its own.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#ifndef _LIBPV_H
+#define _LIBPV_H 1
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Opaque handle for one transfer.
+ */
+struct libpv_transfer_s;
+typedef struct libpv_transfer_s *libpv_transfer_t;
+
+/*
+ * Progress of a transfer, as passed to the progress callback.  Amounts are
+ * in bytes, or in lines in line mode.
+ */
+struct libpv_progress_s {
+	long long transferred;		/* amount transferred so far */
+	long long size;			/* expected total, or 0 if unknown */
+	double elapsed;			/* seconds since the transfer started */
+	double rate;			/* current rate, per second */
+	double average_rate;		/* average rate, per second */
+	long eta;			/* seconds left, or -1 if unknown */
+	int finished;			/* nonzero on the last call */
+};
+
+typedef void (*libpv_progress_fn) (const struct libpv_progress_s *, void *);
+typedef void (*libpv_error_fn) (const char *, void *);
+
+/*
+ * Create a new transfer, with no display, reading standard input and
+ * writing standard output until file descriptors are attached.  Returns
+ * NULL on error.
+ */
+extern libpv_transfer_t libpv_transfer_new(void);
+
+/*
+ * Read from "input_fd" and write to "output_fd".  Both remain the
+ * caller's, and are left open.  Returns 0, or -1 if either is negative.
+ */
+extern int libpv_transfer_set_fds(libpv_transfer_t, int input_fd, int output_fd);
+
+/*
+ * Choose the I/O engine by name: "auto", "readwrite", and where available,
+ * "io_uring" or "mmap".  Returns 0, or -1 if the name is not known.
+ */
+extern int libpv_transfer_set_engine(libpv_transfer_t, const char *engine);
+
+/*
+ * Set the expected total size (0 for unknown), the rate limit per second
+ * (0 for none), the buffer size in bytes (0 for the default), and the
+ * interval in seconds between progress callbacks.
+ */
+extern void libpv_transfer_set_size(libpv_transfer_t, off_t size);
+extern void libpv_transfer_set_rate_limit(libpv_transfer_t, off_t rate);
+extern void libpv_transfer_set_buffer_size(libpv_transfer_t, size_t size);
+extern void libpv_transfer_set_interval(libpv_transfer_t, double seconds);
+
+/*
+ * Count lines instead of bytes if "linemode" is nonzero.
+ */
+extern void libpv_transfer_set_linemode(libpv_transfer_t, int linemode);
+
+/*
+ * Have "callback" called with "data" at every interval while the transfer
+ * runs, and once more when it finishes.  It is called from the thread
+ * that called libpv_transfer_run().
+ */
+extern void libpv_transfer_set_progress_callback(libpv_transfer_t, libpv_progress_fn callback, void *data);
+
+/*
+ * Have "callback" called with "data" and the text of each error message,
+ * instead of the message being discarded.
+ */
+extern void libpv_transfer_set_error_callback(libpv_transfer_t, libpv_error_fn callback, void *data);
+
+/*
+ * Run the transfer to the end, in the calling thread.  Returns 0 on
+ * success, or the same nonzero bitmask of errors as pv's exit status.
+ * A transfer can only be run once.
+ */
+extern int libpv_transfer_run(libpv_transfer_t);
+
+/*
+ * Ask a running transfer to stop as soon as it can; it may be called from
+ * any thread.
+ */
+extern void libpv_transfer_cancel(libpv_transfer_t);
+
+/*
+ * Free a transfer that is not running.
+ */
+extern void libpv_transfer_free(libpv_transfer_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* _LIBPV_H */
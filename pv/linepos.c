@@ -0,0 +1,196 @@
+/*
+ * Record of where recent line separators were written, so that in line
+ * mode the bytes still sitting unread in an output pipe can be turned back
+ * into a number of lines.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * Entries allocated to begin with, and the most that the record is allowed
+ * to grow to; both are powers of 2.
+ */
+#define PV_LINEPOS_INITIAL	1024
+#define PV_LINEPOS_MAX		1048576
+
+/*
+ * Separators further back than this from the newest are forgotten.  No
+ * pipe or socket buffer holds anywhere near this much, so the lines in one
+ * can always be counted.
+ */
+#define PV_LINEPOS_WINDOW	((off_t) 16 * 1024 * 1024)
+
+/* Offsets from the base are kept below this, so that they fit in 32 bits. */
+#define PV_LINEPOS_REBASE	((off_t) 0x7fffffff)
+
+/*
+ * Separator positions only ever increase, so they are kept in order in a
+ * ring, as 32-bit offsets from "base", which is moved up whenever the
+ * newest would not fit; that halves the space of a full "off_t" each, and
+ * means a binary search finds how many are after any given position.  The
+ * ring starts small and doubles as needed, holding only what falls in the
+ * window, instead of a fixed number of entries allocated up front.
+ */
+struct pvlinepositions_s {
+	/*@only@ */ uint32_t *offset;	 /* ring of positions minus base */
+	off_t base;			 /* position the offsets are from */
+	size_t capacity;		 /* entries allocated, a power of 2 */
+	size_t head;			 /* index of the oldest entry */
+	size_t length;			 /* number of entries held */
+};
+
+
+/*
+ * Allocate an empty record.  Returns NULL on error.
+ */
+/*@null@ */ /*@only@ */ struct pvlinepositions_s *pv_linepos_alloc(void)
+{
+	struct pvlinepositions_s *positions;
+
+	positions = calloc(1, sizeof(*positions));
+	if (NULL == positions)
+		return NULL;
+
+	positions->offset = calloc(PV_LINEPOS_INITIAL, sizeof(uint32_t));
+	if (NULL == positions->offset) {
+		free(positions);
+		return NULL;
+	}
+	positions->capacity = PV_LINEPOS_INITIAL;
+
+	return positions;
+}
+
+
+/*
+ * Forget all of the positions recorded.
+ */
+void pv_linepos_reset(/*@null@ */ struct pvlinepositions_s *positions)
+{
+	if (NULL == positions)
+		return;
+	positions->base = 0;
+	positions->head = 0;
+	positions->length = 0;
+}
+
+
+/*
+ * Free the record.
+ */
+void pv_linepos_free(/*@only@ */ /*@null@ */ struct pvlinepositions_s *positions)
+{
+	if (NULL == positions)
+		return;
+	free(positions->offset);
+	free(positions);
+}
+
+
+/*
+ * Return the position held at index "idx" from the oldest.
+ */
+static inline off_t pv__linepos_at(const struct pvlinepositions_s *positions, size_t idx)
+{
+	return positions->base + (off_t) (positions->offset[(positions->head + idx) & (positions->capacity - 1)]);
+}
+
+
+/*
+ * Double the size of the ring, keeping the entries in order.  Returns
+ * false if it is already as big as it may get, or on error.
+ */
+static bool pv__linepos_grow(struct pvlinepositions_s *positions)
+{
+	uint32_t *new_offset;
+	size_t idx;
+
+	if (positions->capacity >= PV_LINEPOS_MAX)
+		return false;
+
+	new_offset = calloc(positions->capacity * 2, sizeof(uint32_t));
+	if (NULL == new_offset)
+		return false;
+
+	for (idx = 0; idx < positions->length; idx++)
+		new_offset[idx] = positions->offset[(positions->head + idx) & (positions->capacity - 1)];
+
+	free(positions->offset);
+	positions->offset = new_offset;
+	positions->capacity *= 2;
+	positions->head = 0;
+
+	return true;
+}
+
+
+/*
+ * Record that a line separator was written at output position "position",
+ * which is never lower than the last one recorded.
+ */
+void pv_linepos_add(struct pvlinepositions_s *positions, off_t position)
+{
+	/* Forget whatever has fallen out of the window. */
+	while ((positions->length > 0) && (position - pv__linepos_at(positions, 0) > PV_LINEPOS_WINDOW)) {
+		positions->head = (positions->head + 1) & (positions->capacity - 1);
+		positions->length--;
+	}
+
+	/* Move the base up to the oldest entry if the offset won't fit. */
+	if ((0 == positions->length) || (position - positions->base > PV_LINEPOS_REBASE)) {
+		off_t new_base = (positions->length > 0) ? pv__linepos_at(positions, 0) : position;
+		uint32_t shift = (uint32_t) (new_base - positions->base);
+		size_t idx;
+
+		for (idx = 0; idx < positions->length; idx++)
+			positions->offset[(positions->head + idx) & (positions->capacity - 1)] -= shift;
+		positions->base = new_base;
+	}
+
+	/* When full, grow, or failing that, drop the oldest. */
+	if ((positions->length >= positions->capacity) && (!pv__linepos_grow(positions))) {
+		positions->head = (positions->head + 1) & (positions->capacity - 1);
+		positions->length--;
+	}
+
+	positions->offset[(positions->head + positions->length) & (positions->capacity - 1)] =
+	    (uint32_t) (position - positions->base);
+	positions->length++;
+}
+
+
+/*
+ * Return the number of line separators recorded at output positions after
+ * "position".
+ */
+size_t pv_linepos_count_after(/*@null@ */ const struct pvlinepositions_s *positions, off_t position)
+{
+	size_t low, high;
+
+	if ((NULL == positions) || (0 == positions->length))
+		return 0;
+
+	/* Find the first entry after "position". */
+	low = 0;
+	high = positions->length;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (pv__linepos_at(positions, middle) <= position) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return positions->length - low;
+}
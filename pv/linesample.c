@@ -0,0 +1,453 @@
+/*
+ * Functions for estimating the number of lines in the input files from a
+ * sample of blocks, for "--line-estimate".
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * Instead of reading all of the input to count its lines, blocks of
+ * PV_LINESAMPLE_BLOCK bytes are read with pread() from places spread
+ * across all the input files, taken together as one stream: the stream is
+ * split into as many equal strata as there are samples in a round, and
+ * one block is read from a random place in each.  The total is the
+ * stream's size times the density of separators in the sample.
+ *
+ * The 95% confidence bound on the total comes from how much the density
+ * varies from block to block.  Rounds of samples are taken, doubling each
+ * time, until the bound is within PV_LINESAMPLE_TARGET_PPM of the total,
+ * or PV_LINESAMPLE_MAX_SAMPLES blocks or PV_LINESAMPLE_MAX_NSEC have been
+ * used, so the estimate is ready before the first display update.
+ *
+ * During the transfer, the estimate is refined: the lines already
+ * transferred are known exactly, and only the rest is estimated, from the
+ * samples that lie in the part of the stream not yet read.  Once too few
+ * samples are left there, the density seen so far in the transfer itself
+ * is used instead.  When everything has been read, the size is exact.
+ *
+ * Inputs smaller than PV_LINESAMPLE_MIN_SIZE are quick enough to count in
+ * full, so they are left to the normal line count, as is anything that
+ * isn't a regular file.
+ */
+#define PV_LINESAMPLE_BLOCK		65536		/* bytes per sample */
+#define PV_LINESAMPLE_FIRST_ROUND	64		/* samples in the first round */
+#define PV_LINESAMPLE_MAX_SAMPLES	2048		/* most samples to take */
+#define PV_LINESAMPLE_MAX_NSEC		500000000	/* most time to spend sampling */
+#define PV_LINESAMPLE_TARGET_PPM	5000		/* confidence bound to aim for */
+#define PV_LINESAMPLE_MIN_REMAINING	16		/* samples needed to estimate the rest */
+#define PV_LINESAMPLE_MIN_SIZE		((off_t) 67108864)	/* smallest input worth sampling */
+
+struct pvlinesample_sample_s {
+	off_t offset;			 /* position in the stream of all inputs */
+	size_t bytes;			 /* bytes read */
+	size_t lines;			 /* separators found */
+};
+
+struct pvlinesample_s {
+	/*@only@ */ struct pvlinesample_sample_s *samples;
+	unsigned int sample_count;	 /* samples taken */
+	off_t total_bytes;		 /* size of all inputs together */
+	off_t initial_estimate;		 /* total lines estimated from the sample */
+	off_t initial_bound;		 /* 95% confidence bound on that */
+	bool finished;			 /* set once the size is exact */
+};
+
+
+/*
+ * Return the next number from a xorshift generator.
+ */
+static uint64_t pv__linesample_random(uint64_t *seed)
+{
+	uint64_t x = *seed;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*seed = x;
+	return x;
+}
+
+
+/*
+ * Read the sample at "sample->offset" from whichever input file holds
+ * that part of the stream, filling in its counts.  The sample is cut short
+ * at the end of its file.  Returns false on a read error.
+ */
+static bool pv__linesample_read(struct pvlinesample_sample_s *sample, const int *fds, const off_t *sizes,
+				unsigned int file_count, char separator, char *buffer)
+{
+	unsigned int file_idx;
+	off_t offset;
+	size_t wanted, done;
+
+	offset = sample->offset;
+	for (file_idx = 0; file_idx < file_count && offset >= sizes[file_idx]; file_idx++)
+		offset -= sizes[file_idx];
+	if (file_idx >= file_count)
+		return false;
+
+	wanted = PV_LINESAMPLE_BLOCK;
+	if ((off_t) wanted > sizes[file_idx] - offset)
+		wanted = (size_t) (sizes[file_idx] - offset);
+
+	done = 0;
+	while (done < wanted) {
+		ssize_t nread;
+		nread = pread(fds[file_idx], buffer + done, wanted - done, offset + (off_t) done);	/* flawfinder: ignore */
+		/* flawfinder rationale: bounded by "wanted", at most the buffer size. */
+		if ((nread < 0) && (EINTR == errno))
+			continue;
+		if (nread < 0)
+			return false;
+		if (0 == nread)
+			break;
+		done += (size_t) nread;
+	}
+
+	sample->bytes = done;
+	sample->lines = pv_linescan_count(buffer, done, separator);
+
+	return done > 0;
+}
+
+
+/*
+ * Work out the estimated total and its 95% confidence bound from the
+ * samples taken so far.
+ */
+static void pv__linesample_estimate(struct pvlinesample_s *linesample)
+{
+	long double sum_density, sum_squares, mean, variance, blocks, bound;
+	unsigned int idx, count;
+	off_t sum_bytes, sum_lines;
+
+	sum_density = 0.0L;
+	sum_squares = 0.0L;
+	sum_bytes = 0;
+	sum_lines = 0;
+	count = 0;
+
+	for (idx = 0; idx < linesample->sample_count; idx++) {
+		struct pvlinesample_sample_s *sample = &(linesample->samples[idx]);
+		long double density;
+		if (0 == sample->bytes)
+			continue;
+		density = (long double) (sample->lines) / (long double) (sample->bytes);
+		sum_density += density;
+		sum_squares += density * density;
+		sum_bytes += (off_t) (sample->bytes);
+		sum_lines += (off_t) (sample->lines);
+		count++;
+	}
+
+	if ((count < 2) || (sum_bytes < 1)) {
+		linesample->initial_estimate = 0;
+		linesample->initial_bound = 0;
+		return;
+	}
+
+	mean = sum_density / (long double) count;
+	variance = (sum_squares - (long double) count * mean * mean) / (long double) (count - 1);
+	if (variance < 0.0L)
+		variance = 0.0L;
+
+	/* A smaller share of the stream left unsampled means less doubt. */
+	blocks = (long double) (linesample->total_bytes) / (long double) PV_LINESAMPLE_BLOCK;
+	bound = 1.96L * (long double) (linesample->total_bytes) * sqrtl(variance / (long double) count);
+	if ((blocks > 0.0L) && ((long double) count < blocks))
+		bound *= sqrtl(1.0L - (long double) count / blocks);
+
+	linesample->initial_estimate =
+	    (off_t) ((long double) sum_lines * (long double) (linesample->total_bytes) / (long double) sum_bytes);
+	linesample->initial_bound = (off_t) bound;
+}
+
+
+/*
+ * Take the samples, returning false if they couldn't be.
+ */
+static bool pv__linesample_take(struct pvlinesample_s *linesample, const int *fds, const off_t *sizes,
+				unsigned int file_count, char separator)
+{
+	struct timespec start_time, now, spent;
+	unsigned int round_size;
+	uint64_t seed;
+	char *buffer;
+
+	buffer = malloc(PV_LINESAMPLE_BLOCK);
+	if (NULL == buffer)
+		return false;
+
+	pv_elapsedtime_read(&start_time);
+	seed = (uint64_t) (start_time.tv_nsec) ^ ((uint64_t) getpid() << 32) ^ (uint64_t) (start_time.tv_sec);
+	if (0 == seed)
+		seed = 1;
+
+	round_size = PV_LINESAMPLE_FIRST_ROUND;
+	while (linesample->sample_count + round_size <= PV_LINESAMPLE_MAX_SAMPLES) {
+		off_t stratum;
+		unsigned int idx;
+
+		stratum = linesample->total_bytes / (off_t) round_size;
+		if (stratum < 1)
+			break;
+
+		for (idx = 0; idx < round_size; idx++) {
+			struct pvlinesample_sample_s *sample = &(linesample->samples[linesample->sample_count]);
+			off_t spread = stratum > PV_LINESAMPLE_BLOCK ? stratum - PV_LINESAMPLE_BLOCK : 1;
+
+			sample->offset = (off_t) idx * stratum + (off_t) (pv__linesample_random(&seed) % (uint64_t) spread);
+			if (!pv__linesample_read(sample, fds, sizes, file_count, separator, buffer)) {
+				debug("%s: %lld: %s", "sample read failed", (long long) (sample->offset), strerror(errno));
+				free(buffer);
+				return false;
+			}
+			linesample->sample_count++;
+		}
+
+		pv__linesample_estimate(linesample);
+
+		debug("%s: %s=%u, %s=%lld, %s=%lld", "line sample", "samples", linesample->sample_count, "estimate",
+		      (long long) (linesample->initial_estimate), "bound", (long long) (linesample->initial_bound));
+
+		if ((linesample->initial_estimate > 0)
+		    && ((long double) (linesample->initial_bound) * 1000000.0L <=
+			(long double) (linesample->initial_estimate) * (long double) PV_LINESAMPLE_TARGET_PPM))
+			break;
+
+		pv_elapsedtime_read(&now);
+		pv_elapsedtime_subtract(&spent, &now, &start_time);
+		if (pv_elapsedtime_seconds(&spent) * 1000000000.0L >= (long double) PV_LINESAMPLE_MAX_NSEC)
+			break;
+
+		round_size *= 2;
+	}
+
+	free(buffer);
+
+	return linesample->sample_count > 0;
+}
+
+
+/*
+ * Estimate the number of lines in the input files by sampling them, and
+ * set state->control.size to the estimate; pv_linesample_update() then
+ * refines it as the transfer goes on.
+ *
+ * Returns false if the inputs can't be sampled, or are small enough to be
+ * counted in full, in which case the caller should count them instead.
+ */
+bool pv_linesample_start(pvstate_t state)
+{
+	struct pvlinesample_s *linesample;
+	unsigned int file_idx, file_count, opened;
+	off_t total_bytes;
+	int *fds;
+	off_t *sizes;
+	bool ok;
+
+	pv_linesample_free(state);
+
+	if ((NULL == state->files.filename) || (0 == state->files.file_count))
+		return false;
+	file_count = state->files.file_count;
+
+	fds = calloc((size_t) file_count, sizeof(int));
+	sizes = calloc((size_t) file_count, sizeof(off_t));
+	if ((NULL == fds) || (NULL == sizes)) {
+		if (NULL != fds)
+			free(fds);
+		if (NULL != sizes)
+			free(sizes);
+		return false;
+	}
+
+	ok = true;
+	total_bytes = 0;
+	for (opened = 0; ok && opened < file_count; opened++) {
+		const char *filename = state->files.filename[opened];
+		struct stat sb;
+		int fd;
+
+		if ((NULL == filename) || (0 == strcmp(filename, "-"))) {
+			fd = dup(STDIN_FILENO);
+		} else if (pv_net_is_address(filename)) {
+			fd = -1;
+		} else {
+			fd = open(filename, O_RDONLY);	/* flawfinder: ignore */
+			/* flawfinder - as with pv_next_file(). */
+		}
+		fds[opened] = fd;
+
+		memset(&sb, 0, sizeof(sb));
+		if ((fd < 0) || (0 != fstat(fd, &sb)) || (!S_ISREG(sb.st_mode))) {
+			ok = false;
+			continue;
+		}
+		sizes[opened] = sb.st_size;
+		total_bytes += sb.st_size;
+	}
+
+	linesample = NULL;
+	if (ok && (total_bytes >= PV_LINESAMPLE_MIN_SIZE)) {
+		linesample = calloc(1, sizeof(*linesample));
+		if (NULL != linesample) {
+			linesample->samples = calloc(PV_LINESAMPLE_MAX_SAMPLES, sizeof(*(linesample->samples)));
+			if (NULL == linesample->samples) {
+				free(linesample);
+				linesample = NULL;
+			}
+		}
+	}
+
+	if (NULL != linesample) {
+		linesample->total_bytes = total_bytes;
+		if ((!pv__linesample_take
+		     (linesample, fds, sizes, file_count, state->control.null_terminated_lines ? '\0' : '\n'))
+		    || (linesample->initial_estimate < 1)) {
+			free(linesample->samples);
+			free(linesample);
+			linesample = NULL;
+		}
+	}
+
+	for (file_idx = 0; file_idx < opened; file_idx++) {
+		if (fds[file_idx] >= 0)
+			(void) close(fds[file_idx]);
+	}
+	free(fds);
+	free(sizes);
+
+	if (NULL == linesample)
+		return false;
+
+	state->files.linesample = linesample;
+	state->control.size = linesample->initial_estimate;
+	state->control.size_provisional = true;
+
+	debug("%s: %lld +/- %lld", "estimated lines", (long long) (linesample->initial_estimate),
+	      (long long) (linesample->initial_bound));
+
+	return true;
+}
+
+
+/*
+ * Refine the line estimate from what has been transferred so far.  Called
+ * from the main loop once per display interval.
+ */
+void pv_linesample_update(pvstate_t state)
+{
+	struct pvlinesample_s *linesample;
+	off_t bytes_read, bytes_done, lines_done, remaining, sum_bytes, sum_lines, estimate;
+	size_t unwritten;
+	unsigned int idx, samples_left;
+
+	linesample = state->files.linesample;
+	if ((NULL == linesample) || linesample->finished)
+		return;
+
+	bytes_read = state->transfer.total_bytes_read;
+	lines_done = state->transfer.total_written;
+	unwritten = 0;
+	if (state->transfer.read_position > state->transfer.write_position)
+		unwritten = state->transfer.read_position - state->transfer.write_position;
+
+	/* Once everything has been read and written, the count is exact. */
+	if ((bytes_read >= linesample->total_bytes) && (0 == unwritten)) {
+		linesample->finished = true;
+		state->control.size = lines_done;
+		state->control.size_provisional = false;
+		debug("%s: %lld", "line count now exact", (long long) lines_done);
+		return;
+	}
+
+	bytes_done = bytes_read - (off_t) unwritten;
+	if (bytes_done < 1)
+		return;
+
+	remaining = linesample->total_bytes - bytes_done;
+	if (remaining < 0)
+		remaining = 0;
+
+	sum_bytes = 0;
+	sum_lines = 0;
+	samples_left = 0;
+	for (idx = 0; idx < linesample->sample_count; idx++) {
+		if (linesample->samples[idx].offset < bytes_done)
+			continue;
+		sum_bytes += (off_t) (linesample->samples[idx].bytes);
+		sum_lines += (off_t) (linesample->samples[idx].lines);
+		samples_left++;
+	}
+
+	if ((samples_left < PV_LINESAMPLE_MIN_REMAINING) || (sum_bytes < 1)) {
+		sum_bytes = bytes_done;
+		sum_lines = lines_done;
+	}
+
+	estimate = lines_done + (off_t) ((long double) sum_lines * (long double) remaining / (long double) sum_bytes);
+	if (estimate < lines_done)
+		estimate = lines_done;
+
+	state->control.size = estimate;
+}
+
+
+/*
+ * Write the sampled estimate of the line count, and its confidence bound,
+ * to the terminal, for "--stats".
+ */
+void pv_linesample_show(pvstate_t state)
+{
+	char stats_buf[128];		 /* flawfinder: ignore */
+	struct pvlinesample_s *linesample;
+	int stats_size;
+
+	/* flawfinder: made safe by use of pv_snprintf() */
+
+	linesample = state->files.linesample;
+	if (NULL == linesample)
+		return;
+
+	/*@-mustfreefresh@ */
+	memset(stats_buf, 0, sizeof(stats_buf));
+	stats_size =
+	    pv_snprintf(stats_buf, sizeof(stats_buf), "%s = %lld +/- %lld (%u %s)\n", _("estimated lines"),
+			(long long) (linesample->initial_estimate), (long long) (linesample->initial_bound),
+			linesample->sample_count, _("samples"));
+	/*@+mustfreefresh@ *//* splint: see above about gettext(). */
+
+	if (stats_size > 0 && stats_size < (int) (sizeof(stats_buf)))
+		pv_tty_write(&(state->flags), stats_buf, (size_t) stats_size);
+}
+
+
+/*
+ * Free the line sample, if there is one.
+ */
+void pv_linesample_free(pvstate_t state)
+{
+	if ((NULL == state) || (NULL == state->files.linesample))
+		return;
+	free(state->files.linesample->samples);
+	free(state->files.linesample);
+	state->files.linesample = NULL;
+}
@@ -83,10 +83,28 @@ static bool pv__resize_display_on_signal(pvstate_t state)
 
 /*
  * Calculate and display the transfer statistics at the end of the transfer,
- * if stats are enabled and any measurements were taken.
+ * if stats are enabled and any measurements were taken, and the digest of
+ * the output, if one was asked for.
  */
 static void pv__show_stats(pvstate_t state)
 {
+	/* The --digest digest is shown with or without the other stats. */
+	if (PV_DIGEST_NONE != state->control.digest) {
+		char digest_buf[80];	 /* flawfinder: ignore */
+		char stats_buf[128];	 /* flawfinder: ignore */
+		int stats_size;
+
+		/* flawfinder: made safe by use of pv_snprintf() */
+
+		if (pv_digest_hex(state, digest_buf, sizeof(digest_buf))) {
+			stats_size =
+			    pv_snprintf(stats_buf, sizeof(stats_buf), "%s = %s\n",
+					pv_digest_name(state->control.digest), digest_buf);
+			if (stats_size > 0 && stats_size < (int) (sizeof(stats_buf)))
+				pv_tty_write(&(state->flags), stats_buf, (size_t) stats_size);
+		}
+	}
+
 	if (!state->control.show_stats)
 		return;
 
@@ -122,6 +140,27 @@ static void pv__show_stats(pvstate_t state)
 
 		if (stats_size > 0 && stats_size < (int) (sizeof(stats_buf)))
 			pv_tty_write(&(state->flags), stats_buf, (size_t) stats_size);
+
+		/* Percentiles over the last average rate window. */
+		if (state->calc.window_count > 2) {
+			long double rate_p50, rate_p99;
+
+			rate_p50 = pv_calc_rate_percentile(&(state->calc), 0.5);
+			rate_p99 = pv_calc_rate_percentile(&(state->calc), 0.99);
+			if (state->control.bits) {
+				rate_p50 = 8.0 * rate_p50;
+				rate_p99 = 8.0 * rate_p99;
+			}
+
+			memset(stats_buf, 0, sizeof(stats_buf));
+			stats_size =
+			    pv_snprintf(stats_buf, sizeof(stats_buf), "%s = %.3Lf/%.3Lf %s\n",
+					_("window rate p50/p99"), rate_p50, rate_p99,
+					state->control.bits ? _("b/s") : _("B/s"));
+
+			if (stats_size > 0 && stats_size < (int) (sizeof(stats_buf)))
+				pv_tty_write(&(state->flags), stats_buf, (size_t) stats_size);
+		}
 	} else if (state->control.show_stats && state->calc.measurements_taken < 1) {
 		char msg_buf[256];	 /* flawfinder: ignore */
 		int msg_size;
@@ -134,6 +173,18 @@ static void pv__show_stats(pvstate_t state)
 		if (msg_size > 0 && msg_size < (int) (sizeof(msg_buf)))
 			pv_tty_write(&(state->flags), msg_buf, (size_t) msg_size);
 	}
+
+	pv_latency_show(state);
+	pv_transfer_engines_show(state);
+	pv_pipesize_show(state);
+	pv_throttle_show(state);
+	pv_linesample_show(state);
+
+#ifdef HAVE_IPC
+	/* Say where the bottleneck was, if other "pv -c" instances took part. */
+	if ('\0' != state->cursor.bottleneck[0])
+		pv_tty_write(&(state->flags), state->cursor.bottleneck, strlen(state->cursor.bottleneck));	/* flawfinder: ignore */
+#endif
 }
 
 
@@ -166,6 +217,80 @@ static long double pv__elapsed_transfer_time(const struct timespec *loop_start_t
 }
 
 
+/*
+ * Top up the "-L" token bucket "tokens" with the rate limit's worth of
+ * tokens for the time since "last_refill", up to the burst size, and
+ * return how much may be written now.
+ *
+ * Writes are paced in quanta of RATE_QUANTUM nanoseconds' worth of the
+ * rate, so the output is spread evenly instead of arriving in bursts.  If
+ * there isn't a whole quantum available yet, 0 is returned, and
+ * "next_ratecheck" is set to when there will be.
+ */
+static off_t pv__rate_allowance(pvstate_t state, long double *tokens, struct timespec *last_refill,
+				const struct timespec *now, struct timespec *next_ratecheck)
+{
+	struct timespec elapsed;
+	long double rate, burst, quantum;
+
+	rate = (long double) (state->control.rate_limit);
+	if (NULL != state->control.rate_budget)
+		rate = pv_budget_rate(state, rate);
+	quantum = rate * RATE_QUANTUM / 1000000000.0L;
+	if (quantum < 1.0L)
+		quantum = 1.0L;
+	burst = rate * RATE_BURST_WINDOW;
+	if (state->control.rate_burst > 0)
+		burst = (long double) (state->control.rate_burst);
+	if (burst < quantum)
+		burst = quantum;
+
+	pv_elapsedtime_subtract(&elapsed, now, last_refill);
+	pv_elapsedtime_copy(last_refill, now);
+
+	*tokens += rate * pv_elapsedtime_seconds(&elapsed);
+	if (*tokens > burst)
+		*tokens = burst;
+
+	if (*tokens < quantum) {
+		pv_budget_held_back(state);
+		pv_elapsedtime_copy(next_ratecheck, now);
+		pv_elapsedtime_add_nsec(next_ratecheck, (long long) (1000000000.0L * (quantum - *tokens) / rate) + 1);
+		pv_trace_record(&(state->transfer), PV_TRACE_RATE, -1, 0, NULL);
+		return 0;
+	}
+
+	pv_elapsedtime_copy(next_ratecheck, now);
+
+	/*
+	 * In line mode the tokens are lines, which don't map onto a write
+	 * size, so allow them all; pv_transfer() cuts the write after that
+	 * many lines.
+	 */
+	if (state->control.linemode) {
+		pv_trace_record(&(state->transfer), PV_TRACE_RATE, -1, (long long) (*tokens), NULL);
+		return (off_t) (*tokens);
+	}
+
+	pv_trace_record(&(state->transfer), PV_TRACE_RATE, -1, (long long) quantum, NULL);
+	return (off_t) quantum;
+}
+
+
+/*
+ * Call each progress observer with the transfer state and the rates just
+ * calculated.
+ */
+static void pv__notify_observers(pvstate_t state, bool final)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < state->control.observer_count; idx++)
+		state->control.observer[idx].callback(&(state->transfer), &(state->calc), final,
+						      state->control.observer[idx].data);
+}
+
+
 /*
  * Pipe data from a list of files to standard output, giving information
  * about the transfer on standard error according to the given options.
@@ -178,12 +303,12 @@ int pv_main_loop(pvstate_t state)
 	off_t cansend;
 	ssize_t written;
 	long double target;
-	bool eof_in, eof_out, final_update;
+	bool eof_in, eof_out, final_update, remote_due, ticking;
 	struct timespec start_time, next_update, next_ratecheck, cur_time;
-	struct timespec next_remotecheck;
+	struct timespec next_remotecheck, last_refill;
 	int input_fd, output_fd;
 	unsigned int file_idx;
-	bool output_is_pipe;
+	bool output_is_pipe, output_is_socket;
 
 	/*
 	 * "written" is ALWAYS bytes written by the last transfer.
@@ -206,6 +331,7 @@ int pv_main_loop(pvstate_t state)
 
 	/* Determine whether the output is a pipe. */
 	output_is_pipe = false;
+	output_is_socket = false;
 	{
 		struct stat sb;
 		memset(&sb, 0, sizeof(sb));
@@ -214,6 +340,9 @@ int pv_main_loop(pvstate_t state)
 			if ((sb.st_mode & S_IFMT) == S_IFIFO) {
 				output_is_pipe = true;
 				debug("%s", "output is a pipe");
+			} else if ((sb.st_mode & S_IFMT) == S_IFSOCK) {
+				output_is_socket = true;
+				debug("%s", "output is a socket");
 			}
 			/*@+type@ *//* splint says st_mode is __mode_t, not mode_t */
 		} else {
@@ -249,10 +378,12 @@ int pv_main_loop(pvstate_t state)
 	pv_elapsedtime_copy(&start_time, &cur_time);
 
 	memset(&next_ratecheck, 0, sizeof(next_ratecheck));
+	memset(&last_refill, 0, sizeof(last_refill));
 	memset(&next_remotecheck, 0, sizeof(next_remotecheck));
 	memset(&next_update, 0, sizeof(next_update));
 
 	pv_elapsedtime_copy(&next_ratecheck, &cur_time);
+	pv_elapsedtime_copy(&last_refill, &cur_time);
 	pv_elapsedtime_copy(&next_remotecheck, &cur_time);
 	pv_elapsedtime_copy(&next_update, &cur_time);
 	if ((state->control.delay_start > 0)
@@ -276,6 +407,12 @@ int pv_main_loop(pvstate_t state)
 			file_idx++;
 	}
 
+	/*
+	 * Carry on from the --checkpoint file, if there is one.
+	 */
+	if (input_fd >= 0)
+		input_fd = pv_checkpoint_start(state, &file_idx, input_fd);
+
 	/*
 	 * Exit early if there was no readable input file.
 	 */
@@ -289,20 +426,12 @@ int pv_main_loop(pvstate_t state)
 	(void) posix_fadvise(input_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 #endif
 
-#ifdef O_DIRECT
-	/*
-	 * Set or clear O_DIRECT on the output.
-	 */
-	if (0 != fcntl(output_fd, F_SETFL, (state->control.direct_io ? O_DIRECT : 0) | fcntl(output_fd, F_GETFL))) {
-		debug("%s: %s", "fcntl", strerror(errno));
-	}
-	state->control.direct_io_changed = false;
-#endif				/* O_DIRECT */
-
 #if HAVE_STRUCT_STAT_ST_BLKSIZE
 	/*
 	 * Set target buffer size if the initial file's block size can be
-	 * read and we weren't given a target buffer size.
+	 * read and we weren't given a target buffer size.  If the input or
+	 * output is a disk device, the size is then fitted to its sectors,
+	 * so that raw disk copies are done in whole aligned units.
 	 */
 	if (0 == state->control.target_buffer_size) {
 		struct stat sb;
@@ -313,6 +442,8 @@ int pv_main_loop(pvstate_t state)
 			if (sz > BUFFER_SIZE_MAX) {
 				sz = BUFFER_SIZE_MAX;
 			}
+			sz = pv_blkdev_buffer_size(input_fd, sz, BUFFER_SIZE_MAX);
+			sz = pv_blkdev_buffer_size(state->control.output_fd, sz, BUFFER_SIZE_MAX);
 			state->control.target_buffer_size = sz;
 		}
 	}
@@ -321,6 +452,39 @@ int pv_main_loop(pvstate_t state)
 	if (0 == state->control.target_buffer_size)
 		state->control.target_buffer_size = BUFFER_SIZE;
 
+	/*
+	 * Settle which NUMA node and processors to use before any buffers
+	 * are allocated or threads started.
+	 */
+	pv_numa_place(state, input_fd, output_fd);
+
+	/* Start the rate and ETA from earlier transfers, for --history. */
+	if (NULL != state->control.history_file)
+		pv_history_start(state, input_fd, output_fd);
+
+	/*
+	 * Writes to a socket are made with MSG_DONTWAIT, so they don't need
+	 * a timer to interrupt them.
+	 */
+	pv_transfer_output_check(state, output_fd);
+
+	/* Size the pipes for --pipe-size before anything goes through them. */
+	if ((state->control.pipe_size > 0) || state->control.pipe_size_auto)
+		pv_pipesize_update(state, input_fd, &cur_time);
+
+	/*
+	 * Have the ticker thread say when the clock needs to be looked at,
+	 * so that otherwise the loop doesn't have to read it on every pass.
+	 */
+	ticking = false;
+#ifdef HAVE_PTHREAD
+	ticking = pv_ticker_start(&(state->transfer), &next_update);
+#endif
+
+	/* Start recording events for --trace. */
+	if (NULL != state->control.trace_file)
+		(void) pv_trace_start(state);
+
 	/*
 	 * Repeat until eof_in is true, eof_out is true, and final_update is
 	 * true.
@@ -333,9 +497,17 @@ int pv_main_loop(pvstate_t state)
 		/*
 		 * Check for remote messages from -R, -Q every short while.
 		 */
+		remote_due = false;
 		if (pv_elapsedtime_compare(&cur_time, &next_remotecheck) > 0) {
-			(void) pv_remote_check(state);
+			if (!state->control.embedded)
+				(void) pv_remote_check(state);
 			pv_elapsedtime_add_nsec(&next_remotecheck, REMOTE_INTERVAL);
+			/* Don't let the check fall behind the clock. */
+			if (pv_elapsedtime_compare(&next_remotecheck, &cur_time) < 0) {
+				pv_elapsedtime_copy(&next_remotecheck, &cur_time);
+				pv_elapsedtime_add_nsec(&next_remotecheck, REMOTE_INTERVAL);
+			}
+			remote_due = true;
 		}
 
 		if (1 == state->flags.trigger_exit)
@@ -343,18 +515,22 @@ int pv_main_loop(pvstate_t state)
 
 		if (state->control.rate_limit > 0) {
 			pv_elapsedtime_read(&cur_time);
-			if (pv_elapsedtime_compare(&cur_time, &next_ratecheck) > 0) {
-				target +=
-				    ((long double) (state->control.rate_limit)) / (long double) (1000000000.0 /
-												 (long double)
-												 (RATE_GRANULARITY));
-				long double burst_max = ((long double) (state->control.rate_limit * RATE_BURST_WINDOW));
-				if (target > burst_max) {
-					target = burst_max;
-				}
-				pv_elapsedtime_add_nsec(&next_ratecheck, RATE_GRANULARITY);
+			cansend = pv__rate_allowance(state, &target, &last_refill, &cur_time, &next_ratecheck);
+
+			/*
+			 * If there's data waiting to be written and the
+			 * next quantum is only a moment away, sleep until
+			 * it's due rather than waiting for the next poll
+			 * timeout, which is only accurate to a millisecond.
+			 */
+			if ((0 == cansend) && (state->transfer.read_position > state->transfer.write_position)) {
+				struct timespec wait_for;
+				pv_elapsedtime_subtract(&wait_for, &next_ratecheck, &cur_time);
+				if ((0 == wait_for.tv_sec) && (wait_for.tv_nsec > 0))
+					pv_nanosleep((long long) (wait_for.tv_nsec));
+				pv_elapsedtime_read(&cur_time);
+				cansend = pv__rate_allowance(state, &target, &last_refill, &cur_time, &next_ratecheck);
 			}
-			cansend = (off_t) target;
 		}
 
 		/*
@@ -374,6 +550,40 @@ int pv_main_loop(pvstate_t state)
 			}
 		}
 
+		/*
+		 * Let pv_transfer() wait for I/O until whichever comes
+		 * first of the next remote control check, display update,
+		 * or rate limit step, but no longer.  A display update
+		 * that is already overdue is left out, since with -W or
+		 * no display it won't move on until data arrives.
+		 *
+		 * With the ticker running, "cur_time" is only read when it
+		 * ticks, so those deadlines go stale in between; the wait
+		 * is until the ticker's next tick instead, which is when
+		 * they will next be looked at.
+		 */
+		pv_elapsedtime_copy(&(state->transfer.wait_deadline), &next_remotecheck);
+		if ((pv_elapsedtime_compare(&next_update, &cur_time) > 0)
+		    && (pv_elapsedtime_compare(&next_update, &(state->transfer.wait_deadline)) < 0))
+			pv_elapsedtime_copy(&(state->transfer.wait_deadline), &next_update);
+#ifdef HAVE_PTHREAD
+		if (ticking)
+			(void) pv_ticker_next(&(state->transfer), &(state->transfer.wait_deadline));
+#endif
+		if ((state->control.rate_limit > 0)
+		    && (pv_elapsedtime_compare(&next_ratecheck, &(state->transfer.wait_deadline)) < 0))
+			pv_elapsedtime_copy(&(state->transfer.wait_deadline), &next_ratecheck);
+
+		/*
+		 * Answer any requests on the control socket, and send any
+		 * subscription updates that are due, bringing the deadline
+		 * forward to the next one.  The poller flags the socket as
+		 * readable, but it is also checked along with -R and -Q in
+		 * case the poller can't watch it.
+		 */
+		if (!state->control.embedded)
+			pv_ctlsock_service(state, &cur_time, remote_due, &(state->transfer.wait_deadline));
+
 		if ((0 < state->control.size) && (state->control.stop_at_size)
 		    && (0 >= cansend) && eof_in && eof_out) {
 			written = 0;
@@ -381,9 +591,45 @@ int pv_main_loop(pvstate_t state)
 			written = pv_transfer(state, input_fd, &eof_in, &eof_out, cansend, &lineswritten);
 		}
 
+		/* Move a store-and-forward spool to disk once it's too big. */
+		if (NULL != state->status.spool)
+			pv_spool_check(state);
+
+		/* Release the page cache behind the transfer. */
+		if (state->control.drop_behind && (written > 0))
+			pv_dropbehind_update(state, input_fd);
+
+		/* Size the input and output pipes, for --pipe-size. */
+		if ((state->control.pipe_size > 0) || state->control.pipe_size_auto)
+			pv_pipesize_update(state, input_fd, &cur_time);
+
+		/* Adjust the rate limit to keep latency down, for --latency-target. */
+		if ((state->control.latency_target > 0) || (state->control.pressure_target > 0))
+			pv_throttle_update(state, &cur_time);
+
+		/* Make the output durable a group of writes at a time. */
+		if (((state->control.sync_every > 0) || (state->control.sync_interval > 0)) && (written > 0)
+		    && (!pv_groupsync_update(state, written)))
+			written = -1;
+
 		/* End on write error. */
 		if (written < 0) {
 			debug("%s: %s", "write error from pv_transfer", strerror(errno));
+#ifdef HAVE_PTHREAD
+			pv_pipeline_stop(&(state->transfer));
+			pv_directio_stop(&(state->transfer));
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+			pv_uring_stop(&(state->transfer));
+#endif
+#ifdef HAVE_MMAP
+			pv_mmapin_stop(&(state->transfer));
+#endif
+#ifdef HAVE_PTHREAD
+			pv_ticker_stop(&(state->transfer));
+#endif
+			pv_rescue_finish(state);
+			pv_checkpoint_finish(state, false);
 			if (state->control.cursor)
 				pv_crs_fini(&(state->cursor), &(state->control), &(state->flags));
 			return state->status.exit_status;
@@ -399,6 +645,10 @@ int pv_main_loop(pvstate_t state)
 				target -= written;
 		}
 
+		/* Record how far we've got with --checkpoint. */
+		if (written > 0)
+			pv_checkpoint_update(state, written);
+
 #ifdef FIONREAD
 		/*
 		 * If writing to a pipe, look at how much is sitting in the
@@ -417,6 +667,8 @@ int pv_main_loop(pvstate_t state)
 					if (((size_t) nbytes) != state->transfer.written_but_not_consumed)
 						debug("%s: %d", "written_but_not_consumed is now", nbytes);
 					state->transfer.written_but_not_consumed = (size_t) nbytes;
+					pv_trace_record(&(state->transfer), PV_TRACE_UNCONSUMED, output_fd,
+							(long long) nbytes, NULL);
 				} else {
 					debug("%s: %d", "FIONREAD gave a negative byte count", nbytes);
 					state->transfer.written_but_not_consumed = 0;
@@ -425,11 +677,28 @@ int pv_main_loop(pvstate_t state)
 				debug("%s(%d,%s): %s", "ioctl", output_fd, "FIONREAD", strerror(errno));
 				state->transfer.written_but_not_consumed = 0;
 			}
+			/* With --streams, add what the streams haven't delivered yet. */
+			if ((NULL != state->status.stripe_output) && (0 == state->flags.pipe_closed))
+				state->transfer.written_but_not_consumed += pv_stripe_queued(state);
 		}
 #endif
 
+		/*
+		 * If writing to a socket, the data still waiting for the
+		 * receiver is whatever it has not yet acknowledged, which is
+		 * treated like the unread data in a pipe.
+		 */
+		if (output_is_socket) {
+			size_t nbytes = 0;
+			if ((0 != state->flags.pipe_closed) || (!pv_net_queued(output_fd, &nbytes)))
+				nbytes = 0;
+			if (nbytes != state->transfer.written_but_not_consumed)
+				debug("%s: %ld", "written_but_not_consumed is now", (long) nbytes);
+			state->transfer.written_but_not_consumed = nbytes;
+		}
+
 		state->transfer.transferred = state->transfer.total_written;
-		if (output_is_pipe && !state->control.linemode) {
+		if ((output_is_pipe || output_is_socket) && !state->control.linemode) {
 			/*
 			 * Writing bytes to a pipe - the amount transferred
 			 * to the receiver is the total amount we've
@@ -438,43 +707,24 @@ int pv_main_loop(pvstate_t state)
 			 */
 			state->transfer.transferred -= state->transfer.written_but_not_consumed;
 
-		} else if (output_is_pipe && state->control.linemode && state->transfer.written_but_not_consumed > 0
+		} else if ((output_is_pipe || output_is_socket) && state->control.linemode
+			   && state->transfer.written_but_not_consumed > 0
 			   && NULL != state->transfer.line_positions) {
 			/*
 			 * Writing lines to a pipe - similar to above, but
 			 * we have to work out how many lines the
 			 * yet-to-be-consumed data in the buffer equates to.
 			 *
-			 * To do this, we walk backwards through our record
-			 * of the line positions in the output we've
-			 * written.
+			 * To do this, we count the line separators we
+			 * recorded writing after the last consumed
+			 * position.
 			 */
 			off_t last_consumed_position =
 			    state->transfer.last_output_position - state->transfer.written_but_not_consumed;
-			size_t lines_not_consumed = 0;
-			size_t line_from_end = 0;
+			size_t lines_not_consumed;
 
-			/*
-			 * positions[head-1] = position of last separator written
-			 * positions[head-2] = position of second last separator written
-			 * etc
-			 *
-			 * We start at [head-1] and go backwards, wrapping
-			 * around as it's a circular buffer, stopping at the
-			 * length (number of positions stored), or when we
-			 * have gone before the last consumed position.
-			 */
-			for (line_from_end = 0; line_from_end < state->transfer.line_positions_length; line_from_end++) {
-				size_t array_index;
-				array_index =
-				    state->transfer.line_positions_head + state->transfer.line_positions_capacity -
-				    line_from_end - 1;
-				while (array_index >= state->transfer.line_positions_capacity)
-					array_index -= state->transfer.line_positions_capacity;
-				if (state->transfer.line_positions[array_index] <= last_consumed_position)
-					break;
-				lines_not_consumed++;
-			}
+			lines_not_consumed = pv_linepos_count_after(state->transfer.line_positions,
+								    last_consumed_position);
 
 			debug("%s: %lld -> %lld", "written_but_not_consumed bytes to lines",
 			      (unsigned long long) (state->transfer.written_but_not_consumed),
@@ -499,8 +749,19 @@ int pv_main_loop(pvstate_t state)
 			}
 		}
 
-		/* Now check the current time. */
-		pv_elapsedtime_read(&cur_time);
+		/*
+		 * Now check the current time - but with the ticker running,
+		 * only when it has ticked, or at the end.  In between,
+		 * "cur_time" stays where it was, so none of the deadlines
+		 * compared against it are reached.
+		 */
+		if ((!ticking) || (eof_in && eof_out)) {
+			pv_elapsedtime_read(&cur_time);
+#ifdef HAVE_PTHREAD
+		} else if (pv_ticker_due(&(state->transfer))) {
+			pv_elapsedtime_read(&cur_time);
+#endif
+		}
 
 		/*
 		 * If we've read everything and written everything, and the
@@ -554,10 +815,12 @@ int pv_main_loop(pvstate_t state)
 			 * While we reset the offset counter we must disable
 			 * SIGTSTOP so things don't mess up.
 			 */
-			pv_sig_nopause();
+			if (!state->control.embedded)
+				pv_sig_nopause();
 			pv_elapsedtime_read(&start_time);
 			pv_elapsedtime_zero(&(state->signal.total_stoppage_time));
-			pv_sig_allowpause();
+			if (!state->control.embedded)
+				pv_sig_allowpause();
 
 			/*
 			 * Start the display, but only at the next interval,
@@ -565,17 +828,38 @@ int pv_main_loop(pvstate_t state)
 			 */
 			pv_elapsedtime_copy(&next_update, &start_time);
 			pv_elapsedtime_add_nsec(&next_update, (long long) (1000000000.0 * state->control.interval));
+#ifdef HAVE_PTHREAD
+			pv_ticker_schedule(&(state->transfer), &next_update);
+#endif
 		}
 
 		/* Calculate the elapsed transfer time. */
 		state->transfer.elapsed_seconds =
 		    pv__elapsed_transfer_time(&start_time, &cur_time, &(state->signal.total_stoppage_time));
 
+		/* Publish the new totals for external monitors. */
+		pv_statspage_update(state, false);
+
+#ifdef HAVE_PTHREAD
+		/* Pick up the latest total from any background size calculation. */
+		pv_prescan_update(state);
+		pv_sizescan_update(state);
+		pv_spool_update(state);
+#endif
+		pv_linesample_update(state);
+
+		/* Follow the codec's ratio so far, so the ETA tracks the input. */
+		pv_codec_update(state);
+
 		/*
 		 * Just go round the loop again if there's no display and
-		 * we're not reporting statistics.
+		 * we're not reporting statistics, or measuring rates for
+		 * --history.
 		 */
-		if (state->control.no_display && !state->control.show_stats) {
+		if (state->control.no_display && !state->control.show_stats && (state->control.stats_fd < 0)
+		    && (NULL == state->control.metrics_file) && (0 == state->control.observer_count)
+		    && (state->control.stall_timeout <= 0) && (0 == state->control.rate_drop)
+		    && (NULL == state->transfer.history)) {
 			continue;
 		}
 
@@ -589,6 +873,9 @@ int pv_main_loop(pvstate_t state)
 		/* Set the "next update" time to now, if it's in the past. */
 		if (pv_elapsedtime_compare(&next_update, &cur_time) < 0)
 			pv_elapsedtime_copy(&next_update, &cur_time);
+#ifdef HAVE_PTHREAD
+		pv_ticker_schedule(&(state->transfer), &next_update);
+#endif
 
 		/* Resize the display, if a resize signal was received. */
 		(void) pv__resize_display_on_signal(state);
@@ -598,17 +885,41 @@ int pv_main_loop(pvstate_t state)
 			pv_calculate_transfer_rate(&(state->calc), &(state->transfer), &(state->control),
 						   &(state->display), final_update);
 		} else {
+			struct timespec display_start;
+
+			if (NULL != state->transfer.trace)
+				pv_elapsedtime_read(&display_start);
+
 			/* Produce the display. */
 			pv_display(&(state->status), &(state->control), &(state->flags), &(state->transfer),
 				   &(state->calc), &(state->cursor), &(state->display), &(state->extra_display),
 				   final_update);
+
+			if (NULL != state->transfer.trace)
+				pv_trace_record(&(state->transfer), PV_TRACE_DISPLAY, -1, 0, &display_start);
 		}
+
+		/* Note the rate in the first few seconds for --history. */
+		pv_history_sample(state);
+
+		/* Write a machine-readable record for --stats-fd. */
+		pv_statsout_write(state, final_update);
+		pv_metrics_update(state, final_update);
+
+		/* Look for stalls and rate drops, for --stall-timeout. */
+		pv_stall_check(state, final_update);
+
+		/* Tell any observers, such as a program that pv is embedded in. */
+		pv__notify_observers(state, final_update);
 	}
 
 	debug("%s: %s=%s, %s=%s", "loop ended", "eof_in", eof_in ? "true" : "false", "eof_out",
 	      eof_out ? "true" : "false");
 
 	if (state->control.cursor) {
+#ifdef HAVE_IPC
+		pv_crs_publish(&(state->cursor), &(state->control), &(state->transfer));
+#endif
 		pv_crs_fini(&(state->cursor), &(state->control), &(state->flags));
 	} else {
 		if ((!state->control.numeric) && (!state->control.no_display)
@@ -619,11 +930,54 @@ int pv_main_loop(pvstate_t state)
 	if (1 == state->flags.trigger_exit)
 		state->status.exit_status |= PV_ERROREXIT_SIGNAL;
 
-	if (input_fd >= 0)
+#ifdef HAVE_PTHREAD
+	pv_ticker_stop(&(state->transfer));
+
+	/* Make sure no reader thread is still using the input. */
+	pv_pipeline_stop(&(state->transfer));
+	pv_directio_stop(&(state->transfer));
+	pv_prescan_stop(state);
+	pv_prefetch_stop(state);
+	pv_sizescan_stop(state);
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+	pv_uring_stop(&(state->transfer));
+#endif
+#ifdef HAVE_MMAP
+	pv_mmapin_stop(&(state->transfer));
+#endif
+
+	pv_groupsync_finish(state);
+
+	if (state->control.drop_behind)
+		pv_dropbehind_finish(state, input_fd);
+
+	/* Write out the final --rescue map. */
+	pv_rescue_finish(state);
+
+	/* Remove the checkpoint if we got to the end, or update it if not. */
+	pv_checkpoint_finish(state, eof_in && eof_out && (0 == state->status.exit_status));
+
+	/* Remember how fast this transfer went, for --history. */
+	pv_history_finish(state, eof_in && eof_out && (0 == state->status.exit_status));
+
+	/* An input passed in with pv_state_input_fd_set() is the caller's to close. */
+	if ((input_fd >= 0) && (input_fd != state->control.input_fd)) {
+		pv_poller_forget(&(state->transfer), input_fd);
 		(void) close(input_fd);
+	}
+
+	/* Wait for any parallel streams to send the last of the data. */
+	pv_stripe_finish(state);
+
+	/* Write out the rest of the --trace events and close the file. */
+	pv_trace_free(&(state->transfer));
+
+	pv_statspage_update(state, true);
 
 	/* Calculate and display the transfer statistics. */
 	pv__show_stats(state);
+	pv_profile_show(state);
 
 	return state->status.exit_status;
 }
@@ -633,7 +987,7 @@ int pv_main_loop(pvstate_t state)
  * Return true if the given string contains a "%N" or "%{name}" format
  * sequence.
  */
-static bool format_contains_name(const char *format_string)
+bool pv_format_contains_name(const char *format_string)
 {
 	while ('\0' != format_string[0]) {
 		/* If we're not on a '%' character, move on. */
@@ -712,7 +1066,7 @@ static void pv_watchfd_update_format_string(pvstate_t state)
 
 	if (state->watchfd.count > 1 || -1 == state->watchfd.watching[0].fd) {
 		/* Watching more than one single FD; need %N. */
-		if (!format_contains_name(original_format_string)) {
+		if (!pv_format_contains_name(original_format_string)) {
 			(void) pv_snprintf(new_format_string, sizeof(new_format_string), "%%N %s",
 					   original_format_string);
 		} else {
@@ -739,6 +1093,310 @@ static void pv_watchfd_update_format_string(pvstate_t state)
 }
 
 
+/*
+ * Bring the given fd item of a watched item up to date for the display
+ * update happening at "cur_time": remove it if it has been closed for long
+ * enough or, if not displayable, has changed; otherwise sample its current
+ * position, marking it as closed if that fails.  The progress since the
+ * last sample is added to the totals for its process and for the tree.
+ *
+ * Returns true if the item is to be displayed.
+ */
+static bool pv__watchfd_sample(pvstate_t state, struct pvwatcheditem_s *item, pvwatchfd_t info_item,
+			       const struct timespec *cur_time)
+{
+	off_t position_now;
+
+	info_item->recent = 0;
+
+	if (!info_item->displayable) {
+		/*
+		 * Non-displayable fd - just remove if changed.
+		 */
+		if (pv_watchfd_changed(info_item)) {
+			debug("%s %d: %s", "fd", info_item->watch_fd, "non-displayable, and has changed - removing");
+			info_item->unused = true;
+			info_item->displayable = false;
+			pv_freecontents_watchfd(info_item);
+		}
+		return false;
+	}
+
+	if (info_item->watch_fd < 0) {
+		debug("%s %d: %s", "fd", info_item->watch_fd, "negative fd - skipping");
+		return false;
+	}
+
+	/*
+	 * Displayable fd - display, or remove if changed.
+	 */
+
+	position_now = -1;
+
+	if (info_item->closed) {
+		/*
+		 * Closed fd - check how long since it was closed.
+		 */
+		struct timespec time_since_closed;
+		long double seconds_since_closed;
+
+		memset(&time_since_closed, 0, sizeof(time_since_closed));
+		pv_elapsedtime_subtract(&time_since_closed, cur_time, &(info_item->end_time));
+		seconds_since_closed = pv_elapsedtime_seconds(&time_since_closed);
+
+		/* Closed for long enough - remove. */
+		if (seconds_since_closed > state->control.interval) {
+			debug("%s %d: %s (%Lf s)", "fd", info_item->watch_fd,
+			      "closed for long enough - removing", seconds_since_closed);
+			info_item->unused = true;
+			info_item->displayable = false;
+			pv_freecontents_watchfd(info_item);
+			return false;
+		}
+
+	} else {
+
+		/*
+		 * Open fd - get its current position.
+		 */
+
+		position_now = pv_watchfd_position(info_item);
+
+		if (position_now < 0) {
+			/*
+			 * The fd was closed - mark as closed.
+			 */
+			debug("%s %d: %s", "fd", info_item->watch_fd, "marking as closed");
+			pv_elapsedtime_copy(&(info_item->end_time), cur_time);
+			info_item->closed = true;
+		}
+	}
+
+	if (position_now >= 0) {
+		/*
+		 * If the fd is still open and we got its current position,
+		 * update its position and timers.
+		 */
+		if (position_now > info_item->position) {
+			info_item->recent = position_now - info_item->position;
+			item->transferred += info_item->recent;
+			state->watchfd.tree_transferred += info_item->recent;
+		}
+		info_item->position = position_now;
+		info_item->transfer.elapsed_seconds =
+		    pv__elapsed_transfer_time(&(info_item->start_time), cur_time, &(info_item->total_stoppage_time));
+	}
+
+	return true;
+}
+
+
+/*
+ * Display the progress of the given fd item on line "line" of the output,
+ * allocating its display state if this is the first time it is shown.
+ */
+static void pv__watchfd_show(pvstate_t state, pvwatchfd_t info_item, int line, bool terminal_resized)
+{
+	if (!pv_watchfd_prepare_display(state, info_item)) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		return;
+	}
+
+	if (line > 0) {
+		debug("%s", "adding newline");
+		pv_tty_write(&(state->flags), "\n", 1);
+	}
+
+	debug("%s %d, %s %d: %Lf / %Ld", "pid", (int) (info_item->watch_pid), "fd",
+	      info_item->watch_fd, info_item->transfer.elapsed_seconds, info_item->position);
+
+	if (terminal_resized) {
+		pv_watchpid_setname(state, info_item);
+		info_item->flags.reparse_display = 1;
+	}
+
+	/*
+	 * If this fd's line has moved, what's on the screen there belongs
+	 * to another fd, so redraw it in full.
+	 */
+	if (info_item->display_line != (unsigned int) line) {
+		info_item->display->rendered_valid = false;
+		info_item->display_line = (unsigned int) line;
+	}
+
+	info_item->transfer.transferred = info_item->position;
+	info_item->transfer.total_written = info_item->position;
+	state->control.name = info_item->display_name;
+	state->control.size = info_item->size;
+
+	pv_display(&(state->status),
+		   &(state->control), &(info_item->flags),
+		   &(info_item->transfer), &(info_item->calc), &(state->cursor), info_item->display, NULL, false);
+
+	/*@-mustfreeonly@ */
+	state->control.name = NULL;
+	/*
+	 * splint warns of a memory leak, but we'd set name to be an alias
+	 * of display_name, so nothing is lost here.
+	 */
+	/*@+mustfreeonly@ */
+}
+
+
+/*
+ * Comparison function for qsort, to order fd items with "--tree" by how
+ * much progress they made since the last update, busiest first.
+ */
+static int pv__watchfd_compare_recent(const void *a, const void *b)
+{
+	const struct pvwatchfd_s *info_a = *((const struct pvwatchfd_s *const *) a);
+	const struct pvwatchfd_s *info_b = *((const struct pvwatchfd_s *const *) b);
+
+	if (info_a->recent > info_b->recent)
+		return -1;
+	if (info_a->recent < info_b->recent)
+		return 1;
+	if (info_a->watch_pid != info_b->watch_pid)
+		return info_a->watch_pid < info_b->watch_pid ? -1 : 1;
+	if (info_a->watch_fd != info_b->watch_fd)
+		return info_a->watch_fd < info_b->watch_fd ? -1 : 1;
+	return 0;
+}
+
+
+/*
+ * Comparison function for qsort, to put the fd items chosen for display
+ * with "--tree" back into process and file descriptor order, so that they
+ * don't swap lines every update when their rates are close.
+ */
+static int pv__watchfd_compare_pidfd(const void *a, const void *b)
+{
+	const struct pvwatchfd_s *info_a = *((const struct pvwatchfd_s *const *) a);
+	const struct pvwatchfd_s *info_b = *((const struct pvwatchfd_s *const *) b);
+
+	if (info_a->watch_pid != info_b->watch_pid)
+		return info_a->watch_pid < info_b->watch_pid ? -1 : 1;
+	if (info_a->watch_fd != info_b->watch_fd)
+		return info_a->watch_fd < info_b->watch_fd ? -1 : 1;
+	return 0;
+}
+
+
+/*
+ * With "--tree", sample every fd of every process in the tree, then show
+ * one summary line for the whole tree, followed by the busiest fds, as
+ * many as fit on the screen.  Returns the number of lines displayed.
+ */
+static int pv__watchfd_tree_show(pvstate_t state, const struct timespec *cur_time, bool terminal_resized)
+{
+	char tree_name[PV_SIZEOF_DISPLAY_NAME];	/* flawfinder: ignore - bounded with pv_snprintf() */
+	/*@only@ */ /*@null@ */ pvwatchfd_t *chosen = NULL;
+	struct pvwatcheditem_s *busiest;
+	unsigned int watch_idx, process_count, chosen_count, chosen_size, chosen_idx, limit;
+	int displayed_lines;
+
+	busiest = NULL;
+	process_count = 0;
+	chosen_count = 0;
+	chosen_size = 0;
+
+	for (watch_idx = 0; watch_idx < state->watchfd.count; watch_idx++) {
+		struct pvwatcheditem_s *item = &(state->watchfd.watching[watch_idx]);
+		off_t item_recent;
+		int info_idx;
+
+		if (item->finished)
+			continue;
+
+		if (-1 == item->fd) {
+			if (0 != pv_watchpid_scanfds(state, item)) {
+				item->finished = true;
+				continue;
+			}
+		} else if ((NULL == item->info_array) || (0 == item->array_length) || (item->info_array[0].unused)
+			   || (!item->info_array[0].displayable)) {
+			item->finished = true;
+			continue;
+		}
+
+		process_count++;
+		item_recent = 0;
+
+		for (info_idx = 0; NULL != item->info_array && info_idx < item->array_length; info_idx++) {
+			pvwatchfd_t info_item = &(item->info_array[info_idx]);
+
+			if (info_item->unused)
+				continue;
+			if (!pv__watchfd_sample(state, item, info_item, cur_time))
+				continue;
+
+			item_recent += info_item->recent;
+
+			if (chosen_count >= chosen_size) {
+				pvwatchfd_t *new_chosen;
+				chosen_size = chosen_size < 64 ? 64 : 2 * chosen_size;
+				new_chosen = realloc(chosen, chosen_size * sizeof(*chosen));
+				if (NULL == new_chosen)
+					continue;
+				chosen = new_chosen;
+			}
+			if (NULL != chosen)
+				chosen[chosen_count++] = info_item;
+		}
+
+		if ((item_recent > 0) && ((NULL == busiest) || (item->transferred > busiest->transferred)))
+			busiest = item;
+	}
+
+	/* The summary line for the whole tree. */
+	if (NULL != busiest) {
+		(void) pv_snprintf(tree_name, sizeof(tree_name), "%8d:tree:%u %s, %s %d", (int) (state->watchfd.watching[0].pid),
+				   process_count, _("processes"), _("busiest"), (int) (busiest->pid));
+	} else {
+		(void) pv_snprintf(tree_name, sizeof(tree_name), "%8d:tree:%u %s", (int) (state->watchfd.watching[0].pid),
+				   process_count, _("processes"));
+	}
+
+	state->transfer.transferred = state->watchfd.tree_transferred;
+	state->transfer.total_written = state->watchfd.tree_transferred;
+	state->transfer.elapsed_seconds =
+	    pv__elapsed_transfer_time(&(state->watchfd.tree_start), cur_time, &(state->signal.total_stoppage_time));
+	state->control.name = tree_name;
+	state->control.size = 0;
+	if (terminal_resized)
+		state->flags.reparse_display = 1;
+
+	pv_display(&(state->status), &(state->control), &(state->flags), &(state->transfer), &(state->calc),
+		   &(state->cursor), &(state->display), NULL, false);
+
+	/*@-mustfreeonly@ */
+	state->control.name = NULL;
+	/*@+mustfreeonly@ */
+
+	displayed_lines = 1;
+
+	if (NULL == chosen)
+		return displayed_lines;
+
+	/* Choose the busiest fds that fit under the summary line. */
+	limit = state->control.height > 1 ? state->control.height - 1 : 0;
+	qsort(chosen, (size_t) chosen_count, sizeof(chosen[0]), pv__watchfd_compare_recent);
+	if (chosen_count > limit)
+		chosen_count = limit;
+	qsort(chosen, (size_t) chosen_count, sizeof(chosen[0]), pv__watchfd_compare_pidfd);
+
+	for (chosen_idx = 0; chosen_idx < chosen_count; chosen_idx++) {
+		pv__watchfd_show(state, chosen[chosen_idx], displayed_lines, terminal_resized);
+		displayed_lines++;
+	}
+
+	free(chosen);
+
+	return displayed_lines;
+}
+
+
 /*
  * Watch the progress of the PID:FD pairs, or of all FDs under PIDs, as
  * specified in state->watchfd, showing details on standard error according
@@ -810,9 +1468,7 @@ int pv_watchfd_loop(pvstate_t state)
 			 * If this is a whole-PID watch, do the initial FD
 			 * scan to list all the FDs under that PID.
 			 */
-			rc = pv_watchpid_scanfds(state, watching[watch_idx].pid, -1,
-						 &(watching[watch_idx].array_length),
-						 &(watching[watch_idx].info_array));
+			rc = pv_watchpid_scanfds(state, &(watching[watch_idx]));
 			if (rc != 0) {
 				/* Scan failed - error, mark as finished. */
 				pv_error("%s %u: %s", _("pid"), watching[watch_idx].pid, strerror(errno));
@@ -823,9 +1479,7 @@ int pv_watchfd_loop(pvstate_t state)
 			/*
 			 * Scan the PID for the one specific FD given.
 			 */
-			rc = pv_watchpid_scanfds(state, watching[watch_idx].pid, watching[watch_idx].fd,
-						 &(watching[watch_idx].array_length),
-						 &(watching[watch_idx].info_array));
+			rc = pv_watchpid_scanfds(state, &(watching[watch_idx]));
 			if (rc != 0) {
 				/* Scan failed - mark as finished. */
 				state->status.exit_status |= PV_ERROREXIT_ACCESS;
@@ -858,6 +1512,27 @@ int pv_watchfd_loop(pvstate_t state)
 	if (all_watching_finished)
 		goto end_pv_watchfd_loop;
 
+	/*
+	 * Arrange to be woken as soon as any of the watched processes
+	 * exits, instead of only noticing at the next update.
+	 */
+	pv_watchpid_notify_init(state);
+
+	/*
+	 * With "--tree", show PIDs on every line, and look for the first
+	 * generation of child processes straight away.
+	 */
+	if (state->watchfd.tree) {
+		state->watchfd.multiple_pids = true;
+		state->flags.reparse_display = 1;
+		pv_elapsedtime_read(&(state->watchfd.tree_start));
+		if (!pv_watchpid_tree_scan(state)) {
+			pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		}
+		watching = state->watchfd.watching;
+	}
+
 	/*
 	 * Prepare timing structures for the main loop.
 	 */
@@ -892,6 +1567,12 @@ int pv_watchfd_loop(pvstate_t state)
 				/* Fake a resize, to force a reparse. */
 				state->flags.terminal_resized = 1;
 			}
+			/*
+			 * Without kqueue there's no word of a fork, so look
+			 * for new child processes this often too.
+			 */
+			if (state->watchfd.tree)
+				state->watchfd.tree_changed = true;
 			pv_elapsedtime_add_nsec(&next_remotecheck, REMOTE_INTERVAL);
 		}
 
@@ -904,10 +1585,29 @@ int pv_watchfd_loop(pvstate_t state)
 
 		/*
 		 * Restart the loop after a brief delay, if it's not time to
-		 * update the display.
+		 * update the display - unless a watched process exits
+		 * during the delay, in which case update straight away.
 		 */
 		if (pv_elapsedtime_compare(&cur_time, &next_update) < 0) {
-			pv_nanosleep(50000000);
+			struct timespec time_to_update;
+			long long wait_nsec;
+
+			pv_elapsedtime_subtract(&time_to_update, &next_update, &cur_time);
+			wait_nsec = (long long) (time_to_update.tv_sec) * 1000000000LL + time_to_update.tv_nsec;
+			if (wait_nsec > 50000000)
+				wait_nsec = 50000000;
+
+			if (pv_watchpid_notify_wait(state, wait_nsec)) {
+				pv_elapsedtime_read(&cur_time);
+				pv_elapsedtime_copy(&next_update, &cur_time);
+			}
+
+			/* Follow new child processes as soon as they appear. */
+			if (state->watchfd.tree_changed) {
+				if (!pv_watchpid_tree_scan(state))
+					state->status.exit_status |= PV_ERROREXIT_MEMORY;
+				watching = state->watchfd.watching;
+			}
 			continue;
 		}
 
@@ -928,10 +1628,26 @@ int pv_watchfd_loop(pvstate_t state)
 		terminal_resized = pv__resize_display_on_signal(state);
 
 		/*
-		 * Run through each watched item.
+		 * Compose every line of this update into one frame, written
+		 * out at the end in a single write().
+		 */
+		pv_tty_frame_begin();
+
+		/*
+		 * Run through each watched item - or, with "--tree", show
+		 * the summary of the whole tree and its busiest fds.
 		 */
 		displayed_lines = 0;
-		for (watch_idx = 0; NULL != watching && watch_idx < state->watchfd.count; watch_idx++) {
+		if (state->watchfd.tree) {
+			if (!pv_watchpid_tree_scan(state)) {
+				pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+				state->status.exit_status |= PV_ERROREXIT_MEMORY;
+			}
+			watching = state->watchfd.watching;
+			displayed_lines = pv__watchfd_tree_show(state, &cur_time, terminal_resized);
+		}
+		for (watch_idx = 0; !state->watchfd.tree && NULL != watching && watch_idx < state->watchfd.count;
+		     watch_idx++) {
 			int info_idx;
 
 			/* Skip watched items that have finished. */
@@ -944,9 +1660,7 @@ int pv_watchfd_loop(pvstate_t state)
 				 * If this watched item is a whole PID,
 				 * rescan that PID's FDs.
 				 */
-				rc = pv_watchpid_scanfds(state, watching[watch_idx].pid, -1,
-							 &(watching[watch_idx].array_length),
-							 &(watching[watch_idx].info_array));
+				rc = pv_watchpid_scanfds(state, &(watching[watch_idx]));
 				if (rc != 0) {
 					/*
 					 * PID now inaccessible - mark it as
@@ -974,7 +1688,6 @@ int pv_watchfd_loop(pvstate_t state)
 			for (info_idx = 0;
 			     NULL != watching[watch_idx].info_array && info_idx < watching[watch_idx].array_length;
 			     info_idx++) {
-				off_t position_now;
 				pvwatchfd_t info_item = &(watching[watch_idx].info_array[info_idx]);
 
 				/* Skip unused array entries. */
@@ -985,123 +1698,10 @@ int pv_watchfd_loop(pvstate_t state)
 				if (displayed_lines >= (int) (state->control.height))
 					break;
 
-				if (!info_item->displayable) {
-					/*
-					 * Non-displayable fd - just remove if
-					 * changed.
-					 */
-					if (pv_watchfd_changed(info_item)) {
-						debug("%s %d: %s", "fd", info_item->watch_fd,
-						      "non-displayable, and has changed - removing");
-						info_item->unused = true;
-						info_item->displayable = false;
-						pv_freecontents_watchfd(info_item);
-					}
-					continue;
-				}
-
-				if (info_item->watch_fd < 0) {
-					debug("%s %d: %s", "fd", info_item->watch_fd, "negative fd - skipping");
+				if (!pv__watchfd_sample(state, &(watching[watch_idx]), info_item, &cur_time))
 					continue;
-				}
-
-				/*
-				 * Displayable fd - display, or remove if
-				 * changed.
-				 */
-
-				position_now = -1;
-
-				if (info_item->closed) {
-					/*
-					 * Closed fd - check how long since
-					 * it was closed.
-					 */
-					struct timespec time_since_closed;
-					long double seconds_since_closed;
-
-					memset(&time_since_closed, 0, sizeof(time_since_closed));
-					pv_elapsedtime_subtract(&time_since_closed, &cur_time, &(info_item->end_time));
-					seconds_since_closed = pv_elapsedtime_seconds(&time_since_closed);
-
-					/* Closed for long enough - remove. */
-					if (seconds_since_closed > state->control.interval) {
-						debug("%s %d: %s (%Lf s)", "fd", info_item->watch_fd,
-						      "closed for long enough - removing", seconds_since_closed);
-						info_item->unused = true;
-						info_item->displayable = false;
-						pv_freecontents_watchfd(info_item);
-						continue;
-					}
-
-				} else {
-
-					/*
-					 * Open fd - get its current
-					 * position.
-					 */
-
-					position_now = pv_watchfd_position(info_item);
-
-					if (position_now < 0) {
-						/*
-						 * The fd was closed - mark
-						 * as closed.
-						 */
-						debug("%s %d: %s", "fd", info_item->watch_fd, "marking as closed");
-						pv_elapsedtime_copy(&(info_item->end_time), &cur_time);
-						info_item->closed = true;
-					}
-				}
 
-				if (position_now >= 0) {
-					/*
-					 * If the fd is still open and we
-					 * got its current position, update
-					 * its position and timers.
-					 */
-					info_item->position = position_now;
-					info_item->transfer.elapsed_seconds =
-					    pv__elapsed_transfer_time(&(info_item->start_time), &cur_time,
-								      &(info_item->total_stoppage_time));
-				}
-
-				/*
-				 * Now display the information about the fd.
-				 */
-
-				if (displayed_lines > 0) {
-					debug("%s", "adding newline");
-					pv_tty_write(&(state->flags), "\n", 1);
-				}
-
-				debug("%s %d, %s %d [%d/%d]: %Lf / %Ld", "pid", (int) (info_item->watch_pid), "fd",
-				      info_item->watch_fd, watch_idx, info_idx, info_item->transfer.elapsed_seconds,
-				      info_item->position);
-
-				if (terminal_resized) {
-					pv_watchpid_setname(state, info_item);
-					info_item->flags.reparse_display = 1;
-				}
-
-				info_item->transfer.transferred = info_item->position;
-				info_item->transfer.total_written = info_item->position;
-				state->control.name = info_item->display_name;
-				state->control.size = info_item->size;
-
-				pv_display(&(state->status),
-					   &(state->control), &(info_item->flags),
-					   &(info_item->transfer), &(info_item->calc),
-					   &(state->cursor), &(info_item->display), NULL, false);
-
-				/*@-mustfreeonly@ */
-				state->control.name = NULL;
-				/*
-				 * splint warns of a memory leak, but we'd
-				 * set name to be an alias of display_name,
-				 * so nothing is lost here.
-				 */
-				/*@+mustfreeonly@ */
+				pv__watchfd_show(state, info_item, displayed_lines, terminal_resized);
 
 				displayed_lines++;
 			}
@@ -1136,6 +1736,8 @@ int pv_watchfd_loop(pvstate_t state)
 			displayed_lines--;
 		}
 
+		pv_tty_frame_end(&(state->flags), !state->control.numeric);
+
 		/* Check whether all watched items have finished. */
 		all_watching_finished = true;
 		for (watch_idx = 0; watch_idx < state->watchfd.count; watch_idx++) {
@@ -1167,7 +1769,9 @@ int pv_watchfd_loop(pvstate_t state)
 
       end_pv_watchfd_loop:
 	/* Free all allocated sub-structures. */
+	pv_watchpid_notify_free(state);
 	pv_freecontents_watchfd_items(watching, state->watchfd.count);
+	pv_tty_frame_free();
 
 	return state->status.exit_status;
 }
@@ -1240,7 +1844,8 @@ int pv_query_loop(pvstate_t state, pid_t query)
 		 * Just go round the loop again if there's no display and
 		 * we're not reporting statistics.
 		 */
-		if (state->control.no_display && !state->control.show_stats) {
+		if (state->control.no_display && !state->control.show_stats && (state->control.stats_fd < 0)
+		    && (state->control.stall_timeout <= 0) && (0 == state->control.rate_drop)) {
 			pv_nanosleep(50000000);
 			continue;
 		}
@@ -1289,6 +1894,9 @@ int pv_query_loop(pvstate_t state, pid_t query)
 			pv_display(&(state->status), &(state->control), &(state->flags), &(state->transfer),
 				   &(state->calc), &(state->cursor), &(state->display), &(state->extra_display), false);
 		}
+
+		pv_statsout_write(state, false);
+		pv_stall_check(state, false);
 	}
 
 	if (state->control.cursor) {
@@ -1302,8 +1910,12 @@ int pv_query_loop(pvstate_t state, pid_t query)
 	if (1 == state->flags.trigger_exit)
 		state->status.exit_status |= PV_ERROREXIT_SIGNAL;
 
+	/* The queried process has finished, so mark the last record. */
+	pv_statsout_write(state, true);
+
 	/* Calculate and display the transfer statistics. */
 	pv__show_stats(state);
+	pv_profile_show(state);
 
 	return state->status.exit_status;
 }
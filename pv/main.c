@@ -125,7 +125,7 @@ static int pv__write_pidfile(opts_t opts)
  */
 static int pv__set_output(pvstate_t state, opts_t opts, /*@null@ */ const char *output_file)
 {
-	int output_fd;
+	int output_fd, open_flags;
 
 	if ((NULL == state) || (NULL == opts))
 		return 0;
@@ -135,7 +135,30 @@ static int pv__set_output(pvstate_t state, opts_t opts, /*@null@ */ const char *
 		return 0;
 	}
 
-	output_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);	/* flawfinder: ignore */
+	/*
+	 * A resumed --rescue fills in the gaps in what it wrote last time,
+	 * and a resumed --checkpoint carries on from part way through, so
+	 * the output must not be truncated; --checkpoint truncates it itself
+	 * at the point it starts writing from.
+	 */
+	open_flags = O_WRONLY | O_CREAT;
+	if ((NULL == opts->rescue_map) && (NULL == opts->checkpoint_file))
+		open_flags |= O_TRUNC;
+
+	if (pv_net_is_address(output_file)) {
+		/* These report their own errors. */
+		if (opts->streams > 1) {
+			output_fd = pv_stripe_output_open(state, output_file, opts->streams, opts->buffer_size);
+		} else {
+			output_fd = pv_net_open(output_file, true, opts->buffer_size);
+		}
+		if (output_fd < 0)
+			return PV_ERROREXIT_ACCESS;
+		pv_state_output_set(state, output_fd, output_file);
+		return 0;
+	}
+
+	output_fd = open(output_file, open_flags, 0600);	/* flawfinder: ignore */
 	/*
 	 * flawfinder rationale: the output filename has been
 	 * explicitly provided, and in many cases the operator will
@@ -154,73 +177,126 @@ static int pv__set_output(pvstate_t state, opts_t opts, /*@null@ */ const char *
 
 
 /*
- * Run in store-and-forward mode: run the main loop once with the output
- * forced to the store-and-forward file (taking care of creation and removal
- * of a temporary file if "-" was specified); then run the main loop again
- * with the input file list forced to be just the store-and-forward file. 
+ * Open each extra output given by repeating "-o", and add it to the state.
  * Returns nonzero on error.
  */
-static int pv__store_and_forward(pvstate_t state, opts_t opts, bool can_have_eta)
+static int pv__set_extra_outputs(pvstate_t state, opts_t opts)
 {
-	char tmp_filename[4096];	 /* flawfinder: ignore */
-	bool use_temporary_file;
-	char *real_store_and_forward_file;
+	unsigned int output_idx;
+
+	if ((NULL == state) || (NULL == opts) || (NULL == opts->extra_output))
+		return 0;
+
+	for (output_idx = 0; output_idx < opts->extra_output_count; output_idx++) {
+		const char *output_file = opts->extra_output[output_idx];
+		int output_fd;
+
+		if (0 == strcmp(output_file, "-")) {
+			output_fd = dup(STDOUT_FILENO);
+		} else if (pv_net_is_address(output_file)) {
+			output_fd = pv_net_open(output_file, true, opts->buffer_size);
+			if (output_fd < 0)
+				return PV_ERROREXIT_ACCESS;
+		} else {
+			output_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);	/* flawfinder: ignore */
+			/* flawfinder - see pv__set_output(). */
+		}
+		if (output_fd < 0) {
+			fprintf(stderr, "%s: %s: %s\n", opts->program_name, output_file, strerror(errno));
+			return PV_ERROREXIT_ACCESS;
+		}
+		(void) fcntl(output_fd, F_SETFD, FD_CLOEXEC);
+
+		if (!pv_fanout_add(state, output_fd, output_file)) {
+			(void) close(output_fd);
+			return PV_ERROREXIT_MEMORY;
+		}
+	}
+
+	return 0;
+}
+
+
+#ifdef HAVE_PTHREAD
+/*
+ * Run in overlapped store-and-forward mode: store the input in the
+ * background, and start transmitting it, from behind, as soon as enough
+ * has been stored, rather than waiting for all of it.  Returns nonzero on
+ * error.
+ */
+static int pv__store_and_forward_overlapped(pvstate_t state, opts_t opts)
+{
+	const char *forward_input;
 	int retcode;
 
-	/* flawfinder: zeroed with memset and bounded by pv_snprintf. */
+	debug("%s: %s", "starting overlapped store-and-forward", opts->store_and_forward_file);
+	forward_input =
+	    pv_spool_forward_start(state,
+				   0 == strcmp(opts->store_and_forward_file, "-") ? NULL : opts->store_and_forward_file,
+				   opts->forward_after);
+	if (NULL == forward_input)
+		return PV_ERROREXIT_SAF;
+
+	/* The main loop transmits what the spool forwards to it. */
+	pv_state_inputfiles(state, 1, &forward_input);
+	pv_state_size_set(state, 0);
+
+	debug("%s", "running store-and-forward transmitter");
+	retcode = pv_main_loop(state);
+	retcode |= pv_spool_forward_finish(state);
+
+	pv_spool_free(state);
+
+	return retcode;
+}
+#endif				/* HAVE_PTHREAD */
+
+
+/*
+ * Run in store-and-forward mode: run the main loop once with the output
+ * forced to the store-and-forward file (or to a temporary spool if "-" was
+ * specified); then run the main loop again with the input file list forced
+ * to be just the store-and-forward file.  Returns nonzero on error.
+ */
+static int pv__store_and_forward(pvstate_t state, opts_t opts, bool can_have_eta)
+{
+	bool use_spool;
+	const char *real_store_and_forward_file;
+	int retcode;
 
 	if ((NULL == state) || (NULL == opts) || (NULL == opts->store_and_forward_file))
 		return 0;
 
-	memset(tmp_filename, 0, sizeof(tmp_filename));
+#ifdef HAVE_PTHREAD
+	if (opts->forward_after > 0)
+		return pv__store_and_forward_overlapped(state, opts);
+#endif
 
-	use_temporary_file = false;
+	use_spool = false;
 	if (0 == strcmp(opts->store_and_forward_file, "-"))
-		use_temporary_file = true;
+		use_spool = true;
 
 	/*
-	 * Create a temporary file if the specified file was "-".
+	 * First, set the output file to the store-and-forward file, or to
+	 * a new spool if the specified file was "-".
 	 */
-	if (use_temporary_file) {
-		char *tmpdir;
-		int tmp_fd;
-
-		tmpdir = (char *) getenv("TMPDIR");	/* flawfinder: ignore */
-		if ((NULL == tmpdir) || ('\0' == tmpdir[0]))
-			tmpdir = (char *) getenv("TMP");	/* flawfinder: ignore */
-		if ((NULL == tmpdir) || ('\0' == tmpdir[0]))
-			tmpdir = "/tmp";
-
-		/*
-		 * flawfinder rationale: null and zero-size values of $TMPDIR and
-		 * $TMP are rejected, and the destination buffer is bounded.
-		 */
+	if (use_spool) {
+		int spool_fd;
 
-		(void) pv_snprintf(tmp_filename, sizeof(tmp_filename), "%s/pv.XXXXXX", tmpdir);
-		/*@-unrecog@ *//* splint doesn't know mkstemp() */
-		tmp_fd = mkstemp(tmp_filename);	/* flawfinder: ignore */
-		/*@+unrecog@ */
-		if (tmp_fd < 0) {
-			fprintf(stderr, "%s: %s: %s\n", opts->program_name, tmp_filename, strerror(errno));
+		debug("%s", "setting output to store-and-forward spool");
+		spool_fd = pv_spool_create(state, opts->spool_memory);
+		if (spool_fd < 0)
 			return PV_ERROREXIT_SAF;
-		}
-		(void) close(tmp_fd);
+		/*@-mustfreefresh@ */
+		pv_state_output_set(state, spool_fd, _("(spool)"));
+		/*@+mustfreefresh@ *//* see below about gettext _() calls. */
+	} else {
+		debug("%s: %s", "setting output to store-and-forward file", opts->store_and_forward_file);
+		retcode = pv__set_output(state, opts, opts->store_and_forward_file);
+		if (0 != retcode)
+			goto end_store_and_forward;
 	}
 
-	/*
-	 * Real store-and-forward file: either the one we were given, or the
-	 * temporary file we created if we were given "-".
-	 */
-	real_store_and_forward_file = use_temporary_file ? tmp_filename : opts->store_and_forward_file;
-
-	/*
-	 * First, set the output file to the store-and-forward file.
-	 */
-	debug("%s: %s", "setting output to store-and-forward file", real_store_and_forward_file);
-	retcode = pv__set_output(state, opts, real_store_and_forward_file);
-	if (0 != retcode)
-		goto end_store_and_forward;
-
 	/* Reset the formatting to set the displayed name to "(input)". */
 	/*@-mustfreefresh@ */
 	pv_state_set_format(state, opts->progress, opts->timer, can_have_eta ? opts->eta : false,
@@ -228,9 +304,11 @@ static int pv__store_and_forward(pvstate_t state, opts_t opts, bool can_have_eta
 			    opts->bytes, opts->bufpercent, opts->lastwritten, _("(input)"));
 	/*@+mustfreefresh@ *//* see below about gettext _() calls. */
 
-	/* Run the main loop as normal. */
+	/* Run the main loop as normal, with the extra outputs held back. */
 	debug("%s", "running store-and-forward receiver");
+	pv_fanout_hold(state, true);
 	retcode = pv_main_loop(state);
+	pv_fanout_hold(state, false);
 	if (0 != retcode)
 		goto end_store_and_forward;
 
@@ -242,7 +320,12 @@ static int pv__store_and_forward(pvstate_t state, opts_t opts, bool can_have_eta
 
 	/* Replace the list of input files with the store-and-forward file. */
 	debug("%s", "resetting input file list");
-	pv_state_inputfiles(state, 1, (const char **) &real_store_and_forward_file);
+	real_store_and_forward_file = use_spool ? pv_spool_rewind(state) : opts->store_and_forward_file;
+	if (NULL == real_store_and_forward_file) {
+		retcode = PV_ERROREXIT_SAF;
+		goto end_store_and_forward;
+	}
+	pv_state_inputfiles(state, 1, &real_store_and_forward_file);
 
 	/* Recalculate the input size. */
 	pv_state_size_set(state, pv_calc_total_size(state));
@@ -260,8 +343,8 @@ static int pv__store_and_forward(pvstate_t state, opts_t opts, bool can_have_eta
 	retcode = pv_main_loop(state);
 
       end_store_and_forward:
-	if (use_temporary_file)
-		(void) remove(tmp_filename);
+	if (use_spool)
+		pv_spool_free(state);
 
 	return retcode;
 }
@@ -277,6 +360,7 @@ int main(int argc, char **argv)
 	/*@only@ */ pvstate_t state = NULL;
 	int retcode = 0;
 	bool can_have_eta = true;
+	bool size_pending = false;
 	bool terminal_supports_utf8 = false;
 
 #if ! HAVE_SETPROCTITLE
@@ -288,12 +372,6 @@ int main(int argc, char **argv)
 	(void) setlocale(LC_ALL, "");
 	(void) bindtextdomain(PACKAGE, LOCALEDIR);
 	(void) textdomain(PACKAGE);
-#ifdef HAVE_LANGINFO_H
-	/*@-mustfreefresh@ *//* splint thinks nl_langinfo() leaks memory */
-	if (0 == strcmp(nl_langinfo(CODESET), "UTF-8"))
-		terminal_supports_utf8 = true;
-	/*@+mustfreefresh@ */
-#endif
 #endif
 
 	/* Parse the command line arguments. */
@@ -371,6 +449,7 @@ int main(int argc, char **argv)
 	 */
 	if ((opts->watchfd_count > 0) && (NULL != opts->watchfd_pid) && (NULL != opts->watchfd_fd)) {
 		pv_state_watchfds(state, opts->watchfd_count, opts->watchfd_pid, opts->watchfd_fd);
+		pv_state_watch_tree_set(state, opts->watch_tree);
 	}
 
 	/*
@@ -384,10 +463,26 @@ int main(int argc, char **argv)
 		debug("%s", "nothing to display - setting no_display");
 	}
 
+	/*
+	 * Everything from here on that only matters to the display is
+	 * skipped if there isn't going to be one, so that "pv -q" starts
+	 * up as quickly as possible; the signal handlers need to know
+	 * this too.
+	 */
+	pv_state_no_display_set(state, opts->no_display);
+
+#if defined(ENABLE_NLS) && defined(HAVE_LANGINFO_H)
+	/* Check whether the terminal can show UTF-8 characters. */
+	/*@-mustfreefresh@ *//* splint thinks nl_langinfo() leaks memory */
+	if ((!opts->no_display) && (0 == strcmp(nl_langinfo(CODESET), "UTF-8")))
+		terminal_supports_utf8 = true;
+	/*@+mustfreefresh@ */
+#endif
+
 	/*
 	 * Auto-detect width or height if either are unspecified.
 	 */
-	if ((0 == opts->width) || (0 == opts->height)) {
+	if ((!opts->no_display) && ((0 == opts->width) || (0 == opts->height))) {
 		unsigned int width, height;
 		width = 0;
 		height = 0;
@@ -434,6 +529,8 @@ int main(int argc, char **argv)
 	 */
 	pv_state_sparse_output_set(state, opts->sparse_output);
 	retcode = pv__set_output(state, opts, opts->output);
+	if (0 == retcode)
+		retcode = pv__set_extra_outputs(state, opts);
 	if (0 != retcode) {
 		pv_state_free(state);
 		opts_free(opts);
@@ -448,6 +545,9 @@ int main(int argc, char **argv)
 	 */
 	pv_state_stop_at_size_set(state, opts->stop_at_size);
 
+	/* The size calculation needs to know about the codec, too. */
+	pv_state_codec_set(state, opts->codec, opts->codec_compress, opts->codec_level);
+
 	/* Total size calculation, in normal transfer mode. */
 	if (PV_ACTION_TRANSFER == opts->action) {
 		/*
@@ -456,14 +556,25 @@ int main(int argc, char **argv)
 		if (0 == opts->size) {
 			pv_state_linemode_set(state, opts->linemode);
 			pv_state_null_terminated_lines_set(state, opts->null_terminated_lines);
-			opts->size = pv_calc_total_size(state);
-			debug("%s: %llu", "no size given - calculated", opts->size);
+			pv_state_line_estimate_set(state, opts->line_estimate);
+			pv_state_record_set(state, opts->record);
+			/*
+			 * Work the size out in the background if we can,
+			 * unless it's needed up front to know when to stop.
+			 */
+			if ((!opts->stop_at_size) && pv_calc_total_size_start(state)) {
+				size_pending = true;
+				debug("%s", "no size given - calculating in the background");
+			} else {
+				opts->size = pv_calc_total_size(state);
+				debug("%s: %llu", "no size given - calculated", opts->size);
+			}
 		}
 
 		/*
 		 * If the size is unknown, we cannot have an ETA.
 		 */
-		if (opts->size < 1) {
+		if ((opts->size < 1) && (!size_pending)) {
 			can_have_eta = false;
 			debug("%s", "size unknown - ETA disabled");
 		}
@@ -478,7 +589,7 @@ int main(int argc, char **argv)
 	 * Note that this uses signals, so signal handling has to have been
 	 * set up first.
 	 */
-	if (PV_ACTION_QUERY == opts->action) {
+	if ((PV_ACTION_QUERY == opts->action) && (NULL == opts->query_targets)) {
 		opts->size = 0;
 		retcode = pv_remote_transferstate_fetch(state, opts->query, &(opts->size), false);
 		if (0 != retcode) {
@@ -506,6 +617,14 @@ int main(int argc, char **argv)
 	pv_state_force_set(state, opts->force);
 	pv_state_cursor_set(state, opts->cursor);
 	pv_state_show_stats_set(state, opts->show_stats);
+	pv_state_self_profile_set(state, opts->self_profile);
+	pv_state_huge_pages_set(state, opts->huge_pages);
+	pv_state_lock_buffers_set(state, opts->lock_buffers);
+	pv_state_numa_node_set(state, opts->numa_node);
+	pv_state_cpu_affinity_set(state, opts->cpu_affinity);
+	pv_state_manifest_set(state, opts->manifest);
+	pv_state_copy_into_set(state, opts->copy_into);
+	pv_state_jobs_set(state, opts->jobs);
 	pv_state_numeric_set(state, opts->numeric);
 	pv_state_wait_set(state, opts->wait);
 	pv_state_delay_start_set(state, opts->delay_start);
@@ -514,20 +633,49 @@ int main(int argc, char **argv)
 	pv_state_bits_set(state, opts->bits);
 	pv_state_decimal_units_set(state, opts->decimal_units);
 	pv_state_null_terminated_lines_set(state, opts->null_terminated_lines);
+	pv_state_line_estimate_set(state, opts->line_estimate);
+	pv_state_record_set(state, opts->record);
 	pv_state_skip_errors_set(state, opts->skip_errors);
 	pv_state_error_skip_block_set(state, opts->error_skip_block);
 	pv_state_sync_after_write_set(state, opts->sync_after_write);
+	pv_state_sync_group_set(state, opts->sync_every, opts->sync_interval);
+	pv_state_pipe_size_set(state, opts->pipe_size, opts->pipe_size_auto);
 	pv_state_direct_io_set(state, opts->direct_io);
+	pv_state_drop_behind_set(state, opts->drop_behind);
+	pv_state_streams_set(state, opts->streams);
+	pv_state_rescue_map_set(state, opts->rescue_map);
+	pv_state_rescue_retries_set(state, opts->rescue_retries);
+	pv_state_rescue_direct_set(state, opts->rescue_direct);
+	pv_state_checkpoint_file_set(state, opts->checkpoint_file);
 	pv_state_discard_input_set(state, opts->discard_input);
 	pv_state_rate_limit_set(state, opts->rate_limit);
+	pv_state_rate_burst_set(state, opts->rate_burst);
+	pv_state_rate_budget_set(state, opts->rate_budget, opts->rate_weight);
+	pv_state_throttle_set(state, opts->latency_target, opts->pressure_target);
+	pv_state_coalesce_set(state, opts->coalesce, opts->coalesce_bytes);
 	pv_state_target_buffer_size_set(state, opts->buffer_size);
+	pv_state_adaptive_buffer_set(state, opts->adaptive_buffer);
 	pv_state_no_splice_set(state, opts->no_splice);
+	pv_state_pipeline_buffers_set(state, opts->pipeline_buffers);
+	pv_state_io_engine_set(state, opts->io_engine);
+	pv_state_stats_page_set(state, opts->stats_page);
+	pv_state_stats_output_set(state, opts->stats_fd, opts->stats_format);
+	pv_state_metrics_file_set(state, opts->metrics_file);
+	pv_state_trace_file_set(state, opts->trace_file);
+	pv_state_history_file_set(state, opts->history_file);
+	pv_state_engine_cache_set(state, opts->engine_cache);
+	pv_state_stall_timeout_set(state, opts->stall_timeout);
+	pv_state_rate_drop_set(state, opts->rate_drop);
+	pv_state_stall_command_set(state, opts->stall_command);
 	pv_state_size_set(state, opts->size);
 	pv_state_name_set(state, opts->name);
 	pv_state_default_bar_style_set(state, opts->default_bar_style);
 	pv_state_format_string_set(state, opts->format);
 	pv_state_extra_display_set(state, opts->extra_display);
 	pv_state_average_rate_window_set(state, opts->average_rate_window);
+	pv_state_eta_model_set(state, opts->eta_model);
+	pv_state_digest_set(state, opts->digest);
+	pv_state_fanout_policy_set(state, opts->fanout_policy);
 
 	pv_state_set_format(state, opts->progress, opts->timer, can_have_eta ? opts->eta : false,
 			    can_have_eta ? opts->fineta : false, opts->rate, opts->average_rate,
@@ -558,7 +706,19 @@ int main(int argc, char **argv)
 		break;
 	case PV_ACTION_QUERY:
 		/* Query the progress of another running pv. */
-		retcode = pv_query_loop(state, opts->query);
+		if (NULL != opts->query_targets) {
+			retcode = pv_query_multi_loop(state, opts->query_targets);
+		} else {
+			retcode = pv_query_loop(state, opts->query);
+		}
+		break;
+	case PV_ACTION_MULTISTREAM:
+		/* Copy many files at once, from a manifest or into a directory. */
+		retcode = pv_multistream_loop(state);
+		break;
+	case PV_ACTION_TRACE_DECODE:
+		/* Turn a --trace file into JSON. */
+		retcode = pv_trace_decode(opts->trace_decode);
 		break;
 	}
 
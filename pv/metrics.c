@@ -0,0 +1,202 @@
+/*
+ * Functions for writing Prometheus metrics text files with "--metrics-file".
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+/*
+ * The metrics are written in the Prometheus text exposition format, which
+ * OpenMetrics scrapers also accept, to a temporary file next to the
+ * target, which is then renamed over it, so that a textfile collector
+ * such as the one in the Prometheus node exporter only ever sees a
+ * complete file.  This happens once per display interval, from the same
+ * place as the display update, so nothing about it depends on when or how
+ * often the file is scraped.
+ *
+ * "Stalled" time is elapsed time across which nothing at all was
+ * transferred, measured between successive updates.
+ */
+struct pvmetrics_s {
+	char temp_filename[PV_SIZEOF_METRICS_FILENAME];	/* flawfinder: ignore */
+	long double stalled_seconds;	 /* total time with no progress */
+	long double previous_elapsed;	 /* elapsed time at the last update */
+	off_t previous_transferred;	 /* amount transferred at the last update */
+	bool failed;			 /* set once an error has been reported */
+};
+
+/*
+ * flawfinder rationale: temp_filename is only written by pv_snprintf(),
+ * which always bounds and terminates it.
+ */
+
+
+/*
+ * Write the shared label set for this process into "buffer", escaping
+ * backslashes, double quotes, and newlines in the name.
+ */
+static void pv__metrics_labels(pvstate_t state, char *buffer, size_t bufsize)
+{
+	const char *name;
+	size_t offset;
+
+	(void) pv_snprintf(buffer, bufsize, "pid=\"%lu\",name=\"", (unsigned long) getpid());
+	offset = strlen(buffer);	    /* flawfinder: ignore - always terminated */
+
+	for (name = NULL == state->control.name ? "" : state->control.name; '\0' != *name; name++) {
+		const char *escaped = NULL;
+		if ('\\' == *name) {
+			escaped = "\\\\";
+		} else if ('"' == *name) {
+			escaped = "\\\"";
+		} else if ('\n' == *name) {
+			escaped = "\\n";
+		}
+		if (offset + 4 >= bufsize)
+			break;
+		if (NULL != escaped) {
+			buffer[offset++] = escaped[0];
+			buffer[offset++] = escaped[1];
+		} else {
+			buffer[offset++] = *name;
+		}
+	}
+
+	buffer[offset++] = '"';
+	buffer[offset] = '\0';
+}
+
+
+/*
+ * Write one metric family with a single sample to "stream".
+ */
+static void pv__metrics_family(FILE *stream, const char *labels, const char *name, const char *type,
+			       const char *help, long double value)
+{
+	fprintf(stream, "# HELP %s %s\n", name, help);
+	fprintf(stream, "# TYPE %s %s\n", name, type);
+	fprintf(stream, "%s{%s} %.18Lg\n", name, labels, value);
+}
+
+
+/*
+ * Write the current metrics to the --metrics-file, if one was given.  If
+ * "final" is true, the transfer has ended, and pv_running is written as 0.
+ *
+ * Errors are reported once, and then no more updates are attempted.
+ */
+void pv_metrics_update(pvstate_t state, bool final)
+{
+	struct pvmetrics_s *metrics;
+	char labels[PV_SIZEOF_METRICS_LABELS];	/* flawfinder: ignore - bounded by pv_snprintf() */
+	long double buffer_fill;
+	FILE *stream;
+
+	if (NULL == state->control.metrics_file)
+		return;
+
+	if (NULL == state->status.metrics) {
+		state->status.metrics = calloc(1, sizeof(*(state->status.metrics)));
+		if (NULL == state->status.metrics)
+			return;
+		(void) pv_snprintf(state->status.metrics->temp_filename,
+				   sizeof(state->status.metrics->temp_filename), "%s.tmp.%lu",
+				   state->control.metrics_file, (unsigned long) getpid());
+	}
+
+	metrics = state->status.metrics;
+	if (metrics->failed)
+		return;
+
+	/* Add up the time which passed with nothing moving. */
+	if ((state->transfer.transferred == metrics->previous_transferred)
+	    && (state->transfer.elapsed_seconds > metrics->previous_elapsed))
+		metrics->stalled_seconds += state->transfer.elapsed_seconds - metrics->previous_elapsed;
+	metrics->previous_transferred = state->transfer.transferred;
+	metrics->previous_elapsed = state->transfer.elapsed_seconds;
+
+	pv__metrics_labels(state, labels, sizeof(labels));
+
+	buffer_fill = 0.0;
+	if (state->transfer.buffer_size > 0)
+		buffer_fill = (long double) (state->transfer.read_position - state->transfer.write_position) /
+		    (long double) (state->transfer.buffer_size);
+#ifdef HAVE_SPLICE
+	/* Data moved by splice() never sits in our buffer. */
+	if (state->transfer.splice_used)
+		buffer_fill = 0.0;
+#endif
+
+	stream = fopen(metrics->temp_filename, "w");	/* flawfinder: ignore */
+	/*
+	 * flawfinder rationale: the name is chosen by the user, and the
+	 * temporary file is only ever renamed over it.
+	 */
+	if (NULL == stream) {
+		pv_error("%s: %s", metrics->temp_filename, strerror(errno));
+		metrics->failed = true;
+		return;
+	}
+
+	pv__metrics_family(stream, labels,
+			   state->control.linemode ? "pv_transferred_lines_total" : "pv_transferred_bytes_total",
+			   "counter", "Amount read from the input.", (long double) (state->transfer.transferred));
+	pv__metrics_family(stream, labels,
+			   state->control.linemode ? "pv_written_lines_total" : "pv_written_bytes_total", "counter",
+			   "Amount written to the output.", (long double) (state->transfer.total_written));
+	pv__metrics_family(stream, labels, "pv_unconsumed_bytes", "gauge",
+			   "Amount written to the output pipe but not yet read.",
+			   (long double) (state->transfer.written_but_not_consumed));
+	pv__metrics_family(stream, labels, state->control.linemode ? "pv_size_lines" : "pv_size_bytes", "gauge",
+			   "Expected total size, or 0 if unknown.", (long double) (state->control.size));
+	pv__metrics_family(stream, labels, "pv_rate", "gauge", "Current transfer rate per second.",
+			   state->calc.transfer_rate);
+	pv__metrics_family(stream, labels, "pv_average_rate", "gauge",
+			   "Average transfer rate per second over the averaging window.", state->calc.average_rate);
+	pv__metrics_family(stream, labels, "pv_buffer_fill_ratio", "gauge",
+			   "Fraction of the transfer buffer holding unwritten data.", buffer_fill);
+	pv__metrics_family(stream, labels, "pv_elapsed_seconds_total", "counter",
+			   "Time spent transferring, excluding time stopped.", state->transfer.elapsed_seconds);
+	pv__metrics_family(stream, labels, "pv_stalled_seconds_total", "counter",
+			   "Time during which nothing was transferred.", metrics->stalled_seconds);
+	pv__metrics_family(stream, labels, "pv_running", "gauge", "1 while the transfer is in progress.",
+			   final ? 0.0L : 1.0L);
+
+	if (0 != fclose(stream)) {
+		pv_error("%s: %s", metrics->temp_filename, strerror(errno));
+		(void) unlink(metrics->temp_filename);
+		metrics->failed = true;
+		return;
+	}
+
+	if (0 != rename(metrics->temp_filename, state->control.metrics_file)) {
+		pv_error("%s: %s", state->control.metrics_file, strerror(errno));
+		(void) unlink(metrics->temp_filename);
+		metrics->failed = true;
+	}
+}
+
+
+/*
+ * Free the metrics file state.  The file itself is left in place with the
+ * final values.
+ */
+void pv_metrics_free(pvstate_t state)
+{
+	if ((NULL == state) || (NULL == state->status.metrics))
+		return;
+
+	free(state->status.metrics);
+	state->status.metrics = NULL;
+}
@@ -0,0 +1,286 @@
+/*
+ * Memory-mapped input engine, for "--engine mmap".
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#ifdef HAVE_MMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/*
+ * A regular input file is mapped into memory a window at a time, and the
+ * output is written straight from the mapping, so the data is never copied
+ * into the transfer buffer.  Anything that looks at the data on the way
+ * through - line counting, the last-written display, the --sparse zero
+ * checks, --digest - does so in the mapping.
+ *
+ * A new window is mapped once less than a quarter of the current one is
+ * left, so that a line which runs across the end of one window is
+ * written whole from the next.
+ *
+ * The file's read position is kept in step with what has been written, so
+ * that anything else looking at it, such as --drop-behind, or read() if
+ * the mapping has to be given up part way through, carries on from the
+ * right place.
+ *
+ * Note that if the file is truncated while it is mapped, accessing the
+ * missing pages will raise SIGBUS.
+ */
+#define PV_MMAPIN_WINDOW	(8 * 1024 * 1024)	/* minimum bytes mapped at once */
+
+struct pvmmapin_s {
+	int fd;				 /* input file descriptor */
+	/*@null@ */ char *mapping;	 /* current window, or NULL */
+	size_t mapped_length;		 /* length of the current window */
+	off_t mapped_offset;		 /* file offset of the current window */
+	off_t position;			 /* file offset of the next byte to write */
+	off_t size;			 /* size of the file, when last checked */
+	size_t window_size;		 /* bytes to map at once */
+	size_t page_size;		 /* mapping offsets are a multiple of this */
+	bool splice_output;		 /* set if the output can take vmsplice() */
+};
+
+
+/*
+ * Unmap the current window, if there is one.
+ */
+static void pv__mmapin_unmap(struct pvmmapin_s *mmapin)
+{
+	if (NULL == mmapin->mapping)
+		return;
+	(void) munmap(mmapin->mapping, mmapin->mapped_length);
+	mmapin->mapping = NULL;
+	mmapin->mapped_length = 0;
+}
+
+
+/*
+ * Start reading "fd" through a memory mapping, from its current position.
+ * Returns false, having done nothing, if it is not a regular file with data
+ * left in it, so that the caller can read it as usual.
+ */
+bool pv_mmapin_start(pvstate_t state, int fd)
+{
+	struct pvmmapin_s *mmapin;
+	struct stat sb;
+	off_t position;
+	size_t window_size, page_size;
+
+	memset(&sb, 0, sizeof(sb));
+	if ((0 != fstat(fd, &sb)) || (!S_ISREG(sb.st_mode))) {
+		debug("%s: %d", "input is not a regular file - not mapping it", fd);
+		return false;
+	}
+
+	/*
+	 * Files such as those in /proc claim to be empty but aren't, so
+	 * only map files which say they have something left in them.
+	 */
+	position = lseek(fd, 0, SEEK_CUR);
+	if ((position < 0) || (sb.st_size <= position)) {
+		debug("%s: %d", "nothing to map in input", fd);
+		return false;
+	}
+
+	page_size = 4096;
+#if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
+	if (sysconf(_SC_PAGESIZE) > 0)
+		page_size = (size_t) sysconf(_SC_PAGESIZE);
+#endif
+
+	window_size = PV_MMAPIN_WINDOW;
+	if (state->control.target_buffer_size > window_size)
+		window_size = state->control.target_buffer_size;
+	window_size += page_size - 1;
+	window_size -= window_size % page_size;
+
+	mmapin = calloc(1, sizeof(*mmapin));
+	if (NULL == mmapin) {
+		debug("%s: %s", "calloc", strerror(errno));
+		return false;
+	}
+
+	mmapin->fd = fd;
+	mmapin->mapping = NULL;
+	mmapin->position = position;
+	mmapin->size = sb.st_size;
+	mmapin->window_size = window_size;
+	mmapin->page_size = page_size;
+
+#ifdef HAVE_SPLICE
+	/*
+	 * The pages of the mapping can be handed to an output pipe with
+	 * vmsplice(), instead of being copied into it by write().
+	 */
+	memset(&sb, 0, sizeof(sb));
+	if ((0 == fstat(state->control.output_fd, &sb)) && S_ISFIFO(sb.st_mode))
+		mmapin->splice_output = true;
+#endif				/* HAVE_SPLICE */
+
+	state->transfer.mmapin = mmapin;
+
+	debug("%s: %d: %s=%lld, %s=%ld", "mapping input", fd, "position", (long long) position, "window",
+	      (long) window_size);
+
+	return true;
+}
+
+
+/*
+ * Stop reading through a memory mapping, if we were, and unmap it.  The
+ * file descriptor is left open.
+ */
+void pv_mmapin_stop(pvtransferstate_t transfer)
+{
+	struct pvmmapin_s *mmapin;
+
+	if ((NULL == transfer) || (NULL == transfer->mmapin))
+		return;
+
+	mmapin = transfer->mmapin;
+	transfer->mmapin = NULL;
+
+	pv__mmapin_unmap(mmapin);
+	free(mmapin);
+}
+
+
+/*
+ * Return the input file descriptor being read through a mapping, or -1 if
+ * there isn't one.
+ */
+int pv_mmapin_input_fd(readonly_pvtransferstate_t transfer)
+{
+	if (NULL == transfer->mmapin)
+		return -1;
+	return transfer->mmapin->fd;
+}
+
+
+/*
+ * Point *data at the next data to write, mapping a new window first if
+ * necessary, and return how many bytes are there.
+ *
+ * Returns -1 at the end of the file.  Returns 0 if the file could not be
+ * mapped, in which case the mapping is given up on, and the rest of the
+ * file will be read as usual.
+ */
+ssize_t pv_mmapin_fetch(pvstate_t state, char **data)
+{
+	struct pvmmapin_s *mmapin;
+	off_t window_end;
+
+	mmapin = state->transfer.mmapin;
+	if (NULL == mmapin)
+		return 0;
+
+	/* At the end of the file - see whether it has grown since. */
+	if (mmapin->position >= mmapin->size) {
+		struct stat sb;
+		memset(&sb, 0, sizeof(sb));
+		if ((0 == fstat(mmapin->fd, &sb)) && (sb.st_size > mmapin->size))
+			mmapin->size = sb.st_size;
+		if (mmapin->position >= mmapin->size)
+			return -1;
+	}
+
+	window_end = mmapin->mapped_offset + (off_t) (mmapin->mapped_length);
+
+	if ((NULL == mmapin->mapping) || (mmapin->position < mmapin->mapped_offset)
+	    || (mmapin->position >= window_end)
+	    || ((window_end < mmapin->size) && (window_end - mmapin->position < (off_t) (mmapin->window_size / 4)))) {
+		off_t offset;
+		size_t length;
+		void *mapping;
+
+		pv__mmapin_unmap(mmapin);
+
+		offset = mmapin->position - (mmapin->position % (off_t) (mmapin->page_size));
+		length = mmapin->window_size;
+		if ((off_t) length > mmapin->size - offset)
+			length = (size_t) (mmapin->size - offset);
+
+		mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, mmapin->fd, offset);
+		if (MAP_FAILED == mapping) {
+			debug("%s: %s", "mmap", strerror(errno));
+			state->transfer.mmap_checked_fd = mmapin->fd;
+			pv_mmapin_stop(&(state->transfer));
+			return 0;
+		}
+#ifdef MADV_SEQUENTIAL
+		(void) madvise(mapping, length, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+		(void) madvise(mapping, length, MADV_WILLNEED);
+#endif
+
+		mmapin->mapping = mapping;
+		mmapin->mapped_offset = offset;
+		mmapin->mapped_length = length;
+		window_end = offset + (off_t) length;
+	}
+
+	*data = mmapin->mapping + (mmapin->position - mmapin->mapped_offset);
+
+	return (ssize_t) (window_end - mmapin->position);
+}
+
+
+/*
+ * Mark "count" bytes from the mapping as written, counting them as read,
+ * and move the file's read position past them.
+ */
+void pv_mmapin_consume(pvstate_t state, size_t count)
+{
+	struct pvmmapin_s *mmapin;
+
+	mmapin = state->transfer.mmapin;
+	if (NULL == mmapin)
+		return;
+
+	mmapin->position += (off_t) count;
+	state->transfer.total_bytes_read += (off_t) count;
+
+	if (lseek(mmapin->fd, mmapin->position, SEEK_SET) < 0)
+		debug("%s: %s", "lseek", strerror(errno));
+}
+
+
+/*
+ * Return true if the output is a pipe which can be given the mapped pages
+ * with vmsplice().
+ */
+bool pv_mmapin_splice_output(readonly_pvtransferstate_t transfer)
+{
+	if (NULL == transfer->mmapin)
+		return false;
+	return transfer->mmapin->splice_output;
+}
+
+
+/*
+ * Stop using vmsplice() on the output, after it has failed.
+ */
+void pv_mmapin_no_splice(pvtransferstate_t transfer)
+{
+	if (NULL == transfer->mmapin)
+		return;
+	transfer->mmapin->splice_output = false;
+}
+
+#endif				/* HAVE_MMAP */
@@ -0,0 +1,720 @@
+/*
+ * Multi-stream mode, for "--manifest" and "--copy-into": copying many input
+ * files to their own outputs, several at a time, on a pool of worker
+ * threads, with a progress line for each copy in progress and one for the
+ * total.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/* Files copied at once if "--jobs" isn't given, and the most allowed. */
+#define PV_MULTISTREAM_DEFAULT_JOBS	4
+#define PV_MULTISTREAM_MAX_JOBS		256
+
+/* Longest manifest line, which holds two paths. */
+#define PV_MULTISTREAM_LINE_LENGTH	(2 * PV_SIZEOF_FILE_FDPATH + 2)
+
+/* Longest wait between checks for finished copies, in nanoseconds. */
+#define PV_MULTISTREAM_POLL_NSEC	50000000LL
+
+typedef enum {
+	PV_MULTISTREAM_WAITING = 0,
+	PV_MULTISTREAM_RUNNING,
+	PV_MULTISTREAM_DONE,
+	PV_MULTISTREAM_FAILED
+} pvmultistream_status_t;
+
+/*
+ * One input and output pair.  The worker copying it is the only writer of
+ * "status", "position", "started", and "error", and the main thread reads
+ * them with atomic loads to show the progress; everything else belongs to
+ * the main thread.
+ */
+struct pvmultistream_pair_s {
+	/*@only@ */ char *source;	 /* file to read */
+	/*@only@ */ char *dest;		 /* file to write */
+	struct pvtransientflags_s flags; /* display flags for this pair */
+	struct pvtransferstate_s transfer; /* progress, as shown */
+	struct pvtransfercalc_s calc;	 /* rate calculations for this pair */
+	/*@only@ */ /*@null@ */ struct pvdisplay_s *display; /* display, once first shown */
+	char display_name[PV_SIZEOF_DISPLAY_NAME]; /* flawfinder: ignore */
+	off_t size;			 /* size of the source, 0 if unknown */
+	off_t position;			 /* bytes copied so far */
+	long long started;		 /* nsec time the copy started */
+	int status;			 /* a pvmultistream_status_t */
+	int error;			 /* errno of the failure, if FAILED */
+	bool reported;			 /* set once the end has been dealt with */
+};
+
+/*
+ * flawfinder rationale: display_name is only written by pv_snprintf(),
+ * which always bounds and terminates it.
+ */
+
+/*
+ * The set of pairs, and the pool of workers taking them in turn; "next" is
+ * the index of the next pair to be taken, and is claimed atomically.
+ */
+struct pvmultistream_s {
+	/*@only@ */ /*@null@ */ struct pvmultistream_pair_s *pair;
+	unsigned int count;		 /* number of pairs */
+	unsigned int allocated;		 /* pairs allocated */
+	unsigned int next;		 /* next pair for a worker to take */
+	size_t buffer_size;		 /* copy buffer size for each worker */
+	bool stop;			 /* set to make the workers finish early */
+#ifdef HAVE_PTHREAD
+	/*@only@ */ /*@null@ */ pthread_t *workers;
+	unsigned int worker_count;	 /* number of workers started */
+#endif
+};
+
+
+/*
+ * Add a pair to copy from "source" to "dest".  Returns false on error.
+ */
+static bool pv__multistream_add(struct pvmultistream_s *ms, const char *source, const char *dest)
+{
+	struct pvmultistream_pair_s *pair;
+	const char *leaf;
+
+	if (ms->count >= ms->allocated) {
+		struct pvmultistream_pair_s *new_array;
+		unsigned int new_allocated = ms->allocated < 16 ? 16 : ms->allocated * 2;
+
+		new_array = realloc(ms->pair, new_allocated * sizeof(*new_array));
+		if (NULL == new_array)
+			return false;
+		ms->pair = new_array;
+		ms->allocated = new_allocated;
+	}
+
+	pair = &(ms->pair[ms->count]);
+	memset(pair, 0, sizeof(*pair));
+
+	pair->source = pv_strdup(source);
+	pair->dest = pv_strdup(dest);
+	if ((NULL == pair->source) || (NULL == pair->dest)) {
+		free(pair->source);
+		free(pair->dest);
+		return false;
+	}
+
+	leaf = strrchr(source, '/');
+	leaf = (NULL == leaf) ? source : leaf + 1;
+	(void) pv_snprintf(pair->display_name, sizeof(pair->display_name), "%s", leaf);
+
+	ms->count++;
+
+	return true;
+}
+
+
+/*
+ * Read the pairs from the manifest file "filename", or from standard input
+ * if it is "-": one pair per line, the source and the destination
+ * separated by a tab.  Blank lines and lines starting with "#" are
+ * ignored.  Returns false on error, after reporting it.
+ */
+static bool pv__multistream_read_manifest(struct pvmultistream_s *ms, const char *filename)
+{
+	char line[PV_MULTISTREAM_LINE_LENGTH];	/* flawfinder: ignore - bounded by fgets() */
+	unsigned int line_number;
+	FILE *fptr;
+	bool ok;
+
+	if (0 == strcmp(filename, "-")) {
+		fptr = stdin;
+	} else {
+		fptr = fopen(filename, "r");	/* flawfinder: ignore */
+		/* flawfinder rationale: the manifest is only read. */
+	}
+	if (NULL == fptr) {
+		pv_error("%s: %s", filename, strerror(errno));
+		return false;
+	}
+
+	ok = true;
+	line_number = 0;
+	while (ok && (NULL != fgets(line, (int) sizeof(line), fptr))) {
+		size_t length = strlen(line);	/* flawfinder: ignore - fgets() always \0-terminates */
+		char *tab;
+
+		line_number++;
+
+		while ((length > 0) && (('\n' == line[length - 1]) || ('\r' == line[length - 1])))
+			line[--length] = '\0';
+		if ((0 == length) || ('#' == line[0]))
+			continue;
+
+		tab = strchr(line, '\t');
+		if ((NULL == tab) || (tab == line) || ('\0' == tab[1])) {
+			pv_error("%s: %u: %s", filename, line_number, _("expected a source and a destination"));
+			ok = false;
+			break;
+		}
+		*tab = '\0';
+
+		if (!pv__multistream_add(ms, line, tab + 1)) {
+			pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+			ok = false;
+		}
+	}
+
+	if (fptr != stdin)
+		(void) fclose(fptr);
+
+	return ok;
+}
+
+
+/*
+ * Add a pair for each input file, copying it into the directory "dir" under
+ * the same name.  Returns false on error, after reporting it.
+ */
+static bool pv__multistream_copy_into(struct pvmultistream_s *ms, pvstate_t state, const char *dir)
+{
+	char dest[PV_SIZEOF_FILE_FDPATH];	/* flawfinder: ignore - bounded by pv_snprintf() */
+	unsigned int file_idx;
+
+	for (file_idx = 0; file_idx < state->files.file_count; file_idx++) {
+		const char *source = state->files.filename[file_idx];
+		const char *leaf;
+
+		if ((NULL == source) || (0 == strcmp(source, "-"))) {
+			pv_error("%s: %s", "-", _("standard input cannot be copied into a directory"));
+			return false;
+		}
+
+		leaf = strrchr(source, '/');
+		leaf = (NULL == leaf) ? source : leaf + 1;
+		if ('\0' == leaf[0]) {
+			pv_error("%s: %s", source, strerror(EISDIR));
+			return false;
+		}
+
+		if (pv_snprintf(dest, sizeof(dest), "%s/%s", dir, leaf) >= (int) sizeof(dest)) {
+			pv_error("%s: %s", source, strerror(ENAMETOOLONG));
+			return false;
+		}
+
+		if (!pv__multistream_add(ms, source, dest)) {
+			pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+#ifdef HAVE_PTHREAD
+/*
+ * Copy one pair, using "buffer", of the pool's buffer size.  Returns false
+ * on error, leaving the errno in the pair.
+ */
+static bool pv__multistream_copy(struct pvmultistream_s *ms, struct pvmultistream_pair_s *pair,
+				 char *buffer)
+{
+	int input_fd, output_fd;
+	bool ok;
+
+	input_fd = open(pair->source, O_RDONLY);	/* flawfinder: ignore */
+	if (input_fd < 0) {
+		pair->error = errno;
+		return false;
+	}
+
+	output_fd = open(pair->dest, O_WRONLY | O_CREAT | O_TRUNC, 0666);	/* flawfinder: ignore */
+	/*
+	 * flawfinder rationale: the destinations are what the user asked
+	 * for, and are created subject to the umask, as "cp" would.
+	 */
+	if (output_fd < 0) {
+		pair->error = errno;
+		(void) close(input_fd);
+		return false;
+	}
+
+	ok = true;
+	while (ok && !__atomic_load_n(&(ms->stop), __ATOMIC_RELAXED)) {
+		ssize_t got, offset;
+
+		got = read(input_fd, buffer, ms->buffer_size);	/* flawfinder: ignore - bounded */
+		if (got < 0) {
+			if (EINTR == errno)
+				continue;
+			pair->error = errno;
+			ok = false;
+			break;
+		}
+		if (0 == got)
+			break;
+
+		offset = 0;
+		while (offset < got) {
+			ssize_t put = write(output_fd, buffer + offset, (size_t) (got - offset));
+			if (put < 0) {
+				if (EINTR == errno)
+					continue;
+				pair->error = errno;
+				ok = false;
+				break;
+			}
+			offset += put;
+		}
+
+		__atomic_add_fetch(&(pair->position), (off_t) offset, __ATOMIC_RELEASE);
+	}
+
+	if ((0 != close(output_fd)) && ok) {
+		pair->error = errno;
+		ok = false;
+	}
+	(void) close(input_fd);
+
+	return ok;
+}
+
+
+/*
+ * Main function of each worker thread: keep taking the next pair not yet
+ * taken, and copying it, until there are none left.
+ */
+/*@null@ */ static void *pv__multistream_worker(void *arg)
+{
+	struct pvmultistream_s *ms = (struct pvmultistream_s *) arg;
+	char *buffer;
+
+	buffer = malloc(ms->buffer_size);
+	if (NULL == buffer)
+		return NULL;
+
+	while (!__atomic_load_n(&(ms->stop), __ATOMIC_RELAXED)) {
+		struct pvmultistream_pair_s *pair;
+		unsigned int idx;
+		bool ok;
+
+		idx = __atomic_fetch_add(&(ms->next), 1, __ATOMIC_ACQ_REL);
+		if (idx >= ms->count)
+			break;
+
+		pair = &(ms->pair[idx]);
+		__atomic_store_n(&(pair->started), pv_elapsedtime_nsec(), __ATOMIC_RELAXED);
+		__atomic_store_n(&(pair->status), (int) PV_MULTISTREAM_RUNNING, __ATOMIC_RELEASE);
+
+		ok = pv__multistream_copy(ms, pair, buffer);
+
+		__atomic_store_n(&(pair->status), (int) (ok ? PV_MULTISTREAM_DONE : PV_MULTISTREAM_FAILED),
+				 __ATOMIC_RELEASE);
+	}
+
+	free(buffer);
+
+	return NULL;
+}
+
+
+/*
+ * Start "jobs" worker threads.  Returns false if none could be started.
+ */
+static bool pv__multistream_start(struct pvmultistream_s *ms, unsigned int jobs)
+{
+	sigset_t all_signals, old_signals;
+	unsigned int idx;
+
+	ms->workers = calloc((size_t) jobs, sizeof(pthread_t));
+	if (NULL == ms->workers)
+		return false;
+
+	/* As with the other threads, signals go to the main thread. */
+	(void) sigfillset(&all_signals);
+	(void) sigemptyset(&old_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	for (idx = 0; idx < jobs; idx++) {
+		int rc = pthread_create(&(ms->workers[idx]), NULL, pv__multistream_worker, ms);
+		if (0 != rc) {
+			debug("%s: %s", "failed to start worker", strerror(rc));
+			break;
+		}
+		ms->worker_count++;
+	}
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	debug("%s: %u", "workers started", ms->worker_count);
+
+	return (ms->worker_count > 0) ? true : false;
+}
+
+
+/*
+ * Wait for all of the workers to finish.
+ */
+static void pv__multistream_join(struct pvmultistream_s *ms)
+{
+	unsigned int idx;
+
+	if (NULL == ms->workers)
+		return;
+	for (idx = 0; idx < ms->worker_count; idx++)
+		(void) pthread_join(ms->workers[idx], NULL);
+	free(ms->workers);
+	ms->workers = NULL;
+	ms->worker_count = 0;
+}
+#endif				/* HAVE_PTHREAD */
+
+
+/*
+ * Free the pairs and everything they hold.
+ */
+static void pv__multistream_free(struct pvmultistream_s *ms)
+{
+	unsigned int idx;
+
+	if (NULL == ms->pair)
+		return;
+
+	for (idx = 0; idx < ms->count; idx++) {
+		struct pvmultistream_pair_s *pair = &(ms->pair[idx]);
+		free(pair->source);
+		free(pair->dest);
+		pv_freecontents_calc(&(pair->calc));
+		pv_freecontents_transfer(&(pair->transfer));
+		if (NULL != pair->display) {
+			pv_freecontents_display(pair->display);
+			free(pair->display);
+		}
+	}
+
+	free(ms->pair);
+	ms->pair = NULL;
+	ms->count = 0;
+	ms->allocated = 0;
+}
+
+
+/*
+ * Show the progress of "pair" on the next line of the frame, allocating
+ * its display the first time it is shown.
+ */
+static void pv__multistream_show(pvstate_t state, struct pvmultistream_pair_s *pair, long long now, int line,
+				 bool terminal_resized)
+{
+	if (NULL == pair->display) {
+		pair->display = calloc(1, sizeof(*(pair->display)));
+		if (NULL == pair->display) {
+			pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_MEMORY;
+			return;
+		}
+		pv_reset_display(pair->display);
+		pair->flags.reparse_display = 1;
+		pv_update_calc_average_rate_window(&(pair->calc), state->control.average_rate_window);
+	}
+
+	if (terminal_resized)
+		pair->flags.reparse_display = 1;
+
+	if (line > 0)
+		pv_tty_write(&(state->flags), "\n", 1);
+
+	/* Its line on screen changes as other copies come and go. */
+	pair->display->rendered_valid = false;
+
+	pair->transfer.transferred = __atomic_load_n(&(pair->position), __ATOMIC_ACQUIRE);
+	pair->transfer.total_written = pair->transfer.transferred;
+	pair->transfer.elapsed_seconds =
+	    (long double) (now - __atomic_load_n(&(pair->started), __ATOMIC_RELAXED)) / 1000000000.0L;
+
+	/*@-mustfreeonly@ *//* as with --watchfd, the name is only borrowed */
+	state->control.name = pair->display_name;
+	state->control.size = pair->size;
+
+	pv_display(&(state->status), &(state->control), &(pair->flags), &(pair->transfer), &(pair->calc),
+		   &(state->cursor), pair->display, NULL, false);
+
+	state->control.name = NULL;
+	/*@+mustfreeonly@ */
+}
+
+
+/*
+ * Make sure the format shows each line's name, as with --watchfd.
+ */
+static void pv__multistream_format(pvstate_t state)
+{
+	char new_format_string[512];	 /* flawfinder: ignore - bounded by pv_snprintf() */
+	const char *original_format_string;
+
+	original_format_string = state->control.format_string;
+	if (NULL == original_format_string)
+		original_format_string = state->control.default_format;
+	if (pv_format_contains_name(original_format_string))
+		return;
+
+	memset(new_format_string, 0, sizeof(new_format_string));
+	(void) pv_snprintf(new_format_string, sizeof(new_format_string), "%%N %s", original_format_string);
+
+	if (NULL != state->control.format_string)
+		free(state->control.format_string);
+	state->control.format_string = pv_strdup(new_format_string);
+}
+
+
+/*
+ * Copy each pair of the manifest, or each input file into the directory
+ * given with "--copy-into", running up to "--jobs" copies at once.  Each
+ * copy in progress has its own line, above a line for the total, with an
+ * ETA from the combined size of all of the sources.
+ *
+ * Returns nonzero on error.
+ */
+int pv_multistream_loop(pvstate_t state)
+{
+	struct pvmultistream_s ms;
+	struct pvtransientflags_s total_flags;
+	char total_name[PV_SIZEOF_DISPLAY_NAME];	/* flawfinder: ignore - bounded by pv_snprintf() */
+	off_t total_size;
+	long long start, next_update;
+	unsigned int idx, jobs, finished;
+	int prev_displayed_lines;
+	bool final_update;
+
+	memset(&ms, 0, sizeof(ms));
+	memset(&total_flags, 0, sizeof(total_flags));
+
+	if (NULL != state->control.manifest) {
+		if (!pv__multistream_read_manifest(&ms, state->control.manifest)) {
+			pv__multistream_free(&ms);
+			return PV_ERROREXIT_ACCESS;
+		}
+	} else if (NULL != state->control.copy_into) {
+		if (!pv__multistream_copy_into(&ms, state, state->control.copy_into)) {
+			pv__multistream_free(&ms);
+			return PV_ERROREXIT_ACCESS;
+		}
+	}
+
+	if (0 == ms.count) {
+		pv__multistream_free(&ms);
+		return 0;
+	}
+
+	/*
+	 * The total size, for the ETA, is what the sources add up to, if
+	 * they are all files whose size is known.
+	 */
+	total_size = 0;
+	for (idx = 0; idx < ms.count; idx++) {
+		struct stat sb;
+		memset(&sb, 0, sizeof(sb));
+		if ((0 == stat(ms.pair[idx].source, &sb)) && S_ISREG(sb.st_mode)) {
+			ms.pair[idx].size = sb.st_size;
+			if (total_size >= 0)
+				total_size += sb.st_size;
+		} else {
+			total_size = -1;
+		}
+	}
+	if (total_size < 0)
+		total_size = 0;
+	if (state->control.size > 0)
+		total_size = state->control.size;
+
+	jobs = state->control.jobs;
+	if (0 == jobs)
+		jobs = PV_MULTISTREAM_DEFAULT_JOBS;
+	if (jobs > PV_MULTISTREAM_MAX_JOBS)
+		jobs = PV_MULTISTREAM_MAX_JOBS;
+	if (jobs > ms.count)
+		jobs = ms.count;
+
+	ms.buffer_size = state->control.target_buffer_size > 0 ? state->control.target_buffer_size : BUFFER_SIZE;
+
+	if (NULL != state->control.name) {
+		(void) pv_snprintf(total_name, sizeof(total_name), "%s", state->control.name);
+		free(state->control.name);
+		state->control.name = NULL;
+	} else {
+		(void) pv_snprintf(total_name, sizeof(total_name), "%s", _("total"));
+	}
+
+	pv__multistream_format(state);
+	state->flags.reparse_display = 1;
+	state->transfer.total_written = 0;
+	state->display.initial_offset = 0;
+
+	debug("%s: %u, %s: %u", "pairs", ms.count, "jobs", jobs);
+
+#ifdef HAVE_PTHREAD
+	if (!pv__multistream_start(&ms, jobs)) {
+		pv_error("%s: %s", _("failed to start copying"), strerror(errno));
+		pv__multistream_join(&ms);
+		pv__multistream_free(&ms);
+		return PV_ERROREXIT_MEMORY;
+	}
+#else
+	pv_error("%s", _("copying several files at once is not supported on this system"));
+	pv__multistream_free(&ms);
+	return PV_ERROREXIT_TRANSFER;
+#endif
+
+	start = pv_elapsedtime_nsec();
+	next_update = start + (long long) (1000000000.0 * state->control.interval);
+	prev_displayed_lines = 0;
+	finished = 0;
+	final_update = false;
+
+	while (!final_update) {
+		long long now;
+		off_t total_copied;
+		int displayed_lines, blank_lines;
+		bool terminal_resized;
+
+		if (1 == state->flags.trigger_exit) {
+			__atomic_store_n(&(ms.stop), true, __ATOMIC_RELAXED);
+			final_update = true;
+		}
+
+		/* Report failed copies, and count finished ones. */
+		total_copied = 0;
+		for (idx = 0; idx < ms.count; idx++) {
+			struct pvmultistream_pair_s *pair = &(ms.pair[idx]);
+			int status = __atomic_load_n(&(pair->status), __ATOMIC_ACQUIRE);
+
+			total_copied += __atomic_load_n(&(pair->position), __ATOMIC_ACQUIRE);
+
+			if (pair->reported || ((int) PV_MULTISTREAM_DONE > status))
+				continue;
+			pair->reported = true;
+			finished++;
+			if ((int) PV_MULTISTREAM_FAILED == status) {
+				pv_error("%s -> %s: %s", pair->source, pair->dest, strerror(pair->error));
+				state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+			}
+		}
+		if (finished >= ms.count)
+			final_update = true;
+
+		now = pv_elapsedtime_nsec();
+
+		if ((!final_update) && (now < next_update)) {
+			struct timespec pause;
+			long long wait_nsec = next_update - now;
+			if (wait_nsec > PV_MULTISTREAM_POLL_NSEC)
+				wait_nsec = PV_MULTISTREAM_POLL_NSEC;
+			pv_elapsedtime_from_nsec(&pause, wait_nsec);
+			(void) nanosleep(&pause, NULL);
+			continue;
+		}
+
+		next_update += (long long) (1000000000.0 * state->control.interval);
+		if (next_update < now)
+			next_update = now;
+
+		state->transfer.transferred = total_copied;
+		state->transfer.total_written = total_copied;
+		state->transfer.elapsed_seconds = (long double) (now - start) / 1000000000.0L;
+
+		if (state->control.no_display)
+			continue;
+
+		terminal_resized = (1 == state->flags.terminal_resized) ? true : false;
+		if (terminal_resized) {
+			unsigned int width = 0, height = 0;
+			state->flags.terminal_resized = 0;
+			pv_screensize(&width, &height);
+			if (!state->control.width_set_manually)
+				state->control.width = (pvdisplay_width_t) width;
+			if (!state->control.height_set_manually)
+				state->control.height = height;
+			state->flags.reparse_display = 1;
+		}
+
+		pv_tty_frame_begin();
+
+		/* A line for each copy in progress, leaving room for the total. */
+		displayed_lines = 0;
+		for (idx = 0; (!final_update) && (idx < ms.count); idx++) {
+			if ((int) PV_MULTISTREAM_RUNNING != __atomic_load_n(&(ms.pair[idx].status), __ATOMIC_ACQUIRE))
+				continue;
+			if (displayed_lines + 1 >= (int) (state->control.height))
+				break;
+			pv__multistream_show(state, &(ms.pair[idx]), now, displayed_lines, terminal_resized);
+			displayed_lines++;
+		}
+
+		if (displayed_lines > 0)
+			pv_tty_write(&(state->flags), "\n", 1);
+		/*@-mustfreeonly@ *//* the name is only borrowed, as above */
+		state->control.name = total_name;
+		state->control.size = total_size;
+		state->display.rendered_valid = false;
+		pv_display(&(state->status), &(state->control), &(state->flags), &(state->transfer), &(state->calc),
+			   &(state->cursor), &(state->display), &(state->extra_display), final_update);
+		state->control.name = NULL;
+		/*@+mustfreeonly@ */
+		displayed_lines++;
+
+		/* Blank out the lines left over from the last update. */
+		blank_lines = prev_displayed_lines - displayed_lines;
+		prev_displayed_lines = displayed_lines;
+		while (blank_lines > 0) {
+			pvdisplay_width_t blank_count;
+			pv_tty_write(&(state->flags), "\n", 1);
+			for (blank_count = 0; blank_count < state->control.width; blank_count++)
+				pv_tty_write(&(state->flags), " ", 1);
+			pv_tty_write(&(state->flags), "\r", 1);
+			blank_lines--;
+			displayed_lines++;
+		}
+
+		while (displayed_lines > 1) {
+			pv_tty_write(&(state->flags), "\033[A", 3);
+			displayed_lines--;
+		}
+
+		pv_tty_frame_end(&(state->flags), !state->control.numeric);
+	}
+
+#ifdef HAVE_PTHREAD
+	pv__multistream_join(&ms);
+#endif
+
+	/* Leave the last update on the screen, above the prompt. */
+	if ((!state->control.numeric) && (!state->control.no_display) && (state->display.output_produced)) {
+		while (prev_displayed_lines > 0) {
+			pv_tty_write(&(state->flags), "\n", 1);
+			prev_displayed_lines--;
+		}
+	}
+
+	if (1 == state->flags.trigger_exit)
+		state->status.exit_status |= PV_ERROREXIT_SIGNAL;
+
+	pv__multistream_free(&ms);
+	pv_tty_frame_free();
+
+	return state->status.exit_status;
+}
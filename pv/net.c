@@ -0,0 +1,334 @@
+/*
+ * Functions for using network addresses such as "tcp://host:port" as input
+ * files or outputs, instead of piping through a separate program.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#ifdef HAVE_LINUX_SOCKIOS_H
+#include <linux/sockios.h>
+#endif
+
+/*
+ * Two forms of address are understood:
+ *
+ *   tcp://HOST:PORT          connect to HOST on PORT
+ *   tcp-listen://[HOST:]PORT wait for one connection on PORT, optionally
+ *                            only on the address HOST
+ *
+ * HOST may be a name or a numeric address, with IPv6 addresses in square
+ * brackets, and PORT may be a number or a service name.
+ *
+ * Once connected, the socket is an ordinary file descriptor, so the usual
+ * engines move the data: splice() between it and a pipe, sendfile() from a
+ * regular file to it, and read() and write() otherwise.
+ *
+ * The socket buffer sizes are only set if a buffer size was given with
+ * "-B", since setting them turns off the system's own tuning of them,
+ * which usually does better.  An output socket has TCP_NOTSENT_LOWAT set,
+ * where it is available, so that data doesn't pile up unsent in the
+ * kernel, and the count of bytes not yet acknowledged by the receiver is
+ * used like the unread bytes in an output pipe: see pv_net_queued().
+ */
+#define PV_NET_SCHEME_CONNECT	"tcp://"
+#define PV_NET_SCHEME_LISTEN	"tcp-listen://"
+#define PV_NET_NOTSENT_LOWAT	(128 * 1024)	/* unsent bytes to allow */
+
+
+/*
+ * Return true if "name" is a network address rather than a file name.
+ */
+bool pv_net_is_address(/*@null@ */ const char *name)
+{
+	if (NULL == name)
+		return false;
+	if (0 == strncmp(name, PV_NET_SCHEME_CONNECT, strlen(PV_NET_SCHEME_CONNECT)))	/* flawfinder: ignore */
+		return true;
+	if (0 == strncmp(name, PV_NET_SCHEME_LISTEN, strlen(PV_NET_SCHEME_LISTEN)))	/* flawfinder: ignore */
+		return true;
+	/* flawfinder - the scheme strings are constant and \0-terminated. */
+	return false;
+}
+
+
+/*
+ * Split "spec", the part of an address after the scheme, into "host" and
+ * "port", which are "host_size" and "port_size" bytes long.  If there is
+ * no host part, "host" is left empty.  Returns false if the address can't
+ * be understood.
+ */
+static bool pv__net_split(const char *spec, char *host, size_t host_size, char *port, size_t port_size)
+{
+	const char *port_start;
+	size_t host_length;
+
+	host[0] = '\0';
+	port[0] = '\0';
+
+	if ('[' == spec[0]) {
+		const char *host_end = strchr(spec, ']');
+		if ((NULL == host_end) || (':' != host_end[1]))
+			return false;
+		host_length = (size_t) (host_end - spec - 1);
+		if (host_length >= host_size)
+			return false;
+		memcpy(host, spec + 1, host_length);	/* flawfinder: ignore - bounds checked above */
+		host[host_length] = '\0';
+		port_start = host_end + 2;
+	} else {
+		const char *colon = strrchr(spec, ':');
+		if (NULL == colon) {
+			port_start = spec;
+		} else {
+			host_length = (size_t) (colon - spec);
+			if (host_length >= host_size)
+				return false;
+			memcpy(host, spec, host_length);	/* flawfinder: ignore - bounds checked above */
+			host[host_length] = '\0';
+			port_start = colon + 1;
+		}
+	}
+
+	if (('\0' == port_start[0]) || (strlen(port_start) >= port_size))	/* flawfinder: ignore */
+		return false;
+	/* flawfinder - "spec" is always \0-terminated. */
+	(void) pv_snprintf(port, port_size, "%s", port_start);
+
+	return true;
+}
+
+
+/*
+ * Set the socket options for a newly connected socket.
+ */
+static void pv__net_tune(int fd, bool for_output, size_t buffer_size)
+{
+	if (buffer_size > 0) {
+		int size = buffer_size > 0x40000000 ? 0x40000000 : (int) buffer_size;
+		if (0 != setsockopt(fd, SOL_SOCKET, for_output ? SO_SNDBUF : SO_RCVBUF, &size, sizeof(size)))
+			debug("%s: %s", "setsockopt buffer size", strerror(errno));
+	}
+
+#ifdef TCP_NOTSENT_LOWAT
+	if (for_output) {
+		int lowat = PV_NET_NOTSENT_LOWAT;
+		if (0 != setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)))
+			debug("%s: %s", "setsockopt TCP_NOTSENT_LOWAT", strerror(errno));
+	}
+#endif
+}
+
+
+/*
+ * Connect a new socket to "result", returning it, or -1 with errno set.
+ */
+static int pv__net_connect(const struct addrinfo *result)
+{
+	int fd, rc, saved_errno;
+
+	fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	if (fd < 0)
+		return -1;
+
+	do {
+		rc = connect(fd, result->ai_addr, result->ai_addrlen);
+	} while ((0 != rc) && (EINTR == errno));
+
+	if (0 != rc) {
+		saved_errno = errno;
+		(void) close(fd);
+		errno = saved_errno;
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/*
+ * Make "count" connections to "address", or listen on it and accept
+ * "count" connections if it is a "tcp-listen://" address, storing the
+ * connected sockets in fds[].  The socket buffers are set to
+ * "buffer_size" bytes if that is nonzero.
+ *
+ * On error, it is reported, errno is set, nothing is left open, and -1 is
+ * returned; otherwise 0 is returned.
+ */
+int pv_net_open_streams(const char *address, bool for_output, size_t buffer_size, int *fds, unsigned int count)
+{
+	char host[256];			 /* flawfinder: ignore - bounded by pv__net_split() */
+	char port[64];			 /* flawfinder: ignore - bounded by pv__net_split() */
+	struct addrinfo hints, *results, *result;
+	bool listening;
+	const char *spec;
+	unsigned int opened, stream_idx;
+	int rc, saved_errno;
+
+	listening = (0 == strncmp(address, PV_NET_SCHEME_LISTEN, strlen(PV_NET_SCHEME_LISTEN)));	/* flawfinder: ignore */
+	/* flawfinder - as above. */
+	spec = address + (listening ? strlen(PV_NET_SCHEME_LISTEN) : strlen(PV_NET_SCHEME_CONNECT));	/* flawfinder: ignore */
+	/* flawfinder - as above. */
+
+	if ((!pv__net_split(spec, host, sizeof(host), port, sizeof(port))) || ((!listening) && ('\0' == host[0]))) {
+		pv_error("%s: %s", address, _("network address not understood"));
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (listening)
+		hints.ai_flags = AI_PASSIVE;
+
+	results = NULL;
+	rc = getaddrinfo('\0' == host[0] ? NULL : host, port, &hints, &results);
+	if ((0 != rc) || (NULL == results)) {
+		pv_error("%s: %s", address, 0 != rc ? gai_strerror(rc) : _("no addresses found"));
+		errno = EHOSTUNREACH;
+		return -1;
+	}
+
+	opened = 0;
+	saved_errno = 0;
+
+	for (result = results; (NULL != result) && (0 == opened); result = result->ai_next) {
+		if (listening) {
+			int one = 1;
+			int listen_fd;
+
+			listen_fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+			if (listen_fd < 0) {
+				saved_errno = errno;
+				continue;
+			}
+
+			(void) setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if ((0 != bind(listen_fd, result->ai_addr, result->ai_addrlen))
+			    || (0 != listen(listen_fd, (int) count))) {
+				saved_errno = errno;
+				(void) close(listen_fd);
+				continue;
+			}
+
+			debug("%s: %s: %u", "waiting for connections", address, count);
+			while (opened < count) {
+				int fd;
+				do {
+					fd = accept(listen_fd, NULL, NULL);
+				} while ((fd < 0) && (EINTR == errno));
+				if (fd < 0) {
+					saved_errno = errno;
+					break;
+				}
+				fds[opened++] = fd;
+			}
+			(void) close(listen_fd);
+
+			/* The listener can't be tried again, so stop here. */
+			break;
+		}
+
+		/*
+		 * Once one connection to this address has worked, make the
+		 * rest to the same one.
+		 */
+		while (opened < count) {
+			int fd = pv__net_connect(result);
+			if (fd < 0) {
+				saved_errno = errno;
+				break;
+			}
+			fds[opened++] = fd;
+		}
+		if ((opened > 0) && (opened < count))
+			break;
+	}
+
+	freeaddrinfo(results);
+
+	if (opened < count) {
+		for (stream_idx = 0; stream_idx < opened; stream_idx++)
+			(void) close(fds[stream_idx]);
+		pv_error("%s: %s", address, strerror(saved_errno));
+		errno = saved_errno;
+		return -1;
+	}
+
+	for (stream_idx = 0; stream_idx < count; stream_idx++) {
+		(void) fcntl(fds[stream_idx], F_SETFD, FD_CLOEXEC);
+		pv__net_tune(fds[stream_idx], for_output, buffer_size);
+	}
+
+	debug("%s: %s: %u", listening ? "accepted connections" : "connected", address, count);
+
+	return 0;
+}
+
+
+/*
+ * Connect to "address", or listen on it and accept one connection if it
+ * is a "tcp-listen://" address, returning the connected socket, or -1 on
+ * error after reporting it, as with pv_net_open_streams().
+ */
+int pv_net_open(const char *address, bool for_output, size_t buffer_size)
+{
+	int fd = -1;
+
+	if (0 != pv_net_open_streams(address, for_output, buffer_size, &fd, 1))
+		return -1;
+
+	return fd;
+}
+
+
+/*
+ * Put the number of bytes written to the socket "fd" that the receiver
+ * has not yet acknowledged into *queued.  Returns false if this can't be
+ * found out.
+ */
+bool pv_net_queued(int fd, size_t *queued)
+{
+#if defined(SIOCOUTQ) || defined(SO_NWRITE)
+	int nbytes;
+
+	nbytes = 0;
+#ifdef SIOCOUTQ
+	if (0 != ioctl(fd, SIOCOUTQ, &nbytes))
+		return false;
+#else
+	{
+		socklen_t length = sizeof(nbytes);
+		if (0 != getsockopt(fd, SOL_SOCKET, SO_NWRITE, &nbytes, &length))
+			return false;
+	}
+#endif
+	if (nbytes < 0)
+		return false;
+
+	*queued = (size_t) nbytes;
+	return true;
+#else				/* ! SIOCOUTQ || SO_NWRITE */
+	(void) fd;
+	(void) queued;
+	return false;
+#endif				/* SIOCOUTQ || SO_NWRITE */
+}
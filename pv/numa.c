@@ -0,0 +1,325 @@
+/*
+ * NUMA placement for "--numa-node" and "--cpu-affinity": binding buffers to
+ * the memory of the node nearest the input or output device, and keeping
+ * pv's threads on that node's processors.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+/* Memory policy for mbind(), from <linux/mempolicy.h>. */
+#define PV_NUMA_MPOL_PREFERRED 1
+
+/* The highest node number that buffers can be bound to, plus one. */
+#define PV_NUMA_MAX_NODES 1024
+
+/*
+ * The node that buffers are bound to, or -1 for none.  This is
+ * process-wide, like the other buffer settings, since the buffers are
+ * allocated by modules which only see the file descriptors.
+ */
+static int pv__numa_node = -1;
+
+
+#ifdef __linux__
+/*
+ * Read a single integer from the sysfs file "path", returning -1 if it
+ * can't be read.
+ */
+static int pv__numa_read_int(const char *path)
+{
+	FILE *fptr;
+	int value;
+
+	fptr = fopen(path, "r");	    /* flawfinder: ignore */
+	/* flawfinder rationale: sysfs paths are built by us, and only read. */
+	if (NULL == fptr)
+		return -1;
+	if (1 != fscanf(fptr, "%d", &value))
+		value = -1;
+	(void) fclose(fptr);
+	return value;
+}
+
+
+/*
+ * Return the node of processor "cpu", from the "nodeN" entry in its sysfs
+ * directory, or -1 if it isn't known.
+ */
+static int pv__numa_cpu_node(int cpu)
+{
+	char path[128];			 /* flawfinder: ignore */
+	struct dirent *entry;
+	DIR *dir;
+	int node;
+
+	/* flawfinder: bounded by pv_snprintf(). */
+
+	(void) pv_snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (NULL == dir)
+		return -1;
+
+	node = -1;
+	while (NULL != (entry = readdir(dir))) {
+		if ((0 == strncmp(entry->d_name, "node", 4)) && (entry->d_name[4] >= '0') && (entry->d_name[4] <= '9')) {
+			node = atoi(&(entry->d_name[4]));
+			break;
+		}
+	}
+	(void) closedir(dir);
+
+	return node;
+}
+
+
+/*
+ * Return the node nearest to the device behind "fd", or -1 if it can't be
+ * told: for a block device or a file, the node of the disk's controller,
+ * from sysfs; for a socket, the node of the processor its incoming packets
+ * are handled on, which is the one the network card interrupts.
+ */
+static int pv__numa_fd_node(int fd)
+{
+	static const char *const device_paths[] = {
+		"device/numa_node",
+		"device/device/numa_node",
+		"../device/numa_node",
+		"../device/device/numa_node"
+	};
+	char path[128];			 /* flawfinder: ignore */
+	struct stat sb;
+	dev_t device;
+	unsigned int idx;
+
+	/* flawfinder: bounded by pv_snprintf(). */
+
+	memset(&sb, 0, sizeof(sb));
+	if (0 != fstat(fd, &sb))
+		return -1;
+
+#ifdef SO_INCOMING_CPU
+	if (S_ISSOCK(sb.st_mode)) {
+		int cpu = -1;
+		socklen_t cpu_size = sizeof(cpu);
+		if ((0 != getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &cpu_size)) || (cpu < 0))
+			return -1;
+		return pv__numa_cpu_node(cpu);
+	}
+#endif
+
+	if (S_ISBLK(sb.st_mode)) {
+		device = sb.st_rdev;
+	} else if (S_ISREG(sb.st_mode)) {
+		device = sb.st_dev;
+	} else {
+		return -1;
+	}
+
+	/* Partitions have no device link of their own, so try their parent. */
+	for (idx = 0; idx < sizeof(device_paths) / sizeof(device_paths[0]); idx++) {
+		int node;
+		(void) pv_snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/%s", major(device), minor(device),
+				   device_paths[idx]);
+		node = pv__numa_read_int(path);
+		if (node >= 0)
+			return node;
+	}
+
+	return -1;
+}
+
+
+/*
+ * Parse a processor list such as "0-7,16-23", as used by sysfs and
+ * taskset(1), into "cpus".  Returns false if it is not understood.
+ */
+static bool pv__numa_parse_cpulist(const char *list, cpu_set_t *cpus)
+{
+	const char *ptr;
+
+	CPU_ZERO(cpus);
+
+	ptr = list;
+	while (('\0' != *ptr) && ('\n' != *ptr)) {
+		char *end;
+		long first, last, cpu;
+
+		first = strtol(ptr, &end, 10);
+		if ((end == ptr) || (first < 0))
+			return false;
+		last = first;
+		ptr = end;
+		if ('-' == *ptr) {
+			ptr++;
+			last = strtol(ptr, &end, 10);
+			if ((end == ptr) || (last < first))
+				return false;
+			ptr = end;
+		}
+		for (cpu = first; (cpu <= last) && (cpu < CPU_SETSIZE); cpu++)
+			CPU_SET((int) cpu, cpus);
+		if (',' == *ptr) {
+			ptr++;
+		} else if (('\0' != *ptr) && ('\n' != *ptr)) {
+			return false;
+		}
+	}
+
+	return (CPU_COUNT(cpus) > 0) ? true : false;
+}
+
+
+/*
+ * Fill in "cpus" with the processors of "node", from sysfs.  Returns false
+ * if they can't be read.
+ */
+static bool pv__numa_node_cpus(int node, cpu_set_t *cpus)
+{
+	char path[128];			 /* flawfinder: ignore */
+	char list[4096];		 /* flawfinder: ignore */
+	FILE *fptr;
+	bool ok;
+
+	/* flawfinder: bounded by pv_snprintf() and fgets(). */
+
+	(void) pv_snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	fptr = fopen(path, "r");	    /* flawfinder: ignore */
+	if (NULL == fptr)
+		return false;
+	ok = (NULL != fgets(list, (int) sizeof(list), fptr)) ? pv__numa_parse_cpulist(list, cpus) : false;
+	(void) fclose(fptr);
+
+	return ok;
+}
+#endif				/* __linux__ */
+
+
+/*
+ * Return true if "list" is a processor list that "--cpu-affinity" can
+ * use.
+ */
+bool pv_numa_cpulist_valid(const char *list)
+{
+#ifdef __linux__
+	cpu_set_t cpus;
+	return pv__numa_parse_cpulist(list, &cpus);
+#else
+	const char *ptr;
+	for (ptr = list; '\0' != *ptr; ptr++) {
+		if (!(((*ptr >= '0') && (*ptr <= '9')) || (',' == *ptr) || ('-' == *ptr)))
+			return false;
+	}
+	return ('\0' != list[0]) ? true : false;
+#endif
+}
+
+
+/*
+ * Work out where the transfer from "input_fd" to "output_fd" should run,
+ * before any buffers are allocated or threads started: the node that
+ * buffers are bound to, from "--numa-node", and the processors that this
+ * thread, and so every thread it starts, may run on, from
+ * "--cpu-affinity", or otherwise the processors of that node.
+ */
+void pv_numa_place(pvstate_t state, int input_fd, int output_fd)
+{
+	int node;
+
+	node = state->control.numa_node;
+
+	if ((node < 0) && (NULL == state->control.cpu_affinity))
+		return;
+
+#ifdef __linux__
+	if (PV_NUMA_NODE_AUTO == node) {
+		node = pv__numa_fd_node(input_fd);
+		if (node < 0)
+			node = pv__numa_fd_node(output_fd);
+		if (node < 0) {
+			debug("%s", "no NUMA node found for the input or output");
+		} else {
+			debug("%s: %d", "NUMA node of the input or output", node);
+		}
+	}
+
+	if (node >= PV_NUMA_MAX_NODES)
+		node = -1;
+	pv__numa_node = node;
+
+	{
+		cpu_set_t cpus;
+		bool have_cpus = false;
+
+		if (NULL != state->control.cpu_affinity) {
+			have_cpus = pv__numa_parse_cpulist(state->control.cpu_affinity, &cpus);
+		} else if (node >= 0) {
+			have_cpus = pv__numa_node_cpus(node, &cpus);
+		}
+
+		if (have_cpus && (0 != sched_setaffinity(0, sizeof(cpus), &cpus))) {
+			pv_error("%s: %s", _("failed to set processor affinity"), strerror(errno));
+		} else if (have_cpus) {
+			debug("%s: %d", "processors allowed", CPU_COUNT(&cpus));
+		}
+	}
+#else				/* !__linux__ */
+	(void) input_fd;
+	(void) output_fd;
+	debug("%s", "NUMA placement is not supported on this platform");
+#endif				/* __linux__ */
+}
+
+
+/*
+ * Bind the memory of a newly allocated buffer to the node chosen by
+ * pv_numa_place(), if there is one.  This has to be done before the buffer
+ * is first touched, since that is when its pages are placed.  Memory is
+ * preferred on the node rather than strictly bound to it, so that a full
+ * node doesn't make the allocation fail.
+ */
+void pv_numa_bind_buffer(void *buffer, size_t size)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+	unsigned long nodemask[PV_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+	long page_size;
+
+	if ((pv__numa_node < 0) || (NULL == buffer) || (0 == size))
+		return;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if ((page_size <= 0) || (0 != ((size_t) buffer % (size_t) page_size)))
+		return;
+
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[pv__numa_node / (8 * sizeof(unsigned long))] |= 1UL << (pv__numa_node % (8 * sizeof(unsigned long)));
+
+	if (0 !=
+	    syscall(SYS_mbind, buffer, size, PV_NUMA_MPOL_PREFERRED, nodemask, (unsigned long) (8 * sizeof(nodemask) + 1),
+		    0))
+		debug("%s: %s", "mbind", strerror(errno));
+#else
+	(void) buffer;
+	(void) size;
+#endif
+}
@@ -38,6 +38,156 @@ void display_version(void);
 static bool opts_watchfd_parse(opts_t, const char *, /*@null@ */ const char *, unsigned int);
 
 
+/*
+ * Values returned by getopt_long() for options which have no short
+ * equivalent, starting above the range of any single-character option.
+ */
+enum {
+	PV_LONGOPT_PIPELINE = 256,
+	PV_LONGOPT_ENGINE,
+	PV_LONGOPT_RATE_BURST,
+	PV_LONGOPT_STATS_PAGE,
+	PV_LONGOPT_STATS_FD,
+	PV_LONGOPT_STATS_FORMAT,
+	PV_LONGOPT_METRICS_FILE,
+	PV_LONGOPT_TREE,
+	PV_LONGOPT_SPOOL_MEMORY,
+	PV_LONGOPT_FORWARD_AFTER,
+	PV_LONGOPT_ETA_MODEL,
+	PV_LONGOPT_DIGEST,
+	PV_LONGOPT_FANOUT_POLICY,
+	PV_LONGOPT_DROP_BEHIND,
+	PV_LONGOPT_RESCUE,
+	PV_LONGOPT_RESCUE_RETRIES,
+	PV_LONGOPT_RESCUE_DIRECT,
+	PV_LONGOPT_CHECKPOINT,
+	PV_LONGOPT_STREAMS,
+	PV_LONGOPT_COMPRESS,
+	PV_LONGOPT_DECOMPRESS,
+	PV_LONGOPT_SELF_PROFILE,
+	PV_LONGOPT_HUGE_PAGES,
+	PV_LONGOPT_LOCK_BUFFERS,
+	PV_LONGOPT_NUMA_NODE,
+	PV_LONGOPT_CPU_AFFINITY,
+	PV_LONGOPT_MANIFEST,
+	PV_LONGOPT_COPY_INTO,
+	PV_LONGOPT_JOBS,
+	PV_LONGOPT_RECORD,
+	PV_LONGOPT_STALL_TIMEOUT,
+	PV_LONGOPT_RATE_DROP,
+	PV_LONGOPT_ON_STALL,
+	PV_LONGOPT_COALESCE,
+	PV_LONGOPT_COALESCE_BYTES,
+	PV_LONGOPT_SYNC_EVERY,
+	PV_LONGOPT_SYNC_INTERVAL,
+	PV_LONGOPT_PIPE_SIZE,
+	PV_LONGOPT_UNCOMPRESSED_SIZE,
+	PV_LONGOPT_LINE_ESTIMATE,
+	PV_LONGOPT_RATE_BUDGET,
+	PV_LONGOPT_RATE_WEIGHT,
+	PV_LONGOPT_LATENCY_TARGET,
+	PV_LONGOPT_PRESSURE_TARGET,
+	PV_LONGOPT_TRACE,
+	PV_LONGOPT_TRACE_DECODE,
+	PV_LONGOPT_HISTORY,
+	PV_LONGOPT_ENGINE_CACHE
+};
+
+
+/*
+ * Names accepted by --engine.  Engines not available in this build are
+ * left out, so that asking for one is an error.
+ */
+static const struct {
+	const char *name;
+	pvioengine_t engine;
+} opts_io_engines[] = {
+	{ "auto", PV_IOENGINE_AUTO },
+	{ "readwrite", PV_IOENGINE_READWRITE },
+#ifdef HAVE_LINUX_IO_URING_H
+	{ "io_uring", PV_IOENGINE_IO_URING },
+#endif				/* HAVE_LINUX_IO_URING_H */
+#ifdef HAVE_MMAP
+	{ "mmap", PV_IOENGINE_MMAP },
+#endif				/* HAVE_MMAP */
+	{ NULL, PV_IOENGINE_AUTO }
+};
+
+
+/*
+ * Names accepted by --stats-format.
+ */
+static const struct {
+	const char *name;
+	pvstatsformat_t format;
+} opts_stats_formats[] = {
+	{ "json", PV_STATSFORMAT_JSON },
+	{ "binary", PV_STATSFORMAT_BINARY },
+	{ NULL, PV_STATSFORMAT_JSON }
+};
+
+
+/*
+ * Names accepted by --eta-model.
+ */
+static const struct {
+	const char *name;
+	pvetamodel_t model;
+} opts_eta_models[] = {
+	{ "average", PV_ETAMODEL_AVERAGE },
+	{ "linear", PV_ETAMODEL_LINEAR },
+	{ "ewma", PV_ETAMODEL_EWMA },
+	{ "phase", PV_ETAMODEL_PHASE },
+	{ NULL, PV_ETAMODEL_AVERAGE }
+};
+
+
+/*
+ * Names accepted by --digest.
+ */
+static const struct {
+	const char *name;
+	pvdigest_t digest;
+} opts_digests[] = {
+	{ "crc32c", PV_DIGEST_CRC32C },
+	{ "xxh64", PV_DIGEST_XXH64 },
+	{ "sha256", PV_DIGEST_SHA256 },
+	{ NULL, PV_DIGEST_NONE }
+};
+
+
+/*
+ * Names accepted by --fanout-policy.
+ */
+static const struct {
+	const char *name;
+	pvfanoutpolicy_t policy;
+} opts_fanout_policies[] = {
+	{ "wait", PV_FANOUT_WAIT },
+	{ "drop", PV_FANOUT_DROP },
+	{ NULL, PV_FANOUT_WAIT }
+};
+
+
+/*
+ * Names accepted by --compress and --decompress, and the highest level
+ * each accepts.  Codecs not available in this build are left out.
+ */
+static const struct {
+	const char *name;
+	pvcodec_t codec;
+	int max_level;
+} opts_codecs[] = {
+#ifdef HAVE_ZSTD_H
+	{ "zstd", PV_CODEC_ZSTD, 22 },
+#endif
+#ifdef HAVE_LZ4FRAME_H
+	{ "lz4", PV_CODEC_LZ4, 12 },
+#endif
+	{ NULL, PV_CODEC_NONE, 0 }
+};
+
+
 /*
  * splint note about mustfreefresh: the gettext calls made by _() cause
  * memory leak warnings, but in these cases it's unavoidable, and mitigated
@@ -72,12 +222,42 @@ void opts_free( /*@only@ */ opts_t opts)
 		free(opts->store_and_forward_file);
 	if (NULL != opts->extra_display)
 		free(opts->extra_display);
+	if (NULL != opts->metrics_file)
+		free(opts->metrics_file);
+	if (NULL != opts->stall_command)
+		free(opts->stall_command);
+	if (NULL != opts->rate_budget)
+		free(opts->rate_budget);
+	if (NULL != opts->trace_file)
+		free(opts->trace_file);
+	if (NULL != opts->trace_decode)
+		free(opts->trace_decode);
+	if (NULL != opts->history_file)
+		free(opts->history_file);
+	if (NULL != opts->engine_cache)
+		free(opts->engine_cache);
+	if (NULL != opts->rescue_map)
+		free(opts->rescue_map);
+	if (NULL != opts->checkpoint_file)
+		free(opts->checkpoint_file);
+	if (NULL != opts->cpu_affinity)
+		free(opts->cpu_affinity);
+	if (NULL != opts->manifest)
+		free(opts->manifest);
+	if (NULL != opts->copy_into)
+		free(opts->copy_into);
+	if (NULL != opts->record)
+		free(opts->record);
+	if (NULL != opts->query_targets)
+		free(opts->query_targets);
 	if (NULL != opts->watchfd_pid)
 		free(opts->watchfd_pid);
 	if (NULL != opts->watchfd_fd)
 		free(opts->watchfd_fd);
 	if (NULL != opts->argv)
 		free(opts->argv);
+	if (NULL != opts->extra_output)
+		free(opts->extra_output);
 	/*@+keeptrans@ */
 	free(opts);
 }
@@ -117,6 +297,38 @@ bool opts_add_file(opts_t opts, const char *filename)
 	return true;
 }
 
+/*
+ * Add a filename to the list of extra outputs, for "-o" given more than
+ * once, returning false on error.  As with opts_add_file(), the filename
+ * is not copied.
+ */
+static bool opts_add_extra_output(opts_t opts, const char *filename)
+{
+	/*@-branchstate@ */
+	if ((opts->extra_output_count >= opts->extra_output_length) || (NULL == opts->extra_output)) {
+		opts->extra_output_length = opts->extra_output_count + 4;
+		/*@-keeptrans@ */
+		opts->extra_output = realloc(opts->extra_output, opts->extra_output_length * sizeof(char *));
+		/*@+keeptrans@ */
+		if (NULL == opts->extra_output) {
+			fprintf(stderr, "%s: %s\n", opts->program_name, strerror(errno));
+			opts->extra_output_length = 0;
+			opts->extra_output_count = 0;
+			return false;
+		}
+	}
+	/*@+branchstate@ */
+
+	/*
+	 * splint notes: we turned off "branchstate" and "keeptrans" above
+	 * because of the same reason as in opts_add_file().
+	 */
+
+	opts->extra_output[opts->extra_output_count++] = filename;
+
+	return true;
+}
+
 /*
  * Add a process ID and file descriptor to the list of items to watch with
  * --watchfd, returning false on error.
@@ -473,7 +685,7 @@ static bool opts_use_size_of_file(opts_t opts, const char *size_file)
 	/*
 	 * Block device - determine its size by looking for
 	 * /sys/dev/block/MAJOR:MINOR/size, and if that fails, try opening
-	 * the file and seeking to the end.
+	 * the device and asking it.
 	 */
 
 #ifdef CAN_BUILD_SYSFS_FILENAME
@@ -518,7 +730,8 @@ static bool opts_use_size_of_file(opts_t opts, const char *size_file)
 #endif				/* CAN_BUILD_SYSFS_FILENAME */
 
 	/*
-	 * Try opening the block device and seeking to the end.
+	 * Try opening the block device and asking it for its size, which
+	 * falls back to seeking to the end.
 	 */
 	device_fd = open(size_file, O_RDONLY);	/* flawfinder: ignore */
 	/*
@@ -535,7 +748,7 @@ static bool opts_use_size_of_file(opts_t opts, const char *size_file)
 		/*@+mustfreefresh@ */
 	}
 
-	device_size = (off_t) lseek(device_fd, 0, SEEK_END);
+	device_size = pv_blkdev_size(device_fd);
 
 	if (device_size < 0) {
 		/*@-mustfreefresh@ *//* see above */
@@ -593,9 +806,11 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		{ "wait", 0, NULL, (int) 'W' },
 		{ "delay-start", 1, NULL, (int) 'D' },
 		{ "size", 1, NULL, (int) 's' },
+		{ "uncompressed-size", 1, NULL, PV_LONGOPT_UNCOMPRESSED_SIZE },
 		{ "gauge", 0, NULL, (int) 'g' },
 		{ "line-mode", 0, NULL, (int) 'l' },
 		{ "null", 0, NULL, (int) '0' },
+		{ "line-estimate", 0, NULL, PV_LONGOPT_LINE_ESTIMATE },
 		{ "interval", 1, NULL, (int) 'i' },
 		{ "width", 1, NULL, (int) 'w' },
 		{ "height", 1, NULL, (int) 'H' },
@@ -606,12 +821,32 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		{ "stats", 0, NULL, (int) 'v' },
 		{ "rate-limit", 1, NULL, (int) 'L' },
 		{ "buffer-size", 1, NULL, (int) 'B' },
+		{ "huge-pages", 0, NULL, PV_LONGOPT_HUGE_PAGES },
+		{ "lock-buffers", 0, NULL, PV_LONGOPT_LOCK_BUFFERS },
+		{ "numa-node", 1, NULL, PV_LONGOPT_NUMA_NODE },
+		{ "cpu-affinity", 1, NULL, PV_LONGOPT_CPU_AFFINITY },
 		{ "no-splice", 0, NULL, (int) 'C' },
+		{ "pipe-size", 1, NULL, PV_LONGOPT_PIPE_SIZE },
 		{ "skip-errors", 0, NULL, (int) 'E' },
 		{ "error-skip-block", 1, NULL, (int) 'Z' },
+		{ "rescue", 1, NULL, PV_LONGOPT_RESCUE },
+		{ "rescue-retries", 1, NULL, PV_LONGOPT_RESCUE_RETRIES },
+		{ "rescue-direct", 0, NULL, PV_LONGOPT_RESCUE_DIRECT },
+		{ "checkpoint", 1, NULL, PV_LONGOPT_CHECKPOINT },
+		{ "streams", 1, NULL, PV_LONGOPT_STREAMS },
+		{ "manifest", 1, NULL, PV_LONGOPT_MANIFEST },
+		{ "copy-into", 1, NULL, PV_LONGOPT_COPY_INTO },
+		{ "jobs", 1, NULL, PV_LONGOPT_JOBS },
+		{ "record", 1, NULL, PV_LONGOPT_RECORD },
+		{ "compress", 1, NULL, PV_LONGOPT_COMPRESS },
+		{ "decompress", 1, NULL, PV_LONGOPT_DECOMPRESS },
+		{ "self-profile", 0, NULL, PV_LONGOPT_SELF_PROFILE },
 		{ "stop-at-size", 0, NULL, (int) 'S' },
 		{ "sync", 0, NULL, (int) 'Y' },
+		{ "sync-every", 1, NULL, PV_LONGOPT_SYNC_EVERY },
+		{ "sync-interval", 1, NULL, PV_LONGOPT_SYNC_INTERVAL },
 		{ "direct-io", 0, NULL, (int) 'K' },
+		{ "drop-behind", 0, NULL, PV_LONGOPT_DROP_BEHIND },
 		{ "sparse", 0, NULL, (int) 'O' },
 		{ "sparse-output", 0, NULL, (int) 'O' },
 		{ "discard", 0, NULL, (int) 'X' },
@@ -621,7 +856,37 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		{ "pidfile", 1, NULL, (int) 'P' },
 		{ "watchfd", 1, NULL, (int) 'd' },
 		{ "output", 1, NULL, (int) 'o' },
+		{ "fanout-policy", 1, NULL, PV_LONGOPT_FANOUT_POLICY },
 		{ "average-rate-window", 1, NULL, (int) 'm' },
+		{ "eta-model", 1, NULL, PV_LONGOPT_ETA_MODEL },
+		{ "digest", 1, NULL, PV_LONGOPT_DIGEST },
+#ifdef HAVE_PTHREAD
+		{ "pipeline", 1, NULL, PV_LONGOPT_PIPELINE },
+#endif				/* HAVE_PTHREAD */
+		{ "engine", 1, NULL, PV_LONGOPT_ENGINE },
+		{ "engine-cache", 1, NULL, PV_LONGOPT_ENGINE_CACHE },
+		{ "rate-burst", 1, NULL, PV_LONGOPT_RATE_BURST },
+		{ "rate-budget", 1, NULL, PV_LONGOPT_RATE_BUDGET },
+		{ "rate-weight", 1, NULL, PV_LONGOPT_RATE_WEIGHT },
+		{ "latency-target", 1, NULL, PV_LONGOPT_LATENCY_TARGET },
+		{ "pressure-target", 1, NULL, PV_LONGOPT_PRESSURE_TARGET },
+		{ "coalesce", 1, NULL, PV_LONGOPT_COALESCE },
+		{ "coalesce-bytes", 1, NULL, PV_LONGOPT_COALESCE_BYTES },
+		{ "stats-page", 0, NULL, PV_LONGOPT_STATS_PAGE },
+		{ "stats-fd", 1, NULL, PV_LONGOPT_STATS_FD },
+		{ "stats-format", 1, NULL, PV_LONGOPT_STATS_FORMAT },
+		{ "metrics-file", 1, NULL, PV_LONGOPT_METRICS_FILE },
+		{ "trace", 1, NULL, PV_LONGOPT_TRACE },
+		{ "trace-decode", 1, NULL, PV_LONGOPT_TRACE_DECODE },
+		{ "history", 1, NULL, PV_LONGOPT_HISTORY },
+		{ "stall-timeout", 1, NULL, PV_LONGOPT_STALL_TIMEOUT },
+		{ "rate-drop", 1, NULL, PV_LONGOPT_RATE_DROP },
+		{ "on-stall", 1, NULL, PV_LONGOPT_ON_STALL },
+		{ "tree", 0, NULL, PV_LONGOPT_TREE },
+		{ "spool-memory", 1, NULL, PV_LONGOPT_SPOOL_MEMORY },
+#ifdef HAVE_PTHREAD
+		{ "forward-after", 1, NULL, PV_LONGOPT_FORWARD_AFTER },
+#endif				/* HAVE_PTHREAD */
 #ifdef ENABLE_DEBUGGING
 		{ "debug", 1, NULL, (int) '!' },
 #endif				/* ENABLE_DEBUGGING */
@@ -681,6 +946,9 @@ opts_t opts_parse(unsigned int argc, char **argv)
 	opts->interval = 1;
 	opts->delay_start = 0;
 	opts->average_rate_window = 30;
+	opts->stats_fd = -1;
+	opts->numa_node = -1;
+	opts->spool_memory = (off_t) 64 * 1024 * 1024;
 
 	opts->width_set_manually = false;
 	opts->height_set_manually = false;
@@ -717,6 +985,9 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		case 'B':
 			/*@fallthrough@ */
 		case 'Z':
+			/* "-B auto" is valid, so allow it. */
+			if (('B' == c) && (0 == strcmp(optarg, "auto")))
+				break;
 			if (!pv_getnum_check(optarg, PV_NUMTYPE_ANY_WITH_SUFFIX)) {
 				/*@-mustfreefresh@ *//* see above */
 				fprintf(stderr, "%s: -%c: %s: %s\n", opts->program_name, c, optarg,
@@ -734,8 +1005,6 @@ opts_t opts_parse(unsigned int argc, char **argv)
 			/*@fallthrough@ */
 		case 'R':
 			/*@fallthrough@ */
-		case 'Q':
-			/*@fallthrough@ */
 		case 'm':
 			if (!pv_getnum_check(optarg, PV_NUMTYPE_BARE_INTEGER)) {
 				/*@-mustfreefresh@ *//* see above */
@@ -746,6 +1015,233 @@ opts_t opts_parse(unsigned int argc, char **argv)
 				/*@+mustfreefresh@ */
 			}
 			break;
+		case 'Q':
+			if (!pv_query_targets_valid(optarg)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: -%c: %s: %s\n", opts->program_name, c, optarg,
+					_("process ID, list of process IDs, or \"all\" expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_RESCUE_RETRIES:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_BARE_INTEGER)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--rescue-retries", optarg,
+					_("integer argument expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_JOBS:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_BARE_INTEGER)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--jobs", optarg,
+					_("integer argument expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_NUMA_NODE:
+			/* "--numa-node auto" is valid, so allow it. */
+			if (0 == strcmp(optarg, "auto"))
+				break;
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_BARE_INTEGER)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--numa-node", optarg,
+					_("integer argument expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_CPU_AFFINITY:
+			if (!pv_numa_cpulist_valid(optarg)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--cpu-affinity", optarg,
+					_("processor list not understood"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_RECORD:
+			if (!pv_record_spec_valid(optarg)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--record", optarg,
+					_("record framing not understood"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_STALL_TIMEOUT:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_BARE_DOUBLE)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--stall-timeout", optarg,
+					_("numeric argument expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_RATE_DROP:
+			if ((!pv_getnum_check(optarg, PV_NUMTYPE_BARE_INTEGER)) || (pv_getnum_count(optarg, false) > 100)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--rate-drop", optarg,
+					_("percentage expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_STATS_FD:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_BARE_INTEGER)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--stats-fd", optarg,
+					_("integer argument expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_PIPE_SIZE:
+			if ((0 != strcmp(optarg, "auto")) && (!pv_getnum_check(optarg, PV_NUMTYPE_ANY_WITH_SUFFIX))) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--pipe-size", optarg,
+					_("numeric value not understood"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_SYNC_EVERY:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_ANY_WITH_SUFFIX)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--sync-every", optarg,
+					_("numeric value not understood"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_SYNC_INTERVAL:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_BARE_DOUBLE)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--sync-interval", optarg,
+					_("numeric argument expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_COALESCE:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_BARE_DOUBLE)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--coalesce", optarg,
+					_("numeric argument expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_COALESCE_BYTES:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_ANY_WITH_SUFFIX)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--coalesce-bytes", optarg,
+					_("numeric value not understood"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_RATE_BURST:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_ANY_WITH_SUFFIX)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--rate-burst", optarg,
+					_("numeric value not understood"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_RATE_BUDGET:
+			if (!pv_budget_name_valid(optarg)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--rate-budget", optarg,
+					_("budget name not understood"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_RATE_WEIGHT:
+			if ((!pv_getnum_check(optarg, PV_NUMTYPE_BARE_INTEGER)) || (pv_getnum_count(optarg, false) < 1)
+			    || (pv_getnum_count(optarg, false) > 1000)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--rate-weight", optarg,
+					_("weight from 1 to 1000 expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_LATENCY_TARGET:
+			if ((!pv_getnum_check(optarg, PV_NUMTYPE_BARE_DOUBLE)) || (pv_getnum_interval(optarg) <= 0)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--latency-target", optarg,
+					_("numeric argument expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_PRESSURE_TARGET:
+			if ((!pv_getnum_check(optarg, PV_NUMTYPE_BARE_INTEGER)) || (pv_getnum_count(optarg, false) < 1)
+			    || (pv_getnum_count(optarg, false) > 100)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--pressure-target", optarg,
+					_("percentage expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_SPOOL_MEMORY:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_ANY_WITH_SUFFIX)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--spool-memory", optarg,
+					_("numeric value not understood"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_FORWARD_AFTER:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_ANY_WITH_SUFFIX)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--forward-after", optarg,
+					_("numeric value not understood"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+#ifdef HAVE_PTHREAD
+		case PV_LONGOPT_PIPELINE:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_BARE_INTEGER)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--pipeline", optarg,
+					_("integer argument expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+#endif				/* HAVE_PTHREAD */
 		case 'i':
 			/*@fallthrough@ */
 		case 'D':
@@ -877,7 +1373,6 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		case 'A':
 			opts->lastwritten = (size_t) pv_getnum_count(optarg, opts->decimal_units);
 			numopts++;
-			opts->no_splice = true;
 			break;
 		case 'f':
 			opts->force = true;
@@ -885,6 +1380,32 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		case 'v':
 			opts->show_stats = true;
 			break;
+		case PV_LONGOPT_SELF_PROFILE:
+			opts->self_profile = true;
+			break;
+		case PV_LONGOPT_HUGE_PAGES:
+			opts->huge_pages = true;
+			break;
+		case PV_LONGOPT_LOCK_BUFFERS:
+			opts->lock_buffers = true;
+			break;
+		case PV_LONGOPT_NUMA_NODE:
+			if (0 == strcmp(optarg, "auto")) {
+				opts->numa_node = PV_NUMA_NODE_AUTO;
+			} else {
+				opts->numa_node = (int) pv_getnum_count(optarg, false);
+			}
+			break;
+		case PV_LONGOPT_CPU_AFFINITY:
+			if (NULL != opts->cpu_affinity)
+				free(opts->cpu_affinity);
+			opts->cpu_affinity = pv_strdup(optarg);
+			if (NULL == opts->cpu_affinity) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--cpu-affinity", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
 		case 'n':
 			opts->numeric = true;
 			numopts++;
@@ -915,12 +1436,29 @@ opts_t opts_parse(unsigned int argc, char **argv)
 				}
 			}
 			break;
+		case PV_LONGOPT_UNCOMPRESSED_SIZE:
+			{
+				off_t uncompressed_size = pv_sizehint_file(optarg);
+				if (uncompressed_size < 0) {
+					/*@-mustfreefresh@ *//* see above */
+					fprintf(stderr, "%s: %s: %s\n", opts->program_name, optarg,
+						_("decompressed size is not recorded in this file"));
+					opts_free(opts);
+					return NULL;
+					/*@+mustfreefresh@ */
+				}
+				opts->size = uncompressed_size;
+			}
+			break;
 		case 'g':
 			opts->rate_gauge = true;
 			break;
 		case 'l':
 			opts->linemode = true;
 			break;
+		case PV_LONGOPT_LINE_ESTIMATE:
+			opts->line_estimate = true;
+			break;
 		case '0':
 			opts->null_terminated_lines = true;
 			opts->linemode = true;
@@ -955,13 +1493,63 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		case 'L':
 			opts->rate_limit = pv_getnum_size(optarg, opts->decimal_units);
 			break;
+		case PV_LONGOPT_RATE_BURST:
+			opts->rate_burst = pv_getnum_size(optarg, opts->decimal_units);
+			break;
+		case PV_LONGOPT_RATE_BUDGET:
+			if (NULL != opts->rate_budget)
+				free(opts->rate_budget);
+			opts->rate_budget = pv_strdup(optarg);
+			if (NULL == opts->rate_budget) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--rate-budget", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case PV_LONGOPT_RATE_WEIGHT:
+			opts->rate_weight = (unsigned int) pv_getnum_count(optarg, false);
+			break;
+		case PV_LONGOPT_LATENCY_TARGET:
+			opts->latency_target = pv_getnum_interval(optarg);
+			break;
+		case PV_LONGOPT_PRESSURE_TARGET:
+			opts->pressure_target = (unsigned int) pv_getnum_count(optarg, false);
+			break;
+		case PV_LONGOPT_COALESCE:
+			opts->coalesce = pv_getnum_interval(optarg);
+			opts->no_splice = true;
+			break;
+		case PV_LONGOPT_COALESCE_BYTES:
+			opts->coalesce_bytes = (size_t) pv_getnum_size(optarg, opts->decimal_units);
+			break;
+		case PV_LONGOPT_SPOOL_MEMORY:
+			opts->spool_memory = pv_getnum_size(optarg, opts->decimal_units);
+			break;
+		case PV_LONGOPT_FORWARD_AFTER:
+			opts->forward_after = pv_getnum_size(optarg, opts->decimal_units);
+			break;
 		case 'B':
-			opts->buffer_size = (size_t) pv_getnum_size(optarg, opts->decimal_units);
+			if (0 == strcmp(optarg, "auto")) {
+				opts->adaptive_buffer = true;
+				opts->buffer_size = 0;
+			} else {
+				opts->adaptive_buffer = false;
+				opts->buffer_size = (size_t) pv_getnum_size(optarg, opts->decimal_units);
+			}
 			opts->no_splice = true;
 			break;
 		case 'C':
 			opts->no_splice = true;
 			break;
+		case PV_LONGOPT_PIPE_SIZE:
+			if (0 == strcmp(optarg, "auto")) {
+				opts->pipe_size_auto = true;
+				opts->pipe_size = 0;
+			} else {
+				opts->pipe_size_auto = false;
+				opts->pipe_size = (size_t) pv_getnum_size(optarg, opts->decimal_units);
+			}
+			break;
 		case 'E':
 			opts->skip_errors++;
 			break;
@@ -974,6 +1562,14 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		case 'Y':
 			opts->sync_after_write = true;
 			break;
+		case PV_LONGOPT_SYNC_EVERY:
+			opts->sync_every = pv_getnum_size(optarg, opts->decimal_units);
+			opts->sync_after_write = true;
+			break;
+		case PV_LONGOPT_SYNC_INTERVAL:
+			opts->sync_interval = pv_getnum_interval(optarg);
+			opts->sync_after_write = true;
+			break;
 		case 'K':
 			opts->direct_io = true;
 			break;
@@ -999,7 +1595,20 @@ opts_t opts_parse(unsigned int argc, char **argv)
 			opts->action = PV_ACTION_REMOTE_CONTROL;
 			break;
 		case 'Q':
-			opts->query = (pid_t) pv_getnum_count(optarg, false);
+			if (NULL != opts->query_targets)
+				free(opts->query_targets);
+			opts->query_targets = NULL;
+			opts->query = 0;
+			if (pv_getnum_check(optarg, PV_NUMTYPE_BARE_INTEGER)) {
+				opts->query = (pid_t) pv_getnum_count(optarg, false);
+			} else {
+				opts->query_targets = pv_strdup(optarg);
+				if (NULL == opts->query_targets) {
+					fprintf(stderr, "%s: -Q: %s\n", opts->program_name, strerror(errno));
+					opts_free(opts);
+					return NULL;
+				}
+			}
 			opts->action = PV_ACTION_QUERY;
 			break;
 		case 'P':
@@ -1034,6 +1643,14 @@ opts_t opts_parse(unsigned int argc, char **argv)
 			opts->action = PV_ACTION_WATCHFD;
 			break;
 		case 'o':
+			/* Any "-o" after the first adds another output. */
+			if (NULL != opts->output) {
+				if (!opts_add_extra_output(opts, optarg)) {
+					opts_free(opts);
+					return NULL;
+				}
+				break;
+			}
 			opts->output = pv_strdup(optarg);
 			if (NULL == opts->output) {
 				fprintf(stderr, "%s: -o: %s\n", opts->program_name, strerror(errno));
@@ -1044,6 +1661,322 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		case 'm':
 			opts->average_rate_window = pv_getnum_count(optarg, opts->decimal_units);
 			break;
+#ifdef HAVE_PTHREAD
+		case PV_LONGOPT_PIPELINE:
+			opts->pipeline_buffers = pv_getnum_count(optarg, false);
+			/* A single buffer can't overlap anything. */
+			if (1 == opts->pipeline_buffers)
+				opts->pipeline_buffers = 2;
+			opts->no_splice = true;
+			break;
+#endif				/* HAVE_PTHREAD */
+		case PV_LONGOPT_ENGINE:
+			{
+				unsigned int engine_idx;
+				bool engine_found = false;
+				for (engine_idx = 0; NULL != opts_io_engines[engine_idx].name; engine_idx++) {
+					if (0 == strcmp(optarg, opts_io_engines[engine_idx].name)) {
+						opts->io_engine = opts_io_engines[engine_idx].engine;
+						engine_found = true;
+						break;
+					}
+				}
+				if (!engine_found) {
+					/*@-mustfreefresh@ *//* see above */
+					fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--engine", optarg,
+						_("unknown or unavailable I/O engine"));
+					opts_free(opts);
+					return NULL;
+					/*@+mustfreefresh@ */
+				}
+			}
+			break;
+		case PV_LONGOPT_ENGINE_CACHE:
+			if (NULL != opts->engine_cache)
+				free(opts->engine_cache);
+			opts->engine_cache = pv_strdup(optarg);
+			if (NULL == opts->engine_cache) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--engine-cache", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case PV_LONGOPT_STATS_PAGE:
+			opts->stats_page = true;
+			break;
+		case PV_LONGOPT_DROP_BEHIND:
+			opts->drop_behind = true;
+			break;
+		case PV_LONGOPT_RESCUE:
+			if (NULL != opts->rescue_map)
+				free(opts->rescue_map);
+			opts->rescue_map = pv_strdup(optarg);
+			if (NULL == opts->rescue_map) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--rescue", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case PV_LONGOPT_RESCUE_RETRIES:
+			opts->rescue_retries = (unsigned int) pv_getnum_count(optarg, false);
+			break;
+		case PV_LONGOPT_RESCUE_DIRECT:
+			opts->rescue_direct = true;
+			break;
+		case PV_LONGOPT_STREAMS:
+			opts->streams = (unsigned int) pv_getnum_count(optarg, false);
+			break;
+		case PV_LONGOPT_MANIFEST:
+			if (NULL != opts->manifest)
+				free(opts->manifest);
+			opts->manifest = pv_strdup(optarg);
+			if (NULL == opts->manifest) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--manifest", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			opts->action = PV_ACTION_MULTISTREAM;
+			break;
+		case PV_LONGOPT_COPY_INTO:
+			if (NULL != opts->copy_into)
+				free(opts->copy_into);
+			opts->copy_into = pv_strdup(optarg);
+			if (NULL == opts->copy_into) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--copy-into", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			opts->action = PV_ACTION_MULTISTREAM;
+			break;
+		case PV_LONGOPT_JOBS:
+			opts->jobs = (unsigned int) pv_getnum_count(optarg, false);
+			break;
+		case PV_LONGOPT_RECORD:
+			if (NULL != opts->record)
+				free(opts->record);
+			opts->record = pv_strdup(optarg);
+			if (NULL == opts->record) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--record", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			opts->linemode = true;
+			break;
+		case PV_LONGOPT_CHECKPOINT:
+			if (NULL != opts->checkpoint_file)
+				free(opts->checkpoint_file);
+			opts->checkpoint_file = pv_strdup(optarg);
+			if (NULL == opts->checkpoint_file) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--checkpoint", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case PV_LONGOPT_STATS_FD:
+			opts->stats_fd = (int) pv_getnum_count(optarg, false);
+			if (fcntl(opts->stats_fd, F_GETFL) < 0) {
+				fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--stats-fd", optarg,
+					strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case PV_LONGOPT_STALL_TIMEOUT:
+			opts->stall_timeout = pv_getnum_interval(optarg);
+			break;
+		case PV_LONGOPT_RATE_DROP:
+			opts->rate_drop = (unsigned int) pv_getnum_count(optarg, false);
+			break;
+		case PV_LONGOPT_ON_STALL:
+			if (NULL != opts->stall_command)
+				free(opts->stall_command);
+			opts->stall_command = pv_strdup(optarg);
+			if (NULL == opts->stall_command) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--on-stall", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case PV_LONGOPT_METRICS_FILE:
+			if (NULL != opts->metrics_file)
+				free(opts->metrics_file);
+			opts->metrics_file = pv_strdup(optarg);
+			if (NULL == opts->metrics_file) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--metrics-file", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case PV_LONGOPT_TRACE:
+			if (NULL != opts->trace_file)
+				free(opts->trace_file);
+			opts->trace_file = pv_strdup(optarg);
+			if (NULL == opts->trace_file) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--trace", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case PV_LONGOPT_TRACE_DECODE:
+			if (NULL != opts->trace_decode)
+				free(opts->trace_decode);
+			opts->trace_decode = pv_strdup(optarg);
+			if (NULL == opts->trace_decode) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--trace-decode", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			opts->action = PV_ACTION_TRACE_DECODE;
+			break;
+		case PV_LONGOPT_HISTORY:
+			if (NULL != opts->history_file)
+				free(opts->history_file);
+			opts->history_file = pv_strdup(optarg);
+			if (NULL == opts->history_file) {
+				fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--history", strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case PV_LONGOPT_ETA_MODEL:
+			{
+				unsigned int model_idx;
+				bool model_found = false;
+				for (model_idx = 0; NULL != opts_eta_models[model_idx].name; model_idx++) {
+					if (0 == strcmp(optarg, opts_eta_models[model_idx].name)) {
+						opts->eta_model = opts_eta_models[model_idx].model;
+						model_found = true;
+						break;
+					}
+				}
+				if (!model_found) {
+					/*@-mustfreefresh@ *//* see above */
+					fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--eta-model",
+						optarg, _("unknown ETA model"));
+					opts_free(opts);
+					return NULL;
+					/*@+mustfreefresh@ */
+				}
+			}
+			break;
+		case PV_LONGOPT_DIGEST:
+			{
+				unsigned int digest_idx;
+				bool digest_found = false;
+				for (digest_idx = 0; NULL != opts_digests[digest_idx].name; digest_idx++) {
+					if (0 == strcmp(optarg, opts_digests[digest_idx].name)) {
+						opts->digest = opts_digests[digest_idx].digest;
+						digest_found = true;
+						break;
+					}
+				}
+				if (!digest_found) {
+					/*@-mustfreefresh@ *//* see above */
+					fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--digest",
+						optarg, _("unknown digest type"));
+					opts_free(opts);
+					return NULL;
+					/*@+mustfreefresh@ */
+				}
+			}
+			break;
+		case PV_LONGOPT_COMPRESS:
+			/*@fallthrough@ */
+		case PV_LONGOPT_DECOMPRESS:
+			{
+				const char *option_name = PV_LONGOPT_COMPRESS == c ? "--compress" : "--decompress";
+				char codec_name[32];	/* flawfinder: ignore - bounded by pv_snprintf() */
+				char *level_string;
+				unsigned int codec_idx;
+				bool codec_found = false;
+
+				(void) pv_snprintf(codec_name, sizeof(codec_name), "%s", optarg);
+				level_string = strchr(codec_name, ':');
+				if (NULL != level_string) {
+					*level_string = '\0';
+					level_string++;
+				}
+
+				for (codec_idx = 0; NULL != opts_codecs[codec_idx].name; codec_idx++) {
+					if (0 == strcmp(codec_name, opts_codecs[codec_idx].name)) {
+						codec_found = true;
+						break;
+					}
+				}
+				if (!codec_found) {
+					/*@-mustfreefresh@ *//* see above */
+					fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, option_name,
+						optarg, _("unknown or unsupported codec"));
+					opts_free(opts);
+					return NULL;
+					/*@+mustfreefresh@ */
+				}
+
+				opts->codec = opts_codecs[codec_idx].codec;
+				opts->codec_compress = (PV_LONGOPT_COMPRESS == c);
+				opts->codec_level = 0;
+
+				if (NULL != level_string) {
+					if ((PV_LONGOPT_DECOMPRESS == c)
+					    || (!pv_getnum_check(level_string, PV_NUMTYPE_BARE_INTEGER))
+					    || (pv_getnum_count(level_string, false) < 1)
+					    || ((int) pv_getnum_count(level_string, false) > opts_codecs[codec_idx].max_level)) {
+						/*@-mustfreefresh@ *//* see above */
+						fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, option_name,
+							optarg, _("compression level not valid for this codec"));
+						opts_free(opts);
+						return NULL;
+						/*@+mustfreefresh@ */
+					}
+					opts->codec_level = (int) pv_getnum_count(level_string, false);
+				}
+			}
+			break;
+		case PV_LONGOPT_FANOUT_POLICY:
+			{
+				unsigned int policy_idx;
+				bool policy_found = false;
+				for (policy_idx = 0; NULL != opts_fanout_policies[policy_idx].name; policy_idx++) {
+					if (0 == strcmp(optarg, opts_fanout_policies[policy_idx].name)) {
+						opts->fanout_policy = opts_fanout_policies[policy_idx].policy;
+						policy_found = true;
+						break;
+					}
+				}
+				if (!policy_found) {
+					/*@-mustfreefresh@ *//* see above */
+					fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--fanout-policy",
+						optarg, _("unknown output policy"));
+					opts_free(opts);
+					return NULL;
+					/*@+mustfreefresh@ */
+				}
+			}
+			break;
+		case PV_LONGOPT_STATS_FORMAT:
+			{
+				unsigned int format_idx;
+				bool format_found = false;
+				for (format_idx = 0; NULL != opts_stats_formats[format_idx].name; format_idx++) {
+					if (0 == strcmp(optarg, opts_stats_formats[format_idx].name)) {
+						opts->stats_format = opts_stats_formats[format_idx].format;
+						format_found = true;
+						break;
+					}
+				}
+				if (!format_found) {
+					/*@-mustfreefresh@ *//* see above */
+					fprintf(stderr, "%s: %s: %s: %s\n", opts->program_name, "--stats-format",
+						optarg, _("unknown stats record format"));
+					opts_free(opts);
+					return NULL;
+					/*@+mustfreefresh@ */
+				}
+			}
+			break;
+		case PV_LONGOPT_TREE:
+			opts->watch_tree = true;
+			break;
 #ifdef ENABLE_DEBUGGING
 		case '!':
 			debugging_output_destination(optarg);
@@ -1080,10 +2013,49 @@ opts_t opts_parse(unsigned int argc, char **argv)
 	if (NULL == opts)
 		return NULL;
 
+	if ((NULL != opts->rate_budget) && ((opts->latency_target > 0) || (opts->pressure_target > 0))) {
+		/*@-mustfreefresh@ *//* see above */
+		fprintf(stderr, "%s: %s\n", opts->program_name,
+			_("cannot use --rate-budget with --latency-target or --pressure-target"));
+		opts_free(opts);
+		return NULL;
+		/*@+mustfreefresh@ */
+	}
+
+	if ((NULL != opts->rate_budget) && (opts->rate_limit <= 0)) {
+		/*@-mustfreefresh@ *//* see above */
+		fprintf(stderr, "%s: %s\n", opts->program_name, _("--rate-budget needs a rate limit from -L"));
+		opts_free(opts);
+		return NULL;
+		/*@+mustfreefresh@ */
+	}
+
+	if ((PV_ACTION_TRACE_DECODE == opts->action) && (optind < (int) argc)) {
+		/*@-mustfreefresh@ *//* see above */
+		fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--trace-decode",
+			_("files cannot be specified with this option"));
+		opts_free(opts);
+		return NULL;
+		/*@+mustfreefresh@ */
+	}
+
+	if ((NULL != opts->record) && opts->null_terminated_lines) {
+		/*@-mustfreefresh@ *//* see above */
+		fprintf(stderr, "%s: %s\n", opts->program_name, _("cannot use --record with -0"));
+		opts_free(opts);
+		return NULL;
+		/*@+mustfreefresh@ */
+	}
+
 	if (PV_ACTION_WATCHFD == opts->action) {
 		if (opts->linemode || opts->null_terminated_lines || opts->stop_at_size
-		    || (opts->skip_errors > 0) || (opts->buffer_size > 0)
-		    || (opts->rate_limit > 0)) {
+		    || (opts->skip_errors > 0) || (opts->buffer_size > 0) || opts->adaptive_buffer
+		    || (opts->rate_limit > 0) || (opts->rate_burst > 0) || (NULL != opts->rate_budget)
+		    || (opts->latency_target > 0) || (opts->pressure_target > 0) || (NULL != opts->trace_file)
+		    || (NULL != opts->history_file)
+		    || (opts->pipeline_buffers > 0) || (opts->coalesce > 0)
+		    || (PV_IOENGINE_AUTO != opts->io_engine) || (NULL != opts->engine_cache) || (NULL != opts->rescue_map)
+		    || (NULL != opts->checkpoint_file) || (opts->streams > 1) || (PV_CODEC_NONE != opts->codec)) {
 			/*@-mustfreefresh@ *//* see above */
 			fprintf(stderr, "%s: %s\n", opts->program_name,
 				_("cannot use line mode or transfer modifier options when watching file descriptors"));
@@ -1110,7 +2082,7 @@ opts_t opts_parse(unsigned int argc, char **argv)
 			/*@+mustfreefresh@ */
 		}
 
-		if (0 != opts->query) {
+		if ((0 != opts->query) || (NULL != opts->query_targets)) {
 			/*@-mustfreefresh@ *//* see above */
 			fprintf(stderr, "%s: %s\n", opts->program_name,
 				_("cannot use remote query when watching file descriptors"));
@@ -1155,8 +2127,16 @@ opts_t opts_parse(unsigned int argc, char **argv)
 #endif
 	}
 
+	if (opts->watch_tree && (PV_ACTION_WATCHFD != opts->action)) {
+		/*@-mustfreefresh@ *//* see above */
+		fprintf(stderr, "%s: --tree: %s\n", opts->program_name, _("only available when watching file descriptors"));
+		opts_free(opts);
+		return NULL;
+		/*@+mustfreefresh@ */
+	}
+
 	/* Don't allow -R and -Q together. */
-	if ((0 != opts->remote) && (0 != opts->query)) {
+	if ((0 != opts->remote) && ((0 != opts->query) || (NULL != opts->query_targets))) {
 		/*@-mustfreefresh@ *//* see above */
 		fprintf(stderr, "%s: %s\n", opts->program_name,
 			_("cannot use remote control and remote query together"));
@@ -1183,7 +2163,7 @@ opts_t opts_parse(unsigned int argc, char **argv)
 	/*
 	 * Don't allow any non-option arguments with -R or -Q.
 	 */
-	if ((optind < (int) argc) && ((0 != opts->remote) || (0 != opts->query))) {
+	if ((optind < (int) argc) && ((0 != opts->remote) || (0 != opts->query) || (NULL != opts->query_targets))) {
 		/*@-mustfreefresh@ *//* see above */
 		fprintf(stderr, "%s: %s: %s\n", opts->program_name, 0 != opts->remote ? "-R" : "-Q",
 			_("files cannot be specified with this option"));
@@ -1202,5 +2182,138 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		}
 	}
 
+	/*
+	 * A rescue works on one input, read out of order, and writes each
+	 * region to the matching place in the output, so it can't be
+	 * combined with anything which needs the data to arrive in order.
+	 */
+	if (NULL != opts->rescue_map) {
+		if (opts->argc > 1) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--rescue",
+				_("only one input file can be rescued at a time"));
+			opts_free(opts);
+			return NULL;
+			/*@+mustfreefresh@ */
+		}
+		if (opts->linemode || opts->null_terminated_lines || opts->sparse_output || opts->discard_input
+		    || (opts->extra_output_count > 0) || (NULL != opts->store_and_forward_file)
+		    || (PV_DIGEST_NONE != opts->digest)) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--rescue",
+				_("cannot be used with line mode, sparse output, discard, digest, store-and-forward, or extra outputs"));
+			opts_free(opts);
+			return NULL;
+			/*@+mustfreefresh@ */
+		}
+	}
+
+	/*
+	 * A checkpoint records one output offset, and the state of what is
+	 * being written there, so only a single, direct output can be
+	 * resumed.
+	 */
+	if ((NULL != opts->checkpoint_file)
+	    && ((NULL != opts->rescue_map) || (opts->extra_output_count > 0)
+		|| (NULL != opts->store_and_forward_file))) {
+		/*@-mustfreefresh@ *//* see above */
+		fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--checkpoint",
+			_("cannot be used with --rescue, store-and-forward, or extra outputs"));
+		opts_free(opts);
+		return NULL;
+		/*@+mustfreefresh@ */
+	}
+
+	/*
+	 * The codec changes how much is written for each byte read, so the
+	 * output offsets that a rescue or a checkpoint relies on no longer
+	 * match the input.
+	 */
+	if ((PV_CODEC_NONE != opts->codec) && ((NULL != opts->rescue_map) || (NULL != opts->checkpoint_file))) {
+		/*@-mustfreefresh@ *//* see above */
+		fprintf(stderr, "%s: %s: %s\n", opts->program_name, opts->codec_compress ? "--compress" : "--decompress",
+			_("cannot be used with --rescue or --checkpoint"));
+		opts_free(opts);
+		return NULL;
+		/*@+mustfreefresh@ */
+	}
+
+	/*
+	 * Copying many files at once replaces the single transfer, so none
+	 * of the options which shape that transfer, or its one output, fit
+	 * with it; the input files are copied from the command line with
+	 * "--copy-into", and only from the manifest otherwise.
+	 */
+	if (PV_ACTION_MULTISTREAM == opts->action) {
+		if ((NULL != opts->manifest) && (NULL != opts->copy_into)) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--manifest",
+				_("cannot be used with --copy-into"));
+			opts_free(opts);
+			return NULL;
+			/*@+mustfreefresh@ */
+		}
+		if ((NULL != opts->output) || (opts->extra_output_count > 0) || (NULL != opts->store_and_forward_file)
+		    || (NULL != opts->rescue_map) || (NULL != opts->checkpoint_file) || (opts->streams > 1)
+		    || (PV_CODEC_NONE != opts->codec) || opts->linemode || opts->null_terminated_lines
+		    || (opts->rate_limit > 0) || opts->cursor || (0 != opts->remote) || (0 != opts->query)
+		    || (NULL != opts->query_targets)) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: %s: %s\n", opts->program_name,
+				NULL != opts->manifest ? "--manifest" : "--copy-into",
+				_("cannot be used with -o, -c, -l, -R, -Q, or transfer modifier options"));
+			opts_free(opts);
+			return NULL;
+			/*@+mustfreefresh@ */
+		}
+		if ((NULL != opts->manifest) && (opts->argc > 0)) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--manifest",
+				_("files cannot be specified with this option"));
+			opts_free(opts);
+			return NULL;
+			/*@+mustfreefresh@ */
+		}
+		if ((NULL != opts->copy_into) && (0 == opts->argc)) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--copy-into",
+				_("no files given to copy"));
+			opts_free(opts);
+			return NULL;
+			/*@+mustfreefresh@ */
+		}
+	}
+
+	/*
+	 * Parallel streams are only used for network addresses, so there
+	 * has to be one to use them on.
+	 */
+	if (opts->streams > 1) {
+		bool have_address = pv_net_is_address(opts->output);
+		unsigned int arg_idx;
+
+		for (arg_idx = 0; (NULL != opts->argv) && (arg_idx < opts->argc); arg_idx++) {
+			if (pv_net_is_address(opts->argv[arg_idx]))
+				have_address = true;
+		}
+
+		if (opts->streams > 64) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--streams",
+				_("no more than 64 streams can be used"));
+			opts_free(opts);
+			return NULL;
+			/*@+mustfreefresh@ */
+		}
+		if (!have_address) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: %s: %s\n", opts->program_name, "--streams",
+				_("needs a network address as an input or output"));
+			opts_free(opts);
+			return NULL;
+			/*@+mustfreefresh@ */
+		}
+	}
+
 	return opts;
 }
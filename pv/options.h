@@ -16,6 +16,8 @@
 #include <stdlib.h>
 #include <sys/types.h>
 
+#include "pv.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -32,7 +34,9 @@ typedef enum {
 	PV_ACTION_STORE_AND_FORWARD,	/* store to file, then output from it */
 	PV_ACTION_WATCHFD,		/* watch process file descriptors */
 	PV_ACTION_REMOTE_CONTROL,	/* remotely control another pv */
-	PV_ACTION_QUERY			/* watch the state of another pv */
+	PV_ACTION_QUERY,		/* watch the state of another pv */
+	PV_ACTION_MULTISTREAM,		/* copy many files at once */
+	PV_ACTION_TRACE_DECODE		/* decode a --trace file */
 } pvaction_t;
 
 /*
@@ -43,6 +47,10 @@ typedef enum {
 struct opts_s {
 	double interval;               /* interval between updates */
 	double delay_start;            /* delay before first display */
+	double stall_timeout;          /* --stall-timeout seconds (0=off) */
+	double coalesce;               /* --coalesce seconds to hold writes for (0=off) */
+	double latency_target;         /* --latency-target seconds (0=off) */
+	double sync_interval;          /* --sync-interval seconds between full syncs (0=off) */
 	/*@keep@*/ const char *program_name; /* name the program is running as */
 	/*@keep@*/ /*@null@*/ char *output; /* fd to write output to */
 	/*@keep@*/ /*@null@*/ char *name;    /* display name, if any */
@@ -51,24 +59,63 @@ struct opts_s {
 	/*@keep@*/ /*@null@*/ char *pidfile; /* PID file, if any */
 	/*@keep@*/ /*@null@*/ char *store_and_forward_file; /* store and forward file, if any */
 	/*@keep@*/ /*@null@*/ char *extra_display; /* extra display specifier, if any */
+	/*@keep@*/ /*@null@*/ char *metrics_file; /* file to write metrics to, if any */
+	/*@keep@*/ /*@null@*/ char *stall_command; /* --on-stall command, if any */
+	/*@keep@*/ /*@null@*/ char *rate_budget; /* --rate-budget name, if any */
+	/*@keep@*/ /*@null@*/ char *trace_file; /* --trace file, if any */
+	/*@keep@*/ /*@null@*/ char *trace_decode; /* --trace-decode file, if any */
+	/*@keep@*/ /*@null@*/ char *history_file; /* --history file, if any */
+	/*@keep@*/ /*@null@*/ char *engine_cache; /* --engine-cache file, if any */
+	/*@keep@*/ /*@null@*/ char *rescue_map; /* --rescue region map file, if any */
+	/*@keep@*/ /*@null@*/ char *checkpoint_file; /* --checkpoint file, if any */
+	/*@keep@*/ /*@null@*/ char *cpu_affinity; /* --cpu-affinity processor list */
+	/*@keep@*/ /*@null@*/ char *manifest; /* --manifest file of pairs to copy */
+	/*@keep@*/ /*@null@*/ char *copy_into; /* --copy-into destination directory */
+	/*@keep@*/ /*@null@*/ char *record; /* --record framing specification */
+	/*@keep@*/ /*@null@*/ char *query_targets; /* --query list of PIDs, or "all" */
 	/*@keep@*/ /*@null@*/ pid_t *watchfd_pid;  /* array of processes to watch fds of */
 	/*@keep@*/ /*@null@*/ int *watchfd_fd;  /* array of fds to watch in each one (0=all) */
 	/*@keep@*/ /*@null@*/ const char **argv;   /* array of non-option arguments */
+	/*@keep@*/ /*@null@*/ const char **extra_output; /* outputs from repeated "-o" */
 	size_t lastwritten;            /* show N bytes last written */
 	off_t rate_limit;              /* rate limit, in bytes per second */
+	off_t rate_burst;              /* rate limit burst size, in bytes */
+	off_t spool_memory;            /* store-and-forward spool memory limit */
+	off_t sync_every;              /* --sync-every bytes between full syncs (0=off) */
+	off_t forward_after;           /* start forwarding after this much (0=at end) */
 	size_t buffer_size;            /* buffer size, in bytes (0=default) */
+	size_t coalesce_bytes;         /* --coalesce-bytes write threshold (0=default) */
+	size_t pipe_size;              /* --pipe-size capacity (0=leave alone) */
 	off_t size;                    /* total size of data */
 	off_t error_skip_block;        /* skip block size, 0 for adaptive */
 	pid_t remote;                  /* PID of pv to update settings of */
 	pid_t query;                   /* PID of pv to query progress of */
 	unsigned int skip_errors;      /* skip read errors counter */
+	unsigned int rescue_retries;   /* --rescue retry passes */
+	unsigned int streams;          /* parallel streams per network address */
+	unsigned int jobs;             /* files to copy at once (0=default) */
+	unsigned int rate_drop;        /* --rate-drop percentage (0=off) */
+	unsigned int rate_weight;      /* --rate-weight share of the budget (0=default) */
+	unsigned int pressure_target;  /* --pressure-target I/O stall percentage (0=off) */
+	int codec_level;               /* --compress level (0=default) */
 	unsigned int average_rate_window; /* time window in seconds for average rate calculations */
 	unsigned int width;            /* screen width */
 	unsigned int height;           /* screen height */
 	unsigned int argc;             /* number of non-option arguments */
 	unsigned int argv_length;      /* allocated array size */
+	unsigned int extra_output_count; /* number of extra outputs */
+	unsigned int extra_output_length; /* allocated extra_output array size */
 	unsigned int watchfd_count;	       /* number of watchfd items */
 	unsigned int watchfd_length;	       /* allocated array size */
+	unsigned int pipeline_buffers;	       /* reader thread buffer count (0=none) */
+	pvioengine_t io_engine;		       /* I/O engine to transfer with */
+	pvstatsformat_t stats_format;	       /* record format for --stats-fd */
+	pvetamodel_t eta_model;		       /* how to estimate the rate for the ETA */
+	pvdigest_t digest;		       /* digest of the output to compute */
+	pvfanoutpolicy_t fanout_policy;	       /* what to do with slow extra outputs */
+	pvcodec_t codec;		       /* codec to pass the data through */
+	int stats_fd;			       /* fd to write stats records to (-1=none) */
+	int numa_node;			       /* --numa-node, -1=none, PV_NUMA_NODE_AUTO */
 	pvaction_t action;	       /* the program action to perform */
 	bool progress;                 /* progress bar flag */
 	bool timer;                    /* timer flag */
@@ -87,14 +134,25 @@ struct opts_s {
 	bool rate_gauge;               /* if size unknown, show rate vs max rate */
 	bool linemode;                 /* count lines instead of bytes */
 	bool null_terminated_lines;    /* lines are null-terminated */
+	bool line_estimate;            /* estimate the line count by sampling */
 	bool no_display;               /* do nothing other than pipe data */
 	bool no_splice;                /* flag set if never to use splice */
 	bool stop_at_size;             /* set if we stop at "size" bytes */
 	bool sync_after_write;         /* set if we sync after every write */
+	bool pipe_size_auto;           /* set for "--pipe-size auto" */
 	bool direct_io;                /* set if O_DIRECT is to be used */
+	bool drop_behind;	       /* set to release the page cache as we go */
+	bool rescue_direct;	       /* set to retry --rescue with direct I/O */
+	bool codec_compress;	       /* set to compress, not decompress */
 	bool sparse_output;            /* set if we leave holes in the output */
 	bool discard_input;            /* set to write nothing to output */
 	bool show_stats;	       /* set to write statistics at the end */
+	bool self_profile;	       /* set to report pv's own time per phase */
+	bool huge_pages;	       /* set to back buffers with huge pages */
+	bool lock_buffers;	       /* set to lock buffers into memory */
+	bool adaptive_buffer;	       /* set to tune the buffer size as we go */
+	bool watch_tree;	       /* set to follow child processes with -d */
+	bool stats_page;	       /* set to publish a shared memory stats page */
 	bool width_set_manually;       /* width was set manually, not detected */
 	bool height_set_manually;      /* height was set manually, not detected */
 };
@@ -0,0 +1,460 @@
+/*
+ * Reader thread pipeline, to overlap reading input with writing output.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#ifdef HAVE_PTHREAD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/select.h>
+
+
+/*
+ * States that each buffer in the pipeline ring can be in.  Only the reader
+ * thread touches a buffer while it is PV_PIPELINE_SLOT_READING, and only
+ * the consumer (pv_transfer()) touches it while it is
+ * PV_PIPELINE_SLOT_FILLED, so the buffer contents themselves never need
+ * the mutex - only the state changes do.
+ */
+typedef enum {
+	PV_PIPELINE_SLOT_FREE,
+	PV_PIPELINE_SLOT_READING,
+	PV_PIPELINE_SLOT_FILLED
+} pvpipeline_slot_state_t;
+
+struct pvpipeline_slot_s {
+	/*@only@ */ /*@null@ */ char *buffer;	/* aligned data buffer */
+	size_t capacity;		 /* usable size of the buffer */
+	size_t length;			 /* bytes of data in the buffer */
+	size_t offset;			 /* bytes already taken by the consumer */
+	pvpipeline_slot_state_t state;	 /* who owns the buffer right now */
+};
+
+/*
+ * The pipeline - a reader thread filling a ring of buffers from an input
+ * file descriptor, which pv_transfer() empties into the transfer buffer.
+ */
+struct pvpipeline_s {
+	pthread_t thread;		 /* the reader thread */
+	pthread_mutex_t mutex;		 /* protects everything below */
+	pthread_cond_t changed;		 /* signalled on any slot state change */
+	/*@only@ */ struct pvpipeline_slot_s *slots;	/* ring of buffers */
+	unsigned int slot_count;	 /* number of buffers in the ring */
+	unsigned int fill_index;	 /* next slot for the reader to fill */
+	unsigned int take_index;	 /* next slot for the consumer to take */
+	off_t read_limit;		 /* bytes left to read, or -1 for no limit */
+	int fd;				 /* input file descriptor */
+	int read_errno;			 /* errno of the read error, if any */
+	bool thread_started;		 /* set once pthread_create() succeeded */
+	bool stop_requested;		 /* set by the consumer to end the thread */
+	bool finished;			 /* set by the reader at EOF or on error */
+};
+
+
+/*
+ * Wait for up to "usec" microseconds for "fd" to become readable, for use
+ * by the reader thread after a transient read error.
+ */
+static void pv__pipeline_wait_readable(int fd, long usec)
+{
+	struct timeval tv;
+	fd_set readfds;
+
+	memset(&tv, 0, sizeof(tv));
+	tv.tv_sec = usec / 1000000;
+	tv.tv_usec = usec % 1000000;
+
+#if SPLINT
+	memset(&readfds, 0, sizeof(readfds));
+#else
+	FD_ZERO(&readfds);
+	FD_SET(fd, &readfds);
+#endif
+
+	(void) select(fd + 1, &readfds, NULL, NULL, &tv);
+}
+
+
+/*
+ * Fill one slot from the pipeline's input, returning the number of bytes
+ * read, 0 at end of file, or -1 on error with errno set.
+ *
+ * Reads are repeated while each one fills the chunk requested, so that a
+ * fast input fills the whole buffer, but a short read returns immediately
+ * so that a slow input does not hold up the data it has already produced.
+ */
+static ssize_t pv__pipeline_fill(struct pvpipeline_s *pipeline, struct pvpipeline_slot_s *slot)
+{
+	size_t capacity;
+	ssize_t total_read;
+
+	capacity = slot->capacity;
+	if ((pipeline->read_limit >= 0) && ((off_t) capacity > pipeline->read_limit))
+		capacity = (size_t) (pipeline->read_limit);
+
+	total_read = 0;
+
+	while ((size_t) total_read < capacity) {
+		size_t asked;
+		ssize_t nread;
+		int old_cancel_state;
+
+		asked = capacity - (size_t) total_read;
+		if (asked > MAX_READ_AT_ONCE)
+			asked = MAX_READ_AT_ONCE;
+
+		/*
+		 * The read is the only point at which the thread may be
+		 * cancelled - it holds no locks here, so pv_pipeline_stop()
+		 * can safely cancel a read that is blocked indefinitely.
+		 */
+		old_cancel_state = 0;
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancel_state);
+		nread = read(pipeline->fd, slot->buffer + total_read, asked);	/* flawfinder: ignore */
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancel_state);
+
+		/*
+		 * flawfinder rationale: the read is bounded by the slot
+		 * capacity, which is the usable size of the slot's buffer.
+		 */
+
+		if (nread < 0) {
+			if ((EINTR == errno) || (EAGAIN == errno)) {
+				bool stopping;
+				if (total_read > 0)
+					break;
+				pv__pipeline_wait_readable(pipeline->fd, 90000);
+				(void) pthread_mutex_lock(&(pipeline->mutex));
+				stopping = pipeline->stop_requested;
+				(void) pthread_mutex_unlock(&(pipeline->mutex));
+				if (stopping)
+					break;
+				continue;
+			}
+			if (total_read > 0)
+				break;
+			return -1;
+		}
+
+		total_read += nread;
+
+		if ((size_t) nread < asked)
+			break;
+	}
+
+	return total_read;
+}
+
+
+/*
+ * Main function of the reader thread: keep filling free slots until the
+ * end of the input, a read error, or the consumer asks us to stop.
+ */
+/*@null@ */
+static void *pv__pipeline_reader(void *arg)
+{
+	struct pvpipeline_s *pipeline;
+
+	pipeline = (struct pvpipeline_s *) arg;
+
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	while (true) {
+		struct pvpipeline_slot_s *slot;
+		ssize_t nread;
+		int read_errno;
+
+		(void) pthread_mutex_lock(&(pipeline->mutex));
+		while ((!pipeline->stop_requested)
+		       && (PV_PIPELINE_SLOT_FREE != pipeline->slots[pipeline->fill_index].state)) {
+			(void) pthread_cond_wait(&(pipeline->changed), &(pipeline->mutex));
+		}
+		if (pipeline->stop_requested) {
+			(void) pthread_mutex_unlock(&(pipeline->mutex));
+			break;
+		}
+		slot = &(pipeline->slots[pipeline->fill_index]);
+		slot->state = PV_PIPELINE_SLOT_READING;
+		(void) pthread_mutex_unlock(&(pipeline->mutex));
+
+		nread = pv__pipeline_fill(pipeline, slot);
+		read_errno = errno;
+
+		(void) pthread_mutex_lock(&(pipeline->mutex));
+		if (nread > 0) {
+			slot->length = (size_t) nread;
+			slot->offset = 0;
+			slot->state = PV_PIPELINE_SLOT_FILLED;
+			pipeline->fill_index = (pipeline->fill_index + 1) % pipeline->slot_count;
+			if (pipeline->read_limit >= 0)
+				pipeline->read_limit -= (off_t) nread;
+		} else {
+			slot->state = PV_PIPELINE_SLOT_FREE;
+		}
+		if ((nread < 0) || (0 == nread && !pipeline->stop_requested) || (0 == pipeline->read_limit)) {
+			pipeline->finished = true;
+			if (nread < 0)
+				pipeline->read_errno = read_errno;
+		}
+		(void) pthread_cond_broadcast(&(pipeline->changed));
+		if (pipeline->finished || pipeline->stop_requested) {
+			(void) pthread_mutex_unlock(&(pipeline->mutex));
+			break;
+		}
+		(void) pthread_mutex_unlock(&(pipeline->mutex));
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Free a pipeline structure and its buffers - the reader thread must not
+ * be running.
+ */
+static void pv__pipeline_free( /*@only@ */ struct pvpipeline_s *pipeline)
+{
+	unsigned int slot_idx;
+
+	for (slot_idx = 0; slot_idx < pipeline->slot_count; slot_idx++) {
+		if (NULL != pipeline->slots[slot_idx].buffer)
+			pv_free_aligned_buffer(pipeline->slots[slot_idx].buffer, pipeline->slots[slot_idx].capacity + 32);
+	}
+	free(pipeline->slots);
+	(void) pthread_cond_destroy(&(pipeline->changed));
+	(void) pthread_mutex_destroy(&(pipeline->mutex));
+	free(pipeline);
+}
+
+
+/*
+ * Start a reader thread on "fd", with a ring of "buffer_count" buffers of
+ * "buffer_size" bytes each, aligned for "fd" and "output_fd".  If
+ * "read_limit" is not negative, no more than that many bytes will be read.
+ *
+ * Returns false if the pipeline could not be started, in which case the
+ * caller should fall back to reading directly.
+ */
+bool pv_pipeline_start(pvtransferstate_t transfer, pvcontrol_t control, int fd, int output_fd,
+		       unsigned int buffer_count, size_t buffer_size, off_t read_limit)
+{
+	struct pvpipeline_s *pipeline;
+	unsigned int slot_idx;
+	sigset_t all_signals, old_signals;
+	int rc;
+
+	if (NULL != transfer->pipeline)
+		pv_pipeline_stop(transfer);
+
+	if (buffer_count < 2 || 0 == buffer_size)
+		return false;
+
+	pipeline = calloc(1, sizeof(*pipeline));
+	if (NULL == pipeline) {
+		pv_error("%s: %s", _("pipeline allocation failed"), strerror(errno));
+		return false;
+	}
+
+	pipeline->slots = calloc((size_t) buffer_count, sizeof(pipeline->slots[0]));
+	if (NULL == pipeline->slots) {
+		pv_error("%s: %s", _("pipeline allocation failed"), strerror(errno));
+		free(pipeline);
+		return false;
+	}
+
+	pipeline->slot_count = buffer_count;
+	pipeline->fd = fd;
+	pipeline->read_limit = read_limit;
+	(void) pthread_mutex_init(&(pipeline->mutex), NULL);
+	(void) pthread_cond_init(&(pipeline->changed), NULL);
+
+	for (slot_idx = 0; slot_idx < buffer_count; slot_idx++) {
+		struct pvpipeline_slot_s *slot = &(pipeline->slots[slot_idx]);
+		slot->buffer = pv_allocate_aligned_buffer(control, output_fd, fd, buffer_size + 32);
+		if (NULL == slot->buffer) {
+			pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+			pv__pipeline_free(pipeline);
+			return false;
+		}
+		slot->capacity = buffer_size;
+		slot->state = PV_PIPELINE_SLOT_FREE;
+	}
+
+	/*
+	 * Block all signals in the reader thread, so that SIGALRM from the
+	 * write timer, SIGWINCH, SIGTSTP and so on are always delivered to
+	 * the main thread, whose writes they are meant to interrupt.
+	 */
+	(void) sigfillset(&all_signals);
+	(void) sigemptyset(&old_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&(pipeline->thread), NULL, pv__pipeline_reader, pipeline);
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 != rc) {
+		pv_error("%s: %s", _("failed to start reader thread"), strerror(rc));
+		pv__pipeline_free(pipeline);
+		return false;
+	}
+
+	pipeline->thread_started = true;
+	transfer->pipeline = pipeline;
+
+	debug("%s: fd=%d, %s=%u, %s=%ld", "reader thread started", fd, "buffers", buffer_count, "buffer size",
+	      (long) buffer_size);
+
+	return true;
+}
+
+
+/*
+ * Stop the reader thread, if there is one, and free the pipeline.  Any
+ * data which was read but not yet taken is discarded.
+ */
+void pv_pipeline_stop(pvtransferstate_t transfer)
+{
+	struct pvpipeline_s *pipeline;
+
+	if (NULL == transfer || NULL == transfer->pipeline)
+		return;
+
+	pipeline = transfer->pipeline;
+	transfer->pipeline = NULL;
+
+	if (pipeline->thread_started) {
+		(void) pthread_mutex_lock(&(pipeline->mutex));
+		pipeline->stop_requested = true;
+		(void) pthread_cond_broadcast(&(pipeline->changed));
+		(void) pthread_mutex_unlock(&(pipeline->mutex));
+		/*
+		 * The thread may be blocked in read() on an input that will
+		 * never produce anything more, so cancel it - this only
+		 * takes effect inside the read().
+		 */
+		(void) pthread_cancel(pipeline->thread);
+		(void) pthread_join(pipeline->thread, NULL);
+		debug("%s: fd=%d", "reader thread stopped", pipeline->fd);
+	}
+
+	pv__pipeline_free(pipeline);
+}
+
+
+/*
+ * Move data that the reader thread has produced into the transfer buffer,
+ * waiting up to "usec" microseconds for some to arrive if none is ready.
+ *
+ * When the transfer buffer is empty and a whole slot is ready, the two
+ * buffers are swapped rather than copied; otherwise as much as fits is
+ * copied in after the data already in the transfer buffer.
+ *
+ * Returns the number of bytes added to the transfer buffer, or -1 if the
+ * reader has finished and there is nothing left to take, in which case
+ * *read_errno is set to the errno of the read failure, or 0 at end of file.
+ */
+ssize_t pv_pipeline_fetch(pvtransferstate_t transfer, long usec, int *read_errno)
+{
+	struct pvpipeline_s *pipeline;
+	struct pvpipeline_slot_s *slot;
+	ssize_t moved;
+
+	*read_errno = 0;
+
+	pipeline = transfer->pipeline;
+	if (NULL == pipeline || NULL == transfer->transfer_buffer)
+		return 0;
+
+	(void) pthread_mutex_lock(&(pipeline->mutex));
+
+	slot = &(pipeline->slots[pipeline->take_index]);
+
+	if ((PV_PIPELINE_SLOT_FILLED != slot->state) && (!pipeline->finished) && (usec > 0)) {
+		struct timespec deadline;
+
+		memset(&deadline, 0, sizeof(deadline));
+		(void) clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += usec / 1000000;
+		deadline.tv_nsec += (usec % 1000000) * 1000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		while ((PV_PIPELINE_SLOT_FILLED != slot->state) && (!pipeline->finished)) {
+			if (ETIMEDOUT == pthread_cond_timedwait(&(pipeline->changed), &(pipeline->mutex), &deadline))
+				break;
+		}
+	}
+
+	if (PV_PIPELINE_SLOT_FILLED != slot->state) {
+		bool finished = pipeline->finished;
+		*read_errno = pipeline->read_errno;
+		(void) pthread_mutex_unlock(&(pipeline->mutex));
+		return finished ? -1 : 0;
+	}
+
+	(void) pthread_mutex_unlock(&(pipeline->mutex));
+
+	/*
+	 * The slot is ours until we mark it free again, so the swap or copy
+	 * can be done without holding the lock.
+	 */
+	if ((0 == transfer->read_position) && (0 == slot->offset) && (slot->capacity == transfer->buffer_size)
+	    && (NULL != slot->buffer)) {
+		char *drained_buffer;
+
+		drained_buffer = transfer->transfer_buffer;
+		transfer->transfer_buffer = slot->buffer;
+		slot->buffer = drained_buffer;
+		transfer->read_position = slot->length;
+		transfer->write_position = 0;
+		moved = (ssize_t) (slot->length);
+		slot->offset = slot->length;
+	} else {
+		size_t room, available;
+
+		room = transfer->buffer_size - transfer->read_position;
+		available = slot->length - slot->offset;
+		if (available > room)
+			available = room;
+		if (available > 0 && NULL != slot->buffer) {
+			memcpy(transfer->transfer_buffer + transfer->read_position,	/* flawfinder: ignore */
+			       slot->buffer + slot->offset, available);
+			/*
+			 * flawfinder rationale: "available" is capped to
+			 * the room left in the transfer buffer.
+			 */
+			transfer->read_position += available;
+			slot->offset += available;
+		}
+		moved = (ssize_t) available;
+	}
+
+	if (slot->offset >= slot->length) {
+		(void) pthread_mutex_lock(&(pipeline->mutex));
+		slot->state = PV_PIPELINE_SLOT_FREE;
+		slot->length = 0;
+		slot->offset = 0;
+		pipeline->take_index = (pipeline->take_index + 1) % pipeline->slot_count;
+		(void) pthread_cond_broadcast(&(pipeline->changed));
+		(void) pthread_mutex_unlock(&(pipeline->mutex));
+	}
+
+	return moved;
+}
+
+#endif				/* HAVE_PTHREAD */
@@ -0,0 +1,291 @@
+/*
+ * Functions for "--pipe-size", which sets the capacity of input and output
+ * pipes, or with "auto", grows it to suit the transfer.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+/*
+ * With a fixed size, each pipe is set to that size, up to the system
+ * limit, once when it is first seen.
+ *
+ * With "auto", each pipe starts out at least as big as the transfer
+ * buffer, so that a whole buffer can be spliced or written in one go.
+ * After that, every PV_PIPESIZE_CHECK_NSEC, each pipe is looked at to see
+ * if it is full: an input pipe that is full means the producer is being
+ * held up waiting for us, and an output pipe that is full means we are
+ * being held up waiting for the consumer.  Either way the two ends are
+ * not keeping pace with each other from moment to moment, so the pipe's
+ * capacity is doubled to absorb more of the difference, up to the system
+ * limit.
+ *
+ * The limit for unprivileged processes is in /proc/sys/fs/pipe-max-size;
+ * if that can't be read, PV_PIPESIZE_MAX_DEFAULT is assumed, which is the
+ * usual value.
+ *
+ * This needs F_SETPIPE_SZ, which is specific to Linux; elsewhere, the
+ * option has no effect.
+ */
+#define PV_PIPESIZE_MAX_DEFAULT	1048576		/* assumed pipe-max-size */
+#define PV_PIPESIZE_CHECK_NSEC	50000000	/* nsec between checks for "auto" */
+#define PV_PIPESIZE_SLACK	4096		/* a pipe this close to capacity is full */
+
+struct pvpipesize_s {
+	struct timespec next_check;	 /* when to look at the pipes again */
+	int input_fd;			 /* the input pipe, or -1 */
+	long input_size;		 /* its capacity */
+	long input_largest;		 /* the largest capacity any input pipe had */
+	long output_size;		 /* the output pipe's capacity, or 0 if not a pipe */
+	long max_size;			 /* largest capacity allowed */
+	bool output_checked;		 /* set once the output has been looked at */
+};
+
+
+/*
+ * Return the largest pipe capacity we may set.
+ */
+static long pv__pipesize_max(void)
+{
+	char buf[32];			 /* flawfinder: ignore - bounded by fgets() */
+	FILE *fptr;
+	long max_size;
+
+	max_size = PV_PIPESIZE_MAX_DEFAULT;
+
+	fptr = fopen("/proc/sys/fs/pipe-max-size", "r");	/* flawfinder: ignore - constant path */
+	if (NULL == fptr)
+		return max_size;
+
+	memset(buf, 0, sizeof(buf));
+	if (NULL != fgets(buf, (int) sizeof(buf), fptr)) {
+		long value = strtol(buf, NULL, 10);
+		if (value > 0)
+			max_size = value;
+	}
+	(void) fclose(fptr);
+
+	debug("%s: %ld", "pipe-max-size", max_size);
+
+	return max_size;
+}
+
+
+/*
+ * Return true if "fd" is a pipe.
+ */
+static bool pv__pipesize_is_pipe(int fd)
+{
+	struct stat sb;
+
+	if (fd < 0)
+		return false;
+	memset(&sb, 0, sizeof(sb));
+	if (0 != fstat(fd, &sb))
+		return false;
+	return S_ISFIFO(sb.st_mode) ? true : false;
+}
+
+
+/*
+ * Try to give pipe "fd" a capacity of "size", up to the limit, and return
+ * its capacity afterwards, or 0 if it isn't known.  Pipes are never made
+ * smaller than they already are.
+ */
+static long pv__pipesize_set(struct pvpipesize_s *pipesize, int fd, long size)
+{
+#if defined(F_SETPIPE_SZ) && defined(F_GETPIPE_SZ)
+	long current, result;
+
+	current = (long) fcntl(fd, F_GETPIPE_SZ);
+	if (current < 0)
+		return 0;
+
+	if (size > pipesize->max_size)
+		size = pipesize->max_size;
+	if (size <= current)
+		return current;
+
+	result = (long) fcntl(fd, F_SETPIPE_SZ, (int) size);
+	if (result < 0) {
+		debug("%s(%d, %ld): %s", "F_SETPIPE_SZ", fd, size, strerror(errno));
+		return current;
+	}
+
+	debug("%s: %d: %ld -> %ld", "pipe capacity", fd, current, result);
+
+	return result;
+#else				/* !F_SETPIPE_SZ */
+	(void) pipesize;
+	(void) fd;
+	(void) size;
+	return 0;
+#endif				/* F_SETPIPE_SZ */
+}
+
+
+/*
+ * Return the size a pipe should start out at.
+ */
+static long pv__pipesize_initial(pvstate_t state)
+{
+	size_t size;
+
+	size = state->control.pipe_size;
+	if (state->control.pipe_size_auto) {
+		size = state->transfer.buffer_size;
+		if (0 == size)
+			size = state->control.target_buffer_size;
+		if (0 == size)
+			size = BUFFER_SIZE;
+	}
+
+	return size > (size_t) LONG_MAX ? LONG_MAX : (long) size;
+}
+
+
+/*
+ * Return true if pipe "fd", whose capacity is "size", is full.
+ */
+static bool pv__pipesize_full(int fd, long size)
+{
+#ifdef FIONREAD
+	int nbytes = 0;
+
+	if (size <= 0)
+		return false;
+	if (0 != ioctl(fd, FIONREAD, &nbytes))
+		return false;
+	return ((long) nbytes + PV_PIPESIZE_SLACK >= size) ? true : false;
+#else
+	(void) fd;
+	(void) size;
+	return false;
+#endif
+}
+
+
+/*
+ * Size the input and output pipes for "--pipe-size", and with "auto",
+ * grow any that keep filling up.  Called from the main loop after each
+ * transfer, with the current input file descriptor and the time.
+ */
+void pv_pipesize_update(pvstate_t state, int input_fd, const struct timespec *now)
+{
+	struct pvpipesize_s *pipesize;
+
+	pipesize = state->transfer.pipesize;
+	if (NULL == pipesize) {
+		pipesize = calloc(1, sizeof(*pipesize));
+		if (NULL == pipesize)
+			return;
+		pipesize->input_fd = -1;
+		pipesize->max_size = pv__pipesize_max();
+		state->transfer.pipesize = pipesize;
+	}
+
+	if (!pipesize->output_checked) {
+		pipesize->output_checked = true;
+		if (pv__pipesize_is_pipe(state->control.output_fd))
+			pipesize->output_size = pv__pipesize_set(pipesize, state->control.output_fd,
+								 pv__pipesize_initial(state));
+	}
+
+	if (input_fd != pipesize->input_fd) {
+		pipesize->input_fd = input_fd;
+		pipesize->input_size = 0;
+		if (pv__pipesize_is_pipe(input_fd))
+			pipesize->input_size = pv__pipesize_set(pipesize, input_fd, pv__pipesize_initial(state));
+		if (pipesize->input_size > pipesize->input_largest)
+			pipesize->input_largest = pipesize->input_size;
+	}
+
+	if (!state->control.pipe_size_auto)
+		return;
+
+	if (pv_elapsedtime_compare(now, &(pipesize->next_check)) < 0)
+		return;
+	pv_elapsedtime_copy(&(pipesize->next_check), now);
+	pv_elapsedtime_add_nsec(&(pipesize->next_check), PV_PIPESIZE_CHECK_NSEC);
+
+	if ((pipesize->input_size > 0) && (pipesize->input_size < pipesize->max_size)
+	    && pv__pipesize_full(input_fd, pipesize->input_size)) {
+		pipesize->input_size = pv__pipesize_set(pipesize, input_fd, 2 * pipesize->input_size);
+		if (pipesize->input_size > pipesize->input_largest)
+			pipesize->input_largest = pipesize->input_size;
+	}
+
+	if ((pipesize->output_size > 0) && (pipesize->output_size < pipesize->max_size)
+	    && (0 == state->flags.pipe_closed)
+	    && ((long) (state->transfer.written_but_not_consumed) + PV_PIPESIZE_SLACK >= pipesize->output_size)) {
+		pipesize->output_size = pv__pipesize_set(pipesize, state->control.output_fd, 2 * pipesize->output_size);
+	}
+}
+
+
+/*
+ * Write the pipe capacities that were used to the terminal, for "--stats".
+ */
+void pv_pipesize_show(pvstate_t state)
+{
+	char stats_buf[128];		 /* flawfinder: ignore */
+	struct pvpipesize_s *pipesize;
+	char input_size[32];		 /* flawfinder: ignore */
+	char output_size[32];		 /* flawfinder: ignore */
+	int stats_size;
+
+	/* flawfinder: made safe by use of pv_snprintf() */
+
+	pipesize = state->transfer.pipesize;
+	if ((NULL == pipesize) || ((pipesize->input_largest <= 0) && (pipesize->output_size <= 0)))
+		return;
+
+	/*@-mustfreefresh@ */
+	if (pipesize->input_largest > 0) {
+		(void) pv_snprintf(input_size, sizeof(input_size), "%ld", pipesize->input_largest);
+	} else {
+		(void) pv_snprintf(input_size, sizeof(input_size), "%s", "-");
+	}
+	if (pipesize->output_size > 0) {
+		(void) pv_snprintf(output_size, sizeof(output_size), "%ld", pipesize->output_size);
+	} else {
+		(void) pv_snprintf(output_size, sizeof(output_size), "%s", "-");
+	}
+
+	memset(stats_buf, 0, sizeof(stats_buf));
+	stats_size =
+	    pv_snprintf(stats_buf, sizeof(stats_buf), "%s = %s/%s %s\n", _("pipe size in/out"), input_size,
+			output_size, _("B"));
+	/*@+mustfreefresh@ *//* splint: see above about gettext(). */
+
+	if (stats_size > 0 && stats_size < (int) (sizeof(stats_buf)))
+		pv_tty_write(&(state->flags), stats_buf, (size_t) stats_size);
+}
+
+
+/*
+ * Free the pipe size state, if there is any.
+ */
+void pv_pipesize_free(pvtransferstate_t transfer)
+{
+	if ((NULL == transfer) || (NULL == transfer->pipesize))
+		return;
+	free(transfer->pipesize);
+	transfer->pipesize = NULL;
+}
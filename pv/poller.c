@@ -0,0 +1,529 @@
+/*
+ * Functions for waiting for the input or output to become ready, using a
+ * persistent epoll (Linux) or kqueue (BSD, macOS) descriptor where one is
+ * available, and poll() otherwise.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#if defined(HAVE_SYS_EPOLL_H)
+#include <sys/epoll.h>
+#define PV_POLLER_EPOLL 1
+#elif defined(HAVE_SYS_EVENT_H)
+#include <sys/event.h>
+#define PV_POLLER_KQUEUE 1
+#endif
+
+#define PV_POLLER_INPUT 0
+#define PV_POLLER_OUTPUT 1
+#define PV_POLLER_CONTROL 2
+
+/*
+ * Unlike select(), the kernel keeps the set of descriptors being watched
+ * between calls, so the input and output are only registered once, and
+ * are only touched again when whether each side is waited for changes -
+ * kqueue enables or disables the filter, and epoll adds or removes the
+ * descriptor, since it reports hangups even with an empty event mask.
+ *
+ * Regular files and block devices are always ready, and epoll refuses
+ * them, so they are never registered; waiting on them returns at once.
+ *
+ * The control socket, if there is one, stays registered for reading the
+ * whole time, and is waited on alongside the input and output whenever
+ * there would be a wait anyway, so that a request wakes the main loop;
+ * transfer->control_pending is set when it is ready.
+ */
+struct pvpoller_s {
+	int queue_fd;			 /* epoll or kqueue descriptor, or -1 */
+	struct {
+		int fd;			 /* descriptor in this slot, or -1 */
+		bool registered;	 /* true if known to queue_fd */
+		bool always_ready;	 /* true if a file or block device */
+		bool wanted;		 /* true if enabled in queue_fd */
+	} slot[2];			 /* input, then output */
+	int control_fd;			 /* control socket, or -1 */
+	bool control_registered;	 /* true if control_fd is in queue_fd */
+};
+
+
+/*
+ * Return the poller, creating it if necessary, or NULL if it could not be
+ * allocated.
+ */
+/*@null@ */ /*@dependent@ */ static struct pvpoller_s *pv__poller(pvtransferstate_t transfer)
+{
+	struct pvpoller_s *poller;
+
+	if (NULL != transfer->poller)
+		return transfer->poller;
+
+	poller = calloc(1, sizeof(*poller));
+	if (NULL == poller)
+		return NULL;
+
+	poller->slot[PV_POLLER_INPUT].fd = -1;
+	poller->slot[PV_POLLER_OUTPUT].fd = -1;
+	poller->control_fd = -1;
+
+#if defined(PV_POLLER_EPOLL)
+	poller->queue_fd = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(PV_POLLER_KQUEUE)
+	poller->queue_fd = kqueue();
+#else
+	poller->queue_fd = -1;
+#endif
+
+	if (poller->queue_fd < 0) {
+#if defined(PV_POLLER_EPOLL) || defined(PV_POLLER_KQUEUE)
+		debug("%s: %s", "failed to create event queue - using poll()", strerror(errno));
+#endif
+		poller->queue_fd = -1;
+	}
+
+	transfer->poller = poller;
+	return poller;
+}
+
+
+/*
+ * Remove the descriptor in slot "idx" from the event queue, and empty the
+ * slot.
+ */
+static void pv__poller_drop(struct pvpoller_s *poller, int idx)
+{
+	if (poller->slot[idx].registered && (poller->queue_fd >= 0)) {
+#if defined(PV_POLLER_EPOLL)
+		/* Only sides being waited for are in the epoll set. */
+		if (poller->slot[idx].wanted) {
+			struct epoll_event event;
+			memset(&event, 0, sizeof(event));
+			(void) epoll_ctl(poller->queue_fd, EPOLL_CTL_DEL, poller->slot[idx].fd, &event);
+		}
+#elif defined(PV_POLLER_KQUEUE)
+		struct kevent change;
+		EV_SET(&change, poller->slot[idx].fd, PV_POLLER_INPUT == idx ? EVFILT_READ : EVFILT_WRITE,
+		       EV_DELETE, 0, 0, NULL);
+		(void) kevent(poller->queue_fd, &change, 1, NULL, 0, NULL);
+#endif
+	}
+
+	poller->slot[idx].fd = -1;
+	poller->slot[idx].registered = false;
+	poller->slot[idx].always_ready = false;
+	poller->slot[idx].wanted = false;
+}
+
+
+/*
+ * Put "fd" into slot "idx", working out whether it is always ready, and
+ * registering it with the event queue if it isn't.  The registration
+ * starts disabled.
+ */
+static void pv__poller_add(struct pvpoller_s *poller, int idx, int fd)
+{
+	struct stat sb;
+
+	poller->slot[idx].fd = fd;
+	poller->slot[idx].registered = false;
+	poller->slot[idx].wanted = false;
+	poller->slot[idx].always_ready = false;
+
+	memset(&sb, 0, sizeof(sb));
+	if ((0 == fstat(fd, &sb)) && (S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode))) {
+		poller->slot[idx].always_ready = true;
+		return;
+	}
+
+	if (poller->queue_fd < 0)
+		return;
+
+#if defined(PV_POLLER_EPOLL)
+	{
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.data.u32 = (uint32_t) idx;
+		/*
+		 * Add and immediately remove it, to find out whether it can
+		 * be used with epoll at all; it is added back whenever this
+		 * side is waited for.
+		 */
+		if (0 == epoll_ctl(poller->queue_fd, EPOLL_CTL_ADD, fd, &event)) {
+			(void) epoll_ctl(poller->queue_fd, EPOLL_CTL_DEL, fd, &event);
+			poller->slot[idx].registered = true;
+		} else if (EPERM == errno) {
+			/* Not pollable, so treat it like a regular file. */
+			poller->slot[idx].always_ready = true;
+		} else {
+			debug("%s %d: %s: %s", "fd", fd, "epoll_ctl failed", strerror(errno));
+		}
+	}
+#elif defined(PV_POLLER_KQUEUE)
+	{
+		struct kevent change;
+		EV_SET(&change, fd, PV_POLLER_INPUT == idx ? EVFILT_READ : EVFILT_WRITE, EV_ADD | EV_DISABLE, 0, 0,
+		       NULL);
+		if (0 == kevent(poller->queue_fd, &change, 1, NULL, 0, NULL)) {
+			poller->slot[idx].registered = true;
+		} else {
+			debug("%s %d: %s: %s", "fd", fd, "kevent failed", strerror(errno));
+		}
+	}
+#endif
+}
+
+
+/*
+ * Forget about "fd", which is about to be closed, so that a new descriptor
+ * which reuses the same number is registered afresh.
+ */
+void pv_poller_forget(pvtransferstate_t transfer, int fd)
+{
+	int idx;
+
+	if ((NULL == transfer->poller) || (fd < 0))
+		return;
+
+	for (idx = PV_POLLER_INPUT; idx <= PV_POLLER_OUTPUT; idx++) {
+		if (fd == transfer->poller->slot[idx].fd)
+			pv__poller_drop(transfer->poller, idx);
+	}
+}
+
+
+/*
+ * Wait for the descriptors "fds" to be ready using poll(), for descriptors
+ * that aren't registered with an event queue.  Entries in "fds" may be
+ * negative, and "ready" is filled in for each one.  If "control_fd" is not
+ * negative, it is waited for too, and *control_ready is set if it becomes
+ * readable.
+ */
+static int pv__poller_wait_poll(const int *fds, bool *ready, int control_fd, bool *control_ready, long usec)
+{
+	struct pollfd pfd[3];
+	nfds_t count;
+	int idx, result;
+
+	count = 0;
+	for (idx = PV_POLLER_INPUT; idx <= PV_POLLER_OUTPUT; idx++) {
+		if (fds[idx] < 0)
+			continue;
+		pfd[count].fd = fds[idx];
+		pfd[count].events = PV_POLLER_INPUT == idx ? POLLIN : POLLOUT;
+		pfd[count].revents = 0;
+		count++;
+	}
+	if (control_fd >= 0) {
+		pfd[count].fd = control_fd;
+		pfd[count].events = POLLIN;
+		pfd[count].revents = 0;
+		count++;
+	}
+
+	result = poll(pfd, count, (int) ((usec + 999) / 1000));
+	if (result <= 0)
+		return result;
+
+	if ((control_fd >= 0) && (0 != pfd[count - 1].revents)) {
+		*control_ready = true;
+		result--;
+	}
+
+	count = 0;
+	for (idx = PV_POLLER_INPUT; idx <= PV_POLLER_OUTPUT; idx++) {
+		if (fds[idx] < 0)
+			continue;
+		if (0 != pfd[count].revents)
+			ready[idx] = true;
+		count++;
+	}
+
+	return result;
+}
+
+
+/*
+ * Return >0 if data is ready to read on fd_in, or write on fd_out, before
+ * "usec" microseconds have elapsed, 0 if not, or negative on error, in the
+ * same way as is_data_ready() in transfer.c, but keeping the descriptors
+ * registered with an event queue between calls.
+ */
+static int pv__poller_wait(pvtransferstate_t transfer, int fd_in, /*@null@ */ bool *fd_in_ready, int fd_out,
+			   /*@null@ */ bool *fd_out_ready, long usec)
+{
+	struct pvpoller_s *poller;
+	int want_fd[2];
+	int poll_fd[2];
+	bool ready[2];
+	bool need_queue;
+	int idx, ready_count, result, control_poll_fd;
+
+	if (NULL != fd_in_ready)
+		*fd_in_ready = false;
+	if (NULL != fd_out_ready)
+		*fd_out_ready = false;
+
+	want_fd[PV_POLLER_INPUT] = fd_in;
+	want_fd[PV_POLLER_OUTPUT] = fd_out;
+	poll_fd[PV_POLLER_INPUT] = -1;
+	poll_fd[PV_POLLER_OUTPUT] = -1;
+	ready[PV_POLLER_INPUT] = false;
+	ready[PV_POLLER_OUTPUT] = false;
+
+	poller = pv__poller(transfer);
+	if ((NULL == poller) || ((fd_in >= 0) && (fd_in == fd_out))) {
+		/* Both sides on one descriptor can't share a registration. */
+		result =
+		    pv__poller_wait_poll(want_fd, ready, NULL == poller ? -1 : poller->control_fd,
+					 &(transfer->control_pending), usec);
+		if (NULL != fd_in_ready)
+			*fd_in_ready = ready[PV_POLLER_INPUT];
+		if (NULL != fd_out_ready)
+			*fd_out_ready = ready[PV_POLLER_OUTPUT];
+		return result;
+	}
+
+	/*
+	 * Bring the registrations up to date, and see which wanted sides
+	 * are always ready or have to be polled the slow way.
+	 */
+	ready_count = 0;
+	need_queue = false;
+	for (idx = PV_POLLER_INPUT; idx <= PV_POLLER_OUTPUT; idx++) {
+		int fd = want_fd[idx];
+
+		if ((fd >= 0) && (fd != poller->slot[idx].fd)) {
+			pv__poller_drop(poller, idx);
+			pv__poller_add(poller, idx, fd);
+		}
+
+		if (poller->slot[idx].registered && (poller->slot[idx].wanted != (fd >= 0))) {
+#if defined(PV_POLLER_EPOLL)
+			/*
+			 * Hangups and errors are reported even with no
+			 * events requested, so a side that isn't wanted is
+			 * taken out of the set, rather than left in it with
+			 * an empty event mask.
+			 */
+			struct epoll_event event;
+			memset(&event, 0, sizeof(event));
+			event.data.u32 = (uint32_t) idx;
+			event.events = PV_POLLER_INPUT == idx ? EPOLLIN : EPOLLOUT;
+			(void) epoll_ctl(poller->queue_fd, fd >= 0 ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+					 poller->slot[idx].fd, &event);
+#elif defined(PV_POLLER_KQUEUE)
+			struct kevent change;
+			EV_SET(&change, poller->slot[idx].fd, PV_POLLER_INPUT == idx ? EVFILT_READ : EVFILT_WRITE,
+			       fd >= 0 ? EV_ENABLE : EV_DISABLE, 0, 0, NULL);
+			(void) kevent(poller->queue_fd, &change, 1, NULL, 0, NULL);
+#endif
+			poller->slot[idx].wanted = (fd >= 0);
+		}
+
+		if (fd < 0)
+			continue;
+
+		if (poller->slot[idx].always_ready) {
+			ready[idx] = true;
+			ready_count++;
+		} else if (poller->slot[idx].registered) {
+			need_queue = true;
+		} else {
+			poll_fd[idx] = fd;
+		}
+	}
+
+	/* Don't wait at all if one side is already known to be ready. */
+	if (ready_count > 0)
+		usec = 0;
+
+	/*
+	 * If we're going to wait, wait for the control socket too - in the
+	 * event queue if that's being used anyway, or if nothing needs
+	 * poll(), otherwise alongside the others in poll().
+	 */
+	control_poll_fd = -1;
+	if ((poller->control_fd >= 0) && (usec > 0)) {
+		if (poller->control_registered
+		    && (need_queue || ((poll_fd[PV_POLLER_INPUT] < 0) && (poll_fd[PV_POLLER_OUTPUT] < 0)))) {
+			need_queue = true;
+		} else {
+			control_poll_fd = poller->control_fd;
+		}
+	}
+
+	result = 0;
+
+	if (need_queue) {
+#if defined(PV_POLLER_EPOLL)
+		struct epoll_event events[3];
+		int event_idx;
+
+		memset(events, 0, sizeof(events));
+		result = epoll_wait(poller->queue_fd, events, 3, (int) ((usec + 999) / 1000));
+		for (event_idx = 0; event_idx < result; event_idx++) {
+			if (PV_POLLER_CONTROL == events[event_idx].data.u32)
+				transfer->control_pending = true;
+			else if ((events[event_idx].data.u32 <= PV_POLLER_OUTPUT)
+			    && (want_fd[events[event_idx].data.u32] >= 0))
+				ready[events[event_idx].data.u32] = true;
+		}
+#elif defined(PV_POLLER_KQUEUE)
+		struct kevent events[3];
+		struct timespec timeout;
+		int event_idx;
+
+		timeout.tv_sec = (time_t) (usec / 1000000);
+		timeout.tv_nsec = (long) ((usec % 1000000) * 1000);
+		memset(events, 0, sizeof(events));
+		result = kevent(poller->queue_fd, NULL, 0, events, 3, &timeout);
+		for (event_idx = 0; event_idx < result; event_idx++) {
+			if ((EVFILT_READ == events[event_idx].filter)
+			    && ((int) (events[event_idx].ident) == poller->control_fd)) {
+				transfer->control_pending = true;
+				continue;
+			}
+			idx = EVFILT_READ == events[event_idx].filter ? PV_POLLER_INPUT : PV_POLLER_OUTPUT;
+			if ((int) (events[event_idx].ident) == poller->slot[idx].fd)
+				ready[idx] = true;
+		}
+#endif
+		/* Anything left for poll() has to be checked without waiting. */
+		if (result > 0)
+			usec = 0;
+	}
+
+	if ((result >= 0)
+	    && ((poll_fd[PV_POLLER_INPUT] >= 0) || (poll_fd[PV_POLLER_OUTPUT] >= 0) || (control_poll_fd >= 0))) {
+		result =
+		    pv__poller_wait_poll(poll_fd, ready, control_poll_fd, &(transfer->control_pending),
+					 need_queue ? 0 : usec);
+	} else if ((result >= 0) && (!need_queue) && (0 == ready_count) && (usec > 0)) {
+		/* Nothing to wait for, so just sleep, as select() would. */
+		result = poll(NULL, 0, (int) ((usec + 999) / 1000));
+	}
+
+	if (result < 0)
+		return result;
+
+	if (NULL != fd_in_ready)
+		*fd_in_ready = ready[PV_POLLER_INPUT];
+	if (NULL != fd_out_ready)
+		*fd_out_ready = ready[PV_POLLER_OUTPUT];
+
+	return (ready[PV_POLLER_INPUT] ? 1 : 0) + (ready[PV_POLLER_OUTPUT] ? 1 : 0);
+}
+
+
+/*
+ * Wait as in pv__poller_wait(), timing the wait for "--self-profile" and
+ * recording it for "--trace".
+ */
+int pv_poller_wait(pvtransferstate_t transfer, int fd_in, /*@null@ */ bool *fd_in_ready, int fd_out,
+		   /*@null@ */ bool *fd_out_ready, long usec)
+{
+	struct timespec wait_start;
+	uint64_t profile_start;
+	int result;
+
+	if (NULL != transfer->trace)
+		pv_elapsedtime_read(&wait_start);
+
+	profile_start = pv_profile_begin();
+	result = pv__poller_wait(transfer, fd_in, fd_in_ready, fd_out, fd_out_ready, usec);
+	pv_profile_end(PV_PROFILE_SELECT, profile_start);
+
+	if (NULL != transfer->trace) {
+		long long ready = result;
+		if (result >= 0) {
+			ready = 0;
+			if ((NULL != fd_in_ready) && (*fd_in_ready))
+				ready |= PV_TRACE_WAIT_INPUT;
+			if ((NULL != fd_out_ready) && (*fd_out_ready))
+				ready |= PV_TRACE_WAIT_OUTPUT;
+		}
+		pv_trace_record(transfer, PV_TRACE_WAIT, -1, ready, &wait_start);
+	}
+
+	return result;
+}
+
+
+/*
+ * Start watching "fd" as the control socket, replacing any previous one;
+ * if "fd" is negative, stop watching the control socket.
+ */
+void pv_poller_control_set(pvtransferstate_t transfer, int fd)
+{
+	struct pvpoller_s *poller;
+
+	poller = pv__poller(transfer);
+	if (NULL == poller)
+		return;
+
+	if (poller->control_registered) {
+#if defined(PV_POLLER_EPOLL)
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		(void) epoll_ctl(poller->queue_fd, EPOLL_CTL_DEL, poller->control_fd, &event);
+#elif defined(PV_POLLER_KQUEUE)
+		struct kevent change;
+		EV_SET(&change, poller->control_fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+		(void) kevent(poller->queue_fd, &change, 1, NULL, 0, NULL);
+#endif
+	}
+
+	poller->control_fd = fd;
+	poller->control_registered = false;
+
+	if ((fd < 0) || (poller->queue_fd < 0))
+		return;
+
+#if defined(PV_POLLER_EPOLL)
+	{
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.data.u32 = PV_POLLER_CONTROL;
+		event.events = EPOLLIN;
+		if (0 == epoll_ctl(poller->queue_fd, EPOLL_CTL_ADD, fd, &event))
+			poller->control_registered = true;
+	}
+#elif defined(PV_POLLER_KQUEUE)
+	{
+		struct kevent change;
+		EV_SET(&change, fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+		if (0 == kevent(poller->queue_fd, &change, 1, NULL, 0, NULL))
+			poller->control_registered = true;
+	}
+#endif
+}
+
+
+/*
+ * Free the poller and close its event queue.
+ */
+void pv_poller_free(pvtransferstate_t transfer)
+{
+	if ((NULL == transfer) || (NULL == transfer->poller))
+		return;
+
+	if (transfer->poller->queue_fd >= 0)
+		(void) close(transfer->poller->queue_fd);
+
+	free(transfer->poller);
+	transfer->poller = NULL;
+}
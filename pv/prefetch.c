@@ -0,0 +1,324 @@
+/*
+ * Functions for opening the next few input files in the background, so
+ * that moving from one input file to the next doesn't wait on the disk.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#ifdef HAVE_PTHREAD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+/*
+ * With many small input files, the time goes on opening each one and on
+ * waiting for its first block, rather than on the transfer itself.  While
+ * one file is being transferred, a thread opens the next few, and asks
+ * the kernel to start reading their first blocks, so that pv_next_file()
+ * can usually just pick up a descriptor which is already open and whose
+ * data is already on its way into the page cache.
+ *
+ * Files are only ever opened in order, and no more than PV_PREFETCH_FILES
+ * ahead of the one being transferred, so the number of extra descriptors
+ * held open stays small.  Standard input ("-") is never opened here.
+ */
+#define PV_PREFETCH_FILES	8
+#define PV_PREFETCH_READAHEAD	262144	/* bytes at the start of each file */
+
+typedef enum {
+	PV_PREFETCH_PENDING = 0,	 /* not looked at yet */
+	PV_PREFETCH_OPENED,		 /* open, descriptor not yet taken */
+	PV_PREFETCH_FAILED,		 /* open failed, errno recorded */
+	PV_PREFETCH_SKIPPED,		 /* left for pv_next_file() to open */
+	PV_PREFETCH_DONE		 /* descriptor or error handed over */
+} pvprefetch_status_t;
+
+struct pvprefetch_s {
+	pthread_t thread;		 /* the opening thread */
+	pthread_mutex_t mutex;		 /* protects everything below */
+	pthread_cond_t changed;		 /* signalled when anything below changes */
+	/*@dependent@ */ nullable_string_t *filename;	/* the input file list */
+	/*@only@ */ int *fds;		 /* descriptor for each opened file */
+	/*@only@ */ int *errors;	 /* errno for each failed file */
+	/*@only@ */ unsigned char *status;	/* pvprefetch_status_t for each file */
+	unsigned int file_count;	 /* number of input files */
+	unsigned int next_open;		 /* next file for the thread to open */
+	unsigned int open_limit;	 /* open files up to, but not including, this */
+	unsigned int consumed;		 /* files before this have been handed over */
+	bool thread_started;		 /* set once pthread_create() succeeded */
+	bool stop_requested;		 /* set to end the thread */
+};
+
+
+/*
+ * Open one input file for the background thread, and ask for the start
+ * of it to be read ahead.  Returns the descriptor, or -1 with errno set.
+ */
+static int pv__prefetch_open(const char *filename)
+{
+	int fd;
+
+	fd = open(filename, O_RDONLY);	    /* flawfinder: ignore */
+	/* flawfinder - as with pv_next_file(). */
+	if (fd < 0)
+		return -1;
+
+#if HAVE_POSIX_FADVISE
+	(void) posix_fadvise(fd, 0, PV_PREFETCH_READAHEAD, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+	{
+		struct radvisory advice;
+		memset(&advice, 0, sizeof(advice));
+		advice.ra_offset = 0;
+		advice.ra_count = PV_PREFETCH_READAHEAD;
+		(void) fcntl(fd, F_RDADVISE, &advice);
+	}
+#endif
+
+	return fd;
+}
+
+
+/*
+ * Background thread which opens files as they come within the window.
+ */
+/*@null@ */ static void *pv__prefetch_thread(void *arg)
+{
+	struct pvprefetch_s *prefetch = (struct pvprefetch_s *) arg;
+
+	(void) pthread_mutex_lock(&(prefetch->mutex));
+
+	while (!prefetch->stop_requested) {
+		unsigned int file_idx;
+		const char *filename;
+		int fd, open_errno;
+
+		if ((prefetch->next_open >= prefetch->file_count) || (prefetch->next_open >= prefetch->open_limit)) {
+			if (prefetch->next_open >= prefetch->file_count)
+				break;
+			(void) pthread_cond_wait(&(prefetch->changed), &(prefetch->mutex));
+			continue;
+		}
+
+		file_idx = prefetch->next_open++;
+		filename = prefetch->filename[file_idx];
+
+		/* Network connections are only made when they're reached. */
+		if ((NULL == filename) || (0 == strcmp(filename, "-")) || pv_net_is_address(filename)) {
+			prefetch->status[file_idx] = (unsigned char) PV_PREFETCH_SKIPPED;
+			continue;
+		}
+
+		/* Opening may block, so it is done without the lock held. */
+		(void) pthread_mutex_unlock(&(prefetch->mutex));
+		fd = pv__prefetch_open(filename);
+		open_errno = errno;
+		(void) pthread_mutex_lock(&(prefetch->mutex));
+
+		if (fd >= 0) {
+			prefetch->fds[file_idx] = fd;
+			prefetch->status[file_idx] = (unsigned char) PV_PREFETCH_OPENED;
+		} else {
+			prefetch->errors[file_idx] = open_errno;
+			prefetch->status[file_idx] = (unsigned char) PV_PREFETCH_FAILED;
+		}
+		(void) pthread_cond_broadcast(&(prefetch->changed));
+	}
+
+	(void) pthread_mutex_unlock(&(prefetch->mutex));
+
+	return NULL;
+}
+
+
+/*
+ * Free a prefetch structure, closing any descriptors which were opened but
+ * never handed over.  The thread must already have finished.
+ */
+static void pv__prefetch_free( /*@only@ */ struct pvprefetch_s *prefetch)
+{
+	unsigned int file_idx;
+
+	if (NULL != prefetch->fds && NULL != prefetch->status) {
+		for (file_idx = 0; file_idx < prefetch->file_count; file_idx++) {
+			if ((unsigned char) PV_PREFETCH_OPENED == prefetch->status[file_idx])
+				(void) close(prefetch->fds[file_idx]);
+		}
+	}
+
+	(void) pthread_cond_destroy(&(prefetch->changed));
+	(void) pthread_mutex_destroy(&(prefetch->mutex));
+
+	if (NULL != prefetch->fds)
+		free(prefetch->fds);
+	if (NULL != prefetch->errors)
+		free(prefetch->errors);
+	if (NULL != prefetch->status)
+		free(prefetch->status);
+	free(prefetch);
+}
+
+
+/*
+ * Start opening the files after "filenum" in the background.  Returns
+ * false if this isn't worth doing, or couldn't be done.
+ */
+static bool pv__prefetch_start(pvstate_t state, unsigned int filenum)
+{
+	struct pvprefetch_s *prefetch;
+	sigset_t all_signals, old_signals;
+	int rc;
+
+	if ((NULL == state->files.filename) || (filenum + 1 >= state->files.file_count))
+		return false;
+
+	prefetch = calloc(1, sizeof(*prefetch));
+	if (NULL == prefetch)
+		return false;
+
+	prefetch->filename = state->files.filename;
+	prefetch->file_count = state->files.file_count;
+	prefetch->fds = calloc((size_t) (prefetch->file_count), sizeof(int));
+	prefetch->errors = calloc((size_t) (prefetch->file_count), sizeof(int));
+	prefetch->status = calloc((size_t) (prefetch->file_count), sizeof(unsigned char));
+	prefetch->next_open = filenum + 1;
+	prefetch->open_limit = filenum + 1 + PV_PREFETCH_FILES;
+	prefetch->consumed = filenum + 1;
+
+	(void) pthread_mutex_init(&(prefetch->mutex), NULL);
+	(void) pthread_cond_init(&(prefetch->changed), NULL);
+
+	if ((NULL == prefetch->fds) || (NULL == prefetch->errors) || (NULL == prefetch->status)) {
+		pv__prefetch_free(prefetch);
+		return false;
+	}
+
+	/* As with the pipeline, leave all signals to the main thread. */
+	(void) sigfillset(&all_signals);
+	(void) sigemptyset(&old_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&(prefetch->thread), NULL, pv__prefetch_thread, prefetch);
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 != rc) {
+		debug("%s: %s", "pthread_create", strerror(rc));
+		pv__prefetch_free(prefetch);
+		return false;
+	}
+
+	prefetch->thread_started = true;
+	state->files.prefetch = prefetch;
+
+	debug("%s: %u", "input file prefetch started", filenum + 1);
+
+	return true;
+}
+
+
+/*
+ * Take input file "filenum" from the background prefetch, and move the
+ * window along so that the files after it are opened next.  The prefetch
+ * is started the first time this is called with more files to come.
+ *
+ * Returns true if the prefetch dealt with the file, in which case either
+ * *fd_ptr is its open descriptor, or it is -1 and *errno_ptr holds the
+ * error from opening it.  Returns false if the caller should open the file
+ * itself.
+ */
+bool pv_prefetch_take(pvstate_t state, unsigned int filenum, int *fd_ptr, int *errno_ptr)
+{
+	struct pvprefetch_s *prefetch;
+	unsigned int file_idx;
+	bool taken;
+
+	*fd_ptr = -1;
+	*errno_ptr = 0;
+
+	prefetch = state->files.prefetch;
+	if (NULL == prefetch) {
+		(void) pv__prefetch_start(state, filenum);
+		return false;
+	}
+
+	if ((filenum >= prefetch->file_count) || (prefetch->filename != state->files.filename))
+		return false;
+
+	(void) pthread_mutex_lock(&(prefetch->mutex));
+
+	/* Close anything that was skipped over, such as after an error. */
+	for (file_idx = prefetch->consumed; file_idx < filenum && file_idx < prefetch->next_open; file_idx++) {
+		if ((unsigned char) PV_PREFETCH_OPENED == prefetch->status[file_idx])
+			(void) close(prefetch->fds[file_idx]);
+		prefetch->status[file_idx] = (unsigned char) PV_PREFETCH_DONE;
+	}
+
+	if (filenum >= prefetch->next_open) {
+		/* The thread hasn't got this far - make it start after this one. */
+		prefetch->next_open = filenum + 1;
+	} else {
+		while ((unsigned char) PV_PREFETCH_PENDING == prefetch->status[filenum] && prefetch->thread_started) {
+			(void) pthread_cond_wait(&(prefetch->changed), &(prefetch->mutex));
+		}
+	}
+
+	taken = false;
+	if ((unsigned char) PV_PREFETCH_OPENED == prefetch->status[filenum]) {
+		*fd_ptr = prefetch->fds[filenum];
+		taken = true;
+	} else if ((unsigned char) PV_PREFETCH_FAILED == prefetch->status[filenum]) {
+		*errno_ptr = prefetch->errors[filenum];
+		taken = true;
+	}
+	if (filenum < prefetch->next_open)
+		prefetch->status[filenum] = (unsigned char) PV_PREFETCH_DONE;
+
+	if (filenum + 1 > prefetch->consumed)
+		prefetch->consumed = filenum + 1;
+	prefetch->open_limit = filenum + 1 + PV_PREFETCH_FILES;
+
+	(void) pthread_cond_broadcast(&(prefetch->changed));
+	(void) pthread_mutex_unlock(&(prefetch->mutex));
+
+	return taken;
+}
+
+
+/*
+ * Stop the background prefetch, if there is one, closing any files it
+ * opened which were never used, and free it.
+ */
+void pv_prefetch_stop(pvstate_t state)
+{
+	struct pvprefetch_s *prefetch;
+
+	if (NULL == state || NULL == state->files.prefetch)
+		return;
+
+	prefetch = state->files.prefetch;
+	state->files.prefetch = NULL;
+
+	if (prefetch->thread_started) {
+		(void) pthread_mutex_lock(&(prefetch->mutex));
+		prefetch->stop_requested = true;
+		(void) pthread_cond_broadcast(&(prefetch->changed));
+		(void) pthread_mutex_unlock(&(prefetch->mutex));
+		(void) pthread_join(prefetch->thread, NULL);
+		debug("%s", "input file prefetch stopped");
+	}
+
+	pv__prefetch_free(prefetch);
+}
+
+#endif				/* HAVE_PTHREAD */
@@ -0,0 +1,608 @@
+/*
+ * Functions for counting the lines in the input files before, or while,
+ * transferring them.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+
+/*
+ * A line counting job covering all of the input files.  The files are
+ * opened up front, by pv__prescan_new(), so that the counting itself never
+ * needs the filenames and can run in its own thread while the transfer is
+ * changing the input file list.
+ *
+ * The counters are updated after every chunk, so that a partial count can
+ * be used to estimate the total before the scan has finished.
+ */
+struct pvprescan_s {
+#ifdef HAVE_PTHREAD
+	pthread_t thread;		 /* the coordinating thread, if in the background */
+	pthread_mutex_t mutex;		 /* protects the counters and flags below */
+#endif
+	/*@only@ */ int *fds;		 /* open descriptor for each input file */
+	/*@only@ */ off_t *sizes;	 /* size of each input file */
+	unsigned int file_count;	 /* number of input files */
+	unsigned int thread_count;	 /* threads to count each file with */
+	char separator;			 /* line separator being counted */
+	off_t total_bytes;		 /* total size of all input files */
+	/* Everything below is protected by the mutex. */
+	off_t bytes_scanned;		 /* bytes looked at so far */
+	off_t lines_counted;		 /* separators found so far */
+	int read_errno;			 /* errno of the first read error, if any */
+	unsigned int error_file;	 /* index of the file with that error */
+	bool thread_started;		 /* set once pthread_create() succeeded */
+	bool stop_requested;		 /* set to end the scan early */
+	bool finished;			 /* set when the scan is complete */
+	bool reported;			 /* set once the result has been used */
+};
+
+/*
+ * One thread's share of a file - "length" bytes at "base" in a mapping.
+ */
+struct pvprescan_range_s {
+	/*@dependent@ */ struct pvprescan_s *prescan;
+	/*@dependent@ */ const char *base;
+	size_t length;
+#ifdef HAVE_PTHREAD
+	pthread_t thread;
+#endif
+	bool thread_started;
+};
+
+
+static void pv__prescan_lock(struct pvprescan_s *prescan)
+{
+#ifdef HAVE_PTHREAD
+	(void) pthread_mutex_lock(&(prescan->mutex));
+#else
+	(void) prescan;
+#endif
+}
+
+static void pv__prescan_unlock(struct pvprescan_s *prescan)
+{
+#ifdef HAVE_PTHREAD
+	(void) pthread_mutex_unlock(&(prescan->mutex));
+#else
+	(void) prescan;
+#endif
+}
+
+
+/*
+ * Add a chunk's results to the running totals, returning false if the scan
+ * should stop.
+ */
+static bool pv__prescan_publish(struct pvprescan_s *prescan, size_t bytes, size_t lines)
+{
+	bool keep_going;
+
+	pv__prescan_lock(prescan);
+	prescan->bytes_scanned += (off_t) bytes;
+	prescan->lines_counted += (off_t) lines;
+	keep_going = !prescan->stop_requested;
+	pv__prescan_unlock(prescan);
+
+	return keep_going;
+}
+
+
+#ifdef HAVE_MMAP
+/*
+ * Count the separators in a range of a mapped file, a chunk at a time.
+ * Returns false if the scan was stopped part way.
+ */
+static bool pv__prescan_count_range(struct pvprescan_range_s *range)
+{
+	size_t offset;
+
+	for (offset = 0; offset < range->length; offset += PV_PRESCAN_CHUNK) {
+		size_t chunk = range->length - offset;
+		if (chunk > PV_PRESCAN_CHUNK)
+			chunk = PV_PRESCAN_CHUNK;
+		if (!pv__prescan_publish
+		    (range->prescan, chunk, pv_linescan_count(range->base + offset, chunk, range->prescan->separator)))
+			return false;
+	}
+
+	return true;
+}
+
+
+#ifdef HAVE_PTHREAD
+/*
+ * Thread wrapper for pv__prescan_count_range().
+ */
+/*@null@ */ static void *pv__prescan_range_thread(void *arg)
+{
+	(void) pv__prescan_count_range((struct pvprescan_range_s *) arg);
+	return NULL;
+}
+#endif				/* HAVE_PTHREAD */
+
+
+/*
+ * Count the separators in the "size" bytes of "fd" by mapping it into
+ * memory and splitting it into ranges, each counted by its own thread,
+ * with the last range counted by the calling thread.
+ *
+ * Returns false, without counting anything, if the file could not be
+ * mapped, so that the caller can read it instead.
+ *
+ * Note that if the file is truncated while it is being counted, accessing
+ * the missing pages will raise SIGBUS.
+ */
+static bool pv__prescan_count_mapped(struct pvprescan_s *prescan, int fd, off_t size)
+{
+	struct pvprescan_range_s ranges[PV_PRESCAN_MAX_THREADS];
+	unsigned int range_count, range_idx;
+	size_t length, range_length;
+	void *mapping;
+
+	if ((uintmax_t) size > (uintmax_t) SIZE_MAX)
+		return false;
+	length = (size_t) size;
+
+	mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == mapping) {
+		debug("%s: %s", "mmap", strerror(errno));
+		return false;
+	}
+#ifdef MADV_SEQUENTIAL
+	(void) madvise(mapping, length, MADV_SEQUENTIAL);
+#endif
+
+	range_count = prescan->thread_count;
+	if ((size_t) range_count > length / PV_PRESCAN_MIN_RANGE)
+		range_count = (unsigned int) (length / PV_PRESCAN_MIN_RANGE);
+	if (range_count < 1)
+		range_count = 1;
+	range_length = length / range_count;
+
+	memset(ranges, 0, sizeof(ranges));
+	for (range_idx = 0; range_idx < range_count; range_idx++) {
+		ranges[range_idx].prescan = prescan;
+		ranges[range_idx].base = (const char *) mapping + range_idx * range_length;
+		ranges[range_idx].length = range_length;
+	}
+	/* The last range also takes the remainder. */
+	ranges[range_count - 1].length = length - (range_count - 1) * range_length;
+
+#ifdef HAVE_PTHREAD
+	for (range_idx = 0; range_idx + 1 < range_count; range_idx++) {
+		int rc = pthread_create(&(ranges[range_idx].thread), NULL, pv__prescan_range_thread,
+					&(ranges[range_idx]));
+		if (0 != rc) {
+			debug("%s: %s", "pthread_create", strerror(rc));
+			continue;
+		}
+		ranges[range_idx].thread_started = true;
+	}
+#endif				/* HAVE_PTHREAD */
+
+	/*
+	 * Count the last range here, along with any that did not get a
+	 * thread of their own.
+	 */
+	for (range_idx = 0; range_idx < range_count; range_idx++) {
+		if ((!ranges[range_idx].thread_started) && (!pv__prescan_count_range(&(ranges[range_idx]))))
+			break;
+	}
+
+#ifdef HAVE_PTHREAD
+	for (range_idx = 0; range_idx < range_count; range_idx++) {
+		if (ranges[range_idx].thread_started)
+			(void) pthread_join(ranges[range_idx].thread, NULL);
+	}
+#endif				/* HAVE_PTHREAD */
+
+	(void) munmap(mapping, length);
+
+	return true;
+}
+#endif				/* HAVE_MMAP */
+
+
+/*
+ * Count the separators in the "size" bytes of "fd" by reading it.  The
+ * file position is not changed, since "fd" may share it with the input
+ * that is being transferred.
+ *
+ * Returns false if the scan was stopped or hit a read error, recording the
+ * error in the prescan structure.
+ */
+static bool pv__prescan_count_read(struct pvprescan_s *prescan, unsigned int file_idx, int fd, off_t size)
+{
+	char *scanbuf;
+	off_t offset;
+	bool keep_going;
+
+	scanbuf = malloc(PV_SIZEOF_LINESCAN_BUFFER);
+	if (NULL == scanbuf) {
+		pv__prescan_lock(prescan);
+		if (0 == prescan->read_errno) {
+			prescan->read_errno = errno;
+			prescan->error_file = file_idx;
+		}
+		pv__prescan_unlock(prescan);
+		return false;
+	}
+
+	keep_going = true;
+	offset = 0;
+
+	while (keep_going && offset < size) {
+		ssize_t numread;
+
+		numread = pread(fd, scanbuf, PV_SIZEOF_LINESCAN_BUFFER, offset);	/* flawfinder: ignore */
+		/*
+		 * flawfinder rationale: each time around the loop we are
+		 * always reading into the start of the buffer, not moving
+		 * along it, so the bounding is OK.
+		 */
+		if (numread < 0 && EINTR == errno)
+			continue;
+		if (numread < 0) {
+			pv__prescan_lock(prescan);
+			if (0 == prescan->read_errno) {
+				prescan->read_errno = errno;
+				prescan->error_file = file_idx;
+			}
+			pv__prescan_unlock(prescan);
+			keep_going = false;
+			break;
+		} else if (0 == numread) {
+			break;
+		}
+
+		offset += (off_t) numread;
+		keep_going =
+		    pv__prescan_publish(prescan, (size_t) numread,
+					pv_linescan_count(scanbuf, (size_t) numread, prescan->separator));
+	}
+
+	free(scanbuf);
+
+	return keep_going;
+}
+
+
+/*
+ * Count the lines in all of the input files, stopping early if asked to.
+ */
+static void pv__prescan_run(struct pvprescan_s *prescan)
+{
+	unsigned int file_idx;
+
+	for (file_idx = 0; file_idx < prescan->file_count; file_idx++) {
+		int fd = prescan->fds[file_idx];
+		off_t size = prescan->sizes[file_idx];
+		bool stopping;
+
+		pv__prescan_lock(prescan);
+		stopping = prescan->stop_requested;
+		pv__prescan_unlock(prescan);
+		if (stopping)
+			break;
+
+		if (size < 1)
+			continue;
+
+#ifdef HAVE_MMAP
+		if (pv__prescan_count_mapped(prescan, fd, size))
+			continue;
+#endif
+
+		/* Carry on with the other files after a read error. */
+		(void) pv__prescan_count_read(prescan, file_idx, fd, size);
+	}
+
+	pv__prescan_lock(prescan);
+	prescan->finished = true;
+	pv__prescan_unlock(prescan);
+}
+
+
+/*
+ * Free a prescan structure, closing its file descriptors.  Any thread it
+ * had must already have been joined.
+ */
+static void pv__prescan_free( /*@only@ */ struct pvprescan_s *prescan)
+{
+	unsigned int file_idx;
+
+	for (file_idx = 0; file_idx < prescan->file_count; file_idx++) {
+		if (prescan->fds[file_idx] >= 0)
+			(void) close(prescan->fds[file_idx]);
+	}
+
+#ifdef HAVE_PTHREAD
+	(void) pthread_mutex_destroy(&(prescan->mutex));
+#endif
+	free(prescan->fds);
+	free(prescan->sizes);
+	free(prescan);
+}
+
+
+/*
+ * Set up a line counting job for all of the input files, opening each one.
+ *
+ * Returns NULL if the total can't be known - if any input is not a regular
+ * file, or can't be opened - or on allocation failure.
+ */
+/*@null@ */ /*@only@ */ static struct pvprescan_s *pv__prescan_new(pvstate_t state)
+{
+	struct pvprescan_s *prescan;
+	unsigned int file_idx;
+	long cpu_count;
+
+	if ((NULL == state->files.filename) || (0 == state->files.file_count))
+		return NULL;
+
+	prescan = calloc(1, sizeof(*prescan));
+	if (NULL == prescan) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		return NULL;
+	}
+	prescan->fds = calloc((size_t) (state->files.file_count), sizeof(int));
+	prescan->sizes = calloc((size_t) (state->files.file_count), sizeof(off_t));
+	if ((NULL == prescan->fds) || (NULL == prescan->sizes)) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		if (NULL != prescan->fds)
+			free(prescan->fds);
+		if (NULL != prescan->sizes)
+			free(prescan->sizes);
+		free(prescan);
+		return NULL;
+	}
+
+#ifdef HAVE_PTHREAD
+	(void) pthread_mutex_init(&(prescan->mutex), NULL);
+#endif
+	prescan->separator = state->control.null_terminated_lines ? '\0' : '\n';
+
+	cpu_count = 1;
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+	cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (cpu_count < 1)
+		cpu_count = 1;
+	if (cpu_count > PV_PRESCAN_MAX_THREADS)
+		cpu_count = PV_PRESCAN_MAX_THREADS;
+	prescan->thread_count = (unsigned int) cpu_count;
+
+	for (file_idx = 0; file_idx < state->files.file_count; file_idx++) {
+		const char *filename = state->files.filename[file_idx];
+		struct stat sb;
+		int fd;
+
+		prescan->fds[file_idx] = -1;
+		prescan->file_count = file_idx + 1;
+
+		/* NULL entries should be impossible, but count them as stdin. */
+		if ((NULL == filename) || (0 == strcmp(filename, "-"))) {
+			fd = dup(STDIN_FILENO);
+		} else if (pv_net_is_address(filename)) {
+			/* Network inputs can't be counted in advance. */
+			debug("%s: %s", filename, "network input - not counting");
+			pv__prescan_free(prescan);
+			return NULL;
+		} else {
+			fd = open(filename, O_RDONLY);	/* flawfinder: ignore */
+			/* flawfinder - as with pv_next_file(). */
+		}
+
+		if (fd < 0) {
+			debug("%s: %s", NULL == filename ? "-" : filename, strerror(errno));
+			pv__prescan_free(prescan);
+			return NULL;
+		}
+		prescan->fds[file_idx] = fd;
+
+		if ((0 != fstat(fd, &sb)) || (!S_ISREG(sb.st_mode))) {
+			pv__prescan_free(prescan);
+			return NULL;
+		}
+
+		prescan->sizes[file_idx] = sb.st_size;
+		prescan->total_bytes += sb.st_size;
+
+#if HAVE_POSIX_FADVISE
+		/* Advise the OS that we will only be reading sequentially. */
+		(void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	}
+
+	return prescan;
+}
+
+
+/*
+ * Report any read error the scan hit, in the main thread.
+ */
+static void pv__prescan_report_error(pvstate_t state, struct pvprescan_s *prescan)
+{
+	const char *filename = NULL;
+
+	if (0 == prescan->read_errno)
+		return;
+
+	if ((NULL != state->files.filename) && (prescan->error_file < state->files.file_count))
+		filename = state->files.filename[prescan->error_file];
+
+	pv_error("%s: %s", NULL == filename ? "-" : filename, strerror(prescan->read_errno));
+	state->status.exit_status |= PV_ERROREXIT_ACCESS;
+}
+
+
+/*
+ * Count the lines in all of the input files, and return the total, or 0 if
+ * it can't be known because an input is not a regular file.
+ *
+ * Large files are mapped into memory and counted by several threads at
+ * once, each taking a separate range of the file.
+ */
+off_t pv_prescan_count(pvstate_t state)
+{
+	struct pvprescan_s *prescan;
+	off_t total;
+
+	prescan = pv__prescan_new(state);
+	if (NULL == prescan)
+		return 0;
+
+	pv__prescan_run(prescan);
+	pv__prescan_report_error(state, prescan);
+	total = prescan->lines_counted;
+	pv__prescan_free(prescan);
+
+	return total;
+}
+
+
+#ifdef HAVE_PTHREAD
+/*
+ * Background thread wrapper for pv__prescan_run().
+ */
+/*@null@ */ static void *pv__prescan_thread(void *arg)
+{
+	pv__prescan_run((struct pvprescan_s *) arg);
+	return NULL;
+}
+
+
+/*
+ * Start counting the lines in the input files in the background, so that
+ * the transfer can start straight away; pv_prescan_update() then keeps
+ * state->control.size up to date as the count progresses.
+ *
+ * Returns false if the count could not be started, in which case the
+ * caller should fall back to pv_calc_total_size().
+ */
+bool pv_prescan_start(pvstate_t state)
+{
+	struct pvprescan_s *prescan;
+	sigset_t all_signals, old_signals;
+	int rc;
+
+	pv_prescan_stop(state);
+
+	prescan = pv__prescan_new(state);
+	if (NULL == prescan)
+		return false;
+
+	/* As with the pipeline, leave all signals to the main thread. */
+	(void) sigfillset(&all_signals);
+	(void) sigemptyset(&old_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&(prescan->thread), NULL, pv__prescan_thread, prescan);
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 != rc) {
+		debug("%s: %s", "pthread_create", strerror(rc));
+		pv__prescan_free(prescan);
+		return false;
+	}
+
+	prescan->thread_started = true;
+	state->files.prescan = prescan;
+	state->control.size_provisional = true;
+
+	debug("%s: %s=%u, %s=%lld", "line count started", "threads", prescan->thread_count, "bytes",
+	      (long long) (prescan->total_bytes));
+
+	return true;
+}
+
+
+/*
+ * Update state->control.size from the background line count, if there is
+ * one.  Until the count is finished, the total is estimated from the
+ * proportion of the input scanned so far.
+ */
+void pv_prescan_update(pvstate_t state)
+{
+	struct pvprescan_s *prescan;
+	off_t bytes_scanned, lines_counted;
+	bool finished;
+
+	prescan = state->files.prescan;
+	if ((NULL == prescan) || (prescan->reported))
+		return;
+
+	pv__prescan_lock(prescan);
+	bytes_scanned = prescan->bytes_scanned;
+	lines_counted = prescan->lines_counted;
+	finished = prescan->finished;
+	pv__prescan_unlock(prescan);
+
+	if (finished) {
+		prescan->reported = true;
+		(void) pthread_join(prescan->thread, NULL);
+		prescan->thread_started = false;
+		pv__prescan_report_error(state, prescan);
+		state->control.size = lines_counted;
+		state->control.size_provisional = false;
+		debug("%s: %lld", "line count finished", (long long) lines_counted);
+		return;
+	}
+
+	if (bytes_scanned < PV_PRESCAN_ESTIMATE_MIN)
+		return;
+
+	state->control.size =
+	    (off_t) ((long double) lines_counted * (long double) (prescan->total_bytes) / (long double) bytes_scanned);
+}
+
+
+/*
+ * Stop the background line count, if there is one, and free it.
+ */
+void pv_prescan_stop(pvstate_t state)
+{
+	struct pvprescan_s *prescan;
+
+	if (NULL == state || NULL == state->files.prescan)
+		return;
+
+	prescan = state->files.prescan;
+	state->files.prescan = NULL;
+
+	if (prescan->thread_started) {
+		pv__prescan_lock(prescan);
+		prescan->stop_requested = true;
+		pv__prescan_unlock(prescan);
+		(void) pthread_join(prescan->thread, NULL);
+		debug("%s", "line count stopped");
+	}
+
+	pv__prescan_free(prescan);
+}
+#endif				/* HAVE_PTHREAD */
@@ -0,0 +1,190 @@
+/*
+ * Self-profiling for "--self-profile": the time pv spends in each phase of
+ * its own work, counted with the cheapest clock the processor offers.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define PV_PROFILE_TSC 1
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define PV_PROFILE_CNTVCT 1
+#endif
+
+/*
+ * The counters are process-wide rather than part of the state, since
+ * pv_tty_write() is timed too and only sees the transient flags.  Only the
+ * main thread calls the timed functions, so no locking is needed.
+ *
+ * Ticks are converted to seconds at the end, by comparing the ticks that
+ * passed against the monotonic clock over the whole run, so the counter
+ * only needs to run at a constant rate, which the x86 time stamp counter
+ * and the ARM virtual counter both do on any processor recent enough to
+ * matter.
+ */
+struct pvprofile_phase_s {
+	uint64_t calls;			 /* number of times the phase was entered */
+	uint64_t ticks;			 /* total ticks spent in the phase */
+};
+
+static bool pv__profile_active = false;
+static uint64_t pv__profile_start_ticks = 0;
+static struct timespec pv__profile_start_time;
+static struct pvprofile_phase_s pv__profile_phase[PV_PROFILE_PHASES];
+
+/* Labels for the summary, in pvprofilephase_t order. */
+/*@observer@ */ static const char *const pv__profile_label[PV_PROFILE_PHASES] = {
+	N_("select"),
+	N_("read"),
+	N_("write"),
+	N_("splice"),
+	N_("line scanning"),
+	N_("formatting"),
+	N_("terminal output"),
+	N_("fd scanning")
+};
+
+
+/*
+ * Return the current tick count.
+ */
+static inline uint64_t pv__profile_ticks(void)
+{
+#if defined(PV_PROFILE_TSC)
+	return (uint64_t) __rdtsc();
+#elif defined(PV_PROFILE_CNTVCT)
+	uint64_t value;
+	__asm__ __volatile__("mrs %0, cntvct_el0":"=r"(value));
+	return value;
+#else
+	struct timespec now;
+	(void) clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) (now.tv_sec) * 1000000000 + (uint64_t) (now.tv_nsec);
+#endif
+}
+
+
+/*
+ * Turn self-profiling on or off, clearing the counters when turning it on.
+ */
+void pv_profile_enable(bool enabled)
+{
+	if (enabled && !pv__profile_active) {
+		memset(pv__profile_phase, 0, sizeof(pv__profile_phase));
+		pv_elapsedtime_read(&pv__profile_start_time);
+		pv__profile_start_ticks = pv__profile_ticks();
+	}
+	pv__profile_active = enabled;
+}
+
+
+/*
+ * Return the tick count at the start of a phase, or 0 if self-profiling is
+ * off, to be passed to pv_profile_end() when the phase is over.
+ */
+uint64_t pv_profile_begin(void)
+{
+	if (!pv__profile_active)
+		return 0;
+	return pv__profile_ticks();
+}
+
+
+/*
+ * Add the time since "start", from pv_profile_begin(), to the given phase.
+ */
+void pv_profile_end(pvprofilephase_t phase, uint64_t start)
+{
+	uint64_t now;
+
+	if ((0 == start) || (phase >= PV_PROFILE_PHASES))
+		return;
+
+	now = pv__profile_ticks();
+	pv__profile_phase[phase].calls++;
+	if (now > start)
+		pv__profile_phase[phase].ticks += now - start;
+}
+
+
+/*
+ * Write the self-profile to the terminal: for each phase that was entered,
+ * the number of calls, the time spent, the time per GiB transferred, and
+ * the share of the elapsed time, followed by the CPU time pv used overall.
+ */
+void pv_profile_show(pvstate_t state)
+{
+	char stats_buf[256];		 /* flawfinder: ignore */
+	struct timespec now, elapsed;
+	long double elapsed_seconds, seconds_per_tick, gibibytes, phase_total;
+	uint64_t ticks_passed;
+	struct rusage usage;
+	unsigned int phase;
+	int stats_size;
+
+	/* flawfinder: made safe by use of pv_snprintf() */
+
+	if (!pv__profile_active)
+		return;
+
+	ticks_passed = pv__profile_ticks() - pv__profile_start_ticks;
+	pv_elapsedtime_read(&now);
+	pv_elapsedtime_subtract(&elapsed, &now, &pv__profile_start_time);
+	elapsed_seconds = pv_elapsedtime_seconds(&elapsed);
+
+	seconds_per_tick = 0.0;
+	if (ticks_passed > 0)
+		seconds_per_tick = elapsed_seconds / (long double) ticks_passed;
+
+	gibibytes = ((long double) (state->transfer.total_written)) / (1024.0L * 1024.0L * 1024.0L);
+	phase_total = 0.0;
+
+	for (phase = 0; phase < PV_PROFILE_PHASES; phase++) {
+		long double phase_seconds;
+
+		if (0 == pv__profile_phase[phase].calls)
+			continue;
+
+		phase_seconds = seconds_per_tick * (long double) (pv__profile_phase[phase].ticks);
+		phase_total += phase_seconds;
+
+		memset(stats_buf, 0, sizeof(stats_buf));
+		stats_size =
+		    pv_snprintf(stats_buf, sizeof(stats_buf), "%s %s %s = %llu/%.6Lf/%.6Lf/%.2Lf%%\n", _("profile"),
+				_(pv__profile_label[phase]), _("calls/seconds/s-per-GiB/elapsed"),
+				(unsigned long long) (pv__profile_phase[phase].calls), phase_seconds,
+				gibibytes > 0.0 ? phase_seconds / gibibytes : 0.0,
+				elapsed_seconds > 0.0 ? 100.0 * phase_seconds / elapsed_seconds : 0.0);
+
+		if (stats_size > 0 && stats_size < (int) (sizeof(stats_buf)))
+			pv_tty_write(&(state->flags), stats_buf, (size_t) stats_size);
+	}
+
+	memset(&usage, 0, sizeof(usage));
+	(void) getrusage(RUSAGE_SELF, &usage);
+
+	memset(stats_buf, 0, sizeof(stats_buf));
+	stats_size =
+	    pv_snprintf(stats_buf, sizeof(stats_buf), "%s %s = %.6Lf/%.6Lf/%.6Lf/%.6Lf %s\n", _("profile"),
+			_("phases/user/system/elapsed"), phase_total,
+			(long double) (usage.ru_utime.tv_sec) + ((long double) (usage.ru_utime.tv_usec)) / 1000000.0L,
+			(long double) (usage.ru_stime.tv_sec) + ((long double) (usage.ru_stime.tv_usec)) / 1000000.0L,
+			elapsed_seconds, _("s"));
+
+	if (stats_size > 0 && stats_size < (int) (sizeof(stats_buf)))
+		pv_tty_write(&(state->flags), stats_buf, (size_t) stats_size);
+}
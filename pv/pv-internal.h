@@ -23,16 +23,44 @@
 extern "C" {
 #endif
 
-#define RATE_GRANULARITY	100000000	 /* nsec between -L rate chunks */
-#define RATE_BURST_WINDOW	5	 	 /* rate burst window (multiples of rate) */
+#define RATE_QUANTUM		1000000		 /* nsec of -L rate to send per write */
+#define RATE_BURST_WINDOW	5	 	 /* default burst size (multiples of rate) */
+#define COALESCE_BYTES		(size_t) 65536	 /* default --coalesce-bytes threshold */
 #define REMOTE_INTERVAL		100000000	 /* nsec between checks for -R and -Q */
 #define BUFFER_SIZE		(size_t) 409600	 /* default transfer buffer size */
 #define BUFFER_SIZE_MAX		(size_t) 524288	 /* max auto transfer buffer size */
 #define MAX_READ_AT_ONCE	(size_t) 524288	 /* max to read() in one go */
 #define MAX_WRITE_AT_ONCE	(size_t) 524288	 /* max to write() in one go */
+#define MAX_COPY_AT_ONCE	(size_t) 16777216 /* max to copy_file_range() or sendfile() in one go */
 #define TRANSFER_READ_TIMEOUT	0.09L		 /* seconds to time reads out at */
 #define TRANSFER_WRITE_TIMEOUT	0.9L		 /* seconds to time writes out at */
-#define MAX_LINE_POSITIONS	100000		 /* number of lines to remember positions of */
+#define PV_URING_BUFFERS	4		 /* buffers kept in flight by --engine io_uring */
+#define PV_LINESCAN_BATCH	256		 /* line separators to locate per scan */
+#define PV_BUFFER_POOL_SLOTS	4		 /* spare buffers kept by "-B auto" */
+#define PV_BUFFER_ADAPT_MIN	(size_t) 65536	 /* smallest buffer "-B auto" will use */
+#define PV_BUFFER_ADAPT_MAX	(size_t) 8388608 /* largest buffer "-B auto" will use */
+#define PV_BUFFER_ADAPT_EPOCH	0.25L		 /* seconds between "-B auto" adjustments */
+#define PV_BUFFER_ADAPT_MIN_CALLS 8		 /* I/O calls needed before adjusting */
+#define PV_BUFFER_ADAPT_MAX_LATENCY 0.05L	 /* seconds per call above which to shrink */
+#define PV_SPARSE_BLOCK_DEFAULT	(size_t) 4096	 /* --sparse block size if not known */
+#define PV_SPARSE_BLOCK_MAX	(size_t) 1048576 /* largest --sparse block size to use */
+#define PV_PRESCAN_CHUNK	(size_t) 4194304 /* bytes to count between progress updates */
+#define PV_PRESCAN_MIN_RANGE	(size_t) 16777216 /* smallest part of a file to give a thread */
+#define PV_PRESCAN_MAX_THREADS	8		 /* most threads to count lines with */
+#define PV_PRESCAN_ESTIMATE_MIN	(off_t) 4194304	 /* bytes to count before estimating total lines */
+#define PV_DISPLAY_REDRAW_EVERY	50		 /* partial display updates between full redraws */
+#define PV_DISPLAY_RENDER_GAP	8		 /* unchanged bytes to rewrite rather than skip */
+#define PV_FORMAT_CACHE_SLOTS	4		 /* compiled format strings to keep */
+#define PV_CTLSOCK_MAX_SUBSCRIBERS 16		 /* control socket subscribers allowed */
+#define PV_CTLSOCK_MAX_WORDS	64		 /* words allowed in a control request */
+#define PV_CTLSOCK_MAX_BATCH	64		 /* control requests to answer per loop */
+#define PV_CTLSOCK_MIN_INTERVAL	0.01		 /* shortest subscription interval */
+#define PV_CTLSOCK_REPLY_TIMEOUT 1100		 /* msec to wait for a control reply */
+#define PV_LATENCY_SUB_BITS	2		 /* log2 of latency buckets per power of 2 */
+#define PV_LATENCY_MAX_BITS	41		 /* latencies above 2^41 nsec share a bucket */
+#define PV_CRS_MAX_STAGES	32		 /* "pv -c" instances to attribute blocking between */
+#define PV_CALC_WINDOW_POINTS	32		 /* progress points kept across the rate window */
+#define PV_HISTORY_RAMP_SECONDS	8		 /* seconds of start-up rates kept by --history */
 
 #define MAXIMISE_BUFFER_FILL	1
 
@@ -40,13 +68,23 @@ extern "C" {
 #define PV_SIZEOF_CWD			4096
 #define PV_SIZEOF_LASTWRITTEN_BUFFER	256
 #define PV_SIZEOF_PREVLINE_BUFFER	1024
+#define PV_SIZEOF_CAPTURE_RING		4096
+#define PV_SIZEOF_LINESCAN_BUFFER	65536
 #define PV_FORMAT_ARRAY_MAX		100
+#define PV_SIZEOF_WIDTH_KEY		32
 #define PV_SIZEOF_FORMAT_SEGMENTS_BUF	4096
 #define PV_SIZEOF_CRS_LOCK_FILE		1024
+#define PV_SIZEOF_CRS_STAGE_NAME	32
+#define PV_SIZEOF_CRS_BOTTLENECK	4096
+#define PV_SIZEOF_CRS_ROW		2048
 
-#define PV_SIZEOF_FILE_FDINFO		4096
-#define PV_SIZEOF_FILE_FD		4096
+#define PV_SIZEOF_FILE_FDINFO		64	/* "/proc/<pid>/fdinfo/<fd>" */
+#define PV_SIZEOF_FILE_FD		64	/* "/proc/<pid>/fd/<fd>" */
 #define PV_SIZEOF_FILE_FDPATH		4096
+#define PV_SIZEOF_STATSPAGE_FILENAME	4096
+#define PV_SIZEOF_CTLSOCK_MSG		4096
+#define PV_SIZEOF_METRICS_FILENAME	4096
+#define PV_SIZEOF_METRICS_LABELS	1024
 #define PV_SIZEOF_DISPLAY_NAME		512
 
 #define PV_BARSTYLE_MAX			4	/* number of different styles allowed in a format */
@@ -59,12 +97,50 @@ extern "C" {
 
 /*
  * Structure for data shared between multiple "pv -c" instances.
+ *
+ * Each instance claims one of the "row" slots with an atomic
+ * compare-and-swap on its owner, which gives it its display line, and
+ * publishes each update into it instead of writing to the terminal.  One
+ * instance at a time is the elected "renderer", which draws every row that
+ * has changed in a single terminal write; the rest never touch the
+ * terminal between init and fini.  Each row is guarded by a sequence
+ * count, which is odd while its owner is writing to it, so the renderer
+ * can read it without a lock and just skip it if it was caught mid-update.
+ *
+ * Each instance also claims one of the "stage" slots, in the order of their
+ * display lines, and fills it in with how long it spent blocked on its
+ * input and output when its transfer ends, so that the last one to finish
+ * can work out where in the pipeline the bottleneck was.
  */
 struct pvipccursorstate_s {
 	int y_topmost;		/* terminal row of topmost "pv" instance */
 	bool tty_tostop_added;	/* whether any instance had to set TOSTOP on the terminal */
+	int rows_claimed;	/* one more than the highest row claimed so far */
+	pid_t renderer;		/* process drawing all rows, 0 if none */
+	long long renderer_seen; /* coarse nsec time the renderer last drew */
+	long long renderer_interval; /* renderer's update interval, in nsec */
+	struct pvipcrow_s {
+		unsigned int sequence;	 /* odd while the line is being written */
+		pid_t pid;		 /* process owning this row, 0 if free */
+		size_t length;		 /* bytes in line */
+		char line[PV_SIZEOF_CRS_ROW]; /* latest update, not \0-terminated */ /* flawfinder: ignore */
+	} row[PV_CRS_MAX_STAGES];
+	struct pvipcstage_s {
+		double elapsed;		 /* seconds spent transferring */
+		double blocked_input;	 /* seconds spent waiting for input */
+		double blocked_output;	 /* seconds spent waiting for output */
+		pid_t pid;		 /* process owning this slot, 0 if free */
+		char name[PV_SIZEOF_CRS_STAGE_NAME]; /* flawfinder: ignore */
+		bool published;		 /* set once the figures are filled in */
+	} stage[PV_CRS_MAX_STAGES];
 };
 
+/*
+ * flawfinder rationale: stage names are only written by pv_snprintf(),
+ * which always bounds and terminates them; row lines are only written by
+ * memcpy() after checking the length against their size.
+ */
+
 /*
  * Types of transfer count - bytes, decimal bytes or lines.
  */
@@ -74,6 +150,124 @@ typedef enum {
 	PV_TRANSFERCOUNT_LINES
 } pvtransfercount_t;
 
+/*
+ * Storage class for variables that each thread has its own copy of.
+ */
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define PV_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define PV_THREAD_LOCAL __thread
+#else
+#define PV_THREAD_LOCAL
+#endif
+
+/*
+ * Ways that "--record" can tell where each record ends.
+ */
+typedef enum {
+	PV_RECORD_NONE,
+	PV_RECORD_DELIMITER,
+	PV_RECORD_FIXED,
+	PV_RECORD_U32BE,
+	PV_RECORD_U32LE,
+	PV_RECORD_VARINT
+} pvrecordtype_t;
+
+/* The most progress observers that can be added to one state. */
+#define PV_MAX_OBSERVERS 8
+
+/* The longest delimiter that "--record delim:" can use. */
+#define PV_RECORD_MAX_DELIMITER 16
+
+/*
+ * The record framing chosen with "--record".
+ */
+struct pvrecordframing_s {
+	pvrecordtype_t type;
+	size_t size;				 /* size of fixed-size records */
+	size_t delimiter_length;		 /* bytes of delimiter */
+	char delimiter[PV_RECORD_MAX_DELIMITER]; /* delimiter (not terminated) */
+};
+
+/*
+ * Ways of copying between file descriptors inside the kernel, used when
+ * splice() can't be because neither end is a pipe.
+ */
+typedef enum {
+	PV_COPY_METHOD_NONE,
+	PV_COPY_METHOD_COPY_FILE_RANGE,
+	PV_COPY_METHOD_SENDFILE
+} pvcopymethod_t;
+
+/*
+ * The engines pv_transfer() can move data with, for the record of which
+ * were used, shown by "--stats"; the first few are whole engines of their
+ * own, and the rest are the ways the buffered engine can move the data.
+ */
+typedef enum {
+	PV_TRANSFER_ENGINE_NONE,
+	PV_TRANSFER_ENGINE_RESCUE,
+	PV_TRANSFER_ENGINE_DIRECT,
+	PV_TRANSFER_ENGINE_IO_URING,
+	PV_TRANSFER_ENGINE_MMAP,
+	PV_TRANSFER_ENGINE_SPLICE,
+	PV_TRANSFER_ENGINE_TEE,
+	PV_TRANSFER_ENGINE_COPY_FILE_RANGE,
+	PV_TRANSFER_ENGINE_SENDFILE,
+	PV_TRANSFER_ENGINE_READWRITE,
+	PV_TRANSFER_ENGINES
+} pvtransferengine_t;
+
+/*
+ * Kinds of operation whose latency is recorded for "--stats" - the
+ * blocking calls made by pv_transfer(), and its waits for the input, the
+ * output, or either, to become ready.
+ */
+typedef enum {
+	PV_LATENCY_READ,
+	PV_LATENCY_WRITE,
+	PV_LATENCY_SPLICE,
+	PV_LATENCY_WAIT_INPUT,
+	PV_LATENCY_WAIT_OUTPUT,
+	PV_LATENCY_WAIT_EITHER,
+	PV_LATENCY_KINDS
+} pvlatencykind_t;
+
+/*
+ * Kinds of event recorded by "--trace".  These are stored in the trace
+ * file, so new kinds go on the end.
+ */
+typedef enum {
+	PV_TRACE_READ,			 /* read() of the input */
+	PV_TRACE_WRITE,			 /* write() of the output */
+	PV_TRACE_SPLICE,		 /* splice(), tee() or copy in the kernel */
+	PV_TRACE_WAIT,			 /* wait for the input or output */
+	PV_TRACE_UNCONSUMED,		 /* FIONREAD sample of the output pipe */
+	PV_TRACE_RATE,			 /* rate limiter allowance */
+	PV_TRACE_DISPLAY,		 /* display update */
+	PV_TRACE_DROPPED,		 /* events lost because the ring was full */
+	PV_TRACE_KINDS
+} pvtracekind_t;
+
+/* Bits in the value of a PV_TRACE_WAIT event. */
+#define PV_TRACE_WAIT_INPUT	1
+#define PV_TRACE_WAIT_OUTPUT	2
+
+/*
+ * Phases of pv's own work timed by "--self-profile".
+ */
+typedef enum {
+	PV_PROFILE_SELECT,
+	PV_PROFILE_READ,
+	PV_PROFILE_WRITE,
+	PV_PROFILE_SPLICE,
+	PV_PROFILE_LINESCAN,
+	PV_PROFILE_FORMAT,
+	PV_PROFILE_TTY_WRITE,
+	PV_PROFILE_SCANFDS,
+	PV_PROFILE_PHASES
+} pvprofilephase_t;
+
 
 /*
  * Structure describing a short string used as part of a progress bar, whose
@@ -131,12 +325,228 @@ typedef uint16_t pvdisplay_bytecount_t;
 typedef uint16_t pvdisplay_width_t;
 #define PVDISPLAY_WIDTH_MAX (65535)	/* UINT16_MAX */
 
+/*
+ * Geometry of a disk device, as found by pv_blkdev_probe().
+ */
+struct pvblkdev_s {
+	off_t size;			 /* size in bytes, or -1 if unknown */
+	size_t logical_sector;		 /* smallest addressable unit, or 0 */
+	size_t physical_sector;		 /* unit the device writes in, or 0 */
+	size_t optimal_io;		 /* preferred transfer size, or 0 */
+};
+
 /*
  * Structure defining the current state of a single watched file descriptor.
  */
 struct pvwatchfd_s;
 typedef /*@null@*/ struct pvwatchfd_s *pvwatchfd_t;
 
+/*
+ * Structure holding the state of the reader thread used by --pipeline.  The
+ * full definition is private to pipeline.c.
+ */
+struct pvpipeline_s;
+
+/*
+ * Structure holding the state of the thread which tells the main loop
+ * when to look at the clock.  The full definition is private to ticker.c.
+ */
+struct pvticker_s;
+
+/*
+ * Structure holding the io_uring used by "--engine io_uring".  The full
+ * definition is private to iouring.c.
+ */
+struct pvuring_s;
+
+/*
+ * Structure holding the reader thread and aligned buffers used by
+ * "--direct-io".  The full definition is private to directio.c.
+ */
+struct pvdirectio_s;
+
+/*
+ * Structure holding how far "--drop-behind" has got through the input and
+ * the output.  The full definition is private to dropbehind.c.
+ */
+struct pvdropbehind_s;
+
+/*
+ * Structure holding how far "--sync-every" and "--sync-interval" have got
+ * with making the output durable.  The full definition is private to
+ * groupsync.c.
+ */
+struct pvgroupsync_s;
+
+/*
+ * Structure holding the capacities "--pipe-size" has given the input and
+ * output pipes.  The full definition is private to pipesize.c.
+ */
+struct pvpipesize_s;
+
+/*
+ * Structure holding this process's place in a "--rate-budget" shared with
+ * other processes.  The full definition is private to budget.c.
+ */
+struct pvbudget_s;
+
+/*
+ * Structure holding the state of "--latency-target" and
+ * "--pressure-target" throttling.  The full definition is private to
+ * throttle.c.
+ */
+struct pvthrottle_s;
+
+/*
+ * Structure holding the "--trace" ring buffer and file.  The full
+ * definition is private to trace.c.
+ */
+struct pvtrace_s;
+
+/*
+ * Structure holding this transfer's "--history" key and start-up rates.
+ * The full definition is private to history.c.
+ */
+struct pvhistory_s;
+
+/*
+ * Structure holding the memory mapping used by "--engine mmap".  The full
+ * definition is private to mmapin.c.
+ */
+struct pvmmapin_s;
+
+/*
+ * Structure holding the trial of engines for "--engine auto".  The full
+ * definition is private to autoengine.c.
+ */
+struct pvautoengine_s;
+
+/*
+ * Structure holding the region map and progress of "--rescue".  The full
+ * definition is private to rescue.c.
+ */
+struct pvrescue_s;
+
+/*
+ * Structure holding the progress recorded in the "--checkpoint" file.  The
+ * full definition is private to checkpoint.c.
+ */
+struct pvcheckpoint_s;
+
+/*
+ * Structure holding the parallel network streams of "--streams", in one
+ * direction.  The full definition is private to stripe.c.
+ */
+struct pvstripe_s;
+
+/*
+ * Structure holding the compressor or decompressor of "--compress" or
+ * "--decompress".  The full definition is private to codec.c.
+ */
+struct pvcodec_s;
+
+/*
+ * Structure holding a line counting job over all the input files.  The
+ * full definition is private to prescan.c.
+ */
+struct pvprescan_s;
+
+/*
+ * Structure holding the sampled line estimate for --line-estimate.  The
+ * full definition is private to linesample.c.
+ */
+struct pvlinesample_s;
+
+/*
+ * Structure holding the input files being opened ahead of the transfer.
+ * The full definition is private to prefetch.c.
+ */
+struct pvprefetch_s;
+
+/*
+ * Structure holding the background calculation of the total size of the
+ * input files.  The full definition is private to sizescan.c.
+ */
+struct pvsizescan_s;
+
+/*
+ * Structure holding where recent line separators were written to the
+ * output.  The full definition is private to linepos.c.
+ */
+struct pvlinepositions_s;
+
+/*
+ * Structure holding how far through the "--record" framing the output has
+ * got.  The full definition is private to record.c.
+ */
+struct pvrecordscan_s;
+
+/*
+ * Structure holding the temporary spool for store-and-forward mode.  The
+ * full definition is private to spool.c.
+ */
+struct pvspool_s;
+
+/*
+ * Structure holding the spare buffers and measurements used by "-B auto".
+ * The full definition is private to buffer.c.
+ */
+struct pvbufferpool_s;
+
+/*
+ * Structure holding the event queue used to wait for the input and output
+ * to become ready.  The full definition is private to poller.c.
+ */
+struct pvpoller_s;
+
+/*
+ * Structure holding the format strings compiled by pv__format_init().  The
+ * full definition is private to display.c.
+ */
+struct pvformatcache_s;
+
+/*
+ * Structure holding the shared memory page published by "--stats-page".
+ * The full definition is private to statspage.c.
+ */
+struct pvstatspage_s;
+
+/*
+ * Structure holding the control socket and its subscribers.  The full
+ * definition is private to ctlsock.c.
+ */
+struct pvctlsock_s;
+
+/*
+ * Structure holding the state of "--metrics-file".  The full definition is
+ * private to metrics.c.
+ */
+struct pvmetrics_s;
+
+/*
+ * Structure holding the state of "--stall-timeout" and "--rate-drop".  The
+ * full definition is private to stall.c.
+ */
+struct pvstall_s;
+
+/*
+ * Structure holding the running digest of the output for "--digest".  The
+ * full definition is private to digest.c.
+ */
+struct pvdigest_s;
+
+/*
+ * Structure holding the extra outputs given by repeating "-o".  The full
+ * definition is private to fanout.c.
+ */
+struct pvfanout_s;
+
+/*
+ * Structure holding the latency histograms shown by "--stats".  The full
+ * definition is private to latency.c.
+ */
+struct pvlatency_s;
+
 /* String pointer, that is the only pointer to this resource, that can be null. */
 typedef /*@only@*/ /*@null@*/ char * nullable_string_t;
 
@@ -156,6 +566,17 @@ struct pvstate_s {
 		bool terminal_supports_utf8;	 /* whether the terminal supports UTF-8 */
 		bool terminal_supports_colour;	 /* whether the terminal supports colour */
 		bool checked_colour_support;	 /* whether we have checked colour support yet */
+		/*@only@*/ /*@null@*/ struct pvformatcache_s *format_cache; /* compiled format strings */
+		/*@only@*/ /*@null@*/ struct pvstatspage_s *stats_page; /* published stats page, if any */
+		/*@only@*/ /*@null@*/ struct pvctlsock_s *control_socket; /* remote control socket */
+		/*@only@*/ /*@null@*/ struct pvmetrics_s *metrics; /* --metrics-file state */
+		/*@only@*/ /*@null@*/ struct pvstall_s *stall; /* stall and rate drop detector */
+		/*@only@*/ /*@null@*/ struct pvspool_s *spool; /* store-and-forward spool, if any */
+		/*@only@*/ /*@null@*/ struct pvdigest_s *digest; /* running digest of the output */
+		/*@only@*/ /*@null@*/ struct pvfanout_s *fanout; /* extra outputs, if any */
+		/*@only@*/ /*@null@*/ struct pvcheckpoint_s *checkpoint; /* --checkpoint progress */
+		/*@only@*/ /*@null@*/ struct pvstripe_s *stripe_input; /* striped network input */
+		/*@only@*/ /*@null@*/ struct pvstripe_s *stripe_output; /* striped network output */
 	} status;
 
 	/***************
@@ -164,6 +585,10 @@ struct pvstate_s {
 	struct pvinputfiles_s {
 		/*@only@*/ /*@null@*/ nullable_string_t *filename; /* input filenames */
 		unsigned int file_count;	 /* number of input files */
+		/*@only@*/ /*@null@*/ struct pvprescan_s *prescan; /* background line count, if running */
+		/*@only@*/ /*@null@*/ struct pvprefetch_s *prefetch; /* files opened ahead, if any */
+		/*@only@*/ /*@null@*/ struct pvsizescan_s *sizescan; /* background size scan, if running */
+		/*@only@*/ /*@null@*/ struct pvlinesample_s *linesample; /* sampled line estimate, if any */
 	} files;
 
 	/*********************************
@@ -177,9 +602,18 @@ struct pvstate_s {
 			pvwatchfd_t info_array;	 /* watch information for each fd */
 			int array_length;	 /* length of watch info array */
 			bool finished;		 /* "PID:FD": fd closed; or PID gone */
+			bool from_tree;		 /* found by following "--tree" */
+			int pidfd;		 /* pidfd_open() descriptor, or -1 */
+			off_t transferred;	 /* progress seen across all its fds */
 		} *watching;
 		unsigned int count;	/* number of items in these arrays */
+		unsigned int allocated;	/* number of items allocated */
 		bool multiple_pids;	/* true if more than one distinct PID */
+		bool tree;		/* follow child processes ("--tree") */
+		bool tree_changed;	/* set when a watched process forks */
+		int exit_queue_fd;	/* kqueue for PID exits, or -1 */
+		off_t tree_transferred;	/* progress seen across the whole tree */
+		struct timespec tree_start; /* time the tree watch started */
 	} watchfd;
 
 	/*******************
@@ -189,23 +623,64 @@ struct pvstate_s {
 		char default_format[PV_SIZEOF_DEFAULT_FORMAT];	 /* default format string */
 		double interval;                 /* interval between updates */
 		double delay_start;              /* delay before first display */
+		double stall_timeout;            /* --stall-timeout seconds (0=off) */
+		double coalesce;                 /* --coalesce seconds to hold writes for (0=off) */
+		double sync_interval;            /* --sync-interval seconds between full syncs (0=off) */
+		double latency_target;           /* --latency-target seconds (0=off) */
 		/*@only@*/ /*@null@*/ char *name;		 /* display name */
 		/*@only@*/ /*@null@*/ char *format_string;	 /* output format string */
 		/*@only@*/ /*@null@*/ char *extra_display_spec;  /* full spec for extra displays */
 		/*@only@*/ /*@null@*/ char *extra_format_string; /* extra format string alone */
 		/*@null@*/ char *output_name;    /* name of the output, for diagnostics */
 		/*@null@*/ char *default_bar_style; /* which bar style to use by default */
+		/*@only@*/ /*@null@*/ char *metrics_file; /* file to write metrics to */
+		/*@only@*/ /*@null@*/ char *stall_command; /* --on-stall command */
+		/*@only@*/ /*@null@*/ char *rate_budget; /* --rate-budget name */
+		/*@only@*/ /*@null@*/ char *trace_file; /* --trace file */
+		/*@only@*/ /*@null@*/ char *history_file; /* --history file */
+		/*@only@*/ /*@null@*/ char *engine_cache; /* --engine-cache file */
+		/*@only@*/ /*@null@*/ char *rescue_map; /* --rescue region map file */
+		/*@only@*/ /*@null@*/ char *checkpoint_file; /* --checkpoint file */
+		/*@only@*/ /*@null@*/ char *cpu_affinity; /* --cpu-affinity processor list */
+		/*@only@*/ /*@null@*/ char *manifest; /* --manifest file of pairs to copy */
+		/*@only@*/ /*@null@*/ char *copy_into; /* --copy-into destination directory */
 		off_t error_skip_block;          /* skip block size, 0 for adaptive */
 		off_t rate_limit;                /* rate limit, in bytes per second */
+		off_t rate_burst;                /* rate limit burst size (0=default) */
+		unsigned int rate_weight;        /* --rate-weight share of the budget */
+		unsigned int pressure_target;    /* --pressure-target I/O stall percentage (0=off) */
+		off_t sync_every;                /* --sync-every bytes between full syncs (0=off) */
 		size_t target_buffer_size;       /* buffer size (0=default) */
+		size_t coalesce_bytes;           /* --coalesce-bytes write threshold (0=default) */
+		size_t pipe_size;                /* --pipe-size capacity (0=leave alone) */
 		off_t size;                      /* total size of data */
 		unsigned int skip_errors;        /* skip read errors counter */
+		unsigned int rescue_retries;	 /* --rescue retry passes */
+		unsigned int streams;		 /* parallel streams per network address */
+		unsigned int jobs;		 /* files to copy at once (0=default) */
+		unsigned int rate_drop;		 /* --rate-drop percentage (0=off) */
+		int codec_level;		 /* --compress level (0=default) */
 		int output_fd;                   /* fd to write output to */
+		int stats_fd;			 /* fd to write --stats-fd records to, or -1 */
+		int numa_node;			 /* --numa-node, or -1 for none */
 		unsigned int average_rate_window; /* time window in seconds for average rate calculations */
-		unsigned int history_interval;	 /* seconds between each average rate calc history entry */
 		pvdisplay_width_t width;         /* screen width */
 		unsigned int height;             /* screen height */
 		unsigned int extra_displays;	 /* bitmask of extra display destinations */
+		unsigned int pipeline_buffers;	 /* buffers for the reader thread (0=none) */
+		pvioengine_t io_engine;		 /* which I/O engine to transfer with */
+		pvstatsformat_t stats_format;	 /* record format for --stats-fd */
+		pvetamodel_t eta_model;		 /* how to estimate the rate for the ETA */
+		pvdigest_t digest;		 /* digest of the output to compute */
+		pvfanoutpolicy_t fanout_policy;	 /* what to do with slow extra outputs */
+		pvcodec_t codec;		 /* codec to pass the data through */
+		struct pvrecordframing_s record; /* --record framing */
+		struct {			 /* progress observers */
+			pvobserverfn_t callback;  /* function to call */
+			/*@null@*/ /*@dependent@*/ void *data; /* passed to the function */
+		} observer[PV_MAX_OBSERVERS];
+		unsigned int observer_count;	 /* number of observers in use */
+		int input_fd;			 /* fd to read instead of stdin, or -1 */
 		struct {			 /* old-style format options (used by -R) */
 			size_t lastwritten;	  /* --last-written (amount) */
 			bool progress;		  /* --progress */
@@ -217,6 +692,7 @@ struct pvstate_s {
 			bool bytes;		  /* --bytes */
 			bool bufpercent;	  /* --buffer-percent */
 		} format_option;
+		bool embedded;			 /* running inside another program */
 		bool force;                      /* display even if not on terminal */
 		bool cursor;                     /* use cursor positioning */
 		bool numeric;                    /* numeric output only */
@@ -229,12 +705,23 @@ struct pvstate_s {
 		bool no_display;                 /* do nothing other than pipe data */
 		bool no_splice;                  /* never use splice() */
 		bool stop_at_size;               /* set if we stop at "size" bytes */
+		bool size_provisional;		 /* "size" is an estimate, still being worked out */
+		bool line_estimate;		 /* estimate the line count by sampling */
 		bool sync_after_write;           /* set if we sync after every write */
 		bool direct_io;                  /* set if O_DIRECT is to be used */
-		bool direct_io_changed;          /* set when direct_io is changed */
+		bool drop_behind;		 /* release the page cache as we go */
+		bool pipe_size_auto;		 /* grow pipes to suit, for "--pipe-size auto" */
+		bool rescue_direct;		 /* retry --rescue regions with direct I/O */
+		bool codec_compress;		 /* compress with the codec, not decompress */
 		bool sparse_output;		 /* set if we leave holes in the output */
 		bool discard_input;              /* write nothing to stdout */
 		bool show_stats;		 /* show statistics on exit */
+		bool self_profile;		 /* show pv's own time per phase on exit */
+		bool huge_pages;		 /* back buffers with huge pages */
+		bool lock_buffers;		 /* lock buffers into memory */
+		bool buffer_lock_warned;	 /* set once a buffer failed to lock */
+		bool adaptive_buffer;		 /* tune the buffer size as we go */
+		bool stats_page;		 /* publish a shared memory stats page */
 		bool width_set_manually;	 /* width was set manually, not detected */
 		bool height_set_manually;	 /* height was set manually, not detected */
 	} control;
@@ -295,23 +782,70 @@ struct pvstate_s {
 			pvdisplay_bytecount_t offset;	/* start offset of this segment in the build buffer */
 			pvdisplay_bytecount_t bytes;	/* length of segment in bytes in the build buffer */
 			pvdisplay_width_t width;	/* displayed width of segment */
+			pvdisplay_bytecount_t line_offset; /* start offset of this segment in display_buffer */
+			pvdisplay_bytecount_t line_bytes; /* bytes of this segment in display_buffer */
+			pvdisplay_width_t line_column;	/* screen column this segment starts at */
+			pvdisplay_bytecount_t precomputed_offset; /* start of fixed content in display->precomputed */
+			pvdisplay_bytecount_t precomputed_bytes; /* length of fixed content */
+			int8_t precomputed_effect;	/* formatter-specific state change from the content */
+			bool precomputed_valid;		/* set if the fixed content has been stored */
+			pvdisplay_bytecount_t width_key_bytes; /* bytes in width_key, 0 if none */
+			pvdisplay_width_t width_key_width; /* displayed width of width_key */
+			char width_key[PV_SIZEOF_WIDTH_KEY]; /* content that width was last measured for */
 		} format[PV_FORMAT_ARRAY_MAX];
 
+		/*
+		 * Where each segment was in the line last written to the
+		 * terminal, so that only changed segments need to be
+		 * rewritten; the extra entry is the trailing padding.  See
+		 * pv__display_render_changes().
+		 */
+		struct pvdisplay_rendered_segment_s {
+			pvdisplay_bytecount_t offset;	/* start offset in rendered_line */
+			pvdisplay_bytecount_t bytes;	/* length in rendered_line */
+			pvdisplay_width_t column;	/* screen column it starts at */
+		} rendered_segment[PV_FORMAT_ARRAY_MAX + 1];
+
 		struct pvbarstyle_s barstyle[PV_BARSTYLE_MAX];
 
-		/* The last-written "n" bytes. */
+		/*
+		 * Each bar style's full and empty cells, rendered once for
+		 * a bar width so that drawing a bar is a matter of copying
+		 * slices of them; see format/progressbar.c.
+		 */
+		struct pvdisplay_bartemplate_s {
+			/*@only@*/ /*@null@*/ char *cells; /* "width" full cells, then "width" empty cells */
+			size_t size;			/* size allocated to cells */
+			pvdisplay_width_t width;	/* number of cells of each kind */
+			uint8_t style_id;		/* style rendered, 0 if none */
+		} bartemplate[PV_BARSTYLE_MAX];
+
+		/* The most recently written output; see capture.c. */
+		char capture_ring[PV_SIZEOF_CAPTURE_RING];
+
+		/* The last-written "n" bytes, taken from capture_ring. */
 		char lastwritten_buffer[PV_SIZEOF_LASTWRITTEN_BUFFER];
 
-		/* The most recently output complete line. */
+		/* The most recently output complete line, likewise. */
 		char previous_line[PV_SIZEOF_PREVLINE_BUFFER];
-		/* The line being received now. */
-		char next_line[PV_SIZEOF_PREVLINE_BUFFER];
 
 		/*@only@*/ /*@null@*/ char *display_buffer;	/* buffer for display string */
+		/*@only@*/ /*@null@*/ char *rendered_line;	/* copy of the line last written */
+		/*@only@*/ /*@null@*/ char *render_buffer;	/* changes to write to the terminal */
+		/*@only@*/ /*@null@*/ char *precomputed;	/* fixed segment content worked out at parse time */
+		size_t precomputed_size;	 /* size allocated to precomputed */
+		size_t precomputed_length;	 /* bytes used in precomputed */
 		off_t initial_offset;			 /* offset when first opened (when watching fds) */
-		size_t next_line_len;				 /* length of currently receiving line so far */
+		uint64_t capture_total;		 /* bytes ever added to capture_ring */
+		uint64_t capture_lastwritten_at; /* capture_total when lastwritten_buffer was filled */
+		uint64_t capture_previous_line_at; /* capture_total when previous_line was filled */
+		size_t capture_lastwritten_bytes; /* bytes put in lastwritten_buffer then */
 
 		size_t format_segment_count;	 /* number of format string segments */
+		size_t rendered_segment_count;	 /* number of segments in rendered_line */
+		size_t rendered_buffer_size;	 /* size allocated to rendered_line */
+		size_t render_bytes;		 /* length of the changes in render_buffer */
+		unsigned int partial_updates;	 /* partial updates since a full redraw */
 
 		pvtransfercount_t count_type;	 /* type of count for transfer, rate, etc */
 
@@ -320,6 +854,8 @@ struct pvstate_s {
 		pvdisplay_bytecount_t display_buffer_size;	/* size allocated to display buffer */
 		pvdisplay_bytecount_t display_string_bytes;	/* byte length of string in display buffer */
 		pvdisplay_width_t display_string_width;		/* displayed width of string in display buffer */
+		pvdisplay_bytecount_t padding_offset;	 /* where the trailing padding starts */
+		pvdisplay_width_t padding_column;	 /* screen column of the trailing padding */
 		pvdisplay_bytecount_t lastwritten_bytes;	 /* largest number of last-written bytes to show */
 
 		bool showing_timer;		 /* set if showing timer */
@@ -333,6 +869,8 @@ struct pvstate_s {
 		bool sgr_code_active;		 /* set while SGR code is active in a display line */
 		bool final_update;		 /* set internally on the final update */
 		bool output_produced;		 /* set once anything written to terminal */
+		bool rendered_valid;		 /* set if rendered_line is what the terminal shows */
+		bool render_to_tty;		 /* set if stderr is a terminal, for partial updates */
 
 	} display;
 
@@ -349,7 +887,9 @@ struct pvstate_s {
 		long double prev_elapsed_sec;	 /* elapsed sec at which rate last calculated */
 		long double prev_rate;		 /* last calculated instantaneous transfer rate */
 		long double prev_trans;		 /* amount transferred since last rate calculation */
-		long double current_avg_rate;    /* current average rate over last history intervals */
+		long double current_avg_rate;    /* current average rate over the window */
+		long double ewma_rate;		 /* exponentially weighted average rate */
+		long double eta_rate;		 /* rate to work out the ETA from */
 
 		long double rate_min;		 /* minimum measured transfer rate */
 		long double rate_max;		 /* maximum measured transfer rate */
@@ -357,14 +897,27 @@ struct pvstate_s {
 		long double ratesquared_sum;	 /* sum of the squares of each transfer rate */
 		unsigned long measurements_taken; /* how many times the rate was measured */
 
-		/* Keep track of progress over last intervals to compute current average rate. */
-		/*@null@*/ struct {	 /* state at previous intervals (circular buffer) */
-			long double elapsed_sec;	/* time since start of transfer */
+		/*
+		 * Progress at evenly spaced points across the average rate
+		 * window (a ring of fixed size, whatever the window length),
+		 * to compute the current average rate and windowed rate
+		 * percentiles from.
+		 */
+		struct {
+			int64_t elapsed_nsec;		/* time since start of transfer */
 			off_t transferred;		/* amount transferred by that time */
-		} *history;
-		size_t history_len;		 /* total size of history array */
-		size_t history_first;		 /* index of oldest entry */
-		size_t history_last;		 /* index of newest entry */
+		} window[PV_CALC_WINDOW_POINTS];
+		int64_t window_nsec;		 /* length of the average rate window */
+		int64_t window_step_nsec;	 /* time between points in the window */
+		unsigned int window_first;	 /* index of the oldest point */
+		unsigned int window_count;	 /* number of points in use */
+
+		/*
+		 * Rates remembered by "--history" from earlier transfers, to
+		 * mix in until the average rate window has filled.
+		 */
+		long double prior_rate;		 /* average rate, or 0 for none */
+		long double prior_ramp[PV_HISTORY_RAMP_SECONDS]; /* rate in each second from the start */
 
 		off_t prev_transferred;		 /* total amount transferred when called last time */
 
@@ -384,9 +937,16 @@ struct pvstate_s {
 		int y_lastread;		 /* last value of _y_top seen */
 		int y_offset;		 /* our Y offset from this top position */
 		int needreinit;		 /* counter if we need to reinit cursor pos */
+		int stage_slot;		 /* our stage slot in shared memory, or -1 */
+		int row;		 /* our row in shared memory, or -1 */
+		int drawn_y_start;	 /* y_start when we last drew as renderer */
+		unsigned int drawn[PV_CRS_MAX_STAGES]; /* row sequences we last drew */
+		/*@only@*/ /*@null@*/ char *batch; /* renderer's terminal output */
+		char bottleneck[PV_SIZEOF_CRS_BOTTLENECK]; /* summary for "--stats", if any */ /* flawfinder: ignore */
 #endif				/* HAVE_IPC */
 		int lock_fd;		 /* fd of lockfile, -1 if none open */
 		int y_start;		 /* our initial Y coordinate */
+		int y_lastwritten;	 /* Y coordinate of the last update, 0 if none */
 #ifdef HAVE_IPC
 		bool noipc;		 /* set if we can't use IPC */
 #endif				/* HAVE_IPC */
@@ -414,6 +974,26 @@ struct pvstate_s {
 	struct pvtransferstate_s {
 		long double elapsed_seconds;	 /* how long we have been transferring data for */
 		/*@only@*/ /*@null@*/ char *transfer_buffer;	 /* data transfer buffer */
+		/*@only@*/ /*@null@*/ struct pvpipeline_s *pipeline; /* reader thread, if running */
+		/*@only@*/ /*@null@*/ struct pvticker_s *ticker; /* ticker thread, if running */
+		/*@only@*/ /*@null@*/ struct pvuring_s *uring; /* io_uring, if in use */
+		/*@only@*/ /*@null@*/ struct pvdirectio_s *directio; /* --direct-io, if in use */
+		/*@only@*/ /*@null@*/ struct pvdropbehind_s *dropbehind; /* --drop-behind progress */
+		/*@only@*/ /*@null@*/ struct pvgroupsync_s *groupsync; /* --sync-every progress */
+		/*@only@*/ /*@null@*/ struct pvpipesize_s *pipesize; /* --pipe-size capacities */
+		/*@only@*/ /*@null@*/ struct pvbudget_s *budget; /* --rate-budget membership */
+		/*@only@*/ /*@null@*/ struct pvthrottle_s *throttle; /* --latency-target controller */
+		/*@only@*/ /*@null@*/ struct pvtrace_s *trace; /* --trace recorder */
+		/*@only@*/ /*@null@*/ struct pvhistory_s *history; /* --history key and ramp */
+		/*@only@*/ /*@null@*/ struct pvmmapin_s *mmapin; /* "--engine mmap" input mapping */
+		/*@only@*/ /*@null@*/ struct pvautoengine_s *autoengine; /* "--engine auto" trial */
+		/*@only@*/ /*@null@*/ struct pvrescue_s *rescue; /* --rescue map and progress */
+		/*@only@*/ /*@null@*/ struct pvcodec_s *codec; /* --compress or --decompress */
+		/*@only@*/ /*@null@*/ struct pvbufferpool_s *buffer_pool; /* for "-B auto" */
+		/*@only@*/ /*@null@*/ struct pvpoller_s *poller; /* readiness event queue */
+		/*@only@*/ /*@null@*/ struct pvlatency_s *latency; /* I/O latency histograms */
+		struct timespec wait_deadline;	 /* latest time to wait for I/O until */
+		struct timespec coalesce_since;	 /* when the data held back for --coalesce arrived */
 		size_t buffer_size;		 /* size of buffer */
 		size_t read_position;		 /* amount of data in buffer */
 		size_t write_position;		 /* buffered data written */
@@ -428,11 +1008,9 @@ struct pvstate_s {
 		off_t transferred;		 /* amount transferred (written - unconsumed) */
 
 		/* Keep track of line positions to backtrack written_but_not_consumed. */
-		/*@only@*/ /*@null@*/ off_t *line_positions; /* line separator write positions (circular buffer) */
-		size_t line_positions_capacity;	 /* total size of line position array */
-		size_t line_positions_length;	 /* number of positions stored in array */
-		size_t line_positions_head;	 /* index to use for next position */
+		/*@only@*/ /*@null@*/ struct pvlinepositions_s *line_positions; /* line separator write positions */
 		off_t last_output_position;	 /* write position last sent to output */
+		/*@only@*/ /*@null@*/ struct pvrecordscan_s *record_scan; /* --record framing position */
 
 		/*
 		 * While reading from a file descriptor we keep track of how
@@ -463,9 +1041,52 @@ struct pvstate_s {
 		 */
 		int splice_failed_fd;
 		bool splice_used;
+		/*
+		 * When the display needs to see the data, a pipe-to-pipe
+		 * transfer can still be spliced by first tee()ing the input
+		 * into tee_pipe, and reading the copy from there.
+		 * tee_pending is how many bytes have been copied into
+		 * tee_pipe but not yet spliced to the output; tee_checked_fd
+		 * is the input fd that tee_possible was worked out for.
+		 */
+		int tee_pipe[2];
+		size_t tee_pending;
+		int tee_checked_fd;
+		bool tee_possible;
+		bool tee_pipe_open;
+		/*
+		 * If splice() fails because neither end is a pipe, a
+		 * regular file input can still be copied in the kernel;
+		 * copy_method is how, for the input fd copy_checked_fd.
+		 */
+		int copy_checked_fd;
+		pvcopymethod_t copy_method;
 #endif
+		/*
+		 * In sparse output mode, the output is checked for zeroes in
+		 * blocks of sparse_block_size bytes, and holes in the input
+		 * are skipped without reading them.  hole_checked_fd is the
+		 * input fd that hole_check_possible was worked out for, and
+		 * input_data_start and input_data_end are the bounds of the
+		 * input's current data extent, as found by SEEK_DATA and
+		 * SEEK_HOLE.
+		 */
+		size_t sparse_block_size;
+		off_t input_data_start;
+		off_t input_data_end;
+		int hole_checked_fd;
+		int direct_checked_fd;		 /* input fd found unsuited to --direct-io */
+		int mmap_checked_fd;		 /* input fd found unsuited to "--engine mmap" */
+		int fast_checked_fd;		 /* input fd fast_eligible was worked out for */
+		pvtransferengine_t engine;	 /* engine which last moved data */
+		unsigned int engines_used;	 /* bit mask of 1 << each engine used */
+		bool hole_check_possible;
+		bool fast_eligible;		 /* the specialised transfer loops can be used */
 		bool read_error_warning_shown;
 		bool output_not_seekable;	/* set if lseek() fails on output */
+		bool output_dontwait;		/* set if writes to the output use MSG_DONTWAIT */
+		bool output_pipe;		/* set if writes are cut to the output pipe's room */
+		bool control_pending;		/* set when the control socket is readable */
 	} transfer;
 };
 
@@ -484,28 +1105,43 @@ typedef struct pvtransferstate_s *pvtransferstate_t;
  * Structure defining the current state of a single watched file descriptor.
  * The full definition needs to go here as it refers to sub-structures of
  * the main state, defined above.
+ *
+ * The display state is most of the memory needed for an fd, so it is only
+ * allocated when the fd is first shown (see pv_watchfd_prepare_display());
+ * fds which never fit on the screen cost little more than this structure.
  */
 struct pvwatchfd_s {
 	struct pvtransientflags_s flags;	/* transient flags */
 	struct pvtransferstate_s transfer;	/* transfer state */
 	struct pvtransfercalc_s calc;	 /* calculated transfer state */
-	struct pvdisplay_s display;	 /* display data */
+	/*@only@ */ /*@null@ */ struct pvdisplay_s *display; /* display data, once first shown */
 #ifdef __APPLE__
+	uint64_t vnode_ino;		 /* inode of the vnode the fd is open on */
+	uint32_t vnode_dev;		 /* device of that vnode */
 #else
 	char file_fdinfo[PV_SIZEOF_FILE_FDINFO]; /* path to /proc fdinfo file */
 	char file_fd[PV_SIZEOF_FILE_FD];	 /* path to /proc fd symlink  */
+	unsigned long long fdinfo_ino;	 /* "ino:" in the fdinfo, first read */
+	unsigned int fdinfo_flags;	 /* "flags:" in the fdinfo, first read */
+	int fdinfo_mnt_id;		 /* "mnt_id:" in the fdinfo, first read */
+	int fdinfo_fd;			 /* fdinfo file kept open, if fdinfo_open */
+	bool fdinfo_open;		 /* true if fdinfo_fd is open */
+	bool fdinfo_baseline;		 /* true once fdinfo_ino etc are set */
 #endif
-	char file_fdpath[PV_SIZEOF_FILE_FDPATH]; /* path to file that was opened */
+	/*@only@ */ /*@null@ */ char *file_fdpath; /* path to file that was opened */
 	/*@keep@ */ char display_name[PV_SIZEOF_DISPLAY_NAME]; /* name to show on progress bar */
 	struct stat sb_fd;		 /* stat of fd symlink */
 	struct stat sb_fd_link;		 /* lstat of fd symlink */
 	off_t size;			 /* size of whole file, 0 if unknown */
 	off_t position;			 /* position last seen at */
+	off_t initial_offset;		 /* position when first seen */
+	off_t recent;			 /* progress since the previous sample */
 	struct timespec start_time;	 /* time we started watching the fd */
 	struct timespec end_time;	 /* time the fd was marked as closed */
 	struct timespec total_stoppage_time;	 /* total time spent stopped */
 	pid_t watch_pid;		 /* PID the fd belongs to */
 	int watch_fd;			 /* fd to watch */
+	unsigned int display_line;	 /* line of the display it was last shown on */
 	bool closed;			 /* true once the fd is closed */
 	bool displayable;		 /* false if not displayable */
 	bool unused;			 /* true if free for re-use */
@@ -561,15 +1197,20 @@ void pv_error(char *, ...);
 
 int pv_main_loop(pvstate_t);
 void pv_calculate_transfer_rate(pvtransfercalc_t, readonly_pvtransferstate_t, readonly_pvcontrol_t, readonly_pvdisplay_t, bool);
+long double pv_calc_rate_percentile(readonly_pvtransfercalc_t, long double);
+void pv_calc_shift_baseline(pvtransfercalc_t, off_t);
 
 long pv_bound_long(long, long, long);
 long pv_seconds_remaining(const off_t, const off_t, const long double);
+size_t pv_describe_duration(char *, size_t, long, bool);
 void pv_si_prefix(long double *, char *, const long double, pvtransfercount_t);
 void pv_describe_amount(char *, size_t, char *, long double, char *, char *, pvtransfercount_t);
 
 int8_t pv_display_barstyle_index(pvformatter_args_t, const char *);
 
 pvdisplay_bytecount_t pv_formatter_segmentcontent(char *, pvformatter_args_t);
+bool pv_formatter_precompute(pvformatter_args_t, const char *, pvdisplay_bytecount_t, int8_t);
+pvdisplay_bytecount_t pv_formatter_precomputed(pvformatter_args_t);
 
 /*
  * Formatting functions.
@@ -609,21 +1250,190 @@ pvdisplay_bytecount_t pv_formatter_bytes(pvformatter_args_t);
 pvdisplay_bytecount_t pv_formatter_buffer_percent(pvformatter_args_t);
 pvdisplay_bytecount_t pv_formatter_last_written(pvformatter_args_t);
 pvdisplay_bytecount_t pv_formatter_previous_line(pvformatter_args_t);
+
+void pv_capture_add(pvdisplay_t, const char *, size_t);
+void pv_capture_last_written(pvdisplay_t);
+void pv_capture_previous_line(pvdisplay_t, char);
 pvdisplay_bytecount_t pv_formatter_name(pvformatter_args_t);
+pvdisplay_bytecount_t pv_formatter_outputs(pvformatter_args_t);
+pvdisplay_bytecount_t pv_formatter_raw_rate(pvformatter_args_t);
+pvdisplay_bytecount_t pv_formatter_compressed_rate(pvformatter_args_t);
+pvdisplay_bytecount_t pv_formatter_ratio(pvformatter_args_t);
 pvdisplay_bytecount_t pv_formatter_sgr(pvformatter_args_t);
 
+bool pv_format_contains_name(const char *);
 bool pv_format (pvprogramstatus_t, readonly_pvcontrol_t,
 		readonly_pvtransferstate_t, readonly_pvtransfercalc_t,
 		/*@null@ */ const char *, pvdisplay_t, bool, bool);
+void pv_format_cache_free(pvprogramstatus_t);
 void pv_display (pvprogramstatus_t, readonly_pvcontrol_t, pvtransientflags_t,
 		 readonly_pvtransferstate_t, pvtransfercalc_t,
 		 pvcursorstate_t, pvdisplay_t, /*@null@ */ pvdisplay_t, bool);
 
 ssize_t pv_transfer(pvstate_t, int, bool *, bool *, off_t, long *);
+void pv_transfer_output_check(pvstate_t, int);
+void pv_transfer_engines_show(pvstate_t);
+bool pv_autoengine_select(pvstate_t, int);
+void pv_autoengine_measured(pvstate_t, long long, ssize_t);
+void pv_autoengine_free(pvtransferstate_t);
+/*@null@*/ /*@only@*/ char *pv_allocate_aligned_buffer(pvcontrol_t, int, int, size_t);
+void pv_free_aligned_buffer(/*@only@*/ /*@null@*/ char *, size_t);
+void pv_numa_place(pvstate_t, int, int);
+void pv_numa_bind_buffer(void *, size_t);
+void pv_buffer_adapt_record(pvtransferstate_t, size_t, ssize_t, const struct timespec *);
+void pv_buffer_adapt(pvstate_t, int);
+void pv_buffer_adapt_free(pvtransferstate_t);
+int pv_poller_wait(pvtransferstate_t, int, /*@null@ */ bool *, int, /*@null@ */ bool *, long);
+void pv_poller_forget(pvtransferstate_t, int);
+void pv_poller_control_set(pvtransferstate_t, int);
+void pv_poller_free(pvtransferstate_t);
+void pv_statspage_update(pvstate_t, bool);
+bool pv_statspage_fetch(pvstate_t, pid_t, /*@null@ */ off_t *);
+void pv_statspage_free(pvstate_t);
+void pv_statsout_write(pvstate_t, bool);
+void pv_statsout_event(pvstate_t, const char *, const char *);
+void pv_stall_check(pvstate_t, bool);
+void pv_stall_free(pvstate_t);
+void pv_metrics_update(pvstate_t, bool);
+void pv_metrics_free(pvstate_t);
+const char *pv_digest_name(pvdigest_t);
+void pv_digest_update(pvstate_t, const char *, size_t);
+bool pv_digest_hex(pvstate_t, char *, size_t);
+bool pv_digest_save(pvstate_t, char *, size_t);
+bool pv_digest_restore(pvstate_t, const char *);
+void pv_digest_free(pvstate_t);
+void pv_fanout_write(pvstate_t, const char *, size_t);
+void pv_fanout_describe(pvformatter_args_t, char *, size_t);
+void pv_fanout_free(pvstate_t);
+
+void pv_spool_check(pvstate_t);
+#ifdef HAVE_PTHREAD
+void pv_spool_update(pvstate_t);
+#endif
+void pv_latency_record(pvtransferstate_t, pvlatencykind_t, const struct timespec *);
+long double pv_latency_total(readonly_pvtransferstate_t, pvlatencykind_t);
+long double pv_latency_recent(pvtransferstate_t, pvlatencykind_t, long double, uint64_t *);
+void pv_latency_show(pvstate_t);
+size_t pv_latency_json(readonly_pvtransferstate_t, char *, size_t);
+void pv_latency_free(pvtransferstate_t);
+void pv_profile_enable(bool);
+uint64_t pv_profile_begin(void);
+void pv_profile_end(pvprofilephase_t, uint64_t);
+void pv_profile_show(pvstate_t);
+size_t pv_linescan_count(const char *, size_t, char);
+size_t pv_linescan_find(const char *, size_t, char, size_t *, size_t, size_t *);
+size_t pv_linescan_cut(const char *, size_t, char, size_t);
+bool pv_zeroscan_all(const char *, size_t);
+size_t pv_zeroscan_run(const char *, size_t, size_t, bool);
+
+#ifdef HAVE_PTHREAD
+bool pv_pipeline_start(pvtransferstate_t, pvcontrol_t, int, int, unsigned int, size_t, off_t);
+void pv_pipeline_stop(pvtransferstate_t);
+ssize_t pv_pipeline_fetch(pvtransferstate_t, long, int *);
+bool pv_ticker_start(pvtransferstate_t, const struct timespec *);
+void pv_ticker_schedule(pvtransferstate_t, const struct timespec *);
+bool pv_ticker_next(pvtransferstate_t, struct timespec *);
+bool pv_ticker_due(pvtransferstate_t);
+void pv_ticker_stop(pvtransferstate_t);
+#endif
+#ifdef HAVE_PTHREAD
+bool pv_directio_start(pvstate_t, int);
+void pv_directio_stop(pvtransferstate_t);
+int pv_directio_input_fd(readonly_pvtransferstate_t);
+ssize_t pv_directio_fetch(pvtransferstate_t, long, char **, int *);
+void pv_directio_consume(pvtransferstate_t, size_t);
+size_t pv_directio_output_block(readonly_pvtransferstate_t);
+void pv_directio_output_buffered(pvtransferstate_t);
+#endif
+void pv_dropbehind_update(pvstate_t, int);
+void pv_dropbehind_input_done(pvstate_t, int);
+void pv_dropbehind_finish(pvstate_t, int);
+void pv_dropbehind_free(pvtransferstate_t);
+bool pv_blkdev_probe(int, struct pvblkdev_s *);
+size_t pv_blkdev_buffer_size(int, size_t, size_t);
+bool pv_groupsync_update(pvstate_t, ssize_t);
+void pv_groupsync_finish(pvstate_t);
+void pv_groupsync_free(pvtransferstate_t);
+void pv_pipesize_update(pvstate_t, int, const struct timespec *);
+void pv_pipesize_show(pvstate_t);
+void pv_pipesize_free(pvtransferstate_t);
+long double pv_budget_rate(pvstate_t, long double);
+void pv_budget_held_back(pvstate_t);
+void pv_budget_free(pvtransferstate_t);
+void pv_throttle_update(pvstate_t, const struct timespec *);
+void pv_throttle_show(pvstate_t);
+void pv_throttle_free(pvtransferstate_t);
+bool pv_trace_start(pvstate_t);
+void pv_trace_record(pvtransferstate_t, pvtracekind_t, int, long long, /*@null@*/ const struct timespec *);
+void pv_trace_free(pvtransferstate_t);
+void pv_history_start(pvstate_t, int, int);
+void pv_history_sample(pvstate_t);
+void pv_history_finish(pvstate_t, bool);
+void pv_history_free(pvtransferstate_t);
+bool pv_linesample_start(pvstate_t);
+void pv_linesample_update(pvstate_t);
+void pv_linesample_show(pvstate_t);
+void pv_linesample_free(pvstate_t);
+#ifdef HAVE_MMAP
+bool pv_mmapin_start(pvstate_t, int);
+void pv_mmapin_stop(pvtransferstate_t);
+int pv_mmapin_input_fd(readonly_pvtransferstate_t);
+ssize_t pv_mmapin_fetch(pvstate_t, char **);
+void pv_mmapin_consume(pvstate_t, size_t);
+bool pv_mmapin_splice_output(readonly_pvtransferstate_t);
+void pv_mmapin_no_splice(pvtransferstate_t);
+#endif
+ssize_t pv_rescue_transfer(pvstate_t, int, bool *, bool *, off_t);
+void pv_rescue_finish(pvstate_t);
+void pv_rescue_free(pvtransferstate_t);
+const char *pv_codec_name(pvcodec_t);
+ssize_t pv_codec_read(pvstate_t, int, char *, size_t);
+bool pv_codec_holding(readonly_pvtransferstate_t);
+void pv_codec_update(pvstate_t);
+bool pv_codec_rates(readonly_pvtransferstate_t, long double *, long double *, long double *);
+void pv_codec_free(pvtransferstate_t);
+bool pv_net_queued(int, size_t *);
+int pv_net_open_streams(const char *, bool, size_t, int *, unsigned int);
+int pv_stripe_input_open(pvstate_t, const char *, unsigned int, size_t);
+size_t pv_stripe_queued(pvstate_t);
+void pv_stripe_finish(pvstate_t);
+void pv_stripe_free(pvstate_t);
+int pv_checkpoint_start(pvstate_t, unsigned int *, int);
+void pv_checkpoint_input_opened(pvstate_t, unsigned int, int);
+void pv_checkpoint_update(pvstate_t, ssize_t);
+void pv_checkpoint_finish(pvstate_t, bool);
+void pv_checkpoint_free(pvstate_t);
+#ifdef HAVE_LINUX_IO_URING_H
+bool pv_uring_start(pvstate_t, int);
+void pv_uring_stop(pvtransferstate_t);
+ssize_t pv_uring_transfer(pvstate_t, int, bool *, bool *, off_t);
+#endif
+off_t pv_prescan_count(pvstate_t);
+#ifdef HAVE_PTHREAD
+bool pv_prescan_start(pvstate_t);
+void pv_prescan_update(pvstate_t);
+void pv_prescan_stop(pvstate_t);
+bool pv_prefetch_take(pvstate_t, unsigned int, int *, int *);
+void pv_prefetch_stop(pvstate_t);
+bool pv_sizescan_start(pvstate_t);
+void pv_sizescan_update(pvstate_t);
+void pv_sizescan_stop(pvstate_t);
+#endif
+/*@null@*/ /*@only@*/ struct pvlinepositions_s *pv_linepos_alloc(void);
+void pv_linepos_reset(/*@null@*/ struct pvlinepositions_s *);
+void pv_linepos_free(/*@only@*/ /*@null@*/ struct pvlinepositions_s *);
+void pv_linepos_add(struct pvlinepositions_s *, off_t);
+size_t pv_linepos_count_after(/*@null@*/ const struct pvlinepositions_s *, off_t);
+bool pv_record_spec_parse(const char *, struct pvrecordframing_s *);
+void pv_record_reset(/*@null@*/ struct pvrecordscan_s *);
+void pv_record_free(/*@only@*/ /*@null@*/ struct pvrecordscan_s *);
+size_t pv_record_count(pvstate_t, const char *, size_t);
+size_t pv_record_boundary(pvstate_t, const char *, size_t, off_t);
+int pv_calc_file_bytes(const char *, off_t *);
 int pv_next_file(pvstate_t, unsigned int, int);
 /*@keep@*/ const char *pv_current_file_name(pvstate_t);
 
-unsigned int pv_update_calc_average_rate_window(pvtransfercalc_t, unsigned int);
+void pv_update_calc_average_rate_window(pvtransfercalc_t, unsigned int);
 void pv_reset_calc(pvtransfercalc_t);
 void pv_reset_transfer(pvtransferstate_t);
 void pv_reset_flags(pvtransientflags_t);
@@ -637,12 +1447,16 @@ void pv_freecontents_watchfd_items(struct pvwatcheditem_s *, unsigned int);
 
 void pv_write_retry(int, const char *, size_t);
 void pv_tty_write(readonly_pvtransientflags_t, const char *, size_t);
+void pv_tty_frame_begin(void);
+void pv_tty_frame_end(readonly_pvtransientflags_t, bool);
+void pv_tty_frame_free(void);
 
 void pv_crs_fini(pvcursorstate_t, readonly_pvcontrol_t, pvtransientflags_t);
 void pv_crs_init(pvcursorstate_t, readonly_pvcontrol_t, pvtransientflags_t);
-void pv_crs_update(pvcursorstate_t, readonly_pvcontrol_t, pvtransientflags_t, const char *);
+bool pv_crs_update(pvcursorstate_t, readonly_pvcontrol_t, pvtransientflags_t, const char *);
 #ifdef HAVE_IPC
 void pv_crs_needreinit(pvcursorstate_t);
+void pv_crs_publish(pvcursorstate_t, readonly_pvcontrol_t, readonly_pvtransferstate_t);
 #endif
 
 void pv_sig_allowpause(void);
@@ -650,11 +1464,21 @@ void pv_sig_checkbg(void);
 void pv_sig_nopause(void);
 
 bool pv_remote_check(pvstate_t);
+void pv_ctlsock_service(pvstate_t, const struct timespec *, bool, /*@null@ */ struct timespec *);
+void pv_ctlsock_free(pvstate_t);
+int pv_ctlsock_request(pid_t, const char *, char *, size_t);
+bool pv_ctlsock_append(char *, size_t, size_t *, const char *, const char *);
+bool pv_ctlsock_reply_value(const char *, const char *, char *, size_t);
 
 int pv_watchfd_info(pvstate_t, pvwatchfd_t, bool);
+bool pv_watchfd_prepare_display(pvstate_t, pvwatchfd_t);
 bool pv_watchfd_changed(pvwatchfd_t);
 off_t pv_watchfd_position(pvwatchfd_t);
-int pv_watchpid_scanfds(pvstate_t, pid_t, int, int *, pvwatchfd_t *);
+int pv_watchpid_scanfds(pvstate_t, struct pvwatcheditem_s *);
+void pv_watchpid_notify_init(pvstate_t);
+bool pv_watchpid_notify_wait(pvstate_t, long long);
+void pv_watchpid_notify_free(pvstate_t);
+bool pv_watchpid_tree_scan(pvstate_t);
 void pv_watchpid_setname(pvstate_t, pvwatchfd_t);
 
 #ifdef __cplusplus
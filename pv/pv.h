@@ -51,6 +51,88 @@ typedef enum {
   PV_NUMTYPE_BARE_DOUBLE
 } pv_numtype;
 
+/*
+ * I/O engines that can be selected with --engine.
+ */
+typedef enum {
+  PV_IOENGINE_AUTO,
+  PV_IOENGINE_READWRITE,
+  PV_IOENGINE_IO_URING,
+  PV_IOENGINE_MMAP
+} pvioengine_t;
+
+/*
+ * Value of "--numa-node auto", which picks the node of the input or output
+ * device.
+ */
+#define PV_NUMA_NODE_AUTO -2
+
+/*
+ * Record formats that can be selected with --stats-format.
+ */
+typedef enum {
+  PV_STATSFORMAT_JSON,
+  PV_STATSFORMAT_BINARY
+} pvstatsformat_t;
+
+/*
+ * Ways of estimating the rate for the ETA, selected with --eta-model.
+ */
+typedef enum {
+  PV_ETAMODEL_AVERAGE,
+  PV_ETAMODEL_LINEAR,
+  PV_ETAMODEL_EWMA,
+  PV_ETAMODEL_PHASE
+} pvetamodel_t;
+
+/*
+ * Digests of the output that can be computed with --digest.
+ */
+typedef enum {
+  PV_DIGEST_NONE,
+  PV_DIGEST_CRC32C,
+  PV_DIGEST_XXH64,
+  PV_DIGEST_SHA256
+} pvdigest_t;
+
+/*
+ * Codecs that the data can be passed through with --compress or
+ * --decompress.
+ */
+typedef enum {
+  PV_CODEC_NONE,
+  PV_CODEC_ZSTD,
+  PV_CODEC_LZ4
+} pvcodec_t;
+
+/*
+ * What to do about an extra "-o" output that can't keep up, selected with
+ * --fanout-policy.
+ */
+typedef enum {
+  PV_FANOUT_WAIT,
+  PV_FANOUT_DROP
+} pvfanoutpolicy_t;
+
+/*
+ * Observer of a transfer's progress, called by the display scheduler at
+ * every display interval, and once more at the end with the third argument
+ * true, with read-only views of the transfer state and the calculated
+ * rates (defined in pv-internal.h), which are only valid during the call.
+ * Observers are called whether or not there is a terminal display, and
+ * no display string is built for them.
+ */
+struct pvtransferstate_s;
+struct pvtransfercalc_s;
+typedef void (*pvobserverfn_t)(const struct pvtransferstate_s *, const struct pvtransfercalc_s *, bool,
+			       /*@null@*/ void *);
+
+/*
+ * Function called with each error message, without a trailing newline,
+ * instead of it being written to standard error.
+ */
+typedef void (*pverrorfn_t)(const char *, /*@null@*/ void *);
+
 
 /*
  * Simple string functions for processing numbers.
@@ -86,6 +168,30 @@ extern unsigned int pv_getnum_count(const char *, bool);
  */
 extern bool pv_getnum_check(const char *, pv_numtype);
 
+/*
+ * Return true if the given string is a processor list, such as "0-7,16",
+ * that --cpu-affinity can use.
+ */
+extern bool pv_numa_cpulist_valid(const char *);
+
+/*
+ * Return true if the given string is a record framing, such as "fixed:512"
+ * or "delim:\r\n", that --record can use.
+ */
+extern bool pv_record_spec_valid(const char *);
+
+/*
+ * Return true if the given string can name a budget that --rate-budget
+ * shares between processes.
+ */
+extern bool pv_budget_name_valid(const char *);
+
+/*
+ * Return true if the given string is "all" or a comma separated list of
+ * process IDs, that --query can watch at once.
+ */
+extern bool pv_query_targets_valid(const char *);
+
 /*
  * Return a value representing the first amount as a percentage of the
  * second total, i.e. 100*amount/total.  If the second value, the total, is
@@ -144,6 +250,19 @@ extern bool pv_isprint(char);
  */
 void pv_elapsedtime_read(struct timespec *);
 
+/* Return the current elapsed time as a whole number of nanoseconds. */
+long long pv_elapsedtime_nsec(void);
+
+/*
+ * Return a cheaper, lower resolution elapsed time in nanoseconds, which
+ * may only be compared with other readings from this function.
+ */
+long long pv_elapsedtime_coarse_nsec(void);
+
+/* Convert between a timespec and a whole number of nanoseconds. */
+long long pv_elapsedtime_to_nsec(const struct timespec *);
+void pv_elapsedtime_from_nsec(struct timespec *, long long);
+
 /* Set the time in the given timespec to zero. */
 void pv_elapsedtime_zero(struct timespec *);
 
@@ -181,6 +300,12 @@ void pv_nanosleep(long long);
  */
 extern void pv_set_error_prefix(/*@unique@ */ const char *);
 
+/*
+ * Send the error messages of the calling thread to the given function
+ * instead of standard error, or back to standard error if it is NULL.
+ */
+extern void pv_set_error_handler(/*@null@*/ pverrorfn_t, /*@null@*/ void *);
+
 /*
  * Create a new state structure, and return it, or 0 (NULL) on error.
  */
@@ -208,6 +333,14 @@ extern void pv_state_set_format(pvstate_t state, bool progress,
 extern void pv_state_force_set(pvstate_t, bool);
 extern void pv_state_cursor_set(pvstate_t, bool);
 extern void pv_state_show_stats_set(pvstate_t, bool);
+extern void pv_state_self_profile_set(pvstate_t, bool);
+extern void pv_state_huge_pages_set(pvstate_t, bool);
+extern void pv_state_lock_buffers_set(pvstate_t, bool);
+extern void pv_state_numa_node_set(pvstate_t, int);
+extern void pv_state_cpu_affinity_set(pvstate_t, /*@null@ */ const char *);
+extern void pv_state_manifest_set(pvstate_t, /*@null@ */ const char *);
+extern void pv_state_copy_into_set(pvstate_t, /*@null@ */ const char *);
+extern void pv_state_jobs_set(pvstate_t, unsigned int);
 extern void pv_state_numeric_set(pvstate_t, bool);
 extern void pv_state_wait_set(pvstate_t, bool);
 extern void pv_state_delay_start_set(pvstate_t, double);
@@ -216,16 +349,47 @@ extern void pv_state_linemode_set(pvstate_t, bool);
 extern void pv_state_bits_set(pvstate_t, bool);
 extern void pv_state_decimal_units_set(pvstate_t, bool);
 extern void pv_state_null_terminated_lines_set(pvstate_t, bool);
+extern void pv_state_record_set(pvstate_t, /*@null@ */ const char *);
+extern void pv_state_embedded_set(pvstate_t, bool);
+extern void pv_state_input_fd_set(pvstate_t, int);
+extern bool pv_state_observer_add(pvstate_t, pvobserverfn_t, /*@null@ */ void *);
+extern void pv_state_observer_remove(pvstate_t, pvobserverfn_t, /*@null@ */ void *);
 extern void pv_state_no_display_set(pvstate_t, bool);
 extern void pv_state_skip_errors_set(pvstate_t, unsigned int);
 extern void pv_state_error_skip_block_set(pvstate_t, off_t);
 extern void pv_state_stop_at_size_set(pvstate_t, bool);
 extern void pv_state_sync_after_write_set(pvstate_t, bool);
 extern void pv_state_direct_io_set(pvstate_t, bool);
+extern void pv_state_drop_behind_set(pvstate_t, bool);
+extern void pv_state_rescue_map_set(pvstate_t, /*@null@*/ const char *);
+extern void pv_state_rescue_retries_set(pvstate_t, unsigned int);
+extern void pv_state_rescue_direct_set(pvstate_t, bool);
+extern void pv_state_checkpoint_file_set(pvstate_t, /*@null@*/ const char *);
+extern void pv_state_streams_set(pvstate_t, unsigned int);
+extern void pv_state_codec_set(pvstate_t, pvcodec_t, bool, int);
 extern void pv_state_sparse_output_set(pvstate_t, bool);
 extern void pv_state_rate_limit_set(pvstate_t, off_t);
+extern void pv_state_rate_burst_set(pvstate_t, off_t);
+extern void pv_state_rate_budget_set(pvstate_t, /*@null@*/ const char *, unsigned int);
+extern void pv_state_throttle_set(pvstate_t, double, unsigned int);
 extern void pv_state_target_buffer_size_set(pvstate_t, size_t);
+extern void pv_state_adaptive_buffer_set(pvstate_t, bool);
 extern void pv_state_no_splice_set(pvstate_t, bool);
+extern void pv_state_pipeline_buffers_set(pvstate_t, unsigned int);
+extern void pv_state_io_engine_set(pvstate_t, pvioengine_t);
+extern void pv_state_stats_page_set(pvstate_t, bool);
+extern void pv_state_stats_output_set(pvstate_t, int, pvstatsformat_t);
+extern void pv_state_metrics_file_set(pvstate_t, /*@null@*/ const char *);
+extern void pv_state_trace_file_set(pvstate_t, /*@null@*/ const char *);
+extern void pv_state_history_file_set(pvstate_t, /*@null@*/ const char *);
+extern void pv_state_engine_cache_set(pvstate_t, /*@null@*/ const char *);
+extern void pv_state_coalesce_set(pvstate_t, double, size_t);
+extern void pv_state_sync_group_set(pvstate_t, off_t, double);
+extern void pv_state_pipe_size_set(pvstate_t, size_t, bool);
+extern void pv_state_line_estimate_set(pvstate_t, bool);
+extern void pv_state_stall_timeout_set(pvstate_t, double);
+extern void pv_state_rate_drop_set(pvstate_t, unsigned int);
+extern void pv_state_stall_command_set(pvstate_t, /*@null@*/ const char *);
 extern void pv_state_discard_input_set(pvstate_t, bool);
 extern void pv_state_size_set(pvstate_t, off_t);
 extern void pv_state_interval_set(pvstate_t, double);
@@ -237,10 +401,14 @@ extern void pv_state_format_string_set(pvstate_t, /*@null@*/ const char *);
 extern void pv_state_extra_display_set(pvstate_t, /*@null@*/ const char *);
 extern void pv_state_output_set(pvstate_t, int, const char *);
 extern void pv_state_average_rate_window_set(pvstate_t, unsigned int);
+extern void pv_state_eta_model_set(pvstate_t, pvetamodel_t);
+extern void pv_state_digest_set(pvstate_t, pvdigest_t);
+extern void pv_state_fanout_policy_set(pvstate_t, pvfanoutpolicy_t);
 extern void pv_state_set_terminal_supports_utf8(pvstate_t, bool);
 
 extern void pv_state_inputfiles(pvstate_t, unsigned int, const char **);
 extern void pv_state_watchfds(pvstate_t, unsigned int, const pid_t *, const int *);
+extern void pv_state_watch_tree_set(pvstate_t, bool);
 
 /*
  * Work out whether we are in the foreground.
@@ -257,6 +425,81 @@ extern void pv_screensize(unsigned int *width, unsigned int *height);
  */
 extern off_t pv_calc_total_size(pvstate_t);
 
+/*
+ * Start calculating the total size of all input files in the background,
+ * returning false if the caller should use pv_calc_total_size() instead.
+ */
+extern bool pv_calc_total_size_start(pvstate_t);
+
+/*
+ * Return the size of the disk device open on the given descriptor, or -1
+ * if it isn't one or its size can't be found.
+ */
+extern off_t pv_blkdev_size(int);
+
+/*
+ * Return the size the gzip, zstd, or xz file with the given name, or open
+ * on the given descriptor, will be once decompressed, as recorded in the
+ * file, or -1 if that isn't known.
+ */
+extern off_t pv_sizehint_file(const char *);
+extern off_t pv_sizehint_fd(int);
+
+/*
+ * Create the temporary spool for store-and-forward mode, keeping up to the
+ * given number of bytes in memory, and return a descriptor to write to it
+ * with, or -1 on error.
+ */
+extern int pv_spool_create(pvstate_t, off_t);
+
+/*
+ * Rewind the spool, returning the name to read it back from.
+ */
+/*@null@*/ /*@observer@*/ extern const char *pv_spool_rewind(pvstate_t);
+
+/* Add an extra output for the transfer to be written to. */
+extern bool pv_fanout_add(pvstate_t, int, const char *);
+
+/* Hold back, or let through, writes to the extra outputs. */
+extern void pv_fanout_hold(pvstate_t, bool);
+
+/*
+ * Return true if the name is a network address such as "tcp://host:port"
+ * rather than a file name.
+ */
+extern bool pv_net_is_address(/*@null@*/ const char *);
+
+/*
+ * Connect to a network address, or accept a connection on it, returning
+ * the connected socket, or reporting the error and returning -1.
+ */
+extern int pv_net_open(const char *, bool, size_t);
+
+/*
+ * Connect to a network address with the given number of parallel streams,
+ * and return a descriptor to write the data to, which is split across
+ * them, or -1 on error.
+ */
+extern int pv_stripe_output_open(pvstate_t, const char *, unsigned int, size_t);
+
+/*
+ * Start storing the input in the given file (or an unnamed temporary file
+ * if NULL) in the background, forwarding it once the given number of bytes
+ * have been stored; returns the name to read the forwarded data from.
+ */
+/*@null@*/ /*@observer@*/ extern const char *pv_spool_forward_start(pvstate_t, /*@null@*/ const char *, off_t);
+
+/*
+ * Wait for the background store-and-forward to finish, and return the
+ * updated exit status.
+ */
+extern int pv_spool_forward_finish(pvstate_t);
+
+/*
+ * Close and free the spool.
+ */
+extern void pv_spool_free(pvstate_t);
+
 /*
  * Set up signal handlers ready for running the main loop.
  */
@@ -282,6 +525,12 @@ extern bool pv_sigusr1_received(pvstate_t, pid_t *);
 /*@dependent@ */
 extern FILE *pv_open_controlfile(char *, size_t, pid_t, int, bool);
 
+/*
+ * Fill in the name of a per-process runtime file, such as a stats page or
+ * control socket.
+ */
+extern bool pv_runtime_filename(char *, size_t, const char *, pid_t, bool, bool);
+
 /*
  * Enter the main transfer loop, transferring all input files to the output.
  */
@@ -297,6 +546,21 @@ extern int pv_watchfd_loop(pvstate_t);
  */
 extern int pv_query_loop(pvstate_t, pid_t);
 
+/*
+ * Watch the progress of several other pv processes at once.
+ */
+extern int pv_query_multi_loop(pvstate_t, const char *);
+
+/*
+ * Copy each input file to its own output, several at a time.
+ */
+extern int pv_multistream_loop(pvstate_t);
+
+/*
+ * Write a "--trace" file out as JSON for trace viewers.
+ */
+extern int pv_trace_decode(const char *);
+
 /*
  * Set the options of another pv process.
  */
@@ -310,6 +574,12 @@ int pv_remote_set(pvstate_t, pid_t);
  */
 int pv_remote_transferstate_fetch(pvstate_t state, pid_t query, /*@null@ */ off_t *sizeptr, bool silent);
 
+/*
+ * As above, but only using the other process's stats page or control
+ * socket, never signals, and returning true on success.
+ */
+bool pv_remote_transferstate_peek(pvstate_t state, pid_t query, /*@null@ */ off_t *sizeptr);
+
 /*
  * Shut down signal handlers after running the main loop.
  */
@@ -0,0 +1,606 @@
+/*
+ * Query mode for several processes at once, for "--query" with a list of
+ * process IDs or with "all": a progress line for each other pv, and one
+ * for the total, drawn together as one frame.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+
+/* Most processes watched at once. */
+#define PV_QUERYMULTI_MAX_TARGETS	1024
+
+/* Time between looks for new processes with "all", in nanoseconds. */
+#define PV_QUERYMULTI_RESCAN_NSEC	1000000000LL
+
+/* Longest wait between checks for the end, in nanoseconds. */
+#define PV_QUERYMULTI_POLL_NSEC		50000000LL
+
+/*
+ * One process being watched.
+ */
+struct pvquerytarget_s {
+	pid_t pid;			 /* process ID of the other pv */
+	struct pvtransientflags_s flags; /* display flags for this process */
+	struct pvtransferstate_s transfer; /* its progress, as last fetched */
+	struct pvtransfercalc_s calc;	 /* rate calculations for it */
+	/*@only@ */ /*@null@ */ struct pvdisplay_s *display; /* display, once first shown */
+	char display_name[PV_SIZEOF_DISPLAY_NAME]; /* flawfinder: ignore */
+	off_t size;			 /* its expected size, 0 if unknown */
+	bool discovered;		 /* found by a scan, not named by the user */
+	bool fetched;			 /* set once its state has been read */
+	bool gone;			 /* set once it has exited */
+};
+
+/*
+ * flawfinder rationale: display_name is only written by pv_snprintf(),
+ * which always bounds and terminates it.
+ */
+
+/*
+ * The set of processes being watched; with "discover" set, the runtime
+ * directories are scanned every so often for more.
+ */
+struct pvquerymulti_s {
+	/*@only@ */ /*@null@ */ struct pvquerytarget_s *target;
+	unsigned int count;		 /* number of targets */
+	unsigned int allocated;		 /* targets allocated */
+	bool discover;			 /* look for every pv of this user */
+};
+
+
+/*
+ * Return true if process "pid" is already being watched.
+ */
+static bool pv__querymulti_known(const struct pvquerymulti_s *qm, pid_t pid)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < qm->count; idx++) {
+		if (qm->target[idx].pid == pid)
+			return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * Start watching process "pid", unless it is already watched or is this
+ * process.  Returns false on error.
+ */
+static bool pv__querymulti_add(struct pvquerymulti_s *qm, pid_t pid, bool discovered)
+{
+	struct pvquerytarget_s *target;
+
+	if ((pid < 1) || (pid == getpid()) || pv__querymulti_known(qm, pid))
+		return true;
+	if (qm->count >= PV_QUERYMULTI_MAX_TARGETS)
+		return true;
+
+	if (qm->count >= qm->allocated) {
+		struct pvquerytarget_s *new_array;
+		unsigned int new_allocated = qm->allocated < 16 ? 16 : qm->allocated * 2;
+
+		new_array = realloc(qm->target, new_allocated * sizeof(*new_array));
+		if (NULL == new_array)
+			return false;
+		qm->target = new_array;
+		qm->allocated = new_allocated;
+	}
+
+	target = &(qm->target[qm->count]);
+	memset(target, 0, sizeof(*target));
+	target->pid = pid;
+	target->discovered = discovered;
+	(void) pv_snprintf(target->display_name, sizeof(target->display_name), "%u", (unsigned int) pid);
+	pv_reset_calc(&(target->calc));
+	pv_reset_transfer(&(target->transfer));
+
+	qm->count++;
+
+	debug("%s: %d", "watching", pid);
+
+	return true;
+}
+
+
+/*
+ * Return true if "targets" is "all", or a comma separated list of process
+ * IDs.
+ */
+bool pv_query_targets_valid(const char *targets)
+{
+	const char *next;
+
+	if (0 == strcmp(targets, "all"))
+		return true;
+
+	next = targets;
+	while (true) {
+		if (('0' > *next) || ('9' < *next))
+			return false;
+		while (('0' <= *next) && ('9' >= *next))
+			next++;
+		if ('\0' == *next)
+			return true;
+		if (',' != *next)
+			return false;
+		next++;
+	}
+}
+
+
+/*
+ * Fill in the targets from the "--query" argument, which is either "all"
+ * or a comma separated list of process IDs.  Returns false on error.
+ */
+static bool pv__querymulti_parse(struct pvquerymulti_s *qm, const char *targets)
+{
+	const char *next;
+
+	if (0 == strcmp(targets, "all")) {
+		qm->discover = true;
+		return true;
+	}
+
+	next = targets;
+	while ('\0' != *next) {
+		char *end = NULL;
+		long pid;
+
+		pid = strtol(next, &end, 10);
+		if ((NULL == end) || (end == next))
+			break;
+		if (!pv__querymulti_add(qm, (pid_t) pid, false))
+			return false;
+		next = end;
+		if (',' == *next)
+			next++;
+	}
+
+	return true;
+}
+
+
+/*
+ * Add every live process with a runtime file of the given "kind" - a stats
+ * page or a control socket - in the directory "fallback" selects, as
+ * described by pv_runtime_filename().  Returns false on error.
+ */
+static bool pv__querymulti_scan(struct pvquerymulti_s *qm, const char *kind, bool fallback)
+{
+	char path[PV_SIZEOF_STATSPAGE_FILENAME];	/* flawfinder: ignore - bounded by pv_snprintf() */
+	char *separator;
+	const char *prefix;
+	size_t prefix_length;
+	DIR *dir;
+	struct dirent *entry;
+	bool ok;
+
+	/*
+	 * The name for process 0 gives both the directory and the prefix of
+	 * each file in it, with the "0" at the end standing in for the PID.
+	 */
+	if (!pv_runtime_filename(path, sizeof(path), kind, 0, fallback, false))
+		return true;
+	separator = strrchr(path, '/');
+	if (NULL == separator)
+		return true;
+	*separator = '\0';
+	prefix = separator + 1;
+	prefix_length = strlen(prefix);	/* flawfinder: ignore - always terminated */
+	if ((prefix_length < 1) || ('0' != prefix[prefix_length - 1]))
+		return true;
+	prefix_length--;
+
+	dir = opendir(path);
+	if (NULL == dir)
+		return true;
+
+	ok = true;
+	while (ok && (NULL != (entry = readdir(dir)))) {
+		const char *digits;
+		char *end = NULL;
+		long pid;
+
+		if (0 != strncmp(entry->d_name, prefix, prefix_length))
+			continue;
+		digits = entry->d_name + prefix_length;
+		if (('\0' == *digits) || ('0' > *digits) || ('9' < *digits))
+			continue;
+		pid = strtol(digits, &end, 10);
+		if ((NULL == end) || ('\0' != *end) || (pid < 1))
+			continue;
+		/* Files left behind by processes that died are ignored. */
+		if (0 != kill((pid_t) pid, 0))
+			continue;
+		ok = pv__querymulti_add(qm, (pid_t) pid, true);
+	}
+
+	(void) closedir(dir);
+
+	return ok;
+}
+
+
+/*
+ * Look for processes that have started since the last look.  Only those
+ * with a stats page or a control socket can be found, and so only those
+ * can be read without being sent a signal.  Returns false on error.
+ */
+static bool pv__querymulti_discover(struct pvquerymulti_s *qm)
+{
+	if (!pv__querymulti_scan(qm, "stats", false))
+		return false;
+	if (!pv__querymulti_scan(qm, "stats", true))
+		return false;
+	if (!pv__querymulti_scan(qm, "control", false))
+		return false;
+	if (!pv__querymulti_scan(qm, "control", true))
+		return false;
+	return true;
+}
+
+
+/*
+ * Read the current state of "target" into it, marking it as gone if it
+ * has exited.  The main state is only used as somewhere for the fetch to
+ * put its results.  Processes found by a scan are never signalled, since
+ * a runtime file can outlive its process and have its PID reused.
+ *
+ * Returns the amount the first successful read found already transferred,
+ * so it can be kept out of the rate of the total, or 0 otherwise.
+ */
+static off_t pv__querymulti_fetch(pvstate_t state, struct pvquerytarget_s *target)
+{
+	off_t size;
+	bool first, ok;
+
+	if (target->gone)
+		return 0;
+
+	size = 0;
+	if (target->discovered) {
+		ok = pv_remote_transferstate_peek(state, target->pid, &size);
+	} else {
+		ok = (0 == kill(target->pid, 0))
+		    && (0 == pv_remote_transferstate_fetch(state, target->pid, &size, true));
+	}
+	if (!ok) {
+		debug("%s: %d", "no longer watching", target->pid);
+		target->gone = true;
+		return 0;
+	}
+
+	first = !target->fetched;
+	target->fetched = true;
+	target->size = size;
+	target->transfer.transferred = state->transfer.transferred;
+	target->transfer.total_written = state->transfer.transferred;
+	target->transfer.elapsed_seconds = state->transfer.elapsed_seconds;
+
+	return first ? target->transfer.transferred : 0;
+}
+
+
+/*
+ * Free the targets and everything they hold.
+ */
+static void pv__querymulti_free(struct pvquerymulti_s *qm)
+{
+	unsigned int idx;
+
+	if (NULL == qm->target)
+		return;
+
+	for (idx = 0; idx < qm->count; idx++) {
+		struct pvquerytarget_s *target = &(qm->target[idx]);
+		pv_freecontents_calc(&(target->calc));
+		pv_freecontents_transfer(&(target->transfer));
+		if (NULL != target->display) {
+			pv_freecontents_display(target->display);
+			free(target->display);
+		}
+	}
+
+	free(qm->target);
+	qm->target = NULL;
+	qm->count = 0;
+	qm->allocated = 0;
+}
+
+
+/*
+ * Show the progress of "target" on the next line of the frame, allocating
+ * its display the first time it is shown.
+ */
+static void pv__querymulti_show(pvstate_t state, struct pvquerytarget_s *target, int line, bool terminal_resized)
+{
+	if (NULL == target->display) {
+		target->display = calloc(1, sizeof(*(target->display)));
+		if (NULL == target->display) {
+			pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_MEMORY;
+			return;
+		}
+		pv_reset_display(target->display);
+		target->flags.reparse_display = 1;
+		pv_update_calc_average_rate_window(&(target->calc), state->control.average_rate_window);
+	}
+
+	if (terminal_resized)
+		target->flags.reparse_display = 1;
+
+	if (line > 0)
+		pv_tty_write(&(state->flags), "\n", 1);
+
+	/* Its line on screen changes as other processes come and go. */
+	target->display->rendered_valid = false;
+
+	/*@-mustfreeonly@ *//* as with --watchfd, the name is only borrowed */
+	state->control.name = target->display_name;
+	state->control.size = target->size;
+
+	pv_display(&(state->status), &(state->control), &(target->flags), &(target->transfer), &(target->calc),
+		   &(state->cursor), target->display, NULL, false);
+
+	state->control.name = NULL;
+	/*@+mustfreeonly@ */
+}
+
+
+/*
+ * Make sure the format shows each line's name, as with --watchfd.
+ */
+static void pv__querymulti_format(pvstate_t state)
+{
+	char new_format_string[512];	 /* flawfinder: ignore - bounded by pv_snprintf() */
+	const char *original_format_string;
+
+	original_format_string = state->control.format_string;
+	if (NULL == original_format_string)
+		original_format_string = state->control.default_format;
+	if (pv_format_contains_name(original_format_string))
+		return;
+
+	memset(new_format_string, 0, sizeof(new_format_string));
+	(void) pv_snprintf(new_format_string, sizeof(new_format_string), "%%N %s", original_format_string);
+
+	if (NULL != state->control.format_string)
+		free(state->control.format_string);
+	state->control.format_string = pv_strdup(new_format_string);
+}
+
+
+/*
+ * Watch the progress of every process in "targets" - a comma separated
+ * list of process IDs, or "all" for every pv of this user that has a stats
+ * page or a control socket - until they have all exited.  Each one still
+ * running has its own line, above a line for the total, whose rate is the
+ * combined rate of them all and whose ETA comes from their combined size.
+ *
+ * The processes are read from their stats pages where they have them, so
+ * that watching them costs them nothing, or over their control sockets,
+ * and only otherwise by signals.
+ *
+ * Returns nonzero on error.
+ */
+int pv_query_multi_loop(pvstate_t state, const char *targets)
+{
+	struct pvquerymulti_s qm;
+	char total_name[PV_SIZEOF_DISPLAY_NAME];	/* flawfinder: ignore - bounded by pv_snprintf() */
+	long long start, next_update, next_rescan;
+	off_t size_override;
+	unsigned int idx, fetched;
+	int prev_displayed_lines;
+	bool final_update;
+
+	memset(&qm, 0, sizeof(qm));
+
+	if ((!pv__querymulti_parse(&qm, targets)) || (qm.discover && !pv__querymulti_discover(&qm))) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		pv__querymulti_free(&qm);
+		return PV_ERROREXIT_MEMORY;
+	}
+
+	/* Complain about any named processes that don't exist. */
+	for (idx = 0; idx < qm.count; idx++) {
+		if (0 != kill(qm.target[idx].pid, 0)) {
+			pv_error("%u: %s", qm.target[idx].pid, strerror(errno));
+			qm.target[idx].gone = true;
+		}
+	}
+
+	if (NULL != state->control.name) {
+		(void) pv_snprintf(total_name, sizeof(total_name), "%s", state->control.name);
+		free(state->control.name);
+		state->control.name = NULL;
+	} else {
+		(void) pv_snprintf(total_name, sizeof(total_name), "%s", _("total"));
+	}
+
+	/* The fetches overwrite the size, so keep any given with "-s". */
+	size_override = state->control.size;
+
+	pv__querymulti_format(state);
+	state->flags.reparse_display = 1;
+	state->transfer.total_written = 0;
+	state->display.initial_offset = 0;
+
+	start = pv_elapsedtime_nsec();
+	next_update = start;
+	next_rescan = start + PV_QUERYMULTI_RESCAN_NSEC;
+	prev_displayed_lines = 0;
+	final_update = false;
+
+	while (!final_update) {
+		long long now;
+		off_t total_transferred, total_size, joined;
+		int displayed_lines, blank_lines;
+		unsigned int running;
+		bool terminal_resized;
+
+		if (1 == state->flags.trigger_exit)
+			final_update = true;
+
+		now = pv_elapsedtime_nsec();
+
+		if ((!final_update) && (now < next_update)) {
+			struct timespec pause;
+			long long wait_nsec = next_update - now;
+			if (wait_nsec > PV_QUERYMULTI_POLL_NSEC)
+				wait_nsec = PV_QUERYMULTI_POLL_NSEC;
+			pv_elapsedtime_from_nsec(&pause, wait_nsec);
+			(void) nanosleep(&pause, NULL);
+			continue;
+		}
+
+		next_update += (long long) (1000000000.0 * state->control.interval);
+		if (next_update < now)
+			next_update = now;
+
+		if (qm.discover && (now >= next_rescan)) {
+			(void) pv__querymulti_discover(&qm);
+			next_rescan = now + PV_QUERYMULTI_RESCAN_NSEC;
+		}
+
+		/*
+		 * Read every process, adding up the totals; those that have
+		 * gone keep their last amount in the total, and their size.
+		 */
+		total_transferred = 0;
+		total_size = 0;
+		joined = 0;
+		running = 0;
+		for (idx = 0; idx < qm.count; idx++) {
+			struct pvquerytarget_s *target = &(qm.target[idx]);
+			joined += pv__querymulti_fetch(state, target);
+			if (!target->gone)
+				running++;
+			total_transferred += target->transfer.transferred;
+			if (total_size >= 0)
+				total_size = target->size > 0 ? total_size + target->size : -1;
+		}
+		if (total_size < 0)
+			total_size = 0;
+		if (size_override > 0)
+			total_size = size_override;
+
+		if ((0 == running) && (!qm.discover || (now - start >= PV_QUERYMULTI_RESCAN_NSEC)))
+			final_update = true;
+
+		/*
+		 * Amounts transferred before a process was first read were
+		 * not transferred during this interval.
+		 */
+		if (joined > 0)
+			pv_calc_shift_baseline(&(state->calc), joined);
+
+		state->transfer.transferred = total_transferred;
+		state->transfer.total_written = total_transferred;
+		state->transfer.elapsed_seconds = (long double) (now - start) / 1000000000.0L;
+
+		if (state->control.no_display)
+			continue;
+
+		terminal_resized = (1 == state->flags.terminal_resized) ? true : false;
+		if (terminal_resized) {
+			unsigned int width = 0, height = 0;
+			state->flags.terminal_resized = 0;
+			pv_screensize(&width, &height);
+			if (!state->control.width_set_manually)
+				state->control.width = (pvdisplay_width_t) width;
+			if (!state->control.height_set_manually)
+				state->control.height = height;
+			state->flags.reparse_display = 1;
+		}
+
+		pv_tty_frame_begin();
+
+		/* A line for each process still running, leaving room for the total. */
+		displayed_lines = 0;
+		for (idx = 0; (!final_update) && (idx < qm.count); idx++) {
+			if (qm.target[idx].gone || !qm.target[idx].fetched)
+				continue;
+			if (displayed_lines + 1 >= (int) (state->control.height))
+				break;
+			pv__querymulti_show(state, &(qm.target[idx]), displayed_lines, terminal_resized);
+			displayed_lines++;
+		}
+
+		if (displayed_lines > 0)
+			pv_tty_write(&(state->flags), "\n", 1);
+		/*@-mustfreeonly@ *//* the name is only borrowed, as above */
+		state->control.name = total_name;
+		state->control.size = total_size;
+		state->display.rendered_valid = false;
+		pv_display(&(state->status), &(state->control), &(state->flags), &(state->transfer), &(state->calc),
+			   &(state->cursor), &(state->display), &(state->extra_display), final_update);
+		state->control.name = NULL;
+		/*@+mustfreeonly@ */
+		displayed_lines++;
+
+		/* Blank out the lines left over from the last update. */
+		blank_lines = prev_displayed_lines - displayed_lines;
+		prev_displayed_lines = displayed_lines;
+		while (blank_lines > 0) {
+			pvdisplay_width_t blank_count;
+			pv_tty_write(&(state->flags), "\n", 1);
+			for (blank_count = 0; blank_count < state->control.width; blank_count++)
+				pv_tty_write(&(state->flags), " ", 1);
+			pv_tty_write(&(state->flags), "\r", 1);
+			blank_lines--;
+			displayed_lines++;
+		}
+
+		while (displayed_lines > 1) {
+			pv_tty_write(&(state->flags), "\033[A", 3);
+			displayed_lines--;
+		}
+
+		pv_tty_frame_end(&(state->flags), !state->control.numeric);
+	}
+
+	/* Leave the last update on the screen, above the prompt. */
+	if ((!state->control.numeric) && (!state->control.no_display) && (state->display.output_produced)) {
+		while (prev_displayed_lines > 0) {
+			pv_tty_write(&(state->flags), "\n", 1);
+			prev_displayed_lines--;
+		}
+	}
+
+	if (1 == state->flags.trigger_exit)
+		state->status.exit_status |= PV_ERROREXIT_SIGNAL;
+
+	/* Nothing to watch at all is an error, as with a single query. */
+	fetched = 0;
+	for (idx = 0; idx < qm.count; idx++) {
+		if (qm.target[idx].fetched)
+			fetched++;
+	}
+	if (0 == fetched) {
+		pv_error("%s", _("no processes to query"));
+		state->status.exit_status |= PV_ERROREXIT_REMOTE_OR_PID;
+	}
+
+	pv__querymulti_free(&qm);
+	pv_tty_frame_free();
+
+	return state->status.exit_status;
+}
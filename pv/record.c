@@ -0,0 +1,526 @@
+/*
+ * Record framing for "--record": finding where each record ends in the
+ * output, so that records can be counted, rate limited, and written whole,
+ * the way lines are in line mode.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+/* The most length prefix bytes there can be - a 64-bit varint. */
+#define PV_RECORD_MAX_HEADER 10
+
+/*
+ * How far through the record framing the output has got, carried from one
+ * write to the next, since records don't line up with writes.  The
+ * structure holds no pointers, so that a copy can be scanned ahead without
+ * changing the original.
+ */
+struct pvrecordscan_s {
+	/* Delimited records: bytes after the last match, which may start one. */
+	unsigned char carry[PV_RECORD_MAX_DELIMITER];
+	size_t carry_length;
+	/* Fixed-size records: bytes of the current record written so far. */
+	size_t fixed_offset;
+	/* Length-prefixed records: the prefix so far, or what's left after it. */
+	unsigned char header[PV_RECORD_MAX_HEADER];
+	size_t header_length;
+	uint64_t body_remaining;
+	bool in_body;
+};
+
+
+/*
+ * Decode the escape sequence at *ptr, just after a backslash, advancing
+ * *ptr past it, and return the byte it stands for, or -1 if it is not
+ * understood.
+ */
+static int pv__record_unescape(const char **ptr)
+{
+	char ch;
+	int value, digits;
+
+	ch = **ptr;
+	(*ptr)++;
+	switch (ch) {
+	case 'n':
+		return '\n';
+	case 'r':
+		return '\r';
+	case 't':
+		return '\t';
+	case '0':
+		return '\0';
+	case '\\':
+		return '\\';
+	case 'x':
+		value = 0;
+		for (digits = 0; digits < 2; digits++) {
+			ch = **ptr;
+			if ((ch >= '0') && (ch <= '9')) {
+				value = value * 16 + (ch - '0');
+			} else if ((ch >= 'a') && (ch <= 'f')) {
+				value = value * 16 + (ch - 'a' + 10);
+			} else if ((ch >= 'A') && (ch <= 'F')) {
+				value = value * 16 + (ch - 'A' + 10);
+			} else {
+				break;
+			}
+			(*ptr)++;
+		}
+		return (digits > 0) ? value : -1;
+	default:
+		return -1;
+	}
+}
+
+
+/*
+ * Parse the "--record" framing specification "spec" into "framing".
+ * Returns false if it is not understood.
+ *
+ * The forms are "delim:STRING", where STRING may use the escapes \n, \r,
+ * \t, \0, \\ and \xHH; "fixed:SIZE"; and "u32be", "u32le" or "varint", for
+ * records each preceded by their length.
+ */
+bool pv_record_spec_parse(const char *spec, struct pvrecordframing_s *framing)
+{
+	memset(framing, 0, sizeof(*framing));
+
+	if (0 == strncmp(spec, "delim:", 6)) {
+		const char *ptr = spec + 6;
+		while ('\0' != *ptr) {
+			int byte;
+			if (framing->delimiter_length >= PV_RECORD_MAX_DELIMITER)
+				return false;
+			if ('\\' == *ptr) {
+				ptr++;
+				byte = pv__record_unescape(&ptr);
+				if (byte < 0)
+					return false;
+			} else {
+				byte = (int) ((unsigned char) (*ptr));
+				ptr++;
+			}
+			framing->delimiter[framing->delimiter_length++] = (char) byte;
+		}
+		if (0 == framing->delimiter_length)
+			return false;
+		framing->type = PV_RECORD_DELIMITER;
+		return true;
+	}
+
+	if (0 == strncmp(spec, "fixed:", 6)) {
+		off_t size;
+		if (!pv_getnum_check(spec + 6, PV_NUMTYPE_ANY_WITH_SUFFIX))
+			return false;
+		size = pv_getnum_size(spec + 6, false);
+		if (size < 1)
+			return false;
+		framing->type = PV_RECORD_FIXED;
+		framing->size = (size_t) size;
+		return true;
+	}
+
+	if (0 == strcmp(spec, "u32be")) {
+		framing->type = PV_RECORD_U32BE;
+	} else if (0 == strcmp(spec, "u32le")) {
+		framing->type = PV_RECORD_U32LE;
+	} else if (0 == strcmp(spec, "varint")) {
+		framing->type = PV_RECORD_VARINT;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Return true if "spec" is a record framing that "--record" can use.
+ */
+bool pv_record_spec_valid(const char *spec)
+{
+	struct pvrecordframing_s framing;
+	return pv_record_spec_parse(spec, &framing);
+}
+
+
+/*
+ * Forget how far through the framing the output has got.
+ */
+void pv_record_reset(/*@null@ */ struct pvrecordscan_s *scan)
+{
+	if (NULL == scan)
+		return;
+	memset(scan, 0, sizeof(*scan));
+}
+
+
+/*
+ * Free the record framing state.
+ */
+void pv_record_free(/*@only@ */ /*@null@ */ struct pvrecordscan_s *scan)
+{
+	if (NULL == scan)
+		return;
+	free(scan);
+}
+
+
+/*
+ * Note that a record ended with the byte at offset "end" of the data being
+ * scanned, which started at output position "base": count it, remember
+ * where the data could be cut after it, and if "positions" is not NULL,
+ * record its position, as a line separator's would be.
+ */
+static void pv__record_ended(size_t end, off_t base, /*@null@ */ struct pvlinepositions_s *positions,
+			     size_t *records, size_t *last_end)
+{
+	(*records)++;
+	*last_end = end + 1;
+	if (NULL != positions)
+		pv_linepos_add(positions, base + (off_t) end);
+}
+
+
+/*
+ * Scan for delimited records, stopping after "max_records" if that is
+ * nonzero.  The delimiter is found by looking for its first byte with
+ * memchr(), which the C library vectorises, and then comparing the rest;
+ * the bytes after the last match are carried over, in case a delimiter is
+ * split between writes.
+ */
+static size_t pv__record_scan_delimited(const struct pvrecordframing_s *framing, struct pvrecordscan_s *scan,
+					const char *data, size_t count, off_t base,
+					/*@null@ */ struct pvlinepositions_s *positions, size_t max_records,
+					size_t *last_end)
+{
+	const char *delimiter = framing->delimiter;
+	size_t length = framing->delimiter_length;
+	size_t records = 0;
+	size_t pos = 0;
+	size_t tail_start;
+
+	/* A delimiter which started in the bytes carried over. */
+	if (scan->carry_length > 0) {
+		unsigned char joined[2 * PV_RECORD_MAX_DELIMITER];
+		size_t joined_length, from_data, idx;
+		bool matched = false;
+
+		from_data = (count < length - 1) ? count : length - 1;
+		memcpy(joined, scan->carry, scan->carry_length);	/* flawfinder: ignore */
+		memcpy(joined + scan->carry_length, data, from_data);	/* flawfinder: ignore */
+		/* flawfinder: both parts are less than PV_RECORD_MAX_DELIMITER. */
+		joined_length = scan->carry_length + from_data;
+
+		for (idx = 0; idx < scan->carry_length && idx + length <= joined_length; idx++) {
+			if (0 != memcmp(joined + idx, delimiter, length))
+				continue;
+			pos = idx + length - scan->carry_length;
+			pv__record_ended(pos - 1, base, positions, &records, last_end);
+			matched = true;
+			break;
+		}
+
+		if ((!matched) && (count < length - 1)) {
+			/* Too little new data to rule out a match yet. */
+			size_t keep = (joined_length < length - 1) ? joined_length : length - 1;
+			memmove(scan->carry, joined + joined_length - keep, keep);
+			scan->carry_length = keep;
+			return 0;
+		}
+		scan->carry_length = 0;
+	}
+
+	while ((pos + length <= count) && ((0 == max_records) || (records < max_records))) {
+		const char *match;
+
+		match = memchr(data + pos, (int) ((unsigned char) delimiter[0]), count - pos - length + 1);
+		if (NULL == match)
+			break;
+		if (0 != memcmp(match, delimiter, length)) {
+			pos = (size_t) (match - data) + 1;
+			continue;
+		}
+		pos = (size_t) (match - data) + length;
+		pv__record_ended(pos - 1, base, positions, &records, last_end);
+	}
+
+	/* Keep whatever could be the start of the next delimiter. */
+	tail_start = (count > length - 1) ? count - (length - 1) : 0;
+	if (tail_start < pos)
+		tail_start = pos;
+	scan->carry_length = count - tail_start;
+	memcpy(scan->carry, data + tail_start, scan->carry_length);	/* flawfinder: ignore */
+	/* flawfinder: carry_length is less than the delimiter length. */
+
+	return records;
+}
+
+
+/*
+ * Scan for delimited records with a single-byte delimiter, which is the
+ * same as counting lines, so the SIMD line scanner does the work.
+ */
+static size_t pv__record_scan_byte(const struct pvrecordframing_s *framing, const char *data, size_t count,
+				   off_t base, /*@null@ */ struct pvlinepositions_s *positions, size_t max_records,
+				   size_t *last_end)
+{
+	size_t offsets[PV_LINESCAN_BATCH];
+	size_t records = 0;
+	size_t start = 0;
+
+	if ((NULL == positions) && (0 == max_records)) {
+		const char *end = pv_memrchr(data, (int) ((unsigned char) framing->delimiter[0]), count);
+		if (NULL != end)
+			*last_end = (size_t) (end - data) + 1;
+		return pv_linescan_count(data, count, framing->delimiter[0]);
+	}
+
+	while (start < count) {
+		size_t found, scanned, found_idx;
+
+		found =
+		    pv_linescan_find(data + start, count - start, framing->delimiter[0], offsets, PV_LINESCAN_BATCH,
+				     &scanned);
+		for (found_idx = 0; found_idx < found; found_idx++) {
+			pv__record_ended(start + offsets[found_idx], base, positions, &records, last_end);
+			if ((max_records > 0) && (records >= max_records))
+				return records;
+		}
+		start += scanned;
+	}
+
+	return records;
+}
+
+
+/*
+ * Scan for fixed-size records, which is just arithmetic.
+ */
+static size_t pv__record_scan_fixed(const struct pvrecordframing_s *framing, struct pvrecordscan_s *scan,
+				    size_t count, off_t base, /*@null@ */ struct pvlinepositions_s *positions,
+				    size_t max_records, size_t *last_end)
+{
+	size_t records, first_end, idx;
+
+	if (scan->fixed_offset + count < framing->size) {
+		scan->fixed_offset += count;
+		return 0;
+	}
+
+	records = (scan->fixed_offset + count) / framing->size;
+	if ((max_records > 0) && (records > max_records))
+		records = max_records;
+	first_end = framing->size - scan->fixed_offset - 1;
+
+	if (NULL != positions) {
+		for (idx = 0; idx < records; idx++)
+			pv_linepos_add(positions, base + (off_t) (first_end + idx * framing->size));
+	}
+
+	*last_end = first_end + (records - 1) * framing->size + 1;
+	scan->fixed_offset = count - *last_end;
+
+	return records;
+}
+
+
+/*
+ * Scan for length-prefixed records.  Only the prefixes are looked at a
+ * byte at a time; the bodies are skipped over whole.
+ */
+static size_t pv__record_scan_prefixed(const struct pvrecordframing_s *framing, struct pvrecordscan_s *scan,
+				       const char *data, size_t count, off_t base,
+				       /*@null@ */ struct pvlinepositions_s *positions, size_t max_records,
+				       size_t *last_end)
+{
+	const unsigned char *bytes = (const unsigned char *) data;
+	size_t records = 0;
+	size_t pos = 0;
+
+	while ((pos < count) && ((0 == max_records) || (records < max_records))) {
+		bool complete;
+		uint64_t length;
+		unsigned int shift;
+		size_t idx;
+
+		if (scan->in_body) {
+			size_t take = count - pos;
+			if ((uint64_t) take > scan->body_remaining)
+				take = (size_t) (scan->body_remaining);
+			pos += take;
+			scan->body_remaining -= take;
+			if (0 == scan->body_remaining) {
+				scan->in_body = false;
+				pv__record_ended(pos - 1, base, positions, &records, last_end);
+			}
+			continue;
+		}
+
+		scan->header[scan->header_length++] = bytes[pos++];
+
+		complete = false;
+		length = 0;
+		switch (framing->type) {
+		case PV_RECORD_U32BE:
+			if (4 == scan->header_length) {
+				complete = true;
+				for (idx = 0; idx < 4; idx++)
+					length = (length << 8) | scan->header[idx];
+			}
+			break;
+		case PV_RECORD_U32LE:
+			if (4 == scan->header_length) {
+				complete = true;
+				for (idx = 4; idx > 0; idx--)
+					length = (length << 8) | scan->header[idx - 1];
+			}
+			break;
+		case PV_RECORD_VARINT:
+		default:
+			if ((0 == (scan->header[scan->header_length - 1] & 0x80))
+			    || (scan->header_length >= PV_RECORD_MAX_HEADER)) {
+				complete = true;
+				shift = 0;
+				for (idx = 0; idx < scan->header_length; idx++) {
+					length |= ((uint64_t) (scan->header[idx] & 0x7f)) << shift;
+					shift += 7;
+				}
+			}
+			break;
+		}
+
+		if (!complete)
+			continue;
+
+		scan->header_length = 0;
+		if (0 == length) {
+			pv__record_ended(pos - 1, base, positions, &records, last_end);
+		} else {
+			scan->in_body = true;
+			scan->body_remaining = length;
+		}
+	}
+
+	return records;
+}
+
+
+/*
+ * Scan the "count" bytes at "data" against "framing", from the position
+ * held in "scan", which is updated.  Returns the number of records which
+ * end in the data, stopping after "max_records" if it is nonzero, and
+ * sets *last_end to the offset just after the last of them.
+ */
+static size_t pv__record_scan(const struct pvrecordframing_s *framing, struct pvrecordscan_s *scan,
+			      const char *data, size_t count, off_t base,
+			      /*@null@ */ struct pvlinepositions_s *positions, size_t max_records, size_t *last_end)
+{
+	*last_end = 0;
+
+	switch (framing->type) {
+	case PV_RECORD_DELIMITER:
+		if (1 == framing->delimiter_length)
+			return pv__record_scan_byte(framing, data, count, base, positions, max_records, last_end);
+		return pv__record_scan_delimited(framing, scan, data, count, base, positions, max_records,
+						 last_end);
+	case PV_RECORD_FIXED:
+		return pv__record_scan_fixed(framing, scan, count, base, positions, max_records, last_end);
+	case PV_RECORD_U32BE:
+	case PV_RECORD_U32LE:
+	case PV_RECORD_VARINT:
+		return pv__record_scan_prefixed(framing, scan, data, count, base, positions, max_records,
+						last_end);
+	case PV_RECORD_NONE:
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Allocate the framing state of the transfer if it hasn't been already.
+ * Returns false on error.
+ */
+static bool pv__record_scan_alloc(pvstate_t state)
+{
+	if (NULL != state->transfer.record_scan)
+		return true;
+
+	state->transfer.record_scan = calloc(1, sizeof(struct pvrecordscan_s));
+	if (NULL == state->transfer.record_scan) {
+		pv_error("%s: %s", _("record framing state allocation failed"), strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Return the number of records which the "count" bytes at "data", just
+ * written to the output, completed, recording where each one ended in the
+ * line positions buffer if there is one.  The caller advances
+ * state->transfer.last_output_position.
+ */
+size_t pv_record_count(pvstate_t state, const char *data, size_t count)
+{
+	size_t last_end;
+
+	if (!pv__record_scan_alloc(state))
+		return 0;
+
+	/*@-nullpass@ *//* allocated above */
+	return pv__record_scan(&(state->control.record), state->transfer.record_scan, data, count,
+			       state->transfer.last_output_position, state->transfer.line_positions, 0, &last_end);
+	/*@+nullpass@ */
+}
+
+
+/*
+ * Return how many of the "count" bytes at "data", about to be written,
+ * run up to the end of the last complete record among them, and no
+ * further than the end of record "max_records" if that is not negative,
+ * so that records are written whole.  If no record ends in the data, all
+ * of it is written, since the record it is part of can't be held back
+ * forever; but if "max_records" is 0, nothing is.
+ */
+size_t pv_record_boundary(pvstate_t state, const char *data, size_t count, off_t max_records)
+{
+	struct pvrecordscan_s ahead;
+	size_t last_end, records;
+
+	if (0 == max_records)
+		return 0;
+
+	if (!pv__record_scan_alloc(state))
+		return count;
+
+	/* Scan a copy, so the count made after writing starts from here. */
+	/*@-nullderef@ *//* allocated above */
+	memcpy(&ahead, state->transfer.record_scan, sizeof(ahead));	/* flawfinder: ignore */
+	/*@+nullderef@ */
+	/* flawfinder: same structure on both sides. */
+
+	records = pv__record_scan(&(state->control.record), &ahead, data, count, 0, NULL,
+				  (max_records > 0) ? (size_t) max_records : 0, &last_end);
+
+	if (0 == records)
+		return count;
+
+	return last_end;
+}
@@ -21,6 +21,180 @@
 #include <sys/time.h>
 #include <sys/stat.h>
 
+
+/*
+ * Add a NAME=VALUE pair for a number to a control socket request.
+ */
+static bool pv__remote_add_number(char *request, size_t bufsize, size_t *length, const char *name,
+				  long double value, bool integer)
+{
+	char value_string[64];		 /* flawfinder: ignore - bounded by pv_snprintf() */
+
+	if (integer) {
+		(void) pv_snprintf(value_string, sizeof(value_string), "%.0Lf", value);
+	} else {
+		(void) pv_snprintf(value_string, sizeof(value_string), "%.6Lf", value);
+	}
+
+	return pv_ctlsock_append(request, bufsize, length, name, value_string);
+}
+
+
+/*
+ * Send the settings for --remote to the control socket of process
+ * "remote", in one "set" request.
+ *
+ * Returns -1 if the process has no control socket, so signals should be
+ * used instead, or the exit status to give otherwise.
+ */
+static int pv__remote_set_socket(pvstate_t state, pid_t remote)
+{
+	char request[PV_SIZEOF_CTLSOCK_MSG];	/* flawfinder: ignore */
+	char reply[PV_SIZEOF_CTLSOCK_MSG];	/* flawfinder: ignore */
+	size_t length;
+	bool fits;
+	int result;
+
+	/*
+	 * flawfinder rationale: both buffers are only written to by
+	 * pv_snprintf(), pv_ctlsock_append(), and pv_ctlsock_request(),
+	 * which are all bounded and always \0 terminate.
+	 */
+
+	(void) pv_snprintf(request, sizeof(request), "%s", "set");
+	length = 3;
+
+	/*
+	 * The same settings are sent as for a signalled message, with the
+	 * same rules about which ones are left alone when not given.
+	 */
+	fits = true;
+	fits = fits && pv_ctlsock_append(request, sizeof(request), &length, "show-progress",
+					  state->control.format_option.progress ? "1" : "0");
+	fits = fits && pv_ctlsock_append(request, sizeof(request), &length, "show-timer",
+					  state->control.format_option.timer ? "1" : "0");
+	fits = fits && pv_ctlsock_append(request, sizeof(request), &length, "show-eta",
+					  state->control.format_option.eta ? "1" : "0");
+	fits = fits && pv_ctlsock_append(request, sizeof(request), &length, "show-fineta",
+					  state->control.format_option.fineta ? "1" : "0");
+	fits = fits && pv_ctlsock_append(request, sizeof(request), &length, "show-rate",
+					  state->control.format_option.rate ? "1" : "0");
+	fits = fits && pv_ctlsock_append(request, sizeof(request), &length, "show-average-rate",
+					  state->control.format_option.average_rate ? "1" : "0");
+	fits = fits && pv_ctlsock_append(request, sizeof(request), &length, "show-bytes",
+					  state->control.format_option.bytes ? "1" : "0");
+	fits = fits && pv_ctlsock_append(request, sizeof(request), &length, "show-buffer-percent",
+					  state->control.format_option.bufpercent ? "1" : "0");
+	fits = fits && pv__remote_add_number(request, sizeof(request), &length, "last-written",
+					     (long double) (state->control.format_option.lastwritten), true);
+	fits = fits && pv_ctlsock_append(request, sizeof(request), &length, "name",
+					  NULL == state->control.name ? "" : state->control.name);
+	fits = fits && pv_ctlsock_append(request, sizeof(request), &length, "format",
+					  NULL == state->control.format_string ? "" : state->control.format_string);
+	fits = fits && pv_ctlsock_append(request, sizeof(request), &length, "extra-display",
+					  NULL ==
+					  state->control.extra_display_spec ? "" : state->control.extra_display_spec);
+	if (state->control.rate_limit > 0)
+		fits = fits && pv__remote_add_number(request, sizeof(request), &length, "rate-limit",
+						     (long double) (state->control.rate_limit), true);
+	if (state->control.target_buffer_size > 0)
+		fits = fits && pv__remote_add_number(request, sizeof(request), &length, "buffer-size",
+						     (long double) (state->control.target_buffer_size), true);
+	if (state->control.size > 0)
+		fits = fits && pv__remote_add_number(request, sizeof(request), &length, "size",
+						     (long double) (state->control.size), true);
+	if (state->control.interval > 0)
+		fits = fits && pv__remote_add_number(request, sizeof(request), &length, "interval",
+						     (long double) (state->control.interval), false);
+	if ((state->control.width > 0) && state->control.width_set_manually)
+		fits = fits && pv__remote_add_number(request, sizeof(request), &length, "width",
+						     (long double) (state->control.width), true);
+	if ((state->control.height > 0) && state->control.height_set_manually)
+		fits = fits && pv__remote_add_number(request, sizeof(request), &length, "height",
+						     (long double) (state->control.height), true);
+
+	if (!fits) {
+		/*@-mustfreefresh@ *//* splint - see below */
+		pv_error("%u: %s", remote, _("settings too long to send"));
+		/*@+mustfreefresh@ */
+		return PV_ERROREXIT_REMOTE_OR_PID;
+	}
+
+	memset(reply, 0, sizeof(reply));
+	result = pv_ctlsock_request(remote, request, reply, sizeof(reply));
+	if (result < 0)
+		return -1;
+
+	/*@-mustfreefresh@ */
+	/*
+	 * splint note: the gettext calls made by _() cause memory leak
+	 * warnings, but in this case it's unavoidable, and mitigated by the
+	 * fact we only translate each string once.
+	 */
+	if (result > 0) {
+		pv_error("%u: %s", remote, _("message not received"));
+		return PV_ERROREXIT_REMOTE_OR_PID;
+	}
+	/*@+mustfreefresh@ */
+
+	if (0 != strncmp(reply, "ok", 2)) {
+		pv_error("%u: %s", remote, 0 == strncmp(reply, "error ", 6) ? reply + 6 : reply);
+		return PV_ERROREXIT_REMOTE_OR_PID;
+	}
+
+	debug("%s", "settings sent over control socket");
+
+	return 0;
+}
+
+
+/*
+ * Fetch the transfer state of process "query" from its control socket.
+ *
+ * Returns true on success, or false if the process has no control socket
+ * or did not respond, so signals should be used instead.
+ */
+static bool pv__remote_fetch_socket(pvstate_t state, pid_t query, /*@null@ */ off_t * sizeptr)
+{
+	char reply[PV_SIZEOF_CTLSOCK_MSG];	/* flawfinder: ignore - bounded by pv_ctlsock_request() */
+	char value[64];			 /* flawfinder: ignore - bounded by pv_ctlsock_reply_value() */
+
+	memset(reply, 0, sizeof(reply));
+	if (0 != pv_ctlsock_request(query, "get transferred elapsed size", reply, sizeof(reply)))
+		return false;
+	if (0 != strncmp(reply, "ok ", 3))
+		return false;
+
+	if (pv_ctlsock_reply_value(reply, "transferred", value, sizeof(value)))
+		state->transfer.transferred = (off_t) strtoll(value, NULL, 10);
+	if (pv_ctlsock_reply_value(reply, "elapsed", value, sizeof(value)))
+		state->transfer.elapsed_seconds = strtold(value, NULL);
+	if (pv_ctlsock_reply_value(reply, "size", value, sizeof(value)))
+		state->control.size = (off_t) strtoll(value, NULL, 10);
+
+	if (NULL != sizeptr)
+		*sizeptr = state->control.size;
+
+	debug("%s", "state fetched over control socket");
+
+	return true;
+}
+
+
+/*
+ * Read the transfer state of process "query" from its stats page or its
+ * control socket, without signalling it.  This is safe to try on a process
+ * that might not be a pv at all, such as one found through a runtime file
+ * left behind by an earlier process with the same PID.
+ */
+bool pv_remote_transferstate_peek(pvstate_t state, pid_t query, /*@null@ */ off_t * sizeptr)
+{
+	if (pv_statspage_fetch(state, query, sizeptr))
+		return true;
+	return pv__remote_fetch_socket(state, query, sizeptr);
+}
+
+
 #ifdef PV_REMOTE_CONTROL
 
 /* Structure for transferring settings with --remote. */
@@ -77,6 +251,7 @@ int pv_remote_set(pvstate_t state, pid_t remote)
 	pid_t signal_sender;
 	long timeout;
 	bool received;
+	int result;
 
 	/*
 	 * flawfinder rationale: buffer is large enough, explicitly zeroed,
@@ -92,6 +267,14 @@ int pv_remote_set(pvstate_t state, pid_t remote)
 		return PV_ERROREXIT_REMOTE_OR_PID;
 	}
 
+	/*
+	 * Use the remote process's control socket if it has one, falling
+	 * back to a control file and signals for older versions.
+	 */
+	result = pv__remote_set_socket(state, remote);
+	if (result >= 0)
+		return result;
+
 	/*
 	 * Copy parameters into message buffer.
 	 */
@@ -315,6 +498,8 @@ static bool pv__rxsignal_usr2(pvstate_t state)
 	if (msgbuf.rate_limit > 0)
 		pv_state_rate_limit_set(state, msgbuf.rate_limit);
 	if (msgbuf.buffer_size > 0) {
+		/* A buffer size given explicitly overrides "-B auto". */
+		pv_state_adaptive_buffer_set(state, false);
 		pv_state_target_buffer_size_set(state, msgbuf.buffer_size);
 	}
 	if (msgbuf.size > 0)
@@ -523,6 +708,17 @@ int pv_remote_transferstate_fetch(pvstate_t state, pid_t query, /*@null@ */ off_
 		return PV_ERROREXIT_REMOTE_OR_PID;
 	}
 
+	/*
+	 * If the remote process publishes a stats page, read that instead,
+	 * so it doesn't need to be signalled at all.
+	 */
+	if (pv_statspage_fetch(state, query, sizeptr))
+		return 0;
+
+	/* Otherwise, try its control socket, before falling back to signals. */
+	if (pv__remote_fetch_socket(state, query, sizeptr))
+		return 0;
+
 	/* Set up the query message. */
 	memset(&msgbuf, 0, sizeof(msgbuf));
 	msgbuf.response = false;
@@ -637,9 +833,15 @@ bool pv_remote_check( /*@unused@ */  __attribute__((unused)) pvstate_t state)
 }
 
 
-int pv_remote_set(			 /*@unused@ */
-			 __attribute__((unused)) pvstate_t state, /*@unused@ */  __attribute__((unused)) pid_t remote)
+int pv_remote_set(pvstate_t state, pid_t remote)
 {
+	int result;
+
+	/* The control socket doesn't need signals. */
+	result = pv__remote_set_socket(state, remote);
+	if (result >= 0)
+		return result;
+
 	/*@-mustfreefresh@ *//* splint - see above */
 	pv_error("%s", _("SA_SIGINFO not supported on this system"));
 	/*@+mustfreefresh@ */
@@ -647,17 +849,17 @@ int pv_remote_set(			 /*@unused@ */
 }
 
 
-int pv_remote_transferstate_fetch(	 /*@unused@ */
-					 __attribute__((unused)) pvstate_t state,
-					 /*@unused@ */
-					 __attribute__((unused)) pid_t query,
-					 /*@null@ */
-					 /*@unused@ */
-					 __attribute__((unused)) off_t * sizeptr,
+int pv_remote_transferstate_fetch(pvstate_t state, pid_t query, /*@null@ */ off_t * sizeptr,
 					 /*@unused@ */
 					 __attribute__((unused))
 					 bool silent)
 {
+	/* A stats page can still be read without signals. */
+	if (pv_statspage_fetch(state, query, sizeptr))
+		return 0;
+	if (pv__remote_fetch_socket(state, query, sizeptr))
+		return 0;
+
 	/*@-mustfreefresh@ *//* splint - see above */
 	fprintf(stderr, "%s\n", _("SA_SIGINFO not supported on this system"));
 	/*@+mustfreefresh@ */
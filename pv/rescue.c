@@ -0,0 +1,959 @@
+/*
+ * Functions for rescuing data from a failing input with "--rescue", in the
+ * manner of ddrescue(1).
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * The input is covered by a map of regions, each with one of the status
+ * characters used by ddrescue's map files, so that a map written by one
+ * can be read by the other:
+ *
+ *   ?  not tried yet
+ *   *  failed as part of a larger read, still to be narrowed down
+ *   /  as "*" (ddrescue's "non-scraped")
+ *   -  bad sector, failed on its own
+ *   +  rescued
+ *
+ * The rescue goes through these phases:
+ *
+ *  1. Copy the untried regions in whole buffers, at full speed.  When a
+ *     read fails, the buffer's range is marked "*", and the next read
+ *     jumps ahead, by an amount which doubles with each failure in a row,
+ *     so that a damaged area is got past quickly.
+ *
+ *  2. Copy whatever was jumped over, without jumping.
+ *
+ *  3. Bisect each "*" region: read each half, splitting again on failure,
+ *     down to single sectors, which are marked bad if they still fail.
+ *
+ *  4. With "--rescue-retries", re-read each bad sector that many more
+ *     times, optionally with direct I/O, so that each attempt reaches the
+ *     device instead of an error cached by the system.
+ *
+ * Each call to pv_rescue_transfer() does one read, so that the display
+ * keeps being updated.  Only newly rescued data counts as transferred;
+ * when resuming from a map, the size is reduced by what was already
+ * rescued.
+ *
+ * The map is written to a temporary file, and renamed over the map file,
+ * at most every PV_RESCUE_MAP_INTERVAL seconds, at the end of each phase,
+ * and when the transfer ends for any reason.
+ */
+#define PV_RESCUE_MIN_SKIP	(64 * 1024)	 /* first jump after a failed read */
+#define PV_RESCUE_MAX_SKIP	(64 * 1024 * 1024)	/* largest jump after a failed read */
+#define PV_RESCUE_MAP_INTERVAL	30		 /* seconds between map file updates */
+#define PV_RESCUE_BISECT_DEPTH	128		 /* size of the bisection stack */
+#define PV_RESCUE_LINE_LENGTH	256		 /* longest map file line we accept */
+
+typedef enum {
+	PV_RESCUE_PHASE_COPY_SKIP,
+	PV_RESCUE_PHASE_COPY,
+	PV_RESCUE_PHASE_BISECT,
+	PV_RESCUE_PHASE_RETRY,
+	PV_RESCUE_PHASE_DONE
+} pvrescue_phase_t;
+
+struct pvrescue_region_s {
+	off_t pos;			 /* offset of the start of the region */
+	off_t size;			 /* length of the region */
+	char status;			 /* one of the status characters above */
+};
+
+struct pvrescue_range_s {
+	off_t pos;
+	off_t size;
+};
+
+struct pvrescue_s {
+	/*@only@ */ struct pvrescue_region_s *regions;	/* the map, in order */
+	size_t region_count;		 /* number of regions in the map */
+	size_t region_capacity;		 /* allocated size of the regions array */
+	/*@only@ */ char *temp_filename; /* where the map is written first */
+	struct pvrescue_range_s stack[PV_RESCUE_BISECT_DEPTH];	/* ranges left to bisect */
+	unsigned int stack_depth;	 /* number of ranges on the stack */
+	off_t size;			 /* size of the input */
+	off_t output_start;		 /* output offset of input offset 0 */
+	off_t cursor;			 /* where the current pass has got to */
+	off_t skip_size;		 /* next jump after a failed read */
+	size_t sector_size;		 /* smallest unit to read */
+	time_t map_written;		 /* when the map was last written */
+	pvrescue_phase_t phase;		 /* which phase the rescue is in */
+	unsigned int retry_pass;	 /* number of the current retry pass */
+	int input_fd;			 /* input being rescued */
+	bool direct_io;			 /* set while direct I/O is on for retries */
+	bool map_failed;		 /* set once writing the map has failed */
+	bool error_shown;		 /* set once a read error has been reported */
+};
+
+
+/*
+ * Return the index of the region containing "offset", which must be
+ * within the input.
+ */
+static size_t pv__rescue_region_at(const struct pvrescue_s *rescue, off_t offset)
+{
+	size_t low, high;
+
+	low = 0;
+	high = rescue->region_count;
+	while (high - low > 1) {
+		size_t middle = low + (high - low) / 2;
+		if (rescue->regions[middle].pos <= offset) {
+			low = middle;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+
+/*
+ * Make sure that a region starts at "offset", splitting the region it
+ * falls in if necessary.  Returns false on memory allocation failure.
+ */
+static bool pv__rescue_split(struct pvrescue_s *rescue, off_t offset)
+{
+	struct pvrescue_region_s *region;
+	size_t index;
+
+	if ((offset <= 0) || (offset >= rescue->size))
+		return true;
+
+	index = pv__rescue_region_at(rescue, offset);
+	if (rescue->regions[index].pos == offset)
+		return true;
+
+	if (rescue->region_count >= rescue->region_capacity) {
+		struct pvrescue_region_s *new_regions;
+		size_t new_capacity;
+
+		new_capacity = rescue->region_capacity * 2;
+		new_regions = realloc(rescue->regions, new_capacity * sizeof(*new_regions));
+		if (NULL == new_regions)
+			return false;
+		rescue->regions = new_regions;
+		rescue->region_capacity = new_capacity;
+	}
+
+	memmove(&(rescue->regions[index + 2]), &(rescue->regions[index + 1]),
+		(rescue->region_count - index - 1) * sizeof(rescue->regions[0]));
+	rescue->region_count++;
+
+	region = &(rescue->regions[index]);
+	region[1].pos = offset;
+	region[1].size = region[0].pos + region[0].size - offset;
+	region[1].status = region[0].status;
+	region[0].size = offset - region[0].pos;
+
+	return true;
+}
+
+
+/*
+ * Give the "size" bytes at "pos" the status "status", merging regions
+ * with the same status afterwards.
+ */
+static void pv__rescue_mark(pvstate_t state, struct pvrescue_s *rescue, off_t pos, off_t size, char status)
+{
+	size_t index, merged;
+
+	if (pos + size > rescue->size)
+		size = rescue->size - pos;
+	if (size <= 0)
+		return;
+
+	if ((!pv__rescue_split(rescue, pos)) || (!pv__rescue_split(rescue, pos + size))) {
+		pv_error("%s: %s", _("rescue map allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		return;
+	}
+
+	for (index = pv__rescue_region_at(rescue, pos);
+	     (index < rescue->region_count) && (rescue->regions[index].pos < pos + size); index++) {
+		rescue->regions[index].status = status;
+	}
+
+	merged = 0;
+	for (index = 1; index < rescue->region_count; index++) {
+		if (rescue->regions[index].status == rescue->regions[merged].status) {
+			rescue->regions[merged].size += rescue->regions[index].size;
+		} else {
+			merged++;
+			rescue->regions[merged] = rescue->regions[index];
+		}
+	}
+	rescue->region_count = merged + 1;
+}
+
+
+/*
+ * Find the first part of the map at or after "from" whose status is
+ * "status", putting its bounds in *pos and *size.  Returns false if there
+ * isn't one.
+ */
+static bool pv__rescue_find(const struct pvrescue_s *rescue, char status, off_t from, off_t *pos, off_t *size)
+{
+	size_t index;
+
+	if (from >= rescue->size)
+		return false;
+	if (from < 0)
+		from = 0;
+
+	for (index = pv__rescue_region_at(rescue, from); index < rescue->region_count; index++) {
+		const struct pvrescue_region_s *region = &(rescue->regions[index]);
+		off_t start;
+
+		if (region->status != status)
+			continue;
+		start = region->pos > from ? region->pos : from;
+		*pos = start;
+		*size = region->pos + region->size - start;
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * Return the total size of the parts of the map whose status is "status".
+ */
+static off_t pv__rescue_total(const struct pvrescue_s *rescue, char status)
+{
+	off_t total;
+	size_t index;
+
+	total = 0;
+	for (index = 0; index < rescue->region_count; index++) {
+		if (rescue->regions[index].status == status)
+			total += rescue->regions[index].size;
+	}
+
+	return total;
+}
+
+
+/*
+ * Write the map to the map file, by way of a temporary file.  Errors are
+ * reported once, after which the map is no longer written.
+ */
+static void pv__rescue_write_map(pvstate_t state, struct pvrescue_s *rescue)
+{
+	FILE *stream;
+	size_t index;
+	char current_status;
+	unsigned int current_pass;
+
+	rescue->map_written = time(NULL);
+
+	if ((rescue->map_failed) || (NULL == state->control.rescue_map))
+		return;
+
+	switch (rescue->phase) {
+	case PV_RESCUE_PHASE_COPY_SKIP:
+		current_status = '?';
+		current_pass = 1;
+		break;
+	case PV_RESCUE_PHASE_COPY:
+		current_status = '?';
+		current_pass = 2;
+		break;
+	case PV_RESCUE_PHASE_BISECT:
+		current_status = '*';
+		current_pass = 1;
+		break;
+	case PV_RESCUE_PHASE_RETRY:
+		current_status = '-';
+		current_pass = rescue->retry_pass;
+		break;
+	default:
+		current_status = '+';
+		current_pass = 1;
+		break;
+	}
+
+	stream = fopen(rescue->temp_filename, "w");	/* flawfinder: ignore */
+	/*
+	 * flawfinder rationale: the name is chosen by the user, and the
+	 * temporary file is only ever renamed over it.
+	 */
+	if (NULL == stream) {
+		pv_error("%s: %s", rescue->temp_filename, strerror(errno));
+		rescue->map_failed = true;
+		return;
+	}
+
+	fprintf(stream, "# Mapfile. Created by %s version %s\n", PACKAGE_NAME, PACKAGE_VERSION);
+	fprintf(stream, "# current_pos  current_status  current_pass\n");
+	fprintf(stream, "0x%08llX     %c               %u\n", (unsigned long long) (rescue->cursor), current_status,
+		current_pass);
+	fprintf(stream, "#      pos        size  status\n");
+	for (index = 0; index < rescue->region_count; index++) {
+		fprintf(stream, "0x%08llX  0x%08llX  %c\n", (unsigned long long) (rescue->regions[index].pos),
+			(unsigned long long) (rescue->regions[index].size), rescue->regions[index].status);
+	}
+
+	if (0 != fclose(stream)) {
+		pv_error("%s: %s", rescue->temp_filename, strerror(errno));
+		(void) unlink(rescue->temp_filename);
+		rescue->map_failed = true;
+		return;
+	}
+
+	if (0 != rename(rescue->temp_filename, state->control.rescue_map)) {
+		pv_error("%s: %s", state->control.rescue_map, strerror(errno));
+		(void) unlink(rescue->temp_filename);
+		rescue->map_failed = true;
+	}
+}
+
+
+/*
+ * Read the regions listed in the map file, if it exists, and work out
+ * where to carry on from.  Returns false if the file exists but can't be
+ * used, so that it isn't overwritten.
+ */
+static bool pv__rescue_read_map(pvstate_t state, struct pvrescue_s *rescue)
+{
+	char line[PV_RESCUE_LINE_LENGTH];	/* flawfinder: ignore - bounded by fgets() */
+	FILE *stream;
+	off_t expected_pos;
+	bool valid, have_current;
+	long long current_pos;
+	char current_status;
+	unsigned int current_pass;
+
+	stream = fopen(state->control.rescue_map, "r");	/* flawfinder: ignore */
+	/* flawfinder rationale: the name is chosen by the user. */
+	if (NULL == stream) {
+		if (ENOENT == errno)
+			return true;
+		pv_error("%s: %s", state->control.rescue_map, strerror(errno));
+		return false;
+	}
+
+	valid = true;
+	have_current = false;
+	current_pos = 0;
+	current_status = '?';
+	current_pass = 1;
+	expected_pos = 0;
+
+	while (NULL != fgets(line, (int) sizeof(line), stream)) {
+		long long pos, size;
+		char status;
+		char *start = line;
+
+		while ((' ' == *start) || ('\t' == *start))
+			start++;
+		if (('#' == *start) || ('\n' == *start) || ('\r' == *start) || ('\0' == *start))
+			continue;
+
+		if (!have_current) {
+			/* The first line is where the last run got to. */
+			if (sscanf(start, "%lli %c %u", &current_pos, &current_status, &current_pass) < 2) {	/* flawfinder: ignore */
+				/* flawfinder rationale: only numbers and one character are read. */
+				valid = false;
+				break;
+			}
+			have_current = true;
+			continue;
+		}
+
+		if ((3 != sscanf(start, "%lli %lli %c", &pos, &size, &status))	/* flawfinder: ignore */
+		    /* flawfinder rationale: only numbers and one character are read. */
+		    || (pos != (long long) expected_pos) || (size <= 0) || (NULL == strchr("?*/-+", (int) status))) {
+			valid = false;
+			break;
+		}
+
+		if ((off_t) pos < rescue->size)
+			pv__rescue_mark(state, rescue, (off_t) pos, (off_t) size, status);
+		expected_pos = (off_t) (pos + size);
+	}
+
+	(void) fclose(stream);
+
+	if (!valid) {
+		pv_error("%s: %s", state->control.rescue_map, _("not a valid rescue map file"));
+		return false;
+	}
+
+	/* Carry on with the first pass from where it was, if that's where it was. */
+	if (('?' == current_status) && (current_pass <= 1) && (current_pos > 0)
+	    && ((off_t) current_pos < rescue->size)) {
+		rescue->cursor = (off_t) current_pos;
+	}
+
+	debug("%s: %s: %s=%lld, %s=%lld", "loaded rescue map", state->control.rescue_map, "rescued",
+	      (long long) pv__rescue_total(rescue, '+'), "bad", (long long) pv__rescue_total(rescue, '-'));
+
+	return true;
+}
+
+
+/*
+ * Return the size of the sectors of "fd", the smallest unit it makes
+ * sense to read on its own.
+ */
+static size_t pv__rescue_sector_size(int fd)
+{
+	struct stat sb;
+	long sector_size;
+
+	sector_size = 512;
+
+	memset(&sb, 0, sizeof(sb));
+	if (0 != fstat(fd, &sb))
+		return (size_t) sector_size;
+
+	if (S_ISBLK(sb.st_mode) || S_ISCHR(sb.st_mode)) {
+		struct pvblkdev_s geometry;
+		if (pv_blkdev_probe(fd, &geometry) && (geometry.logical_sector > 0))
+			sector_size = (long) (geometry.logical_sector);
+	} else if ((sb.st_blksize > 0) && (sb.st_blksize <= 65536)) {
+		/* Filesystems report read errors a block at a time. */
+		sector_size = (long) (sb.st_blksize);
+	}
+
+	return (size_t) sector_size;
+}
+
+
+/*
+ * Turn direct I/O on "fd" on or off, returning false if it couldn't be
+ * done.
+ */
+static bool pv__rescue_set_direct(int fd, bool enable)
+{
+#if defined(O_DIRECT)
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0)
+		return false;
+	flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+	if (0 != fcntl(fd, F_SETFL, flags)) {
+		debug("%s: %d: %s", "fcntl", fd, strerror(errno));
+		return false;
+	}
+	return true;
+#elif defined(F_NOCACHE)
+	if (0 != fcntl(fd, F_NOCACHE, enable ? 1 : 0)) {
+		debug("%s: %d: %s", "fcntl", fd, strerror(errno));
+		return false;
+	}
+	return true;
+#else
+	(void) fd;
+	(void) enable;
+	return false;
+#endif
+}
+
+
+/*
+ * Set up the rescue of "fd": check that the input and output are both
+ * seekable, and load the map file if there is one.  Returns false, having
+ * reported the problem, if the rescue can't go ahead.
+ */
+static bool pv__rescue_start(pvstate_t state, int fd)
+{
+	struct pvrescue_s *rescue;
+	off_t size, output_start, already_rescued;
+	size_t name_length;
+
+	size = pv_blkdev_size(fd);
+	if (size <= 0)
+		size = lseek(fd, 0, SEEK_END);
+	if (size <= 0) {
+		/*@-compdef@ */
+		pv_error("%s: %s", pv_current_file_name(state), _("input size unknown - cannot rescue it"));
+		/*@+compdef@ */
+		/* splint - see pv_current_file_name() calls in transfer.c. */
+		return false;
+	}
+
+	output_start = lseek(state->control.output_fd, 0, SEEK_CUR);
+	if (output_start < 0) {
+		pv_error("%s: %s", _("output is not seekable - cannot rescue to it"), strerror(errno));
+		return false;
+	}
+
+	rescue = calloc(1, sizeof(*rescue));
+	if (NULL == rescue) {
+		pv_error("%s: %s", _("rescue map allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		return false;
+	}
+
+	rescue->region_capacity = 64;
+	rescue->regions = calloc(rescue->region_capacity, sizeof(rescue->regions[0]));
+	name_length = strlen(state->control.rescue_map) + 32;	/* flawfinder: ignore - always \0-terminated */
+	rescue->temp_filename = malloc(name_length);
+	if ((NULL == rescue->regions) || (NULL == rescue->temp_filename)) {
+		pv_error("%s: %s", _("rescue map allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		if (NULL != rescue->regions)
+			free(rescue->regions);
+		if (NULL != rescue->temp_filename)
+			free(rescue->temp_filename);
+		free(rescue);
+		return false;
+	}
+	(void) pv_snprintf(rescue->temp_filename, name_length, "%s.tmp.%lu", state->control.rescue_map,
+			   (unsigned long) getpid());
+
+	rescue->region_count = 1;
+	rescue->regions[0].pos = 0;
+	rescue->regions[0].size = size;
+	rescue->regions[0].status = '?';
+	rescue->size = size;
+	rescue->output_start = output_start;
+	rescue->skip_size = PV_RESCUE_MIN_SKIP;
+	rescue->sector_size = pv__rescue_sector_size(fd);
+	rescue->phase = PV_RESCUE_PHASE_COPY_SKIP;
+	rescue->input_fd = fd;
+
+	state->transfer.rescue = rescue;
+
+	if (!pv__rescue_read_map(state, rescue)) {
+		rescue->map_failed = true;
+		pv_rescue_free(&(state->transfer));
+		return false;
+	}
+
+	/* Show the progress of what's left to rescue. */
+	already_rescued = pv__rescue_total(rescue, '+');
+	if ((already_rescued > 0) && (state->control.size == size))
+		state->control.size = size - already_rescued;
+
+	pv__rescue_write_map(state, rescue);
+
+	debug("%s: %s=%lld, %s=%ld, %s=%lld", "rescue started", "size", (long long) size, "sector",
+	      (long) (rescue->sector_size), "output start", (long long) output_start);
+
+	return true;
+}
+
+
+/*
+ * Move on to the next phase, starting it from the beginning of the input.
+ */
+static void pv__rescue_next_phase(pvstate_t state, struct pvrescue_s *rescue)
+{
+	switch (rescue->phase) {
+	case PV_RESCUE_PHASE_COPY_SKIP:
+		rescue->phase = PV_RESCUE_PHASE_COPY;
+		break;
+	case PV_RESCUE_PHASE_COPY:
+		rescue->phase = PV_RESCUE_PHASE_BISECT;
+		break;
+	case PV_RESCUE_PHASE_BISECT:
+		rescue->phase = PV_RESCUE_PHASE_RETRY;
+		rescue->retry_pass = 1;
+		break;
+	case PV_RESCUE_PHASE_RETRY:
+		if (rescue->retry_pass < state->control.rescue_retries) {
+			rescue->retry_pass++;
+		} else {
+			rescue->phase = PV_RESCUE_PHASE_DONE;
+		}
+		break;
+	default:
+		rescue->phase = PV_RESCUE_PHASE_DONE;
+		break;
+	}
+
+	if ((PV_RESCUE_PHASE_RETRY == rescue->phase) && (0 == state->control.rescue_retries))
+		rescue->phase = PV_RESCUE_PHASE_DONE;
+
+	/* Direct I/O is only for the retries. */
+	if (rescue->direct_io && (PV_RESCUE_PHASE_RETRY != rescue->phase)) {
+		(void) pv__rescue_set_direct(rescue->input_fd, false);
+		rescue->direct_io = false;
+	}
+	if ((PV_RESCUE_PHASE_RETRY == rescue->phase) && state->control.rescue_direct && (!rescue->direct_io))
+		rescue->direct_io = pv__rescue_set_direct(rescue->input_fd, true);
+
+	rescue->cursor = 0;
+	rescue->skip_size = PV_RESCUE_MIN_SKIP;
+	rescue->stack_depth = 0;
+
+	debug("%s: %d (%s %u)", "rescue phase", (int) (rescue->phase), "pass", rescue->retry_pass);
+
+	pv__rescue_write_map(state, rescue);
+}
+
+
+/*
+ * Put the two halves of the failed range of "size" bytes at "pos" on the
+ * bisection stack, split on a sector boundary, with the first half on top
+ * so that it is tried first.  A range of one sector is put back whole.
+ */
+static void pv__rescue_bisect_push(struct pvrescue_s *rescue, off_t pos, off_t size)
+{
+	off_t half;
+
+	half = size / 2;
+	half -= half % (off_t) (rescue->sector_size);
+	if (half <= 0)
+		half = size;
+
+	if (half < size) {
+		rescue->stack[rescue->stack_depth].pos = pos + half;
+		rescue->stack[rescue->stack_depth].size = size - half;
+		rescue->stack_depth++;
+	}
+	rescue->stack[rescue->stack_depth].pos = pos;
+	rescue->stack[rescue->stack_depth].size = half;
+	rescue->stack_depth++;
+}
+
+
+/*
+ * Read "length" bytes at input offset "pos" into the transfer buffer.
+ * Returns the number of bytes read, or -1 with *read_errno set.
+ */
+static ssize_t pv__rescue_read(pvstate_t state, struct pvrescue_s *rescue, off_t pos, size_t length, int *read_errno)
+{
+	struct timespec io_start;
+	ssize_t nread;
+
+	*read_errno = 0;
+
+	pv_elapsedtime_read(&io_start);
+	nread = pread(rescue->input_fd, state->transfer.transfer_buffer, length, pos);
+	if ((nread < 0) && (EINVAL == errno) && rescue->direct_io) {
+		/* The read wasn't aligned for direct I/O - do without it. */
+		debug("%s", "direct read rejected - turning direct I/O off");
+		(void) pv__rescue_set_direct(rescue->input_fd, false);
+		rescue->direct_io = false;
+		nread = pread(rescue->input_fd, state->transfer.transfer_buffer, length, pos);
+	}
+	if (nread < 0)
+		*read_errno = errno;
+	pv_latency_record(&(state->transfer), PV_LATENCY_READ, &io_start);
+	pv_trace_record(&(state->transfer), PV_TRACE_READ, rescue->input_fd, (long long) nread, &io_start);
+
+	return nread;
+}
+
+
+/*
+ * Write "length" bytes from the transfer buffer to the output, at the
+ * place matching input offset "pos".  Returns false on error, which has
+ * been reported.
+ */
+static bool pv__rescue_write(pvstate_t state, struct pvrescue_s *rescue, off_t pos, size_t length)
+{
+	struct timespec io_start;
+	size_t offset;
+
+	pv_elapsedtime_read(&io_start);
+
+	for (offset = 0; offset < length;) {
+		ssize_t nwritten;
+
+		nwritten = pwrite(state->control.output_fd, state->transfer.transfer_buffer + offset, length - offset,
+				  rescue->output_start + pos + (off_t) offset);
+		if (nwritten > 0) {
+			offset += (size_t) nwritten;
+			continue;
+		}
+		if ((nwritten < 0) && (EINTR == errno))
+			continue;
+
+		pv_error("%s: %s", _("write failed"), nwritten < 0 ? strerror(errno) : _("no data written"));
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		return false;
+	}
+
+	if (state->control.sync_after_write)
+		(void) fsync(state->control.output_fd);
+
+	pv_latency_record(&(state->transfer), PV_LATENCY_WRITE, &io_start);
+	pv_trace_record(&(state->transfer), PV_TRACE_WRITE, state->control.output_fd, (long long) length, &io_start);
+
+	return true;
+}
+
+
+/*
+ * Note a read error at input offset "pos".  The first one is reported,
+ * with where it was; after that, the map file records where they were.
+ */
+static void pv__rescue_read_error(pvstate_t state, struct pvrescue_s *rescue, off_t pos, int read_errno)
+{
+	state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+
+	debug("%s: %lld: %s", "rescue read error", (long long) pos, strerror(read_errno));
+
+	if (rescue->error_shown)
+		return;
+	rescue->error_shown = true;
+
+	/*@-compdef@ */
+	pv_error("%s: %s %lld: %s", pv_current_file_name(state), _("warning: read errors detected, starting at offset"),
+		 (long long) pos, strerror(read_errno));
+	/*@+compdef@ */
+	/* splint - see pv_current_file_name() calls in transfer.c. */
+}
+
+
+/*
+ * Finish the rescue: make sure the output covers the whole input, even if
+ * the end of it couldn't be read, and leave the output positioned after
+ * it.  Reports how much couldn't be rescued.
+ */
+static void pv__rescue_done(pvstate_t state, struct pvrescue_s *rescue)
+{
+	struct stat sb;
+	off_t output_end, unrescued;
+
+	output_end = rescue->output_start + rescue->size;
+	memset(&sb, 0, sizeof(sb));
+	if ((0 == fstat(state->control.output_fd, &sb)) && S_ISREG(sb.st_mode) && (sb.st_size < output_end)) {
+		if (0 != ftruncate(state->control.output_fd, output_end))
+			debug("%s: %s", "output ftruncate() failed", strerror(errno));
+	}
+	(void) lseek(state->control.output_fd, output_end, SEEK_SET);
+
+	unrescued = rescue->size - pv__rescue_total(rescue, '+');
+	if (unrescued > 0) {
+		/*@-compdef@ */
+		pv_error("%s: %lld %s", pv_current_file_name(state), (long long) unrescued,
+			 _("bytes could not be rescued - see the rescue map for where"));
+		/*@+compdef@ */
+		/* splint - see pv_current_file_name() calls in transfer.c. */
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+	}
+}
+
+
+/*
+ * Do the next step of the rescue of "fd" to the output: one read, and, if
+ * it worked, one write.  No more than "allowed" bytes are read if a rate
+ * limit is in force.
+ *
+ * Returns the number of bytes rescued, 0 if nothing was rescued this time
+ * (such as after a read error), or -1 on a write error.  Sets *eof_in and
+ * *eof_out once every phase is complete.
+ */
+ssize_t pv_rescue_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed)
+{
+	struct pvrescue_s *rescue;
+	off_t pos, size;
+	size_t limit, length;
+	ssize_t nread;
+	int read_errno;
+
+	state->transfer.written = 0;
+
+	rescue = state->transfer.rescue;
+	if (NULL == rescue) {
+		if (!pv__rescue_start(state, fd)) {
+			state->status.exit_status |= PV_ERROREXIT_ACCESS;
+			*eof_in = true;
+			*eof_out = true;
+			return -1;
+		}
+		rescue = state->transfer.rescue;
+		if (NULL == rescue)
+			return -1;
+	}
+
+	if (time(NULL) - rescue->map_written >= PV_RESCUE_MAP_INTERVAL)
+		pv__rescue_write_map(state, rescue);
+
+	/* Read in whole sectors, the size of the buffer at most. */
+	limit = state->transfer.buffer_size;
+	if ((allowed > 0) && ((off_t) limit > allowed))
+		limit = (size_t) allowed;
+	if (limit > rescue->sector_size)
+		limit -= limit % rescue->sector_size;
+
+	while (PV_RESCUE_PHASE_DONE != rescue->phase) {
+		struct pvrescue_range_s range;
+
+		switch (rescue->phase) {
+		case PV_RESCUE_PHASE_COPY_SKIP:
+		case PV_RESCUE_PHASE_COPY:
+			if (!pv__rescue_find(rescue, '?', rescue->cursor, &pos, &size)) {
+				pv__rescue_next_phase(state, rescue);
+				continue;
+			}
+			length = (off_t) limit < size ? limit : (size_t) size;
+			nread = pv__rescue_read(state, rescue, pos, length, &read_errno);
+			if (nread < 0) {
+				if ((EINTR == read_errno) || (EAGAIN == read_errno))
+					return 0;
+				pv__rescue_read_error(state, rescue, pos, read_errno);
+				pv__rescue_mark(state, rescue, pos, (off_t) length, '*');
+				rescue->cursor = pos + (off_t) length;
+				if (PV_RESCUE_PHASE_COPY_SKIP == rescue->phase) {
+					rescue->cursor += rescue->skip_size;
+					if (rescue->skip_size < PV_RESCUE_MAX_SKIP)
+						rescue->skip_size *= 2;
+				}
+				return 0;
+			}
+			if (0 == nread) {
+				/* The input seems to be shorter than it said. */
+				pv__rescue_mark(state, rescue, pos, size, '-');
+				rescue->cursor = pos + size;
+				return 0;
+			}
+			rescue->skip_size = PV_RESCUE_MIN_SKIP;
+			break;
+
+		case PV_RESCUE_PHASE_BISECT:
+			if (0 == rescue->stack_depth) {
+				if ((!pv__rescue_find(rescue, '*', 0, &pos, &size))
+				    && (!pv__rescue_find(rescue, '/', 0, &pos, &size))) {
+					pv__rescue_next_phase(state, rescue);
+					continue;
+				}
+				if (size > (off_t) (state->transfer.buffer_size))
+					size = (off_t) (state->transfer.buffer_size);
+				/*
+				 * The whole range has already failed once, so
+				 * go straight to its two halves.
+				 */
+				pv__rescue_bisect_push(rescue, pos, size);
+				continue;
+			}
+
+			range = rescue->stack[rescue->stack_depth - 1];
+			pos = range.pos;
+			length = (off_t) limit < range.size ? limit : (size_t) (range.size);
+			nread = pv__rescue_read(state, rescue, pos, length, &read_errno);
+			if ((nread < 0) && ((EINTR == read_errno) || (EAGAIN == read_errno)))
+				return 0;
+
+			rescue->stack_depth--;
+
+			if ((nread >= 0) && ((off_t) nread < range.size)) {
+				/* Leave the rest of the range for the next step. */
+				rescue->stack[rescue->stack_depth].pos = pos + (off_t) nread;
+				rescue->stack[rescue->stack_depth].size = range.size - (off_t) nread;
+				rescue->stack_depth++;
+			}
+
+			if (0 == nread) {
+				/* The input seems to be shorter than it said. */
+				rescue->stack_depth = 0;
+				pv__rescue_mark(state, rescue, pos, range.size, '-');
+				return 0;
+			}
+
+			if (nread < 0) {
+				pv__rescue_read_error(state, rescue, pos, read_errno);
+
+				if ((range.size <= (off_t) (rescue->sector_size))
+				    || (rescue->stack_depth + 2 > PV_RESCUE_BISECT_DEPTH)) {
+					pv__rescue_mark(state, rescue, pos, range.size, '-');
+					return 0;
+				}
+
+				pv__rescue_bisect_push(rescue, pos, range.size);
+				return 0;
+			}
+			break;
+
+		case PV_RESCUE_PHASE_RETRY:
+			if (!pv__rescue_find(rescue, '-', rescue->cursor, &pos, &size)) {
+				pv__rescue_next_phase(state, rescue);
+				continue;
+			}
+			length = rescue->sector_size < (size_t) size ? rescue->sector_size : (size_t) size;
+			nread = pv__rescue_read(state, rescue, pos, length, &read_errno);
+			if (nread <= 0) {
+				if ((nread < 0) && ((EINTR == read_errno) || (EAGAIN == read_errno)))
+					return 0;
+				rescue->cursor = pos + (off_t) length;
+				return 0;
+			}
+			break;
+
+		default:
+			continue;
+		}
+
+		/* Something was read - write it out and mark it as rescued. */
+		if (!pv__rescue_write(state, rescue, pos, (size_t) nread)) {
+			*eof_out = true;
+			return -1;
+		}
+		pv__rescue_mark(state, rescue, pos, (off_t) nread, '+');
+		rescue->cursor = pos + (off_t) nread;
+		state->transfer.total_bytes_read += nread;
+		state->transfer.written = nread;
+		return nread;
+	}
+
+	pv__rescue_done(state, rescue);
+	pv__rescue_write_map(state, rescue);
+	*eof_in = true;
+	*eof_out = true;
+
+	return 0;
+}
+
+
+/*
+ * Write out the map one last time and free the rescue state, if there is
+ * any.  Called when the transfer ends, however it ends.
+ */
+void pv_rescue_finish(pvstate_t state)
+{
+	if (NULL == state->transfer.rescue)
+		return;
+	pv__rescue_write_map(state, state->transfer.rescue);
+	pv_rescue_free(&(state->transfer));
+}
+
+
+/*
+ * Free the rescue state, if there is any, without writing the map.
+ */
+void pv_rescue_free(pvtransferstate_t transfer)
+{
+	struct pvrescue_s *rescue;
+
+	if ((NULL == transfer) || (NULL == transfer->rescue))
+		return;
+
+	rescue = transfer->rescue;
+	transfer->rescue = NULL;
+
+	if (rescue->direct_io)
+		(void) pv__rescue_set_direct(rescue->input_fd, false);
+	if (NULL != rescue->regions)
+		free(rescue->regions);
+	if (NULL != rescue->temp_filename)
+		free(rescue->temp_filename);
+	free(rescue);
+}
@@ -411,13 +411,16 @@ void pv_sig_init(pvstate_t state)
 
 	/*
 	 * Handle SIGWINCH by setting a flag to let the main loop know it
-	 * has to reread the terminal size.
+	 * has to reread the terminal size - unless there is no display, in
+	 * which case the size is never needed.
 	 */
 #ifdef SIGWINCH
-	sa.sa_handler = pv_sig_winch;
-	(void) sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	(void) sigaction(SIGWINCH, &sa, &(pv_sig_state->signal.old_sigwinch));
+	if (!pv_sig_state->control.no_display) {
+		sa.sa_handler = pv_sig_winch;
+		(void) sigemptyset(&(sa.sa_mask));
+		sa.sa_flags = 0;
+		(void) sigaction(SIGWINCH, &sa, &(pv_sig_state->signal.old_sigwinch));
+	}
 #endif
 
 	/*
@@ -503,7 +506,8 @@ void pv_sig_fini( /*@unused@ */  __attribute__((unused)) pvstate_t state)
 	(void) sigaction(SIGTSTP, &(pv_sig_state->signal.old_sigtstp), NULL);
 	(void) sigaction(SIGCONT, &(pv_sig_state->signal.old_sigcont), NULL);
 #ifdef SIGWINCH
-	(void) sigaction(SIGWINCH, &(pv_sig_state->signal.old_sigwinch), NULL);
+	if (!pv_sig_state->control.no_display)
+		(void) sigaction(SIGWINCH, &(pv_sig_state->signal.old_sigwinch), NULL);
 #endif
 	(void) sigaction(SIGINT, &(pv_sig_state->signal.old_sigint), NULL);
 	(void) sigaction(SIGHUP, &(pv_sig_state->signal.old_sighup), NULL);
@@ -0,0 +1,402 @@
+/*
+ * Functions for finding out how big a compressed file will be once it is
+ * decompressed, from the sizes recorded in the file itself.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * Only a few reads are needed for each format, and nothing is
+ * decompressed:
+ *
+ * gzip - the last 4 bytes of the file are the size of the last member,
+ * modulo 2^32.  Since deflate can't make anything more than slightly
+ * bigger, a size that comes out well below the size of the file itself
+ * must have wrapped, and 2^32 is added until it doesn't.  Only the last
+ * member of a multi-member file is counted.
+ *
+ * zstd - each frame header may hold the frame's content size.  The frames
+ * are walked by their block headers, skipping skippable frames, and their
+ * sizes are added up; if any frame has no content size, the total is
+ * unknown.  A file written by "zstd" from a regular file is usually a
+ * single frame, so this is normally one read.
+ *
+ * xz - the stream footer at the end of the file points back to the index,
+ * which lists the uncompressed size of every block.  The streams are
+ * followed backwards from the end, so concatenated streams and stream
+ * padding are allowed for.
+ *
+ * Only seekable files can be looked at; anything else has no hint.
+ */
+#define PV_SIZEHINT_MAX_ZSTD_BLOCKS	10000000	/* give up after this many blocks */
+#define PV_SIZEHINT_MAX_XZ_INDEX	67108864	/* largest xz index read */
+
+
+/*
+ * Read exactly "count" bytes at "offset" of "fd" into "buf", returning
+ * false if that many couldn't be read.
+ */
+static bool pv__sizehint_read(int fd, off_t offset, unsigned char *buf, size_t count)
+{
+	size_t done;
+
+	if (offset < 0)
+		return false;
+
+	done = 0;
+	while (done < count) {
+		ssize_t nread;
+		nread = pread(fd, buf + done, count - done, offset + (off_t) done);	/* flawfinder: ignore */
+		/* flawfinder rationale: bounded by "count", the caller's buffer size. */
+		if ((nread < 0) && (EINTR == errno))
+			continue;
+		if (nread <= 0)
+			return false;
+		done += (size_t) nread;
+	}
+
+	return true;
+}
+
+
+/*
+ * Return the little-endian value of the "count" bytes at "buf".
+ */
+static uint64_t pv__sizehint_le(const unsigned char *buf, size_t count)
+{
+	uint64_t value;
+	size_t idx;
+
+	value = 0;
+	for (idx = count; idx > 0; idx--)
+		value = (value << 8) | (uint64_t) (buf[idx - 1]);
+
+	return value;
+}
+
+
+/*
+ * Return the decompressed size of the gzip file open on "fd", whose size
+ * is "file_size", or -1 if it isn't known.
+ */
+static off_t pv__sizehint_gzip(int fd, off_t file_size)
+{
+	unsigned char trailer[4];
+	uint64_t size, minimum;
+
+	if (file_size < 18)
+		return -1;
+	if (!pv__sizehint_read(fd, file_size - 4, trailer, sizeof(trailer)))
+		return -1;
+
+	size = pv__sizehint_le(trailer, 4);
+
+	/*
+	 * Stored blocks add 5 bytes in every 65535, plus the header and
+	 * trailer, so the data can't be smaller than this.
+	 */
+	minimum = (uint64_t) file_size;
+	if (minimum > 65536 + minimum / 256) {
+		minimum -= 65536 + minimum / 256;
+	} else {
+		minimum = 0;
+	}
+	while (size < minimum)
+		size += (uint64_t) 1 << 32;
+
+	return (off_t) size;
+}
+
+
+/*
+ * Return the decompressed size of the zstd file open on "fd", whose size
+ * is "file_size", or -1 if it isn't known.
+ */
+static off_t pv__sizehint_zstd(int fd, off_t file_size)
+{
+	unsigned long blocks;
+	uint64_t total;
+	off_t offset;
+
+	total = 0;
+	offset = 0;
+	blocks = 0;
+
+	while (offset < file_size) {
+		unsigned char header[18];
+		uint32_t magic;
+		unsigned int descriptor, fcs_flag, dictionary_bytes, fcs_bytes;
+		bool single_segment, last_block;
+		size_t header_size;
+
+		if (!pv__sizehint_read(fd, offset, header, 8))
+			return -1;
+		magic = (uint32_t) pv__sizehint_le(header, 4);
+
+		if (0x184D2A50 == (magic & 0xFFFFFFF0)) {
+			/* Skippable frame. */
+			offset += 8 + (off_t) pv__sizehint_le(header + 4, 4);
+			continue;
+		}
+		if (0xFD2FB528 != magic)
+			return -1;
+
+		descriptor = (unsigned int) (header[4]);
+		fcs_flag = descriptor >> 6;
+		single_segment = (0 != (descriptor & 0x20)) ? true : false;
+		dictionary_bytes = (descriptor & 0x03) == 3 ? 4 : (descriptor & 0x03);
+		fcs_bytes = (0 == fcs_flag) ? (single_segment ? 1 : 0) : (1U << fcs_flag);
+		if (0 == fcs_bytes) {
+			debug("%s: %lld", "zstd frame has no content size", (long long) offset);
+			return -1;
+		}
+
+		header_size = 5 + (single_segment ? 0 : 1) + dictionary_bytes + fcs_bytes;
+		if (!pv__sizehint_read(fd, offset, header, header_size))
+			return -1;
+
+		if (2 == fcs_bytes) {
+			total += 256 + pv__sizehint_le(header + header_size - 2, 2);
+		} else {
+			total += pv__sizehint_le(header + header_size - fcs_bytes, fcs_bytes);
+		}
+
+		offset += (off_t) header_size;
+
+		/* Walk the blocks to find the end of the frame. */
+		do {
+			unsigned char block_header[3];
+			uint32_t block;
+			unsigned int block_type;
+
+			if (++blocks > PV_SIZEHINT_MAX_ZSTD_BLOCKS)
+				return -1;
+			if (!pv__sizehint_read(fd, offset, block_header, sizeof(block_header)))
+				return -1;
+			block = (uint32_t) pv__sizehint_le(block_header, 3);
+			last_block = (0 != (block & 1)) ? true : false;
+			block_type = (unsigned int) ((block >> 1) & 3);
+			offset += 3;
+			if (3 == block_type)
+				return -1;
+			offset += (1 == block_type) ? 1 : (off_t) (block >> 3);
+		} while ((!last_block) && (offset < file_size));
+
+		/* Content checksum. */
+		if (0 != (descriptor & 0x04))
+			offset += 4;
+	}
+
+	if (offset != file_size)
+		return -1;
+
+	return (off_t) total;
+}
+
+
+/*
+ * Decode the xz variable-length integer at "buf", no further than "end",
+ * into "value", returning the number of bytes it took, or 0 if it isn't
+ * valid.
+ */
+static size_t pv__sizehint_xz_varint(const unsigned char *buf, const unsigned char *end, uint64_t *value)
+{
+	size_t used;
+
+	*value = 0;
+	for (used = 0; used < 9 && buf + used < end; used++) {
+		*value |= (uint64_t) (buf[used] & 0x7F) << (7 * used);
+		if (0 == (buf[used] & 0x80))
+			return used + 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Add up the uncompressed sizes in the xz stream that ends at "end" in the
+ * file open on "fd", adding them to "total" and setting "start" to where
+ * the stream begins.  Returns false if the stream can't be understood.
+ */
+static bool pv__sizehint_xz_stream(int fd, off_t end, uint64_t *total, off_t *start)
+{
+	unsigned char footer[12];
+	unsigned char stream_header[12];
+	unsigned char *index;
+	const unsigned char *ptr, *index_end;
+	uint64_t records, record, blocks_size;
+	size_t index_size, used;
+	off_t index_start;
+
+	if (end < 32)
+		return false;
+	if (!pv__sizehint_read(fd, end - 12, footer, sizeof(footer)))
+		return false;
+	if (('Y' != footer[10]) || ('Z' != footer[11]))
+		return false;
+
+	index_size = (size_t) ((pv__sizehint_le(footer + 4, 4) + 1) * 4);
+	if (index_size > PV_SIZEHINT_MAX_XZ_INDEX)
+		return false;
+	index_start = end - 12 - (off_t) index_size;
+	if (index_start < 12)
+		return false;
+
+	index = malloc(index_size);
+	if (NULL == index)
+		return false;
+	if ((!pv__sizehint_read(fd, index_start, index, index_size)) || (0 != index[0])) {
+		free(index);
+		return false;
+	}
+
+	/* The index ends with a CRC32, which isn't checked here. */
+	index_end = index + index_size - 4;
+	ptr = index + 1;
+
+	used = pv__sizehint_xz_varint(ptr, index_end, &records);
+	if (0 == used) {
+		free(index);
+		return false;
+	}
+	ptr += used;
+
+	blocks_size = 0;
+	for (record = 0; record < records; record++) {
+		uint64_t unpadded, uncompressed;
+
+		used = pv__sizehint_xz_varint(ptr, index_end, &unpadded);
+		if (0 == used)
+			break;
+		ptr += used;
+		used = pv__sizehint_xz_varint(ptr, index_end, &uncompressed);
+		if (0 == used)
+			break;
+		ptr += used;
+
+		blocks_size += (unpadded + 3) & ~((uint64_t) 3);
+		*total += uncompressed;
+	}
+
+	free(index);
+
+	if (record < records)
+		return false;
+
+	if (blocks_size + 12 > (uint64_t) index_start)
+		return false;
+	*start = index_start - (off_t) blocks_size - 12;
+
+	if (!pv__sizehint_read(fd, *start, stream_header, sizeof(stream_header)))
+		return false;
+	if (0 != memcmp(stream_header, "\3757zXZ\0", 6))
+		return false;
+
+	return true;
+}
+
+
+/*
+ * Return the decompressed size of the xz file open on "fd", whose size is
+ * "file_size", or -1 if it isn't known.
+ */
+static off_t pv__sizehint_xz(int fd, off_t file_size)
+{
+	uint64_t total;
+	off_t end;
+
+	total = 0;
+	end = file_size;
+
+	while (end > 0) {
+		unsigned char padding[4];
+		off_t start;
+
+		/* Stream padding is null bytes, in multiples of 4. */
+		if (!pv__sizehint_read(fd, end - 4, padding, sizeof(padding)))
+			return -1;
+		if (0 == (padding[0] | padding[1] | padding[2] | padding[3])) {
+			end -= 4;
+			continue;
+		}
+
+		if (!pv__sizehint_xz_stream(fd, end, &total, &start))
+			return -1;
+		end = start;
+	}
+
+	return (off_t) total;
+}
+
+
+/*
+ * Return the size that the compressed file open on "fd" will be once it
+ * is decompressed, if it is a gzip, zstd, or xz file that records it, or
+ * -1 if that isn't known.
+ */
+off_t pv_sizehint_fd(int fd)
+{
+	unsigned char magic[6];
+	struct stat sb;
+	uint32_t zstd_magic;
+	off_t size;
+
+	memset(&sb, 0, sizeof(sb));
+	if ((0 != fstat(fd, &sb)) || (!S_ISREG(sb.st_mode)))
+		return -1;
+	if (!pv__sizehint_read(fd, 0, magic, sizeof(magic)))
+		return -1;
+
+	zstd_magic = (uint32_t) pv__sizehint_le(magic, 4);
+
+	size = -1;
+	if ((0x1F == magic[0]) && (0x8B == magic[1])) {
+		size = pv__sizehint_gzip(fd, sb.st_size);
+	} else if ((0xFD2FB528 == zstd_magic) || (0x184D2A50 == (zstd_magic & 0xFFFFFFF0))) {
+		size = pv__sizehint_zstd(fd, sb.st_size);
+	} else if (0 == memcmp(magic, "\3757zXZ\0", 6)) {
+		size = pv__sizehint_xz(fd, sb.st_size);
+	}
+
+	debug("%s: %d: %lld", "size hint", fd, (long long) size);
+
+	return size;
+}
+
+
+/*
+ * Return the decompressed size of the file "filename", as for
+ * pv_sizehint_fd(), or -1 if it isn't known.
+ */
+off_t pv_sizehint_file(const char *filename)
+{
+	off_t size;
+	int fd;
+
+	fd = open(filename, O_RDONLY);	    /* flawfinder: ignore */
+	/* flawfinder - see the open() in pv_next_file(). */
+	if (fd < 0)
+		return -1;
+
+	size = pv_sizehint_fd(fd);
+	(void) close(fd);
+
+	return size;
+}
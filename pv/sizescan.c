@@ -0,0 +1,252 @@
+/*
+ * Functions for adding up the sizes of a long list of input files in the
+ * background, while transferring them.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#ifdef HAVE_PTHREAD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+/*
+ * Working out the total size means a stat() of every input file, which
+ * with a very long list on a network filesystem can take minutes, so with
+ * PV_SIZESCAN_MIN_FILES or more files it is done by a small pool of
+ * threads instead, each taking the next file from the list in turn, so
+ * that the round trips overlap with each other and with the transfer.
+ *
+ * Until every file has been looked at, the total is estimated from the
+ * average size of the files seen so far, and the size is marked as
+ * provisional so that the ETA can be shown as such.  If any file turns
+ * out to be of indeterminate size, the whole size becomes unknown, as it
+ * does with pv_calc_total_size().
+ */
+#define PV_SIZESCAN_MIN_FILES	32
+#define PV_SIZESCAN_THREADS	8
+
+struct pvsizescan_s {
+	pthread_t thread[PV_SIZESCAN_THREADS];	/* the worker threads */
+	pthread_mutex_t mutex;		 /* protects everything below */
+	/*@dependent@ */ nullable_string_t *filename;	/* the input file list */
+	unsigned int file_count;	 /* number of input files */
+	unsigned int thread_count;	 /* number of threads started */
+	/* Everything below is protected by the mutex. */
+	unsigned int next_file;		 /* next file for a worker to look at */
+	unsigned int files_done;	 /* number of files looked at */
+	unsigned int threads_running;	 /* workers which have not yet finished */
+	off_t total_bytes;		 /* total size of the files looked at */
+	bool unknown;			 /* set if the total can't be known */
+	bool stop_requested;		 /* set to end the scan early */
+	bool reported;			 /* set once the final total has been used */
+};
+
+
+/*
+ * Worker thread - look at files from the list until there are none left.
+ */
+/*@null@ */ static void *pv__sizescan_thread(void *arg)
+{
+	struct pvsizescan_s *sizescan = (struct pvsizescan_s *) arg;
+
+	(void) pthread_mutex_lock(&(sizescan->mutex));
+
+	while ((!sizescan->stop_requested) && (!sizescan->unknown) && (sizescan->next_file < sizescan->file_count)) {
+		const char *filename;
+		off_t file_size;
+		int rc;
+
+		filename = sizescan->filename[sizescan->next_file++];
+
+		/* Skip any NULL entries, though they should be impossible. */
+		if (NULL == filename) {
+			sizescan->files_done++;
+			continue;
+		}
+
+		(void) pthread_mutex_unlock(&(sizescan->mutex));
+		rc = pv_calc_file_bytes(filename, &file_size);
+		(void) pthread_mutex_lock(&(sizescan->mutex));
+
+		sizescan->files_done++;
+		if (rc > 0) {
+			sizescan->total_bytes += file_size;
+		} else {
+			sizescan->unknown = true;
+		}
+	}
+
+	sizescan->threads_running--;
+
+	(void) pthread_mutex_unlock(&(sizescan->mutex));
+
+	return NULL;
+}
+
+
+/*
+ * Stop the workers, if any are running, and wait for them to finish.
+ */
+static void pv__sizescan_join(struct pvsizescan_s *sizescan)
+{
+	unsigned int thread_idx;
+
+	(void) pthread_mutex_lock(&(sizescan->mutex));
+	sizescan->stop_requested = true;
+	(void) pthread_mutex_unlock(&(sizescan->mutex));
+
+	for (thread_idx = 0; thread_idx < sizescan->thread_count; thread_idx++)
+		(void) pthread_join(sizescan->thread[thread_idx], NULL);
+
+	sizescan->thread_count = 0;
+}
+
+
+/*
+ * Start adding up the sizes of the input files in the background, if
+ * there are enough of them for it to be worth it; pv_sizescan_update()
+ * then keeps state->control.size up to date as the scan progresses.
+ *
+ * Returns false if the scan was not started, in which case the caller
+ * should fall back to pv_calc_total_size().
+ */
+bool pv_sizescan_start(pvstate_t state)
+{
+	struct pvsizescan_s *sizescan;
+	sigset_t all_signals, old_signals;
+	struct stat sb;
+	unsigned int thread_idx;
+
+	pv_sizescan_stop(state);
+
+	if ((NULL == state->files.filename) || (state->files.file_count < PV_SIZESCAN_MIN_FILES))
+		return false;
+
+	/*
+	 * Sizing from an output block device means seeking on it, which
+	 * can't be done once the transfer has started.
+	 */
+	if ((0 == fstat(state->control.output_fd, &sb)) && S_ISBLK(sb.st_mode))
+		return false;
+
+	sizescan = calloc(1, sizeof(*sizescan));
+	if (NULL == sizescan)
+		return false;
+
+	sizescan->filename = state->files.filename;
+	sizescan->file_count = state->files.file_count;
+	(void) pthread_mutex_init(&(sizescan->mutex), NULL);
+
+	/* As with the pipeline, leave all signals to the main thread. */
+	(void) sigfillset(&all_signals);
+	(void) sigemptyset(&old_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+	(void) pthread_mutex_lock(&(sizescan->mutex));
+	for (thread_idx = 0; thread_idx < PV_SIZESCAN_THREADS; thread_idx++) {
+		int rc = pthread_create(&(sizescan->thread[thread_idx]), NULL, pv__sizescan_thread, sizescan);
+		if (0 != rc) {
+			debug("%s: %s", "pthread_create", strerror(rc));
+			break;
+		}
+		sizescan->thread_count++;
+		sizescan->threads_running++;
+	}
+	(void) pthread_mutex_unlock(&(sizescan->mutex));
+
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 == sizescan->thread_count) {
+		(void) pthread_mutex_destroy(&(sizescan->mutex));
+		free(sizescan);
+		return false;
+	}
+
+	state->files.sizescan = sizescan;
+	state->control.size_provisional = true;
+
+	debug("%s: %s=%u, %s=%u", "size scan started", "threads", sizescan->thread_count, "files",
+	      sizescan->file_count);
+
+	return true;
+}
+
+
+/*
+ * Update state->control.size from the background size scan, if there is
+ * one.  Until the scan is finished, the total is estimated from the
+ * average size of the files looked at so far.
+ */
+void pv_sizescan_update(pvstate_t state)
+{
+	struct pvsizescan_s *sizescan;
+	unsigned int files_done;
+	off_t total_bytes;
+	bool finished, unknown;
+
+	sizescan = state->files.sizescan;
+	if ((NULL == sizescan) || (sizescan->reported))
+		return;
+
+	(void) pthread_mutex_lock(&(sizescan->mutex));
+	files_done = sizescan->files_done;
+	total_bytes = sizescan->total_bytes;
+	unknown = sizescan->unknown;
+	finished = (0 == sizescan->threads_running);
+	(void) pthread_mutex_unlock(&(sizescan->mutex));
+
+	if (unknown || finished) {
+		sizescan->reported = true;
+		pv__sizescan_join(sizescan);
+		state->control.size = unknown ? 0 : total_bytes;
+		state->control.size_provisional = false;
+		debug("%s: %lld", "size scan finished", (long long) (state->control.size));
+		return;
+	}
+
+	if (0 == files_done)
+		return;
+
+	state->control.size =
+	    (off_t) ((long double) total_bytes * (long double) (sizescan->file_count) / (long double) files_done);
+}
+
+
+/*
+ * Stop the background size scan, if there is one, and free it.
+ */
+void pv_sizescan_stop(pvstate_t state)
+{
+	struct pvsizescan_s *sizescan;
+
+	if (NULL == state || NULL == state->files.sizescan)
+		return;
+
+	sizescan = state->files.sizescan;
+	state->files.sizescan = NULL;
+
+	if (sizescan->thread_count > 0) {
+		pv__sizescan_join(sizescan);
+		debug("%s", "size scan stopped");
+	}
+
+	(void) pthread_mutex_destroy(&(sizescan->mutex));
+	free(sizescan);
+}
+
+#endif				/* HAVE_PTHREAD */
@@ -0,0 +1,758 @@
+/*
+ * Functions for the temporary spool used by store-and-forward mode, when
+ * it is given "-" as the file to store the input in.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <poll.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/*
+ * The spool starts out in memory, as an anonymous memfd where the system
+ * has them, and only once more than the memory limit has been written to
+ * it is it copied into a temporary file, which then takes the memfd's place
+ * behind the receiver's output descriptor - so the receiver just carries
+ * on writing, and small inputs never touch the disk at all.
+ *
+ * The temporary file is created with O_TMPFILE where that is available,
+ * and is otherwise unlinked as soon as it has been created, so it never has
+ * a name to clear up afterwards.  The transmitter reads the spool back
+ * through "/dev/fd/N", so that it is an ordinary regular file as far as
+ * the transfer is concerned, and splice() or copy_file_range() can be used
+ * to send it on.
+ *
+ * With "--forward-after", the two stages overlap instead: a receiver
+ * thread copies the input into the spool, and a feeder thread reads it
+ * back from behind the receiver, once enough has been stored, and writes
+ * it into a pipe for the main loop to transmit as its only input.  The
+ * total size is the amount stored so far, marked as provisional, until
+ * the receiver reaches the end of the input.  This mode always spools to
+ * a file, since the memfd could not be swapped out while the threads are
+ * using it.
+ */
+#define PV_SPOOL_COPY_CHUNK	1048576
+#define PV_SPOOL_THREAD_CHUNK	131072
+#define PV_SPOOL_POLL_MSEC	200	/* how often the receiver checks for a stop */
+
+struct pvspool_s {
+	char input_name[32];		 /* flawfinder: ignore - "/dev/fd/N" */
+	off_t memory_limit;		 /* most to hold in memory before spilling */
+	int fd;				 /* the spool itself */
+	bool in_memory;			 /* set while the spool is a memfd */
+	bool receiving;			 /* set while the receiver is writing to it */
+#ifdef HAVE_PTHREAD
+	/* Everything below is only used with "--forward-after". */
+	pthread_t receiver;		 /* thread copying the input into the spool */
+	pthread_t feeder;		 /* thread copying the spool into the pipe */
+	pthread_mutex_t mutex;		 /* protects the counters and flags below */
+	pthread_cond_t changed;		 /* signalled when they change */
+	/*@only@ */ /*@null@ */ char **input_files;	/* copy of the input file list */
+	unsigned int input_count;	 /* number of input files (0=stdin) */
+	int pipe_fd[2];			 /* pipe from the feeder to the main loop */
+	off_t forward_after;		 /* amount to store before forwarding */
+	char separator;			 /* line separator, in line mode */
+	bool linemode;			 /* count lines as well as bytes */
+	bool threads_started;		 /* set once both threads are running */
+	/* Everything below is protected by the mutex. */
+	off_t stored_bytes;		 /* bytes written to the spool so far */
+	off_t stored_lines;		 /* separators written to the spool so far */
+	int receive_errno;		 /* errno of the first receiving error */
+	unsigned int error_file;	 /* index of the input with that error */
+	bool error_on_spool;		 /* set if the error was writing the spool */
+	bool receive_done;		 /* set when the receiver has finished */
+	bool stop_requested;		 /* set to stop both threads */
+#endif
+};
+
+/*
+ * flawfinder rationale: input_name is only written by pv_snprintf(), which
+ * always bounds and terminates it.
+ */
+
+
+/*
+ * Create an anonymous temporary file in $TMPDIR, $TMP, or "/tmp", which has
+ * no name on the filesystem.  Returns the descriptor, or -1 on error, with
+ * the error already reported.
+ */
+static int pv__spool_tmpfile(void)
+{
+	char tmp_filename[4096];	 /* flawfinder: ignore */
+	const char *tmpdir;
+	int tmp_fd;
+
+	/* flawfinder: zeroed with memset and bounded by pv_snprintf. */
+
+	tmpdir = getenv("TMPDIR");	    /* flawfinder: ignore */
+	if ((NULL == tmpdir) || ('\0' == tmpdir[0]))
+		tmpdir = getenv("TMP");	    /* flawfinder: ignore */
+	if ((NULL == tmpdir) || ('\0' == tmpdir[0]))
+		tmpdir = "/tmp";
+
+	/*
+	 * flawfinder rationale: null and zero-size values of $TMPDIR and
+	 * $TMP are rejected, and the destination buffer is bounded.
+	 */
+
+#ifdef O_TMPFILE
+	tmp_fd = open(tmpdir, O_TMPFILE | O_RDWR | O_EXCL, 0600);	/* flawfinder: ignore */
+	/* flawfinder rationale: the file is created with no name at all. */
+	if (tmp_fd >= 0)
+		return tmp_fd;
+	debug("%s: %s: %s", tmpdir, "O_TMPFILE", strerror(errno));
+#endif
+
+	memset(tmp_filename, 0, sizeof(tmp_filename));
+	(void) pv_snprintf(tmp_filename, sizeof(tmp_filename), "%s/pv.XXXXXX", tmpdir);
+
+	/*@-unrecog@ *//* splint doesn't know mkstemp() */
+	tmp_fd = mkstemp(tmp_filename);	    /* flawfinder: ignore */
+	/*@+unrecog@ */
+	if (tmp_fd < 0) {
+		pv_error("%s: %s", tmp_filename, strerror(errno));
+		return -1;
+	}
+
+	if (0 != unlink(tmp_filename))
+		debug("%s: %s: %s", tmp_filename, "unlink", strerror(errno));
+
+	return tmp_fd;
+}
+
+
+/*
+ * Allocate a new, empty spool, and attach it to the state.  Returns NULL
+ * on error, after reporting it.
+ */
+/*@null@ */ static struct pvspool_s *pv__spool_new(pvstate_t state)
+{
+	struct pvspool_s *spool;
+
+	pv_spool_free(state);
+
+	spool = calloc(1, sizeof(*spool));
+	if (NULL == spool) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		return NULL;
+	}
+
+	spool->fd = -1;
+#ifdef HAVE_PTHREAD
+	spool->pipe_fd[0] = -1;
+	spool->pipe_fd[1] = -1;
+	(void) pthread_mutex_init(&(spool->mutex), NULL);
+	(void) pthread_cond_init(&(spool->changed), NULL);
+#endif
+
+	state->status.spool = spool;
+
+	return spool;
+}
+
+
+/*
+ * Create the spool, holding up to "memory_limit" bytes in memory before
+ * spilling to a temporary file.  Returns a new descriptor for the receiver
+ * to write to, or -1 on error, after reporting it.
+ */
+int pv_spool_create(pvstate_t state, off_t memory_limit)
+{
+	struct pvspool_s *spool;
+	int output_fd;
+
+	spool = pv__spool_new(state);
+	if (NULL == spool)
+		return -1;
+
+	spool->memory_limit = memory_limit;
+
+#if defined(HAVE_MMAP) && defined(MFD_CLOEXEC)
+	/*
+	 * The io_uring engine writes asynchronously through its own file
+	 * table, so the memfd could not be swapped out from under it.
+	 */
+	if ((memory_limit > 0) && (PV_IOENGINE_IO_URING != state->control.io_engine)) {
+		spool->fd = memfd_create("pv-spool", MFD_CLOEXEC);
+		if (spool->fd >= 0) {
+			spool->in_memory = true;
+		} else {
+			debug("%s: %s", "memfd_create", strerror(errno));
+		}
+	}
+#endif
+
+	if (spool->fd < 0)
+		spool->fd = pv__spool_tmpfile();
+	if (spool->fd < 0) {
+		pv_spool_free(state);
+		return -1;
+	}
+
+	/*
+	 * The receiver gets its own descriptor, since setting the output
+	 * back afterwards closes it, but the two share a file offset.
+	 */
+	output_fd = dup(spool->fd);
+	if (output_fd < 0) {
+		pv_error("%s: %s", "dup", strerror(errno));
+		pv_spool_free(state);
+		return -1;
+	}
+
+	spool->receiving = true;
+
+	debug("%s: %s, %s=%lld", "spool created", spool->in_memory ? "memory" : "file", "limit",
+	      (long long) memory_limit);
+
+	return output_fd;
+}
+
+
+/*
+ * Copy the memory spool into a temporary file, and put the file in the
+ * memfd's place behind the receiver's output descriptor.  On failure, the
+ * spool just stays in memory.
+ */
+static void pv__spool_spill(pvstate_t state, struct pvspool_s *spool)
+{
+	struct stat sb;
+	char *buffer;
+	off_t position, offset;
+	int tmp_fd;
+
+	spool->in_memory = false;
+
+	position = lseek(state->control.output_fd, 0, SEEK_CUR);
+	if ((position < 0) || (0 != fstat(spool->fd, &sb))) {
+		debug("%s: %s", "spool", strerror(errno));
+		return;
+	}
+
+	buffer = malloc(PV_SPOOL_COPY_CHUNK);
+	if (NULL == buffer) {
+		debug("%s: %s", "spool", strerror(errno));
+		return;
+	}
+
+	tmp_fd = pv__spool_tmpfile();
+	if (tmp_fd < 0) {
+		free(buffer);
+		return;
+	}
+
+	for (offset = 0; offset < sb.st_size;) {
+		ssize_t nread, nwritten, done;
+
+		nread = pread(spool->fd, buffer, PV_SPOOL_COPY_CHUNK, offset);
+		if ((nread < 0) && (EINTR == errno))
+			continue;
+		if (nread <= 0)
+			break;
+		for (done = 0; done < nread; done += nwritten) {
+			nwritten = pwrite(tmp_fd, buffer + done, (size_t) (nread - done), offset + done);
+			if ((nwritten < 0) && (EINTR == errno)) {
+				nwritten = 0;
+				continue;
+			}
+			if (nwritten <= 0)
+				break;
+		}
+		if (done < nread)
+			break;
+		offset += (off_t) nread;
+	}
+
+	free(buffer);
+
+	if ((offset < sb.st_size) || (0 != ftruncate(tmp_fd, sb.st_size))
+	    || (lseek(tmp_fd, position, SEEK_SET) < 0)) {
+		pv_error("%s: %s", _("failed to spill spool to disk"), strerror(0 == errno ? EIO : errno));
+		(void) close(tmp_fd);
+		return;
+	}
+
+	/* Swap the file in under the receiver's output descriptor. */
+	pv_poller_forget(&(state->transfer), state->control.output_fd);
+	if (dup2(tmp_fd, state->control.output_fd) < 0) {
+		pv_error("%s: %s", _("failed to spill spool to disk"), strerror(errno));
+		(void) close(tmp_fd);
+		return;
+	}
+
+	(void) close(spool->fd);
+	spool->fd = tmp_fd;
+
+	debug("%s: %lld", "spool moved to disk", (long long) (sb.st_size));
+}
+
+
+/*
+ * Move the spool from memory to disk if the receiver has now written more
+ * than the memory limit to it.
+ */
+void pv_spool_check(pvstate_t state)
+{
+	struct pvspool_s *spool;
+	off_t position;
+
+	spool = state->status.spool;
+	if ((NULL == spool) || (!spool->in_memory) || (!spool->receiving))
+		return;
+
+	/* Line mode counts lines written, so ask the spool how big it is. */
+	position = state->transfer.total_written;
+	if (state->control.linemode)
+		position = lseek(state->control.output_fd, 0, SEEK_CUR);
+	if (position <= spool->memory_limit)
+		return;
+
+	pv__spool_spill(state, spool);
+}
+
+
+/*
+ * Rewind the spool ready for the transmitter, and return the name to read
+ * it back through as an input file, or NULL if there is no spool.
+ */
+/*@null@ */ /*@observer@ */ const char *pv_spool_rewind(pvstate_t state)
+{
+	struct pvspool_s *spool;
+
+	spool = state->status.spool;
+	if (NULL == spool)
+		return NULL;
+
+	spool->receiving = false;
+
+	/* Some systems share the offset when "/dev/fd/N" is opened. */
+	(void) lseek(spool->fd, 0, SEEK_SET);
+
+	(void) pv_snprintf(spool->input_name, sizeof(spool->input_name), "/dev/fd/%d", spool->fd);
+
+	return spool->input_name;
+}
+
+
+#ifdef HAVE_PTHREAD
+/*
+ * Receiver thread - copy all of the input files into the spool, counting
+ * what has been stored so far, until they are exhausted or the spool is
+ * being stopped.
+ */
+/*@null@ */ static void *pv__spool_receiver(void *arg)
+{
+	struct pvspool_s *spool = (struct pvspool_s *) arg;
+	char buffer[PV_SPOOL_THREAD_CHUNK];	/* flawfinder: ignore - bounded by read() */
+	unsigned int file_idx;
+	off_t offset;
+	bool stop;
+
+	offset = 0;
+	stop = false;
+
+	for (file_idx = 0; (!stop) && (file_idx < spool->input_count || (0 == file_idx && 0 == spool->input_count));
+	     file_idx++) {
+		const char *name;
+		int fd, failure;
+
+		name = spool->input_count > 0 ? spool->input_files[file_idx] : "-";
+		if ((NULL == name) || (0 == strcmp(name, "-"))) {
+			fd = STDIN_FILENO;
+		} else if (pv_net_is_address(name)) {
+			fd = pv_net_open(name, false, 0);
+		} else {
+			fd = open(name, O_RDONLY);	/* flawfinder: ignore */
+			/* flawfinder - as with pv_next_file(). */
+		}
+
+		failure = fd < 0 ? errno : 0;
+
+		while ((fd >= 0) && (0 == failure)) {
+			struct pollfd pfd;
+			ssize_t nread, done, nwritten;
+			size_t lines;
+
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			if (poll(&pfd, 1, PV_SPOOL_POLL_MSEC) < 0 && EINTR != errno) {
+				failure = errno;
+				break;
+			}
+
+			(void) pthread_mutex_lock(&(spool->mutex));
+			stop = spool->stop_requested;
+			(void) pthread_mutex_unlock(&(spool->mutex));
+			if (stop)
+				break;
+
+			if (0 == pfd.revents)
+				continue;
+
+			nread = read(fd, buffer, sizeof(buffer));	/* flawfinder: ignore */
+			if (nread < 0) {
+				if ((EINTR == errno) || (EAGAIN == errno))
+					continue;
+				failure = errno;
+				break;
+			}
+			if (0 == nread)
+				break;
+
+			for (done = 0; done < nread; done += nwritten) {
+				nwritten = pwrite(spool->fd, buffer + done, (size_t) (nread - done), offset + done);
+				if ((nwritten < 0) && (EINTR == errno)) {
+					nwritten = 0;
+					continue;
+				}
+				if (nwritten <= 0)
+					break;
+			}
+			if (done < nread) {
+				(void) pthread_mutex_lock(&(spool->mutex));
+				spool->error_on_spool = true;
+				spool->receive_errno = 0 == errno ? ENOSPC : errno;
+				spool->error_file = file_idx;
+				(void) pthread_mutex_unlock(&(spool->mutex));
+				stop = true;
+				break;
+			}
+
+			offset += (off_t) nread;
+			lines = spool->linemode ? pv_linescan_count(buffer, (size_t) nread, spool->separator) : 0;
+
+			(void) pthread_mutex_lock(&(spool->mutex));
+			spool->stored_bytes = offset;
+			spool->stored_lines += (off_t) lines;
+			(void) pthread_cond_broadcast(&(spool->changed));
+			(void) pthread_mutex_unlock(&(spool->mutex));
+		}
+
+		if ((fd >= 0) && (STDIN_FILENO != fd))
+			(void) close(fd);
+
+		if (0 != failure) {
+			(void) pthread_mutex_lock(&(spool->mutex));
+			if (0 == spool->receive_errno) {
+				spool->receive_errno = failure;
+				spool->error_file = file_idx;
+			}
+			(void) pthread_mutex_unlock(&(spool->mutex));
+		}
+	}
+
+	(void) pthread_mutex_lock(&(spool->mutex));
+	spool->receive_done = true;
+	(void) pthread_cond_broadcast(&(spool->changed));
+	(void) pthread_mutex_unlock(&(spool->mutex));
+
+	return NULL;
+}
+
+
+/*
+ * Feeder thread - once enough has been stored, copy the spool into the
+ * pipe, following behind the receiver, and close the pipe once everything
+ * the receiver stored has been passed on.
+ */
+/*@null@ */ static void *pv__spool_feeder(void *arg)
+{
+	struct pvspool_s *spool = (struct pvspool_s *) arg;
+	char buffer[PV_SPOOL_THREAD_CHUNK];	/* flawfinder: ignore - bounded by pread() */
+	off_t offset;
+	bool forwarding;
+
+	offset = 0;
+	forwarding = false;
+
+	(void) pthread_mutex_lock(&(spool->mutex));
+
+	while (!spool->stop_requested) {
+		ssize_t nread, done, nwritten;
+		size_t count;
+
+		if ((!forwarding) && (spool->receive_done || spool->stored_bytes >= spool->forward_after))
+			forwarding = true;
+
+		if ((!forwarding) || (offset >= spool->stored_bytes)) {
+			if (spool->receive_done && forwarding)
+				break;
+			(void) pthread_cond_wait(&(spool->changed), &(spool->mutex));
+			continue;
+		}
+
+		count = sizeof(buffer);
+		if ((off_t) count > spool->stored_bytes - offset)
+			count = (size_t) (spool->stored_bytes - offset);
+
+		(void) pthread_mutex_unlock(&(spool->mutex));
+
+		nread = pread(spool->fd, buffer, count, offset);
+		for (done = 0; nread > 0 && done < nread; done += nwritten) {
+			nwritten = write(spool->pipe_fd[1], buffer + done, (size_t) (nread - done));
+			if ((nwritten < 0) && (EINTR == errno)) {
+				nwritten = 0;
+				continue;
+			}
+			if (nwritten <= 0)
+				break;
+		}
+
+		(void) pthread_mutex_lock(&(spool->mutex));
+
+		if ((nread < 0) && (EINTR == errno))
+			continue;
+
+		/* The transmitter has gone, or the spool can't be read. */
+		if ((nread <= 0) || (done < nread))
+			break;
+
+		offset += (off_t) nread;
+	}
+
+	(void) pthread_mutex_unlock(&(spool->mutex));
+
+	(void) close(spool->pipe_fd[1]);
+	spool->pipe_fd[1] = -1;
+
+	return NULL;
+}
+
+
+/*
+ * Start storing the input in the background - in "filename", or in an
+ * unnamed temporary file if that is NULL - and forwarding it once
+ * "forward_after" bytes have been stored.  Returns the name for the main
+ * loop to read the forwarded data from, or NULL on error, after reporting
+ * it.
+ */
+/*@null@ */ /*@observer@ */ const char *pv_spool_forward_start(pvstate_t state, /*@null@ */ const char *filename,
+							  off_t forward_after)
+{
+	struct pvspool_s *spool;
+	sigset_t all_signals, old_signals;
+	unsigned int file_idx;
+	int rc;
+
+	spool = pv__spool_new(state);
+	if (NULL == spool)
+		return NULL;
+
+	spool->forward_after = forward_after;
+	spool->linemode = state->control.linemode;
+	spool->separator = state->control.null_terminated_lines ? '\0' : '\n';
+
+	/* Take a copy of the input list, since it's about to be replaced. */
+	if ((NULL != state->files.filename) && (state->files.file_count > 0)) {
+		spool->input_files = calloc((size_t) (state->files.file_count), sizeof(char *));
+		if (NULL == spool->input_files) {
+			pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+			pv_spool_free(state);
+			return NULL;
+		}
+		spool->input_count = state->files.file_count;
+		for (file_idx = 0; file_idx < spool->input_count; file_idx++) {
+			if (NULL == state->files.filename[file_idx])
+				continue;
+			spool->input_files[file_idx] = pv_strdup(state->files.filename[file_idx]);
+			if (NULL == spool->input_files[file_idx]) {
+				pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+				pv_spool_free(state);
+				return NULL;
+			}
+		}
+	}
+
+	if (NULL == filename) {
+		spool->fd = pv__spool_tmpfile();
+	} else {
+		spool->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);	/* flawfinder: ignore */
+		/* flawfinder - as with the output file in main.c. */
+		if (spool->fd < 0)
+			pv_error("%s: %s", filename, strerror(errno));
+	}
+	if (spool->fd < 0) {
+		pv_spool_free(state);
+		return NULL;
+	}
+
+	if (0 != pipe(spool->pipe_fd)) {
+		pv_error("%s: %s", "pipe", strerror(errno));
+		spool->pipe_fd[0] = -1;
+		spool->pipe_fd[1] = -1;
+		pv_spool_free(state);
+		return NULL;
+	}
+
+	/* As with the pipeline, leave all signals to the main thread. */
+	(void) sigfillset(&all_signals);
+	(void) sigemptyset(&old_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&(spool->receiver), NULL, pv__spool_receiver, spool);
+	if (0 == rc) {
+		rc = pthread_create(&(spool->feeder), NULL, pv__spool_feeder, spool);
+		if (0 != rc) {
+			(void) pthread_mutex_lock(&(spool->mutex));
+			spool->stop_requested = true;
+			(void) pthread_mutex_unlock(&(spool->mutex));
+			(void) pthread_join(spool->receiver, NULL);
+		}
+	}
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 != rc) {
+		pv_error("%s: %s", "pthread_create", strerror(rc));
+		pv_spool_free(state);
+		return NULL;
+	}
+
+	spool->threads_started = true;
+	state->control.size_provisional = true;
+
+	(void) pv_snprintf(spool->input_name, sizeof(spool->input_name), "/dev/fd/%d", spool->pipe_fd[0]);
+
+	debug("%s: %s=%lld", "overlapped store-and-forward started", "forward_after", (long long) forward_after);
+
+	return spool->input_name;
+}
+
+
+/*
+ * Update state->control.size from the amount stored so far, while
+ * forwarding overlaps with storing.
+ */
+void pv_spool_update(pvstate_t state)
+{
+	struct pvspool_s *spool;
+	off_t stored;
+	bool done;
+
+	spool = state->status.spool;
+	if ((NULL == spool) || (!spool->threads_started) || (!state->control.size_provisional))
+		return;
+
+	(void) pthread_mutex_lock(&(spool->mutex));
+	stored = spool->linemode ? spool->stored_lines : spool->stored_bytes;
+	done = spool->receive_done;
+	(void) pthread_mutex_unlock(&(spool->mutex));
+
+	state->control.size = stored;
+	if (done) {
+		state->control.size_provisional = false;
+		debug("%s: %lld", "store-and-forward receiver finished", (long long) stored);
+	}
+}
+
+
+/*
+ * Stop the store-and-forward threads, if they are running, and report any
+ * error the receiver had.
+ */
+static void pv__spool_forward_stop(pvstate_t state, struct pvspool_s *spool)
+{
+	if (!spool->threads_started)
+		return;
+
+	spool->threads_started = false;
+
+	(void) pthread_mutex_lock(&(spool->mutex));
+	spool->stop_requested = true;
+	(void) pthread_cond_broadcast(&(spool->changed));
+	(void) pthread_mutex_unlock(&(spool->mutex));
+
+	/* Closing the pipe unblocks the feeder if it is part way through. */
+	if (spool->pipe_fd[0] >= 0) {
+		(void) close(spool->pipe_fd[0]);
+		spool->pipe_fd[0] = -1;
+	}
+
+	(void) pthread_join(spool->feeder, NULL);
+	(void) pthread_join(spool->receiver, NULL);
+
+	if (0 != spool->receive_errno) {
+		if (spool->error_on_spool) {
+			pv_error("%s: %s", _("failed to write to store-and-forward file"),
+				 strerror(spool->receive_errno));
+			state->status.exit_status |= PV_ERROREXIT_SAF;
+		} else {
+			const char *name = "-";
+			if ((spool->error_file < spool->input_count) && (NULL != spool->input_files)
+			    && (NULL != spool->input_files[spool->error_file]))
+				name = spool->input_files[spool->error_file];
+			pv_error("%s: %s: %s", _("failed to read file"), name, strerror(spool->receive_errno));
+			state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		}
+	}
+}
+
+
+/*
+ * Finish an overlapped store-and-forward, waiting for the threads and
+ * reporting any receiving errors; returns the updated exit status.
+ */
+int pv_spool_forward_finish(pvstate_t state)
+{
+	if (NULL != state->status.spool)
+		pv__spool_forward_stop(state, state->status.spool);
+	return state->status.exit_status;
+}
+#endif				/* HAVE_PTHREAD */
+
+
+/*
+ * Close and free the spool, if there is one.
+ */
+void pv_spool_free(pvstate_t state)
+{
+	struct pvspool_s *spool;
+
+	if ((NULL == state) || (NULL == state->status.spool))
+		return;
+
+	spool = state->status.spool;
+	state->status.spool = NULL;
+
+#ifdef HAVE_PTHREAD
+	pv__spool_forward_stop(state, spool);
+	if (NULL != spool->input_files) {
+		unsigned int file_idx;
+		for (file_idx = 0; file_idx < spool->input_count; file_idx++) {
+			if (NULL != spool->input_files[file_idx])
+				free(spool->input_files[file_idx]);
+		}
+		free(spool->input_files);
+	}
+	if (spool->pipe_fd[0] >= 0)
+		(void) close(spool->pipe_fd[0]);
+	if (spool->pipe_fd[1] >= 0)
+		(void) close(spool->pipe_fd[1]);
+	(void) pthread_cond_destroy(&(spool->changed));
+	(void) pthread_mutex_destroy(&(spool->mutex));
+#endif
+
+	if (spool->fd >= 0)
+		(void) close(spool->fd);
+
+	free(spool);
+}
@@ -0,0 +1,231 @@
+/*
+ * Functions for detecting stalls and sudden drops in the transfer rate,
+ * for "--stall-timeout" and "--rate-drop", and for reporting them as
+ * events with "--stats-fd" and "--on-stall".
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* Highest descriptor closed in the hook command's process. */
+#define PV_STALL_MAX_CLOSE_FD	1024
+
+/*
+ * The detector is checked once per display interval, after the rates have
+ * been calculated.  A stall is time in which nothing at all was
+ * transferred, measured from the last update at which something had
+ * been; a rate drop is the current rate falling below a percentage of the
+ * average over the averaging window, once the window has filled.  Each is
+ * reported once when it starts, and once more when it clears, so that a
+ * watchdog sees an edge rather than a level.
+ */
+struct pvstall_s {
+	long double last_progress;	 /* elapsed time of the last progress */
+	off_t last_transferred;		 /* amount transferred at that time */
+	pid_t hook_pid;			 /* running hook command, or 0 */
+	bool stalled;			 /* a stall has been reported */
+	bool slow;			 /* a rate drop has been reported */
+};
+
+
+/*
+ * Collect the last hook command, if it has finished.  If "wait" is true,
+ * wait for it to finish first.
+ */
+static void pv__stall_reap(struct pvstall_s *stall, bool wait)
+{
+	if (stall->hook_pid <= 0)
+		return;
+	if (waitpid(stall->hook_pid, NULL, wait ? 0 : WNOHANG) != 0)
+		stall->hook_pid = 0;
+}
+
+
+/*
+ * Run the "--on-stall" command in the background, with the event and the
+ * state of the transfer in its environment.  The command is not given the
+ * transfer's own descriptors, so that a hook which outlives pv does not
+ * hold the output pipe open.  If the previous command is still running,
+ * this one is skipped.
+ */
+static void pv__stall_hook(pvstate_t state, struct pvstall_s *stall, const char *event, const char *side,
+			   long double idle_seconds)
+{
+	char value[64];			 /* flawfinder: ignore - bounded by pv_snprintf() */
+	pid_t child;
+	int fd;
+
+	if (NULL == state->control.stall_command)
+		return;
+
+	pv__stall_reap(stall, false);
+	if (stall->hook_pid > 0) {
+		debug("%s: %s", event, "previous hook still running - skipping");
+		return;
+	}
+
+	child = fork();
+	if (child < 0) {
+		pv_error("%s: %s", "--on-stall", strerror(errno));
+		return;
+	}
+	if (child > 0) {
+		stall->hook_pid = child;
+		return;
+	}
+
+	fd = open("/dev/null", O_RDWR);	    /* flawfinder: ignore - constant path */
+	if (fd >= 0) {
+		(void) dup2(fd, STDIN_FILENO);
+		(void) dup2(fd, STDOUT_FILENO);
+	}
+	for (fd = STDERR_FILENO + 1; fd < PV_STALL_MAX_CLOSE_FD; fd++)
+		(void) close(fd);
+
+	(void) setenv("PV_EVENT", event, 1);
+	(void) setenv("PV_SIDE", side, 1);
+	(void) pv_snprintf(value, sizeof(value), "%ld", (long) getppid());
+	(void) setenv("PV_PID", value, 1);
+	(void) pv_snprintf(value, sizeof(value), "%lld", (long long) (state->transfer.transferred));
+	(void) setenv("PV_TRANSFERRED", value, 1);
+	(void) pv_snprintf(value, sizeof(value), "%.3Lf", state->transfer.elapsed_seconds);
+	(void) setenv("PV_ELAPSED", value, 1);
+	(void) pv_snprintf(value, sizeof(value), "%.3Lf", idle_seconds);
+	(void) setenv("PV_IDLE", value, 1);
+	(void) pv_snprintf(value, sizeof(value), "%.3Lf", state->calc.transfer_rate);
+	(void) setenv("PV_RATE", value, 1);
+	(void) pv_snprintf(value, sizeof(value), "%.3Lf", state->calc.current_avg_rate);
+	(void) setenv("PV_AVERAGE_RATE", value, 1);
+
+	(void) execl("/bin/sh", "sh", "-c", state->control.stall_command, (char *) NULL);	/* flawfinder: ignore */
+
+	/*
+	 * flawfinder rationale: the command is the one the user asked for,
+	 * run through the shell, as they would expect.
+	 */
+
+	_exit(127);
+}
+
+
+/*
+ * Report an event, as a --stats-fd record and through the hook command.
+ */
+static void pv__stall_event(pvstate_t state, struct pvstall_s *stall, const char *event)
+{
+	char fields[512];		 /* flawfinder: ignore - bounded by pv_snprintf() */
+	long double idle_seconds;
+	const char *side;
+
+	/*
+	 * Data waiting in our buffer, or sitting unread in the output pipe,
+	 * means the output is what is holding things up; otherwise it is
+	 * the input.
+	 */
+	side = "input";
+	if ((state->transfer.read_position > state->transfer.write_position)
+	    || (state->transfer.written_but_not_consumed > 0))
+		side = "output";
+
+	idle_seconds = state->transfer.elapsed_seconds - stall->last_progress;
+	if (idle_seconds < 0)
+		idle_seconds = 0;
+
+	debug("%s: %s, %s=%Lg", event, side, "idle", idle_seconds);
+
+	(void) pv_snprintf(fields, sizeof(fields),
+			   ",\"side\":\"%s\",\"idle\":%.3Lf,\"transferred\":%lld,\"rate\":%.3Lf,\"average_rate\":%.3Lf",
+			   side, idle_seconds, (long long) (state->transfer.transferred), state->calc.transfer_rate,
+			   state->calc.current_avg_rate);
+	pv_statsout_event(state, event, fields);
+
+	pv__stall_hook(state, stall, event, side, idle_seconds);
+}
+
+
+/*
+ * Check for the start or end of a stall or a rate drop, and report it.
+ * This is called once per display interval, after the rates have been
+ * calculated; "final" is true on the last update.
+ */
+void pv_stall_check(pvstate_t state, bool final)
+{
+	struct pvstall_s *stall;
+
+	if ((state->control.stall_timeout <= 0) && (0 == state->control.rate_drop))
+		return;
+
+	if (NULL == state->status.stall) {
+		state->status.stall = calloc(1, sizeof(*(state->status.stall)));
+		if (NULL == state->status.stall)
+			return;
+		state->status.stall->last_progress = state->transfer.elapsed_seconds;
+		state->status.stall->last_transferred = state->transfer.transferred;
+	}
+
+	stall = state->status.stall;
+	pv__stall_reap(stall, false);
+
+	if (state->transfer.transferred != stall->last_transferred) {
+		stall->last_transferred = state->transfer.transferred;
+		if (stall->stalled)
+			pv__stall_event(state, stall, "stall-cleared");
+		stall->last_progress = state->transfer.elapsed_seconds;
+		stall->stalled = false;
+	} else if ((!stall->stalled) && (!final) && (state->control.stall_timeout > 0)
+		   && (state->transfer.elapsed_seconds - stall->last_progress >= state->control.stall_timeout)) {
+		stall->stalled = true;
+		pv__stall_event(state, stall, "stall");
+	}
+
+	/*
+	 * Rate drops are only looked for once the average covers a whole
+	 * window, and not while stalled, since a stall is already a drop to
+	 * nothing.
+	 */
+	if ((0 == state->control.rate_drop) || stall->stalled || final)
+		return;
+	if (state->transfer.elapsed_seconds < (long double) (state->control.average_rate_window))
+		return;
+	if (state->calc.current_avg_rate <= 0)
+		return;
+
+	if (state->calc.transfer_rate * 100.0L < state->calc.current_avg_rate * (long double) (state->control.rate_drop)) {
+		if (!stall->slow) {
+			stall->slow = true;
+			pv__stall_event(state, stall, "rate-drop");
+		}
+	} else if (stall->slow) {
+		stall->slow = false;
+		pv__stall_event(state, stall, "rate-recovered");
+	}
+}
+
+
+/*
+ * Free the detector, waiting for any hook command still running.
+ */
+void pv_stall_free(pvstate_t state)
+{
+	if ((NULL == state) || (NULL == state->status.stall))
+		return;
+
+	pv__stall_reap(state->status.stall, true);
+
+	free(state->status.stall);
+	state->status.stall = NULL;
+}
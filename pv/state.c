@@ -22,56 +22,18 @@
 
 
 /*
- * Allocate or reallocate the history buffer for calculating average
- * transfer rate.
+ * Set the length of the "calc" state sub-structure's average rate window,
+ * in seconds, and empty the window.
  */
-static void pv_alloc_calc_history(pvtransfercalc_t calc)
+void pv_update_calc_average_rate_window(pvtransfercalc_t calc, unsigned int val)
 {
-	if (NULL != calc->history)
-		free(calc->history);
-	calc->history = NULL;
-
-	calc->history = calloc((size_t) (calc->history_len), sizeof(calc->history[0]));
-	if (NULL == calc->history) {
-		/*@-mustfreefresh@ */
-		/*
-		 * splint note: the gettext calls made by _() cause memory
-		 * leak warnings, but in this case it's unavoidable, and
-		 * mitigated by the fact we only translate each string once.
-		 */
-		pv_error("%s: %s", _("history structure allocation failed"), strerror(errno));
-		/*@+mustfreefresh@ */
-		return;
-	}
-
-	calc->history_first = calc->history_last = 0;
-	calc->history[0].elapsed_sec = 0.0; /* to be safe, memset() not recommended for doubles */
-}
-
-
-/*
- * Set the "calc" state sub-structure's history length appropriately for the
- * given average rate window setting, allocate an appropriate history, and
- * return the appropriate history interval to use.
- */
-unsigned int pv_update_calc_average_rate_window(pvtransfercalc_t calc, unsigned int val)
-{
-	unsigned int history_interval;
-
 	if (val < 1)
 		val = 1;
 
-	if (val >= 20) {
-		calc->history_len = (size_t) (val / 5 + 1);
-		history_interval = 5;
-	} else {
-		calc->history_len = (size_t) (val + 1);
-		history_interval = 1;
-	}
-
-	pv_alloc_calc_history(calc);
-
-	return history_interval;
+	calc->window_nsec = (int64_t) val * 1000000000;
+	calc->window_step_nsec = calc->window_nsec / (PV_CALC_WINDOW_POINTS - 1);
+	calc->window_first = 0;
+	calc->window_count = 0;
 }
 
 
@@ -92,6 +54,7 @@ void pv_reset_calc(pvtransfercalc_t calc)
 	calc->prev_rate = 0.0;
 	calc->prev_trans = 0.0;
 	calc->current_avg_rate = 0.0;
+	calc->ewma_rate = 0.0;
 	calc->rate_min = 0.0;
 	calc->rate_max = 0.0;
 	calc->rate_sum = 0.0;
@@ -99,10 +62,10 @@ void pv_reset_calc(pvtransfercalc_t calc)
 	calc->measurements_taken = 0;
 	calc->prev_transferred = 0;
 	calc->percentage = 0.0;
-	calc->history_first = calc->history_last = 0;
-	if (NULL != calc->history) {
-		calc->history[0].elapsed_sec = 0.0;
-	}
+	calc->window_first = 0;
+	calc->window_count = 0;
+	calc->prior_rate = 0.0;
+	memset(calc->prior_ramp, 0, sizeof(calc->prior_ramp));
 }
 
 
@@ -126,12 +89,23 @@ void pv_reset_transfer(pvtransferstate_t transfer)
 	transfer->last_read_skip_fd = 0;
 #ifdef HAVE_SPLICE
 	transfer->splice_failed_fd = -1;
+	transfer->tee_checked_fd = -1;
+	transfer->copy_checked_fd = -1;
 #endif				/* HAVE_SPLICE */
 
-	transfer->line_positions_length = 0;
-	transfer->line_positions_head = 0;
+	pv_linepos_reset(transfer->line_positions);
+	pv_record_reset(transfer->record_scan);
 	transfer->last_output_position = 0;
+	transfer->sparse_block_size = 0;
+	transfer->input_data_start = 0;
+	transfer->input_data_end = 0;
+	transfer->hole_checked_fd = -1;
+	transfer->direct_checked_fd = -1;
+	transfer->mmap_checked_fd = -1;
+	transfer->fast_checked_fd = -1;
 	transfer->output_not_seekable = false;
+	transfer->wait_deadline.tv_sec = 0;
+	transfer->wait_deadline.tv_nsec = 0;
 }
 
 
@@ -155,6 +129,7 @@ void pv_reset_display(pvdisplay_t display)
 		return;
 	display->initial_offset = 0;
 	display->output_produced = false;
+	display->rendered_valid = false;
 }
 
 
@@ -174,6 +149,9 @@ void pv_state_reset(pvstate_t state)
 
 	pv_reset_calc(&(state->calc));
 	pv_reset_transfer(&(state->transfer));
+
+	/* Each transfer gets its own digest. */
+	pv_digest_free(state);
 }
 
 
@@ -190,10 +168,16 @@ pvstate_t pv_state_alloc(void)
 	memset(state, 0, sizeof(*state));
 
 	state->watchfd.count = 0;
+	state->watchfd.exit_queue_fd = -1;
 	state->control.output_fd = -1;
+	state->control.stats_fd = -1;
+	state->control.numa_node = -1;
+	state->control.input_fd = -1;
 #ifdef HAVE_IPC
 	state->cursor.shmid = -1;
 	state->cursor.pvcount = 1;
+	state->cursor.stage_slot = -1;
+	state->cursor.row = -1;
 #endif				/* HAVE_IPC */
 	state->cursor.lock_fd = -1;
 
@@ -222,9 +206,32 @@ pvstate_t pv_state_alloc(void)
  */
 void pv_freecontents_display(pvdisplay_t display)
 {
+	size_t style_idx;
+
 	if (NULL != display->display_buffer)
 		free(display->display_buffer);
 	display->display_buffer = NULL;
+	if (NULL != display->rendered_line)
+		free(display->rendered_line);
+	display->rendered_line = NULL;
+	if (NULL != display->render_buffer)
+		free(display->render_buffer);
+	display->render_buffer = NULL;
+	display->rendered_buffer_size = 0;
+	display->rendered_valid = false;
+	if (NULL != display->precomputed)
+		free(display->precomputed);
+	display->precomputed = NULL;
+	display->precomputed_size = 0;
+	display->precomputed_length = 0;
+	for (style_idx = 0; style_idx < PV_BARSTYLE_MAX; style_idx++) {
+		if (NULL != display->bartemplate[style_idx].cells)
+			free(display->bartemplate[style_idx].cells);
+		display->bartemplate[style_idx].cells = NULL;
+		display->bartemplate[style_idx].size = 0;
+		display->bartemplate[style_idx].width = 0;
+		display->bartemplate[style_idx].style_id = 0;
+	}
 }
 
 
@@ -233,27 +240,62 @@ void pv_freecontents_display(pvdisplay_t display)
  */
 void pv_freecontents_transfer(pvtransferstate_t transfer)
 {
+	pv_buffer_adapt_free(transfer);
+	pv_latency_free(transfer);
+	pv_poller_free(transfer);
+	pv_dropbehind_free(transfer);
+	pv_groupsync_free(transfer);
+	pv_pipesize_free(transfer);
+	pv_budget_free(transfer);
+	pv_throttle_free(transfer);
+	pv_trace_free(transfer);
+	pv_history_free(transfer);
+	pv_rescue_free(transfer);
+	pv_codec_free(transfer);
+	pv_autoengine_free(transfer);
+
+#ifdef HAVE_PTHREAD
+	pv_ticker_stop(transfer);
+	pv_pipeline_stop(transfer);
+	pv_directio_stop(transfer);
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+	pv_uring_stop(transfer);
+#endif
+#ifdef HAVE_MMAP
+	pv_mmapin_stop(transfer);
+#endif
+
+#ifdef HAVE_SPLICE
+	if (transfer->tee_pipe_open) {
+		(void) close(transfer->tee_pipe[0]);
+		(void) close(transfer->tee_pipe[1]);
+		transfer->tee_pipe_open = false;
+	}
+#endif				/* HAVE_SPLICE */
+
 	/*@-keeptrans@ */
 	if (NULL != transfer->transfer_buffer)
-		free(transfer->transfer_buffer);
+		pv_free_aligned_buffer(transfer->transfer_buffer, transfer->buffer_size + 32);
 	transfer->transfer_buffer = NULL;
 	/*@+keeptrans@ */
 	/* splint - explicitly freeing this structure, so free() here is OK. */
 
-	if (NULL != transfer->line_positions)
-		free(transfer->line_positions);
+	pv_linepos_free(transfer->line_positions);
 	transfer->line_positions = NULL;
+	pv_record_free(transfer->record_scan);
+	transfer->record_scan = NULL;
 }
 
 
 /*
- * Free dynamic contents of a calculated transfer state structure.
+ * Free dynamic contents of a calculated transfer state structure.  The
+ * average rate window is held within the structure itself, so there is
+ * currently nothing to free.
  */
-void pv_freecontents_calc(pvtransfercalc_t calc)
+void pv_freecontents_calc( /*@unused@ */ pvtransfercalc_t calc)
 {
-	if (NULL != calc->history)
-		free(calc->history);
-	calc->history = NULL;
+	(void) calc;
 }
 
 
@@ -330,13 +372,19 @@ void pv_state_free(pvstate_t state)
 	if (0 == state)
 		return;
 
+	/*
+	 * Stop any parallel streams before the output is closed, so that an
+	 * unfinished transfer isn't sent as if it were complete.
+	 */
+	pv_stripe_free(state);
+
 	/*
 	 * Close the output file first, so we can report any errors while we
 	 * still know the program name and output filename.
 	 */
 	if (state->control.output_fd >= 0) {
 		pv_truncate_output(state);
-		if (STDOUT_FILENO != state->control.output_fd) {
+		if ((STDOUT_FILENO != state->control.output_fd) && (!state->control.embedded)) {
 			if (close(state->control.output_fd) < 0) {
 				pv_error("%s: %s",
 					 NULL == state->control.output_name ? "(null)" : state->control.output_name,
@@ -353,6 +401,15 @@ void pv_state_free(pvstate_t state)
 
 	pv_freecontents_display(&(state->display));
 	pv_freecontents_display(&(state->extra_display));
+	pv_format_cache_free(&(state->status));
+	pv_statspage_free(state);
+	pv_ctlsock_free(state);
+	pv_metrics_free(state);
+	pv_stall_free(state);
+	pv_spool_free(state);
+	pv_digest_free(state);
+	pv_fanout_free(state);
+	pv_checkpoint_free(state);
 
 	if (NULL != state->control.name) {
 		free(state->control.name);
@@ -364,6 +421,61 @@ void pv_state_free(pvstate_t state)
 		state->control.default_bar_style = NULL;
 	}
 
+	if (NULL != state->control.metrics_file) {
+		free(state->control.metrics_file);
+		state->control.metrics_file = NULL;
+	}
+
+	if (NULL != state->control.stall_command) {
+		free(state->control.stall_command);
+		state->control.stall_command = NULL;
+	}
+
+	if (NULL != state->control.rate_budget) {
+		free(state->control.rate_budget);
+		state->control.rate_budget = NULL;
+	}
+
+	if (NULL != state->control.trace_file) {
+		free(state->control.trace_file);
+		state->control.trace_file = NULL;
+	}
+
+	if (NULL != state->control.history_file) {
+		free(state->control.history_file);
+		state->control.history_file = NULL;
+	}
+
+	if (NULL != state->control.engine_cache) {
+		free(state->control.engine_cache);
+		state->control.engine_cache = NULL;
+	}
+
+	if (NULL != state->control.rescue_map) {
+		free(state->control.rescue_map);
+		state->control.rescue_map = NULL;
+	}
+
+	if (NULL != state->control.checkpoint_file) {
+		free(state->control.checkpoint_file);
+		state->control.checkpoint_file = NULL;
+	}
+
+	if (NULL != state->control.cpu_affinity) {
+		free(state->control.cpu_affinity);
+		state->control.cpu_affinity = NULL;
+	}
+
+	if (NULL != state->control.manifest) {
+		free(state->control.manifest);
+		state->control.manifest = NULL;
+	}
+
+	if (NULL != state->control.copy_into) {
+		free(state->control.copy_into);
+		state->control.copy_into = NULL;
+	}
+
 	if (NULL != state->control.format_string) {
 		free(state->control.format_string);
 		state->control.format_string = NULL;
@@ -383,6 +495,13 @@ void pv_state_free(pvstate_t state)
 
 	pv_freecontents_calc(&(state->calc));
 
+	pv_linesample_free(state);
+#ifdef HAVE_PTHREAD
+	pv_prescan_stop(state);
+	pv_prefetch_stop(state);
+	pv_sizescan_stop(state);
+#endif
+
 	if (NULL != state->files.filename) {
 		unsigned int file_idx;
 		for (file_idx = 0; file_idx < state->files.file_count; file_idx++) {
@@ -502,6 +621,62 @@ void pv_state_show_stats_set(pvstate_t state, bool val)
 	state->control.show_stats = val;
 }
 
+void pv_state_self_profile_set(pvstate_t state, bool val)
+{
+	state->control.self_profile = val;
+	pv_profile_enable(val);
+}
+
+void pv_state_huge_pages_set(pvstate_t state, bool val)
+{
+	state->control.huge_pages = val;
+}
+
+void pv_state_lock_buffers_set(pvstate_t state, bool val)
+{
+	state->control.lock_buffers = val;
+}
+
+void pv_state_numa_node_set(pvstate_t state, int val)
+{
+	state->control.numa_node = val;
+}
+
+void pv_state_cpu_affinity_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if (NULL != state->control.cpu_affinity) {
+		free(state->control.cpu_affinity);
+		state->control.cpu_affinity = NULL;
+	}
+	if (NULL != val)
+		state->control.cpu_affinity = pv_strdup(val);
+}
+
+void pv_state_manifest_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if (NULL != state->control.manifest) {
+		free(state->control.manifest);
+		state->control.manifest = NULL;
+	}
+	if (NULL != val)
+		state->control.manifest = pv_strdup(val);
+}
+
+void pv_state_copy_into_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if (NULL != state->control.copy_into) {
+		free(state->control.copy_into);
+		state->control.copy_into = NULL;
+	}
+	if (NULL != val)
+		state->control.copy_into = pv_strdup(val);
+}
+
+void pv_state_jobs_set(pvstate_t state, unsigned int val)
+{
+	state->control.jobs = val;
+}
+
 void pv_state_numeric_set(pvstate_t state, bool val)
 {
 	state->control.numeric = val;
@@ -542,6 +717,68 @@ void pv_state_null_terminated_lines_set(pvstate_t state, bool val)
 	state->control.null_terminated_lines = val;
 }
 
+/*
+ * Set the "--record" framing; NULL, or one that can't be parsed, means
+ * none.
+ */
+void pv_state_record_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if ((NULL == val) || (!pv_record_spec_parse(val, &(state->control.record))))
+		memset(&(state->control.record), 0, sizeof(state->control.record));
+}
+
+/*
+ * Mark the state as belonging to a transfer embedded in another program,
+ * which owns the file descriptors and the signal handling: the loop then
+ * leaves out the remote control and control socket, which are keyed on
+ * the process ID, and nothing closes the input or output.
+ */
+void pv_state_embedded_set(pvstate_t state, bool val)
+{
+	state->control.embedded = val;
+}
+
+/*
+ * Read from "fd" instead of standard input wherever the input file list
+ * says "-".
+ */
+void pv_state_input_fd_set(pvstate_t state, int fd)
+{
+	state->control.input_fd = fd;
+}
+
+/*
+ * Add an observer of the transfer's progress.  Returns false if there are
+ * already as many as there can be.
+ */
+bool pv_state_observer_add(pvstate_t state, pvobserverfn_t callback, /*@null@ */ void *data)
+{
+	if (state->control.observer_count >= PV_MAX_OBSERVERS)
+		return false;
+	state->control.observer[state->control.observer_count].callback = callback;
+	state->control.observer[state->control.observer_count].data = data;
+	state->control.observer_count++;
+	return true;
+}
+
+/*
+ * Remove an observer added with the same function and data.
+ */
+void pv_state_observer_remove(pvstate_t state, pvobserverfn_t callback, /*@null@ */ void *data)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < state->control.observer_count; idx++) {
+		if ((state->control.observer[idx].callback != callback) || (state->control.observer[idx].data != data))
+			continue;
+		state->control.observer_count--;
+		if (idx < state->control.observer_count)
+			memmove(&(state->control.observer[idx]), &(state->control.observer[idx + 1]),
+				(state->control.observer_count - idx) * sizeof(state->control.observer[0]));
+		return;
+	}
+}
+
 void pv_state_no_display_set(pvstate_t state, bool val)
 {
 	state->control.no_display = val;
@@ -570,7 +807,70 @@ void pv_state_sync_after_write_set(pvstate_t state, bool val)
 void pv_state_direct_io_set(pvstate_t state, bool val)
 {
 	state->control.direct_io = val;
-	state->control.direct_io_changed = true;
+}
+
+void pv_state_sync_group_set(pvstate_t state, off_t bytes, double seconds)
+{
+	state->control.sync_every = bytes;
+	state->control.sync_interval = seconds;
+}
+
+void pv_state_pipe_size_set(pvstate_t state, size_t bytes, bool automatic)
+{
+	state->control.pipe_size = bytes;
+	state->control.pipe_size_auto = automatic;
+}
+
+void pv_state_line_estimate_set(pvstate_t state, bool val)
+{
+	state->control.line_estimate = val;
+}
+
+void pv_state_drop_behind_set(pvstate_t state, bool val)
+{
+	state->control.drop_behind = val;
+}
+
+void pv_state_rescue_map_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if (NULL != state->control.rescue_map) {
+		free(state->control.rescue_map);
+		state->control.rescue_map = NULL;
+	}
+	if (NULL != val)
+		state->control.rescue_map = pv_strdup(val);
+}
+
+void pv_state_rescue_retries_set(pvstate_t state, unsigned int val)
+{
+	state->control.rescue_retries = val;
+}
+
+void pv_state_rescue_direct_set(pvstate_t state, bool val)
+{
+	state->control.rescue_direct = val;
+}
+
+void pv_state_streams_set(pvstate_t state, unsigned int val)
+{
+	state->control.streams = val;
+}
+
+void pv_state_codec_set(pvstate_t state, pvcodec_t codec, bool compress, int level)
+{
+	state->control.codec = codec;
+	state->control.codec_compress = compress;
+	state->control.codec_level = level;
+}
+
+void pv_state_checkpoint_file_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if (NULL != state->control.checkpoint_file) {
+		free(state->control.checkpoint_file);
+		state->control.checkpoint_file = NULL;
+	}
+	if (NULL != val)
+		state->control.checkpoint_file = pv_strdup(val);
 }
 
 void pv_state_sparse_output_set(pvstate_t state, bool val)
@@ -588,16 +888,64 @@ void pv_state_rate_limit_set(pvstate_t state, off_t val)
 	state->control.rate_limit = val;
 }
 
+void pv_state_rate_burst_set(pvstate_t state, off_t val)
+{
+	state->control.rate_burst = val;
+}
+
+void pv_state_rate_budget_set(pvstate_t state, /*@null@ */ const char *name, unsigned int weight)
+{
+	if (NULL != state->control.rate_budget) {
+		free(state->control.rate_budget);
+		state->control.rate_budget = NULL;
+	}
+	if (NULL != name)
+		state->control.rate_budget = pv_strdup(name);
+	state->control.rate_weight = weight > 0 ? weight : 1;
+}
+
+void pv_state_throttle_set(pvstate_t state, double latency_target, unsigned int pressure_target)
+{
+	state->control.latency_target = latency_target;
+	state->control.pressure_target = pressure_target;
+}
+
 void pv_state_target_buffer_size_set(pvstate_t state, size_t val)
 {
 	state->control.target_buffer_size = val;
 }
 
+void pv_state_adaptive_buffer_set(pvstate_t state, bool val)
+{
+	state->control.adaptive_buffer = val;
+}
+
 void pv_state_no_splice_set(pvstate_t state, bool val)
 {
 	state->control.no_splice = val;
 }
 
+void pv_state_pipeline_buffers_set(pvstate_t state, unsigned int val)
+{
+	state->control.pipeline_buffers = val;
+}
+
+void pv_state_io_engine_set(pvstate_t state, pvioengine_t val)
+{
+	state->control.io_engine = val;
+}
+
+void pv_state_stats_page_set(pvstate_t state, bool val)
+{
+	state->control.stats_page = val;
+}
+
+void pv_state_stats_output_set(pvstate_t state, int fd, pvstatsformat_t format)
+{
+	state->control.stats_fd = fd;
+	state->control.stats_format = format;
+}
+
 void pv_state_size_set(pvstate_t state, off_t val)
 {
 	state->control.size = val;
@@ -642,6 +990,72 @@ void pv_state_default_bar_style_set(pvstate_t state, /*@null@ */ const char *val
 		state->control.default_bar_style = pv_strdup(val);
 }
 
+void pv_state_metrics_file_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if (NULL != state->control.metrics_file) {
+		free(state->control.metrics_file);
+		state->control.metrics_file = NULL;
+	}
+	if (NULL != val)
+		state->control.metrics_file = pv_strdup(val);
+}
+
+void pv_state_trace_file_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if (NULL != state->control.trace_file) {
+		free(state->control.trace_file);
+		state->control.trace_file = NULL;
+	}
+	if (NULL != val)
+		state->control.trace_file = pv_strdup(val);
+}
+
+void pv_state_history_file_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if (NULL != state->control.history_file) {
+		free(state->control.history_file);
+		state->control.history_file = NULL;
+	}
+	if (NULL != val)
+		state->control.history_file = pv_strdup(val);
+}
+
+void pv_state_engine_cache_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if (NULL != state->control.engine_cache) {
+		free(state->control.engine_cache);
+		state->control.engine_cache = NULL;
+	}
+	if (NULL != val)
+		state->control.engine_cache = pv_strdup(val);
+}
+
+void pv_state_coalesce_set(pvstate_t state, double seconds, size_t bytes)
+{
+	state->control.coalesce = seconds;
+	state->control.coalesce_bytes = bytes;
+}
+
+void pv_state_stall_timeout_set(pvstate_t state, double val)
+{
+	state->control.stall_timeout = val;
+}
+
+void pv_state_rate_drop_set(pvstate_t state, unsigned int val)
+{
+	state->control.rate_drop = val;
+}
+
+void pv_state_stall_command_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if (NULL != state->control.stall_command) {
+		free(state->control.stall_command);
+		state->control.stall_command = NULL;
+	}
+	if (NULL != val)
+		state->control.stall_command = pv_strdup(val);
+}
+
 void pv_state_format_string_set(pvstate_t state, /*@null@ */ const char *val)
 {
 	if (NULL != state->control.format_string) {
@@ -718,7 +1132,8 @@ void pv_state_output_set(pvstate_t state, int fd, const char *name)
 	 * before we store the new output filename.
 	 */
 	pv_truncate_output(state);
-	if (state->control.output_fd >= 0 && state->control.output_fd != STDOUT_FILENO) {
+	pv_poller_forget(&(state->transfer), state->control.output_fd);
+	if (state->control.output_fd >= 0 && state->control.output_fd != STDOUT_FILENO && !state->control.embedded) {
 		if (close(state->control.output_fd) < 0) {
 			pv_error("%s: %s",
 				 NULL == state->control.output_name ? "(null)" : state->control.output_name,
@@ -756,12 +1171,27 @@ void pv_state_output_set(pvstate_t state, int fd, const char *name)
 	}
 }
 
+void pv_state_digest_set(pvstate_t state, pvdigest_t val)
+{
+	state->control.digest = val;
+}
+
+void pv_state_fanout_policy_set(pvstate_t state, pvfanoutpolicy_t val)
+{
+	state->control.fanout_policy = val;
+}
+
+void pv_state_eta_model_set(pvstate_t state, pvetamodel_t val)
+{
+	state->control.eta_model = val;
+}
+
 void pv_state_average_rate_window_set(pvstate_t state, unsigned int val)
 {
 	if (val < 1)
 		val = 1;
 	state->control.average_rate_window = val;
-	state->control.history_interval = pv_update_calc_average_rate_window(&(state->calc), val);
+	pv_update_calc_average_rate_window(&(state->calc), val);
 }
 
 void pv_state_set_terminal_supports_utf8(pvstate_t state, bool val)
@@ -777,6 +1207,14 @@ void pv_state_inputfiles(pvstate_t state, unsigned int input_file_count, const c
 	unsigned int file_idx;
 	/*@only@ */ nullable_string_t *new_array;
 
+	pv_linesample_free(state);
+#ifdef HAVE_PTHREAD
+	/* Any background line count, size scan, or prefetch was for the old list. */
+	pv_prescan_stop(state);
+	pv_prefetch_stop(state);
+	pv_sizescan_stop(state);
+#endif
+
 	/* Free the old array and its contents, if there was one. */
 	if (NULL != state->files.filename) {
 		for (file_idx = 0; file_idx < state->files.file_count; file_idx++) {
@@ -833,6 +1271,7 @@ void pv_state_watchfds(pvstate_t state, unsigned int watchfd_count, const pid_t
 		 */
 	}
 	state->watchfd.count = 0;
+	state->watchfd.allocated = 0;
 	state->watchfd.multiple_pids = false;
 
 	/* Allocate an empty new array of the right size. */
@@ -850,11 +1289,23 @@ void pv_state_watchfds(pvstate_t state, unsigned int watchfd_count, const pid_t
 	for (item_idx = 0; item_idx < watchfd_count; item_idx++) {
 		state->watchfd.watching[item_idx].pid = pids[item_idx];
 		state->watchfd.watching[item_idx].fd = fds[item_idx];
+		state->watchfd.watching[item_idx].pidfd = -1;
 		if ((item_idx > 0) && (pids[item_idx] != pids[item_idx - 1]))
 			state->watchfd.multiple_pids = true;
 	}
 	state->watchfd.count = watchfd_count;
+	state->watchfd.allocated = 1 + watchfd_count;
 
 	debug("%s=%d, %s=%s", "watchfd.count", state->watchfd.count, "multiple_pids",
 	      state->watchfd.multiple_pids ? "true" : "false");
 }
+
+
+/*
+ * Set whether to follow the child processes of the watched processes
+ * ("--tree").
+ */
+void pv_state_watch_tree_set(pvstate_t state, bool val)
+{
+	state->watchfd.tree = val;
+}
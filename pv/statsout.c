@@ -0,0 +1,213 @@
+/*
+ * Functions for writing machine-readable stats records with "--stats-fd".
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+/*
+ * One record is written per display interval, straight from the
+ * calculated and transfer state, without going through the formatter.
+ * Records are either a line of JSON or the fixed-size structure below, in
+ * host byte order, so a collector can read them with a single read() or
+ * fread() each.  JSON records also carry the smoothed and windowed rates
+ * and a summary of the I/O latency histograms; the binary structure does
+ * not, so that its size stays fixed.
+ *
+ * A record is skipped rather than written if the descriptor is not ready
+ * for it, so a slow collector never holds up the transfer - except for
+ * the final record, which is always written.
+ *
+ * Events, such as a stall being detected, are JSON lines of their own,
+ * with an "event" member that ordinary records never have; they are
+ * always written, since they are rare and are what a collector most
+ * needs to see, and are left out of binary streams, whose records all
+ * have the same layout.
+ */
+#define PV_STATSOUT_MAGIC	0x52535650	/* "PVSR" */
+#define PV_STATSOUT_VERSION	1
+#define PV_STATSOUT_FLAG_FINAL	1
+#define PV_STATSOUT_FLAG_LINES	4
+#define PV_STATSOUT_WRITE_TIMEOUT 1000		/* msec to wait to finish a record */
+
+struct pvstatsout_record_s {
+	uint32_t magic;			 /* PV_STATSOUT_MAGIC */
+	uint32_t version;		 /* PV_STATSOUT_VERSION */
+	uint64_t flags;			 /* PV_STATSOUT_FLAG_* */
+	int64_t pid;			 /* process ID of this pv */
+	int64_t elapsed_nsec;		 /* elapsed transfer time */
+	int64_t transferred;		 /* amount read so far */
+	int64_t written;		 /* amount written so far */
+	int64_t unconsumed;		 /* written but not yet read by the receiver */
+	int64_t size;			 /* expected total size, 0 if unknown */
+	int64_t measurements;		 /* number of rate measurements taken */
+	double percentage;		 /* completion percentage */
+	double rate;			 /* current rate per second */
+	double average_rate;		 /* average rate per second */
+	double rate_min;		 /* slowest rate measured */
+	double rate_max;		 /* fastest rate measured */
+	double rate_sum;		 /* sum of measured rates */
+	double ratesquared_sum;		 /* sum of their squares, for the deviation */
+};
+
+
+/*
+ * Write "length" bytes of "data" to the --stats-fd descriptor.
+ *
+ * Records are much smaller than PIPE_BUF, so a pipe takes them whole, but
+ * a short write to anything else is carried on with so that the stream
+ * stays in step.
+ */
+static void pv__statsout_send(pvstate_t state, const char *data, size_t length)
+{
+	size_t offset;
+
+	for (offset = 0; offset < length;) {
+		ssize_t written;
+
+		written = write(state->control.stats_fd, data + offset, length - offset);
+		if (written > 0) {
+			offset += (size_t) written;
+			continue;
+		}
+		if ((written < 0) && (EINTR == errno))
+			continue;
+		if ((written < 0) && ((EAGAIN == errno) || (EWOULDBLOCK == errno))) {
+			struct pollfd pfd;
+
+			/* Non-blocking descriptor - wait a while for room. */
+			pfd.fd = state->control.stats_fd;
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+			if (poll(&pfd, 1, PV_STATSOUT_WRITE_TIMEOUT) > 0)
+				continue;
+			errno = EAGAIN;
+		}
+
+		pv_error("%s: %s", "--stats-fd", written < 0 ? strerror(errno) : _("write failed"));
+		state->control.stats_fd = -1;
+		return;
+	}
+}
+
+
+/*
+ * Write a stats record to the --stats-fd descriptor, if there is one; if
+ * "final" is true, this is the last record of the transfer.
+ *
+ * If the descriptor can no longer be written to, this is reported once,
+ * and no more records are written.
+ */
+void pv_statsout_write(pvstate_t state, bool final)
+{
+	char buffer[2048];		 /* flawfinder: ignore - bounded by pv_snprintf() */
+	char latency[1024];		 /* flawfinder: ignore - bounded by pv_snprintf() */
+	struct pvstatsout_record_s record;
+	const char *data;
+	size_t length;
+
+	if (state->control.stats_fd < 0)
+		return;
+
+	if (!final) {
+		struct pollfd pfd;
+
+		pfd.fd = state->control.stats_fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+		if ((poll(&pfd, 1, 0) < 1) || (0 == (pfd.revents & POLLOUT))) {
+			debug("%s", "stats descriptor not ready - skipping record");
+			return;
+		}
+	}
+
+	if (PV_STATSFORMAT_BINARY == state->control.stats_format) {
+		memset(&record, 0, sizeof(record));
+		record.magic = PV_STATSOUT_MAGIC;
+		record.version = PV_STATSOUT_VERSION;
+		record.flags =
+		    (final ? PV_STATSOUT_FLAG_FINAL : 0) | (state->control.linemode ? PV_STATSOUT_FLAG_LINES : 0);
+		record.pid = (int64_t) getpid();
+		record.elapsed_nsec = (int64_t) (state->transfer.elapsed_seconds * 1000000000.0L);
+		record.transferred = (int64_t) (state->transfer.transferred);
+		record.written = (int64_t) (state->transfer.total_written);
+		record.unconsumed = (int64_t) (state->transfer.written_but_not_consumed);
+		record.size = (int64_t) (state->control.size);
+		record.measurements = (int64_t) (state->calc.measurements_taken);
+		record.percentage = state->calc.percentage;
+		record.rate = (double) (state->calc.transfer_rate);
+		record.average_rate = (double) (state->calc.average_rate);
+		record.rate_min = (double) (state->calc.rate_min);
+		record.rate_max = (double) (state->calc.rate_max);
+		record.rate_sum = (double) (state->calc.rate_sum);
+		record.ratesquared_sum = (double) (state->calc.ratesquared_sum);
+
+		data = (const char *) &record;
+		length = sizeof(record);
+	} else {
+		int record_length;
+
+		if (0 == pv_latency_json(&(state->transfer), latency, sizeof(latency)))
+			latency[0] = '\0';
+
+		record_length = pv_snprintf(buffer, sizeof(buffer),
+					    "{\"pid\":%ld,\"elapsed\":%.6Lf,\"transferred\":%lld,\"written\":%lld"
+					    ",\"unconsumed\":%lld,\"size\":%lld,\"percentage\":%.3f,\"rate\":%.3Lf"
+					    ",\"average_rate\":%.3Lf,\"rate_min\":%.3Lf,\"rate_max\":%.3Lf"
+					    ",\"rate_sum\":%.3Lf,\"ratesquared_sum\":%.3Lf,\"measurements\":%lu"
+					    ",\"rate_ewma\":%.3Lf,\"rate_p50\":%.3Lf,\"rate_p99\":%.3Lf"
+					    ",\"line_mode\":%s,\"final\":%s%s}\n",
+					    (long) getpid(), state->transfer.elapsed_seconds,
+					    (long long) (state->transfer.transferred),
+					    (long long) (state->transfer.total_written),
+					    (long long) (state->transfer.written_but_not_consumed),
+					    (long long) (state->control.size), state->calc.percentage,
+					    state->calc.transfer_rate, state->calc.average_rate, state->calc.rate_min,
+					    state->calc.rate_max, state->calc.rate_sum, state->calc.ratesquared_sum,
+					    state->calc.measurements_taken, state->calc.ewma_rate,
+					    pv_calc_rate_percentile(&(state->calc), 0.5),
+					    pv_calc_rate_percentile(&(state->calc), 0.99), state->control.linemode ? "true" : "false",
+					    final ? "true" : "false", latency);
+		if ((record_length < 1) || (record_length >= (int) sizeof(buffer)))
+			return;
+
+		data = buffer;
+		length = (size_t) record_length;
+	}
+
+	pv__statsout_send(state, data, length);
+}
+
+
+/*
+ * Write an event record to the --stats-fd descriptor, if there is one and
+ * it is taking JSON records, naming the event "event" and adding
+ * "fields", which are further JSON members, each preceded by a comma.
+ */
+void pv_statsout_event(pvstate_t state, const char *event, const char *fields)
+{
+	char buffer[1024];		 /* flawfinder: ignore - bounded by pv_snprintf() */
+	int record_length;
+
+	if ((state->control.stats_fd < 0) || (PV_STATSFORMAT_BINARY == state->control.stats_format))
+		return;
+
+	record_length = pv_snprintf(buffer, sizeof(buffer), "{\"pid\":%ld,\"elapsed\":%.6Lf,\"event\":\"%s\"%s}\n",
+				    (long) getpid(), state->transfer.elapsed_seconds, event, fields);
+	if ((record_length < 1) || (record_length >= (int) sizeof(buffer)))
+		return;
+
+	pv__statsout_send(state, buffer, (size_t) record_length);
+}
@@ -0,0 +1,335 @@
+/*
+ * Functions for publishing the transfer state in a shared memory page, for
+ * "--stats-page", and for reading it back for "--query".
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#define PV_STATSPAGE_MAGIC	0x54535650	 /* "PVST", little-endian */
+#define PV_STATSPAGE_VERSION	1
+
+#define PV_STATSPAGE_RUNNING	1		 /* the transfer is in progress */
+#define PV_STATSPAGE_FINISHED	2		 /* the transfer has ended */
+#define PV_STATSPAGE_LINEMODE	4		 /* amounts are lines, not bytes */
+
+#define PV_STATSPAGE_READ_TRIES	1000		 /* attempts at a consistent read */
+
+/*
+ * The layout of the page, as documented in the manual.  Every field is
+ * naturally aligned and in host byte order.
+ *
+ * The page is protected by a sequence lock: the writer makes "sequence"
+ * odd, updates the fields, and then makes it even again, so a reader takes
+ * a copy of the fields between two reads of an even "sequence" and tries
+ * again if the two differ.  Nobody ever waits for anybody else, and the
+ * transferring process is never woken up by a reader.
+ */
+struct pvstatspage_layout_s {
+	uint32_t magic;			 /* PV_STATSPAGE_MAGIC once initialised */
+	uint32_t version;		 /* PV_STATSPAGE_VERSION */
+	uint64_t sequence;		 /* odd while an update is in progress */
+	uint64_t flags;			 /* PV_STATSPAGE_* flags */
+	int64_t pid;			 /* process ID of the writer */
+	int64_t total_written;		 /* bytes or lines written so far */
+	int64_t transferred;		 /* total_written, less any still in the pipe */
+	int64_t size;			 /* expected total size, or 0 if unknown */
+	int64_t elapsed_nsec;		 /* transfer time so far, in nanoseconds */
+	int64_t rate;			 /* current rate, per second */
+	int64_t average_rate;		 /* average rate, per second */
+};
+
+/*
+ * The writer's handle on its own page.
+ */
+struct pvstatspage_s {
+	char filename[PV_SIZEOF_STATSPAGE_FILENAME];	/* flawfinder: ignore */
+	/*@null@ */ /*@dependent@ */ struct pvstatspage_layout_s *page;	/* the mapped page */
+	bool failed;			 /* set if the page could not be created */
+};
+
+/*
+ * flawfinder rationale: the filename buffer is only ever written with
+ * pv_snprintf(), which bounds and terminates it.
+ */
+
+
+#ifdef HAVE_MMAP
+
+/*
+ * Create and map a new stats page for this process, returning false on
+ * failure.
+ */
+static bool pv__statspage_create(struct pvstatspage_s *handle)
+{
+	int open_flags, page_fd, attempt;
+	void *mapping;
+
+	open_flags = O_RDWR | O_CREAT | O_EXCL;
+#ifdef O_NOFOLLOW
+	open_flags |= O_NOFOLLOW;
+#endif
+
+	page_fd = -1;
+	for (attempt = 0; attempt < 2 && page_fd < 0; attempt++) {
+		if (!pv_runtime_filename
+		    (handle->filename, sizeof(handle->filename), "stats", getpid(), 1 == attempt, true))
+			break;
+		page_fd = open(handle->filename, open_flags, 0644);	/* flawfinder: ignore */
+		if ((page_fd < 0) && (EEXIST == errno)) {
+			/* Left behind by an earlier process with our PID. */
+			(void) unlink(handle->filename);
+			page_fd = open(handle->filename, open_flags, 0644);	/* flawfinder: ignore */
+		}
+	}
+
+	/*
+	 * flawfinder rationale: as with pv_open_controlfile(), the files
+	 * are in a directory whose parents cannot be manipulated, and the
+	 * final component is not allowed to be a symbolic link.
+	 */
+
+	if (page_fd < 0) {
+		debug("%s: %s", "stats page", strerror(errno));
+		return false;
+	}
+
+	if (0 != ftruncate(page_fd, (off_t) sizeof(struct pvstatspage_layout_s))) {
+		debug("%s: %s: %s", handle->filename, "ftruncate", strerror(errno));
+		(void) close(page_fd);
+		(void) unlink(handle->filename);
+		return false;
+	}
+
+	mapping =
+	    mmap(NULL, sizeof(struct pvstatspage_layout_s), PROT_READ | PROT_WRITE, MAP_SHARED, page_fd, 0);
+	(void) close(page_fd);
+	if (MAP_FAILED == mapping) {
+		debug("%s: %s: %s", handle->filename, "mmap", strerror(errno));
+		(void) unlink(handle->filename);
+		return false;
+	}
+
+	handle->page = (struct pvstatspage_layout_s *) mapping;
+	handle->page->version = PV_STATSPAGE_VERSION;
+	handle->page->pid = (int64_t) getpid();
+
+	/* Only mark the page as valid once everything else is in place. */
+	__atomic_store_n(&(handle->page->magic), PV_STATSPAGE_MAGIC, __ATOMIC_RELEASE);
+
+	debug("%s: %s", "stats page", handle->filename);
+
+	return true;
+}
+
+
+/*
+ * Publish the current transfer state in the stats page, creating it first
+ * if necessary.  If "finished" is true, the page is marked as belonging to
+ * a transfer that has ended.
+ *
+ * This is called every time round the main loop, so it only does a handful
+ * of memory writes - no system calls - once the page exists.
+ */
+void pv_statspage_update(pvstate_t state, bool finished)
+{
+	struct pvstatspage_s *handle;
+	struct pvstatspage_layout_s *page;
+	long double average_rate;
+	uint64_t sequence, flags;
+
+	if (!state->control.stats_page)
+		return;
+
+	if (NULL == state->status.stats_page) {
+		state->status.stats_page = calloc(1, sizeof(*(state->status.stats_page)));
+		if (NULL == state->status.stats_page)
+			return;
+		if (!pv__statspage_create(state->status.stats_page))
+			state->status.stats_page->failed = true;
+	}
+
+	handle = state->status.stats_page;
+	if (handle->failed || (NULL == handle->page))
+		return;
+	page = handle->page;
+
+	flags = finished ? PV_STATSPAGE_FINISHED : PV_STATSPAGE_RUNNING;
+	if (state->control.linemode)
+		flags |= PV_STATSPAGE_LINEMODE;
+
+	average_rate = 0.0;
+	if (state->transfer.elapsed_seconds > 0.000001)
+		average_rate = (long double) (state->transfer.transferred) / state->transfer.elapsed_seconds;
+
+	/* We are the only writer, so a plain read of the sequence is safe. */
+	sequence = page->sequence;
+	__atomic_store_n(&(page->sequence), sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&(page->flags), flags, __ATOMIC_RELAXED);
+	__atomic_store_n(&(page->total_written), (int64_t) (state->transfer.total_written), __ATOMIC_RELAXED);
+	__atomic_store_n(&(page->transferred), (int64_t) (state->transfer.transferred), __ATOMIC_RELAXED);
+	__atomic_store_n(&(page->size), (int64_t) (state->control.size), __ATOMIC_RELAXED);
+	__atomic_store_n(&(page->elapsed_nsec), (int64_t) (state->transfer.elapsed_seconds * 1000000000.0L),
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&(page->rate), (int64_t) (state->calc.transfer_rate), __ATOMIC_RELAXED);
+	__atomic_store_n(&(page->average_rate), (int64_t) average_rate, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&(page->sequence), sequence + 2, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Read the stats page of process "pid", if it has one, into the transfer
+ * state, returning true on success, like a --query response.  If "sizeptr"
+ * is not NULL, the size is also copied to it.
+ */
+bool pv_statspage_fetch(pvstate_t state, pid_t pid, /*@null@ */ off_t *sizeptr)
+{
+	char filename[PV_SIZEOF_STATSPAGE_FILENAME];	/* flawfinder: ignore - bounded by pv_snprintf() */
+	struct pvstatspage_layout_s copy;
+	const struct pvstatspage_layout_s *page;
+	struct stat sb;
+	int open_flags, page_fd, attempt;
+	void *mapping;
+	bool consistent;
+
+	open_flags = O_RDONLY;
+#ifdef O_NOFOLLOW
+	open_flags |= O_NOFOLLOW;
+#endif
+
+	page_fd = -1;
+	for (attempt = 0; attempt < 2 && page_fd < 0; attempt++) {
+		if (!pv_runtime_filename(filename, sizeof(filename), "stats", pid, 1 == attempt, false))
+			break;
+		page_fd = open(filename, open_flags);	/* flawfinder: ignore - see pv__statspage_create() */
+	}
+	if (page_fd < 0)
+		return false;
+
+	memset(&sb, 0, sizeof(sb));
+	if ((0 != fstat(page_fd, &sb)) || (sb.st_size < (off_t) sizeof(copy))) {
+		(void) close(page_fd);
+		return false;
+	}
+
+	mapping = mmap(NULL, sizeof(copy), PROT_READ, MAP_SHARED, page_fd, 0);
+	(void) close(page_fd);
+	if (MAP_FAILED == mapping)
+		return false;
+	page = (const struct pvstatspage_layout_s *) mapping;
+
+	consistent = false;
+	memset(&copy, 0, sizeof(copy));
+
+	if ((PV_STATSPAGE_MAGIC == __atomic_load_n(&(page->magic), __ATOMIC_ACQUIRE))
+	    && (PV_STATSPAGE_VERSION == page->version)
+	    && ((int64_t) pid == page->pid)) {
+		for (attempt = 0; attempt < PV_STATSPAGE_READ_TRIES && !consistent; attempt++) {
+			uint64_t sequence_before, sequence_after;
+
+			sequence_before = __atomic_load_n(&(page->sequence), __ATOMIC_ACQUIRE);
+			if (0 != (sequence_before & 1))
+				continue;
+
+			copy.flags = __atomic_load_n(&(page->flags), __ATOMIC_RELAXED);
+			copy.transferred = __atomic_load_n(&(page->transferred), __ATOMIC_RELAXED);
+			copy.size = __atomic_load_n(&(page->size), __ATOMIC_RELAXED);
+			copy.elapsed_nsec = __atomic_load_n(&(page->elapsed_nsec), __ATOMIC_RELAXED);
+
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			sequence_after = __atomic_load_n(&(page->sequence), __ATOMIC_RELAXED);
+
+			consistent = (sequence_before == sequence_after);
+		}
+	}
+
+	(void) munmap(mapping, sizeof(copy));
+
+	/* A page that has never been written to tells us nothing. */
+	if ((!consistent) || (0 == copy.flags))
+		return false;
+
+	state->transfer.elapsed_seconds = (long double) (copy.elapsed_nsec) / 1000000000.0L;
+	state->transfer.transferred = (off_t) (copy.transferred);
+	state->control.size = (off_t) (copy.size);
+	if (NULL != sizeptr)
+		*sizeptr = state->control.size;
+
+	debug("%s: %d [%Lg, %ld, %ld]", "stats page read", pid, state->transfer.elapsed_seconds,
+	      state->transfer.transferred, state->control.size);
+
+	return true;
+}
+
+#else				/* !HAVE_MMAP */
+
+/*
+ * Without mmap(), there is no stats page; "--stats-page" does nothing and
+ * "--query" always falls back to signals.
+ */
+
+void pv_statspage_update(pvstate_t state, __attribute__((unused)) bool finished)
+{
+	if (!state->control.stats_page)
+		return;
+	debug("%s", "stats page not supported without mmap()");
+}
+
+
+bool pv_statspage_fetch( /*@unused@ */ __attribute__((unused)) pvstate_t state,
+			/*@unused@ */ __attribute__((unused)) pid_t pid,
+			/*@unused@ */ __attribute__((unused)) /*@null@ */ off_t *sizeptr)
+{
+	return false;
+}
+
+#endif				/* HAVE_MMAP */
+
+
+/*
+ * Remove this process's stats page, if it has one, and free it.
+ */
+void pv_statspage_free(pvstate_t state)
+{
+	struct pvstatspage_s *handle;
+
+	if ((NULL == state) || (NULL == state->status.stats_page))
+		return;
+
+	handle = state->status.stats_page;
+
+#ifdef HAVE_MMAP
+	if (NULL != handle->page) {
+		/* Readers which already have it open see it as finished. */
+		pv_statspage_update(state, true);
+		(void) munmap((void *) (handle->page), sizeof(struct pvstatspage_layout_s));
+		handle->page = NULL;
+		debug("%s: %s", "removing", handle->filename);
+		(void) unlink(handle->filename);
+	}
+#endif
+
+	free(handle);
+	state->status.stats_page = NULL;
+}
@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #if defined(ENABLE_NLS) && defined(HAVE_WCHAR_H)
@@ -20,6 +21,15 @@
 #endif
 #endif
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <emmintrin.h>
+#define PV_STRING_SSE2 1
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PV_STRING_NEON 1
+#endif
+
 
 /*
  * Wrapper for sprintf(), falling back to sprintf() on systems without that
@@ -188,6 +198,54 @@ void *pv_memrchr(const void *buffer, int match, size_t length)
 }
 
 
+/*
+ * Return true if all "bytes" bytes at "string" are printable ASCII - space
+ * to tilde - so that each takes exactly one display column.  Anything
+ * else, including the escape that starts a CSI sequence, returns false.
+ *
+ * Display strings are short, so 16 bytes at a time is enough; SSE2 and
+ * NEON are always there on x86-64 and AArch64.
+ */
+static bool pv__strwidth_all_printable(const char *string, size_t bytes)
+{
+	size_t idx = 0;
+
+#if defined(PV_STRING_SSE2)
+	{
+		const __m128i below = _mm_set1_epi8(0x1F);
+		const __m128i above = _mm_set1_epi8(0x7F);
+
+		/* Signed compares, so bytes with the top bit set are "below". */
+		for (; idx + 16 <= bytes; idx += 16) {
+			__m128i chunk = _mm_loadu_si128((const __m128i *) (string + idx));
+			__m128i good = _mm_and_si128(_mm_cmpgt_epi8(chunk, below), _mm_cmplt_epi8(chunk, above));
+			if (0xffff != _mm_movemask_epi8(good))
+				return false;
+		}
+	}
+#elif defined(PV_STRING_NEON)
+	{
+		const uint8x16_t lowest = vdupq_n_u8(0x20);
+		const uint8x16_t highest = vdupq_n_u8(0x7E);
+
+		for (; idx + 16 <= bytes; idx += 16) {
+			uint8x16_t chunk = vld1q_u8((const uint8_t *) (string + idx));
+			uint8x16_t good = vandq_u8(vcgeq_u8(chunk, lowest), vcleq_u8(chunk, highest));
+			if (0xFF != vminvq_u8(good))
+				return false;
+		}
+	}
+#endif
+
+	for (; idx < bytes; idx++) {
+		if ((string[idx] < (char) 32) || (string[idx] > (char) 126))
+			return false;
+	}
+
+	return true;
+}
+
+
 /*
  * Return the number of display columns needed to show the
  * non-null-terminated string "string" whose length in bytes is "bytes".
@@ -199,7 +257,8 @@ void *pv_memrchr(const void *buffer, int match, size_t length)
  * character display width function "wcswidth()" on it.
  *
  * If NLS is disabled, or the string cannot be converted, this just returns
- * the value of "bytes".
+ * the value of "bytes".  Printable ASCII, which is what most of the display
+ * is made of, is counted without any conversion at all.
  *
  * Note that this function uses internal buffers if the string is short
  * enough, otherwise it has to call malloc() and free(), so it becomes less
@@ -225,6 +284,9 @@ size_t pv_strwidth(const char *string, size_t bytes)
 	if (0 == bytes)
 		return 0;
 
+	if (pv__strwidth_all_printable(string, bytes))
+		return bytes;
+
 	if (bytes < sizeof(internal_raw) - 1) {
 		raw_string = internal_raw;
 	} else {
@@ -0,0 +1,1002 @@
+/*
+ * Functions for splitting a transfer across several parallel network
+ * connections, for "--streams", and putting it back together at the other
+ * end.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_PTHREAD
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ * A single TCP connection over a long, fast link can only have so much
+ * data in flight, however fast each end is, so "--streams" spreads the
+ * data over several connections to the same address.
+ *
+ * On the sending side, the main loop writes to a pipe as usual - so the
+ * rate limit, progress, and ETA cover all of the streams together - and a
+ * thread reads from the pipe in chunks of up to PV_STRIPE_CHUNK bytes,
+ * numbers each chunk, and sends it on whichever connection is free to
+ * take it.  On the receiving side, a thread reads the chunks from every
+ * connection and writes them to a pipe in order, for the main loop to
+ * read as its input.
+ *
+ * Every connection starts with a PV_STRIPE_HELLO_SIZE byte greeting:
+ *
+ *   8 bytes  PV_STRIPE_MAGIC
+ *   4 bytes  number of streams
+ *   4 bytes  index of this stream
+ *   4 bytes  largest chunk size
+ *
+ * and then carries chunks, each with a PV_STRIPE_HEADER_SIZE byte header:
+ *
+ *   8 bytes  sequence number, counting from 0 across all the streams
+ *   4 bytes  length of the data which follows
+ *
+ * A chunk with no data ends the stream, and its sequence number is the
+ * number of chunks sent overall.  All numbers are big-endian.
+ *
+ * Each connection carries its chunks in increasing order, so the
+ * receiver only ever needs to hold one finished chunk per connection: the
+ * next one it wants is always the one in progress on some connection.
+ */
+#define PV_STRIPE_MAGIC		"PVSTRIPE"
+#define PV_STRIPE_HELLO_SIZE	20
+#define PV_STRIPE_HEADER_SIZE	12
+#define PV_STRIPE_CHUNK		(1024 * 1024)	/* largest chunk to send */
+#define PV_STRIPE_MAX_CHUNK	(64 * 1024 * 1024)	/* largest chunk to accept */
+
+struct pvstripe_stream_s {
+	int fd;				 /* connected socket */
+	/*@only@ */ /*@null@ */ char *buffer; /* chunk header and data */
+	size_t length;			 /* bytes of the chunk in the buffer */
+	size_t done;			 /* bytes of it sent or received so far */
+	uint64_t sequence;		 /* receiving: sequence number of the chunk */
+	bool busy;			 /* sending: chunk in progress; receiving: chunk complete */
+	bool ended;			 /* receiving: end of stream seen */
+};
+
+struct pvstripe_s {
+	pthread_t thread;		 /* the sender or receiver thread */
+	pthread_mutex_t mutex;		 /* protects "held" and "finished" */
+	/*@only@ */ /*@null@ */ char *address; /* network address, for messages */
+	/*@only@ */ /*@null@ */ struct pvstripe_stream_s *streams; /* the connections */
+	/*@only@ */ /*@null@ */ struct pollfd *pollfds; /* one per stream, plus the pipe */
+	unsigned int count;		 /* number of streams */
+	size_t chunk_size;		 /* largest chunk */
+	size_t held;			 /* sending: bytes read from the pipe but not yet sent */
+	int pipe_fd[2];			 /* pipe to or from the main loop */
+	int error_number;		 /* errno of a failure, if any */
+	/*@null@ */ const char *error_message; /* protocol failure, if any */
+	bool sending;			 /* set on the sending side */
+	bool thread_started;		 /* set once pthread_create() succeeded */
+	bool finished;			 /* set by the thread when it ends */
+	bool stop_requested;		 /* set when stopping before the end */
+};
+
+
+/*
+ * Store "value" big-endian in the "bytes" bytes at "buffer".
+ */
+static void pv__stripe_put(char *buffer, uint64_t value, unsigned int bytes)
+{
+	while (bytes > 0) {
+		bytes--;
+		buffer[bytes] = (char) (value & 0xff);
+		value >>= 8;
+	}
+}
+
+
+/*
+ * Return the big-endian number in the "bytes" bytes at "buffer".
+ */
+static uint64_t pv__stripe_get(const char *buffer, unsigned int bytes)
+{
+	uint64_t value = 0;
+	unsigned int byte_idx;
+
+	for (byte_idx = 0; byte_idx < bytes; byte_idx++)
+		value = (value << 8) | (uint64_t) ((unsigned char) (buffer[byte_idx]));
+
+	return value;
+}
+
+
+/*
+ * Record the first failure in the stripe, either as an errno value, or as
+ * a message if "error_number" is zero.
+ */
+static void pv__stripe_fail(struct pvstripe_s *stripe, int error_number, /*@null@ */ const char *message)
+{
+	if ((0 != stripe->error_number) || (NULL != stripe->error_message))
+		return;
+	stripe->error_number = error_number;
+	stripe->error_message = message;
+	debug("%s: %s", "stripe failed", 0 != error_number ? strerror(error_number) : message);
+}
+
+
+/*
+ * Wait for activity on "nfds" descriptors, allowing the thread to be
+ * cancelled while it waits, as in pv__directio_reader().
+ */
+static int pv__stripe_poll(struct pollfd *pollfds, unsigned int nfds)
+{
+	int old_cancel_state, rc;
+
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancel_state);
+	rc = poll(pollfds, (nfds_t) nfds, -1);
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancel_state);
+
+	return rc;
+}
+
+
+/*
+ * Mark the thread of "stripe" as finished, and as having stopped early,
+ * without it being an error, if "stopped" is true.
+ */
+static void pv__stripe_finished(struct pvstripe_s *stripe, bool stopped)
+{
+	(void) pthread_mutex_lock(&(stripe->mutex));
+	stripe->finished = true;
+	if (stopped)
+		stripe->stop_requested = true;
+	(void) pthread_mutex_unlock(&(stripe->mutex));
+}
+
+
+/*
+ * Main function of the sending thread: read chunks from the pipe and send
+ * them on whichever streams are free, until the pipe is closed and
+ * everything has been sent, or something fails.
+ */
+/*@null@ */
+static void *pv__stripe_sender(void *arg)
+{
+	struct pvstripe_s *stripe;
+	uint64_t next_sequence;
+	bool input_ended, ends_queued, receiver_gone;
+
+	stripe = (struct pvstripe_s *) arg;
+	next_sequence = 0;
+	input_ended = false;
+	ends_queued = false;
+	receiver_gone = false;
+
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	while (true) {
+		struct pvstripe_stream_s *idle;
+		unsigned int stream_idx, nfds;
+		bool all_idle;
+		int rc;
+
+		idle = NULL;
+		all_idle = true;
+		for (stream_idx = 0; stream_idx < stripe->count; stream_idx++) {
+			if (stripe->streams[stream_idx].busy) {
+				all_idle = false;
+			} else if (NULL == idle) {
+				idle = &(stripe->streams[stream_idx]);
+			}
+		}
+
+		if (input_ended && all_idle) {
+			if (ends_queued)
+				break;
+			for (stream_idx = 0; stream_idx < stripe->count; stream_idx++) {
+				struct pvstripe_stream_s *stream = &(stripe->streams[stream_idx]);
+				pv__stripe_put(stream->buffer, next_sequence, 8);
+				pv__stripe_put(stream->buffer + 8, 0, 4);
+				stream->length = PV_STRIPE_HEADER_SIZE;
+				stream->done = 0;
+				stream->busy = true;
+			}
+			ends_queued = true;
+			continue;
+		}
+
+		nfds = 0;
+		for (stream_idx = 0; stream_idx < stripe->count; stream_idx++) {
+			if (!stripe->streams[stream_idx].busy)
+				continue;
+			stripe->pollfds[nfds].fd = stripe->streams[stream_idx].fd;
+			stripe->pollfds[nfds].events = POLLOUT;
+			stripe->pollfds[nfds].revents = 0;
+			nfds++;
+		}
+		if ((!input_ended) && (NULL != idle)) {
+			stripe->pollfds[nfds].fd = stripe->pipe_fd[0];
+			stripe->pollfds[nfds].events = POLLIN;
+			stripe->pollfds[nfds].revents = 0;
+			nfds++;
+		}
+
+		rc = pv__stripe_poll(stripe->pollfds, nfds);
+		if ((rc < 0) && (EINTR == errno))
+			continue;
+		if (rc < 0) {
+			pv__stripe_fail(stripe, errno, NULL);
+			break;
+		}
+
+		/* Fill a free stream's buffer with the next chunk. */
+		if ((!input_ended) && (NULL != idle) && (0 != stripe->pollfds[nfds - 1].revents)) {
+			size_t got = 0;
+
+			while (got < stripe->chunk_size) {
+				ssize_t nread;
+				nread =
+				    read(stripe->pipe_fd[0], idle->buffer + PV_STRIPE_HEADER_SIZE + got,
+					 stripe->chunk_size - got);
+				if (nread > 0) {
+					got += (size_t) nread;
+					continue;
+				}
+				if (0 == nread) {
+					input_ended = true;
+					break;
+				}
+				if (EINTR == errno)
+					continue;
+				if ((EAGAIN != errno) && (EWOULDBLOCK != errno)) {
+					pv__stripe_fail(stripe, errno, NULL);
+					input_ended = true;
+				}
+				break;
+			}
+
+			if ((NULL != stripe->error_message) || (0 != stripe->error_number))
+				break;
+
+			if (got > 0) {
+				pv__stripe_put(idle->buffer, next_sequence, 8);
+				pv__stripe_put(idle->buffer + 8, (uint64_t) got, 4);
+				next_sequence++;
+				idle->length = PV_STRIPE_HEADER_SIZE + got;
+				idle->done = 0;
+				idle->busy = true;
+				(void) pthread_mutex_lock(&(stripe->mutex));
+				stripe->held += got;
+				(void) pthread_mutex_unlock(&(stripe->mutex));
+			}
+		}
+
+		/* Send what we can on each stream that has something to send. */
+		for (stream_idx = 0; stream_idx < nfds; stream_idx++) {
+			struct pvstripe_stream_s *stream;
+			unsigned int match_idx;
+			size_t data_before, data_after;
+			ssize_t nwritten;
+			int flags = 0;
+
+			if ((stripe->pollfds[stream_idx].fd == stripe->pipe_fd[0])
+			    || (0 == stripe->pollfds[stream_idx].revents))
+				continue;
+
+			stream = NULL;
+			for (match_idx = 0; match_idx < stripe->count; match_idx++) {
+				if (stripe->streams[match_idx].fd == stripe->pollfds[stream_idx].fd)
+					stream = &(stripe->streams[match_idx]);
+			}
+			if ((NULL == stream) || (!stream->busy) || (stream->done >= stream->length))
+				continue;
+
+#ifdef MSG_NOSIGNAL
+			flags = MSG_NOSIGNAL;
+#endif
+			nwritten = send(stream->fd, stream->buffer + stream->done, stream->length - stream->done, flags);
+			if (nwritten < 0) {
+				if ((EINTR == errno) || (EAGAIN == errno) || (EWOULDBLOCK == errno))
+					continue;
+				/*
+				 * As with an output pipe, the receiver going
+				 * away just means we've finished.
+				 */
+				if ((EPIPE == errno) || (ECONNRESET == errno)) {
+					debug("%s: %s", "stripe receiver has gone", strerror(errno));
+					receiver_gone = true;
+				} else {
+					pv__stripe_fail(stripe, errno, NULL);
+				}
+				break;
+			}
+
+			/* Only count data bytes, not the header, as sent. */
+			data_before = stream->done > PV_STRIPE_HEADER_SIZE ? stream->done - PV_STRIPE_HEADER_SIZE : 0;
+			stream->done += (size_t) nwritten;
+			data_after = stream->done > PV_STRIPE_HEADER_SIZE ? stream->done - PV_STRIPE_HEADER_SIZE : 0;
+			if (data_after > data_before) {
+				(void) pthread_mutex_lock(&(stripe->mutex));
+				stripe->held -= data_after - data_before;
+				(void) pthread_mutex_unlock(&(stripe->mutex));
+			}
+
+			if (stream->done >= stream->length)
+				stream->busy = false;
+		}
+
+		if ((NULL != stripe->error_message) || (0 != stripe->error_number) || receiver_gone)
+			break;
+	}
+
+	/*
+	 * Closing our end of the pipe, on failure, makes the main loop's
+	 * next write fail too, so that it stops.
+	 */
+	(void) close(stripe->pipe_fd[0]);
+	stripe->pipe_fd[0] = -1;
+
+	pv__stripe_finished(stripe, receiver_gone);
+
+	return NULL;
+}
+
+
+/*
+ * Write the "count" bytes at "buffer" to the pipe, returning false if it
+ * could not all be written.
+ */
+static bool pv__stripe_write_all(int fd, const char *buffer, size_t count)
+{
+	while (count > 0) {
+		ssize_t nwritten = write(fd, buffer, count);
+		if ((nwritten < 0) && (EINTR == errno))
+			continue;
+		if (nwritten <= 0)
+			return false;
+		buffer += nwritten;
+		count -= (size_t) nwritten;
+	}
+	return true;
+}
+
+
+/*
+ * Read more of the chunk arriving on "stream", marking it complete, or the
+ * stream ended, once the whole of it is there.
+ */
+static void pv__stripe_receive_more(struct pvstripe_s *stripe, struct pvstripe_stream_s *stream)
+{
+	size_t wanted;
+	ssize_t nread;
+
+	wanted = stream->done < PV_STRIPE_HEADER_SIZE ? PV_STRIPE_HEADER_SIZE : stream->length;
+
+	nread = read(stream->fd, stream->buffer + stream->done, wanted - stream->done);
+	if (nread < 0) {
+		if ((EINTR == errno) || (EAGAIN == errno) || (EWOULDBLOCK == errno))
+			return;
+		pv__stripe_fail(stripe, errno, NULL);
+		return;
+	}
+	if (0 == nread) {
+		/*@-mustfreefresh@ *//* splint: see below about gettext _() calls. */
+		pv__stripe_fail(stripe, 0, _("connection closed before the end of the data"));
+		/*@+mustfreefresh@ */
+		return;
+	}
+
+	stream->done += (size_t) nread;
+
+	if (PV_STRIPE_HEADER_SIZE == stream->done) {
+		uint64_t chunk_length = pv__stripe_get(stream->buffer + 8, 4);
+		stream->sequence = pv__stripe_get(stream->buffer, 8);
+		if (0 == chunk_length) {
+			stream->ended = true;
+			return;
+		}
+		if (chunk_length > stripe->chunk_size) {
+			/*@-mustfreefresh@ */
+			pv__stripe_fail(stripe, 0, _("chunk too large"));
+			/*@+mustfreefresh@ */
+			return;
+		}
+		stream->length = PV_STRIPE_HEADER_SIZE + (size_t) chunk_length;
+		return;
+	}
+
+	if ((stream->done > PV_STRIPE_HEADER_SIZE) && (stream->done >= stream->length))
+		stream->busy = true;
+}
+
+
+/*
+ * Main function of the receiving thread: read chunks from the streams and
+ * write them to the pipe in order, until every stream has ended, the main
+ * loop stops reading, or something fails.
+ */
+/*@null@ */
+static void *pv__stripe_receiver(void *arg)
+{
+	struct pvstripe_s *stripe;
+	uint64_t next_sequence;
+
+	stripe = (struct pvstripe_s *) arg;
+	next_sequence = 0;
+
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	while (true) {
+		unsigned int stream_idx, nfds;
+		bool found, all_ended;
+		int rc;
+
+		/* Pass on the next chunk if it has arrived. */
+		found = false;
+		for (stream_idx = 0; stream_idx < stripe->count; stream_idx++) {
+			struct pvstripe_stream_s *stream = &(stripe->streams[stream_idx]);
+			int old_cancel_state;
+			bool written;
+
+			if ((!stream->busy) || (stream->sequence != next_sequence))
+				continue;
+
+			/* The pipe may be full, so allow cancellation here too. */
+			(void) pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancel_state);
+			written =
+			    pv__stripe_write_all(stripe->pipe_fd[1], stream->buffer + PV_STRIPE_HEADER_SIZE,
+						 stream->length - PV_STRIPE_HEADER_SIZE);
+			(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancel_state);
+
+			if (!written) {
+				/* The main loop has stopped reading - not an error. */
+				debug("%s: %s", "stripe receiver stopping", strerror(errno));
+				goto end_receive;
+			}
+			stream->busy = false;
+			stream->done = 0;
+			stream->length = 0;
+			next_sequence++;
+			found = true;
+		}
+		if (found)
+			continue;
+
+		all_ended = true;
+		for (stream_idx = 0; stream_idx < stripe->count; stream_idx++) {
+			if (!stripe->streams[stream_idx].ended)
+				all_ended = false;
+		}
+
+		if (all_ended) {
+			for (stream_idx = 0; stream_idx < stripe->count; stream_idx++) {
+				if (stripe->streams[stream_idx].sequence != next_sequence) {
+					/*@-mustfreefresh@ */
+					pv__stripe_fail(stripe, 0, _("data missing from the streams"));
+					/*@+mustfreefresh@ */
+					break;
+				}
+			}
+			break;
+		}
+
+		nfds = 0;
+		for (stream_idx = 0; stream_idx < stripe->count; stream_idx++) {
+			struct pvstripe_stream_s *stream = &(stripe->streams[stream_idx]);
+			if (stream->busy || stream->ended)
+				continue;
+			stripe->pollfds[nfds].fd = stream->fd;
+			stripe->pollfds[nfds].events = POLLIN;
+			stripe->pollfds[nfds].revents = 0;
+			nfds++;
+		}
+
+		/* Every stream is waiting, but none has the chunk we need. */
+		if (0 == nfds) {
+			/*@-mustfreefresh@ */
+			pv__stripe_fail(stripe, 0, _("chunks arrived out of order"));
+			/*@+mustfreefresh@ */
+			break;
+		}
+
+		rc = pv__stripe_poll(stripe->pollfds, nfds);
+		if ((rc < 0) && (EINTR == errno))
+			continue;
+		if (rc < 0) {
+			pv__stripe_fail(stripe, errno, NULL);
+			break;
+		}
+
+		for (stream_idx = 0; stream_idx < stripe->count; stream_idx++) {
+			struct pvstripe_stream_s *stream = &(stripe->streams[stream_idx]);
+			unsigned int poll_idx;
+			bool ready = false;
+
+			if (stream->busy || stream->ended)
+				continue;
+			for (poll_idx = 0; poll_idx < nfds; poll_idx++) {
+				if ((stripe->pollfds[poll_idx].fd == stream->fd) && (0 != stripe->pollfds[poll_idx].revents))
+					ready = true;
+			}
+			if (ready)
+				pv__stripe_receive_more(stripe, stream);
+		}
+
+		if ((NULL != stripe->error_message) || (0 != stripe->error_number))
+			break;
+	}
+
+      end_receive:
+	/* The main loop sees the end of its input when we close the pipe. */
+	(void) close(stripe->pipe_fd[1]);
+	stripe->pipe_fd[1] = -1;
+
+	pv__stripe_finished(stripe, false);
+
+	return NULL;
+}
+
+
+/*
+ * Free a stripe and close everything it has open - its thread must not
+ * be running.
+ */
+static void pv__stripe_free( /*@only@ */ struct pvstripe_s *stripe)
+{
+	unsigned int stream_idx;
+
+	if (NULL != stripe->streams) {
+		for (stream_idx = 0; stream_idx < stripe->count; stream_idx++) {
+			if (stripe->streams[stream_idx].fd >= 0)
+				(void) close(stripe->streams[stream_idx].fd);
+			if (NULL != stripe->streams[stream_idx].buffer)
+				free(stripe->streams[stream_idx].buffer);
+		}
+		free(stripe->streams);
+	}
+	if (NULL != stripe->pollfds)
+		free(stripe->pollfds);
+	if (NULL != stripe->address)
+		free(stripe->address);
+	(void) pthread_mutex_destroy(&(stripe->mutex));
+	free(stripe);
+}
+
+
+/*
+ * Read exactly "count" bytes from "fd", returning false on error or end of
+ * file.
+ */
+static bool pv__stripe_read_all(int fd, char *buffer, size_t count)
+{
+	while (count > 0) {
+		ssize_t nread = read(fd, buffer, count);
+		if ((nread < 0) && (EINTR == errno))
+			continue;
+		if (nread <= 0) {
+			if (0 == nread)
+				errno = ECONNRESET;
+			return false;
+		}
+		buffer += nread;
+		count -= (size_t) nread;
+	}
+	return true;
+}
+
+
+/*
+ * Open "count" streams to or from "address", exchange greetings, make the
+ * pipe, and start the thread.  Returns the new stripe, or NULL on error,
+ * after reporting it.
+ */
+/*@null@ */
+static struct pvstripe_s *pv__stripe_start(pvstate_t state, const char *address, unsigned int count,
+					   size_t buffer_size, bool sending)
+{
+	struct pvstripe_s *stripe;
+	sigset_t all_signals, old_signals;
+	unsigned int stream_idx;
+	int *fds;
+	int rc;
+
+	stripe = calloc(1, sizeof(*stripe));
+	fds = calloc((size_t) count, sizeof(*fds));
+	if ((NULL == stripe) || (NULL == fds)) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		if (NULL != stripe)
+			free(stripe);
+		if (NULL != fds)
+			free(fds);
+		return NULL;
+	}
+
+	(void) pthread_mutex_init(&(stripe->mutex), NULL);
+	stripe->count = count;
+	stripe->sending = sending;
+	stripe->chunk_size = PV_STRIPE_CHUNK;
+	stripe->pipe_fd[0] = -1;
+	stripe->pipe_fd[1] = -1;
+	stripe->address = pv_strdup(address);
+	stripe->streams = calloc((size_t) count, sizeof(*(stripe->streams)));
+	stripe->pollfds = calloc((size_t) count + 1, sizeof(*(stripe->pollfds)));
+
+	if ((NULL == stripe->streams) || (NULL == stripe->pollfds) || (NULL == stripe->address)) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		stripe->count = 0;
+		pv__stripe_free(stripe);
+		free(fds);
+		return NULL;
+	}
+	for (stream_idx = 0; stream_idx < count; stream_idx++)
+		stripe->streams[stream_idx].fd = -1;
+
+	if (0 != pv_net_open_streams(address, sending, buffer_size, fds, count)) {
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		pv__stripe_free(stripe);
+		free(fds);
+		return NULL;
+	}
+	for (stream_idx = 0; stream_idx < count; stream_idx++)
+		stripe->streams[stream_idx].fd = fds[stream_idx];
+	free(fds);
+
+	/*
+	 * Greet the other end on every stream, or check its greetings,
+	 * before anything else, so that a mismatch is reported straight
+	 * away.
+	 */
+	for (stream_idx = 0; stream_idx < count; stream_idx++) {
+		struct pvstripe_stream_s *stream = &(stripe->streams[stream_idx]);
+		char hello[PV_STRIPE_HELLO_SIZE];	/* flawfinder: ignore - fixed size, always filled */
+		const char *problem = NULL;
+
+		if (sending) {
+			memcpy(hello, PV_STRIPE_MAGIC, 8);	/* flawfinder: ignore - fits */
+			pv__stripe_put(hello + 8, (uint64_t) count, 4);
+			pv__stripe_put(hello + 12, (uint64_t) stream_idx, 4);
+			pv__stripe_put(hello + 16, (uint64_t) (stripe->chunk_size), 4);
+			if (!pv__stripe_write_all(stream->fd, hello, sizeof(hello))) {
+				pv_error("%s: %s", address, strerror(errno));
+				state->status.exit_status |= PV_ERROREXIT_ACCESS;
+				pv__stripe_free(stripe);
+				return NULL;
+			}
+		} else {
+			uint64_t chunk_size;
+
+			if (!pv__stripe_read_all(stream->fd, hello, sizeof(hello))) {
+				pv_error("%s: %s", address, strerror(errno));
+				state->status.exit_status |= PV_ERROREXIT_ACCESS;
+				pv__stripe_free(stripe);
+				return NULL;
+			}
+			chunk_size = pv__stripe_get(hello + 16, 4);
+			/*@-mustfreefresh@ */
+			if (0 != memcmp(hello, PV_STRIPE_MAGIC, 8)) {
+				problem = _("the other end is not sending parallel streams");
+			} else if (pv__stripe_get(hello + 8, 4) != (uint64_t) count) {
+				problem = _("the other end is using a different number of streams");
+			} else if ((0 == chunk_size) || (chunk_size > PV_STRIPE_MAX_CHUNK)) {
+				problem = _("chunk too large");
+			}
+			/*@+mustfreefresh@ */
+			if (NULL != problem) {
+				pv_error("%s: %s", address, problem);
+				state->status.exit_status |= PV_ERROREXIT_ACCESS;
+				pv__stripe_free(stripe);
+				return NULL;
+			}
+			if ((0 == stream_idx) || ((size_t) chunk_size > stripe->chunk_size))
+				stripe->chunk_size = (size_t) chunk_size;
+		}
+	}
+
+	for (stream_idx = 0; stream_idx < count; stream_idx++) {
+		stripe->streams[stream_idx].buffer = malloc(PV_STRIPE_HEADER_SIZE + stripe->chunk_size);
+		if (NULL == stripe->streams[stream_idx].buffer) {
+			pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_MEMORY;
+			pv__stripe_free(stripe);
+			return NULL;
+		}
+		if (sending) {
+			(void) fcntl(stripe->streams[stream_idx].fd, F_SETFL,
+				     O_NONBLOCK | fcntl(stripe->streams[stream_idx].fd, F_GETFL));
+		} else {
+			(void) shutdown(stripe->streams[stream_idx].fd, SHUT_WR);
+		}
+	}
+
+	if (0 != pipe(stripe->pipe_fd)) {
+		pv_error("%s: %s", "pipe", strerror(errno));
+		stripe->pipe_fd[0] = -1;
+		stripe->pipe_fd[1] = -1;
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		pv__stripe_free(stripe);
+		return NULL;
+	}
+	(void) fcntl(stripe->pipe_fd[0], F_SETFD, FD_CLOEXEC);
+	(void) fcntl(stripe->pipe_fd[1], F_SETFD, FD_CLOEXEC);
+	if (sending)
+		(void) fcntl(stripe->pipe_fd[0], F_SETFL, O_NONBLOCK | fcntl(stripe->pipe_fd[0], F_GETFL));
+
+	/* As with the pipeline, leave all signals to the main thread. */
+	(void) sigfillset(&all_signals);
+	(void) sigemptyset(&old_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&(stripe->thread), NULL, sending ? pv__stripe_sender : pv__stripe_receiver, stripe);
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 != rc) {
+		pv_error("%s: %s", "pthread_create", strerror(rc));
+		(void) close(stripe->pipe_fd[0]);
+		(void) close(stripe->pipe_fd[1]);
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		pv__stripe_free(stripe);
+		return NULL;
+	}
+
+	stripe->thread_started = true;
+
+	debug("%s: %s: %s=%u, %s=%ld", sending ? "striped output started" : "striped input started", address,
+	      "streams", count, "chunk size", (long) (stripe->chunk_size));
+
+	return stripe;
+}
+
+
+/*
+ * Connect to "address" with "count" parallel streams, and return the
+ * descriptor the main loop should write the data to, or -1 on error.
+ */
+int pv_stripe_output_open(pvstate_t state, const char *address, unsigned int count, size_t buffer_size)
+{
+	struct pvstripe_s *stripe;
+
+	if (NULL != state->status.stripe_output) {
+		pv_error("%s: %s", address, _("only one output can use parallel streams"));
+		return -1;
+	}
+
+	stripe = pv__stripe_start(state, address, count, buffer_size, true);
+	if (NULL == stripe)
+		return -1;
+
+	state->status.stripe_output = stripe;
+
+	return stripe->pipe_fd[1];
+}
+
+
+/*
+ * Accept, or make, "count" parallel streams on "address", and return the
+ * descriptor the main loop should read the reassembled data from, or -1
+ * on error.
+ */
+int pv_stripe_input_open(pvstate_t state, const char *address, unsigned int count, size_t buffer_size)
+{
+	struct pvstripe_s *stripe;
+
+	if (NULL != state->status.stripe_input) {
+		pv_error("%s: %s", address, _("only one input can use parallel streams"));
+		return -1;
+	}
+
+	stripe = pv__stripe_start(state, address, count, buffer_size, false);
+	if (NULL == stripe)
+		return -1;
+
+	state->status.stripe_input = stripe;
+
+	return stripe->pipe_fd[0];
+}
+
+
+/*
+ * Return the number of bytes written to the striped output which the
+ * receiving end has not yet acknowledged, whether they are still waiting
+ * to be sent or sitting in the socket buffers.  This does not include
+ * what is in the pipe, which the main loop counts itself.
+ */
+size_t pv_stripe_queued(pvstate_t state)
+{
+	struct pvstripe_s *stripe;
+	unsigned int stream_idx;
+	size_t queued;
+
+	stripe = state->status.stripe_output;
+	if ((NULL == stripe) || (!stripe->thread_started))
+		return 0;
+
+	(void) pthread_mutex_lock(&(stripe->mutex));
+	queued = stripe->held;
+	(void) pthread_mutex_unlock(&(stripe->mutex));
+
+	for (stream_idx = 0; stream_idx < stripe->count; stream_idx++) {
+		size_t in_socket = 0;
+		if (pv_net_queued(stripe->streams[stream_idx].fd, &in_socket))
+			queued += in_socket;
+	}
+
+	return queued;
+}
+
+
+/*
+ * Stop the thread of "stripe" if it is still running, without waiting for
+ * it to get to the end of the data or sending the end of each stream.
+ * Shutting down the sockets wakes it up if it is waiting for them; if
+ * "cancel" is true, it is also cancelled, in case it is a receiver stuck
+ * writing to a full pipe which the main loop is no longer reading.
+ */
+static void pv__stripe_stop(struct pvstripe_s *stripe, bool cancel)
+{
+	unsigned int stream_idx;
+	bool finished;
+
+	(void) pthread_mutex_lock(&(stripe->mutex));
+	finished = stripe->finished;
+	if (!finished)
+		stripe->stop_requested = true;
+	(void) pthread_mutex_unlock(&(stripe->mutex));
+
+	if (finished)
+		return;
+
+	for (stream_idx = 0; stream_idx < stripe->count; stream_idx++)
+		(void) shutdown(stripe->streams[stream_idx].fd, SHUT_RDWR);
+	if (cancel)
+		(void) pthread_cancel(stripe->thread);
+}
+
+
+/*
+ * Wait for the thread of "stripe" to end, and report any failure, unless
+ * it was stopped early on purpose.
+ */
+static void pv__stripe_join(pvstate_t state, struct pvstripe_s *stripe)
+{
+	if (!stripe->thread_started)
+		return;
+
+	(void) pthread_join(stripe->thread, NULL);
+	stripe->thread_started = false;
+
+	/* If the thread was cancelled, close the pipe end it was using. */
+	if (stripe->sending && (stripe->pipe_fd[0] >= 0)) {
+		(void) close(stripe->pipe_fd[0]);
+		stripe->pipe_fd[0] = -1;
+	} else if ((!stripe->sending) && (stripe->pipe_fd[1] >= 0)) {
+		(void) close(stripe->pipe_fd[1]);
+		stripe->pipe_fd[1] = -1;
+	}
+
+	if (stripe->stop_requested)
+		return;
+
+	if (0 != stripe->error_number) {
+		pv_error("%s: %s", NULL == stripe->address ? "-" : stripe->address, strerror(stripe->error_number));
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+	} else if (NULL != stripe->error_message) {
+		pv_error("%s: %s", NULL == stripe->address ? "-" : stripe->address, stripe->error_message);
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+	}
+}
+
+
+/*
+ * Finish any striped transfers, once the main loop has stopped reading
+ * and writing.  The output pipe is closed, so that the sender sends the
+ * last of the data and ends each stream, and is waited for - unless we
+ * were interrupted, in which case the streams are cut off, so that the
+ * receiving end can tell the data is incomplete.  The receiver is stopped
+ * if it hasn't already reached the end, since the main loop has stopped
+ * reading from it.  Any failures are reported.
+ */
+void pv_stripe_finish(pvstate_t state)
+{
+	struct pvstripe_s *stripe;
+
+	stripe = state->status.stripe_output;
+	if ((NULL != stripe) && stripe->thread_started) {
+		if ((stripe->pipe_fd[1] >= 0) && (state->control.output_fd == stripe->pipe_fd[1])) {
+			pv_poller_forget(&(state->transfer), state->control.output_fd);
+			state->control.output_fd = -1;
+		}
+		if (stripe->pipe_fd[1] >= 0)
+			(void) close(stripe->pipe_fd[1]);
+		stripe->pipe_fd[1] = -1;
+		if (0 != state->flags.trigger_exit)
+			pv__stripe_stop(stripe, false);
+		debug("%s", "waiting for the striped output to be sent");
+		pv__stripe_join(state, stripe);
+	}
+
+	stripe = state->status.stripe_input;
+	if ((NULL != stripe) && stripe->thread_started) {
+		pv__stripe_stop(stripe, false);
+		pv__stripe_join(state, stripe);
+	}
+}
+
+
+/*
+ * Stop any striped transfers which are still going, without waiting for
+ * them to complete, and free them.  The pipe ends given to the main loop
+ * are left for it to close.
+ */
+void pv_stripe_free(pvstate_t state)
+{
+	struct pvstripe_s *stripes[2];
+	unsigned int stripe_idx;
+
+	stripes[0] = state->status.stripe_output;
+	stripes[1] = state->status.stripe_input;
+	state->status.stripe_output = NULL;
+	state->status.stripe_input = NULL;
+
+	for (stripe_idx = 0; stripe_idx < 2; stripe_idx++) {
+		struct pvstripe_s *stripe = stripes[stripe_idx];
+
+		if (NULL == stripe)
+			continue;
+
+		if (stripe->thread_started) {
+			pv__stripe_stop(stripe, !stripe->sending);
+			pv__stripe_join(state, stripe);
+		}
+
+		pv__stripe_free(stripe);
+	}
+}
+
+#else				/* !HAVE_PTHREAD */
+
+int pv_stripe_output_open(pvstate_t state, const char *address, /*@unused@ */
+			  __attribute__((unused)) unsigned int count, /*@unused@ */
+			  __attribute__((unused)) size_t buffer_size)
+{
+	pv_error("%s: %s", address, _("parallel streams are not supported in this build"));
+	state->status.exit_status |= PV_ERROREXIT_ACCESS;
+	return -1;
+}
+
+int pv_stripe_input_open(pvstate_t state, const char *address, /*@unused@ */
+			 __attribute__((unused)) unsigned int count, /*@unused@ */
+			 __attribute__((unused)) size_t buffer_size)
+{
+	pv_error("%s: %s", address, _("parallel streams are not supported in this build"));
+	state->status.exit_status |= PV_ERROREXIT_ACCESS;
+	return -1;
+}
+
+size_t pv_stripe_queued( /*@unused@ */  __attribute__((unused)) pvstate_t state)
+{
+	return 0;
+}
+
+void pv_stripe_finish( /*@unused@ */  __attribute__((unused)) pvstate_t state)
+{
+}
+
+void pv_stripe_free( /*@unused@ */  __attribute__((unused)) pvstate_t state)
+{
+}
+
+#endif				/* HAVE_PTHREAD */
@@ -0,0 +1,295 @@
+/*
+ * Functions for "--latency-target" and "--pressure-target", which adjust
+ * the rate limit to keep the output's write latency, or the system's I/O
+ * pressure, below a target.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+/*
+ * Every PV_THROTTLE_PERIOD_NSEC, the transfer is judged to be congested if
+ * either:
+ *
+ *  - the 90th percentile of the write (or splice) latency over the period
+ *    just gone is above "--latency-target"; or
+ *
+ *  - the share of the period in which some tasks on the system were
+ *    stalled waiting for I/O, from the "some" line of /proc/pressure/io
+ *    (Linux pressure stall information), is above "--pressure-target".
+ *
+ * The rate limit is then adjusted in the manner of TCP congestion control
+ * - additive increase, multiplicative decrease:
+ *
+ *  - When congested, the rate is cut to PV_THROTTLE_DECREASE of what was
+ *    actually being transferred, and the next period is left alone, so
+ *    that the cut has time to show before it is judged again.
+ *
+ *  - Otherwise, the rate goes up by a fixed step each period, of 1 in
+ *    PV_THROTTLE_STEPS of the rate before the last cut, so it climbs back
+ *    to where it was over a few seconds and then keeps probing upwards.
+ *
+ * The rate never goes above "-L", if one was given, or below
+ * PV_THROTTLE_MIN_RATE.  Without "-L", the transfer runs unlimited until it
+ * first causes congestion, and the limit is lifted again once it climbs
+ * well above what the transfer can manage anyway.  A new "-L" from
+ * "--remote" becomes the new ceiling.
+ *
+ * Where /proc/pressure/io can't be read, only the latency is used.
+ */
+#define PV_THROTTLE_PERIOD_NSEC	250000000LL	 /* how often the rate is adjusted */
+#define PV_THROTTLE_PERCENTILE	0.9L		 /* write latency percentile compared to target */
+#define PV_THROTTLE_DECREASE	0.5L		 /* rate kept when congested */
+#define PV_THROTTLE_STEPS	32		 /* steps to climb back after a cut */
+#define PV_THROTTLE_MIN_RATE	65536		 /* never throttle below this, per second */
+#define PV_THROTTLE_HEADROOM	2.0L		 /* lift the limit at this much above actual rate */
+#define PV_THROTTLE_PSI_FILE	"/proc/pressure/io"
+
+struct pvthrottle_s {
+	struct timespec next_check;	 /* when to adjust the rate next */
+	struct timespec last_check;	 /* when it was last adjusted */
+	off_t last_written;		 /* total_written at that time */
+	off_t ceiling;			 /* the "-L" rate limit, or 0 for none */
+	off_t applied;			 /* the rate limit we last set */
+	long double rate;		 /* current rate, or 0 while unthrottled */
+	long double step;		 /* additive increase per period */
+	long double lowest;		 /* lowest rate set */
+	long long pressure_usec;	 /* last stall total from PSI, or -1 */
+	unsigned long slowdowns;	 /* number of times the rate was cut */
+	bool holding;			 /* skip the next period after a cut */
+};
+
+
+/*
+ * Return the total microseconds for which some tasks have been stalled on
+ * I/O, from PSI, or -1 if that isn't available.
+ */
+static long long pv__throttle_pressure(void)
+{
+	char buf[256];			 /* flawfinder: ignore - bounded by fgets() */
+	long long total;
+	FILE *fptr;
+
+	fptr = fopen(PV_THROTTLE_PSI_FILE, "r");	/* flawfinder: ignore - constant path */
+	if (NULL == fptr)
+		return -1;
+
+	total = -1;
+	memset(buf, 0, sizeof(buf));
+	while (NULL != fgets(buf, (int) sizeof(buf), fptr)) {
+		char *field;
+		if (0 != strncmp(buf, "some ", 5))
+			continue;
+		field = strstr(buf, "total=");
+		if (NULL != field)
+			total = strtoll(field + 6, NULL, 10);
+		break;
+	}
+	(void) fclose(fptr);
+
+	return total;
+}
+
+
+/*
+ * Return true if the output was held up by more than "--latency-target" in
+ * the period just gone.
+ */
+static bool pv__throttle_latency_high(pvstate_t state)
+{
+	long double write_latency, splice_latency;
+	uint64_t write_count, splice_count;
+
+	write_latency =
+	    pv_latency_recent(&(state->transfer), PV_LATENCY_WRITE, PV_THROTTLE_PERCENTILE, &write_count);
+	splice_latency =
+	    pv_latency_recent(&(state->transfer), PV_LATENCY_SPLICE, PV_THROTTLE_PERCENTILE, &splice_count);
+
+	if (state->control.latency_target <= 0)
+		return false;
+
+	if (splice_latency > write_latency)
+		write_latency = splice_latency;
+	if ((0 == write_count) && (0 == splice_count))
+		return false;
+
+	return (write_latency > (long double) (state->control.latency_target)) ? true : false;
+}
+
+
+/*
+ * Return true if the system spent more than "--pressure-target" percent of
+ * the last "seconds" with tasks stalled on I/O.
+ */
+static bool pv__throttle_pressure_high(pvstate_t state, struct pvthrottle_s *throttle, long double seconds)
+{
+	long long pressure_usec, stalled;
+
+	if ((0 == state->control.pressure_target) || (throttle->pressure_usec < 0))
+		return false;
+
+	pressure_usec = pv__throttle_pressure();
+	if (pressure_usec < 0) {
+		throttle->pressure_usec = -1;
+		return false;
+	}
+	stalled = pressure_usec - throttle->pressure_usec;
+	throttle->pressure_usec = pressure_usec;
+
+	if ((stalled <= 0) || (seconds <= 0.0L))
+		return false;
+
+	return ((long double) stalled / (seconds * 10000.0L) > (long double) (state->control.pressure_target))
+	    ? true : false;
+}
+
+
+/*
+ * Adjust the rate limit for "--latency-target" and "--pressure-target".
+ * Called from the main loop after each transfer, with the time.
+ */
+void pv_throttle_update(pvstate_t state, const struct timespec *now)
+{
+	struct pvthrottle_s *throttle;
+	struct timespec elapsed;
+	long double seconds, throughput, min_rate;
+	bool congested;
+
+	throttle = state->transfer.throttle;
+	if (NULL == throttle) {
+		throttle = calloc(1, sizeof(*throttle));
+		if (NULL == throttle)
+			return;
+		state->transfer.throttle = throttle;
+		throttle->ceiling = state->control.rate_limit;
+		throttle->applied = state->control.rate_limit;
+		throttle->pressure_usec = -1;
+		if (state->control.pressure_target > 0) {
+			throttle->pressure_usec = pv__throttle_pressure();
+			if (throttle->pressure_usec < 0)
+				debug("%s: %s", PV_THROTTLE_PSI_FILE, "not available");
+		}
+		throttle->last_written = state->transfer.total_written;
+		pv_elapsedtime_copy(&(throttle->last_check), now);
+		pv_elapsedtime_copy(&(throttle->next_check), now);
+		pv_elapsedtime_add_nsec(&(throttle->next_check), PV_THROTTLE_PERIOD_NSEC);
+		/* Start the latency window from here. */
+		(void) pv__throttle_latency_high(state);
+		return;
+	}
+
+	if (pv_elapsedtime_compare(now, &(throttle->next_check)) < 0)
+		return;
+
+	pv_elapsedtime_subtract(&elapsed, now, &(throttle->last_check));
+	seconds = pv_elapsedtime_seconds(&elapsed);
+	pv_elapsedtime_copy(&(throttle->last_check), now);
+	pv_elapsedtime_copy(&(throttle->next_check), now);
+	pv_elapsedtime_add_nsec(&(throttle->next_check), PV_THROTTLE_PERIOD_NSEC);
+
+	throughput = 0.0L;
+	if (seconds > 0.0L)
+		throughput = (long double) (state->transfer.total_written - throttle->last_written) / seconds;
+	throttle->last_written = state->transfer.total_written;
+
+	/* A rate limit that we didn't set came from "--remote". */
+	if (state->control.rate_limit != throttle->applied) {
+		throttle->ceiling = state->control.rate_limit;
+		debug("%s: %lld", "throttle ceiling now", (long long) (throttle->ceiling));
+	}
+
+	/* Both are always checked, to keep their windows in step. */
+	congested = pv__throttle_latency_high(state);
+	if (pv__throttle_pressure_high(state, throttle, seconds))
+		congested = true;
+
+	min_rate = state->control.linemode ? 1.0L : (long double) PV_THROTTLE_MIN_RATE;
+
+	if (throttle->holding) {
+		throttle->holding = false;
+	} else if (congested) {
+		long double base = throttle->rate;
+		if ((base <= 0.0L) || ((throughput > 0.0L) && (throughput < base)))
+			base = throughput;
+		throttle->step = base / PV_THROTTLE_STEPS;
+		if (throttle->step < min_rate / PV_THROTTLE_STEPS)
+			throttle->step = min_rate / PV_THROTTLE_STEPS;
+		throttle->rate = base * PV_THROTTLE_DECREASE;
+		if (throttle->rate < min_rate)
+			throttle->rate = min_rate;
+		if ((0 == throttle->slowdowns) || (throttle->rate < throttle->lowest))
+			throttle->lowest = throttle->rate;
+		throttle->slowdowns++;
+		throttle->holding = true;
+		debug("%s: %.0Lf", "congested - rate cut to", throttle->rate);
+	} else if (throttle->rate > 0.0L) {
+		throttle->rate += throttle->step;
+		if ((throttle->ceiling <= 0) && (throttle->rate > throughput * PV_THROTTLE_HEADROOM)
+		    && (throughput > 0.0L)) {
+			throttle->rate = 0.0L;
+			debug("%s", "throttle lifted");
+		}
+	}
+
+	if ((throttle->ceiling > 0) && ((throttle->rate <= 0.0L) || (throttle->rate > (long double) throttle->ceiling)))
+		throttle->rate = (long double) (throttle->ceiling);
+
+	state->control.rate_limit = (throttle->rate > 0.0L) ? (off_t) (throttle->rate) : 0;
+	throttle->applied = state->control.rate_limit;
+}
+
+
+/*
+ * Write how often the rate was cut, and how far, to the terminal, for
+ * "--stats".
+ */
+void pv_throttle_show(pvstate_t state)
+{
+	char stats_buf[256];		 /* flawfinder: ignore */
+	struct pvthrottle_s *throttle;
+	int stats_size;
+
+	/* flawfinder: made safe by use of pv_snprintf() */
+
+	throttle = state->transfer.throttle;
+	if (NULL == throttle)
+		return;
+
+	/*@-mustfreefresh@ */
+	memset(stats_buf, 0, sizeof(stats_buf));
+	if (0 == throttle->slowdowns) {
+		stats_size = pv_snprintf(stats_buf, sizeof(stats_buf), "%s = %s\n", _("throttle"), _("never slowed"));
+	} else {
+		stats_size =
+		    pv_snprintf(stats_buf, sizeof(stats_buf), "%s = %lu %s, %s %.0Lf %s\n", _("throttle"),
+				throttle->slowdowns, _("slowdowns"), _("lowest"), throttle->lowest,
+				state->control.linemode ? _("lines/s") : _("B/s"));
+	}
+	/*@+mustfreefresh@ *//* splint: see above about gettext(). */
+
+	if (stats_size > 0 && stats_size < (int) (sizeof(stats_buf)))
+		pv_tty_write(&(state->flags), stats_buf, (size_t) stats_size);
+}
+
+
+/*
+ * Free the throttle state, if there is any.
+ */
+void pv_throttle_free(pvtransferstate_t transfer)
+{
+	if ((NULL == transfer) || (NULL == transfer->throttle))
+		return;
+	free(transfer->throttle);
+	transfer->throttle = NULL;
+}
@@ -0,0 +1,249 @@
+/*
+ * Ticker thread, to tell the main loop when a display update or remote
+ * control check is due, so that it doesn't have to read the clock on every
+ * pass to find out.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#ifdef HAVE_PTHREAD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+
+/*
+ * The thread sleeps until whichever is sooner of the next display update
+ * that the main loop has scheduled, and the next remote control check,
+ * and then raises "due".  The main loop only looks at the clock, and so
+ * only compares it against its own deadlines, when "due" has been raised,
+ * so between ticks, a busy transfer goes round the loop without any clock
+ * reads of its own.
+ *
+ * A display update is only ticked for once; the main loop schedules the
+ * next one after each update, so if it has slipped, or been put back by
+ * "-W", the ticker follows it.
+ *
+ * The condition variable's deadline is on the real time clock, so it is
+ * recalculated from the monotonic clock on every wakeup; if waking up
+ * early or late because the real time clock was changed, the next pass
+ * just sleeps again or ticks.
+ */
+struct pvticker_s {
+	pthread_t thread;		 /* the ticker thread */
+	pthread_mutex_t mutex;		 /* protects everything below but "due" */
+	pthread_cond_t changed;		 /* signalled when rescheduled or stopping */
+	struct timespec next_update;	 /* when the next display update is due */
+	struct timespec next_remote;	 /* when the next remote check is due */
+	bool update_scheduled;		 /* set if next_update is yet to be ticked */
+	bool thread_started;		 /* set once pthread_create() succeeded */
+	bool stop_requested;		 /* set by the main loop to end the thread */
+	bool due;			 /* raised by the thread, cleared by the loop */
+};
+
+
+/*
+ * Main function of the ticker thread.
+ */
+/*@null@ */ static void *pv__ticker_thread(void *arg)
+{
+	struct pvticker_s *ticker = (struct pvticker_s *) arg;
+
+	(void) pthread_mutex_lock(&(ticker->mutex));
+
+	while (!ticker->stop_requested) {
+		struct timespec now, next, remaining, deadline;
+		bool tick;
+
+		pv_elapsedtime_read(&now);
+
+		tick = false;
+		if (pv_elapsedtime_compare(&now, &(ticker->next_remote)) >= 0) {
+			tick = true;
+			while (pv_elapsedtime_compare(&now, &(ticker->next_remote)) >= 0)
+				pv_elapsedtime_add_nsec(&(ticker->next_remote), REMOTE_INTERVAL);
+		}
+		if (ticker->update_scheduled && (pv_elapsedtime_compare(&now, &(ticker->next_update)) >= 0)) {
+			tick = true;
+			ticker->update_scheduled = false;
+		}
+		if (tick)
+			__atomic_store_n(&(ticker->due), true, __ATOMIC_RELEASE);
+
+		pv_elapsedtime_copy(&next, &(ticker->next_remote));
+		if (ticker->update_scheduled && (pv_elapsedtime_compare(&(ticker->next_update), &next) < 0))
+			pv_elapsedtime_copy(&next, &(ticker->next_update));
+
+		pv_elapsedtime_subtract(&remaining, &next, &now);
+
+		memset(&deadline, 0, sizeof(deadline));
+		(void) clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += remaining.tv_sec;
+		deadline.tv_nsec += remaining.tv_nsec;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		(void) pthread_cond_timedwait(&(ticker->changed), &(ticker->mutex), &deadline);
+	}
+
+	(void) pthread_mutex_unlock(&(ticker->mutex));
+
+	return NULL;
+}
+
+
+/*
+ * Start the ticker thread, with the first display update due at
+ * "next_update".  Returns false if it could not be started, in which case
+ * the main loop has to keep reading the clock itself.
+ */
+bool pv_ticker_start(pvtransferstate_t transfer, const struct timespec *next_update)
+{
+	struct pvticker_s *ticker;
+	sigset_t all_signals, old_signals;
+	int rc;
+
+	if (NULL != transfer->ticker)
+		pv_ticker_stop(transfer);
+
+	ticker = calloc(1, sizeof(*ticker));
+	if (NULL == ticker) {
+		debug("%s: %s", "ticker allocation failed", strerror(errno));
+		return false;
+	}
+
+	(void) pthread_mutex_init(&(ticker->mutex), NULL);
+	(void) pthread_cond_init(&(ticker->changed), NULL);
+
+	pv_elapsedtime_copy(&(ticker->next_update), next_update);
+	ticker->update_scheduled = true;
+	pv_elapsedtime_read(&(ticker->next_remote));
+	pv_elapsedtime_add_nsec(&(ticker->next_remote), REMOTE_INTERVAL);
+
+	/* As with the --pipeline reader, signals go to the main thread. */
+	(void) sigfillset(&all_signals);
+	(void) sigemptyset(&old_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&(ticker->thread), NULL, pv__ticker_thread, ticker);
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 != rc) {
+		debug("%s: %s", "failed to start ticker thread", strerror(rc));
+		(void) pthread_cond_destroy(&(ticker->changed));
+		(void) pthread_mutex_destroy(&(ticker->mutex));
+		free(ticker);
+		return false;
+	}
+
+	ticker->thread_started = true;
+	transfer->ticker = ticker;
+
+	debug("%s", "ticker thread started");
+
+	return true;
+}
+
+
+/*
+ * Tell the ticker when the next display update is due.
+ */
+void pv_ticker_schedule(pvtransferstate_t transfer, const struct timespec *next_update)
+{
+	struct pvticker_s *ticker = transfer->ticker;
+
+	if (NULL == ticker)
+		return;
+
+	(void) pthread_mutex_lock(&(ticker->mutex));
+	pv_elapsedtime_copy(&(ticker->next_update), next_update);
+	ticker->update_scheduled = true;
+	(void) pthread_cond_broadcast(&(ticker->changed));
+	(void) pthread_mutex_unlock(&(ticker->mutex));
+}
+
+
+/*
+ * Put the time of the ticker's next tick into *next, or the current time
+ * if it has already ticked and the main loop hasn't seen it yet.  Returns
+ * false, leaving *next alone, if there is no ticker.
+ *
+ * The main loop only acts on its deadlines when the ticker ticks, so this
+ * is how long it can usefully wait for I/O: waiting only until its own
+ * deadlines, which go stale between ticks, would have it polling without
+ * blocking once they had passed.
+ */
+bool pv_ticker_next(pvtransferstate_t transfer, struct timespec *next)
+{
+	struct pvticker_s *ticker = transfer->ticker;
+
+	if (NULL == ticker)
+		return false;
+
+	if (__atomic_load_n(&(ticker->due), __ATOMIC_ACQUIRE)) {
+		pv_elapsedtime_read(next);
+		return true;
+	}
+
+	(void) pthread_mutex_lock(&(ticker->mutex));
+	pv_elapsedtime_copy(next, &(ticker->next_remote));
+	if (ticker->update_scheduled && (pv_elapsedtime_compare(&(ticker->next_update), next) < 0))
+		pv_elapsedtime_copy(next, &(ticker->next_update));
+	(void) pthread_mutex_unlock(&(ticker->mutex));
+
+	return true;
+}
+
+
+/*
+ * Return true, and lower the flag, if the ticker has ticked since the last
+ * call; always returns true if there is no ticker.
+ */
+bool pv_ticker_due(pvtransferstate_t transfer)
+{
+	if (NULL == transfer->ticker)
+		return true;
+	return __atomic_exchange_n(&(transfer->ticker->due), false, __ATOMIC_ACQ_REL);
+}
+
+
+/*
+ * Stop the ticker thread, if there is one, and free it.
+ */
+void pv_ticker_stop(pvtransferstate_t transfer)
+{
+	struct pvticker_s *ticker;
+
+	if (NULL == transfer || NULL == transfer->ticker)
+		return;
+
+	ticker = transfer->ticker;
+	transfer->ticker = NULL;
+
+	if (ticker->thread_started) {
+		(void) pthread_mutex_lock(&(ticker->mutex));
+		ticker->stop_requested = true;
+		(void) pthread_cond_broadcast(&(ticker->changed));
+		(void) pthread_mutex_unlock(&(ticker->mutex));
+		(void) pthread_join(ticker->thread, NULL);
+		debug("%s", "ticker thread stopped");
+	}
+
+	(void) pthread_cond_destroy(&(ticker->changed));
+	(void) pthread_mutex_destroy(&(ticker->mutex));
+	free(ticker);
+}
+
+#endif				/* HAVE_PTHREAD */
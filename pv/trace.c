@@ -0,0 +1,568 @@
+/*
+ * Functions for "--trace", which records what the transfer loop does to a
+ * binary file, and "--trace-decode", which turns that file into JSON for
+ * trace viewers.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_PTHREAD
+#include <signal.h>
+#include <pthread.h>
+#endif
+
+/*
+ * Each event is a fixed-size record, written as it is in memory, after a
+ * header that says which version of the format it is, how big an event
+ * is, and when the trace started.  Times within the trace are nanoseconds
+ * since it started, from the monotonic clock.
+ *
+ * The transfer loop only ever copies events into a ring buffer, without
+ * taking any locks or making any system calls beyond reading the clock.
+ * With threads, a background thread writes the ring out to the file every
+ * PV_TRACE_FLUSH_NSEC, or sooner once it is half full; if the ring fills
+ * up anyway, events are dropped, and a PV_TRACE_DROPPED event saying how
+ * many were lost is recorded once there is room again.  Without threads,
+ * the ring is written out as soon as it fills up.
+ *
+ * The ring has only one producer (the main loop) and one consumer (the
+ * flushing thread), so "head" and "tail" are all the synchronisation it
+ * needs.
+ *
+ * The file is in the byte order of the machine that wrote it, and is
+ * meant to be decoded with "--trace-decode" on the same kind of machine.
+ */
+#define PV_TRACE_MAGIC		"PVTRACE"	 /* 8 bytes including the terminator */
+#define PV_TRACE_VERSION	1
+#define PV_TRACE_RING_EVENTS	65536		 /* must be a power of 2 */
+#define PV_TRACE_FLUSH_NSEC	50000000LL	 /* how often the ring is written out */
+
+struct pvtrace_header_s {
+	char magic[8];			 /* PV_TRACE_MAGIC */
+	uint32_t version;		 /* PV_TRACE_VERSION */
+	uint32_t event_size;		 /* sizeof(struct pvtrace_event_s) */
+	int64_t pid;			 /* process that wrote the trace */
+	int64_t start_nsec;		 /* real time the trace started */
+};
+
+struct pvtrace_event_s {
+	uint64_t when_nsec;		 /* start of the event, since the trace started */
+	int64_t value;			 /* result, byte count, or allowance */
+	uint32_t duration_nsec;		 /* how long it took, saturating */
+	uint16_t kind;			 /* pvtracekind_t */
+	int16_t error;			 /* errno, if it failed */
+	int32_t fd;			 /* file descriptor, or -1 */
+	uint32_t reserved;
+};
+
+struct pvtrace_s {
+	/*@only@ */ struct pvtrace_event_s *ring; /* PV_TRACE_RING_EVENTS events */
+	/*@only@ */ char *filename;	 /* file being written */
+	struct timespec origin;		 /* when the trace started */
+	uint64_t head;			 /* next event to fill; main loop only */
+	uint64_t tail;			 /* next event to write; flusher only */
+	uint64_t dropped;		 /* events lost since the last DROPPED event */
+	uint64_t total_dropped;		 /* events lost altogether */
+	int fd;				 /* trace file */
+	int write_error;		 /* errno of the first failed write, or 0 */
+	bool thread_started;		 /* set once the flushing thread is running */
+#ifdef HAVE_PTHREAD
+	pthread_t thread;		 /* the flushing thread */
+	pthread_mutex_t mutex;		 /* protects stop_requested */
+	pthread_cond_t wake;		 /* signalled to flush early, or stop */
+	bool stop_requested;		 /* set to end the flushing thread */
+#endif
+};
+
+/* The names of the kinds of event, in "--trace-decode" output. */
+static const char *const pv__trace_kind_names[PV_TRACE_KINDS] = {
+	"read", "write", "splice", "wait", "unconsumed", "rate", "display", "dropped"
+};
+
+
+/*
+ * Write all "count" bytes of "buf" to "fd", returning false on error.
+ */
+static bool pv__trace_write(int fd, const void *buf, size_t count)
+{
+	const char *ptr = (const char *) buf;
+
+	while (count > 0) {
+		ssize_t nwritten;
+		nwritten = write(fd, ptr, count);
+		if ((nwritten < 0) && (EINTR == errno))
+			continue;
+		if (nwritten <= 0)
+			return false;
+		ptr += nwritten;
+		count -= (size_t) nwritten;
+	}
+
+	return true;
+}
+
+
+/*
+ * Write out everything in the ring buffer.  Only one thread may call this
+ * at a time - the flushing thread if it is running, or the main loop if it
+ * isn't.
+ */
+static void pv__trace_flush(struct pvtrace_s *trace)
+{
+	uint64_t head, tail;
+
+	head = __atomic_load_n(&(trace->head), __ATOMIC_ACQUIRE);
+	tail = trace->tail;
+
+	while (tail < head) {
+		size_t first, count;
+
+		first = (size_t) (tail & (PV_TRACE_RING_EVENTS - 1));
+		count = (size_t) (head - tail);
+		if (first + count > PV_TRACE_RING_EVENTS)
+			count = PV_TRACE_RING_EVENTS - first;
+
+		if ((0 == trace->write_error)
+		    && (!pv__trace_write(trace->fd, &(trace->ring[first]), count * sizeof(trace->ring[0])))) {
+			trace->write_error = (0 == errno) ? EIO : errno;
+		}
+
+		tail += count;
+		__atomic_store_n(&(trace->tail), tail, __ATOMIC_RELEASE);
+	}
+}
+
+
+#ifdef HAVE_PTHREAD
+/*
+ * Main function of the flushing thread.
+ */
+/*@null@ */ static void *pv__trace_thread(void *arg)
+{
+	struct pvtrace_s *trace = (struct pvtrace_s *) arg;
+
+	(void) pthread_mutex_lock(&(trace->mutex));
+
+	while (!trace->stop_requested) {
+		struct timespec deadline;
+
+		(void) pthread_mutex_unlock(&(trace->mutex));
+		pv__trace_flush(trace);
+		(void) pthread_mutex_lock(&(trace->mutex));
+
+		if (trace->stop_requested)
+			break;
+
+		memset(&deadline, 0, sizeof(deadline));
+		(void) clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += (long) PV_TRACE_FLUSH_NSEC;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		(void) pthread_cond_timedwait(&(trace->wake), &(trace->mutex), &deadline);
+	}
+
+	(void) pthread_mutex_unlock(&(trace->mutex));
+
+	return NULL;
+}
+#endif				/* HAVE_PTHREAD */
+
+
+/*
+ * Add "event" to the ring buffer, returning false if there was no room.
+ */
+static bool pv__trace_push(struct pvtrace_s *trace, const struct pvtrace_event_s *event)
+{
+	uint64_t head, tail;
+
+	head = trace->head;
+	tail = __atomic_load_n(&(trace->tail), __ATOMIC_ACQUIRE);
+
+	if (head - tail >= PV_TRACE_RING_EVENTS) {
+		if (trace->thread_started)
+			return false;
+		pv__trace_flush(trace);
+		tail = trace->tail;
+	}
+
+	trace->ring[head & (PV_TRACE_RING_EVENTS - 1)] = *event;
+	__atomic_store_n(&(trace->head), head + 1, __ATOMIC_RELEASE);
+
+#ifdef HAVE_PTHREAD
+	/*
+	 * Wake the flushing thread early when the ring is half full.  The
+	 * mutex isn't taken, so the signal can be missed if the thread is
+	 * just about to wait, but then it only waits until its next flush.
+	 */
+	if (trace->thread_started && (head + 1 - tail == PV_TRACE_RING_EVENTS / 2))
+		(void) pthread_cond_signal(&(trace->wake));
+#endif
+
+	return true;
+}
+
+
+/*
+ * Start recording events to the "--trace" file.  Returns false, after
+ * reporting the error, if the file could not be written; the transfer then
+ * goes ahead without a trace.
+ */
+bool pv_trace_start(pvstate_t state)
+{
+	struct pvtrace_header_s header;
+	struct pvtrace_s *trace;
+	struct timespec realtime;
+	int fd;
+
+	if ((NULL == state->control.trace_file) || (NULL != state->transfer.trace))
+		return true;
+
+	trace = calloc(1, sizeof(*trace));
+	if (NULL == trace) {
+		pv_error("%s: %s", state->control.trace_file, strerror(errno));
+		return false;
+	}
+	trace->ring = malloc(PV_TRACE_RING_EVENTS * sizeof(trace->ring[0]));
+	trace->filename = pv_strdup(state->control.trace_file);
+	if ((NULL == trace->ring) || (NULL == trace->filename)) {
+		pv_error("%s: %s", state->control.trace_file, strerror(errno));
+		if (NULL != trace->ring)
+			free(trace->ring);
+		if (NULL != trace->filename)
+			free(trace->filename);
+		free(trace);
+		return false;
+	}
+
+	fd = open(state->control.trace_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);	/* flawfinder: ignore */
+	/* flawfinder - the user asked for this file to be written. */
+	if (fd < 0) {
+		pv_error("%s: %s", state->control.trace_file, strerror(errno));
+		free(trace->ring);
+		free(trace->filename);
+		free(trace);
+		return false;
+	}
+	trace->fd = fd;
+
+	memset(&realtime, 0, sizeof(realtime));
+	(void) clock_gettime(CLOCK_REALTIME, &realtime);
+	pv_elapsedtime_read(&(trace->origin));
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PV_TRACE_MAGIC, sizeof(header.magic));
+	header.version = PV_TRACE_VERSION;
+	header.event_size = (uint32_t) sizeof(struct pvtrace_event_s);
+	header.pid = (int64_t) getpid();
+	header.start_nsec = (int64_t) (realtime.tv_sec) * 1000000000 + (int64_t) (realtime.tv_nsec);
+
+	if (!pv__trace_write(fd, &header, sizeof(header))) {
+		pv_error("%s: %s", state->control.trace_file, strerror(errno));
+		(void) close(fd);
+		free(trace->ring);
+		free(trace->filename);
+		free(trace);
+		return false;
+	}
+
+#ifdef HAVE_PTHREAD
+	{
+		sigset_t all_signals, old_signals;
+		int rc;
+
+		(void) pthread_mutex_init(&(trace->mutex), NULL);
+		(void) pthread_cond_init(&(trace->wake), NULL);
+
+		/* As with the ticker, signals go to the main thread. */
+		(void) sigfillset(&all_signals);
+		(void) sigemptyset(&old_signals);
+		(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+		rc = pthread_create(&(trace->thread), NULL, pv__trace_thread, trace);
+		(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+		if (0 == rc) {
+			trace->thread_started = true;
+		} else {
+			debug("%s: %s", "failed to start trace thread", strerror(rc));
+			(void) pthread_cond_destroy(&(trace->wake));
+			(void) pthread_mutex_destroy(&(trace->mutex));
+		}
+	}
+#endif
+
+	debug("%s: %s", "tracing to", trace->filename);
+
+	state->transfer.trace = trace;
+
+	return true;
+}
+
+
+/*
+ * Record an event of the given kind, on "fd", with the given value - the
+ * result of the call, for I/O and waits, or the byte count otherwise.  If
+ * "start" is not NULL, the event began then and ends now; otherwise it
+ * happened just now.  A negative value means the call failed, and errno is
+ * recorded with it.
+ *
+ * This does nothing if "--trace" is not in use.  The caller's errno is
+ * left untouched.
+ */
+void pv_trace_record(pvtransferstate_t transfer, pvtracekind_t kind, int fd, long long value,
+		     /*@null@ */ const struct timespec *start)
+{
+	struct pvtrace_event_s event;
+	struct pvtrace_s *trace;
+	struct timespec now, offset;
+	int saved_errno;
+
+	trace = transfer->trace;
+	if (NULL == trace)
+		return;
+
+	saved_errno = errno;
+
+	pv_elapsedtime_read(&now);
+
+	memset(&event, 0, sizeof(event));
+	event.kind = (uint16_t) kind;
+	event.fd = (int32_t) fd;
+	event.value = (int64_t) value;
+	if (value < 0)
+		event.error = (int16_t) saved_errno;
+
+	if (NULL != start) {
+		struct timespec elapsed;
+		uint64_t duration;
+		pv_elapsedtime_subtract(&elapsed, &now, start);
+		duration = 0;
+		if (elapsed.tv_sec >= 0)
+			duration = (uint64_t) (elapsed.tv_sec) * 1000000000 + (uint64_t) (elapsed.tv_nsec);
+		event.duration_nsec = (duration > UINT32_MAX) ? UINT32_MAX : (uint32_t) duration;
+		pv_elapsedtime_subtract(&offset, start, &(trace->origin));
+	} else {
+		pv_elapsedtime_subtract(&offset, &now, &(trace->origin));
+	}
+	if (offset.tv_sec >= 0)
+		event.when_nsec = (uint64_t) (offset.tv_sec) * 1000000000 + (uint64_t) (offset.tv_nsec);
+
+	if (trace->dropped > 0) {
+		struct pvtrace_event_s lost;
+		memset(&lost, 0, sizeof(lost));
+		lost.when_nsec = event.when_nsec;
+		lost.kind = (uint16_t) PV_TRACE_DROPPED;
+		lost.fd = -1;
+		lost.value = (int64_t) (trace->dropped);
+		if (!pv__trace_push(trace, &lost)) {
+			trace->dropped++;
+			trace->total_dropped++;
+			errno = saved_errno;
+			return;
+		}
+		trace->dropped = 0;
+	}
+
+	if (!pv__trace_push(trace, &event)) {
+		trace->dropped++;
+		trace->total_dropped++;
+	}
+
+	errno = saved_errno;
+}
+
+
+/*
+ * Stop tracing, writing out whatever is left and closing the file.  This
+ * is called at the end of the transfer, and again when the state is freed.
+ */
+void pv_trace_free(pvtransferstate_t transfer)
+{
+	struct pvtrace_s *trace;
+
+	if ((NULL == transfer) || (NULL == transfer->trace))
+		return;
+
+	trace = transfer->trace;
+	transfer->trace = NULL;
+
+#ifdef HAVE_PTHREAD
+	if (trace->thread_started) {
+		(void) pthread_mutex_lock(&(trace->mutex));
+		trace->stop_requested = true;
+		(void) pthread_cond_signal(&(trace->wake));
+		(void) pthread_mutex_unlock(&(trace->mutex));
+		(void) pthread_join(trace->thread, NULL);
+		(void) pthread_cond_destroy(&(trace->wake));
+		(void) pthread_mutex_destroy(&(trace->mutex));
+		trace->thread_started = false;
+	}
+#endif
+
+	pv__trace_flush(trace);
+
+	/* Now that there's room, say how many events were lost at the end. */
+	if (trace->dropped > 0) {
+		struct pvtrace_event_s lost;
+		struct timespec now, offset;
+		memset(&lost, 0, sizeof(lost));
+		pv_elapsedtime_read(&now);
+		pv_elapsedtime_subtract(&offset, &now, &(trace->origin));
+		lost.when_nsec = (uint64_t) (offset.tv_sec) * 1000000000 + (uint64_t) (offset.tv_nsec);
+		lost.kind = (uint16_t) PV_TRACE_DROPPED;
+		lost.fd = -1;
+		lost.value = (int64_t) (trace->dropped);
+		if (pv__trace_push(trace, &lost))
+			pv__trace_flush(trace);
+	}
+
+	if ((0 != close(trace->fd)) && (0 == trace->write_error))
+		trace->write_error = errno;
+
+	if (0 != trace->write_error)
+		pv_error("%s: %s", trace->filename, strerror(trace->write_error));
+
+	debug("%s: %llu, %s: %llu", "trace events", (unsigned long long) (trace->head), "dropped",
+	      (unsigned long long) (trace->total_dropped));
+
+	free(trace->ring);
+	free(trace->filename);
+	free(trace);
+}
+
+
+/*
+ * Write the event "event", whose process is "pid", to "output" as a
+ * Chrome trace event object.
+ */
+static void pv__trace_decode_event(FILE * output, const struct pvtrace_event_s *event, long long pid)
+{
+	const char *name;
+	double when_usec;
+
+	name = (event->kind < PV_TRACE_KINDS) ? pv__trace_kind_names[event->kind] : "unknown";
+	when_usec = (double) (event->when_nsec) / 1000.0;
+
+	switch (event->kind) {
+	case PV_TRACE_READ:
+	case PV_TRACE_WRITE:
+	case PV_TRACE_SPLICE:
+		fprintf(output,
+			"{\"name\":\"%s\",\"cat\":\"io\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lld,\"tid\":%d,"
+			"\"args\":{\"fd\":%d,\"result\":%lld,\"errno\":%d}}", name, when_usec,
+			(double) (event->duration_nsec) / 1000.0, pid, 1, (int) (event->fd),
+			(long long) (event->value), (int) (event->error));
+		break;
+	case PV_TRACE_WAIT:
+		fprintf(output,
+			"{\"name\":\"%s\",\"cat\":\"wait\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lld,\"tid\":%d,"
+			"\"args\":{\"input_ready\":%s,\"output_ready\":%s,\"errno\":%d}}", name, when_usec,
+			(double) (event->duration_nsec) / 1000.0, pid, 1,
+			((event->value > 0) && (0 != (event->value & PV_TRACE_WAIT_INPUT))) ? "true" : "false",
+			((event->value > 0) && (0 != (event->value & PV_TRACE_WAIT_OUTPUT))) ? "true" : "false",
+			(int) (event->error));
+		break;
+	case PV_TRACE_DISPLAY:
+		fprintf(output,
+			"{\"name\":\"%s\",\"cat\":\"display\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lld,"
+			"\"tid\":%d}", name, when_usec, (double) (event->duration_nsec) / 1000.0, pid, 1);
+		break;
+	case PV_TRACE_UNCONSUMED:
+	case PV_TRACE_RATE:
+		fprintf(output,
+			"{\"name\":\"%s\",\"cat\":\"counter\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%lld,"
+			"\"args\":{\"%s\":%lld}}", name, when_usec, pid,
+			PV_TRACE_RATE == event->kind ? "allowance" : "bytes", (long long) (event->value));
+		break;
+	default:
+		fprintf(output,
+			"{\"name\":\"%s\",\"cat\":\"trace\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%.3f,\"pid\":%lld,"
+			"\"tid\":%d,\"args\":{\"count\":%lld}}", name, when_usec, pid, 1, (long long) (event->value));
+		break;
+	}
+}
+
+
+/*
+ * Read the "--trace" file "filename" and write it to standard output as
+ * JSON in the Chrome trace event format, which Perfetto and chrome://tracing
+ * can load.  Returns nonzero on error.
+ */
+int pv_trace_decode(const char *filename)
+{
+	struct pvtrace_header_s header;
+	struct pvtrace_event_s event;
+	unsigned long long event_count;
+	FILE *input;
+
+	input = fopen(filename, "rb");	    /* flawfinder: ignore */
+	/* flawfinder - the user asked for this file to be read. */
+	if (NULL == input) {
+		pv_error("%s: %s", filename, strerror(errno));
+		return PV_ERROREXIT_ACCESS;
+	}
+
+	memset(&header, 0, sizeof(header));
+	if ((1 != fread(&header, sizeof(header), 1, input))
+	    || (0 != memcmp(header.magic, PV_TRACE_MAGIC, sizeof(header.magic)))) {
+		/*@-mustfreefresh@ *//* see options.c about gettext() */
+		pv_error("%s: %s", filename, _("not a trace file"));
+		/*@+mustfreefresh@ */
+		(void) fclose(input);
+		return PV_ERROREXIT_ACCESS;
+	}
+	if ((PV_TRACE_VERSION != header.version) || (sizeof(event) != (size_t) (header.event_size))) {
+		/*@-mustfreefresh@ *//* see above */
+		pv_error("%s: %s", filename, _("unsupported trace file version"));
+		/*@+mustfreefresh@ */
+		(void) fclose(input);
+		return PV_ERROREXIT_ACCESS;
+	}
+
+	printf("{\"displayTimeUnit\":\"ns\",\"otherData\":{\"pid\":%lld,\"start_nsec\":%lld},\"traceEvents\":[\n",
+	       (long long) (header.pid), (long long) (header.start_nsec));
+	printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lld,\"args\":{\"name\":\"pv\"}}",
+	       (long long) (header.pid));
+
+	event_count = 0;
+	while (1 == fread(&event, sizeof(event), 1, input)) {
+		printf(",\n");
+		pv__trace_decode_event(stdout, &event, (long long) (header.pid));
+		event_count++;
+	}
+	printf("\n]}\n");
+
+	debug("%s: %llu", "events decoded", event_count);
+
+	if (0 != ferror(input)) {
+		pv_error("%s: %s", filename, strerror(errno));
+		(void) fclose(input);
+		return PV_ERROREXIT_ACCESS;
+	}
+	(void) fclose(input);
+
+	if ((0 != fflush(stdout)) || (0 != ferror(stdout))) {
+		pv_error("%s: %s", "(stdout)", strerror(errno));
+		return PV_ERROREXIT_TRANSFER;
+	}
+
+	return 0;
+}
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/file.h>
@@ -21,15 +22,23 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/time.h>
-
-/*
- * splint note: In a few places we use "#if SPLINT" to substitute other code
- * while analysing with splint, to work around the issues it has with
- * FD_ZERO, FD_SET, FD_ISSET - these macros expand to code it does not like,
- * such as using << with an fd which may be negative, or comparing an
- * unsigned integer with a size_t, and it doesn't seem to work to turn off
- * those specific warnings where these macros are used.
- */
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#if defined(HAVE_MMAP) && defined(HAVE_SPLICE)
+#include <sys/uio.h>
+#endif
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#if defined(HAVE_LINUX_FIEMAP_H) && defined(HAVE_LINUX_FS_H)
+#include <stdint.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
 
 /*
  * Return >0 if data is ready to read on fd_in, or write on fd_out, before
@@ -37,99 +46,162 @@
  * or both of "fd_in" and "fd_out" may be negative to ignore that side.  If
  * fd_in_ready and/or fd_out_ready are not NULL, they will be populated with
  * true or false depending on whether data is ready on those sides.
+ *
+ * This is for one-off checks; the main wait in pv_transfer() goes through
+ * pv_poller_wait() instead, which keeps its descriptors registered.  We use
+ * poll() rather than select() so that descriptors above FD_SETSIZE work.
  */
 static int is_data_ready(int fd_in, /*@null@ */ bool *fd_in_ready, int fd_out, /*@null@ */ bool *fd_out_ready,
 			 long usec)
 {
-	struct timeval tv;
-	fd_set readfds;
-	fd_set writefds;
-	fd_set exceptfds;
-	int max_fd;
+	struct pollfd pfd[2];
+	nfds_t count;
 	int result;
 
-	max_fd = -1;
-	if (fd_in > max_fd)
-		max_fd = fd_in;
-	if (fd_out > max_fd)
-		max_fd = fd_out;
-
-	memset(&tv, 0, sizeof(tv));
-
-#if SPLINT
-	/* splint doesn't like FD_ZERO and FD_SET. */
-	memset(&readfds, 0, sizeof(readfds));
-	memset(&writefds, 0, sizeof(writefds));
-	memset(&exceptfds, 0, sizeof(exceptfds));
-#else				/* !SPLINT */
-	FD_ZERO(&readfds);
-	FD_ZERO(&writefds);
-	FD_ZERO(&exceptfds);
-	if (fd_in >= 0)
-		FD_SET(fd_in, &readfds);
-	if (fd_out >= 0)
-		FD_SET(fd_out, &writefds);
-#endif				/* !SPLINT */
-
-	tv.tv_sec = usec / 1000000;
-	tv.tv_usec = usec % 1000000;
+	count = 0;
+	if (fd_in >= 0) {
+		pfd[count].fd = fd_in;
+		pfd[count].events = POLLIN;
+		pfd[count].revents = 0;
+		count++;
+	}
+	if (fd_out >= 0) {
+		pfd[count].fd = fd_out;
+		pfd[count].events = POLLOUT;
+		pfd[count].revents = 0;
+		count++;
+	}
 
 	if (NULL != fd_in_ready)
 		*fd_in_ready = false;
 	if (NULL != fd_out_ready)
 		*fd_out_ready = false;
 
-	result = select(max_fd + 1, &readfds, &writefds, &exceptfds, &tv);
+	result = poll(pfd, count, (int) ((usec + 999) / 1000));
 
 	if (result > 0) {
-		if ((fd_in >= 0) && (NULL != fd_in_ready)
-#ifndef SPLINT
-		    && (FD_ISSET(fd_in, &readfds))
-#endif
-		    ) {
-			*fd_in_ready = true;
+		count = 0;
+		if (fd_in >= 0) {
+			if ((NULL != fd_in_ready) && (0 != pfd[count].revents))
+				*fd_in_ready = true;
+			count++;
 		}
-		if ((fd_out >= 0) && (NULL != fd_out_ready)
-#ifndef SPLINT
-		    && (FD_ISSET(fd_out, &writefds))
-#endif
-		    ) {
+		if ((fd_out >= 0) && (NULL != fd_out_ready) && (0 != pfd[count].revents))
 			*fd_out_ready = true;
-		}
 	}
 
 	return result;
 }
 
 
+/*
+ * Return how many microseconds pv_transfer() may wait for the input or
+ * output to become ready - up to the deadline set by the main loop, which
+ * is the next display update, rate limit step, or remote control check, or
+ * 90ms if no deadline was set.
+ */
+static long pv__transfer_wait_usec(pvstate_t state)
+{
+	struct timespec now, remaining;
+	long double seconds;
+
+	if ((0 == state->transfer.wait_deadline.tv_sec) && (0 == state->transfer.wait_deadline.tv_nsec))
+		return 90000;
+
+	pv_elapsedtime_read(&now);
+	if (pv_elapsedtime_compare(&now, &(state->transfer.wait_deadline)) >= 0)
+		return 0;
+
+	pv_elapsedtime_subtract(&remaining, &(state->transfer.wait_deadline), &now);
+	seconds = pv_elapsedtime_seconds(&remaining);
+	if (seconds > 1.0L)
+		return 1000000;
+
+	return (long) (seconds * 1000000.0L);
+}
+
+
+/*
+ * Return true if the output is to be synced after every write, which is
+ * what "--sync" does unless "--sync-every" or "--sync-interval" have it
+ * done in groups by pv_groupsync_update() instead.
+ */
+static bool pv__transfer_sync_each_write(pvstate_t state)
+{
+	return state->control.sync_after_write && (state->control.sync_every <= 0)
+	    && (state->control.sync_interval <= 0);
+}
+
+
+/*
+ * With "--coalesce", return true if the data waiting in the buffer should
+ * be held back for now, so that it goes out in one write along with
+ * whatever arrives next, and set *wait_usec to how long it may be held
+ * for.  Otherwise return false, which is always the case without
+ * "--coalesce", so that data is written as soon as it is read.
+ *
+ * Data is held while the input is still open and there is room to read
+ * more, until either "--coalesce-bytes" are waiting or the oldest of them
+ * has been waiting for the "--coalesce" time.  Everything waiting is
+ * contiguous in the transfer buffer, so the single write that follows
+ * gathers it all without needing writev().
+ */
+static bool pv__transfer_coalesce_hold(pvstate_t state, bool eof_in, long *wait_usec)
+{
+	struct timespec now, held;
+	long double held_seconds;
+	size_t threshold;
+
+	if ((state->control.coalesce <= 0) || eof_in)
+		return false;
+	if (state->transfer.read_position >= state->transfer.buffer_size)
+		return false;
+
+	threshold = state->control.coalesce_bytes;
+	if (0 == threshold)
+		threshold = COALESCE_BYTES;
+	if (state->transfer.read_position - state->transfer.write_position >= threshold)
+		return false;
+
+	pv_elapsedtime_read(&now);
+	pv_elapsedtime_subtract(&held, &now, &(state->transfer.coalesce_since));
+	held_seconds = pv_elapsedtime_seconds(&held);
+	if (held_seconds >= (long double) (state->control.coalesce))
+		return false;
+
+	*wait_usec = (long) (((long double) (state->control.coalesce) - held_seconds) * 1000000.0L) + 1;
+
+	return true;
+}
+
+
 /*
  * Read up to "count" bytes from file descriptor "fd" into the buffer "buf",
  * and return the number of bytes read, like read().
  *
  * Unlike read(), if we have read less than "count" bytes, we check to see
  * if there's any more to read, and keep trying, to make sure we fill the
- * buffer as full as we can.
+ * buffer as full as we can.  No more than "max_at_once" bytes are asked
+ * for by each read().
  *
  * We stop retrying if the time elapsed since this function was entered
  * reaches TRANSFER_READ_TIMEOUT seconds.
  */
-static ssize_t pv__transfer_read_repeated(int fd, char *buf, size_t count)
+static ssize_t pv__transfer_read_repeated(int fd, char *buf, size_t count, size_t max_at_once)
 {
-	struct timespec start_time;
+	long long start_nsec;
 	ssize_t total_read;
 
-	memset(&start_time, 0, sizeof(start_time));
-
-	pv_elapsedtime_read(&start_time);
+	/* The timeout doesn't need to be exact, so the coarse clock will do. */
+	start_nsec = pv_elapsedtime_coarse_nsec();
 
 	total_read = 0;
 
 	while (count > 0) {
 		ssize_t nread;
-		struct timespec cur_time, transfer_elapsed;
 		long double elapsed_seconds;
 
-		nread = read(fd, buf, (size_t) (count > MAX_READ_AT_ONCE ? MAX_READ_AT_ONCE : count));	/* flawfinder: ignore */
+		nread = read(fd, buf, (size_t) (count > max_at_once ? max_at_once : count));	/* flawfinder: ignore */
 
 		/*
 		 * flawfinder rationale: reads stop after "count" bytes, and
@@ -147,13 +219,7 @@ static ssize_t pv__transfer_read_repeated(int fd, char *buf, size_t count)
 		if (0 == nread)
 			return total_read;
 
-		memset(&cur_time, 0, sizeof(cur_time));
-		memset(&transfer_elapsed, 0, sizeof(transfer_elapsed));
-		elapsed_seconds = 0.0;
-
-		pv_elapsedtime_read(&cur_time);
-		pv_elapsedtime_subtract(&transfer_elapsed, &cur_time, &start_time);
-		elapsed_seconds = pv_elapsedtime_seconds(&transfer_elapsed);
+		elapsed_seconds = ((long double) (pv_elapsedtime_coarse_nsec() - start_nsec)) / 1000000000.0L;
 
 		if (elapsed_seconds > TRANSFER_READ_TIMEOUT) {
 			debug("%s %d: %s (%f %s)", "fd", fd,
@@ -181,38 +247,52 @@ static ssize_t pv__transfer_read_repeated(int fd, char *buf, size_t count)
  * see if we can write any more, and keep trying, to make sure we empty the
  * buffer as much as we can.
  *
- * While this is called after a successful write-possible select(), write() is
+ * While this is called after a successful write-possible poll, write() is
  * not guaranteed to succeed for _all_ sizes; we may end up returning 0 if this
  * occurs. (The first write() may return -1 / EINTR if the consumer doesn't
  * read any data before our timeout and the buffer of whatever stdout is is
  * near-full.) (see https://codeberg.org/ivarch/pv/pulls/93)
  *
+ * No more than "max_at_once" bytes are passed to each write().
+ *
  * If "sync_after_write" is true, we call fdatasync() after each write() (or
  * fsync() if _POSIX_SYNCHRONIZED_IO is not > 0).
  *
+ * If "dontwait" is true, "fd" is a socket, and each write is a send() with
+ * MSG_DONTWAIT, which returns EAGAIN at once if the socket is full instead
+ * of blocking, without changing the flags of the socket itself.
+ *
  * We stop retrying if the time elapsed since this function was entered
  * reaches TRANSFER_WRITE_TIMEOUT seconds.
  */
-static ssize_t pv__transfer_write_repeated(int fd, char *buf, size_t count, bool sync_after_write)
+static ssize_t pv__transfer_write_repeated(int fd, char *buf, size_t count, size_t max_at_once,
+					   bool sync_after_write, bool dontwait)
 {
-	struct timespec start_time;
+	long long start_nsec;
 	ssize_t total_written;
 
-	memset(&start_time, 0, sizeof(start_time));
-
-	pv_elapsedtime_read(&start_time);
+	/* As with reads, the coarse clock is good enough for the timeout. */
+	start_nsec = pv_elapsedtime_coarse_nsec();
 
 	total_written = 0;
 
 	while (count > 0) {
 		ssize_t nwritten;
-		struct timespec cur_time, transfer_elapsed;
 		long double elapsed_seconds;
 		size_t asked_to_write;
 
-		asked_to_write = count > MAX_WRITE_AT_ONCE ? MAX_WRITE_AT_ONCE : count;
+		asked_to_write = count > max_at_once ? max_at_once : count;
 
+#ifdef MSG_DONTWAIT
+		if (dontwait) {
+			nwritten = send(fd, buf, asked_to_write, MSG_DONTWAIT);
+		} else {
+			nwritten = write(fd, buf, asked_to_write);
+		}
+#else
+		(void) dontwait;
 		nwritten = write(fd, buf, asked_to_write);
+#endif
 
 #ifdef HAVE_FDATASYNC
 		if (sync_after_write && nwritten >= 0) {
@@ -256,13 +336,7 @@ static ssize_t pv__transfer_write_repeated(int fd, char *buf, size_t count, bool
 		if (0 == nwritten)
 			return total_written;
 
-		memset(&cur_time, 0, sizeof(cur_time));
-		memset(&transfer_elapsed, 0, sizeof(transfer_elapsed));
-		elapsed_seconds = 0.0;
-
-		pv_elapsedtime_read(&cur_time);
-		pv_elapsedtime_subtract(&transfer_elapsed, &cur_time, &start_time);
-		elapsed_seconds = pv_elapsedtime_seconds(&transfer_elapsed);
+		elapsed_seconds = ((long double) (pv_elapsedtime_coarse_nsec() - start_nsec)) / 1000000000.0L;
 
 		if (elapsed_seconds > TRANSFER_WRITE_TIMEOUT) {
 			debug("%s %d: %s (%f %s)", "fd", fd,
@@ -294,6 +368,403 @@ static ssize_t pv__transfer_write_repeated(int fd, char *buf, size_t count, bool
 }
 
 
+/*
+ * Return the most to read() or write() in one call - normally a fixed
+ * limit, but with "-B auto" the whole buffer, so that the controller can
+ * see the effect of changing its size.
+ */
+static size_t pv__transfer_io_limit(pvstate_t state, size_t fixed_limit)
+{
+	if (state->control.adaptive_buffer && (state->transfer.buffer_size > fixed_limit))
+		return state->transfer.buffer_size;
+	return fixed_limit;
+}
+
+
+#if defined(HAVE_SPLICE) && (defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SYS_SENDFILE_H))
+/*
+ * Return the in-kernel copy method to try for input "fd", working it out
+ * the first time it is asked about: copy_file_range() from a regular file
+ * to a regular file, which lets the filesystem share extents or copy on
+ * the server side, or sendfile() from a regular file to anything else
+ * that isn't a pipe (pipes are spliced instead).
+ *
+ * Empty input files are left alone, since some pseudo-files that report a
+ * size of zero do have contents, which copy_file_range() would miss.
+ */
+static pvcopymethod_t pv__transfer_copy_method(pvstate_t state, int fd)
+{
+	struct stat sb_in, sb_out;
+
+	if (fd == state->transfer.copy_checked_fd)
+		return state->transfer.copy_method;
+
+	state->transfer.copy_checked_fd = fd;
+	state->transfer.copy_method = PV_COPY_METHOD_NONE;
+
+	memset(&sb_in, 0, sizeof(sb_in));
+	memset(&sb_out, 0, sizeof(sb_out));
+	if ((0 != fstat(fd, &sb_in)) || (0 != fstat(state->control.output_fd, &sb_out)))
+		return PV_COPY_METHOD_NONE;
+	if ((!S_ISREG(sb_in.st_mode)) || (sb_in.st_size <= 0) || S_ISFIFO(sb_out.st_mode))
+		return PV_COPY_METHOD_NONE;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	if (S_ISREG(sb_out.st_mode)) {
+		state->transfer.copy_method = PV_COPY_METHOD_COPY_FILE_RANGE;
+		return state->transfer.copy_method;
+	}
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+	state->transfer.copy_method = PV_COPY_METHOD_SENDFILE;
+#endif
+
+	return state->transfer.copy_method;
+}
+
+
+/*
+ * Copy up to "count" bytes from "fd" to the output inside the kernel,
+ * using the method chosen by pv__transfer_copy_method(), and return the
+ * number of bytes copied, or -1 on error as with read().
+ *
+ * If the method turns out not to work with these file descriptors - for
+ * instance, copy_file_range() across filesystems on older kernels - the
+ * next one down is tried, and if none work, copy_method is set to
+ * PV_COPY_METHOD_NONE and -2 is returned, so that the caller falls back to
+ * read().  A return of 0 is also passed to read() to confirm, since some
+ * filesystems return 0 from copy_file_range() before the end of the file.
+ */
+static ssize_t pv__transfer_copy(pvstate_t state, int fd, size_t count)
+{
+	ssize_t ncopied;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	if (PV_COPY_METHOD_COPY_FILE_RANGE == state->transfer.copy_method) {
+		/*@-type@ */
+		/* splint doesn't know about copy_file_range */
+		ncopied = copy_file_range(fd, NULL, state->control.output_fd, NULL, count, 0);
+		/*@+type@ */
+		if (ncopied > 0)
+			return ncopied;
+		if ((ncopied < 0)
+		    && (EINVAL != errno) && (EXDEV != errno) && (ENOSYS != errno) && (EOPNOTSUPP != errno)
+		    && (EBADF != errno))
+			return ncopied;
+		if (0 == ncopied) {
+			debug("%s %d: %s", "fd", fd, "copy_file_range returned 0 - confirming with read");
+			state->transfer.copy_method = PV_COPY_METHOD_NONE;
+			return -2;
+		}
+		debug("%s %d: %s: %s", "fd", fd, "copy_file_range failed - trying sendfile", strerror(errno));
+		state->transfer.copy_method = PV_COPY_METHOD_SENDFILE;
+	}
+#endif				/* HAVE_COPY_FILE_RANGE */
+
+#ifdef HAVE_SYS_SENDFILE_H
+	if (PV_COPY_METHOD_SENDFILE == state->transfer.copy_method) {
+		/*@-nullpass@ */
+		/* splint doesn't know about sendfile */
+		ncopied = sendfile(state->control.output_fd, fd, NULL, count);
+		/*@+nullpass@ */
+		if (ncopied > 0)
+			return ncopied;
+		if ((ncopied < 0)
+		    && (EINVAL != errno) && (ENOSYS != errno) && (EOPNOTSUPP != errno))
+			return ncopied;
+		debug("%s %d: %s: %s", "fd", fd, "sendfile did not copy - using read",
+		      ncopied < 0 ? strerror(errno) : "0");
+	}
+#endif				/* HAVE_SYS_SENDFILE_H */
+
+	state->transfer.copy_method = PV_COPY_METHOD_NONE;
+	return -2;
+}
+#endif				/* HAVE_SPLICE && (HAVE_COPY_FILE_RANGE || HAVE_SYS_SENDFILE_H) */
+
+
+/*
+ * Names of the transfer engines, in pvtransferengine_t order.
+ */
+/*@observer@ */ static const char *const pv__transfer_engine_names[PV_TRANSFER_ENGINES] = {
+	"none",
+	"rescue",
+	"direct",
+	"io_uring",
+	"mmap",
+	"splice",
+	"tee",
+	"copy_file_range",
+	"sendfile",
+	"read/write"
+};
+
+
+/*
+ * Record that "engine" is moving the data from "fd", for "--stats",
+ * logging the change if it wasn't the engine that did so last time.
+ */
+static void pv__transfer_engine_note(pvstate_t state, /*@unused@ */ int fd, pvtransferengine_t engine)
+{
+	(void) fd;			    /* only used in debug(). */
+
+	if ((engine <= PV_TRANSFER_ENGINE_NONE) || (engine >= PV_TRANSFER_ENGINES))
+		return;
+	if (engine != state->transfer.engine) {
+		debug("%s %d: %s: %s", "fd", fd, "I/O engine", pv__transfer_engine_names[engine]);
+		state->transfer.engine = engine;
+	}
+	state->transfer.engines_used |= 1U << engine;
+}
+
+
+/*
+ * Read up to "count" bytes from "fd" into the transfer buffer at the
+ * current read position, recording how long it took for "--stats", and for
+ * "-B auto" if the buffer size is being tuned.
+ *
+ * With --compress or --decompress, the data comes through the codec, and
+ * -2 is returned if none of its output is ready yet.
+ */
+static ssize_t pv__transfer_read_buffer(pvstate_t state, int fd, size_t count)
+{
+	struct timespec io_start;
+	uint64_t profile_start;
+	ssize_t nread;
+
+	pv_elapsedtime_read(&io_start);
+	profile_start = pv_profile_begin();
+
+	if (PV_CODEC_NONE != state->control.codec) {
+		nread = pv_codec_read(state, fd, state->transfer.transfer_buffer + state->transfer.read_position, count);
+	} else {
+		nread =
+		    pv__transfer_read_repeated(fd, state->transfer.transfer_buffer + state->transfer.read_position,
+					       count, pv__transfer_io_limit(state, MAX_READ_AT_ONCE));
+	}
+
+	pv_profile_end(PV_PROFILE_READ, profile_start);
+	pv_latency_record(&(state->transfer), PV_LATENCY_READ, &io_start);
+	pv_trace_record(&(state->transfer), PV_TRACE_READ, fd, (long long) nread, &io_start);
+	if (state->control.adaptive_buffer)
+		pv_buffer_adapt_record(&(state->transfer), count, nread, &io_start);
+
+	return nread;
+}
+
+
+#if defined(HAVE_LINUX_FIEMAP_H) && defined(HAVE_LINUX_FS_H) && defined(FS_IOC_FIEMAP)
+#define PV_HAVE_FIEMAP 1
+#define PV_FIEMAP_EXTENTS 32		/* extents to ask for at once */
+
+/*
+ * Find the first data extent of "fd" at or after "position" with the
+ * FIEMAP ioctl, for when SEEK_DATA and SEEK_HOLE are not available, and
+ * put its bounds in *data_start and *data_end; both are set to -1 if
+ * there is no data after "position".  Adjoining extents are merged.
+ *
+ * Unwritten (preallocated) extents are counted as data, since what has
+ * been written to them may still only be in the page cache.
+ *
+ * Returns false if FIEMAP can't be used on this file.
+ */
+static bool pv__transfer_fiemap_extent(int fd, off_t position, off_t *data_start, off_t *data_end)
+{
+	uint64_t request[(sizeof(struct fiemap) + PV_FIEMAP_EXTENTS * sizeof(struct fiemap_extent))
+			 / sizeof(uint64_t) + 1];
+	struct fiemap *map;
+	bool found;
+
+	*data_start = -1;
+	*data_end = -1;
+	found = false;
+	map = (struct fiemap *) request;
+
+	while (true) {
+		unsigned int extent_idx;
+
+		memset(request, 0, sizeof(request));
+		map->fm_start = (uint64_t) position;
+		map->fm_length = FIEMAP_MAX_OFFSET - (uint64_t) position;
+		map->fm_flags = FIEMAP_FLAG_SYNC;
+		map->fm_extent_count = PV_FIEMAP_EXTENTS;
+
+		if (0 != ioctl(fd, FS_IOC_FIEMAP, map)) {
+			debug("%s %d: %s: %s", "fd", fd, "FIEMAP failed", strerror(errno));
+			return found;
+		}
+
+		if (0 == map->fm_mapped_extents)
+			return true;
+
+		for (extent_idx = 0; extent_idx < map->fm_mapped_extents; extent_idx++) {
+			struct fiemap_extent *extent = &(map->fm_extents[extent_idx]);
+			off_t extent_start = (off_t) (extent->fe_logical);
+			off_t extent_end = (off_t) (extent->fe_logical + extent->fe_length);
+
+			if (!found) {
+				if (extent_end <= position)
+					continue;
+				*data_start = extent_start > position ? extent_start : position;
+				*data_end = extent_end;
+				found = true;
+			} else if (extent_start == *data_end) {
+				*data_end = extent_end;
+			} else {
+				return true;
+			}
+
+			if (0 != (extent->fe_flags & FIEMAP_EXTENT_LAST))
+				return true;
+		}
+
+		/* Carry on from the end of the last extent returned. */
+		position = (off_t) (map->fm_extents[map->fm_mapped_extents - 1].fe_logical
+				    + map->fm_extents[map->fm_mapped_extents - 1].fe_length);
+	}
+}
+#endif				/* HAVE_LINUX_FIEMAP_H && HAVE_LINUX_FS_H && FS_IOC_FIEMAP */
+
+
+/*
+ * In sparse output mode, if the input is positioned in a hole, skip over
+ * it without reading it, and seek the output forward by the same amount,
+ * so the hole is reproduced.  No more than "limit" bytes are skipped.
+ *
+ * The input's data extents are found with SEEK_DATA and SEEK_HOLE, or with
+ * the FIEMAP ioctl on Linux if those aren't supported; the last one found
+ * is remembered, so that while the input is in the middle of data, this
+ * only costs one lseek() per read.
+ *
+ * Returns the number of bytes skipped, which is 0 if there was no hole or
+ * it could not be skipped.
+ */
+static off_t pv__transfer_skip_input_hole(pvstate_t state, int fd, off_t limit)
+{
+#if (defined(SEEK_DATA) && defined(SEEK_HOLE)) || defined(PV_HAVE_FIEMAP)
+	struct stat sb;
+	off_t position, data_start, data_end, hole_length;
+	int lookup_errno;
+
+	if (fd != state->transfer.hole_checked_fd) {
+		state->transfer.hole_checked_fd = fd;
+		state->transfer.hole_check_possible = (0 == fstat(fd, &sb)) && S_ISREG(sb.st_mode);
+		state->transfer.input_data_start = 0;
+		state->transfer.input_data_end = 0;
+	}
+
+	if (!state->transfer.hole_check_possible)
+		return 0;
+
+	position = lseek(fd, 0, SEEK_CUR);
+	if (position < 0) {
+		state->transfer.hole_check_possible = false;
+		return 0;
+	}
+
+	/* Still inside the data extent we already know about. */
+	if ((position >= state->transfer.input_data_start) && (position < state->transfer.input_data_end))
+		return 0;
+
+	/* Find the next data extent. */
+	data_start = -1;
+	data_end = -1;
+	lookup_errno = EINVAL;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	data_start = lseek(fd, position, SEEK_DATA);
+	if (data_start >= 0) {
+		data_end = lseek(fd, data_start, SEEK_HOLE);
+	} else {
+		lookup_errno = errno;
+	}
+#endif				/* SEEK_DATA && SEEK_HOLE */
+#ifdef PV_HAVE_FIEMAP
+	if ((data_start < 0) && (ENXIO != lookup_errno)) {
+		debug("%s %d: %s: %s", "fd", fd, "SEEK_DATA failed - trying FIEMAP", strerror(lookup_errno));
+		if (pv__transfer_fiemap_extent(fd, position, &data_start, &data_end))
+			lookup_errno = ENXIO;
+	}
+#endif				/* PV_HAVE_FIEMAP */
+
+	if (data_start < 0) {
+		if (ENXIO != lookup_errno) {
+			debug("%s %d: %s: %s", "fd", fd, "no extent map - disabling", strerror(lookup_errno));
+			state->transfer.hole_check_possible = false;
+			(void) lseek(fd, position, SEEK_SET);
+			return 0;
+		}
+		/* There's nothing but a hole from here to the end. */
+		if ((0 != fstat(fd, &sb)) || (sb.st_size <= position)) {
+			(void) lseek(fd, position, SEEK_SET);
+			return 0;
+		}
+		data_start = sb.st_size;
+		data_end = data_start;
+	}
+
+	state->transfer.input_data_start = data_start;
+	state->transfer.input_data_end = data_end > data_start ? data_end : data_start;
+
+	hole_length = data_start - position;
+	if (hole_length > limit)
+		hole_length = limit;
+
+	if (hole_length <= 0) {
+		(void) lseek(fd, position, SEEK_SET);
+		return 0;
+	}
+
+	if (lseek(state->control.output_fd, hole_length, SEEK_CUR) < 0) {
+		debug("%s: %s", "output lseek() failed", strerror(errno));
+		state->transfer.output_not_seekable = true;
+		(void) lseek(fd, position, SEEK_SET);
+		return 0;
+	}
+
+	if (lseek(fd, position + hole_length, SEEK_SET) < 0) {
+		debug("%s %d: %s: %s", "fd", fd, "input lseek() failed", strerror(errno));
+		state->transfer.hole_check_possible = false;
+		(void) lseek(state->control.output_fd, -hole_length, SEEK_CUR);
+		return 0;
+	}
+
+	debug("%s %d: %s: %lld @ %lld", "fd", fd, "skipped input hole", (long long) hole_length, (long long) position);
+
+	return hole_length;
+#else				/* !((SEEK_DATA && SEEK_HOLE) || PV_HAVE_FIEMAP) */
+	(void) state;
+	(void) fd;
+	(void) limit;
+	return 0;
+#endif				/* (SEEK_DATA && SEEK_HOLE) || PV_HAVE_FIEMAP */
+}
+
+
+/*
+ * Return true if something besides the display needs to see every byte
+ * written to the output - the --digest digest, or extra outputs from
+ * repeating "-o" - so that data can't be moved without passing through our
+ * buffer, or through the tee() side pipe.
+ */
+static bool pv__transfer_data_needed(pvstate_t state)
+{
+	return (PV_DIGEST_NONE != state->control.digest) || (NULL != state->status.fanout);
+}
+
+
+/*
+ * Note that the input has ended, by EOF or an error it can't go past,
+ * setting *eof_in, and *eof_out as well if everything in the buffer has
+ * been written.
+ */
+static void pv__transfer_input_ended(pvstate_t state, bool *eof_in, bool *eof_out)
+{
+	*eof_in = true;
+	if (state->transfer.write_position >= state->transfer.read_position)
+		*eof_out = true;
+}
+
+
 /*
  * Read some data from the given file descriptor. Returns zero if there was
  * a transient error and we need to return 0 from pv_transfer, otherwise
@@ -334,6 +805,11 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 	size_t bytes_can_read;
 	off_t amount_to_skip, amount_skipped, orig_offset, skip_offset;
 	ssize_t nread;
+#ifdef HAVE_SPLICE
+	struct timespec io_start;
+	uint64_t profile_start;
+	bool kernel_copy_permitted;
+#endif
 
 	do_not_skip_errors = false;
 	if (0 == state->control.skip_errors)
@@ -361,9 +837,43 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 
 #ifdef HAVE_SPLICE
 	state->transfer.splice_used = false;
-	if ((!state->control.linemode) && (!state->control.no_splice)
-	    && (fd != state->transfer.splice_failed_fd)
-	    && (0 == state->transfer.to_write)) {
+#endif
+
+	/*
+	 * In sparse output mode, with nothing waiting to be written, skip
+	 * any hole in the input instead of reading its zeroes, respecting
+	 * the rate limit and --size.  Not in line mode, since with --null
+	 * the zeroes are line separators.
+	 */
+	if (state->control.sparse_output && (!state->transfer.output_not_seekable) && (!state->control.linemode)
+	    && (!state->display.showing_last_written) && (!pv__transfer_data_needed(state))
+	    && (PV_CODEC_NONE == state->control.codec) && (0 == state->transfer.read_position)) {
+		off_t hole_limit = (off_t) SSIZE_MAX;
+		off_t skipped = 0;
+
+		if (state->control.stop_at_size && (state->control.size - state->transfer.total_bytes_read < hole_limit))
+			hole_limit = state->control.size - state->transfer.total_bytes_read;
+		if ((state->control.rate_limit > 0 || max_to_write != 0) && (max_to_write < hole_limit))
+			hole_limit = max_to_write;
+
+		if (hole_limit > 0)
+			skipped = pv__transfer_skip_input_hole(state, fd, hole_limit);
+
+		if (skipped > 0) {
+			state->transfer.written += (ssize_t) skipped;
+			state->transfer.total_bytes_read += skipped;
+			state->transfer.read_errors_in_a_row = 0;
+			return 1;
+		}
+	}
+
+#ifdef HAVE_SPLICE
+	kernel_copy_permitted = (!state->control.linemode) && (!state->control.no_splice)
+	    && (!state->display.showing_last_written) && (!state->display.showing_previous_line)
+	    && (!pv__transfer_data_needed(state)) && (PV_CODEC_NONE == state->control.codec)
+	    && (PV_IOENGINE_READWRITE != state->control.io_engine)
+	    && (0 == state->transfer.to_write);
+	if (kernel_copy_permitted && (fd != state->transfer.splice_failed_fd)) {
 		size_t bytes_to_splice;
 
 		if (state->control.rate_limit > 0 || max_to_write != 0) {
@@ -372,6 +882,9 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 			bytes_to_splice = bytes_can_read;
 		}
 
+		pv_elapsedtime_read(&io_start);
+		profile_start = pv_profile_begin();
+
 		/*@-nullpass@ */
 		/*@-type@ */
 		/* splint doesn't know about splice */
@@ -379,6 +892,10 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 		/*@+type@ */
 		/*@+nullpass@ */
 
+		pv_profile_end(PV_PROFILE_SPLICE, profile_start);
+		pv_latency_record(&(state->transfer), PV_LATENCY_SPLICE, &io_start);
+		pv_trace_record(&(state->transfer), PV_TRACE_SPLICE, fd, (long long) nread, &io_start);
+
 		state->transfer.splice_used = true;
 		if ((nread < 0) && (EINVAL == errno)) {
 			debug("%s %d: %s", "fd", fd, "splice failed with EINVAL - disabling");
@@ -388,10 +905,11 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 			 * Fall through to read() below.
 			 */
 		} else if (nread > 0) {
+			pv__transfer_engine_note(state, fd, PV_TRANSFER_ENGINE_SPLICE);
 			state->transfer.written = nread;
 			state->transfer.total_bytes_read += nread;
 #ifdef HAVE_FDATASYNC
-			if (state->control.sync_after_write) {
+			if (pv__transfer_sync_each_write(state)) {
 				/*
 				 * Ignore non IO errors, such as EBADFD (bad file
 				 * descriptor), EINVAL (non syncable fd, such as a
@@ -415,17 +933,63 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 			state->transfer.splice_used = false;
 		}
 	}
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SYS_SENDFILE_H)
+	/*
+	 * If splice() couldn't be used because neither end is a pipe, try
+	 * copy_file_range() or sendfile() instead.  These are treated as
+	 * splice() from here on, since they also bypass the buffer.  The
+	 * chunk size isn't tied to the buffer size, so that large copies
+	 * aren't broken up more than necessary, but it still respects the
+	 * rate limit and --size.
+	 */
+	if (kernel_copy_permitted && (!state->transfer.splice_used)
+	    && (PV_COPY_METHOD_NONE != pv__transfer_copy_method(state, fd))) {
+		size_t bytes_to_copy;
+
+		bytes_to_copy = MAX_COPY_AT_ONCE;
+		if (state->control.stop_at_size
+		    && ((long long) bytes_to_copy > (long long) (state->control.size - state->transfer.total_bytes_read)))
+			bytes_to_copy = (size_t) (state->control.size - state->transfer.total_bytes_read);
+		if ((state->control.rate_limit > 0 || max_to_write != 0) && ((off_t) bytes_to_copy > max_to_write))
+			bytes_to_copy = (size_t) max_to_write;
+
+		pv_elapsedtime_read(&io_start);
+		profile_start = pv_profile_begin();
+		nread = bytes_to_copy > 0 ? pv__transfer_copy(state, fd, bytes_to_copy) : -2;
+		if (-2 != nread) {
+			pv_profile_end(PV_PROFILE_SPLICE, profile_start);
+			pv_latency_record(&(state->transfer), PV_LATENCY_SPLICE, &io_start);
+			pv_trace_record(&(state->transfer), PV_TRACE_SPLICE, fd, (long long) nread, &io_start);
+			state->transfer.splice_used = true;
+			if (nread > 0) {
+				pv__transfer_engine_note(state, fd,
+							 PV_COPY_METHOD_SENDFILE ==
+							 state->transfer.copy_method ? PV_TRANSFER_ENGINE_SENDFILE :
+							 PV_TRANSFER_ENGINE_COPY_FILE_RANGE);
+				state->transfer.written = nread;
+			}
+#ifdef HAVE_FDATASYNC
+			if ((nread > 0) && pv__transfer_sync_each_write(state)) {
+				/* As with splice() above. */
+				if ((fdatasync(state->control.output_fd) < 0) && (EIO == errno)) {
+					nread = -1;
+					do_not_skip_errors = true;
+				}
+			}
+#endif				/* HAVE_FDATASYNC */
+		}
+	}
+#endif				/* HAVE_COPY_FILE_RANGE || HAVE_SYS_SENDFILE_H */
 	if (!state->transfer.splice_used) {
-		nread =
-		    pv__transfer_read_repeated(fd, state->transfer.transfer_buffer + state->transfer.read_position,
-					       bytes_can_read);
+		nread = pv__transfer_read_buffer(state, fd, bytes_can_read);
 	}
 #else
-	nread =
-	    pv__transfer_read_repeated(fd, state->transfer.transfer_buffer + state->transfer.read_position,
-				       bytes_can_read);
+	nread = pv__transfer_read_buffer(state, fd, bytes_can_read);
 #endif				/* HAVE_SPLICE */
 
+	/* The codec has taken some input, but has nothing to give yet. */
+	if ((-2 == nread) && (PV_CODEC_NONE != state->control.codec))
+		return 0;
 
 	if (0 == nread) {
 		/*
@@ -434,9 +998,7 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 		 * buffer, we set eof_out as well, so that the main loop can
 		 * move on to the next input file.
 		 */
-		*eof_in = true;
-		if (state->transfer.write_position >= state->transfer.read_position)
-			*eof_out = true;
+		pv__transfer_input_ended(state, eof_in, eof_out);
 		return 1;
 	} else if (nread > 0) {
 		/*
@@ -488,10 +1050,7 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 	 */
 	if (do_not_skip_errors) {
 		pv_error("%s: %s: %s", pv_current_file_name(state), _("read failed"), strerror(errno));
-		*eof_in = true;
-		if (state->transfer.write_position >= state->transfer.read_position) {
-			*eof_out = true;
-		}
+		pv__transfer_input_ended(state, eof_in, eof_out);
 		return 1;
 	}
 
@@ -636,435 +1195,1984 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 
 
 /*
- * Write state->transfer.to_write bytes of data from the transfer buffer to the output.
- * Returns zero if there was a transient error and we need to return 0 from
- * pv_transfer, otherwise returns 1.
- *
- * Updates state->transfer.write_position by moving it on by the number of bytes
- * written; adds the number of bytes written to state->transfer.written; sets
- * *eof_out to true, on output EOF, or when the write position catches up
- * with the read position AND *eof_in is true (meaning we've reached the end
- * of data).
- *
- * On error, sets *eof_out to true, sets state->transfer.written to -1, and updates
- * state->status.exit_status.
+ * Look through the "count" bytes at "data", which have just been written,
+ * for line separators, adding the number found to *lines, and record the
+ * output position of each separator in the line positions buffer.
+ * Advances state->transfer.last_output_position by "count".
  *
- * If state->control.discard_input is true, does not actually write anything.
+ * The separators are located in batches with pv_linescan_find(), rather
+ * than by looking at every byte here.
  */
-static int pv__transfer_write(pvstate_t state, bool *eof_in, bool *eof_out, long *lineswritten)
+static void pv__transfer_track_lines(pvstate_t state, const char *data, size_t count, char separator, long *lines)
 {
-	ssize_t nwritten;
-	int write_errno;
-	bool all_nulls;
-	off_t output_offset;
-	size_t write_check_position, write_end_position;
+	size_t offsets[PV_LINESCAN_BATCH];
+	size_t start;
 
-	if (NULL == state->transfer.transfer_buffer) {
-		pv_error("%s", _("no transfer buffer allocated"));
-		state->status.exit_status |= PV_ERROREXIT_MEMORY;
-		*eof_out = true;
-		state->transfer.written = -1;
-		return 1;
-	}
+	start = 0;
+	while (start < count) {
+		size_t found, scanned, found_idx;
 
-	nwritten = 0;
-	write_errno = 0;
+		found =
+		    pv_linescan_find(data + start, count - start, separator, offsets, PV_LINESCAN_BATCH, &scanned);
 
-	if (state->control.discard_input) {
-		nwritten = state->transfer.to_write;
-	} else if (state->transfer.to_write > 0) {
+		for (found_idx = 0; found_idx < found; found_idx++) {
+			/* Separator found - increment line count. */
+			++(*lines);
 
-		/*
-		 * In sparse output mode, check whether all of the bytes to
-		 * be written are null, and if so, try to seek the output
-		 * instead of writing the null bytes.
-		 */
-		if (state->control.sparse_output && !state->transfer.output_not_seekable) {
-			write_check_position = state->transfer.write_position;
-			write_end_position = write_check_position + (size_t) (state->transfer.to_write);
-			all_nulls = true;
-			while (all_nulls && write_check_position < write_end_position) {
-				if ('\0' == state->transfer.transfer_buffer[write_check_position]) {
-					write_check_position++;
-				} else {
-					all_nulls = false;
-				}
-			}
-			if (all_nulls) {
+			if (NULL == state->transfer.line_positions)
+				continue;
 
-				/*
-				 * Use lseek() to move forward in the file,
-				 * and then ftruncate() it to its new size.
-				 *
-				 * If any step fails, mark the output not
-				 * seekable so we stop trying.
-				 */
+			/* Store the position of the separator. */
+			pv_linepos_add(state->transfer.line_positions,
+				       state->transfer.last_output_position + (off_t) (start + offsets[found_idx]));
+		}
+
+		start += scanned;
+	}
+
+	state->transfer.last_output_position += (off_t) count;
+}
+
+
+/*
+ * Return the most lines, or with "--record", records, that may be written
+ * now in line mode: when rate limiting, or stopping at a size, the
+ * "allowed" passed to pv_transfer() counts lines rather than bytes;
+ * otherwise there is no limit, and -1 is returned.
+ */
+static off_t pv__transfer_line_limit(pvstate_t state, off_t allowed)
+{
+	if ((state->control.rate_limit > 0) || (allowed > 0))
+		return (allowed > 0) ? allowed : 0;
+	return -1;
+}
+
+
+/*
+ * In line mode, return how many of the "count" bytes at "data" should be
+ * written now: up to the end of the last whole line or record, and when
+ * there is a limit, no further than the end of the last one allowed, found
+ * with the vectorised separator scan, so that a rate limit gives exactly
+ * that many lines in each step rather than however many a byte count
+ * happens to hold.  What is left of a line with no end in the data is
+ * written as it is.
+ */
+static size_t pv__transfer_line_cut(pvstate_t state, const char *data, size_t count, off_t allowed)
+{
+	char separator;
+	off_t limit;
+	char *end;
+
+	limit = pv__transfer_line_limit(state, allowed);
+
+	if (PV_RECORD_NONE != state->control.record.type)
+		return pv_record_boundary(state, data, count, limit);
+
+	if (0 == limit)
+		return 0;
+
+	separator = state->control.null_terminated_lines ? '\0' : '\n';
+
+	if (limit > 0) {
+		size_t cut = pv_linescan_cut(data, count, separator, (size_t) limit);
+		return (cut > 0) ? cut : count;
+	}
+
+	/* Null-terminated lines are not held back when there is no limit. */
+	if (state->control.null_terminated_lines)
+		return count;
+
+	end = pv_memrchr(data, (int) separator, count);
+	if (NULL != end)
+		return (size_t) ((end - data) + 1);
+
+	return count;
+}
+
+
+/*
+ * Account for "count" bytes at "data" having just been written to the
+ * output: copy them to any extra outputs, add them to the --digest
+ * digest, in line mode, add the number
+ * of lines among them to *lineswritten and remember where each line
+ * ended, and add them to the capture ring if the previous-line or
+ * last-written displays are being shown.
+ */
+static void pv__transfer_track_written(pvstate_t state, const char *data, size_t count, /*@null@ */ long *lineswritten)
+{
+	if (NULL != state->status.fanout)
+		pv_fanout_write(state, data, count);
+
+	if (PV_DIGEST_NONE != state->control.digest)
+		pv_digest_update(state, data, count);
+
+	if ((state->control.linemode) && (lineswritten != NULL)) {
+		char separator;
+		long lines = 0;
+		uint64_t profile_start;
+
+		/*
+		 * Line mode, so we need to look through what we've just
+		 * written to count how many lines there were.
+		 */
+
+		/* Allocate the record of line positions. */
+		if (NULL == state->transfer.line_positions) {
+			/*@-mustfreeonly@ */
+			state->transfer.line_positions = pv_linepos_alloc();
+			if (NULL == state->transfer.line_positions) {
+				pv_error("%s: %s", _("line position buffer allocation failed"), strerror(errno));
+			}
+			/*@+mustfreeonly@ */
+			/* splint doesn't see we only allocate when line_positions is NULL. */
+		}
+
+		if (state->control.null_terminated_lines) {
+			separator = '\0';
+		} else {
+			separator = '\n';
+		}
+
+		profile_start = pv_profile_begin();
+		if (PV_RECORD_NONE != state->control.record.type) {
+			/* Counting records rather than lines. */
+			lines = (long) pv_record_count(state, data, count);
+			state->transfer.last_output_position += (off_t) count;
+		} else if (NULL == state->transfer.line_positions) {
+			/* Only counting - no need to know where each line ends. */
+			lines = (long) pv_linescan_count(data, count, separator);
+			state->transfer.last_output_position += (off_t) count;
+		} else {
+			pv__transfer_track_lines(state, data, count, separator, &lines);
+		}
+		pv_profile_end(PV_PROFILE_LINESCAN, profile_start);
+
+		*lineswritten += lines;
+	}
+
+	/*
+	 * If we're showing the output, keep a copy of the end of it, to be
+	 * picked through when the display is next drawn.
+	 */
+	if (state->display.showing_last_written || state->display.showing_previous_line)
+		pv_capture_add(&(state->display), data, count);
+}
+
+
+#ifdef HAVE_SPLICE
+/*
+ * Return true if the input can be moved to the output with tee() and
+ * splice() while a copy is read for the display - that is, if splice()
+ * would otherwise have been skipped only because the display needs to see
+ * the data, and both the input and the output are pipes.
+ *
+ * Opens the side pipe the first time it is needed.
+ */
+static bool pv__transfer_tee_usable(pvstate_t state, int fd)
+{
+	if (state->control.no_splice || (PV_IOENGINE_READWRITE == state->control.io_engine)
+	    || (PV_CODEC_NONE != state->control.codec) || (fd == state->transfer.splice_failed_fd))
+		return false;
+
+	if (!(state->control.linemode || state->display.showing_last_written || state->display.showing_previous_line
+	      || pv__transfer_data_needed(state)))
+		return false;
+
+	/*
+	 * A line mode allowance has to be cut at a line end, which needs
+	 * the data in our buffer before it is written.
+	 */
+	if (state->control.linemode && ((state->control.rate_limit > 0) || state->control.stop_at_size))
+		return false;
+
+	/* Anything already buffered has to be written out first. */
+	if (state->transfer.read_position > state->transfer.write_position)
+		return false;
+
+	if (fd != state->transfer.tee_checked_fd) {
+		struct stat sb;
+
+		state->transfer.tee_checked_fd = fd;
+		state->transfer.tee_possible = false;
+
+		memset(&sb, 0, sizeof(sb));
+		if ((0 == fstat(fd, &sb)) && S_ISFIFO(sb.st_mode)) {
+			memset(&sb, 0, sizeof(sb));
+			if ((0 == fstat(state->control.output_fd, &sb)) && S_ISFIFO(sb.st_mode))
+				state->transfer.tee_possible = true;
+		}
+	}
+
+	if (!state->transfer.tee_possible)
+		return false;
+
+	if (!state->transfer.tee_pipe_open) {
+		if (0 != pipe(state->transfer.tee_pipe)) {
+			debug("%s: %s", "tee pipe", strerror(errno));
+			state->transfer.splice_failed_fd = fd;
+			return false;
+		}
+		(void) fcntl(state->transfer.tee_pipe[0], F_SETFD, FD_CLOEXEC);
+		(void) fcntl(state->transfer.tee_pipe[1], F_SETFD, FD_CLOEXEC);
+		state->transfer.tee_pipe_open = true;
+		state->transfer.tee_pending = 0;
+	}
+
+	return true;
+}
+
+
+/*
+ * Move data from the pipe "fd" to the output pipe without it passing
+ * through our buffer: tee() duplicates it into the side pipe, splice()
+ * moves the original to the output, and only the copy is read, so that
+ * lines can be counted and the last-written bytes captured.
+ *
+ * The amount moved is capped in the same way as pv__transfer_read() caps
+ * its splice().  If splice() moves less than was duplicated, the rest is
+ * left in the side pipe, and spliced before anything more is duplicated.
+ *
+ * Returns 0 if there was a transient error and we need to return 0 from
+ * pv_transfer, 1 if pv_transfer should return state->transfer.written, or
+ * -1 if tee() isn't usable on this fd and a normal read should be done
+ * instead.
+ */
+static int pv__transfer_tee(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed,
+			    /*@null@ */ long *lineswritten)
+{
+	struct timespec io_start;
+	uint64_t profile_start;
+	size_t bytes_can_move, copied;
+	ssize_t nmoved;
+
+	bytes_can_move = state->transfer.buffer_size;
+
+	if (state->control.stop_at_size && !state->control.linemode) {
+		off_t bytes_remaining_to_read = state->control.size - state->transfer.total_bytes_read;
+		if ((long long) bytes_can_move > (long long) bytes_remaining_to_read)
+			bytes_can_move = (size_t) bytes_remaining_to_read;
+	}
+	if (((state->control.rate_limit > 0) || (allowed > 0)) && ((off_t) bytes_can_move > allowed))
+		bytes_can_move = (size_t) allowed;
+
+	if (0 == bytes_can_move)
+		return 0;
+
+	if (0 == state->transfer.tee_pending) {
+		ssize_t nteed;
+
+		/*@-type@ */
+		/* splint doesn't know about tee */
+		nteed = tee(fd, state->transfer.tee_pipe[1], bytes_can_move, SPLICE_F_NONBLOCK);
+		/*@+type@ */
+		if (nteed < 0) {
+			if ((EAGAIN == errno) || (EINTR == errno))
+				return 0;
+			debug("%s %d: %s: %s", "fd", fd, "tee failed - disabling", strerror(errno));
+			state->transfer.splice_failed_fd = fd;
+			return -1;
+		}
+		if (0 == nteed) {
+			/* Nothing left and no writers - end of input. */
+			*eof_in = true;
+			*eof_out = true;
+			return 1;
+		}
+		state->transfer.tee_pending = (size_t) nteed;
+	}
+
+	if (bytes_can_move > state->transfer.tee_pending)
+		bytes_can_move = state->transfer.tee_pending;
+
+	pv_elapsedtime_read(&io_start);
+	profile_start = pv_profile_begin();
+
+	/*@-nullpass@ */
+	/*@-type@ */
+	/* splint doesn't know about splice */
+	nmoved = splice(fd, NULL, state->control.output_fd, NULL, bytes_can_move, SPLICE_F_MORE);
+	/*@+type@ */
+	/*@+nullpass@ */
+
+	pv_profile_end(PV_PROFILE_SPLICE, profile_start);
+	pv_latency_record(&(state->transfer), PV_LATENCY_SPLICE, &io_start);
+	pv_trace_record(&(state->transfer), PV_TRACE_SPLICE, fd, (long long) nmoved, &io_start);
+
+	if (nmoved <= 0) {
+		if ((0 == nmoved) || (EAGAIN == errno) || (EINTR == errno))
+			return 0;
+		if (EPIPE == errno) {
+			*eof_in = true;
+			*eof_out = true;
+			state->flags.pipe_closed = 1;
+			debug("%s", "SIGPIPE received - setting pipe_closed");
+			return 0;
+		}
+		pv_error("%s: %s", _("write failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		*eof_out = true;
+		state->transfer.written = -1;
+		return 1;
+	}
+
+	state->transfer.tee_pending -= (size_t) nmoved;
+	state->transfer.total_bytes_read += nmoved;
+	state->transfer.written = nmoved;
+
+	/*
+	 * Collect the copy of what was just moved - it is already sitting
+	 * in the side pipe, so this won't block.
+	 */
+	copied = 0;
+	while (copied < (size_t) nmoved) {
+		ssize_t nread;
+		nread =
+		    read(state->transfer.tee_pipe[0], state->transfer.transfer_buffer + copied,
+			 (size_t) nmoved - copied);
+		if ((nread < 0) && (EINTR == errno))
+			continue;
+		if (nread <= 0) {
+			debug("%s: %s", "tee pipe read failed", nread < 0 ? strerror(errno) : "EOF");
+			break;
+		}
+		copied += (size_t) nread;
+	}
+
+	if (NULL != state->transfer.transfer_buffer)
+		pv__transfer_track_written(state, state->transfer.transfer_buffer, copied, lineswritten);
+
+	return 1;
+}
+#endif				/* HAVE_SPLICE */
+
+
+/*
+ * Write "count" bytes from "buf" to the output in sparse output mode,
+ * looking at it in blocks of the output's block size, and seeking over any
+ * blocks that are entirely zero instead of writing them.  If the output
+ * turns out not to be seekable, the rest is written normally.
+ *
+ * Returns the number of bytes written or skipped, or -1 on error with
+ * errno set, as with pv__transfer_write_repeated().
+ */
+static ssize_t pv__transfer_write_sparse(pvstate_t state, char *buf, size_t count)
+{
+	size_t done;
+
+	if (0 == state->transfer.sparse_block_size) {
+		struct stat sb;
+		size_t block_size = PV_SPARSE_BLOCK_DEFAULT;
+		if ((0 == fstat(state->control.output_fd, &sb)) && (sb.st_blksize >= 512))
+			block_size = (size_t) (sb.st_blksize);
+		if (block_size > PV_SPARSE_BLOCK_MAX)
+			block_size = PV_SPARSE_BLOCK_MAX;
+		state->transfer.sparse_block_size = block_size;
+		debug("%s: %ld", "sparse block size", (long) block_size);
+	}
+
+	done = 0;
+	while (done < count) {
+		size_t run_length;
+		ssize_t nwritten;
 
+		if (!state->transfer.output_not_seekable) {
+			run_length = pv_zeroscan_run(buf + done, count - done, state->transfer.sparse_block_size, true);
+			if (run_length > 0) {
 				/*@+longintegral@ */
-				/*
-				 * splint has trouble with off_t / __off_t, in the lseek() call.
-				 */
-				output_offset =
-				    lseek(state->control.output_fd, (off_t) (state->transfer.to_write), SEEK_CUR);
-				if (output_offset == (off_t) - 1) {
+				if (lseek(state->control.output_fd, (off_t) run_length, SEEK_CUR) == (off_t) - 1) {
 					debug("%s: %s", "output lseek() failed", strerror(errno));
 					state->transfer.output_not_seekable = true;
 				} else {
-					/* Seek successful - skip write. */
-					debug("%s (%ld) -> %s: %ld", "skipped null writes",
-					      (long) (state->transfer.to_write), "new position", (long) output_offset);
-					nwritten = state->transfer.to_write;
-					goto pv__transfer_write_completed;
+					done += run_length;
 				}
 				/*@-longintegral@ */
+				continue;
 			}
+			run_length =
+			    pv_zeroscan_run(buf + done, count - done, state->transfer.sparse_block_size, false);
+		} else {
+			run_length = count - done;
 		}
 
-		/*
-		 * Set an interval timer or an alarm to interrupt the write
-		 * with a signal if the write takes too long, so we can
-		 * continue producing progress information.
-		 */
-#if HAVE_SETITIMER
-		struct itimerval new_timer;
+		nwritten =
+		    pv__transfer_write_repeated(state->control.output_fd, buf + done, run_length,
+						pv__transfer_io_limit(state, MAX_WRITE_AT_ONCE),
+						pv__transfer_sync_each_write(state), state->transfer.output_dontwait);
+		if (nwritten < 0)
+			return done > 0 ? (ssize_t) done : -1;
 
-		/*@-unrecog@ */
-		/* splint doesn't know setitimer or ITIMER_REAL */
-		memset(&new_timer, 0, sizeof(new_timer));
-		new_timer.it_value.tv_sec = (time_t) (state->control.interval);
-		new_timer.it_value.tv_usec = (suseconds_t) (((long) (state->control.interval * 1000000.0)) % 1000000);
+		done += (size_t) nwritten;
+		if ((size_t) nwritten < run_length)
+			break;
+	}
 
-		/*
-		 * We have to set the interval so that the timer continues
-		 * to repeat while writes are attempted, especially as it's
-		 * possible that the initial timer run will expire
-		 * immediately if the period is less than 1 second.
-		 */
+	return (ssize_t) done;
+}
 
-		new_timer.it_interval.tv_sec = new_timer.it_value.tv_sec;
-		new_timer.it_interval.tv_usec = new_timer.it_value.tv_usec;
 
-		debug("%s: [%lds,%ldus]", "setting interval timer", (long) (new_timer.it_value.tv_sec),
-		      (long) (new_timer.it_value.tv_usec));
+/*
+ * Return true if a write to the output could block for longer than the
+ * display can wait, so that it needs the write timer to interrupt it.
+ */
+static bool pv__transfer_write_can_block(pvstate_t state)
+{
+	return (state->transfer.output_dontwait || state->transfer.output_pipe) ? false : true;
+}
 
-		if (0 != setitimer(ITIMER_REAL, &new_timer, NULL)) {
-			pv_error("%s: %s", _("failed to set interval timer"), strerror(errno));
-		}
 
-#else				/* ! HAVE_SETITIMER */
-		(void) alarm(1);
-		debug("%s", "setting alarm");
-#endif				/* HAVE_SETITIMER */
-		debug("%s: %ld %s", "beginning write attempt", (long) (state->transfer.to_write), "bytes");
-		nwritten = pv__transfer_write_repeated(state->control.output_fd,
-						       state->transfer.transfer_buffer +
-						       state->transfer.write_position,
-						       (size_t) (state->transfer.to_write),
-						       state->control.sync_after_write);
-		if (nwritten < 0) {
-			write_errno = (int) errno;
-			debug("%s: %ld: %s", "bytes written", (long) nwritten, strerror(errno));
-		} else {
-			debug("%s: %ld", "bytes written", (long) nwritten);
-		}
+/*
+ * Return how many of "count" bytes can be written to the output pipe "fd"
+ * without blocking, now that poll() has said that it is writable.
+ *
+ * That alone only promises room for PIPE_BUF bytes.  Where the pipe's
+ * capacity and the amount queued in it can be read, the room is worked
+ * out in whole pages, which is how Linux stores pipe contents: successive
+ * writes fill up the last page before starting another, so the data
+ * queued takes up at most one more page than it fills, the page the
+ * reader is part way through.  An empty pipe can take its whole capacity.
+ */
+static size_t pv__transfer_pipe_room(int fd, size_t count)
+{
+	size_t room;
+#if defined(F_GETPIPE_SZ) && defined(FIONREAD)
+	long capacity, page_size;
+	int queued;
+
+	page_size = 4096;
+#if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
+	if (sysconf(_SC_PAGESIZE) > 0)
+		page_size = sysconf(_SC_PAGESIZE);
+#endif
+
+	room = PIPE_BUF;
+	if (count <= room)
+		return count;
+
+	queued = 0;
+	capacity = (long) fcntl(fd, F_GETPIPE_SZ);
+	if ((capacity > 0) && (0 == ioctl(fd, FIONREAD, &queued)) && (queued >= 0)) {
+		long pages_free = capacity / page_size;
+		if (queued > 0)
+			pages_free -= (((long) queued + page_size - 1) / page_size) + 1;
+		if ((pages_free > 0) && ((size_t) (pages_free * page_size) > room))
+			room = (size_t) (pages_free * page_size);
+	}
+#else				/* !F_GETPIPE_SZ || !FIONREAD */
+	(void) fd;
+	room = PIPE_BUF;
+#endif				/* F_GETPIPE_SZ && FIONREAD */
+
+	return count < room ? count : room;
+}
+
+
+/*
+ * Set an interval timer or an alarm to interrupt a write with a signal if
+ * it takes too long, if "arm" is true, or clear it again if it is false.
+ */
+static void pv__transfer_write_timer(pvstate_t state, bool arm)
+{
 #if HAVE_SETITIMER
-		memset(&new_timer, 0, sizeof(new_timer));
-		new_timer.it_interval.tv_sec = 0;
-		new_timer.it_interval.tv_usec = 0;
-		new_timer.it_value.tv_sec = 0;
-		new_timer.it_value.tv_usec = 0;
+	struct itimerval new_timer;
+
+	/*@-unrecog@ */
+	/* splint doesn't know setitimer or ITIMER_REAL */
+	memset(&new_timer, 0, sizeof(new_timer));
+
+	if (!arm) {
 		if (0 != setitimer(ITIMER_REAL, &new_timer, NULL)) {
 			pv_error("%s: %s", _("failed to clear interval timer"), strerror(errno));
 		}
-
-		/*@+unrecog@ */
-#else				/* ! HAVE_SETITIMER */
-		debug("%s", "cancelling alarm");
-		(void) alarm(0);
-#endif				/* HAVE_SETITIMER */
+		return;
 	}
 
-      pv__transfer_write_completed:
-	/* If lseek() worked for sparse output, it jumps down here. */
+	new_timer.it_value.tv_sec = (time_t) (state->control.interval);
+	new_timer.it_value.tv_usec = (suseconds_t) (((long) (state->control.interval * 1000000.0)) % 1000000);
 
-	if (nwritten > 0) {
-		bool tracking_lines = false;
+	/*
+	 * We have to set the interval so that the timer continues to repeat
+	 * while writes are attempted, especially as it's possible that the
+	 * initial timer run will expire immediately if the period is less
+	 * than 1 second.
+	 */
 
-		if ((state->control.linemode) && (lineswritten != NULL))
-			tracking_lines = true;
-		else if (state->display.showing_previous_line)
-			tracking_lines = true;
+	new_timer.it_interval.tv_sec = new_timer.it_value.tv_sec;
+	new_timer.it_interval.tv_usec = new_timer.it_value.tv_usec;
 
-		/*
-		 * Write returned >0 - data successfully written.
-		 */
-		if (tracking_lines) {
-			char separator;
-			char *ptr;
-			long lines = 0;
+	debug("%s: [%lds,%ldus]", "setting interval timer", (long) (new_timer.it_value.tv_sec),
+	      (long) (new_timer.it_value.tv_usec));
 
-			/*
-			 * Tracking lines - either line mode, or we're
-			 * showing the last line in the display, or both.
-			 * So we need to look through what we've just
-			 * written to either count how many lines there
-			 * were, or get the content of the most recent
-			 * complete line, or both.
-			 */
+	if (0 != setitimer(ITIMER_REAL, &new_timer, NULL)) {
+		pv_error("%s: %s", _("failed to set interval timer"), strerror(errno));
+	}
 
-			/* Allocate buffer to remember line positions. */
-			if (NULL == state->transfer.line_positions && NULL != lineswritten) {
-				state->transfer.line_positions_capacity = MAX_LINE_POSITIONS;
-				/*@-mustfreeonly@ */
-				state->transfer.line_positions =
-				    calloc((size_t) (state->transfer.line_positions_capacity), sizeof(off_t));
-				if (NULL == state->transfer.line_positions) {
-					pv_error("%s: %s", _("line position buffer allocation failed"),
-						 strerror(errno));
-				}
-				/*@+mustfreeonly@ */
-				/* splint doesn't see we only call calloc() when line_positions is NULL. */
-			}
+	/*@+unrecog@ */
+#else				/* ! HAVE_SETITIMER */
+	if (!arm) {
+		debug("%s", "cancelling alarm");
+		(void) alarm(0);
+		return;
+	}
+	(void) alarm(1);
+	debug("%s", "setting alarm");
+#endif				/* HAVE_SETITIMER */
+}
 
-			if (state->control.null_terminated_lines) {
-				separator = '\0';
-			} else {
-				separator = '\n';
-			}
 
-			ptr = (char *) (state->transfer.transfer_buffer + state->transfer.write_position - 1);
-			for (ptr++;
-			     ptr - (char *) state->transfer.transfer_buffer - state->transfer.write_position <
-			     (size_t) nwritten; ptr++, state->transfer.last_output_position++) {
-				if (*ptr != separator) {
-					/*
-					 * If we're displaying the previous
-					 * line ("%L"), add to our line
-					 * buffer.
-					 */
-					if (state->display.showing_previous_line
-					    && state->display.next_line_len < PV_SIZEOF_PREVLINE_BUFFER - 1) {
-						state->display.next_line[state->display.next_line_len] = *ptr;
-						state->display.next_line_len++;
-					}
-					continue;
-				}
+/*
+ * Write "count" bytes from "buf" to the output, no more than "max_at_once"
+ * at a time, with an interval timer or an alarm set to interrupt the write
+ * with a signal if it takes too long, so we can continue producing
+ * progress information.  In sparse output mode, blocks of null bytes are
+ * skipped by pv__transfer_write_sparse().
+ *
+ * If pv_transfer_output_check() found that the output is a socket, each
+ * write is made with MSG_DONTWAIT, so it can't take long, since it stops
+ * as soon as the output is full, and no timer is needed.  If the output is
+ * a pipe, the write is cut down to what the pipe has room for, which has
+ * the same effect; the caller must have seen, with poll(), that the pipe
+ * is writable.
+ *
+ * Returns the number of bytes written, like write(); on error, the errno
+ * value is put in *write_errno.
+ */
+static ssize_t pv__transfer_write_timed(pvstate_t state, char *buf, size_t count, size_t max_at_once,
+					int *write_errno)
+{
+	ssize_t nwritten;
+	struct timespec io_start;
+	uint64_t profile_start;
 
-				/* Separator found - increment line count. */
-				++lines;
+	if (state->transfer.output_pipe)
+		count = pv__transfer_pipe_room(state->control.output_fd, count);
 
-				/*
-				 * If we're displaying the previous line
-				 * ("%L"), update the previous-line buffer
-				 * with the line we just completed, and
-				 * start a new one.
-				 */
-				if (state->display.showing_previous_line) {
-					memset(state->display.previous_line, 0, PV_SIZEOF_PREVLINE_BUFFER);
-					if (state->display.next_line_len > PV_SIZEOF_PREVLINE_BUFFER - 1)
-						state->display.next_line_len = PV_SIZEOF_PREVLINE_BUFFER - 1;
-					if (state->display.next_line_len > 0) {
-						memcpy(state->display.previous_line, state->display.next_line,	/* flawfinder: ignore */
-						       state->display.next_line_len);
-						debug("%s: [%s]", "updated previous_line",
-						      state->display.previous_line);
-					}
-					state->display.next_line_len = 0;
-					/*
-					 * flawfinder - next_line_len is
-					 * guaranteed to be less than the
-					 * size of the previous_line buffer
-					 * since we check it just before
-					 * memcpy(), and we ensure that the
-					 * last byte in the buffer is \0.
-					 */
-				}
+	if (pv__transfer_write_can_block(state))
+		pv__transfer_write_timer(state, true);
 
-				if (NULL == state->transfer.line_positions)
-					continue;
+	*write_errno = 0;
 
-				/* Store the position of the separator. */
-				state->transfer.line_positions[state->transfer.line_positions_head] =
-				    state->transfer.last_output_position;
-				state->transfer.line_positions_head++;
+	debug("%s: %ld %s", "beginning write attempt", (long) count, "bytes");
+	pv_elapsedtime_read(&io_start);
+	profile_start = pv_profile_begin();
+	if (state->control.sparse_output && !state->transfer.output_not_seekable) {
+		nwritten = pv__transfer_write_sparse(state, buf, count);
+	} else {
+		nwritten = pv__transfer_write_repeated(state->control.output_fd, buf, count, max_at_once,
+						       pv__transfer_sync_each_write(state), state->transfer.output_dontwait);
+	}
+	pv_profile_end(PV_PROFILE_WRITE, profile_start);
+	pv_latency_record(&(state->transfer), PV_LATENCY_WRITE, &io_start);
+	pv_trace_record(&(state->transfer), PV_TRACE_WRITE, state->control.output_fd, (long long) nwritten, &io_start);
+	if (nwritten < 0) {
+		*write_errno = (int) errno;
+		debug("%s: %ld: %s", "bytes written", (long) nwritten, strerror(errno));
+	} else {
+		debug("%s: %ld", "bytes written", (long) nwritten);
+	}
 
-				/* Circular buffer - wrap around. */
-				if (state->transfer.line_positions_head >= state->transfer.line_positions_capacity) {
-					state->transfer.line_positions_head = 0;
-				}
+	if (pv__transfer_write_can_block(state))
+		pv__transfer_write_timer(state, false);
 
-				/* Increment count of line positions, if below capacity. */
-				if (state->transfer.line_positions_length < state->transfer.line_positions_capacity) {
-					state->transfer.line_positions_length++;
-				}
-			}
+	return nwritten;
+}
 
-			if (NULL != lineswritten)
-				*lineswritten += lines;
-		}
 
-		state->transfer.write_position += nwritten;
-		state->transfer.written += nwritten;
+/*
+ * Account for "nwritten" bytes having been written from the transfer
+ * buffer: move the write position on, add them to state->transfer.written,
+ * and if that empties the buffer, rewind it, and set *eof_out if *eof_in
+ * is already set, since everything from this input has now been written.
+ */
+static void pv__transfer_wrote(pvstate_t state, ssize_t nwritten, bool *eof_in, bool *eof_out)
+{
+	state->transfer.write_position += nwritten;
+	state->transfer.written += nwritten;
+
+	if (state->transfer.write_position >= state->transfer.read_position) {
+		state->transfer.write_position = 0;
+		state->transfer.read_position = 0;
+		if (*eof_in)
+			*eof_out = true;
+	}
+}
 
-		/*
-		 * If we're monitoring the output, update our copy of the
-		 * last few bytes we've written.
-		 */
-		if (state->display.showing_last_written && (nwritten > 0)) {
-			size_t new_portion_size, old_portion_size;
 
-			new_portion_size = (size_t) nwritten;
-			if (new_portion_size > state->display.lastwritten_bytes)
-				new_portion_size = state->display.lastwritten_bytes;
+/*
+ * Deal with a write that wrote nothing, "nwritten" being 0 or negative,
+ * with "write_errno" being its errno.  If it was a transient error, or the
+ * write blocked, wait briefly; if the output was closed, set *eof_in and
+ * *eof_out and state->flags.pipe_closed.  Either way, return false.
+ *
+ * Any other error is reported, with *eof_out set, state->transfer.written
+ * set to -1, and state->status.exit_status updated, and true is returned.
+ */
+static bool pv__transfer_write_failed(pvstate_t state, ssize_t nwritten, int write_errno, bool *eof_in,
+				      bool *eof_out)
+{
+	/*
+	 * If a write error occurred but it was EINTR or EAGAIN, or write(2)
+	 * blocked on first write such that nwritten == 0, just wait a bit and
+	 * then return, since this was a transient error.
+	 */
+	if ((0 == nwritten) || (EINTR == write_errno) || (EAGAIN == write_errno)) {
+		if (0 == nwritten) {
+			debug("%s", "attempted write blocked - waiting briefly");
+		} else {
+			debug("%s: %s", "transient write error - waiting briefly", strerror(write_errno));
+		}
+		(void) is_data_ready(-1, NULL, -1, NULL, 10000);
+		return false;
+	}
+
+	/*
+	 * SIGPIPE means we've finished. Don't output an error because it's
+	 * not really our error to report.
+	 */
+	if (EPIPE == write_errno) {
+		*eof_in = true;
+		*eof_out = true;
+		state->flags.pipe_closed = 1;
+		debug("%s", "SIGPIPE received - setting pipe_closed");
+		return false;
+	}
+
+	pv_error("%s: %s", _("write failed"), strerror(write_errno));
+	state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+	*eof_out = true;
+	state->transfer.written = -1;
+
+	return true;
+}
+
+
+/*
+ * Write state->transfer.to_write bytes of data from the transfer buffer to the output.
+ * Returns zero if there was a transient error and we need to return 0 from
+ * pv_transfer, otherwise returns 1.
+ *
+ * Updates state->transfer.write_position by moving it on by the number of bytes
+ * written; adds the number of bytes written to state->transfer.written; sets
+ * *eof_out to true, on output EOF, or when the write position catches up
+ * with the read position AND *eof_in is true (meaning we've reached the end
+ * of data).
+ *
+ * On error, sets *eof_out to true, sets state->transfer.written to -1, and updates
+ * state->status.exit_status.
+ *
+ * If state->control.discard_input is true, does not actually write anything.
+ */
+static int pv__transfer_write(pvstate_t state, bool *eof_in, bool *eof_out, long *lineswritten)
+{
+	ssize_t nwritten;
+	int write_errno;
+	off_t output_offset;
+	struct timespec io_start;
+
+	if (NULL == state->transfer.transfer_buffer) {
+		pv_error("%s", _("no transfer buffer allocated"));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		*eof_out = true;
+		state->transfer.written = -1;
+		return 1;
+	}
+
+	nwritten = 0;
+	write_errno = 0;
+
+	if (state->control.discard_input) {
+		nwritten = state->transfer.to_write;
+	} else if (state->transfer.to_write > 0) {
+
+		/*
+		 * In sparse output mode, check whether all of the bytes to
+		 * be written are null, and if so, try to seek the output
+		 * instead of writing the null bytes.
+		 */
+		if (state->control.sparse_output && !state->transfer.output_not_seekable) {
+			if (pv_zeroscan_all
+			    (state->transfer.transfer_buffer + state->transfer.write_position,
+			     (size_t) (state->transfer.to_write))) {
+
+				/*
+				 * Use lseek() to move forward in the file,
+				 * and then ftruncate() it to its new size.
+				 *
+				 * If any step fails, mark the output not
+				 * seekable so we stop trying.
+				 */
+
+				/*@+longintegral@ */
+				/*
+				 * splint has trouble with off_t / __off_t, in the lseek() call.
+				 */
+				output_offset =
+				    lseek(state->control.output_fd, (off_t) (state->transfer.to_write), SEEK_CUR);
+				if (output_offset == (off_t) - 1) {
+					debug("%s: %s", "output lseek() failed", strerror(errno));
+					state->transfer.output_not_seekable = true;
+				} else {
+					/* Seek successful - skip write. */
+					debug("%s (%ld) -> %s: %ld", "skipped null writes",
+					      (long) (state->transfer.to_write), "new position", (long) output_offset);
+					nwritten = state->transfer.to_write;
+					goto pv__transfer_write_completed;
+				}
+				/*@-longintegral@ */
+			}
+		}
+
+		pv_elapsedtime_read(&io_start);
+		nwritten = pv__transfer_write_timed(state,
+						    state->transfer.transfer_buffer + state->transfer.write_position,
+						    (size_t) (state->transfer.to_write),
+						    pv__transfer_io_limit(state, MAX_WRITE_AT_ONCE), &write_errno);
+		if (state->control.adaptive_buffer)
+			pv_buffer_adapt_record(&(state->transfer), (size_t) (state->transfer.to_write), nwritten,
+					       &io_start);
+	}
+
+      pv__transfer_write_completed:
+	/* If lseek() worked for sparse output, it jumps down here. */
+
+	if (nwritten > 0) {
+		/*
+		 * Write returned >0 - data successfully written.
+		 */
+		pv__transfer_track_written(state, state->transfer.transfer_buffer + state->transfer.write_position,
+					   (size_t) nwritten, lineswritten);
+		pv__transfer_wrote(state, nwritten, eof_in, eof_out);
+		return 1;
+	}
+
+	/*
+	 * If we reach this point, nwritten<=0, so there may be an error.
+	 */
+	return pv__transfer_write_failed(state, nwritten, write_errno, eof_in, eof_out) ? 1 : 0;
+}
+
+
+/*
+ * Size that buffers are aligned to for "--huge-pages": the size of a
+ * transparent huge page on x86-64 and 4KiB-page arm64.
+ */
+#define PV_HUGE_PAGE_SIZE 2097152
+
+/*
+ * Return a pointer to a newly allocated buffer of the given size, aligned
+ * appropriately for the current input and output file descriptors
+ * (important if using O_DIRECT).
+ *
+ * With "--huge-pages" in "control", the buffer is aligned to a huge page
+ * and, where the kernel supports transparent huge pages (only Linux, with
+ * MADV_HUGEPAGE), marked to be backed by them, cutting the TLB misses of
+ * going through multi-megabyte buffers.  With "--lock-buffers", it is
+ * locked into memory.  Either way the buffer is faulted in here, by
+ * zeroing it, rather than during the transfer.  The buffer must be freed
+ * with pv_free_aligned_buffer(), so that it is unlocked again.
+ *
+ * Falls back to unaligned allocation if it was not possible to get an
+ * aligned buffer, or if the relevant operating system features were not
+ * available.  With --direct-io, this means that direct writes may be
+ * rejected, in which case they are retried through the page cache.
+ *
+ * Returns NULL on complete allocation failure.
+ */
+/*@null@*/
+/*@only@*/
+char *pv_allocate_aligned_buffer(pvcontrol_t control, int outfd, int infd, size_t target_size)
+{
+	void *newptr;
+
+#if defined(HAVE_FPATHCONF) && defined(HAVE_POSIX_MEMALIGN) && defined(_PC_REC_XFER_ALIGN)
+	long input_alignment, output_alignment, min_alignment;
+	long required_alignment;
+
+	input_alignment = infd >= 0 ? fpathconf(infd, _PC_REC_XFER_ALIGN) : -1;
+	output_alignment = fpathconf(outfd, _PC_REC_XFER_ALIGN);
+#if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
+	min_alignment = sysconf(_SC_PAGESIZE);
+#else				/* ! defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE) */
+	min_alignment = 8192;
+#endif				/* defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE) */
+
+	if (input_alignment > output_alignment) {
+		required_alignment = input_alignment;
+	} else if (output_alignment > input_alignment) {
+		required_alignment = output_alignment;
+	} else if (input_alignment < min_alignment) {
+		required_alignment = min_alignment;
+	} else {
+		required_alignment = input_alignment;
+	}
+
+	/* Ensure the alignment is at least the page size. */
+	if (required_alignment < min_alignment) {
+		required_alignment = min_alignment;
+	}
+
+	if (control->huge_pages && (required_alignment < PV_HUGE_PAGE_SIZE))
+		required_alignment = PV_HUGE_PAGE_SIZE;
+
+	newptr = NULL;
+
+	/*@-unrecog@ */
+	/* splice doesn't know of posix_memalign(). */
+	if (0 != posix_memalign((void **) (&newptr), (size_t) required_alignment, target_size)) {
+		newptr = malloc(target_size);
+	}
+	/*@+unrecog@ */
+#else				/* ! defined(HAVE_FPATHCONF) && defined(HAVE_POSIX_MEMALIGN) && defined(_PC_REC_XFER_ALIGN) */
+	newptr = malloc(target_size);
+#endif				/* defined(HAVE_FPATHCONF) && defined(HAVE_POSIX_MEMALIGN) && defined(_PC_REC_XFER_ALIGN) */
+
+	if (NULL == newptr)
+		return NULL;
+
+#if defined(HAVE_MMAP) && defined(MADV_HUGEPAGE)
+	/*
+	 * This has to come before the buffer is first touched, so that the
+	 * zeroing below faults it in as huge pages.  Only the whole huge
+	 * pages in the buffer can be backed by them.
+	 */
+	if (control->huge_pages && (0 == ((size_t) newptr % PV_HUGE_PAGE_SIZE))
+	    && (target_size >= PV_HUGE_PAGE_SIZE)) {
+		if (0 != madvise(newptr, target_size - (target_size % PV_HUGE_PAGE_SIZE), MADV_HUGEPAGE))
+			debug("%s: %s", "madvise MADV_HUGEPAGE", strerror(errno));
+	}
+#endif				/* HAVE_MMAP && MADV_HUGEPAGE */
+
+	/* As with huge pages, this has to happen before the first touch. */
+	pv_numa_bind_buffer(newptr, target_size);
+
+	/* Initialise the buffer with zeroes, which also faults it in. */
+	memset(newptr, 0, target_size);
+
+#ifdef HAVE_MMAP
+	/*
+	 * A buffer which can't be locked is still usable, so only say so,
+	 * and only the first time.
+	 */
+	if (control->lock_buffers && (0 != mlock(newptr, target_size)) && (!control->buffer_lock_warned)) {
+		pv_error("%s: %s", _("failed to lock buffer into memory"), strerror(errno));
+		control->buffer_lock_warned = true;
+	}
+#endif				/* HAVE_MMAP */
+
+	return newptr;
+}
+
+
+/*
+ * Free a buffer of "size" bytes from pv_allocate_aligned_buffer(),
+ * unlocking it first in case it was locked by "--lock-buffers".  Unlocking
+ * memory which isn't locked does nothing, so this doesn't need to know
+ * whether the option was in effect when the buffer was allocated.
+ */
+void pv_free_aligned_buffer( /*@only@ */ /*@null@ */ char *buffer, size_t size)
+{
+	if (NULL == buffer)
+		return;
+#ifdef HAVE_MMAP
+	(void) munlock(buffer, size);
+#else
+	(void) size;
+#endif
+	free(buffer);
+}
+
+
+#ifdef HAVE_PTHREAD
+/*
+ * If --pipeline is in effect, move data read by the reader thread into the
+ * transfer buffer, starting the thread first if necessary, and return
+ * true.  Returns false if the reader thread is not in use, in which case
+ * the caller should read from "fd" itself.
+ *
+ * The reader thread is not used with --skip-errors, since skipping past
+ * errors relies on each seek being done in step with the failed read.
+ *
+ * Sets *eof_in (and *eof_out, if the buffer is empty) once the reader
+ * thread has reached the end of the input, or hit a read error.
+ */
+static bool pv__transfer_pipeline_read(pvstate_t state, int fd, bool *eof_in, bool *eof_out)
+{
+	ssize_t fetched;
+	int read_errno;
+	long wait_usec;
+
+	if ((state->control.pipeline_buffers < 2) || (state->control.skip_errors > 0)
+	    || (PV_CODEC_NONE != state->control.codec))
+		return false;
+
+	if (NULL == state->transfer.pipeline) {
+		off_t read_limit = -1;
+
+		/* As in pv__transfer_read(), don't read past --size (#166). */
+		if (state->control.stop_at_size && !state->control.linemode) {
+			read_limit = state->control.size - state->transfer.total_bytes_read;
+			if (read_limit < 0)
+				read_limit = 0;
+		}
+
+		if (!pv_pipeline_start
+		    (&(state->transfer), &(state->control), fd, state->control.output_fd,
+		     state->control.pipeline_buffers, state->transfer.buffer_size, read_limit)) {
+			/* Fall back to reading directly from now on. */
+			debug("%s", "failed to start reader thread - disabling pipeline");
+			state->control.pipeline_buffers = 0;
+			return false;
+		}
+	}
+
+	/*
+	 * Only wait for the reader thread if there is nothing in the
+	 * buffer to write in the meantime.
+	 */
+	wait_usec = 0;
+	if (state->transfer.write_position >= state->transfer.read_position)
+		wait_usec = pv__transfer_wait_usec(state);
+
+	read_errno = 0;
+	fetched = pv_pipeline_fetch(&(state->transfer), wait_usec, &read_errno);
+
+	if (fetched >= 0) {
+		state->transfer.total_bytes_read += fetched;
+		return true;
+	}
+
+	/*
+	 * The reader thread has finished, and everything it read has been
+	 * taken, so this input file has ended, either normally or with an
+	 * error.
+	 */
+	pv_pipeline_stop(&(state->transfer));
+
+	if (0 != read_errno) {
+		/*@-compdef@ */
+		pv_error("%s: %s: %s", pv_current_file_name(state), _("read failed"), strerror(read_errno));
+		/*@+compdef@ */
+		/* splint - see pv_current_file_name() calls in pv__transfer_read(). */
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+	}
+
+	*eof_in = true;
+	if (state->transfer.write_position >= state->transfer.read_position)
+		*eof_out = true;
+
+	return true;
+}
+#endif				/* HAVE_PTHREAD */
+
+
+#ifdef HAVE_PTHREAD
+/*
+ * Return true if --direct-io is in effect and the transfer of "fd" can go
+ * through the direct I/O path in directio.c, starting it first if
+ * necessary.
+ *
+ * Direct I/O needs every write to be a whole number of blocks, so it
+ * can't be used with anything that decides for itself how much to write,
+ * such as line mode or sparse output, or with --skip-errors, which seeks
+ * the input in step with each failed read; in those cases the data goes
+ * through the page cache as usual.
+ */
+static bool pv__transfer_direct_active(pvstate_t state, int fd)
+{
+	if (!state->control.direct_io)
+		return false;
+
+	if (NULL != state->transfer.directio) {
+		if (pv_directio_input_fd(&(state->transfer)) == fd)
+			return true;
+		pv_directio_stop(&(state->transfer));
+	}
+
+	if (state->control.linemode || state->control.sparse_output || state->control.discard_input
+	    || (state->control.skip_errors > 0) || (PV_CODEC_NONE != state->control.codec)) {
+		debug("%s", "direct I/O not usable with the selected options - using the page cache");
+		state->control.direct_io = false;
+		return false;
+	}
+
+	/* Don't try again on an input which has already been turned down. */
+	if (fd == state->transfer.direct_checked_fd)
+		return false;
+
+	/* Don't switch over with data still waiting in the transfer buffer. */
+	if (state->transfer.write_position < state->transfer.read_position)
+		return false;
+
+	if (!pv_directio_start(state, fd)) {
+		state->transfer.direct_checked_fd = fd;
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Transfer some data from "fd" to the output through the direct I/O path,
+ * writing out what the reader thread in directio.c has read, in whole
+ * output blocks, except for a final partial block, which is written
+ * through the page cache.
+ *
+ * Returns and sets *eof_in and *eof_out in the same way as pv_transfer().
+ */
+static ssize_t pv__transfer_direct(pvstate_t state, /*@unused@ */ int fd, bool *eof_in, bool *eof_out,
+				   off_t allowed, long *lineswritten)
+{
+	char *data;
+	ssize_t available, nwritten;
+	size_t count, block_size;
+	int read_errno, write_errno;
+
+	(void) fd;
+
+	state->transfer.written = 0;
+
+	data = NULL;
+	read_errno = 0;
+	available = pv_directio_fetch(&(state->transfer), pv__transfer_wait_usec(state), &data, &read_errno);
+
+	if (available < 0) {
+		/* Everything that was read has been written. */
+		pv_directio_stop(&(state->transfer));
+		if (0 != read_errno) {
+			/*@-compdef@ */
+			pv_error("%s: %s: %s", pv_current_file_name(state), _("read failed"), strerror(read_errno));
+			/*@+compdef@ */
+			/* splint - see pv_current_file_name() calls in pv__transfer_read(). */
+			state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		}
+		*eof_in = true;
+		*eof_out = true;
+		return 0;
+	}
+
+	if ((0 == available) || (NULL == data))
+		return 0;
+
+	count = (size_t) available;
+	if (((state->control.rate_limit > 0) || (allowed > 0)) && ((off_t) count > allowed))
+		count = (size_t) allowed;
+	if (0 == count) {
+		/* Nothing allowed yet - pause until the next rate limit step. */
+		(void) is_data_ready(-1, NULL, -1, NULL, pv__transfer_wait_usec(state));
+		return 0;
+	}
+
+	/*
+	 * Write whole blocks directly.  A rate limit step smaller than a
+	 * block is rounded up to one block, since the main loop takes what
+	 * was written off the rate allowance and so catches up afterwards;
+	 * anything else smaller than a block is the tail of the data, and
+	 * goes through the page cache instead.
+	 */
+	block_size = pv_directio_output_block(&(state->transfer));
+	if ((count < block_size) && ((size_t) available >= block_size) && (state->control.rate_limit > 0))
+		count = block_size;
+	if (count >= block_size) {
+		count -= count % block_size;
+	} else {
+		pv_directio_output_buffered(&(state->transfer));
+	}
+
+	/*
+	 * A write to a pipe is only cut down to the room it has if it has
+	 * been seen to be writable, as pv__transfer_write_timed() expects.
+	 */
+	if (state->transfer.output_pipe) {
+		bool ready_to_write = false;
+		if (pv_poller_wait(&(state->transfer), -1, NULL, state->control.output_fd, &ready_to_write,
+				   pv__transfer_wait_usec(state)) < 0)
+			return 0;
+		if (!ready_to_write)
+			return 0;
+	}
+
+	nwritten = pv__transfer_write_timed(state, data, count, MAX_WRITE_AT_ONCE, &write_errno);
+
+	if ((nwritten < 0) && (EINVAL == write_errno) && (block_size > 1)) {
+		debug("%s", "direct write rejected - retrying through the page cache");
+		pv_directio_output_buffered(&(state->transfer));
+		nwritten = pv__transfer_write_timed(state, data, count, MAX_WRITE_AT_ONCE, &write_errno);
+	}
+
+	if (nwritten > 0) {
+		/* After a short write, the output is no longer block aligned. */
+		if (0 != ((size_t) nwritten % block_size))
+			pv_directio_output_buffered(&(state->transfer));
+		pv__transfer_track_written(state, data, (size_t) nwritten, lineswritten);
+		pv_directio_consume(&(state->transfer), (size_t) nwritten);
+		state->transfer.written = nwritten;
+		return nwritten;
+	}
+
+	/* As in pv__transfer_write(), wait briefly after a transient error. */
+	if ((0 == nwritten) || (EINTR == write_errno) || (EAGAIN == write_errno)) {
+		(void) is_data_ready(-1, NULL, -1, NULL, 10000);
+		return 0;
+	}
+
+	if (EPIPE == write_errno) {
+		*eof_in = true;
+		*eof_out = true;
+		state->flags.pipe_closed = 1;
+		debug("%s", "SIGPIPE received - setting pipe_closed");
+		return 0;
+	}
+
+	pv_error("%s: %s", _("write failed"), strerror(write_errno));
+	state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+	*eof_out = true;
+
+	return -1;
+}
+#endif				/* HAVE_PTHREAD */
+
+
+#ifdef HAVE_LINUX_IO_URING_H
+/*
+ * Return true if "--engine io_uring" is in effect and the transfer of
+ * "fd" can go through the io_uring, setting it up first if necessary.
+ *
+ * The io_uring moves data straight from its own buffers to the output, so
+ * it can't be used with anything that needs to look at or alter the data
+ * on the way through, in the same way as splice(); in those cases, and if
+ * the io_uring can't be set up at all, we quietly fall back to read() and
+ * write().
+ */
+static bool pv__transfer_uring_active(pvstate_t state, int fd)
+{
+	if (PV_IOENGINE_IO_URING != state->control.io_engine)
+		return false;
+
+	if (NULL != state->transfer.uring)
+		return true;
+
+	if (state->control.linemode || state->control.sparse_output || state->control.discard_input
+	    || state->control.sync_after_write || (state->control.skip_errors > 0)
+	    || (state->control.pipeline_buffers > 0)
+	    || state->display.showing_last_written || state->display.showing_previous_line
+	    || pv__transfer_data_needed(state) || (PV_CODEC_NONE != state->control.codec)) {
+		debug("%s", "io_uring not usable with the selected options - using read/write");
+		state->control.io_engine = PV_IOENGINE_READWRITE;
+		return false;
+	}
+
+	/* Don't switch over with data still waiting in the transfer buffer. */
+	if (state->transfer.write_position < state->transfer.read_position)
+		return false;
+
+	if (!pv_uring_start(state, fd)) {
+		debug("%s", "io_uring could not be set up - using read/write");
+		state->control.io_engine = PV_IOENGINE_READWRITE;
+		return false;
+	}
+
+	return true;
+}
+#endif				/* HAVE_LINUX_IO_URING_H */
+
+
+#ifdef HAVE_MMAP
+/*
+ * Return true if "--engine mmap" is in effect and "fd" can be read through
+ * a memory mapping, setting one up first if necessary.
+ *
+ * A read error in a mapping raises SIGBUS instead of failing a read(), so
+ * the mapping is not used with --skip-errors, and neither is it used with
+ * --discard or --pipeline, which read the input in their own way; in those
+ * cases we fall back to read() and write().  An input which can't be
+ * mapped, such as a pipe, is read in the usual way.
+ */
+static bool pv__transfer_mmap_active(pvstate_t state, int fd)
+{
+	if (PV_IOENGINE_MMAP != state->control.io_engine)
+		return false;
+
+	if (NULL != state->transfer.mmapin) {
+		if (pv_mmapin_input_fd(&(state->transfer)) == fd)
+			return true;
+		pv_mmapin_stop(&(state->transfer));
+	}
+
+	if (state->control.discard_input || (state->control.skip_errors > 0)
+	    || (state->control.pipeline_buffers > 0) || (PV_CODEC_NONE != state->control.codec)) {
+		debug("%s", "mmap not usable with the selected options - using read/write");
+		state->control.io_engine = PV_IOENGINE_READWRITE;
+		return false;
+	}
+
+	/* Don't try again on an input which has already been turned down. */
+	if (fd == state->transfer.mmap_checked_fd)
+		return false;
+
+	/* Don't switch over with data still waiting in the transfer buffer. */
+	if (state->transfer.write_position < state->transfer.read_position)
+		return false;
+
+	if (!pv_mmapin_start(state, fd)) {
+		state->transfer.mmap_checked_fd = fd;
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Transfer some data from "fd" to the output straight from its memory
+ * mapping, without copying it into the transfer buffer first.  If the
+ * output is a pipe, the mapped pages are handed to it with vmsplice()
+ * where possible.  In sparse output mode, holes in the input are skipped
+ * without being touched, as in pv__transfer_read().
+ *
+ * Returns and sets *eof_in and *eof_out in the same way as pv_transfer().
+ */
+static ssize_t pv__transfer_mmap(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed,
+				 long *lineswritten)
+{
+	struct timespec wait_start;
+	char *data;
+	ssize_t available, nwritten;
+	size_t count;
+	bool ready_to_write;
+	int write_errno, n;
+
+	state->transfer.written = 0;
+
+	if (state->control.sparse_output && (!state->transfer.output_not_seekable) && (!state->control.linemode)
+	    && (!state->display.showing_last_written) && (!pv__transfer_data_needed(state))) {
+		off_t hole_limit = (off_t) SSIZE_MAX;
+		off_t skipped = 0;
+
+		if (state->control.stop_at_size && (state->control.size - state->transfer.total_bytes_read < hole_limit))
+			hole_limit = state->control.size - state->transfer.total_bytes_read;
+		if ((state->control.rate_limit > 0 || allowed != 0) && (allowed < hole_limit))
+			hole_limit = allowed;
+
+		if (hole_limit > 0)
+			skipped = pv__transfer_skip_input_hole(state, fd, hole_limit);
+
+		if (skipped > 0) {
+			pv_mmapin_consume(state, (size_t) skipped);
+			state->transfer.written = (ssize_t) skipped;
+			return (ssize_t) skipped;
+		}
+	}
+
+	data = NULL;
+	available = pv_mmapin_fetch(state, &data);
+
+	/* Don't go past control.size if stop_at_size is true, as in pv__transfer_read(). */
+	if ((available > 0) && state->control.stop_at_size && !state->control.linemode) {
+		off_t bytes_remaining_to_read = state->control.size - state->transfer.total_bytes_read;
+		if (bytes_remaining_to_read <= 0) {
+			available = -1;
+		} else if ((off_t) available > bytes_remaining_to_read) {
+			available = (ssize_t) bytes_remaining_to_read;
+		}
+	}
+
+	if (available < 0) {
+		pv_mmapin_stop(&(state->transfer));
+		*eof_in = true;
+		*eof_out = true;
+		return 0;
+	}
+
+	if ((0 == available) || (NULL == data))
+		return 0;
+
+	count = (size_t) available;
+	if (state->control.linemode) {
+		/* In line mode, write whole lines, counting the allowance in lines. */
+		count = pv__transfer_line_cut(state, data, count, allowed);
+	} else if (((state->control.rate_limit > 0) || (allowed > 0)) && ((off_t) count > allowed))
+		count = (size_t) allowed;
+	if (0 == count) {
+		/* Nothing allowed yet - pause until the next rate limit step. */
+		(void) is_data_ready(-1, NULL, -1, NULL, pv__transfer_wait_usec(state));
+		return 0;
+	}
+
+	ready_to_write = false;
+	pv_elapsedtime_read(&wait_start);
+	n = pv_poller_wait(&(state->transfer), -1, NULL, state->control.output_fd, &ready_to_write,
+			   pv__transfer_wait_usec(state));
+	pv_latency_record(&(state->transfer), PV_LATENCY_WAIT_OUTPUT, &wait_start);
+	if ((n < 0) && (EINTR != errno)) {
+		pv_error("%s: %s: %d: %s", pv_current_file_name(state), _("poll call failed"), n, strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		return -1;
+	}
+	if (!ready_to_write)
+		return 0;
+
+	nwritten = -1;
+	write_errno = 0;
+
+#ifdef HAVE_SPLICE
+	if (pv_mmapin_splice_output(&(state->transfer))) {
+		struct timespec io_start;
+		uint64_t profile_start;
+		struct iovec iov;
+
+		iov.iov_base = data;
+		iov.iov_len = pv__transfer_io_limit(state, MAX_WRITE_AT_ONCE);
+		if (iov.iov_len > count)
+			iov.iov_len = count;
+
+		pv_elapsedtime_read(&io_start);
+		profile_start = pv_profile_begin();
+		/*@-type@ *//* splint doesn't know about vmsplice */
+		nwritten = vmsplice(state->control.output_fd, &iov, 1, SPLICE_F_NONBLOCK);
+		/*@+type@ */
+		pv_profile_end(PV_PROFILE_SPLICE, profile_start);
+		pv_latency_record(&(state->transfer), PV_LATENCY_SPLICE, &io_start);
+		pv_trace_record(&(state->transfer), PV_TRACE_SPLICE, state->control.output_fd, (long long) nwritten,
+				&io_start);
+
+		if (nwritten < 0) {
+			write_errno = (int) errno;
+			if ((EINVAL == write_errno) || (ENOSYS == write_errno)) {
+				debug("%s: %s", "vmsplice failed - using write", strerror(write_errno));
+				pv_mmapin_no_splice(&(state->transfer));
+			}
+		}
+	}
+	if (!pv_mmapin_splice_output(&(state->transfer)))
+#endif				/* HAVE_SPLICE */
+		nwritten =
+		    pv__transfer_write_timed(state, data, count, pv__transfer_io_limit(state, MAX_WRITE_AT_ONCE),
+					     &write_errno);
+
+	if (nwritten > 0) {
+		pv__transfer_track_written(state, data, (size_t) nwritten, lineswritten);
+		pv_mmapin_consume(state, (size_t) nwritten);
+		state->transfer.written = nwritten;
+		return nwritten;
+	}
+
+	/* As in pv__transfer_write(), wait briefly after a transient error. */
+	if ((0 == nwritten) || (EINTR == write_errno) || (EAGAIN == write_errno)) {
+		(void) is_data_ready(-1, NULL, -1, NULL, 10000);
+		return 0;
+	}
+
+	if (EPIPE == write_errno) {
+		*eof_in = true;
+		*eof_out = true;
+		state->flags.pipe_closed = 1;
+		debug("%s", "SIGPIPE received - setting pipe_closed");
+		return 0;
+	}
+
+	pv_error("%s: %s", _("write failed"), strerror(write_errno));
+	state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+	*eof_out = true;
+
+	return -1;
+}
+#endif				/* HAVE_MMAP */
+
+
+/*
+ * Check whether the output "fd" is a socket, in which case writes to it are
+ * made with MSG_DONTWAIT, so that writing to it when it is full returns at
+ * once rather than blocking until interrupted by the write timer, or a
+ * pipe, in which case each write is cut down to the room poll() found for
+ * it, to the same effect.  The wait for the output to have room then
+ * happens in pv_transfer(), along with the wait for input, and no longer
+ * than until the next display update.
+ *
+ * The descriptor's own flags are left alone, since they are shared with
+ * anything else which has the same open file, such as the other stages of
+ * a pipeline.
+ */
+void pv_transfer_output_check(pvstate_t state, int fd)
+{
+	struct stat sb;
+
+	state->transfer.output_dontwait = false;
+	state->transfer.output_pipe = false;
+
+	memset(&sb, 0, sizeof(sb));
+	if ((fd < 0) || (0 != fstat(fd, &sb)))
+		return;
+
+	if (S_ISFIFO(sb.st_mode)) {
+		state->transfer.output_pipe = true;
+		debug("%s %d: %s", "fd", fd, "output is a pipe - writes limited to its free space");
+	}
+#ifdef MSG_DONTWAIT
+	if (S_ISSOCK(sb.st_mode)) {
+		state->transfer.output_dontwait = true;
+		debug("%s %d: %s", "fd", fd, "output is a socket - no write timer needed");
+	}
+#endif
+}
+
+
+/*
+ * Deal with the I/O wait on "fd" having failed: returns 0 if it was only
+ * interrupted, so that pv_transfer() can just be called again; otherwise
+ * reports the error, updates state->status.exit_status, and returns -1.
+ */
+static ssize_t pv__transfer_wait_failed(pvstate_t state, /*@unused@ */ int fd, int n)
+{
+	(void) fd;			    /* only used in debug(). */
+
+	/*
+	 * Ignore transient errors by returning 0 immediately.
+	 */
+	if (EINTR == errno) {
+		debug("%s %d: %s", "fd", fd, "early return 0 - is_data_ready < 0");
+		return 0;
+	}
+
+	/*
+	 * Any other error is a problem and we must report back.
+	 */
+	/*@-compdef@ */
+	pv_error("%s: %s: %d: %s", pv_current_file_name(state), _("poll call failed"), n, strerror(errno));
+	/*@+compdef@ */
+	/* splint - see previous pv_current_file_name() calls. */
+
+	state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+
+	return -1;
+}
+
+
+/*
+ * With MAXIMISE_BUFFER_FILL, rotate the written bytes out of the transfer
+ * buffer so that it can be filled up completely by the next read;
+ * otherwise, do nothing, leaving the buffer to be rewound when it empties.
+ */
+static void pv__transfer_buffer_compact(pvstate_t state)
+{
+#ifdef MAXIMISE_BUFFER_FILL
+	if (state->transfer.write_position > 0) {
+		if (state->transfer.write_position < state->transfer.read_position) {
+			memmove(state->transfer.transfer_buffer,
+				state->transfer.transfer_buffer +
+				state->transfer.write_position,
+				state->transfer.read_position - state->transfer.write_position);
+			state->transfer.read_position -= state->transfer.write_position;
+			state->transfer.write_position = 0;
+		} else {
+			state->transfer.write_position = 0;
+			state->transfer.read_position = 0;
+		}
+	}
+#else				/* !MAXIMISE_BUFFER_FILL */
+	(void) state;
+#endif				/* MAXIMISE_BUFFER_FILL */
+}
+
+
+/*
+ * Transfer some data from "fd" to the output through the transfer buffer,
+ * reading it in and writing it out, or moving it around the buffer with
+ * splice(), tee(), copy_file_range() or sendfile() where the two ends and
+ * the options allow; this is the engine that is used when none of the
+ * others is.
+ *
+ * Returns and sets *eof_in and *eof_out in the same way as pv_transfer().
+ */
+static ssize_t pv__transfer_buffered(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed,
+				     long *lineswritten)
+{
+	struct timespec wait_start;
+	bool ready_to_read, ready_to_write;
+	bool reading_from_pipeline, was_empty;
+	int check_read_fd, check_write_fd;
+	long coalesce_usec;
+	int n;
+
+	/*
+	 * If a reader thread is supplying the input, collect what it has
+	 * read so far, instead of reading from the input ourselves.
+	 */
+	reading_from_pipeline = false;
+#ifdef HAVE_PTHREAD
+	if ((!(*eof_in)) && (state->transfer.read_position < state->transfer.buffer_size)) {
+		reading_from_pipeline = pv__transfer_pipeline_read(state, fd, eof_in, eof_out);
+	} else if (NULL != state->transfer.pipeline) {
+		reading_from_pipeline = true;
+	}
+#endif				/* HAVE_PTHREAD */
+
+	check_read_fd = -1;
+	check_write_fd = -1;
+
+	/*
+	 * If the input file is not at EOF and there's room in the buffer,
+	 * look for incoming data from it.
+	 */
+	if ((!reading_from_pipeline) && (!(*eof_in))
+	    && (state->transfer.read_position < state->transfer.buffer_size)) {
+		check_read_fd = fd;
+	}
+
+	/*
+	 * Work out how much we're allowed to write, based on the amount of
+	 * data left in the buffer.  If rate limiting is active or "allowed"
+	 * is >0, then this puts an upper limit on how much we're allowed to
+	 * write.
+	 */
+	state->transfer.to_write = (ssize_t) (state->transfer.read_position - state->transfer.write_position);
+	if (state->control.linemode) {
+		/* In line mode, "allowed" is in lines, applied below. */
+		if (0 == pv__transfer_line_limit(state, allowed))
+			state->transfer.to_write = 0;
+	} else if ((state->control.rate_limit > 0) || (allowed > 0)) {
+		if ((off_t) (state->transfer.to_write) > allowed) {
+			state->transfer.to_write = (ssize_t) allowed;
+		}
+	}
+
+	/*
+	 * If we don't think we've finished writing and there's anything
+	 * we're allowed to write, look for the output becoming writable -
+	 * unless it is being held back by "--coalesce", in which case we
+	 * only wait for more input until it is due to be written.
+	 */
+	coalesce_usec = -1;
+	if ((!(*eof_out)) && (state->transfer.to_write > 0)
+	    && (!pv__transfer_coalesce_hold(state, *eof_in, &coalesce_usec))) {
+		check_write_fd = state->control.output_fd;
+	}
+
+	ready_to_read = false;
+	ready_to_write = false;
+	if (reading_from_pipeline && (check_write_fd < 0)) {
+		/*
+		 * Nothing to wait for here - pv_pipeline_fetch() has
+		 * already waited for the reader thread.
+		 */
+		n = 0;
+	} else {
+		long wait_usec = pv__transfer_wait_usec(state);
+		bool codec_holding;
+
+		/*
+		 * If the codec is still holding input or output, there is
+		 * something to read whether or not the input is ready.
+		 */
+		codec_holding = (check_read_fd >= 0) && pv_codec_holding(&(state->transfer));
+		if (codec_holding)
+			wait_usec = 0;
+		if ((coalesce_usec >= 0) && (coalesce_usec < wait_usec))
+			wait_usec = coalesce_usec;
+
+		pv_elapsedtime_read(&wait_start);
+		n = pv_poller_wait(&(state->transfer), check_read_fd, &ready_to_read, check_write_fd, &ready_to_write,
+				   wait_usec);
+		if (codec_holding)
+			ready_to_read = true;
+		/*
+		 * Waits with nothing to wait for are just pauses for the
+		 * rate limit, so they aren't counted as blocking.
+		 */
+		if ((check_read_fd >= 0) && (check_write_fd >= 0)) {
+			pv_latency_record(&(state->transfer), PV_LATENCY_WAIT_EITHER, &wait_start);
+		} else if (check_read_fd >= 0) {
+			pv_latency_record(&(state->transfer), PV_LATENCY_WAIT_INPUT, &wait_start);
+		} else if (check_write_fd >= 0) {
+			pv_latency_record(&(state->transfer), PV_LATENCY_WAIT_OUTPUT, &wait_start);
+		}
+	}
+
+	if (n < 0)
+		return pv__transfer_wait_failed(state, fd, n);
+
+	state->transfer.written = 0;
+
+#ifdef HAVE_SPLICE
+	/*
+	 * If splice() is only being held back because the display needs to
+	 * see the data, and both ends are pipes, use tee() and splice()
+	 * instead of reading it in and writing it out.
+	 */
+	if (ready_to_read && pv__transfer_tee_usable(state, fd)) {
+		int tee_result = pv__transfer_tee(state, fd, eof_in, eof_out, allowed, lineswritten);
+		if (0 == tee_result)
+			return 0;
+		if (tee_result > 0) {
+			if (state->transfer.written > 0)
+				pv__transfer_engine_note(state, fd, PV_TRANSFER_ENGINE_TEE);
+			return state->transfer.written;
+		}
+	}
+#endif				/* HAVE_SPLICE */
+
+	/*
+	 * If there is data to read, try to read some in. Return early if
+	 * there was a transient read error.
+	 *
+	 * NB this can update state->transfer.written because of splice().
+	 */
+	if (ready_to_read) {
+		was_empty = (state->transfer.read_position == state->transfer.write_position);
+		if (pv__transfer_read(state, fd, eof_in, eof_out, allowed) == 0) {
+			debug("%s %d: %s (%s=%s, %s=%s, %s=%lu)", "fd", fd,
+			      "early return 0 - pv__transfer_read returned 0", "eof_in", eof_in ? "true" : "false",
+			      "eof_out", eof_out ? "true" : "false", "allowed", (unsigned long) allowed);
+			return 0;
+		}
+		/* Note when the first data to be held back by --coalesce arrived. */
+		if ((state->control.coalesce > 0) && was_empty
+		    && (state->transfer.read_position > state->transfer.write_position))
+			pv_elapsedtime_read(&(state->transfer.coalesce_since));
+	}
+
+	/*
+	 * In line mode, only write up to and including the last newline,
+	 * so that we're writing output line-by-line, or with --record, up
+	 * to the end of the last whole record.
+	 */
+	if ((state->transfer.to_write > 0) && (state->control.linemode)) {
+		char *start;
+
+		start = (char *) (state->transfer.transfer_buffer + state->transfer.write_position);
+		state->transfer.to_write =
+		    (ssize_t) pv__transfer_line_cut(state, start, (size_t) (state->transfer.to_write), allowed);
+	}
+
+	/*
+	 * If there is data to write, and the output is ready to receive it,
+	 * and we didn't use splice() this time, write some data. 
+	 * Return early if there was a transient write error.
+	 */
+	if (ready_to_write
+#ifdef HAVE_SPLICE
+	    && (!state->transfer.splice_used)
+#endif				/* HAVE_SPLICE */
+	    && (state->transfer.read_position > state->transfer.write_position)
+	    && (state->transfer.to_write > 0)
+	    && (NULL != lineswritten)) {
+		if (pv__transfer_write(state, eof_in, eof_out, lineswritten) == 0) {
+			debug("%s %d: %s (%s=%s, %s=%s, %s=%lu)", "fd", fd,
+			      "early return 0 - pv__transfer_write returned 0", "eof_in", eof_in ? "true" : "false",
+			      "eof_out", eof_out ? "true" : "false", "lineswritten", (unsigned long) lineswritten);
+			return 0;
+		}
+		if (state->transfer.written > 0)
+			pv__transfer_engine_note(state, fd, PV_TRANSFER_ENGINE_READWRITE);
+	}
+
+	pv__transfer_buffer_compact(state);
+
+	if (0 == state->transfer.written) {
+		debug("%s %d: %s", "fd", fd, "end-of-function return 0 - transfer.written is zero");
+	}
+
+	return state->transfer.written;
+}
+
+/*
+ * Return true if --rescue is in effect, in which case the input is read
+ * out of order, following the rescue map, so none of the other engines
+ * apply.
+ */
+static bool pv__transfer_rescue_usable(pvstate_t state, /*@unused@ */ int fd)
+{
+	(void) fd;
+	return (NULL != state->control.rescue_map) ? true : false;
+}
+
+
+/*
+ * Transfer some data from "fd" with --rescue, or while the rate limit
+ * holds us back, just wait.
+ */
+static ssize_t pv__transfer_rescue(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed,
+				   /*@unused@ */ long *lineswritten)
+{
+	(void) lineswritten;
+	if ((state->control.rate_limit > 0) && (allowed <= 0)) {
+		(void) is_data_ready(-1, NULL, -1, NULL, pv__transfer_wait_usec(state));
+		return 0;
+	}
+	return pv_rescue_transfer(state, fd, eof_in, eof_out, allowed);
+}
+
+
+#ifdef HAVE_LINUX_IO_URING_H
+/*
+ * Transfer some data from "fd" through the io_uring, which does both the
+ * reading and the writing, and whose completion timeouts replace the
+ * select() and interval timer of the buffered engine.
+ */
+static ssize_t pv__transfer_uring(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed,
+				  /*@unused@ */ long *lineswritten)
+{
+	(void) lineswritten;
+	return pv_uring_transfer(state, fd, eof_in, eof_out, allowed);
+}
+#endif				/* HAVE_LINUX_IO_URING_H */
+
+
+/*
+ * Return true if, with the options that can't change during the transfer,
+ * the data can go through one of the specialised loops below - that is,
+ * it is only read into the buffer and written out again, with nothing
+ * else looking at it or holding it back on the way.
+ */
+static bool pv__transfer_fast_eligible(pvstate_t state)
+{
+	if ((PV_CODEC_NONE != state->control.codec) || pv__transfer_data_needed(state)
+	    || state->control.sparse_output || state->control.discard_input || state->control.stop_at_size
+	    || state->control.adaptive_buffer || (state->control.coalesce > 0) || (state->control.skip_errors > 0)
+	    || (state->control.pipeline_buffers > 1) || pv__transfer_sync_each_write(state)
+	    || (PV_RECORD_NONE != state->control.record.type))
+		return false;
+	return true;
+}
+
+
+/*
+ * Return true if the transfer from "fd" can go through one of the
+ * specialised loops.  The options that can't change are only looked at
+ * once for each input; whether the kernel may yet move the data with
+ * splice() or copy_file_range(), which the buffered engine would rather
+ * do, and what the display shows, which "--remote" can change, are looked
+ * at every time.
+ */
+static bool pv__transfer_fast_usable(pvstate_t state, int fd)
+{
+	if (fd != state->transfer.fast_checked_fd) {
+		state->transfer.fast_checked_fd = fd;
+		state->transfer.fast_eligible = pv__transfer_fast_eligible(state);
+	}
+
+	if (!state->transfer.fast_eligible)
+		return false;
+
+	if (state->display.showing_last_written || state->display.showing_previous_line)
+		return false;
+
+#ifdef HAVE_SPLICE
+	if ((!state->control.linemode) && (!state->control.no_splice)
+	    && (PV_IOENGINE_READWRITE != state->control.io_engine)) {
+		if (fd != state->transfer.splice_failed_fd)
+			return false;
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SYS_SENDFILE_H)
+		if (PV_COPY_METHOD_NONE != pv__transfer_copy_method(state, fd))
+			return false;
+#endif
+	}
+#endif				/* HAVE_SPLICE */
+
+	return true;
+}
+
+
+/*
+ * The body of the specialised loops: one step of waiting for the input
+ * and output, reading into the buffer, and writing out from it, as
+ * pv__transfer_buffered() does, but with only the steps that "bytes" or
+ * "lines" with or without a rate limit need.  It is only called with
+ * constant "rate_limited" and "line_mode", so where the compiler chooses
+ * to inline it, the tests on them fold away.  The handling of errors, the
+ * end of the input, and the buffer afterwards is shared with
+ * pv__transfer_buffered().
+ *
+ * Returns and sets *eof_in and *eof_out in the same way as pv_transfer().
+ */
+static ssize_t pv__transfer_fast(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed, long *lineswritten,
+			  const bool rate_limited, const bool line_mode)
+{
+	struct timespec wait_start, io_start;
+	bool ready_to_read, ready_to_write;
+	int check_read_fd, check_write_fd;
+	uint64_t profile_start;
+	ssize_t nread, nwritten;
+	int n, write_errno;
 
-			old_portion_size = state->display.lastwritten_bytes - new_portion_size;
+#ifdef HAVE_SPLICE
+	state->transfer.splice_used = false;
+#endif
+	state->transfer.written = 0;
 
-			/*
-			 * Make room for the new portion.
-			 */
-			if (old_portion_size > 0) {
-				memmove(state->display.lastwritten_buffer,
-					state->display.lastwritten_buffer + new_portion_size, old_portion_size);
-			}
+	check_read_fd = -1;
+	if ((!(*eof_in)) && (state->transfer.read_position < state->transfer.buffer_size))
+		check_read_fd = fd;
 
-			/*
-			 * Copy the new data in.
-			 */
-			memcpy(state->display.lastwritten_buffer +	/* flawfinder: ignore */
-			       old_portion_size,
-			       state->transfer.transfer_buffer + state->transfer.write_position - new_portion_size,
-			       new_portion_size);
-			/*
-			 * flawfinder rationale: calculations above ensure
-			 * that old_portion_size + new_portion_size is
-			 * always <= lastwritten_bytes, and
-			 * lastwritten_bytes is guaranteed by
-			 * pv__format_init() to be no more than
-			 * PV_SIZEOF_LASTWRITTEN_BUFFER, which is the size
-			 * of lastwritten_buffer, so the memcpy() will
-			 * always fit into the buffer.
-			 */
-		}
+	state->transfer.to_write = (ssize_t) (state->transfer.read_position - state->transfer.write_position);
+	if (line_mode) {
+		if (0 == pv__transfer_line_limit(state, allowed))
+			state->transfer.to_write = 0;
+	} else if (rate_limited && ((off_t) (state->transfer.to_write) > allowed)) {
+		state->transfer.to_write = (ssize_t) allowed;
+	}
 
-		/*
-		 * If we've written all the data in the buffer, reset the
-		 * read pointer to the start, and if the input file is at
-		 * EOF, set eof_out as well to indicate that we've written
-		 * everything for this input file.
-		 */
-		if (state->transfer.write_position >= state->transfer.read_position) {
-			state->transfer.write_position = 0;
-			state->transfer.read_position = 0;
-			if (*eof_in)
-				*eof_out = true;
-		}
+	check_write_fd = -1;
+	if ((!(*eof_out)) && (state->transfer.to_write > 0))
+		check_write_fd = state->control.output_fd;
 
-		return 1;
+	ready_to_read = false;
+	ready_to_write = false;
+	pv_elapsedtime_read(&wait_start);
+	n = pv_poller_wait(&(state->transfer), check_read_fd, &ready_to_read, check_write_fd, &ready_to_write,
+			   pv__transfer_wait_usec(state));
+	if ((check_read_fd >= 0) && (check_write_fd >= 0)) {
+		pv_latency_record(&(state->transfer), PV_LATENCY_WAIT_EITHER, &wait_start);
+	} else if (check_read_fd >= 0) {
+		pv_latency_record(&(state->transfer), PV_LATENCY_WAIT_INPUT, &wait_start);
+	} else if (check_write_fd >= 0) {
+		pv_latency_record(&(state->transfer), PV_LATENCY_WAIT_OUTPUT, &wait_start);
 	}
 
-	/*
-	 * If we reach this point, nwritten<=0, so there may be an error.
-	 */
+	if (n < 0)
+		return pv__transfer_wait_failed(state, fd, n);
 
-	/*
-	 * If a write error occurred but it was EINTR or EAGAIN, or write(2)
-	 * blocked on first write such that nwritten == 0, just wait a bit and
-	 * then return zero, since this was a transient error.
-	 */
-	if ((0 == nwritten) || (EINTR == write_errno) || (EAGAIN == write_errno)) {
-		if (0 == nwritten) {
-			debug("%s", "attempted write blocked - waiting briefly");
+	if (ready_to_read) {
+		pv_elapsedtime_read(&io_start);
+		profile_start = pv_profile_begin();
+		nread =
+		    pv__transfer_read_repeated(fd, state->transfer.transfer_buffer + state->transfer.read_position,
+					       state->transfer.buffer_size - state->transfer.read_position,
+					       MAX_READ_AT_ONCE);
+		pv_profile_end(PV_PROFILE_READ, profile_start);
+		pv_latency_record(&(state->transfer), PV_LATENCY_READ, &io_start);
+		pv_trace_record(&(state->transfer), PV_TRACE_READ, fd, (long long) nread, &io_start);
+
+		if (nread > 0) {
+			state->transfer.read_errors_in_a_row = 0;
+			state->transfer.read_position += nread;
+			state->transfer.total_bytes_read += nread;
+		} else if (0 == nread) {
+			pv__transfer_input_ended(state, eof_in, eof_out);
+		} else if ((EINTR == errno) || (EAGAIN == errno)) {
+			(void) is_data_ready(-1, NULL, -1, NULL, 10000);
+			return 0;
 		} else {
-			debug("%s: %s", "transient write error - waiting briefly", strerror(write_errno));
+			/* As in pv__transfer_read() when not skipping errors. */
+			state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+			state->transfer.read_errors_in_a_row++;
+			pv_error("%s: %s: %s", pv_current_file_name(state), _("read failed"), strerror(errno));
+			pv__transfer_input_ended(state, eof_in, eof_out);
 		}
-		(void) is_data_ready(-1, NULL, -1, NULL, 10000);
-		return 0;
 	}
 
-	/*
-	 * SIGPIPE means we've finished. Don't output an error because it's
-	 * not really our error to report.
-	 */
-	if (EPIPE == write_errno) {
-		*eof_in = true;
-		*eof_out = true;
-		state->flags.pipe_closed = 1;
-		debug("%s", "SIGPIPE received - setting pipe_closed");
-		return 0;
+	if (line_mode && (state->transfer.to_write > 0)) {
+		state->transfer.to_write =
+		    (ssize_t) pv__transfer_line_cut(state,
+						    (char *) (state->transfer.transfer_buffer +
+							      state->transfer.write_position),
+						    (size_t) (state->transfer.to_write), allowed);
 	}
 
-	pv_error("%s: %s", _("write failed"), strerror(write_errno));
-	state->status.exit_status |= PV_ERROREXIT_TRANSFER;
-	*eof_out = true;
-	state->transfer.written = -1;
+	if ((!ready_to_write) || (state->transfer.to_write <= 0) || (NULL == lineswritten))
+		return 0;
 
-	return 1;
+	if (state->transfer.output_pipe)
+		state->transfer.to_write =
+		    (ssize_t) pv__transfer_pipe_room(state->control.output_fd, (size_t) (state->transfer.to_write));
+
+	if (pv__transfer_write_can_block(state))
+		pv__transfer_write_timer(state, true);
+	pv_elapsedtime_read(&io_start);
+	profile_start = pv_profile_begin();
+	nwritten = pv__transfer_write_repeated(state->control.output_fd,
+					       state->transfer.transfer_buffer + state->transfer.write_position,
+					       (size_t) (state->transfer.to_write), MAX_WRITE_AT_ONCE, false,
+					       state->transfer.output_dontwait);
+	write_errno = (nwritten < 0) ? (int) errno : 0;
+	pv_profile_end(PV_PROFILE_WRITE, profile_start);
+	pv_latency_record(&(state->transfer), PV_LATENCY_WRITE, &io_start);
+	pv_trace_record(&(state->transfer), PV_TRACE_WRITE, state->control.output_fd, (long long) nwritten, &io_start);
+	if (pv__transfer_write_can_block(state))
+		pv__transfer_write_timer(state, false);
+
+	if (nwritten > 0) {
+		if (line_mode)
+			pv__transfer_track_written(state,
+						   state->transfer.transfer_buffer + state->transfer.write_position,
+						   (size_t) nwritten, lineswritten);
+		pv__transfer_wrote(state, nwritten, eof_in, eof_out);
+		pv__transfer_buffer_compact(state);
+		pv__transfer_engine_note(state, fd, PV_TRANSFER_ENGINE_READWRITE);
+		return nwritten;
+	}
+
+	return pv__transfer_write_failed(state, nwritten, write_errno, eof_in, eof_out) ? -1 : 0;
 }
 
 
 /*
- * Return a pointer to a newly allocated buffer of the given size, aligned
- * appropriately for the current input and output file descriptors
- * (important if using O_DIRECT).
- *
- * Falls back to unaligned allocation if it was not possible to get an
- * aligned buffer, or if the relevant operating system features were not
- * available.  With O_DIRECT, this means that transfers could fail with an
- * "Invalid argument" error (EINVAL).
- *
- * Returns NULL on complete allocation failure.
+ * The specialised loops, for a plain byte copy, a byte copy with a rate
+ * limit, and line mode, which pv__transfer_fast_dispatch() chooses
+ * between.
  */
-/*@null@*/
-/*@only@*/
-static char *pv__allocate_aligned_buffer(int outfd, int infd, size_t target_size)
+static ssize_t pv__transfer_fast_copy(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed,
+				      long *lineswritten)
 {
-	void *newptr;
-
-#if defined(HAVE_FPATHCONF) && defined(HAVE_POSIX_MEMALIGN) && defined(_PC_REC_XFER_ALIGN)
-	long input_alignment, output_alignment, min_alignment;
-	long required_alignment;
-
-	input_alignment = infd >= 0 ? fpathconf(infd, _PC_REC_XFER_ALIGN) : -1;
-	output_alignment = fpathconf(outfd, _PC_REC_XFER_ALIGN);
-#if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
-	min_alignment = sysconf(_SC_PAGESIZE);
-#else				/* ! defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE) */
-	min_alignment = 8192;
-#endif				/* defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE) */
+	return pv__transfer_fast(state, fd, eof_in, eof_out, allowed, lineswritten, false, false);
+}
 
-	if (input_alignment > output_alignment) {
-		required_alignment = input_alignment;
-	} else if (output_alignment > input_alignment) {
-		required_alignment = output_alignment;
-	} else if (input_alignment < min_alignment) {
-		required_alignment = min_alignment;
-	} else {
-		required_alignment = input_alignment;
-	}
+static ssize_t pv__transfer_fast_copy_limited(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed,
+					      long *lineswritten)
+{
+	return pv__transfer_fast(state, fd, eof_in, eof_out, allowed, lineswritten, true, false);
+}
 
-	/* Ensure the alignment is at least the page size. */
-	if (required_alignment < min_alignment) {
-		required_alignment = min_alignment;
-	}
+static ssize_t pv__transfer_fast_lines(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed,
+				       long *lineswritten)
+{
+	return pv__transfer_fast(state, fd, eof_in, eof_out, allowed, lineswritten, false, true);
+}
 
-	newptr = NULL;
 
-	/*@-unrecog@ */
-	/* splice doesn't know of posix_memalign(). */
-	if (0 != posix_memalign((void **) (&newptr), (size_t) required_alignment, target_size)) {
-		newptr = malloc(target_size);
-	}
-	/*@+unrecog@ */
-#else				/* ! defined(HAVE_FPATHCONF) && defined(HAVE_POSIX_MEMALIGN) && defined(_PC_REC_XFER_ALIGN) */
-	newptr = malloc(target_size);
-#endif				/* defined(HAVE_FPATHCONF) && defined(HAVE_POSIX_MEMALIGN) && defined(_PC_REC_XFER_ALIGN) */
+/*
+ * Hand the transfer to whichever specialised loop suits it.
+ */
+static ssize_t pv__transfer_fast_dispatch(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed,
+					  long *lineswritten)
+{
+	if (state->control.linemode)
+		return pv__transfer_fast_lines(state, fd, eof_in, eof_out, allowed, lineswritten);
+	if ((state->control.rate_limit > 0) || (allowed > 0))
+		return pv__transfer_fast_copy_limited(state, fd, eof_in, eof_out, allowed, lineswritten);
+	return pv__transfer_fast_copy(state, fd, eof_in, eof_out, allowed, lineswritten);
+}
 
-	/* Initialise the buffer with zeroes. */
-	if (NULL != newptr)
-		memset(newptr, 0, target_size);
 
-	return newptr;
-}
+/*
+ * The transfer engines, in the order pv_transfer() tries them.  Each one's
+ * "usable" function probes whether it can move the data from the given
+ * input to the output with the options in effect, setting itself up if it
+ * has to, and falling back for good if it never can; the first one that
+ * is usable is given the transfer.  The buffered engine at the end is
+ * always usable, and records for itself which way it moved the data.
+ */
+struct pvtransferengine_s {
+	pvtransferengine_t engine;
+	bool (*usable)(pvstate_t, int);
+	ssize_t (*transfer)(pvstate_t, int, bool *, bool *, off_t, long *);
+};
+
+static const struct pvtransferengine_s pv__transfer_engines[] = {
+	{ PV_TRANSFER_ENGINE_RESCUE, pv__transfer_rescue_usable, pv__transfer_rescue },
+#ifdef HAVE_PTHREAD
+	/* This takes the place of --pipeline and "--engine io_uring". */
+	{ PV_TRANSFER_ENGINE_DIRECT, pv__transfer_direct_active, pv__transfer_direct },
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+	{ PV_TRANSFER_ENGINE_IO_URING, pv__transfer_uring_active, pv__transfer_uring },
+#endif
+#ifdef HAVE_MMAP
+	{ PV_TRANSFER_ENGINE_MMAP, pv__transfer_mmap_active, pv__transfer_mmap },
+#endif
+	/* Plain copies that the engines above have turned down. */
+	{ PV_TRANSFER_ENGINE_NONE, pv__transfer_fast_usable, pv__transfer_fast_dispatch },
+	{ PV_TRANSFER_ENGINE_NONE, NULL, pv__transfer_buffered }
+};
 
 
 /*
@@ -1080,40 +3188,12 @@ static char *pv__allocate_aligned_buffer(int outfd, int infd, size_t target_size
  */
 ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed, long *lineswritten)
 {
-	bool ready_to_read, ready_to_write;
-	int check_read_fd, check_write_fd;
-	int n;
+	size_t idx;
+	bool trialling;
 
 	if (NULL == state)
 		return 0;
 
-#ifdef O_DIRECT
-	/*
-	 * Set or clear O_DIRECT on the input and output file descriptors,
-	 * if the setting has changed.
-	 */
-	if (state->control.direct_io_changed) {
-		if (!(*eof_in)) {
-			if (0 != fcntl(fd, F_SETFL, (state->control.direct_io ? O_DIRECT : 0) | fcntl(fd, F_GETFL))) {
-				/*@-compdef@ */
-				debug("%s: %s: %s", pv_current_file_name(state), "fcntl", strerror(errno));
-				/*@+compdef@ */
-				/* splint - see previous pv_current_file_name() calls. */
-			}
-		}
-		if (!(*eof_out)) {
-			if (0 != fcntl(state->control.output_fd, F_SETFL,
-				       (state->control.direct_io ? O_DIRECT : 0) |
-				       fcntl(state->control.output_fd, F_GETFL))) {
-				debug("%s: %s: %s",
-				      NULL == state->control.output_name ? "(null)" : state->control.output_name,
-				      "fcntl", strerror(errno));
-			}
-		}
-		state->control.direct_io_changed = false;
-	}
-#endif				/* O_DIRECT */
-
 	/*
 	 * Reinitialise the error skipping variables if the file descriptor
 	 * has changed since the last time we were called.
@@ -1130,7 +3210,8 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 	 */
 	if (NULL == state->transfer.transfer_buffer) {
 		state->transfer.transfer_buffer =
-		    pv__allocate_aligned_buffer(state->control.output_fd, fd, state->control.target_buffer_size + 32);
+		    pv_allocate_aligned_buffer(&(state->control), state->control.output_fd, fd,
+					       state->control.target_buffer_size + 32);
 		if (NULL == state->transfer.transfer_buffer) {
 			pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
 			state->status.exit_status |= PV_ERROREXIT_MEMORY;
@@ -1139,6 +3220,12 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 		state->transfer.buffer_size = state->control.target_buffer_size;
 	}
 
+	/*
+	 * With "-B auto", the buffer may be swapped for one of a different
+	 * size while it's empty.
+	 */
+	pv_buffer_adapt(state, fd);
+
 	/*
 	 * Reallocate the buffer if the buffer size has changed
 	 * mid-transfer.  We have to do this by allocating a new buffer,
@@ -1149,7 +3236,8 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 	if (state->transfer.buffer_size < state->control.target_buffer_size) {
 		char *newptr;
 		newptr =
-		    pv__allocate_aligned_buffer(state->control.output_fd, fd, state->control.target_buffer_size + 32);
+		    pv_allocate_aligned_buffer(&(state->control), state->control.output_fd, fd,
+					       state->control.target_buffer_size + 32);
 		if (NULL == newptr) {
 			/*
 			 * Reset target if realloc failed so we don't keep
@@ -1171,7 +3259,7 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 			 * definitely always smaller than the new buffer
 			 * size.
 			 */
-			free(state->transfer.transfer_buffer);
+			pv_free_aligned_buffer(state->transfer.transfer_buffer, state->transfer.buffer_size + 32);
 			state->transfer.transfer_buffer = newptr;
 			state->transfer.buffer_size = state->control.target_buffer_size;
 		}
@@ -1185,139 +3273,71 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 		return 0;
 	}
 
-	check_read_fd = -1;
-	check_write_fd = -1;
-
-	/*
-	 * If the input file is not at EOF and there's room in the buffer,
-	 * look for incoming data from it.
-	 */
-	if ((!(*eof_in)) && (state->transfer.read_position < state->transfer.buffer_size)) {
-		check_read_fd = fd;
-	}
-
-	/*
-	 * Work out how much we're allowed to write, based on the amount of
-	 * data left in the buffer.  If rate limiting is active or "allowed"
-	 * is >0, then this puts an upper limit on how much we're allowed to
-	 * write.
-	 */
-	state->transfer.to_write = (ssize_t) (state->transfer.read_position - state->transfer.write_position);
-	if ((state->control.rate_limit > 0) || (allowed > 0)) {
-		if ((off_t) (state->transfer.to_write) > allowed) {
-			state->transfer.to_write = (ssize_t) allowed;
-		}
-	}
-
 	/*
-	 * If we don't think we've finished writing and there's anything
-	 * we're allowed to write, look for the output becoming writable.
+	 * With "--engine auto", let the trial pick which of the engines
+	 * below it would rather use, and time the transfer while the trial
+	 * is running.
 	 */
-	if ((!(*eof_out)) && (state->transfer.to_write > 0)) {
-		check_write_fd = state->control.output_fd;
-	}
-
-	ready_to_read = false;
-	ready_to_write = false;
-	n = is_data_ready(check_read_fd, &ready_to_read, check_write_fd, &ready_to_write, 90000);
-
-	if (n < 0) {
-		/*
-		 * Ignore transient errors by returning 0 immediately.
-		 */
-		if (EINTR == errno) {
-			debug("%s %d: %s", "fd", fd, "early return 0 - is_data_ready < 0");
-			return 0;
-		}
-
-		/*
-		 * Any other error is a problem and we must report back.
-		 */
-		/*@-compdef@ */
-		pv_error("%s: %s: %d: %s", pv_current_file_name(state), _("select call failed"), n, strerror(errno));
-		/*@+compdef@ */
-		/* splint - see previous pv_current_file_name() calls. */
-
-		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
-
-		return -1;
-	}
-
-	state->transfer.written = 0;
+	trialling = pv_autoengine_select(state, fd);
 
 	/*
-	 * If there is data to read, try to read some in. Return early if
-	 * there was a transient read error.
-	 *
-	 * NB this can update state->transfer.written because of splice().
+	 * Hand over to the first engine in the table which can move data
+	 * from this input to the output with the options in effect.
 	 */
-	if (ready_to_read) {
-		if (pv__transfer_read(state, fd, eof_in, eof_out, allowed) == 0) {
-			debug("%s %d: %s (%s=%s, %s=%s, %s=%lu)", "fd", fd,
-			      "early return 0 - pv__transfer_read returned 0", "eof_in", eof_in ? "true" : "false",
-			      "eof_out", eof_out ? "true" : "false", "allowed", (unsigned long) allowed);
-			return 0;
-		}
+	for (idx = 0; idx < sizeof(pv__transfer_engines) / sizeof(pv__transfer_engines[0]); idx++) {
+		const struct pvtransferengine_s *engine = &(pv__transfer_engines[idx]);
+		long long started;
+		ssize_t result;
+
+		if ((NULL != engine->usable) && (!engine->usable(state, fd)))
+			continue;
+		if (PV_TRANSFER_ENGINE_NONE != engine->engine)
+			pv__transfer_engine_note(state, fd, engine->engine);
+		if (!trialling)
+			return engine->transfer(state, fd, eof_in, eof_out, allowed, lineswritten);
+		started = pv_elapsedtime_nsec();
+		result = engine->transfer(state, fd, eof_in, eof_out, allowed, lineswritten);
+		pv_autoengine_measured(state, pv_elapsedtime_nsec() - started, result);
+		return result;
 	}
 
-	/*
-	 * In line mode, only write up to and including the last newline,
-	 * so that we're writing output line-by-line.
-	 */
-	if ((state->transfer.to_write > 0) && (state->control.linemode) && !(state->control.null_terminated_lines)) {
-		char *start;
-		char *end;
-
-		start = (char *) (state->transfer.transfer_buffer + state->transfer.write_position);
-		end = pv_memrchr(start, (int) '\n', (size_t) (state->transfer.to_write));
-
-		if (NULL != end) {
-			state->transfer.to_write = (ssize_t) ((end - start) + 1);
-		}
-	}
+	return 0;
+}
 
-	/*
-	 * If there is data to write, and the output is ready to receive it,
-	 * and we didn't use splice() this time, write some data. 
-	 * Return early if there was a transient write error.
-	 */
-	if (ready_to_write
-#ifdef HAVE_SPLICE
-	    && (!state->transfer.splice_used)
-#endif				/* HAVE_SPLICE */
-	    && (state->transfer.read_position > state->transfer.write_position)
-	    && (state->transfer.to_write > 0)
-	    && (NULL != lineswritten)) {
-		if (pv__transfer_write(state, eof_in, eof_out, lineswritten) == 0) {
-			debug("%s %d: %s (%s=%s, %s=%s, %s=%lu)", "fd", fd,
-			      "early return 0 - pv__transfer_write returned 0", "eof_in", eof_in ? "true" : "false",
-			      "eof_out", eof_out ? "true" : "false", "lineswritten", (unsigned long) lineswritten);
-			return 0;
-		}
-	}
-#ifdef MAXIMISE_BUFFER_FILL
-	/*
-	 * Rotate the written bytes out of the buffer so that it can be
-	 * filled up completely by the next read.
-	 */
-	if (state->transfer.write_position > 0) {
-		if (state->transfer.write_position < state->transfer.read_position) {
-			memmove(state->transfer.transfer_buffer,
-				state->transfer.transfer_buffer +
-				state->transfer.write_position,
-				state->transfer.read_position - state->transfer.write_position);
-			state->transfer.read_position -= state->transfer.write_position;
-			state->transfer.write_position = 0;
-		} else {
-			state->transfer.write_position = 0;
-			state->transfer.read_position = 0;
-		}
-	}
-#endif				/* MAXIMISE_BUFFER_FILL */
 
-	if (0 == state->transfer.written) {
-		debug("%s %d: %s", "fd", fd, "end-of-function return 0 - transfer.written is zero");
+/*
+ * Write the list of engines that moved data during the transfer to the
+ * terminal, for "--stats".
+ */
+void pv_transfer_engines_show(pvstate_t state)
+{
+	char stats_buf[256];		 /* flawfinder: ignore */
+	char *engine_list;
+	size_t list_length;
+	unsigned int engine;
+	int stats_size;
+
+	/* flawfinder: made safe by use of pv_snprintf() and pv_strlcat() */
+
+	if (0 == state->transfer.engines_used)
+		return;
+
+	memset(stats_buf, 0, sizeof(stats_buf));
+	stats_size = pv_snprintf(stats_buf, sizeof(stats_buf), "%s =", _("I/O engines"));
+	if ((stats_size < 0) || (stats_size >= (int) (sizeof(stats_buf))))
+		return;
+
+	engine_list = stats_buf + stats_size;
+	list_length = sizeof(stats_buf) - (size_t) stats_size;
+
+	for (engine = PV_TRANSFER_ENGINE_NONE + 1; engine < PV_TRANSFER_ENGINES; engine++) {
+		if (0 == (state->transfer.engines_used & (1U << engine)))
+			continue;
+		(void) pv_strlcat(engine_list, engine_list[0] == '\0' ? " " : ", ", list_length);
+		(void) pv_strlcat(engine_list, pv__transfer_engine_names[engine], list_length);
 	}
+	(void) pv_strlcat(engine_list, "\n", list_length);
 
-	return state->transfer.written;
+	pv_tty_write(&(state->flags), stats_buf, strlen(stats_buf));	/* flawfinder: ignore */
+	/* flawfinder rationale: stats_buf is always terminated, per above. */
 }
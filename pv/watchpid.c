@@ -26,6 +26,17 @@
 #include <sys/types.h>
 #include <dirent.h>
 
+#if defined(HAVE_SYS_EVENT_H)
+#include <sys/event.h>
+#define PV_WATCHPID_KQUEUE 1
+#elif defined(__linux__)
+#include <poll.h>
+#include <sys/syscall.h>
+#ifdef SYS_pidfd_open
+#define PV_WATCHPID_PIDFD 1
+#endif
+#endif
+
 #ifdef __APPLE__
 #include <libproc.h>
 #include <sys/proc_info.h>
@@ -54,6 +65,21 @@
 
 #endif /* __APPLE__ */
 
+/* Initial length of a whole-PID info array, and of a fd listing. */
+#define PV_WATCHPID_MIN_ARRAY 16
+
+/* Most pidfds to wait on at once; any more are left to the next scan. */
+#define PV_WATCHPID_MAX_PIDFDS 64
+
+/*
+ * A file descriptor listed in a process, and whether it refers to a vnode
+ * (always true except on macOS, where sockets and pipes are listed too).
+ */
+struct pvwatchpid_listed_s {
+	int fd;
+	bool vnode;
+};
+
 /*@-type@*/
 /* splint has trouble with off_t and mode_t. */
 
@@ -72,7 +98,7 @@ static bool filesize(pvwatchfd_t info)
 
 		/*
 		 * Get the size of block devices by opening
-		 * them and seeking to the end.
+		 * them and asking the device.
 		 */
 		fd = open(info->file_fdpath, O_RDONLY);	/* flawfinder: ignore */
 		/*
@@ -82,7 +108,7 @@ static bool filesize(pvwatchfd_t info)
 		if (fd >= 0) {
 			/*
 			 * TOCTOU mitigation: check it's still a block
-			 * device before trying to seek to the end. 
+			 * device before asking it for its size.
 			 * Otherwise treat it as unreadable and set the size
 			 * to 0.
 			 */
@@ -90,7 +116,9 @@ static bool filesize(pvwatchfd_t info)
 			memset(&check_fd_sb, 0, sizeof(check_fd_sb));
 			info->size = 0;
 			if (0 == fstat(fd, &check_fd_sb) && S_ISBLK(check_fd_sb.st_mode)) {
-				info->size = lseek(fd, 0, SEEK_END);
+				info->size = pv_blkdev_size(fd);
+				if (info->size < 0)
+					info->size = 0;
 			}
 			(void) close(fd);
 		} else {
@@ -109,6 +137,24 @@ static bool filesize(pvwatchfd_t info)
 
 /*@+type@*/
 
+
+/*
+ * Replace info->file_fdpath with a copy of "path", returning false if it
+ * could not be allocated.
+ */
+static bool pv__watchfd_setpath(pvwatchfd_t info, const char *path)
+{
+	char *copy;
+
+	copy = strdup(path);
+	if (NULL == copy)
+		return false;
+	if (NULL != info->file_fdpath)
+		free(info->file_fdpath);
+	info->file_fdpath = copy;
+	return true;
+}
+
 #ifdef __APPLE__
 int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
 {
@@ -134,7 +180,12 @@ int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
 		return 3;
 	}
 
-	strlcpy(info->file_fdpath, vnodeInfo.pvip.vip_path, PV_SIZEOF_FILE_FDPATH);
+	if (!pv__watchfd_setpath(info, vnodeInfo.pvip.vip_path)) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		return 3;
+	}
+	info->vnode_ino = vnodeInfo.pvip.vip_vi.vi_stat.vst_ino;
+	info->vnode_dev = vnodeInfo.pvip.vip_vi.vi_stat.vst_dev;
 
 	info->size = 0;
 
@@ -179,6 +230,8 @@ int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
  */
 int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
 {
+	char target[PV_SIZEOF_FILE_FDPATH];	/* flawfinder: ignore - zeroed, bounded below */
+
 	if (NULL == state)
 		return -1;
 	if (NULL == info)
@@ -193,8 +246,8 @@ int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
 			   "/proc/%u/fdinfo/%d", info->watch_pid, info->watch_fd);
 	(void) pv_snprintf(info->file_fd, PV_SIZEOF_FILE_FD, "/proc/%u/fd/%d", info->watch_pid, info->watch_fd);
 
-	memset(info->file_fdpath, 0, PV_SIZEOF_FILE_FDPATH);
-	if (readlink(info->file_fd, info->file_fdpath, PV_SIZEOF_FILE_FDPATH - 1) < 0) {	/* flawfinder: ignore */
+	memset(target, 0, sizeof(target));
+	if (readlink(info->file_fd, target, sizeof(target) - 1) < 0) {	/* flawfinder: ignore */
 		/*
 		 * flawfinder: memset() has put \0 at the end already, and
 		 * we tell readlink() to use 1 byte less than the buffer
@@ -209,6 +262,11 @@ int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
 		return 2;
 	}
 
+	if (!pv__watchfd_setpath(info, target)) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		return 2;
+	}
+
 	if (!((0 == stat(info->file_fd, &(info->sb_fd)))
 	      && (0 == lstat(info->file_fd, &(info->sb_fd_link))))) {
 		if (!automatic)
@@ -234,22 +292,38 @@ int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
 #endif
 
 #ifdef __APPLE__
-bool pv_watchfd_changed(pvwatchfd_t info)
-{
-	return true;
-}
-#else
 /*
  * Return true if the given file descriptor has changed in some way since
- * we started looking at it (i.e. changed destination or permissions).
+ * we started looking at it (i.e. closed, or now open on another file).
  */
 bool pv_watchfd_changed(pvwatchfd_t info)
 {
-	struct stat sb_fd, sb_fd_link;
+	struct vnode_fdinfowithpath vnodeInfo = { };
+	int size;
 
 	if (NULL == info)
 		return false;
 
+	size = proc_pidfdinfo(info->watch_pid, (int32_t) info->watch_fd,
+			      PROC_PIDFDVNODEPATHINFO, &vnodeInfo, PROC_PIDFDVNODEPATHINFO_SIZE);
+	if (size != PROC_PIDFDVNODEPATHINFO_SIZE)
+		return true;
+
+	if ((vnodeInfo.pvip.vip_vi.vi_stat.vst_ino != info->vnode_ino)
+	    || (vnodeInfo.pvip.vip_vi.vi_stat.vst_dev != info->vnode_dev))
+		return true;
+
+	return false;
+}
+#else
+/*
+ * Return true if stat() and lstat() of the fd symlink show that it has
+ * changed destination or permissions since pv_watchfd_info() looked.
+ */
+static bool pv__watchfd_stat_changed(pvwatchfd_t info)
+{
+	struct stat sb_fd, sb_fd_link;
+
 	memset(&sb_fd, 0, sizeof(sb_fd));
 	memset(&sb_fd_link, 0, sizeof(sb_fd_link));
 
@@ -267,6 +341,119 @@ bool pv_watchfd_changed(pvwatchfd_t info)
 
 	return false;
 }
+
+
+/*
+ * Read the fdinfo of the given file descriptor, through a descriptor that
+ * is kept open on it between calls, so that each sample is a single
+ * pread() instead of an open(), a read(), a close(), a stat(), and an
+ * lstat().  On success, the position is put in "position", and "same" is
+ * set to true if the fdinfo shows the same inode, mount, and open flags as
+ * it did the first time, so that the stat() checks can be skipped.
+ *
+ * Kernels before Linux 5.14 don't list the inode, in which case "same" is
+ * always false.  Returns false if the fdinfo could not be read at all,
+ * such as when the fd has been closed.
+ */
+static bool pv__watchfd_fdinfo(pvwatchfd_t info, off_t *position, bool *same)
+{
+	char buffer[512];		 /* flawfinder: ignore - bounded, terminated below */
+	unsigned long long ino;
+	unsigned int flags;
+	int mnt_id;
+	bool got_pos, got_flags, got_mnt_id, got_ino;
+	long long pos_long;
+	ssize_t got;
+	char *line;
+
+	*same = false;
+
+	if (!info->fdinfo_open) {
+		info->fdinfo_fd = open(info->file_fdinfo, O_RDONLY);	/* flawfinder: ignore */
+		/* flawfinder: trusted location (/proc). */
+		if (info->fdinfo_fd < 0)
+			return false;
+		info->fdinfo_open = true;
+		info->fdinfo_baseline = false;
+	}
+
+	got = pread(info->fdinfo_fd, buffer, sizeof(buffer) - 1, 0);
+	if (got <= 0) {
+		(void) close(info->fdinfo_fd);
+		info->fdinfo_open = false;
+		return false;
+	}
+	buffer[got] = '\0';
+
+	pos_long = -1;
+	ino = 0;
+	flags = 0;
+	mnt_id = 0;
+	got_pos = false;
+	got_flags = false;
+	got_mnt_id = false;
+	got_ino = false;
+
+	for (line = buffer; NULL != line && '\0' != *line;) {
+		if (0 == strncmp(line, "pos:", 4)) {
+			got_pos = (1 == sscanf(line + 4, "%lld", &pos_long)) ? true : false;
+		} else if (0 == strncmp(line, "flags:", 6)) {
+			got_flags = (1 == sscanf(line + 6, "%o", &flags)) ? true : false;
+		} else if (0 == strncmp(line, "mnt_id:", 7)) {
+			got_mnt_id = (1 == sscanf(line + 7, "%d", &mnt_id)) ? true : false;
+		} else if (0 == strncmp(line, "ino:", 4)) {
+			got_ino = (1 == sscanf(line + 4, "%llu", &ino)) ? true : false;
+		}
+		line = strchr(line, '\n');
+		if (NULL != line)
+			line++;
+	}
+
+	if (!got_pos)
+		return false;
+
+	*position = (off_t) pos_long;
+
+	if (!(got_flags && got_mnt_id && got_ino))
+		return true;
+
+	/*
+	 * The first read comes straight after pv_watchfd_info() has done
+	 * its stat(), so if the inode matches, this is the same file.
+	 */
+	if (!info->fdinfo_baseline) {
+		if (ino != (unsigned long long) (info->sb_fd.st_ino))
+			return true;
+		info->fdinfo_ino = ino;
+		info->fdinfo_flags = flags;
+		info->fdinfo_mnt_id = mnt_id;
+		info->fdinfo_baseline = true;
+	}
+
+	if ((ino == info->fdinfo_ino) && (flags == info->fdinfo_flags) && (mnt_id == info->fdinfo_mnt_id))
+		*same = true;
+
+	return true;
+}
+
+
+/*
+ * Return true if the given file descriptor has changed in some way since
+ * we started looking at it (i.e. changed destination or permissions).
+ */
+bool pv_watchfd_changed(pvwatchfd_t info)
+{
+	off_t position;
+	bool same;
+
+	if (NULL == info)
+		return false;
+
+	if (pv__watchfd_fdinfo(info, &position, &same) && same)
+		return false;
+
+	return pv__watchfd_stat_changed(info);
+}
 #endif
 
 
@@ -279,36 +466,56 @@ off_t pv_watchfd_position(pvwatchfd_t info)
 	off_t position;
 #ifdef __APPLE__
 	struct vnode_fdinfowithpath vnodeInfo = { };
-	int32_t proc_fd = (int32_t) info->watch_fd;
+	int32_t proc_fd;
+	int size;
 
-	int size = proc_pidfdinfo(info->watch_pid, proc_fd,
-				  PROC_PIDFDVNODEPATHINFO, &vnodeInfo,
-				  PROC_PIDFDVNODEPATHINFO_SIZE);
+	if (NULL == info)
+		return -1;
+
+	proc_fd = (int32_t) info->watch_fd;
+	size = proc_pidfdinfo(info->watch_pid, proc_fd,
+			      PROC_PIDFDVNODEPATHINFO, &vnodeInfo, PROC_PIDFDVNODEPATHINFO_SIZE);
 	if (size != PROC_PIDFDVNODEPATHINFO_SIZE) {
 		return -1;
 	}
 
+	/* The same call tells us whether the fd is still on that file. */
+	if ((vnodeInfo.pvip.vip_vi.vi_stat.vst_ino != info->vnode_ino)
+	    || (vnodeInfo.pvip.vip_vi.vi_stat.vst_dev != info->vnode_dev))
+		return -1;
+
 	position = (off_t) vnodeInfo.pfi.fi_offset;
 #else
-	long long pos_long;
-	FILE *fptr;
+	bool same;
 
 	if (NULL == info)
 		return -1;
 
-	if (pv_watchfd_changed(info))
-		return -1;
+	position = -1;
+	if (!pv__watchfd_fdinfo(info, &position, &same)) {
+		long long pos_long;
+		FILE *fptr;
 
-	fptr = fopen(info->file_fdinfo, "r");	/* flawfinder: ignore */
-	/* flawfinder: trusted location (/proc). */
-	if (NULL == fptr)
+		/*
+		 * No descriptor could be kept open on the fdinfo file, so
+		 * fall back to opening it each time.
+		 */
+		if (pv__watchfd_stat_changed(info))
+			return -1;
+
+		fptr = fopen(info->file_fdinfo, "r");	/* flawfinder: ignore */
+		/* flawfinder: trusted location (/proc). */
+		if (NULL == fptr)
+			return -1;
+		pos_long = -1;
+		position = -1;
+		if (1 == fscanf(fptr, "pos: %lld", &pos_long)) {
+			position = (off_t) pos_long;
+		}
+		(void) fclose(fptr);
+	} else if (!same && pv__watchfd_stat_changed(info)) {
 		return -1;
-	pos_long = -1;
-	position = -1;
-	if (1 == fscanf(fptr, "pos: %lld", &pos_long)) {
-		position = (off_t) pos_long;
 	}
-	(void) fclose(fptr);
 #endif
 
 	/*
@@ -357,39 +564,46 @@ static int pidfds(pvstate_t state, unsigned int pid, struct proc_fdinfo **fds, i
  */
 
 /*
- * Extend the info array by one, returning false on error.
+ * Extend the info array of a watched item by at least "wanted" entries,
+ * which are marked as unused, returning false on error.
+ *
+ * For a whole-PID watch, the array at least doubles in size each time, so
+ * that a process which opens many file descriptors doesn't cost one
+ * realloc() for each of them.
  */
-static bool extend_info_array(int *array_length_ptr, pvwatchfd_t * info_array_ptr)
+static bool extend_info_array(struct pvwatcheditem_s *item, int wanted)
 {
-	int array_length = 0;
-	struct pvwatchfd_s *info_array = NULL;
+	int array_length, new_length, idx;
 	struct pvwatchfd_s *new_info_array;
 
-	array_length = *array_length_ptr;
-	info_array = *info_array_ptr;
+	array_length = item->array_length;
 
-	array_length++;
+	new_length = array_length + wanted;
+	if (-1 == item->fd) {
+		if (new_length < 2 * array_length)
+			new_length = 2 * array_length;
+		if (new_length < PV_WATCHPID_MIN_ARRAY)
+			new_length = PV_WATCHPID_MIN_ARRAY;
+	}
 
-	if (NULL == info_array) {
-		new_info_array = malloc(array_length * sizeof(*info_array));
-		if (NULL != new_info_array)
-			memset(new_info_array, 0, array_length * sizeof(*info_array));
+	if (NULL == item->info_array) {
+		new_info_array = malloc(new_length * sizeof(*new_info_array));
 	} else {
-		new_info_array = realloc(info_array, array_length * sizeof(*info_array));
-		if (NULL != new_info_array)
-			memset(&(new_info_array[array_length - 1]), 0, sizeof(*info_array));
+		new_info_array = realloc(item->info_array, new_length * sizeof(*new_info_array));
 	}
 
 	if (NULL == new_info_array) {
 		return false;
 	}
 
-	new_info_array[array_length - 1].unused = true;
+	memset(&(new_info_array[array_length]), 0, (new_length - array_length) * sizeof(*new_info_array));
+	for (idx = array_length; idx < new_length; idx++)
+		new_info_array[idx].unused = true;
 
-	debug("%s", "extended info array");
+	debug("%s: %d -> %d", "extended info array", array_length, new_length);
 
-	*info_array_ptr = new_info_array;
-	*array_length_ptr = array_length;
+	item->info_array = new_info_array;
+	item->array_length = new_length;
 	return true;
 }
 
@@ -408,7 +622,35 @@ void pv_reset_watchfd(pvwatchfd_t info)
 	pv_reset_calc(&(info->calc));
 	pv_reset_transfer(&(info->transfer));
 	pv_reset_flags(&(info->flags));
-	pv_reset_display(&(info->display));
+	if (NULL != info->display) {
+		pv_reset_display(info->display);
+		info->display->initial_offset = info->initial_offset;
+	}
+}
+
+
+/*
+ * Allocate the display state of the given watchfd info structure and set
+ * up its average rate window, if this hasn't been done already, ready for
+ * it to be shown for the first time.  Returns false on error.
+ */
+bool pv_watchfd_prepare_display(pvstate_t state, pvwatchfd_t info)
+{
+	if (NULL != info->display)
+		return true;
+
+	info->display = calloc(1, sizeof(*(info->display)));
+	if (NULL == info->display)
+		return false;
+
+	pv_reset_display(info->display);
+	info->display->initial_offset = info->initial_offset;
+	info->flags.reparse_display = 1;
+
+	/* Set the average rate window for this state. */
+	pv_update_calc_average_rate_window(&(info->calc), state->control.average_rate_window);
+
+	return true;
 }
 
 
@@ -421,24 +663,48 @@ void pv_freecontents_watchfd(pvwatchfd_t info)
 		return;
 	pv_freecontents_calc(&(info->calc));
 	pv_freecontents_transfer(&(info->transfer));
-	pv_freecontents_display(&(info->display));
+	if (NULL != info->display) {
+		pv_freecontents_display(info->display);
+		free(info->display);
+		info->display = NULL;
+	}
+	if (NULL != info->file_fdpath) {
+		free(info->file_fdpath);
+		info->file_fdpath = NULL;
+	}
+#ifndef __APPLE__
+	if (info->fdinfo_open) {
+		(void) close(info->fdinfo_fd);
+		info->fdinfo_open = false;
+	}
+#endif
 }
 
 
 /*
- * Comparison function for qsort, to compare two pvwatchfd_s structures.
+ * Comparison function for qsort, to compare two pvwatchfd_s structures;
+ * unused entries sort after all of the others.
  */
 static int pv_compare_watchfd(const void *a, const void *b)
 {
 	int fd_a, fd_b;
+	bool unused_a, unused_b;
 
 	fd_a = 0;
 	fd_b = 0;
-	if (NULL != a)
+	unused_a = false;
+	unused_b = false;
+	if (NULL != a) {
 		fd_a = ((pvwatchfd_t) a)->watch_fd;
-	if (NULL != b)
+		unused_a = ((pvwatchfd_t) a)->unused;
+	}
+	if (NULL != b) {
 		fd_b = ((pvwatchfd_t) b)->watch_fd;
+		unused_b = ((pvwatchfd_t) b)->unused;
+	}
 
+	if (unused_a != unused_b)
+		return unused_a ? 1 : -1;
 	if (fd_a < fd_b)
 		return -1;
 	if (fd_a > fd_b)
@@ -448,62 +714,102 @@ static int pv_compare_watchfd(const void *a, const void *b)
 
 
 /*
- * Scan the given process and update the arrays with any new file
- * descriptors.  If "watch_fd" is not -1, then all other file descriptor
- * numbers will be ignored,
+ * Comparison function for qsort, to compare two listed file descriptors.
+ */
+static int pv_compare_listedfd(const void *a, const void *b)
+{
+	int fd_a, fd_b;
+
+	fd_a = ((const struct pvwatchpid_listed_s *) a)->fd;
+	fd_b = ((const struct pvwatchpid_listed_s *) b)->fd;
+
+	if (fd_a < fd_b)
+		return -1;
+	if (fd_a > fd_b)
+		return 1;
+	return 0;
+}
+
+
+/*
+ * Append a file descriptor to the listing being built by pv__watchpid_list(),
+ * growing it as necessary; returns false on error.
+ */
+static bool pv__watchpid_list_add(struct pvwatchpid_listed_s **listed_ptr, int *count_ptr, int *size_ptr, int fd,
+				  bool vnode)
+{
+	if (*count_ptr >= *size_ptr) {
+		struct pvwatchpid_listed_s *new_listed;
+		int new_size;
+
+		new_size = *size_ptr < PV_WATCHPID_MIN_ARRAY ? PV_WATCHPID_MIN_ARRAY : 2 * *size_ptr;
+		new_listed = realloc(*listed_ptr, new_size * sizeof(*new_listed));
+		if (NULL == new_listed)
+			return false;
+		*listed_ptr = new_listed;
+		*size_ptr = new_size;
+	}
+
+	(*listed_ptr)[*count_ptr].fd = fd;
+	(*listed_ptr)[*count_ptr].vnode = vnode;
+	(*count_ptr)++;
+
+	return true;
+}
+
+
+/*
+ * List the open file descriptors of the given process, or just "watch_fd"
+ * if it is not -1, into a newly allocated array, in ascending order.
  *
  * Returns 0 on success, 1 if the process no longer exists or could not be
  * read, or 2 for a memory allocation error.
  */
-int pv_watchpid_scanfds(pvstate_t state, pid_t watch_pid, int watch_fd, int *array_length_ptr,
-			pvwatchfd_t * info_array_ptr)
+static int pv__watchpid_list(pvstate_t state, pid_t watch_pid, int watch_fd,
+			     /*@out@ */ struct pvwatchpid_listed_s **listed_ptr, /*@out@ */ int *count_ptr)
 {
-	int array_length = 0;
-	struct pvwatchfd_s *info_array = NULL;
-	bool changes_made;
+	struct pvwatchpid_listed_s *listed = NULL;
+	int count = 0, size = 0, previous_fd = -1;
+	bool in_order = true;
 
 #ifdef __APPLE__
 	struct proc_fdinfo *fd_infos = NULL;
 	int fd_infos_count = 0;
+	int i;
+
+	*listed_ptr = NULL;
+	*count_ptr = 0;
 
 	if (pidfds(state, watch_pid, &fd_infos, &fd_infos_count) != 0) {
 		pv_error("%s: pidfds failed", _("pid"));
-		return -1;
+		return 1;
 	}
+	if (fd_infos_count < 1) {
+		pv_error("%s: no fds found", _("pid"));
+		free(fd_infos);
+		return 1;
+	}
+	for (i = 0; i < fd_infos_count; i++) {
+		int fd = fd_infos[i].proc_fd;
+		bool vnode = (fd_infos[i].proc_fdtype == PROX_FDTYPE_VNODE) ? true : false;
 #else
 	char fd_dir[512];		 /* flawfinder: ignore - zeroed, bounded with pv_snprintf(). */
 	DIR *dptr;
 	struct dirent *d;
 
+	*listed_ptr = NULL;
+	*count_ptr = 0;
+
 	memset(fd_dir, 0, sizeof(fd_dir));
 	(void) pv_snprintf(fd_dir, sizeof(fd_dir), "/proc/%u/fd", watch_pid);
 
 	dptr = opendir(fd_dir);
 	if (NULL == dptr)
 		return 1;
-#endif
-
-	array_length = *array_length_ptr;
-	info_array = *info_array_ptr;
-
-	changes_made = false;
 
-#ifdef __APPLE__
-	if (fd_infos_count < 1) {
-		pv_error("%s: no fds found", _("pid"));
-		return -1;
-	}
-	for (int i = 0; i < fd_infos_count; i++) {
-#else
 	while ((d = readdir(dptr)) != NULL) {
-#endif
-		int fd, check_idx, found_idx, use_idx, rc;
-		off_t position_now;
-
-		fd = -1;
-#ifdef __APPLE__
-		fd = fd_infos[i].proc_fd;
-#else
+		int fd = -1;
+		bool vnode = true;
 		if (sscanf(d->d_name, "%d", &fd) != 1)
 			continue;
 #endif
@@ -516,96 +822,171 @@ int pv_watchpid_scanfds(pvstate_t state, pid_t watch_pid, int watch_fd, int *arr
 		if (watch_fd >= 0 && watch_fd != fd)
 			continue;
 
-		/*
-		 * Skip if this fd is already known to us.
-		 */
-		found_idx = -1;
-		for (check_idx = 0; check_idx < array_length && NULL != info_array; check_idx++) {
-			if (info_array[check_idx].unused)
+		if (!pv__watchpid_list_add(&listed, &count, &size, fd, vnode)) {
+			free(listed);
+#ifdef __APPLE__
+			free(fd_infos);
+#else
+			(void) closedir(dptr);
+#endif
+			return 2;
+		}
+
+		if (fd < previous_fd)
+			in_order = false;
+		previous_fd = fd;
+	}
+
+#ifdef __APPLE__
+	free(fd_infos);
+#else
+	(void) closedir(dptr);
+	/*@-noeffect@ */
+	(void) state;
+	/*@+noeffect@ */
+#endif
+
+	/* Both kernels usually list them in order already. */
+	if (!in_order && count > 1)
+		qsort(listed, (size_t) count, sizeof(listed[0]), pv_compare_listedfd);
+
+	*listed_ptr = listed;
+	*count_ptr = count;
+
+	return 0;
+}
+
+
+/*
+ * Scan the process of the given watched item and update its info array
+ * with any new file descriptors.  If the item's "fd" is not -1, then all
+ * other file descriptor numbers will be ignored,
+ *
+ * The in-use entries of the info array are kept in ascending order of file
+ * descriptor, so the fresh listing from the kernel, which is sorted too, is
+ * compared against it in a single pass, and only the file descriptors that
+ * are new since the last scan are looked up and added.
+ *
+ * Returns 0 on success, 1 if the process no longer exists or could not be
+ * read, or 2 for a memory allocation error.
+ */
+static int pv__watchpid_scanfds(pvstate_t state, struct pvwatcheditem_s *item)
+{
+	struct pvwatchpid_listed_s *listed = NULL;
+	int listed_count = 0, new_count, listed_idx, check_idx, use_idx, free_slots, rc;
+
+	rc = pv__watchpid_list(state, item->pid, item->fd, &listed, &listed_count);
+	if (0 != rc)
+		return rc;
+
+	/*
+	 * Walk the listing and the info array side by side, moving the
+	 * entries of the listing that aren't already known down to the
+	 * start of the listing, as the list of new file descriptors.
+	 */
+	new_count = 0;
+	free_slots = 0;
+	check_idx = 0;
+	for (listed_idx = 0; listed_idx < listed_count; listed_idx++) {
+		int fd = listed[listed_idx].fd;
+		bool known = false;
+
+		for (; NULL != item->info_array && check_idx < item->array_length; check_idx++) {
+			pvwatchfd_t info = &(item->info_array[check_idx]);
+			if (info->unused)
 				continue;
-			if (info_array[check_idx].watch_fd != fd)
+			if (info->watch_fd > fd)
+				break;
+			if (info->watch_fd < fd)
 				continue;
-			if (info_array[check_idx].closed) {
+			if (info->closed) {
 				/*
-				 * If the fd is known but closed,
-				 * immediately free it for re-use.
+				 * If the fd is known but closed, it has
+				 * been re-used, so immediately free the
+				 * old entry for re-use.
 				 */
-				info_array[check_idx].unused = true;
-				info_array[check_idx].displayable = false;
-				pv_freecontents_watchfd(&(info_array[check_idx]));
+				info->unused = true;
+				info->displayable = false;
+				pv_freecontents_watchfd(info);
 				continue;
 			}
-			found_idx = check_idx;
+			known = true;
+			check_idx++;
 			break;
 		}
-		if (found_idx >= 0)
-			continue;
 
-		/*
-		 * See if there's an empty slot we can re-use.
-		 */
-		use_idx = -1;
-		for (check_idx = 0; check_idx < array_length && NULL != info_array; check_idx++) {
-			if (info_array[check_idx].unused) {
-				use_idx = check_idx;
-				break;
-			}
-		}
+		if (!known)
+			listed[new_count++] = listed[listed_idx];
+	}
 
-		/*
-		 * If there's no empty slot, extend the array.
-		 */
-		if (use_idx < 0) {
-			if (!extend_info_array(array_length_ptr, info_array_ptr))
-				return 2;
-			array_length = *array_length_ptr;
-			info_array = *info_array_ptr;
-			use_idx = array_length - 1;
-		}
+	if (0 == new_count) {
+		free(listed);
+		return 0;
+	}
 
-		/* At this point, the array should exist. */
-		if (NULL == info_array)
+	/*
+	 * Make sure there are enough unused slots for all the new file
+	 * descriptors.
+	 */
+	for (check_idx = 0; NULL != item->info_array && check_idx < item->array_length; check_idx++) {
+		if (item->info_array[check_idx].unused)
+			free_slots++;
+	}
+	if (free_slots < new_count) {
+		if (!extend_info_array(item, new_count - free_slots)) {
+			free(listed);
 			return 2;
+		}
+	}
+
+	/* At this point, the array should exist. */
+	if (NULL == item->info_array) {
+		free(listed);
+		return 2;
+	}
+
+	use_idx = 0;
+	for (listed_idx = 0; listed_idx < new_count; listed_idx++) {
+		int fd = listed[listed_idx].fd;
+		off_t position_now;
+		pvwatchfd_t info;
+
+		/* Find the next unused slot. */
+		while (use_idx < item->array_length && !item->info_array[use_idx].unused)
+			use_idx++;
+		if (use_idx >= item->array_length)
+			break;
 
 		debug("%s: %d => index %d", "found new fd", fd, use_idx);
 
-		changes_made = true;
+		info = &(item->info_array[use_idx]);
 
 		/*
 		 * Initialise the details of this new entry.
 		 */
-		memset(&(info_array[use_idx]), 0, sizeof(info_array[use_idx]));
+		memset(info, 0, sizeof(*info));
 
-		pv_reset_watchfd(&(info_array[use_idx]));
-		info_array[use_idx].watch_pid = watch_pid;
-		info_array[use_idx].watch_fd = fd;
-		info_array[use_idx].closed = false;
-		info_array[use_idx].unused = false;
-		info_array[use_idx].displayable = true;
+		pv_reset_watchfd(info);
+		info->watch_pid = item->pid;
+		info->watch_fd = fd;
+		info->closed = false;
+		info->unused = false;
+		info->displayable = true;
 
-		/*
-		 * Set the average rate window so that a new history buffer
-		 * is allocated for this state.
-		 */
-		(void) pv_update_calc_average_rate_window(&(info_array[use_idx].calc),
-							  state->control.average_rate_window);
-
-#ifdef __APPLE__
-		if (fd_infos[i].proc_fdtype != PROX_FDTYPE_VNODE) {
+		if (!listed[listed_idx].vnode)
 			continue;
-		}
-#endif
+
 		/* Retrieve the details of this file descriptor. */
-		rc = pv_watchfd_info(state, &(info_array[use_idx]), -1 == watch_fd ? true : false);
+		rc = pv_watchfd_info(state, info, -1 == item->fd ? true : false);
 
 		/*
 		 * Lookup failed - mark this slot as being free for re-use.
 		 */
 		if ((rc != 0) && (rc != 4)) {
 			debug("%s %d: %s: %d", "fd", fd, "lookup failed - marking slot for re-use", use_idx);
-			pv_freecontents_watchfd(&(info_array[use_idx]));
-			info_array[use_idx].unused = true;
-			info_array[use_idx].displayable = false;
+			pv_freecontents_watchfd(info);
+			info->unused = true;
+			info->displayable = false;
 			continue;
 		}
 
@@ -615,47 +996,456 @@ int pv_watchpid_scanfds(pvstate_t state, pid_t watch_pid, int watch_fd, int *arr
 		 */
 		if (rc != 0) {
 			debug("%s %d: %s", "fd", fd, "marking as not displayable");
-			info_array[use_idx].displayable = false;
+			info->displayable = false;
 		}
 
 		/* Set the info display_name appropriately. */
-		pv_watchpid_setname(state, &(info_array[use_idx]));
+		pv_watchpid_setname(state, info);
 
 		/* Force the display to be re-parsed. */
-		info_array[use_idx].flags.reparse_display = 1;
+		info->flags.reparse_display = 1;
 
-		pv_elapsedtime_read(&(info_array[use_idx].start_time));
+		pv_elapsedtime_read(&(info->start_time));
 
 		/*
 		 * Set the starting position (and initial offset, for the
 		 * display), if known, so that ETA and so on are calculated
 		 * correctly.
 		 */
-		info_array[use_idx].display.initial_offset = 0;
-		info_array[use_idx].position = 0;
-		position_now = pv_watchfd_position(&(info_array[use_idx]));
+		info->initial_offset = 0;
+		info->position = 0;
+		position_now = pv_watchfd_position(info);
 		if (position_now >= 0) {
-			info_array[use_idx].display.initial_offset = position_now;
-			info_array[use_idx].position = position_now;
+			info->initial_offset = position_now;
+			info->position = position_now;
 		}
 	}
 
+	free(listed);
+
+	/*
+	 * Sort the array so that file descriptors are always displayed in
+	 * ascending numerical order, and so the next scan can compare
+	 * against it in one pass.
+	 */
+	if (item->array_length > 1)
+		qsort(item->info_array, (size_t) (item->array_length), sizeof(item->info_array[0]),
+		      pv_compare_watchfd);
+
+	return 0;
+}
+
+
+/*
+ * Scan the watched item's process as in pv__watchpid_scanfds(), timing the
+ * scan for "--self-profile".
+ */
+int pv_watchpid_scanfds(pvstate_t state, struct pvwatcheditem_s *item)
+{
+	uint64_t profile_start;
+	int result;
+
+	profile_start = pv_profile_begin();
+	result = pv__watchpid_scanfds(state, item);
+	pv_profile_end(PV_PROFILE_SCANFDS, profile_start);
+
+	return result;
+}
+
+
+/*
+ * Start watching for the exit of the process of the given item.  With
+ * "--tree", on systems with kqueue, also ask to be told when it forks or
+ * executes, so that its children are found straight away.
+ */
+static void pv__watchpid_notify_add(pvstate_t state, struct pvwatcheditem_s *item)
+{
+	item->pidfd = -1;
+	if (item->finished)
+		return;
+
+#ifdef PV_WATCHPID_KQUEUE
+	if (state->watchfd.exit_queue_fd >= 0) {
+		struct kevent change;
+		unsigned int fflags;
+
+		fflags = NOTE_EXIT;
+		if (state->watchfd.tree)
+			fflags |= NOTE_FORK | NOTE_EXEC;
+
+		/*
+		 * Adding the same PID a second time just replaces the first
+		 * registration.
+		 */
+		EV_SET(&change, (uintptr_t) (item->pid), EVFILT_PROC, EV_ADD | EV_CLEAR, fflags, 0, NULL);
+		if (kevent(state->watchfd.exit_queue_fd, &change, 1, NULL, 0, NULL) < 0)
+			debug("%s %u: %s", "pid", (unsigned int) (item->pid), strerror(errno));
+	}
+#elif defined(PV_WATCHPID_PIDFD)
+	/*@-noeffect@ */
+	(void) state;
+	/*@+noeffect@ */
+	item->pidfd = (int) syscall(SYS_pidfd_open, item->pid, 0);
+	if (item->pidfd < 0) {
+		debug("%s %u: %s: %s", "pid", (unsigned int) (item->pid), "pidfd_open", strerror(errno));
+		item->pidfd = -1;
+	}
+#else
+	/*@-noeffect@ */
+	(void) state;
+	/*@+noeffect@ */
+#endif
+}
+
+
+/*
+ * Start watching for the exit of the watched processes, so that
+ * pv_watchpid_notify_wait() can return as soon as one of them exits rather
+ * than the next time it would have looked anyway.
+ *
+ * Where there is no way to do this, pv_watchpid_notify_wait() just sleeps.
+ */
+void pv_watchpid_notify_init(pvstate_t state)
+{
+	unsigned int watch_idx;
+
+	state->watchfd.exit_queue_fd = -1;
+	if (NULL == state->watchfd.watching)
+		return;
+
+#ifdef PV_WATCHPID_KQUEUE
+	state->watchfd.exit_queue_fd = kqueue();
+	if (state->watchfd.exit_queue_fd < 0) {
+		debug("%s: %s", "kqueue", strerror(errno));
+		state->watchfd.exit_queue_fd = -1;
+		return;
+	}
+	(void) fcntl(state->watchfd.exit_queue_fd, F_SETFD, FD_CLOEXEC);
+#endif
+
+	for (watch_idx = 0; watch_idx < state->watchfd.count; watch_idx++)
+		pv__watchpid_notify_add(state, &(state->watchfd.watching[watch_idx]));
+}
+
+
+/*
+ * Wait for up to "nanoseconds", returning early with true if any of the
+ * watched processes exits in that time, in which case the items watching
+ * it are marked as finished - this also covers a process which has exited
+ * but not yet been reaped, whose fd list can still be read, but is empty.
+ */
+bool pv_watchpid_notify_wait(pvstate_t state, long long nanoseconds)
+{
+#ifdef PV_WATCHPID_KQUEUE
+	struct timespec timeout;
+	struct kevent event;
+	unsigned int watch_idx;
+
+	if (state->watchfd.exit_queue_fd >= 0) {
+		timeout.tv_sec = (time_t) (nanoseconds / 1000000000);
+		timeout.tv_nsec = (long) (nanoseconds % 1000000000);
+		if (kevent(state->watchfd.exit_queue_fd, NULL, 0, &event, 1, &timeout) < 1)
+			return false;
+		if (0 != (event.fflags & (NOTE_FORK | NOTE_EXEC))) {
+			debug("%s %u: %s", "pid", (unsigned int) (event.ident), "forked or executed");
+			state->watchfd.tree_changed = true;
+		}
+		if (0 == (event.fflags & NOTE_EXIT))
+			return false;
+		debug("%s %u: %s", "pid", (unsigned int) (event.ident), "exited");
+		for (watch_idx = 0; NULL != state->watchfd.watching && watch_idx < state->watchfd.count; watch_idx++) {
+			if ((uintptr_t) (state->watchfd.watching[watch_idx].pid) == event.ident)
+				state->watchfd.watching[watch_idx].finished = true;
+		}
+		return true;
+	}
+#elif defined(PV_WATCHPID_PIDFD)
+	struct pollfd pfd[PV_WATCHPID_MAX_PIDFDS];
+	unsigned int watch_idx, item_idx[PV_WATCHPID_MAX_PIDFDS];
+	int count, idx;
+	bool exited;
+
+	count = 0;
+	for (watch_idx = 0; NULL != state->watchfd.watching && watch_idx < state->watchfd.count; watch_idx++) {
+		if (state->watchfd.watching[watch_idx].pidfd < 0)
+			continue;
+		if (count >= PV_WATCHPID_MAX_PIDFDS)
+			break;
+		pfd[count].fd = state->watchfd.watching[watch_idx].pidfd;
+		pfd[count].events = POLLIN;
+		pfd[count].revents = 0;
+		item_idx[count] = watch_idx;
+		count++;
+	}
+
+	if (count > 0) {
+		if (poll(pfd, (nfds_t) count, (int) ((nanoseconds + 999999) / 1000000)) < 1)
+			return false;
+		/*
+		 * A pidfd stays readable once the process has exited, so
+		 * close it, to wait only on the others from now on.
+		 */
+		exited = false;
+		for (idx = 0; idx < count; idx++) {
+			if (0 == pfd[idx].revents)
+				continue;
+			debug("%s %u: %s", "pid", (unsigned int) (state->watchfd.watching[item_idx[idx]].pid),
+			      "exited");
+			(void) close(pfd[idx].fd);
+			state->watchfd.watching[item_idx[idx]].pidfd = -1;
+			state->watchfd.watching[item_idx[idx]].finished = true;
+			exited = true;
+		}
+		return exited;
+	}
+#endif
+
+	pv_nanosleep(nanoseconds);
+	return false;
+}
+
+
+/*
+ * Stop watching for the exit of the watched processes.
+ */
+void pv_watchpid_notify_free(pvstate_t state)
+{
+	unsigned int watch_idx;
+
+	if (state->watchfd.exit_queue_fd >= 0) {
+		(void) close(state->watchfd.exit_queue_fd);
+		state->watchfd.exit_queue_fd = -1;
+	}
+
+	for (watch_idx = 0; NULL != state->watchfd.watching && watch_idx < state->watchfd.count; watch_idx++) {
+		if (state->watchfd.watching[watch_idx].pidfd < 0)
+			continue;
+		(void) close(state->watchfd.watching[watch_idx].pidfd);
+		state->watchfd.watching[watch_idx].pidfd = -1;
+	}
+}
+
+
+/*
+ * List the child processes of "pid" into a newly allocated array, setting
+ * "count_ptr" to how many there are.  Returns false on error, including if
+ * the process has gone away.
+ *
+ * On Linux, this reads /proc/PID/task/TID/children for each thread, which
+ * needs CONFIG_PROC_CHILDREN; without it, no children are found.
+ */
+static bool pv__watchpid_children(pid_t pid, /*@out@ */ pid_t **children_ptr, /*@out@ */ int *count_ptr)
+{
+	pid_t *children = NULL;
+	int count = 0, size = 0;
+
+	*children_ptr = NULL;
+	*count_ptr = 0;
 
 #ifdef __APPLE__
-	free(fd_infos);
+	size = PV_WATCHPID_MIN_ARRAY;
+	while (true) {
+		pid_t *new_children;
+		int got;
+
+		new_children = realloc(children, size * sizeof(*children));
+		if (NULL == new_children) {
+			free(children);
+			return false;
+		}
+		children = new_children;
+
+		got = proc_listchildpids(pid, children, (int) (size * sizeof(*children)));
+		if (got < 0) {
+			free(children);
+			return false;
+		}
+		/* Try again with more room if the list may have been cut short. */
+		if (got >= size) {
+			size *= 2;
+			continue;
+		}
+		count = got;
+		break;
+	}
 #else
+	char task_dir[64];		 /* flawfinder: ignore - bounded with pv_snprintf() */
+	DIR *dptr;
+	struct dirent *d;
+
+	(void) pv_snprintf(task_dir, sizeof(task_dir), "/proc/%u/task", (unsigned int) pid);
+	dptr = opendir(task_dir);
+	if (NULL == dptr)
+		return false;
+
+	while ((d = readdir(dptr)) != NULL) {
+		char children_file[128];	/* flawfinder: ignore - bounded with pv_snprintf() */
+		unsigned long child;
+		FILE *fptr;
+
+		if ('.' == d->d_name[0])
+			continue;
+
+		(void) pv_snprintf(children_file, sizeof(children_file), "%s/%.20s/children", task_dir, d->d_name);
+		fptr = fopen(children_file, "r");	/* flawfinder: ignore */
+		/* flawfinder: trusted location (/proc). */
+		if (NULL == fptr)
+			continue;
+
+		while (1 == fscanf(fptr, "%lu", &child)) {
+			if (count >= size) {
+				pid_t *new_children;
+				size = size < PV_WATCHPID_MIN_ARRAY ? PV_WATCHPID_MIN_ARRAY : 2 * size;
+				new_children = realloc(children, size * sizeof(*children));
+				if (NULL == new_children) {
+					(void) fclose(fptr);
+					(void) closedir(dptr);
+					free(children);
+					return false;
+				}
+				children = new_children;
+			}
+			children[count++] = (pid_t) child;
+		}
+
+		(void) fclose(fptr);
+	}
+
 	(void) closedir(dptr);
 #endif
 
+	*children_ptr = children;
+	*count_ptr = count;
+	return true;
+}
+
+
+/*
+ * Add a watched item for the whole of process "pid", found by following
+ * the process tree, growing the watching array as needed.  Returns false
+ * on error.
+ */
+static bool pv__watchpid_tree_add(pvstate_t state, pid_t pid)
+{
+	struct pvwatcheditem_s *item;
+	int rc;
+
+	if (state->watchfd.count >= state->watchfd.allocated) {
+		struct pvwatcheditem_s *new_array;
+		unsigned int new_allocated;
+
+		new_allocated = state->watchfd.allocated < PV_WATCHPID_MIN_ARRAY ? PV_WATCHPID_MIN_ARRAY
+		    : 2 * state->watchfd.allocated;
+		new_array = realloc(state->watchfd.watching, new_allocated * sizeof(*new_array));
+		if (NULL == new_array)
+			return false;
+		memset(&(new_array[state->watchfd.allocated]), 0,
+		       (new_allocated - state->watchfd.allocated) * sizeof(*new_array));
+		state->watchfd.watching = new_array;
+		state->watchfd.allocated = new_allocated;
+	}
+
+	item = &(state->watchfd.watching[state->watchfd.count]);
+	memset(item, 0, sizeof(*item));
+	item->pid = pid;
+	item->fd = -1;
+	item->pidfd = -1;
+	item->from_tree = true;
+	state->watchfd.count++;
+
+	debug("%s: %u", "following child process", (unsigned int) pid);
+
+	pv__watchpid_notify_add(state, item);
+
+	rc = pv_watchpid_scanfds(state, item);
+	if (2 == rc)
+		return false;
+	if (0 != rc)
+		item->finished = true;
+
+	return true;
+}
+
+
+/*
+ * With "--tree", look for new child processes of every process being
+ * watched as a whole, adding each one as a new whole-process item, and
+ * drop the items of followed processes which have finished.  Their
+ * progress stays in the tree total, which is built up as positions are
+ * sampled elsewhere.
+ *
+ * Processes are found by listing the children of each one, since neither
+ * kernel reports new grandchildren to an unprivileged observer; on systems
+ * with kqueue, NOTE_FORK events make sure this is called soon after any
+ * watched process forks.
+ *
+ * Returns false on a memory allocation error.
+ */
+bool pv_watchpid_tree_scan(pvstate_t state)
+{
+	unsigned int watch_idx, check_idx, keep_idx;
+
+	state->watchfd.tree_changed = false;
+
+	if (!state->watchfd.tree || NULL == state->watchfd.watching)
+		return true;
+
 	/*
-	 * If any changes were made (i.e. new file descriptors were found),
-	 * sort the array so that file descriptors are always displayed in
-	 * ascending numerical order.
+	 * Newly added items are appended, so they are listed in turn too,
+	 * following the tree down as far as it goes.
 	 */
-	if (changes_made && NULL != info_array && array_length > 1)
-		qsort(info_array, (size_t) array_length, sizeof(info_array[0]), pv_compare_watchfd);
+	for (watch_idx = 0; watch_idx < state->watchfd.count; watch_idx++) {
+		pid_t *children = NULL;
+		int child_count = 0, child_idx;
 
-	return 0;
+		if (state->watchfd.watching[watch_idx].finished)
+			continue;
+		if (-1 != state->watchfd.watching[watch_idx].fd)
+			continue;
+
+		if (!pv__watchpid_children(state->watchfd.watching[watch_idx].pid, &children, &child_count))
+			continue;
+
+		for (child_idx = 0; child_idx < child_count; child_idx++) {
+			bool known = false;
+
+			for (check_idx = 0; check_idx < state->watchfd.count; check_idx++) {
+				if (state->watchfd.watching[check_idx].pid != children[child_idx])
+					continue;
+				known = true;
+				break;
+			}
+			if (known)
+				continue;
+
+			if (!pv__watchpid_tree_add(state, children[child_idx])) {
+				free(children);
+				return false;
+			}
+		}
+
+		free(children);
+	}
+
+	/* Drop the followed processes that have finished. */
+	for (watch_idx = 0, keep_idx = 0; watch_idx < state->watchfd.count; watch_idx++) {
+		struct pvwatcheditem_s *item = &(state->watchfd.watching[watch_idx]);
+
+		if (item->from_tree && item->finished) {
+			debug("%s: %u", "dropping finished child process", (unsigned int) (item->pid));
+			pv_freecontents_watchfd_items(item, 1);
+			if (item->pidfd >= 0)
+				(void) close(item->pidfd);
+			continue;
+		}
+
+		if (keep_idx != watch_idx)
+			state->watchfd.watching[keep_idx] = *item;
+		keep_idx++;
+	}
+	state->watchfd.count = keep_idx;
+
+	return true;
 }
 
 
@@ -673,20 +1463,20 @@ void pv_watchpid_setname(pvstate_t state, pvwatchfd_t info)
 {
 	size_t path_length, cwd_length;
 	int max_display_length;
-	char *file_fdpath;
+	const char *file_fdpath;
 
 	if (NULL == info)
 		return;
 
-	file_fdpath = info->file_fdpath;
+	file_fdpath = NULL == info->file_fdpath ? "" : info->file_fdpath;
 
 	memset(info->display_name, 0, PV_SIZEOF_DISPLAY_NAME);
 
-	path_length = strlen(info->file_fdpath);	/* flawfinder: ignore */
+	path_length = strlen(file_fdpath);	/* flawfinder: ignore */
 	cwd_length = strlen(state->status.cwd);	/* flawfinder: ignore */
 	/* flawfinder: both strings are always \0 terminated. */
 	if (cwd_length > 0 && path_length > cwd_length) {
-		if (0 == strncmp(info->file_fdpath, state->status.cwd, cwd_length)) {
+		if (0 == strncmp(file_fdpath, state->status.cwd, cwd_length)) {
 			file_fdpath += cwd_length + 1;
 			path_length -= cwd_length + 1;
 		}
@@ -0,0 +1,160 @@
+/*
+ * Functions for finding runs of zero bytes quickly, for sparse output.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define PV_ZEROSCAN_X86 1
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PV_ZEROSCAN_NEON 1
+#endif
+
+/*
+ * As with the line separator kernels, the best zero test for the CPU is
+ * chosen the first time it is needed.  Each kernel ORs whole vectors
+ * together and only looks at the result once per 64 bytes, so that a
+ * block of zeroes costs little more than the memory reads.
+ */
+typedef bool (*pvzeroscan_fn) (const unsigned char *, size_t);
+
+static bool pv__zeroscan_select(const unsigned char *, size_t);
+
+static pvzeroscan_fn pv__zeroscan_impl = pv__zeroscan_select;
+
+
+/*
+ * Portable word-at-a-time kernel.
+ */
+static bool pv__zeroscan_word(const unsigned char *buf, size_t length)
+{
+	size_t idx;
+
+	for (idx = 0; idx + 32 <= length; idx += 32) {
+		uint64_t words[4];
+		memcpy(words, buf + idx, sizeof(words));
+		if (0 != (words[0] | words[1] | words[2] | words[3]))
+			return false;
+	}
+	for (; idx < length; idx++) {
+		if (0 != buf[idx])
+			return false;
+	}
+
+	return true;
+}
+
+
+#ifdef PV_ZEROSCAN_X86
+static bool pv__zeroscan_sse2(const unsigned char *buf, size_t length)
+{
+	size_t idx;
+
+	for (idx = 0; idx + 64 <= length; idx += 64) {
+		__m128i acc = _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i *) (buf + idx)),
+							 _mm_loadu_si128((const __m128i *) (buf + idx + 16))),
+					   _mm_or_si128(_mm_loadu_si128((const __m128i *) (buf + idx + 32)),
+							_mm_loadu_si128((const __m128i *) (buf + idx + 48))));
+		if (0xffff != _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())))
+			return false;
+	}
+
+	return pv__zeroscan_word(buf + idx, length - idx);
+}
+
+__attribute__((target("avx2")))
+static bool pv__zeroscan_avx2(const unsigned char *buf, size_t length)
+{
+	size_t idx;
+
+	for (idx = 0; idx + 64 <= length; idx += 64) {
+		__m256i acc = _mm256_or_si256(_mm256_loadu_si256((const __m256i *) (buf + idx)),
+					      _mm256_loadu_si256((const __m256i *) (buf + idx + 32)));
+		if (!_mm256_testz_si256(acc, acc))
+			return false;
+	}
+
+	return pv__zeroscan_word(buf + idx, length - idx);
+}
+#endif				/* PV_ZEROSCAN_X86 */
+
+
+#ifdef PV_ZEROSCAN_NEON
+static bool pv__zeroscan_neon(const unsigned char *buf, size_t length)
+{
+	size_t idx;
+
+	for (idx = 0; idx + 64 <= length; idx += 64) {
+		uint8x16_t acc = vorrq_u8(vorrq_u8(vld1q_u8(buf + idx), vld1q_u8(buf + idx + 16)),
+					  vorrq_u8(vld1q_u8(buf + idx + 32), vld1q_u8(buf + idx + 48)));
+		if (0 != vmaxvq_u8(acc))
+			return false;
+	}
+
+	return pv__zeroscan_word(buf + idx, length - idx);
+}
+#endif				/* PV_ZEROSCAN_NEON */
+
+
+static bool pv__zeroscan_select(const unsigned char *buf, size_t length)
+{
+	pv__zeroscan_impl = pv__zeroscan_word;
+#ifdef PV_ZEROSCAN_X86
+	pv__zeroscan_impl = pv__zeroscan_sse2;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		pv__zeroscan_impl = pv__zeroscan_avx2;
+#endif
+#ifdef PV_ZEROSCAN_NEON
+	pv__zeroscan_impl = pv__zeroscan_neon;
+#endif
+	return pv__zeroscan_impl(buf, length);
+}
+
+
+/*
+ * Return true if all "length" bytes at "buf" are zero.
+ */
+bool pv_zeroscan_all(const char *buf, size_t length)
+{
+	if ((NULL == buf) || (0 == length))
+		return true;
+	return pv__zeroscan_impl((const unsigned char *) buf, length);
+}
+
+
+/*
+ * Return the length of the run of blocks at the start of the "length"
+ * bytes at "buf" which are all zero (if "zero" is true) or which each
+ * contain something other than zero (if "zero" is false), looking at it in
+ * blocks of "block_size" bytes.  The last block may be short.
+ */
+size_t pv_zeroscan_run(const char *buf, size_t length, size_t block_size, bool zero)
+{
+	size_t offset;
+
+	if (0 == block_size)
+		block_size = length;
+
+	for (offset = 0; offset < length; offset += block_size) {
+		size_t this_block = length - offset;
+		if (this_block > block_size)
+			this_block = block_size;
+		if (pv_zeroscan_all(buf + offset, this_block) != zero)
+			return offset;
+	}
+
+	return length;
+}